@@ -127,24 +127,20 @@ static void wstAVSyncTerm( VideoFrameManager *vfm )
 void *sync_free_frame( struct vframe *vf )
 {
    VideoFrameManager *vfm= (VideoFrameManager*)vf->private;
-   int i;
+   int i, count;
    FRAME("sync_free_frame: %p pts %d", vf, vf->pts);
-   for( i= 0; i < vfm->queueSize; ++i )
+   count= wstVideoFrameManagerCount( vfm );
+   for( i= 0; i < count; ++i )
    {
-      VideoFrame *fCheck= &vfm->queue[i];
+      VideoFrame *fCheck= wstVideoFrameManagerAt( vfm, i );
       if ( fCheck->vf == vf )
       {
          if ( fCheck->canExpire )
          {
             fCheck->vf= 0;
             vfm->dropFrameCount += 1;
-            wstFreeVideoFrameResources( fCheck );
-            wstVideoServerSendBufferRelease( vfm->conn, fCheck->bufferId );
-            if ( i+1 < vfm->queueSize )
-            {
-               memmove( &vfm->queue[i], &vfm->queue[i+1], (vfm->queueSize-i-1)*sizeof(VideoFrame) );
-            }
-            --vfm->queueSize;
+            wstVideoFrameManagerRelease( vfm, fCheck );
+            wstVideoFrameManagerRemove( vfm, i );
          }
          else
          {
@@ -229,10 +225,11 @@ static VideoFrame *wstAVSyncPop( VideoFrameManager *vfm )
       vf= av_sync_pop_frame( vfm->sync );
       if ( vf )
       {
-         int i;
-         for( i= 0; i < vfm->queueSize; ++i )
+         int i, count;
+         count= wstVideoFrameManagerCount( vfm );
+         for( i= 0; i < count; ++i )
          {
-            VideoFrame *fCheck= &vfm->queue[i];
+            VideoFrame *fCheck= wstVideoFrameManagerAt( vfm, i );
             if ( fCheck->vf == vf )
             {
                if ( i > 0 )
@@ -241,10 +238,9 @@ static VideoFrame *wstAVSyncPop( VideoFrameManager *vfm )
                   {
                      ERROR("bad sync pop: item %d", i);
                   }
-                  memmove( &vfm->queue[0], &vfm->queue[1], (vfm->queueSize-1)*sizeof(VideoFrame) );
-                  --vfm->queueSize;
+                  wstVideoFrameManagerRemove( vfm, 0 );
                }
-               f= &vfm->queue[0];
+               f= wstVideoFrameManagerAt( vfm, 0 );
                break;
             }
          }
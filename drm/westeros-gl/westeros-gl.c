@@ -25,9 +25,13 @@
 #include <memory.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/un.h>
 #include <linux/netlink.h>
@@ -120,6 +124,51 @@ typedef struct _VideoServerCtx VideoServerCtx;
 typedef struct _DisplayServerCtx DisplayServerCtx;
 typedef struct _WstOverlayPlane WstOverlayPlane;
 
+typedef struct _VideoFbKey
+{
+   ino_t ino0;
+   ino_t ino1;
+   uint32_t width;
+   uint32_t height;
+   uint32_t format;
+   uint32_t offsets[2];
+   uint32_t pitches[2];
+} VideoFbKey;
+
+typedef struct _VideoFbCacheEntry
+{
+   VideoFbKey key;
+   uint32_t fbId;
+   uint32_t handle0;
+   uint32_t handle1;
+   unsigned int lastUse;
+} VideoFbCacheEntry;
+
+#define VIDEO_FB_CACHE_SIZE (16)
+
+/*
+ * Importing a dmabuf that already has a GEM handle on the drm fd returns
+ * the same handle, so handles are counted per import and only closed
+ * when the last frame or cache entry holding one lets it go
+ */
+typedef struct _WstPrimeHandle
+{
+   uint32_t handle;
+   int refCount;
+} WstPrimeHandle;
+
+#define DEFAULT_FRM_DELAY (2000)
+
+/*
+ * Video server protocol.  Messages are 'V','S',len,id followed by len-1 bytes of body.
+ * A client that sends a 'V' version message of 2 or higher is answered with the server
+ * version and may then coalesce control updates with a frame in a single send.  Releases
+ * to a version 2 client are sent as one 'X' message holding a count and the buffer ids.
+ */
+#define VS_PROTOCOL_VERSION (2)
+#define VS_MSG_MAX (256)
+#define VS_FD_QUEUE_SIZE (4)
+
 typedef struct _VideoServerConnection
 {
    pthread_mutex_t mutex;
@@ -133,6 +182,16 @@ typedef struct _VideoServerConnection
    int zoomMode;
    int syncType;
    int sessionId;
+   int protocolVersion;
+   VideoFbCacheEntry *fbCache;
+   int fbCacheSize;
+   int fbCacheCount;
+   unsigned int fbCacheUse;
+   bool useThread;
+   unsigned char mbody[2*VS_MSG_MAX];
+   int mbodyLen;
+   int fdQueue[VS_FD_QUEUE_SIZE][3];
+   int fdQueueCount;
 } VideoServerConnection;
 
 typedef struct _DisplayServerConnection
@@ -140,9 +199,6 @@ typedef struct _DisplayServerConnection
    pthread_mutex_t mutex;
    DisplayServerCtx *server;
    int socketFd;
-   pthread_t threadId;
-   bool threadStarted;
-   bool threadStopRequested;
    int responseCode;
    int responseLen;
    char response[256+3];
@@ -158,23 +214,42 @@ typedef struct _WstServerCtx
    char lock[MAX_SUN_PATH+6];
    int lockFd;
    int socketFd;
+   int epollFd;
+   int stopFd;
    pthread_t threadId;
    bool threadStarted;
    bool threadStopRequested;
 } WstServerCtx;
 
-#define MAX_VIDEO_CONNECTIONS (4)
+/*
+ * Each server thread waits in epoll on its listening socket and on every
+ * connection it serves directly.  Display connections are always served
+ * this way.  Video connections get a thread each unless disabled, in which
+ * case they are served by the video server thread as well.  A stop request
+ * is signalled on an eventfd in the same set so the wait needs no timeout.
+ */
+#define SERVER_EPOLL_EVENTS (8)
+#define CONNECTION_TABLE_INITIAL_SIZE (4)
+
+#define DEFAULT_MAX_VIDEO_CONNECTIONS (16)
 typedef struct _VideoServerCtx
 {
    WstServerCtx *server;
-   VideoServerConnection* connections[MAX_VIDEO_CONNECTIONS];
+   bool useConnectionThreads;
+   int maxConnections;
+   int connectionCount;
+   int connectionCapacity;
+   VideoServerConnection **connections;
 } VideoServerCtx;
 
-#define MAX_DISPLAY_CONNECTIONS (4)
+#define DEFAULT_MAX_DISPLAY_CONNECTIONS (16)
 typedef struct _DisplayServerCtx
 {
    WstServerCtx *server;
-   DisplayServerConnection* connections[MAX_VIDEO_CONNECTIONS];
+   int maxConnections;
+   int connectionCount;
+   int connectionCapacity;
+   DisplayServerConnection **connections;
 } DisplayServerCtx;
 
 typedef struct _VideoFrame
@@ -183,6 +258,7 @@ typedef struct _VideoFrame
    bool hide;
    bool hidden;
    bool canExpire;
+   bool fbCached;
    uint32_t fbId;
    uint32_t handle0;
    uint32_t handle1;
@@ -204,13 +280,25 @@ typedef struct _VideoFrame
    void *vf;
 } VideoFrame;
 
-#define VFM_QUEUE_CAPACITY (16)
+/*
+ * Frames are queued in a fixed ring with a single producer (the video
+ * server connection thread) and a single consumer (the refresh thread).
+ * The producer only advances queueTail and the consumer only advances
+ * queueHead so pushing a frame never waits on the refresh thread.
+ * Capacity must be a power of two.
+ */
+#define VFM_QUEUE_CAPACITY (32)
+#define VFM_RELEASE_BATCH (16)
 typedef struct _VideoFrameManager
 {
    VideoServerConnection *conn;
-   int queueSize;
-   int queueCapacity;
-   VideoFrame *queue;
+   unsigned int queueHead;
+   unsigned int queueTail;
+   VideoFrame queue[VFM_QUEUE_CAPACITY];
+   int releaseCount;
+   VideoFrame release[VFM_RELEASE_BATCH];
+   int pushDropCount;
+   int pushDropCountSeen;
    bool paused;
    bool frameAdvance;
    long long vblankTime;
@@ -289,6 +377,23 @@ typedef struct _WstOverlayPlanes
    WstOverlayPlane *primary;
 } WstOverlayPlanes;
 
+typedef struct _WstBoFb
+{
+   int drmFd;
+   uint32_t fbId;
+   int width;
+   int height;
+   uint32_t format;
+} WstBoFb;
+
+#define PRESENT_HISTORY (8)
+typedef struct _WstPresentRecord
+{
+   unsigned int swapCount;
+   long long time;
+   unsigned int sequence;
+} WstPresentRecord;
+
 typedef struct _NativeWindowItem
 {
    struct _NativeWindowItem *next;
@@ -298,10 +403,13 @@ typedef struct _NativeWindowItem
    uint32_t fbId;
    struct gbm_bo *bo;
    struct gbm_bo *prevBo;
-   uint32_t prevFbId;
    int width;
    int height;
    bool dirty;
+   unsigned int swapCount;
+   unsigned int pendingSwapCount;
+   WstPresentRecord presented[PRESENT_HISTORY];
+   int presentedIndex;
    #ifdef USE_REFRESH_LOCK
    bool active;
    pthread_mutex_t mutexRefresh;
@@ -309,6 +417,33 @@ typedef struct _NativeWindowItem
    #endif
 } NativeWindowItem;
 
+#define COMMIT_HISTORY (8)
+#define COMMIT_GUARD (1000)
+#define DEFAULT_VRR_MIN_RATE (48)
+#define VRR_POLL_INTERVAL (1000)
+
+#define PLANE_LAYOUT_CACHE_SIZE (16)
+#define PLANE_LAYOUT_RETRY (120)
+#define PLANE_CANDIDATE_MAX (16)
+typedef struct _WstVideoPlacement
+{
+   WstOverlayPlane *overlay;
+   uint32_t sx, sy, sw, sh;
+   uint32_t dx, dy, dw, dh;
+} WstVideoPlacement;
+
+typedef struct _WstPlaneLayout
+{
+   WstOverlayPlane *overlay;
+   int modeWidth;
+   int modeHeight;
+   int modeRefresh;
+   uint32_t format;
+   bool scaled;
+   uint32_t planeId;
+   int retry;
+} WstPlaneLayout;
+
 typedef struct _WstGLCtx
 {
    pthread_mutex_t mutex;
@@ -346,6 +481,7 @@ typedef struct _WstGLCtx
    NativeWindowItem *nwLast;
    EGLDisplay dpy;
    int flipPending;
+   unsigned int swapCount;
    #ifdef DRM_USE_NATIVE_FENCE
    EGLSyncKHR fenceSync;
    #endif
@@ -358,11 +494,49 @@ typedef struct _WstGLCtx
    bool dirty;
    bool forceDirty;
    bool useVBlank;
+   long long lastVBlankTime;
+   long long lastVBlankInterval;
+   unsigned int lastVBlankSequence;
+   bool useFlipEvents;
+   bool flipEventLoop;
+   bool vblankEventPending;
+   long long commitDuration[COMMIT_HISTORY];
+   bool vrrCapable;
+   bool vrrRequested;
+   bool vrrEnabled;
+   int vrrMinRate;
+   long long vrrLastCheckTime;
+   int commitDurationIndex;
    pthread_t refreshThreadId;
    bool refreshThreadStarted;
    bool refreshThreadStopRequested;
    bool autoFRMModeEnabled;
+   int frmDelay;
+   int frmRateNum;
+   int frmRateDenom;
+   long long frmRequestTime;
+   bool frmRequestPending;
+   bool frmModeActive;
+   drmModeModeInfo frmModeOriginal;
+   drmModeModeInfo frmModeSelected;
    int zoomMode;
+   int maxVideoConnections;
+   int maxDisplayConnections;
+   bool useVideoConnectionThreads;
+   int videoFbCacheSize;
+   unsigned int videoFbCacheHits;
+   unsigned int videoFbCacheMisses;
+   unsigned int videoFbCacheEvictions;
+   WstPrimeHandle *primeHandles;
+   int primeHandleCount;
+   int primeHandleCapacity;
+   bool usePlaneTest;
+   WstPlaneLayout planeLayouts[PLANE_LAYOUT_CACHE_SIZE];
+   int planeLayoutCount;
+   int planeLayoutNext;
+   unsigned int planeLayoutHits;
+   unsigned int planeLayoutTests;
+   unsigned int planeLayoutTestFailures;
 } WstGLCtx;
 
 typedef struct _WstGLSizeCBInfo
@@ -381,25 +555,47 @@ static VideoFrameManager *wstCreateVideoFrameManager( VideoServerConnection *con
 static void wstDestroyVideoFrameManager( VideoFrameManager *vfm );
 static void wstVideoFrameManagerSetSyncType( VideoFrameManager *vfm, int type );
 static void wstVideoFrameManagerUpdateRect( VideoFrameManager *vfm, int rectX, int rectY, int rectW, int rectH );
+static int wstVideoFrameManagerCount( VideoFrameManager *vfm );
+static VideoFrame* wstVideoFrameManagerAt( VideoFrameManager *vfm, int i );
+static void wstVideoFrameManagerRemove( VideoFrameManager *vfm, int i );
+static void wstVideoFrameManagerRelease( VideoFrameManager *vfm, VideoFrame *f );
+static void wstVideoFrameManagerFlushReleases( VideoFrameManager *vfm );
 static void wstVideoFrameManagerPushFrame( VideoFrameManager *vfm, VideoFrame *f );
 static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm );
+static long long wstVideoFrameManagerNextFlipTime( VideoFrameManager *vfm );
 static void wstVideoFrameManagerPause( VideoFrameManager *vfm, bool pause );
 static void wstVideoFrameManagerFrameAdvance( VideoFrameManager *vfm );
 static void wstDestroyVideoServerConnection( VideoServerConnection *conn );
 static void wstDestroyDisplayServerConnection( DisplayServerConnection *conn );
+static bool wstVideoServerConnectionOpen( VideoServerConnection *conn );
+static bool wstVideoServerConnectionRead( VideoServerConnection *conn );
+static void wstVideoServerConnectionClose( VideoServerConnection *conn );
+static void wstVideoServerRemoveConnection( VideoServerCtx *server, VideoServerConnection *conn );
+static int wstServiceServerAccept( WstServerCtx *server );
+static bool wstServiceServerWatch( WstServerCtx *server, int fd, void *ptr );
+static void wstServiceServerUnwatch( WstServerCtx *server, int fd );
+static void wstReleaseVideoFb( WstGLCtx *ctx, uint32_t fbId, uint32_t handle0, uint32_t handle1, bool cached, int line );
+
 static void wstSetVideoFrameRect( VideoFrame *vf, int rectX, int rectY, int rectW, int rectH, uint32_t *skipX, uint32_t *skipY );
 static void wstFreeVideoFrameResources( VideoFrame *f );
+static void wstVideoServerSendVersion( VideoServerConnection *conn, int version );
 static void wstVideoServerSendBufferRelease( VideoServerConnection *conn, int bufferId );
+static void wstVideoServerSendBufferReleases( VideoServerConnection *conn, int *bufferIds, int count );
 static void wstVideoServerSendStatus( VideoServerConnection *conn, VideoFrameManager *vfm );
 static void wstVideoServerSendUnderflow( VideoServerConnection *conn, VideoFrameManager *vfm );
 static void wstVideoServerSendZoomMode( VideoServerConnection *conn, int zoomMode );
 static void wstTermCtx( WstGLCtx *ctx );
 static void wstUpdateCtx( WstGLCtx *ctx );
 static void wstSelectMode( WstGLCtx *ctx, int width, int height );
-static void wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom );
+static bool wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom );
+static void wstRequestFrameRate( WstGLCtx *ctx, int rateNum, int rateDenom );
+static void wstUpdateFrameRateMatching( WstGLCtx *ctx );
 static void wstStartRefreshThread( WstGLCtx *ctx );
+static void wstBoFbDestroy( struct gbm_bo *bo, void *userData );
+static uint32_t wstBoGetFb( WstGLCtx *ctx, struct gbm_bo *bo, int width, int height, bool useModifiers );
 static void wstSwapDRMBuffers( WstGLCtx *ctx );
 static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx );
+static void wstPlaneLayoutForget( WstGLCtx *ctx, WstOverlayPlane *overlay );
 
 static PFNEGLGETPLATFORMDISPLAYEXTPROC gRealEGLGetPlatformDisplay= 0;
 static PREALEGLGETDISPLAY gRealEGLGetDisplay= 0;
@@ -447,6 +643,7 @@ typedef struct _WstResources
 } WstResources;
 static pthread_mutex_t resMutex= PTHREAD_MUTEX_INITIALIZER;
 static WstResources *gResources= 0;
+static pthread_mutex_t gPrimeHandleMutex= PTHREAD_MUTEX_INITIALIZER;
 
 #ifdef USE_AMLOGIC_MESON
 #include "avsync/aml-meson/avsync.c"
@@ -560,6 +757,225 @@ static void avProgTerm()
    }
 }
 
+/*
+ * Event trace.  Each thread records fixed size binary events into its own ring
+ * so recording needs no lock and no formatting.  Rings outlive their threads
+ * and are reused by new threads.  The display server command "trace dump"
+ * writes all rings as Chrome trace event JSON to westeros-trace-<pid>.json in
+ * XDG_RUNTIME_DIR.  Clients don't get to choose the file.
+ */
+#define TRACE_RING_SIZE (2048)
+#define TRACE_RING_MAX (16)
+#define TRACE_PATH_MAX (200)
+
+enum
+{
+   TRACE_VIDEO_FRAME= 0,
+   TRACE_VIDEO_FLUSH,
+   TRACE_VIDEO_RELEASE,
+   TRACE_VFM_PUSH,
+   TRACE_VFM_DROP,
+   TRACE_VFM_FLIP,
+   TRACE_COMMIT,
+   TRACE_FLIP_EVENT,
+   TRACE_VBLANK_EVENT,
+   TRACE_REFRESH,
+   TRACE_ID_COUNT
+};
+
+typedef struct _WstTraceInfo
+{
+   const char *name;
+   const char *arg0;
+   const char *arg1;
+   const char *arg2;
+} WstTraceInfo;
+
+static const WstTraceInfo gTraceInfo[TRACE_ID_COUNT]=
+{
+   { "video-frame", "frame", "buffer", "frameTime" },
+   { "video-flush", "plane", 0, 0 },
+   { "video-release", "buffer", "count", 0 },
+   { "vfm-push", "frame", "buffer", "frameTime" },
+   { "vfm-drop", "frame", "buffer", "frameTime" },
+   { "vfm-flip", "frame", "buffer", "frameTime" },
+   { "commit", "frame", "buffer", "frameTime" },
+   { "flip-event", "sequence", 0, "time" },
+   { "vblank-event", "sequence", 0, "time" },
+   { "refresh", 0, 0, "vblankTime" }
+};
+
+typedef struct _WstTraceEvent
+{
+   long long timeMicros;
+   long long a2;
+   int id;
+   int tid;
+   int a0;
+   int a1;
+} WstTraceEvent;
+
+typedef struct _WstTraceRing
+{
+   struct _WstTraceRing *next;
+   bool inUse;
+   unsigned int head;
+   WstTraceEvent events[TRACE_RING_SIZE];
+} WstTraceRing;
+
+static pthread_mutex_t gTraceMutex= PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t gTraceOnce= PTHREAD_ONCE_INIT;
+static pthread_key_t gTraceKey;
+static WstTraceRing *gTraceRings= 0;
+static int gTraceRingCount= 0;
+static bool gTraceEnabled= true;
+
+static void wstTraceReleaseRing( void *arg )
+{
+   WstTraceRing *ring= (WstTraceRing*)arg;
+
+   pthread_mutex_lock( &gTraceMutex );
+   ring->inUse= false;
+   pthread_mutex_unlock( &gTraceMutex );
+}
+
+static void wstTraceInitKey( void )
+{
+   pthread_key_create( &gTraceKey, wstTraceReleaseRing );
+}
+
+static WstTraceRing *wstTraceGetRing( void )
+{
+   WstTraceRing *ring;
+
+   pthread_once( &gTraceOnce, wstTraceInitKey );
+
+   ring= (WstTraceRing*)pthread_getspecific( gTraceKey );
+   if ( !ring )
+   {
+      pthread_mutex_lock( &gTraceMutex );
+      for( ring= gTraceRings; ring; ring= ring->next )
+      {
+         if ( !ring->inUse )
+         {
+            break;
+         }
+      }
+      if ( !ring && (gTraceRingCount < TRACE_RING_MAX) )
+      {
+         ring= (WstTraceRing*)calloc( 1, sizeof(WstTraceRing) );
+         if ( ring )
+         {
+            ring->next= gTraceRings;
+            gTraceRings= ring;
+            ++gTraceRingCount;
+         }
+      }
+      if ( ring )
+      {
+         ring->inUse= true;
+      }
+      pthread_mutex_unlock( &gTraceMutex );
+
+      if ( ring )
+      {
+         pthread_setspecific( gTraceKey, ring );
+      }
+   }
+
+   return ring;
+}
+
+static void wstTrace( int id, int a0, int a1, long long a2 )
+{
+   if ( gTraceEnabled )
+   {
+      WstTraceRing *ring= wstTraceGetRing();
+      if ( ring )
+      {
+         unsigned int head= ring->head;
+         WstTraceEvent *e= &ring->events[head & (TRACE_RING_SIZE-1)];
+
+         e->timeMicros= getMonotonicTimeMicros();
+         e->a2= a2;
+         e->id= id;
+         e->tid= (int)syscall( SYS_gettid );
+         e->a0= a0;
+         e->a1= a1;
+
+         __atomic_store_n( &ring->head, head+1, __ATOMIC_RELEASE );
+      }
+   }
+}
+
+static bool wstTraceDump( const char *path, int *eventCount )
+{
+   bool result= false;
+   WstTraceRing *ring;
+   FILE *f= 0;
+   int pid= (int)getpid();
+   int count= 0;
+
+   f= fopen( path, "wt" );
+   if ( !f )
+   {
+      ERROR("wstTraceDump: unable to open (%s): errno %d", path, errno);
+      goto exit;
+   }
+
+   /* Events written while dumping may be torn: acceptable for diagnostics */
+   fprintf( f, "{\"traceEvents\":[" );
+   pthread_mutex_lock( &gTraceMutex );
+   for( ring= gTraceRings; ring; ring= ring->next )
+   {
+      unsigned int head, n;
+
+      head= __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+      n= ((head > TRACE_RING_SIZE) ? head-TRACE_RING_SIZE : 0);
+      for( ; n != head; ++n )
+      {
+         WstTraceEvent *e= &ring->events[n & (TRACE_RING_SIZE-1)];
+         const WstTraceInfo *info;
+         const char *sep;
+
+         if ( (e->id < 0) || (e->id >= TRACE_ID_COUNT) )
+         {
+            continue;
+         }
+         info= &gTraceInfo[e->id];
+         fprintf( f, "%s\n{\"name\":\"%s\",\"cat\":\"westeros-gl\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{",
+                  (count ? "," : ""), info->name, e->timeMicros, pid, e->tid );
+         sep= "";
+         if ( info->arg0 )
+         {
+            fprintf( f, "\"%s\":%d", info->arg0, e->a0 );
+            sep= ",";
+         }
+         if ( info->arg1 )
+         {
+            fprintf( f, "%s\"%s\":%d", sep, info->arg1, e->a1 );
+            sep= ",";
+         }
+         if ( info->arg2 )
+         {
+            fprintf( f, "%s\"%s\":%lld", sep, info->arg2, e->a2 );
+         }
+         fprintf( f, "}}" );
+         ++count;
+      }
+   }
+   pthread_mutex_unlock( &gTraceMutex );
+   fprintf( f, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+
+   fclose( f );
+
+   *eventCount= count;
+   result= true;
+
+exit:
+   return result;
+}
+
 static void wstUpdateResources( int type, bool add, long long v, int line )
 {
    pthread_mutex_lock( &resMutex );
@@ -829,6 +1245,105 @@ static void wstOverlayFree( WstOverlayPlanes *planes, WstOverlayPlane *overlay )
    }
 }
 
+static WstOverlayPlane *wstOverlayFindUnused( WstOverlayPlanes *planes, uint32_t planeId )
+{
+   WstOverlayPlane *overlay= planes->availHead;
+
+   while( overlay )
+   {
+      if ( overlay->plane->plane_id == planeId )
+      {
+         break;
+      }
+      overlay= overlay->next;
+   }
+
+   return overlay;
+}
+
+static bool wstOverlaySupportsFormat( WstOverlayPlane *overlay, uint32_t format )
+{
+   bool supported= (overlay->formatCount == 0);
+   int i;
+
+   for( i= 0; i < overlay->formatCount; ++i )
+   {
+      if ( overlay->formats[i].format == format )
+      {
+         supported= true;
+         break;
+      }
+   }
+
+   return supported;
+}
+
+/*
+ * Exchange the drm plane backing an in-use overlay with that of an unused
+ * overlay.  Frame state stays with the in-use overlay so its connection is
+ * unaffected.  Caller must hold gCtx->mutex.
+ */
+static void wstOverlaySwapHardware( WstOverlayPlanes *planes, WstOverlayPlane *used, WstOverlayPlane *unused )
+{
+   drmModePlane *plane;
+   drmModeObjectProperties *planeProps;
+   drmModePropertyRes **planePropRes;
+   WstFormatInfo *formats;
+   int formatCount, zOrder;
+   bool supportsVideo, supportsGraphics, frameRateMatchingPlane;
+
+   if ( unused->next )
+   {
+      unused->next->prev= unused->prev;
+   }
+   else
+   {
+      planes->availTail= unused->prev;
+   }
+   if ( unused->prev )
+   {
+      unused->prev->next= unused->next;
+   }
+   else
+   {
+      planes->availHead= unused->next;
+   }
+
+   plane= used->plane;
+   planeProps= used->planeProps;
+   planePropRes= used->planePropRes;
+   formats= used->formats;
+   formatCount= used->formatCount;
+   zOrder= used->zOrder;
+   supportsVideo= used->supportsVideo;
+   supportsGraphics= used->supportsGraphics;
+   frameRateMatchingPlane= used->frameRateMatchingPlane;
+
+   used->plane= unused->plane;
+   used->planeProps= unused->planeProps;
+   used->planePropRes= unused->planePropRes;
+   used->formats= unused->formats;
+   used->formatCount= unused->formatCount;
+   used->zOrder= unused->zOrder;
+   used->supportsVideo= unused->supportsVideo;
+   used->supportsGraphics= unused->supportsGraphics;
+   used->frameRateMatchingPlane= unused->frameRateMatchingPlane;
+
+   unused->plane= plane;
+   unused->planeProps= planeProps;
+   unused->planePropRes= planePropRes;
+   unused->formats= formats;
+   unused->formatCount= formatCount;
+   unused->zOrder= zOrder;
+   unused->supportsVideo= supportsVideo;
+   unused->supportsGraphics= supportsGraphics;
+   unused->frameRateMatchingPlane= frameRateMatchingPlane;
+
+   unused->next= 0;
+   unused->prev= 0;
+   wstOverlayAppendUnused( planes, unused );
+}
+
 static int wstPutU32( unsigned char *p, unsigned n )
 {
    p[0]= (n>>24);
@@ -878,37 +1393,152 @@ static int wstPutS64( unsigned char *p, long long n )
    return 8;
 }
 
-static void wstClosePrimeFDHandles( WstGLCtx *ctx, uint32_t handle0, uint32_t handle1, int line )
+/* Returns the new reference count, or 0 if the handle could not be tracked */
+static int wstPrimeHandleRef( WstGLCtx *ctx, uint32_t handle )
 {
-   if ( ctx )
+   int refCount= 0;
+   int i;
+
+   pthread_mutex_lock( &gPrimeHandleMutex );
+   for( i= 0; i < ctx->primeHandleCount; ++i )
    {
-      int rc;
-      struct drm_gem_close close;
-      if ( handle0 )
+      if ( ctx->primeHandles[i].handle == handle )
       {
-         memset( &close, 0, sizeof(close) );
-         close.handle= handle0;
-         wstUpdateResources( WSTRES_HD_VIDEO, false, handle0, line);
-         rc= ioctl( ctx->drmFd, DRM_IOCTL_GEM_CLOSE, &close );
-         if ( rc )
+         refCount= ++ctx->primeHandles[i].refCount;
+         goto exit;
+      }
+   }
+   if ( ctx->primeHandleCount >= ctx->primeHandleCapacity )
+   {
+      int capacity= (ctx->primeHandleCapacity ? 2*ctx->primeHandleCapacity : 2*VIDEO_FB_CACHE_SIZE);
+      WstPrimeHandle *primeHandles= (WstPrimeHandle*)realloc( ctx->primeHandles, capacity*sizeof(WstPrimeHandle) );
+      if ( !primeHandles )
+      {
+         ERROR("No memory for prime handle table (%d)", capacity);
+         goto exit;
+      }
+      ctx->primeHandles= primeHandles;
+      ctx->primeHandleCapacity= capacity;
+   }
+   ctx->primeHandles[ctx->primeHandleCount].handle= handle;
+   ctx->primeHandles[ctx->primeHandleCount].refCount= 1;
+   ++ctx->primeHandleCount;
+   refCount= 1;
+
+exit:
+   pthread_mutex_unlock( &gPrimeHandleMutex );
+
+   return refCount;
+}
+
+/* Returns true when the last reference is dropped and the handle should be closed */
+static bool wstPrimeHandleUnref( WstGLCtx *ctx, uint32_t handle )
+{
+   bool result= true;
+   int i;
+
+   pthread_mutex_lock( &gPrimeHandleMutex );
+   for( i= 0; i < ctx->primeHandleCount; ++i )
+   {
+      if ( ctx->primeHandles[i].handle == handle )
+      {
+         if ( --ctx->primeHandles[i].refCount > 0 )
          {
-            ERROR("DRM_IOCTL_GEM_CLOSE failed: handle0 %u rc %d", handle0, rc);
+            result= false;
          }
-         if ( handle1 && (handle1 != handle0) )
+         else
+         {
+            ctx->primeHandles[i]= ctx->primeHandles[--ctx->primeHandleCount];
+         }
+         break;
+      }
+   }
+   pthread_mutex_unlock( &gPrimeHandleMutex );
+
+   return result;
+}
+
+static void wstClosePrimeFDHandle( WstGLCtx *ctx, uint32_t handle, int line )
+{
+   int rc;
+   struct drm_gem_close close;
+
+   if ( wstPrimeHandleUnref( ctx, handle ) )
+   {
+      memset( &close, 0, sizeof(close) );
+      close.handle= handle;
+      wstUpdateResources( WSTRES_HD_VIDEO, false, handle, line);
+      rc= ioctl( ctx->drmFd, DRM_IOCTL_GEM_CLOSE, &close );
+      if ( rc )
+      {
+         ERROR("DRM_IOCTL_GEM_CLOSE failed: handle %u rc %d", handle, rc);
+      }
+   }
+}
+
+/*
+ * Import the plane fds of a frame.  handle1 is only imported separately
+ * when there is a second fd, each import holding one handle reference.
+ */
+static int wstOpenPrimeFDHandles( WstGLCtx *ctx, int fd0, int fd1, uint32_t *handle0, uint32_t *handle1, int line )
+{
+   int rc;
+
+   rc= drmPrimeFDToHandle( ctx->drmFd, fd0, handle0 );
+   if ( !rc )
+   {
+      if ( wstPrimeHandleRef( ctx, *handle0 ) <= 1 )
+      {
+         wstUpdateResources( WSTRES_HD_VIDEO, true, *handle0, line);
+      }
+      *handle1= *handle0;
+      if ( fd1 >= 0 )
+      {
+         rc= drmPrimeFDToHandle( ctx->drmFd, fd1, handle1 );
+         if ( !rc )
          {
-            memset( &close, 0, sizeof(close) );
-            close.handle= handle1;
-            wstUpdateResources( WSTRES_HD_VIDEO, false, handle1, line);
-            rc= ioctl( ctx->drmFd, DRM_IOCTL_GEM_CLOSE, &close );
-            if ( rc )
+            if ( (*handle1 != *handle0) && (wstPrimeHandleRef( ctx, *handle1 ) <= 1) )
             {
-               ERROR("DRM_IOCTL_GEM_CLOSE failed: handle1 %u rc %d", handle1, rc);
+               wstUpdateResources( WSTRES_HD_VIDEO, true, *handle1, line);
             }
          }
+         else
+         {
+            wstClosePrimeFDHandle( ctx, *handle0, line );
+         }
+      }
+   }
+
+   return rc;
+}
+
+static void wstClosePrimeFDHandles( WstGLCtx *ctx, uint32_t handle0, uint32_t handle1, int line )
+{
+   if ( ctx )
+   {
+      if ( handle0 )
+      {
+         wstClosePrimeFDHandle( ctx, handle0, line );
+         if ( handle1 && (handle1 != handle0) )
+         {
+            wstClosePrimeFDHandle( ctx, handle1, line );
+         }
       }
    }
 }
 
+static void wstReleaseVideoFb( WstGLCtx *ctx, uint32_t fbId, uint32_t handle0, uint32_t handle1, bool cached, int line )
+{
+   /* Cached fbs and their handles are owned by the connection's
+      fb cache and are only removed on eviction */
+   if ( fbId && !cached )
+   {
+      wstUpdateResources( WSTRES_FB_VIDEO, false, fbId, line);
+      drmModeRmFB( ctx->drmFd, fbId );
+      wstClosePrimeFDHandles( ctx, handle0, handle1, line );
+   }
+}
+
 static void wstSetVideoFrameRect( VideoFrame *vf, int rectX, int rectY, int rectW, int rectH, uint32_t *skipX, uint32_t *skipY )
 {
    uint32_t frameWidth, frameHeight;
@@ -959,10 +1589,9 @@ static void wstFreeVideoFrameResources( VideoFrame *f )
       }
       if ( f->fbId )
       {
-         wstUpdateResources( WSTRES_FB_VIDEO, false, f->fbId, __LINE__);
-         drmModeRmFB( gCtx->drmFd, f->fbId );
+         wstReleaseVideoFb( gCtx, f->fbId, f->handle0, f->handle1, f->fbCached, __LINE__ );
          f->fbId= 0;
-         wstClosePrimeFDHandles( gCtx, f->handle0, f->handle1, __LINE__ );
+         f->fbCached= false;
          f->handle0= 0;
          f->handle1= 0;
       }
@@ -985,23 +1614,174 @@ static void wstFreeVideoFrameResources( VideoFrame *f )
    }
 }
 
-static void wstVideoServerFreeBuffers( VideoServerConnection *conn, bool full )
+static bool wstVideoFbKeyInit( VideoFbKey *key, int fd0, int fd1, uint32_t width, uint32_t height, uint32_t format,
+                               uint32_t *offsets, uint32_t *pitches )
 {
-   int i;
+   bool result= false;
+   struct stat st;
 
-   for( i= 0; i < ACTIVE_FRAMES; ++i )
+   memset( key, 0, sizeof(VideoFbKey) );
+   if ( fstat( fd0, &st ) == 0 )
    {
-      if ( (i >= 2) || full )
+      key->ino0= st.st_ino;
+      if ( fd1 >= 0 )
       {
-         wstFreeVideoFrameResources( &conn->videoPlane->videoFrame[i] );
-      }
+         if ( fstat( fd1, &st ) != 0 )
+         {
+            goto exit;
+         }
+         key->ino1= st.st_ino;
+      }
+      key->width= width;
+      key->height= height;
+      key->format= format;
+      key->offsets[0]= offsets[0];
+      key->offsets[1]= offsets[1];
+      key->pitches[0]= pitches[0];
+      key->pitches[1]= pitches[1];
+      result= true;
    }
+
+exit:
+   return result;
 }
 
-static void wstVideoServerFlush( VideoServerConnection *conn )
+static VideoFbCacheEntry *wstVideoFbCacheFind( VideoServerConnection *conn, VideoFbKey *key )
 {
-   int rc;
-   int len;
+   VideoFbCacheEntry *entry= 0;
+   int i;
+
+   for( i= 0; i < conn->fbCacheCount; ++i )
+   {
+      if ( !memcmp( &conn->fbCache[i].key, key, sizeof(VideoFbKey) ) )
+      {
+         entry= &conn->fbCache[i];
+         entry->lastUse= ++conn->fbCacheUse;
+         break;
+      }
+   }
+
+   return entry;
+}
+
+static bool wstVideoFbInUse( VideoServerConnection *conn, uint32_t fbId )
+{
+   bool inUse= false;
+   int i;
+
+   for( i= 0; i < ACTIVE_FRAMES; ++i )
+   {
+      if ( conn->videoPlane->videoFrame[i].fbId == fbId )
+      {
+         inUse= true;
+         goto exit;
+      }
+   }
+   if ( conn->videoPlane->vfm )
+   {
+      VideoFrameManager *vfm= conn->videoPlane->vfm;
+      int count= wstVideoFrameManagerCount( vfm );
+      for( i= 0; i < count; ++i )
+      {
+         if ( wstVideoFrameManagerAt( vfm, i )->fbId == fbId )
+         {
+            inUse= true;
+            goto exit;
+         }
+      }
+   }
+
+exit:
+   return inUse;
+}
+
+static void wstVideoFbCacheRemove( VideoServerConnection *conn, int index )
+{
+   VideoFbCacheEntry *entry= &conn->fbCache[index];
+
+   wstUpdateResources( WSTRES_FB_VIDEO, false, entry->fbId, __LINE__);
+   drmModeRmFB( gCtx->drmFd, entry->fbId );
+
+   /* Other entries and uncached frames for the same dmabuf hold their own handle references */
+   wstClosePrimeFDHandles( gCtx, entry->handle0, entry->handle1, __LINE__ );
+
+   if ( index < conn->fbCacheCount-1 )
+   {
+      memmove( &conn->fbCache[index], &conn->fbCache[index+1], (conn->fbCacheCount-(index+1))*sizeof(VideoFbCacheEntry) );
+   }
+   --conn->fbCacheCount;
+}
+
+/* Must be called with gMutex held so that frame ownership can't change
+   while looking for an entry to evict */
+static bool wstVideoFbCacheAdd( VideoServerConnection *conn, VideoFbKey *key, uint32_t fbId, uint32_t handle0, uint32_t handle1 )
+{
+   bool result= false;
+   VideoFbCacheEntry *entry;
+
+   if ( conn->fbCacheCount >= conn->fbCacheSize )
+   {
+      int i, lru= -1;
+      for( i= 0; i < conn->fbCacheCount; ++i )
+      {
+         if ( ((lru < 0) || (conn->fbCache[i].lastUse < conn->fbCache[lru].lastUse)) &&
+              !wstVideoFbInUse( conn, conn->fbCache[i].fbId ) )
+         {
+            lru= i;
+         }
+      }
+      if ( lru < 0 )
+      {
+         goto exit;
+      }
+      FRAME("fb cache evict fb %u", conn->fbCache[lru].fbId);
+      wstVideoFbCacheRemove( conn, lru );
+      ++gCtx->videoFbCacheEvictions;
+   }
+
+   entry= &conn->fbCache[conn->fbCacheCount++];
+   entry->key= *key;
+   entry->fbId= fbId;
+   entry->handle0= handle0;
+   entry->handle1= handle1;
+   entry->lastUse= ++conn->fbCacheUse;
+   result= true;
+
+exit:
+   return result;
+}
+
+static void wstVideoFbCachePurge( VideoServerConnection *conn )
+{
+   if ( conn->fbCache )
+   {
+      while( conn->fbCacheCount )
+      {
+         wstVideoFbCacheRemove( conn, conn->fbCacheCount-1 );
+      }
+      free( conn->fbCache );
+      conn->fbCache= 0;
+      conn->fbCacheSize= 0;
+   }
+}
+
+static void wstVideoServerFreeBuffers( VideoServerConnection *conn, bool full )
+{
+   int i;
+
+   for( i= 0; i < ACTIVE_FRAMES; ++i )
+   {
+      if ( (i >= 2) || full )
+      {
+         wstFreeVideoFrameResources( &conn->videoPlane->videoFrame[i] );
+      }
+   }
+}
+
+static void wstVideoServerFlush( VideoServerConnection *conn )
+{
+   int rc;
+   int len;
 
    DEBUG("wstVideoServerFlush: enter");
 
@@ -1087,6 +1867,48 @@ static void wstVideoServerSendRefreshRate( VideoServerConnection *conn, int rate
    pthread_mutex_unlock( &conn->mutex );
 }
 
+static void wstVideoServerSendVersion( VideoServerConnection *conn, int version )
+{
+   struct msghdr msg;
+   struct iovec iov[1];
+   unsigned char mbody[4+1];
+   int len;
+   int sentLen;
+
+   pthread_mutex_lock( &conn->mutex );
+
+   msg.msg_name= NULL;
+   msg.msg_namelen= 0;
+   msg.msg_iov= iov;
+   msg.msg_iovlen= 1;
+   msg.msg_control= 0;
+   msg.msg_controllen= 0;
+   msg.msg_flags= 0;
+
+   len= 0;
+   mbody[len++]= 'V';
+   mbody[len++]= 'S';
+   mbody[len++]= 2;
+   mbody[len++]= 'V';
+   mbody[len++]= version;
+
+   iov[0].iov_base= (char*)mbody;
+   iov[0].iov_len= len;
+
+   do
+   {
+      sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
+   }
+   while ( (sentLen < 0) && (errno == EINTR));
+
+   if ( sentLen == len )
+   {
+      DEBUG("sent protocol version %d to client", version);
+   }
+
+   pthread_mutex_unlock( &conn->mutex );
+}
+
 static void wstVideoServerSendBufferRelease( VideoServerConnection *conn, int bufferId )
 {
    struct msghdr msg;
@@ -1124,6 +1946,78 @@ static void wstVideoServerSendBufferRelease( VideoServerConnection *conn, int bu
    if ( sentLen == len )
    {
       FRAME("send release buffer %d to client", bufferId);
+      wstTrace( TRACE_VIDEO_RELEASE, bufferId, 1, 0LL );
+   }
+
+   pthread_mutex_unlock( &conn->mutex );
+}
+
+static void wstVideoServerSendBufferReleases( VideoServerConnection *conn, int *bufferIds, int count )
+{
+   struct msghdr msg;
+   struct iovec iov[1];
+   unsigned char mbody[(4+4)*VFM_RELEASE_BATCH];
+   int i, len;
+   int sentLen;
+
+   if ( count == 1 )
+   {
+      wstVideoServerSendBufferRelease( conn, bufferIds[0] );
+      return;
+   }
+   if ( count > VFM_RELEASE_BATCH )
+   {
+      count= VFM_RELEASE_BATCH;
+   }
+
+   pthread_mutex_lock( &conn->mutex );
+
+   msg.msg_name= NULL;
+   msg.msg_namelen= 0;
+   msg.msg_iov= iov;
+   msg.msg_iovlen= 1;
+   msg.msg_control= 0;
+   msg.msg_controllen= 0;
+   msg.msg_flags= 0;
+
+   len= 0;
+   if ( conn->protocolVersion >= 2 )
+   {
+      mbody[len++]= 'V';
+      mbody[len++]= 'S';
+      mbody[len++]= 2+count*4;
+      mbody[len++]= 'X';
+      mbody[len++]= count;
+      for( i= 0; i < count; ++i )
+      {
+         len += wstPutU32( &mbody[len], bufferIds[i] );
+      }
+   }
+   else
+   {
+      for( i= 0; i < count; ++i )
+      {
+         mbody[len++]= 'V';
+         mbody[len++]= 'S';
+         mbody[len++]= 5;
+         mbody[len++]= 'B';
+         len += wstPutU32( &mbody[len], bufferIds[i] );
+      }
+   }
+
+   iov[0].iov_base= (char*)mbody;
+   iov[0].iov_len= len;
+
+   do
+   {
+      sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
+   }
+   while ( (sentLen < 0) && (errno == EINTR));
+
+   if ( sentLen == len )
+   {
+      FRAME("send release of %d buffers to client", count);
+      wstTrace( TRACE_VIDEO_RELEASE, -1, count, 0LL );
    }
 
    pthread_mutex_unlock( &conn->mutex );
@@ -1258,28 +2152,78 @@ static void wstVideoServerSendZoomMode( VideoServerConnection *conn, int zoomMod
    pthread_mutex_unlock( &conn->mutex );
 }
 
-static int wstAdaptFd( int fdin )
+static bool wstVideoServerConnectionOpen( VideoServerConnection *conn )
+{
+   bool result= false;
+   int i;
+
+   conn->videoPlane= wstOverlayAlloc( &gCtx->overlayPlanes, false );
+   INFO("video plane %p : zorder: %d", conn->videoPlane, (conn->videoPlane ? conn->videoPlane->zOrder: -1) );
+
+   if ( !conn->videoPlane )
+   {
+      ERROR("No video plane avaialble");
+      goto exit;
+   }
+
+   conn->videoPlane->vfm= wstCreateVideoFrameManager( conn );
+   if ( !conn->videoPlane->vfm )
+   {
+      ERROR("Unable to allocate vfm");
+      goto exit;
+   }
+
+   if ( gCtx->videoFbCacheSize > 0 )
+   {
+      conn->fbCache= (VideoFbCacheEntry*)calloc( gCtx->videoFbCacheSize, sizeof(VideoFbCacheEntry) );
+      if ( conn->fbCache )
+      {
+         conn->fbCacheSize= gCtx->videoFbCacheSize;
+      }
+      else
+      {
+         ERROR("No memory for video fb cache (size %d)", gCtx->videoFbCacheSize);
+      }
+   }
+
+   for( i= 0; i < ACTIVE_FRAMES; ++i )
+   {
+      conn->videoPlane->videoFrame[i].plane= conn->videoPlane;
+   }
+
+   conn->videoPlane->conn= conn;
+
+   conn->zoomMode= -1;
+
+   result= true;
+
+exit:
+   return result;
+}
+
+static void wstVideoServerDiscardFds( VideoServerConnection *conn )
 {
-   int fdout= fdin;
-   if ( fdin >= 0 )
+   int i, j;
+
+   for( i= 0; i < conn->fdQueueCount; ++i )
    {
-      int fddup= fcntl( fdin, F_DUPFD_CLOEXEC, 0 );
-      if ( fddup >= 0 )
+      for( j= 0; j < 3; ++j )
       {
-         close( fdin );
-         fdout= fddup;
+         if ( conn->fdQueue[i][j] >= 0 )
+         {
+            close( conn->fdQueue[i][j] );
+         }
       }
    }
-   return fdout;
+   conn->fdQueueCount= 0;
 }
 
-static void *wstVideoServerConnectionThread( void *arg )
+static bool wstVideoServerConnectionRead( VideoServerConnection *conn )
 {
-   VideoServerConnection *conn= (VideoServerConnection*)arg;
+   bool result= true;
    struct msghdr msg;
    struct cmsghdr *cmsg;
    struct iovec iov[1];
-   unsigned char mbody[4+64];
    char cmbody[CMSG_SPACE(3*sizeof(int))];
    int moff= 0, len, i, rc;
    uint32_t fbId= 0;
@@ -1295,203 +2239,186 @@ static void *wstVideoServerConnectionThread( void *arg )
    long long frameTime= 0;
    VideoFrame videoFrame;
 
-   DEBUG("wstVideoServerConnectionThread: enter");
-
-   conn->videoPlane= wstOverlayAlloc( &gCtx->overlayPlanes, false );
-   INFO("video plane %p : zorder: %d", conn->videoPlane, (conn->videoPlane ? conn->videoPlane->zOrder: -1) );
+   memset( &videoFrame, 0, sizeof(videoFrame) );
+   videoFrame.plane= conn->videoPlane;
 
-   if ( !conn->videoPlane )
+   if ( gCtx->modeInfo && gCtx->modeInfo->vrefresh != conn->refreshRate )
    {
-      ERROR("No video plane avaialble");
-      goto exit;
+      wstVideoServerSendRefreshRate( conn, gCtx->modeInfo->vrefresh );
    }
-
-   conn->videoPlane->vfm= wstCreateVideoFrameManager( conn );
-   if ( !conn->videoPlane->vfm )
+   if ( (gCtx->zoomMode != -1) && (gCtx->zoomMode != conn->zoomMode) )
    {
-      ERROR("Unable to allocate vfm");
-      goto exit;
+      wstVideoServerSendZoomMode( conn, gCtx->zoomMode );
    }
 
-   videoFrame.plane= conn->videoPlane;
-   for( i= 0; i < ACTIVE_FRAMES; ++i )
-   {
-      conn->videoPlane->videoFrame[i].plane= conn->videoPlane;
-   }
+   iov[0].iov_base= (char*)conn->mbody+conn->mbodyLen;
+   iov[0].iov_len= sizeof(conn->mbody)-conn->mbodyLen;
 
-   conn->videoPlane->conn= conn;
+   cmsg= (struct cmsghdr*)cmbody;
+   cmsg->cmsg_len= CMSG_LEN(3*sizeof(int));
+   cmsg->cmsg_level= SOL_SOCKET;
+   cmsg->cmsg_type= SCM_RIGHTS;
 
-   conn->zoomMode= -1;
+   msg.msg_name= NULL;
+   msg.msg_namelen= 0;
+   msg.msg_iov= iov;
+   msg.msg_iovlen= 1;
+   msg.msg_control= cmsg;
+   msg.msg_controllen= cmsg->cmsg_len;
+   msg.msg_flags= 0;
 
-   conn->threadStarted= true;
-   while( !conn->threadStopRequested )
+   /* A single read may return several messages, a partial message, or both */
+   do
    {
-      if ( gCtx->modeInfo && gCtx->modeInfo->vrefresh != conn->refreshRate )
-      {
-         wstVideoServerSendRefreshRate( conn, gCtx->modeInfo->vrefresh );
-      }
-      if ( (gCtx->zoomMode != -1) && (gCtx->zoomMode != conn->zoomMode) )
-      {
-         wstVideoServerSendZoomMode( conn, gCtx->zoomMode );
-      }
-
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= 4;
-
-      cmsg= (struct cmsghdr*)cmbody;
-      cmsg->cmsg_len= CMSG_LEN(3*sizeof(int));
-      cmsg->cmsg_level= SOL_SOCKET;
-      cmsg->cmsg_type= SCM_RIGHTS;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= cmsg;
-      msg.msg_controllen= cmsg->cmsg_len;
-      msg.msg_flags= 0;
+      len= recvmsg( conn->socketFd, &msg, MSG_CMSG_CLOEXEC );
+   }
+   while ( (len < 0) && (errno == EINTR));
 
-      do
+   if ( len > 0 )
+   {
+      if ( g_activeLevel >= 7 )
       {
-         len= recvmsg( conn->socketFd, &msg, 0 );
+         wstDumpMessage( conn->mbody+conn->mbodyLen, len );
       }
-      while ( (len < 0) && (errno == EINTR));
 
-      if ( len > 0 )
+      /*
+       * The kernel ends a stream read after data that carries descriptors so each
+       * read delivers at most one set.  Sets are consumed in order by 'F' messages.
+       */
+      cmsg= CMSG_FIRSTHDR(&msg);
+      if ( cmsg &&
+           cmsg->cmsg_level == SOL_SOCKET &&
+           cmsg->cmsg_type == SCM_RIGHTS &&
+           cmsg->cmsg_len >= CMSG_LEN(sizeof(int)) )
       {
-         fd0= fd1= fd2= -1;
-
-         if ( g_activeLevel >= 7 )
+         int *fds= (int*)CMSG_DATA(cmsg);
+         int fdCount= (cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+         if ( fdCount > 3 )
          {
-            wstDumpMessage( mbody, len );
+            fdCount= 3;
          }
-         if ( len == 4 )
+         if ( conn->fdQueueCount < VS_FD_QUEUE_SIZE )
          {
-            unsigned char *m= mbody;
-            if ( (m[0] == 'V') && (m[1] == 'S') )
+            for( i= 0; i < 3; ++i )
             {
-               int mlen, id;
-               mlen= m[2];
-               id= m[3];
-               switch( id )
-               {
-                  case 'F':
-                     cmsg= CMSG_FIRSTHDR(&msg);
-                     if ( cmsg &&
-                          cmsg->cmsg_level == SOL_SOCKET &&
-                          cmsg->cmsg_type == SCM_RIGHTS &&
-                          cmsg->cmsg_len >= CMSG_LEN(sizeof(int)) )
-                     {
-                        fd0 = wstAdaptFd( ((int*)CMSG_DATA(cmsg))[0] );
-                        if ( cmsg->cmsg_len >= CMSG_LEN(2*sizeof(int)) )
-                        {
-                           fd1 = wstAdaptFd( ((int*)CMSG_DATA(cmsg))[1] );
-                        }
-                        if ( cmsg->cmsg_len >= CMSG_LEN(3*sizeof(int)) )
-                        {
-                           fd2 = wstAdaptFd( ((int*)CMSG_DATA(cmsg))[2] );
-                        }
-                     }
-                     break;
-                  default:
-                     break;
-               }
+               conn->fdQueue[conn->fdQueueCount][i]= ((i < fdCount) ? fds[i] : -1);
+            }
+            ++conn->fdQueueCount;
+         }
+         else
+         {
+            ERROR("video server fd queue full: discarding %d fds", fdCount);
+            for( i= 0; i < fdCount; ++i )
+            {
+               close( fds[i] );
+            }
+         }
+      }
 
-               if ( mlen > sizeof(mbody) )
-               {
-                  ERROR("bad message length: %d : truncating");
-                  mlen= sizeof(mbody);
-               }
-               if ( mlen > 1 )
-               {
-                  iov[0].iov_base= (char*)mbody+4;
-                  iov[0].iov_len= mlen-1;
-
-                  msg.msg_name= NULL;
-                  msg.msg_namelen= 0;
-                  msg.msg_iov= iov;
-                  msg.msg_iovlen= 1;
-                  msg.msg_control= 0;
-                  msg.msg_controllen= 0;
-                  msg.msg_flags= 0;
-
-                  do
-                  {
-                     len= recvmsg( conn->socketFd, &msg, 0 );
-                  }
-                  while ( (len < 0) && (errno == EINTR));
-               }
+      conn->mbodyLen += len;
+      moff= 0;
+      while ( conn->mbodyLen-moff >= 4 )
+      {
+         unsigned char *m= conn->mbody+moff;
+         if ( (m[0] == 'V') && (m[1] == 'S') )
+         {
+            int mlen, id;
+            mlen= m[2];
+            id= m[3];
+            if ( conn->mbodyLen-moff < mlen+3 )
+            {
+               /* Incomplete: keep the partial message for the next read */
+               break;
+            }
+            moff += (mlen+3);
+
+            fd0= fd1= fd2= -1;
+            if ( (id == 'F') && (conn->fdQueueCount > 0) )
+            {
+               fd0= conn->fdQueue[0][0];
+               fd1= conn->fdQueue[0][1];
+               fd2= conn->fdQueue[0][2];
+               --conn->fdQueueCount;
+               memmove( &conn->fdQueue[0], &conn->fdQueue[1], conn->fdQueueCount*sizeof(conn->fdQueue[0]) );
+            }
 
-               if ( len > 0 )
+            if ( mlen > 0 )
+            {
+               m += 3;
+               switch( id )
                {
-                  len += 4;
-                  m += 3;
-                  if ( g_activeLevel >= 7 )
-                  {
-                     wstDumpMessage( mbody, len );
-                  }
-                  switch( id )
-                  {
-                     case 'F':
-                        if ( fd0 >= 0 )
+                  case 'F':
+                     if ( fd0 >= 0 )
+                     {
+                        uint32_t handle0, handle1;
+                        uint32_t pitches[4]= { 0, 0, 0, 0 };
+                        uint32_t offsets[4]= { 0, 0, 0, 0 };
+                        VideoFbKey fbKey;
+                        VideoFbCacheEntry *fbEntry;
+                        bool fbKeyValid;
+
+                        wstUpdateResources( WSTRES_FD_VIDEO, true, fd0, __LINE__);
+                        frameWidth= wstGetU32( m+1 );
+                        frameHeight= ((wstGetU32( m+5)+1) & ~1);
+                        frameFormat= wstGetU32( m+9);
+                        rectX= (int)wstGetU32( m+13 );
+                        rectY= (int)wstGetU32( m+17 );
+                        rectW= (int)wstGetU32( m+21 );
+                        rectH= (int)wstGetU32( m+25 );
+                        offset0= (int)wstGetU32( m+29 );
+                        stride0= (int)wstGetU32( m+33 );
+                        offset1= (int)wstGetU32( m+37 );
+                        stride1= (int)wstGetU32( m+41 );
+                        offset2= (int)wstGetU32( m+45 );
+                        stride2= (int)wstGetU32( m+49 );
+                        bufferId= (int)wstGetU32( m+53 );
+                        frameTime= (long long)wstGetS64( m+57 );
+                        FRAME("got frame %d buffer %d frameTime %lld", conn->videoPlane->frameCount, bufferId, frameTime);
+                        wstTrace( TRACE_VIDEO_FRAME, conn->videoPlane->frameCount, bufferId, frameTime );
+
+                        TRACE2("got frame fd %d,%d,%d (%dx%d) %X (%d, %d, %d, %d) off(%d, %d, %d) stride(%d, %d, %d)",
+                               fd0, fd1, fd2, frameWidth, frameHeight, frameFormat, rectX, rectY, rectW, rectH,
+                               offset0, offset1, offset2, stride0, stride1, stride2 );
+
+
+                        videoFrame.frameWidth= frameWidth;
+                        videoFrame.frameHeight= frameHeight;
+                        wstSetVideoFrameRect( &videoFrame, rectX, rectY, rectW, rectH, &frameSkipX, &frameSkipY );
+
+                        pitches[0]= stride0;
+                        pitches[1]= stride1;
+                        offsets[0]= offset0+frameSkipX+frameSkipY*stride0;
+                        offsets[1]= offset1+frameSkipX+frameSkipY*(stride1/2);
+
+                        fbEntry= 0;
+                        fbKeyValid= false;
+                        if ( conn->fbCache )
                         {
-                           uint32_t handle0, handle1;
-
-                           wstUpdateResources( WSTRES_FD_VIDEO, true, fd0, __LINE__);
-                           frameWidth= wstGetU32( m+1 );
-                           frameHeight= ((wstGetU32( m+5)+1) & ~1);
-                           frameFormat= wstGetU32( m+9);
-                           rectX= (int)wstGetU32( m+13 );
-                           rectY= (int)wstGetU32( m+17 );
-                           rectW= (int)wstGetU32( m+21 );
-                           rectH= (int)wstGetU32( m+25 );
-                           offset0= (int)wstGetU32( m+29 );
-                           stride0= (int)wstGetU32( m+33 );
-                           offset1= (int)wstGetU32( m+37 );
-                           stride1= (int)wstGetU32( m+41 );
-                           offset2= (int)wstGetU32( m+45 );
-                           stride2= (int)wstGetU32( m+49 );
-                           bufferId= (int)wstGetU32( m+53 );
-                           frameTime= (long long)wstGetS64( m+57 );
-                           FRAME("got frame %d buffer %d frameTime %lld", conn->videoPlane->frameCount, bufferId, frameTime);
-
-                           TRACE2("got frame fd %d,%d,%d (%dx%d) %X (%d, %d, %d, %d) off(%d, %d, %d) stride(%d, %d, %d)",
-                                  fd0, fd1, fd2, frameWidth, frameHeight, frameFormat, rectX, rectY, rectW, rectH,
-                                  offset0, offset1, offset2, stride0, stride1, stride2 );
-
-
-                           videoFrame.frameWidth= frameWidth;
-                           videoFrame.frameHeight= frameHeight;
-                           wstSetVideoFrameRect( &videoFrame, rectX, rectY, rectW, rectH, &frameSkipX, &frameSkipY );
-
-                           rc= drmPrimeFDToHandle( gCtx->drmFd, fd0, &handle0 );
-                           if ( !rc )
+                           fbKeyValid= wstVideoFbKeyInit( &fbKey, fd0, fd1,
+                                                          frameWidth-frameSkipX, frameHeight-frameSkipY, frameFormat,
+                                                          offsets, pitches );
+                           if ( fbKeyValid )
                            {
-                              wstUpdateResources( WSTRES_HD_VIDEO, true, handle0, __LINE__);
-                              handle1= handle0;
-                              if ( fd1 >= 0 )
-                              {
-                                 rc= drmPrimeFDToHandle( gCtx->drmFd, fd1, &handle1 );
-                                 if ( !rc )
-                                 {
-                                    wstUpdateResources( WSTRES_HD_VIDEO, true, handle1, __LINE__);
-                                 }
-                              }
+                              fbEntry= wstVideoFbCacheFind( conn, &fbKey );
                            }
+                        }
+
+                        if ( fbEntry )
+                        {
+                           fbId= fbEntry->fbId;
+                           handle0= fbEntry->handle0;
+                           handle1= fbEntry->handle1;
+                           rc= 0;
+                        }
+                        else
+                        {
+                           rc= wstOpenPrimeFDHandles( gCtx, fd0, fd1, &handle0, &handle1, __LINE__ );
                            if ( !rc )
                            {
                               uint32_t handles[4]= { handle0,
                                                      handle1,
                                                      0,
                                                      0 };
-                              uint32_t pitches[4]= { stride0,
-                                                     stride1,
-                                                     0,
-                                                     0 };
-                              uint32_t offsets[4]= { offset0+frameSkipX+frameSkipY*stride0,
-                                                     offset1+frameSkipX+frameSkipY*(stride1/2),
-                                                     0,
-                                                     0};
 
                               rc= drmModeAddFB2( gCtx->drmFd,
                                                  frameWidth-frameSkipX,
@@ -1505,197 +2432,249 @@ static void *wstVideoServerConnectionThread( void *arg )
                                                );
                               if ( !rc )
                               {
-                                 pthread_mutex_lock( &gMutex );
                                  wstUpdateResources( WSTRES_FB_VIDEO, true, fbId, __LINE__);
-                                 videoFrame.hide= false;
-                                 videoFrame.fbId= fbId;
-                                 videoFrame.handle0= handle0;
-                                 videoFrame.handle1= handle1;
-                                 videoFrame.fd0= fd0;
-                                 videoFrame.fd1= fd1;
-                                 videoFrame.fd2= fd2;
-                                 videoFrame.frameFormat= frameFormat;
-                                 videoFrame.bufferId= bufferId;
-                                 videoFrame.frameTime= frameTime;
-                                 videoFrame.frameNumber= conn->videoPlane->frameCount++;
-                                 videoFrame.vf= 0;
-                                 videoFrame.canExpire= true;
-                                 conn->videoPlane->hidden= false;
-                                 wstVideoFrameManagerPushFrame( conn->videoPlane->vfm, &videoFrame );
-                                 pthread_mutex_unlock( &gMutex );
                               }
                               else
                               {
-                                 ERROR("wstVideoServerConnectionThread: drmModeAddFB2 failed: rc %d errno %d", rc, errno);
+                                 ERROR("wstVideoServerConnectionRead: drmModeAddFB2 failed: rc %d errno %d", rc, errno);
                                  wstClosePrimeFDHandles( gCtx, handle0, handle1, __LINE__ );
-                                 wstUpdateResources( WSTRES_FD_VIDEO, false, fd0, __LINE__);
-                                 close( fd0 );
-                                 if ( fd1 >= 0 )
-                                 {
-                                    close( fd1 );
-                                 }
-                                 if ( fd2 >= 0 )
-                                 {
-                                    close( fd2 );
-                                 }
                               }
                            }
                            else
                            {
-                              ERROR("wstVideoServerConnectionThread: drmPrimeFDToHandle failed: rc %d errno %d", rc, errno);
-                              wstUpdateResources( WSTRES_FD_VIDEO, false, fd0, __LINE__);
-                              close( fd0 );
-                              if ( fd1 >= 0 )
-                              {
-                                 close( fd1 );
-                              }
-                              if ( fd2 >= 0 )
-                              {
-                                 close( fd2 );
-                              }
+                              ERROR("wstVideoServerConnectionRead: drmPrimeFDToHandle failed: rc %d errno %d", rc, errno);
                            }
                         }
-                        break;
-                     case 'H':
+
+                        if ( !rc )
                         {
-                           bool hide= (m[1] == 1);
-                           DEBUG("got hide (%d) video plane %d", hide, conn->videoPlane->plane->plane_id);
                            pthread_mutex_lock( &gMutex );
-                           gCtx->dirty= true;
-                           conn->videoPlane->dirty= true;
-                           conn->videoPlane->hide= hide;
+                           if ( fbEntry )
+                           {
+                              ++gCtx->videoFbCacheHits;
+                              videoFrame.fbCached= true;
+                           }
+                           else if ( fbKeyValid )
+                           {
+                              ++gCtx->videoFbCacheMisses;
+                              videoFrame.fbCached= wstVideoFbCacheAdd( conn, &fbKey, fbId, handle0, handle1 );
+                           }
+                           else
+                           {
+                              videoFrame.fbCached= false;
+                           }
+                           videoFrame.hide= false;
+                           videoFrame.fbId= fbId;
+                           videoFrame.handle0= handle0;
+                           videoFrame.handle1= handle1;
+                           videoFrame.fd0= fd0;
+                           videoFrame.fd1= fd1;
+                           videoFrame.fd2= fd2;
+                           videoFrame.frameFormat= frameFormat;
+                           videoFrame.bufferId= bufferId;
+                           videoFrame.frameTime= frameTime;
+                           videoFrame.frameNumber= conn->videoPlane->frameCount++;
+                           videoFrame.vf= 0;
+                           videoFrame.canExpire= true;
+                           conn->videoPlane->hidden= false;
+                           #ifdef WESTEROS_GL_AVSYNC
+                           wstVideoFrameManagerPushFrame( conn->videoPlane->vfm, &videoFrame );
                            pthread_mutex_unlock( &gMutex );
-                        }
-                        break;
-                     case 'S':
-                        {
-                           DEBUG("got flush video plane %d", conn->videoPlane->plane->plane_id);
-                           FRAME("got flush video plane %d", conn->videoPlane->plane->plane_id);
-                           pthread_mutex_lock( &gMutex );
-                           conn->videoPlane->flipTimeBase= 0LL;
-                           conn->videoPlane->frameTimeBase= 0LL;
-                           wstVideoServerFlush( conn );
+                           #else
                            pthread_mutex_unlock( &gMutex );
+                           /* Only this thread pushes or replaces the vfm so the push needs no lock */
+                           wstVideoFrameManagerPushFrame( conn->videoPlane->vfm, &videoFrame );
+                           #endif
                         }
-                        break;
-                     case 'P':
+                        else
                         {
-                           bool pause= (m[1] == 1);
-                           DEBUG("got pause (%d) video plane %d", pause, conn->videoPlane->plane->plane_id);
-                           pthread_mutex_lock( &gMutex );
-                           wstVideoFrameManagerPause( conn->videoPlane->vfm, pause );
-                           pthread_mutex_unlock( &gMutex );
+                           wstUpdateResources( WSTRES_FD_VIDEO, false, fd0, __LINE__);
+                           close( fd0 );
+                           if ( fd1 >= 0 )
+                           {
+                              close( fd1 );
+                           }
+                           if ( fd2 >= 0 )
+                           {
+                              close( fd2 );
+                           }
                         }
-                        break;
-                     case 'I':
+                     }
+                     break;
+                  case 'H':
+                     {
+                        bool hide= (m[1] == 1);
+                        DEBUG("got hide (%d) video plane %d", hide, conn->videoPlane->plane->plane_id);
+                        pthread_mutex_lock( &gMutex );
+                        gCtx->dirty= true;
+                        conn->videoPlane->dirty= true;
+                        conn->videoPlane->hide= hide;
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'S':
+                     {
+                        DEBUG("got flush video plane %d", conn->videoPlane->plane->plane_id);
+                        FRAME("got flush video plane %d", conn->videoPlane->plane->plane_id);
+                        wstTrace( TRACE_VIDEO_FLUSH, conn->videoPlane->plane->plane_id, 0, 0LL );
+                        pthread_mutex_lock( &gMutex );
+                        conn->videoPlane->flipTimeBase= 0LL;
+                        conn->videoPlane->frameTimeBase= 0LL;
+                        wstVideoServerFlush( conn );
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'P':
+                     {
+                        bool pause= (m[1] == 1);
+                        DEBUG("got pause (%d) video plane %d", pause, conn->videoPlane->plane->plane_id);
+                        pthread_mutex_lock( &gMutex );
+                        wstVideoFrameManagerPause( conn->videoPlane->vfm, pause );
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'I':
+                     {
+                        int syncType= m[1];
+                        int sessionId= wstGetU32( m+2 );
+                        DEBUG("got session info: sync type %d sessionId %d video plane %d", syncType, sessionId, conn->videoPlane->plane->plane_id);
+                        pthread_mutex_lock( &gMutex );
+                        if ( conn->videoPlane->vfm )
                         {
-                           int syncType= m[1];
-                           int sessionId= wstGetU32( m+2 );
-                           DEBUG("got session info: sync type %d sessionId %d video plane %d", syncType, sessionId, conn->videoPlane->plane->plane_id);
-                           pthread_mutex_lock( &gMutex );
-                           if ( conn->videoPlane->vfm )
+                           if (
+                                (conn->sessionId != sessionId) ||
+                                (
+                                  (conn->syncType != syncType) &&
+                                  (
+                                    (conn->syncType > 1) || /* current not video, not audio */
+                                    (syncType > 1)  /* new not video, not audio */
+                                  )
+                                )
+                              )
                            {
-                              if (
-                                   (conn->sessionId != sessionId) ||
-                                   (
-                                     (conn->syncType != syncType) &&
-                                     (
-                                       (conn->syncType > 1) || /* current not video, not audio */
-                                       (syncType > 1)  /* new not video, not audio */
-                                     )
-                                   )
-                                 )
-                              {
-                                 wstDestroyVideoFrameManager( conn->videoPlane->vfm );
-                                 conn->videoPlane->vfm= 0;
-                              }
-                              else if ( conn->syncType != syncType )
-                              {
-                                 conn->syncType= syncType;
-                                 wstVideoFrameManagerSetSyncType( conn->videoPlane->vfm, syncType );
-                              }
+                              wstDestroyVideoFrameManager( conn->videoPlane->vfm );
+                              conn->videoPlane->vfm= 0;
                            }
-                           if ( !conn->videoPlane->vfm )
+                           else if ( conn->syncType != syncType )
                            {
                               conn->syncType= syncType;
-                              conn->sessionId= sessionId;
-                              conn->videoPlane->vfm= wstCreateVideoFrameManager( conn );
+                              wstVideoFrameManagerSetSyncType( conn->videoPlane->vfm, syncType );
                            }
-                           pthread_mutex_unlock( &gMutex );
-                        }
-                        break;
-                     case 'A':
-                        {
-                           DEBUG("got frame advance video plane %d", conn->videoPlane->plane->plane_id);
-                           pthread_mutex_lock( &gMutex );
-                           wstVideoFrameManagerFrameAdvance( conn->videoPlane->vfm );
-                           pthread_mutex_unlock( &gMutex );
                         }
-                        break;
-                    case 'W':
+                        if ( !conn->videoPlane->vfm )
                         {
-                           pthread_mutex_lock( &gMutex );
-                           rectX= (int)wstGetU32( m+1 );
-                           rectY= (int)wstGetU32( m+5 );
-                           rectW= (int)wstGetU32( m+9 );
-                           rectH= (int)wstGetU32( m+13 );
-                           DEBUG("got position video plane %d: (%d, %d, %d, %d)",
-                                  conn->videoPlane->plane->plane_id,
-                                  rectX, rectY, rectW, rectH);
-                           wstVideoFrameManagerUpdateRect( conn->videoPlane->vfm, rectX, rectY, rectW, rectH );
-                           pthread_mutex_unlock( &gMutex );
+                           conn->syncType= syncType;
+                           conn->sessionId= sessionId;
+                           conn->videoPlane->vfm= wstCreateVideoFrameManager( conn );
                         }
-                        break;
-                     case 'R':
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'A':
+                     {
+                        DEBUG("got frame advance video plane %d", conn->videoPlane->plane->plane_id);
+                        pthread_mutex_lock( &gMutex );
+                        wstVideoFrameManagerFrameAdvance( conn->videoPlane->vfm );
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                 case 'W':
+                     {
+                        pthread_mutex_lock( &gMutex );
+                        rectX= (int)wstGetU32( m+1 );
+                        rectY= (int)wstGetU32( m+5 );
+                        rectW= (int)wstGetU32( m+9 );
+                        rectH= (int)wstGetU32( m+13 );
+                        DEBUG("got position video plane %d: (%d, %d, %d, %d)",
+                               conn->videoPlane->plane->plane_id,
+                               rectX, rectY, rectW, rectH);
+                        wstVideoFrameManagerUpdateRect( conn->videoPlane->vfm, rectX, rectY, rectW, rectH );
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'R':
+                     {
+                        int num, denom;
+                        pthread_mutex_lock( &gMutex );
+                        num= (int)wstGetU32( m+1 );
+                        denom= (int)wstGetU32( m+5 );
+                        DEBUG("got frame rate video plane %d: (%d / %d)", conn->videoPlane->plane->plane_id, num, denom);
+                        if ( (num > 0) && (denom > 0) )
                         {
-                           int num, denom;
-                           pthread_mutex_lock( &gMutex );
-                           num= (int)wstGetU32( m+1 );
-                           denom= (int)wstGetU32( m+5 );
-                           DEBUG("got frame rate video plane %d: (%d / %d)", conn->videoPlane->plane->plane_id, num, denom);
-                           if ( (num > 0) && (denom > 0) )
+                           conn->videoPlane->frameRateNum= num;
+                           conn->videoPlane->frameRateDenom= denom;
+                           if ( gCtx->autoFRMModeEnabled && conn->videoPlane->frameRateMatchingPlane )
                            {
-                              conn->videoPlane->frameRateNum= num;
-                              conn->videoPlane->frameRateDenom= denom;
-                              if ( gCtx->autoFRMModeEnabled && conn->videoPlane->frameRateMatchingPlane )
-                              {
-                                 wstSelectRate( gCtx, num, denom );
-                              }
+                              wstRequestFrameRate( gCtx, num, denom );
                            }
-                           pthread_mutex_unlock( &gMutex );
                         }
-                        break;
-                     default:
-                        ERROR("got unknown video server message: mlen %d", mlen);
-                        wstDumpMessage( mbody, mlen+3 );
-                        break;
-                  }
+                        pthread_mutex_unlock( &gMutex );
+                     }
+                     break;
+                  case 'V':
+                     {
+                        int version= m[1];
+                        DEBUG("got protocol version %d from video client", version);
+                        pthread_mutex_lock( &conn->mutex );
+                        conn->protocolVersion= ((version < VS_PROTOCOL_VERSION) ? version : VS_PROTOCOL_VERSION);
+                        pthread_mutex_unlock( &conn->mutex );
+                        wstVideoServerSendVersion( conn, VS_PROTOCOL_VERSION );
+                     }
+                     break;
+                  default:
+                     ERROR("got unknown video server message: mlen %d", mlen);
+                     wstDumpMessage( m-3, mlen+3 );
+                     break;
                }
             }
-            else
-            {
-               ERROR("msg bad header");
-               wstDumpMessage( mbody, len );
-               len= 0;
-            }
+         }
+         else
+         {
+            ERROR("msg bad header");
+            wstDumpMessage( m, conn->mbodyLen-moff );
+            moff= conn->mbodyLen;
+            /* The dropped bytes may hold frames the queued fds belong to */
+            wstVideoServerDiscardFds( conn );
          }
       }
-      else
+      if ( moff > 0 )
       {
-         DEBUG("video server peer disconnected");
-         break;
+         conn->mbodyLen -= moff;
+         if ( conn->mbodyLen > 0 )
+         {
+            memmove( conn->mbody, conn->mbody+moff, conn->mbodyLen );
+         }
       }
    }
+   else
+   {
+      DEBUG("video server peer disconnected");
+      result= false;
+   }
+
+   return result;
+}
+
+static void wstVideoServerConnectionClose( VideoServerConnection *conn )
+{
+   int rc;
+
+   wstVideoServerDiscardFds( conn );
 
-exit:
    if ( conn->videoPlane && gCtx )
    {
       pthread_mutex_lock( &gMutex );
+
+      if ( conn->videoPlane->frameRateMatchingPlane && (gCtx->frmModeActive || gCtx->frmRequestPending) )
+      {
+         wstRequestFrameRate( gCtx, 0, 0 );
+      }
+
       pthread_mutex_lock( &gCtx->mutex );
 
       drmModePlane *plane= conn->videoPlane->plane;
       plane->crtc_id= gCtx->enc->crtc_id;
-      DEBUG("wstVideoServerConnectionThread: drmModeSetPlane plane_id %d crtc_id %d", plane->plane_id, plane->crtc_id);
+      DEBUG("wstVideoServerConnectionClose: drmModeSetPlane plane_id %d crtc_id %d", plane->plane_id, plane->crtc_id);
       rc= drmModeSetPlane( gCtx->drmFd,
                            plane->plane_id,
                            plane->crtc_id,
@@ -1712,6 +2691,8 @@ exit:
 
       wstVideoServerFreeBuffers( conn, true );
 
+      wstPlaneLayoutForget( gCtx, conn->videoPlane );
+
       pthread_mutex_unlock( &gCtx->mutex );
 
       if ( conn->videoPlane->vfm )
@@ -1720,28 +2701,42 @@ exit:
          conn->videoPlane->vfm= 0;
       }
 
+      wstVideoFbCachePurge( conn );
+      INFO("video fb cache: hits %u misses %u evictions %u",
+           gCtx->videoFbCacheHits, gCtx->videoFbCacheMisses, gCtx->videoFbCacheEvictions );
+
       wstOverlayFree( &gCtx->overlayPlanes, conn->videoPlane );
       conn->videoPlane= 0;
 
       pthread_mutex_unlock( &gMutex );
    }
+}
 
-   conn->threadStarted= false;
+static void *wstVideoServerConnectionThread( void *arg )
+{
+   VideoServerConnection *conn= (VideoServerConnection*)arg;
 
-   if ( !conn->threadStopRequested )
+   DEBUG("wstVideoServerConnectionThread: enter");
+
+   if ( wstVideoServerConnectionOpen( conn ) )
    {
-      int i;
-      pthread_mutex_lock( &conn->server->server->mutex );
-      for( i= 0; i < MAX_VIDEO_CONNECTIONS; ++i )
+      conn->threadStarted= true;
+      while( !conn->threadStopRequested )
       {
-         if ( conn->server->connections[i] == conn )
+         if ( !wstVideoServerConnectionRead( conn ) )
          {
-            conn->server->connections[i]= 0;
             break;
          }
       }
-      pthread_mutex_unlock( &conn->server->server->mutex );
+   }
+
+   wstVideoServerConnectionClose( conn );
 
+   conn->threadStarted= false;
+
+   if ( !conn->threadStopRequested )
+   {
+      wstVideoServerRemoveConnection( conn->server, conn );
       wstDestroyVideoServerConnection( conn );
    }
 
@@ -1753,57 +2748,59 @@ exit:
 static VideoServerConnection *wstCreateVideoServerConnection( VideoServerCtx *server, int fd )
 {
    VideoServerConnection *conn= 0;
-   int rc;
-   bool error= false;
 
    conn= (VideoServerConnection*)calloc( 1, sizeof(VideoServerConnection) );
    if ( conn )
    {
-      pthread_attr_t attr;
       pthread_mutex_init( &conn->mutex, 0 );
       conn->socketFd= fd;
       conn->server= server;
+      conn->useThread= server->useConnectionThreads;
+   }
 
-      rc= pthread_attr_init( &attr );
-      if ( rc )
-      {
-         ERROR("unable to init pthread attr: errno %d", errno);
-      }
+   return conn;
+}
 
-      rc= pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED);
-      if ( rc )
-      {
-         ERROR("unable to set pthread attr detached: errno %d", errno);
-      }
+static bool wstVideoServerConnectionStartThread( VideoServerConnection *conn )
+{
+   bool result= false;
+   pthread_attr_t attr;
+   int rc;
 
-      rc= pthread_create( &conn->threadId, &attr, wstVideoServerConnectionThread, conn );
-      if ( rc )
-      {
-         ERROR("unable to start video connection thread: rc %d errno %d", rc, errno);
-         error= true;
-         goto exit;
-      }
+   rc= pthread_attr_init( &attr );
+   if ( rc )
+   {
+      ERROR("unable to init pthread attr: errno %d", errno);
    }
 
-exit:
+   rc= pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED);
+   if ( rc )
+   {
+      ERROR("unable to set pthread attr detached: errno %d", errno);
+   }
 
-   if ( error )
+   rc= pthread_create( &conn->threadId, &attr, wstVideoServerConnectionThread, conn );
+   if ( rc )
    {
-      if ( conn )
-      {
-         pthread_mutex_destroy( &conn->mutex );
-         free( conn );
-         conn= 0;
-      }
+      ERROR("unable to start video connection thread: rc %d errno %d", rc, errno);
+      goto exit;
    }
 
-   return conn;
+   result= true;
+
+exit:
+   return result;
 }
 
 static void wstDestroyVideoServerConnection( VideoServerConnection *conn )
 {
    if ( conn )
    {
+      if ( !conn->useThread )
+      {
+         wstVideoServerConnectionClose( conn );
+      }
+
       if ( conn->socketFd >= 0 )
       {
          shutdown( conn->socketFd, SHUT_RDWR );
@@ -1827,78 +2824,163 @@ static void wstDestroyVideoServerConnection( VideoServerConnection *conn )
    }
 }
 
-static void *wstVideoServerThread( void *arg )
+static bool wstVideoServerAddConnection( VideoServerCtx *server, VideoServerConnection *conn )
 {
-   int rc;
-   VideoServerCtx *server= (VideoServerCtx*)arg;
-
-   DEBUG("wstVideoServerThread: enter");
+   bool result= false;
 
-   while( !server->server->threadStopRequested )
+   pthread_mutex_lock( &server->server->mutex );
+   if ( server->connectionCount < server->maxConnections )
    {
-      int fd;
-      struct sockaddr_un addr;
-      socklen_t addrLen= sizeof(addr);
-
-      DEBUG("waiting for connections...");
-      fd= accept4( server->server->socketFd, (struct sockaddr *)&addr, &addrLen, SOCK_CLOEXEC );
-      if ( fd >= 0 )
+      if ( server->connectionCount >= server->connectionCapacity )
       {
-         if ( !server->server->threadStopRequested )
+         VideoServerConnection **connections;
+         int capacity= (server->connectionCapacity ? 2*server->connectionCapacity : CONNECTION_TABLE_INITIAL_SIZE);
+         if ( capacity > server->maxConnections )
          {
-            VideoServerConnection *conn= 0;
-
-            DEBUG("video server received connection: fd %d", fd);
-
-            conn= wstCreateVideoServerConnection( server, fd );
-            if ( conn )
-            {
-               int i;
-               DEBUG("created video server connection %p for fd %d", conn, fd );
-               pthread_mutex_lock( &server->server->mutex );
-               for( i= 0; i < MAX_VIDEO_CONNECTIONS; ++i )
-               {
-                  if ( conn->server->connections[i] == 0 )
-                  {
-                     conn->server->connections[i]= conn;
-                     break;
-                  }
-               }
-               if ( i >= MAX_VIDEO_CONNECTIONS )
-               {
-                  ERROR("too many video connections");
-                  wstDestroyVideoServerConnection( conn );
-               }
-               pthread_mutex_unlock( &server->server->mutex );
-            }
-            else
-            {
-               ERROR("failed to create video server connection for fd %d", fd);
-            }
+            capacity= server->maxConnections;
+         }
+         connections= (VideoServerConnection**)realloc( server->connections, capacity*sizeof(VideoServerConnection*) );
+         if ( connections )
+         {
+            server->connections= connections;
+            server->connectionCapacity= capacity;
          }
          else
          {
-            close( fd );
+            ERROR("No memory for video connection table (capacity %d)", capacity);
          }
       }
-      else
+      if ( server->connectionCount < server->connectionCapacity )
       {
-         usleep( 10000 );
+         server->connections[server->connectionCount++]= conn;
+         result= true;
       }
    }
+   else
+   {
+      ERROR("too many video connections (max %d)", server->maxConnections);
+   }
+   pthread_mutex_unlock( &server->server->mutex );
 
-exit:
-   server->server->threadStarted= false;
-   DEBUG("wstVideoServerThread: exit");
-
-   return 0;
+   return result;
 }
 
-static bool wstInitServiceServer( const char *name, WstServerCtx **newServer )
+static void wstVideoServerRemoveConnection( VideoServerCtx *server, VideoServerConnection *conn )
 {
-   bool result= false;
-   const char *workingDir;
-   int rc, pathNameLen, addressSize;
+   int i;
+
+   pthread_mutex_lock( &server->server->mutex );
+   for( i= 0; i < server->connectionCount; ++i )
+   {
+      if ( server->connections[i] == conn )
+      {
+         server->connections[i]= server->connections[--server->connectionCount];
+         server->connections[server->connectionCount]= 0;
+         break;
+      }
+   }
+   pthread_mutex_unlock( &server->server->mutex );
+}
+
+static void wstVideoServerAccept( VideoServerCtx *server )
+{
+   int fd;
+
+   fd= wstServiceServerAccept( server->server );
+   if ( fd >= 0 )
+   {
+      VideoServerConnection *conn= 0;
+
+      DEBUG("video server received connection: fd %d", fd);
+
+      conn= wstCreateVideoServerConnection( server, fd );
+      if ( conn )
+      {
+         DEBUG("created video server connection %p for fd %d", conn, fd );
+         if ( wstVideoServerAddConnection( server, conn ) )
+         {
+            bool started;
+
+            if ( conn->useThread )
+            {
+               started= wstVideoServerConnectionStartThread( conn );
+            }
+            else
+            {
+               started= wstVideoServerConnectionOpen( conn ) &&
+                        wstServiceServerWatch( server->server, fd, conn );
+            }
+            if ( !started )
+            {
+               wstVideoServerRemoveConnection( server, conn );
+               wstDestroyVideoServerConnection( conn );
+            }
+         }
+         else
+         {
+            wstDestroyVideoServerConnection( conn );
+         }
+      }
+      else
+      {
+         ERROR("failed to create video server connection for fd %d", fd);
+         close( fd );
+      }
+   }
+}
+
+static void *wstVideoServerThread( void *arg )
+{
+   VideoServerCtx *server= (VideoServerCtx*)arg;
+   struct epoll_event events[SERVER_EPOLL_EVENTS];
+   int i, count;
+
+   DEBUG("wstVideoServerThread: enter");
+
+   DEBUG("waiting for connections...");
+   while( !server->server->threadStopRequested )
+   {
+      count= epoll_wait( server->server->epollFd, events, SERVER_EPOLL_EVENTS, -1 );
+      if ( count < 0 )
+      {
+         if ( errno != EINTR )
+         {
+            ERROR("wstVideoServerThread: epoll_wait failed: errno %d", errno);
+            usleep( 10000 );
+         }
+         continue;
+      }
+      for( i= 0; i < count; ++i )
+      {
+         VideoServerConnection *conn= (VideoServerConnection*)events[i].data.ptr;
+         if ( server->server->threadStopRequested || (events[i].data.ptr == server->server) )
+         {
+            break;
+         }
+         if ( !conn )
+         {
+            wstVideoServerAccept( server );
+         }
+         else if ( !wstVideoServerConnectionRead( conn ) )
+         {
+            wstServiceServerUnwatch( server->server, conn->socketFd );
+            wstVideoServerRemoveConnection( server, conn );
+            wstDestroyVideoServerConnection( conn );
+         }
+      }
+   }
+
+   server->server->threadStarted= false;
+   DEBUG("wstVideoServerThread: exit");
+
+   return 0;
+}
+
+static bool wstInitServiceServer( const char *name, WstServerCtx **newServer )
+{
+   bool result= false;
+   const char *workingDir;
+   int rc, pathNameLen, addressSize;
    WstServerCtx *server= 0;
 
    server= (WstServerCtx*)calloc( 1, sizeof(WstServerCtx) );
@@ -1911,6 +2993,8 @@ static bool wstInitServiceServer( const char *name, WstServerCtx **newServer )
    pthread_mutex_init( &server->mutex, 0 );
    server->socketFd= -1;
    server->lockFd= -1;
+   server->epollFd= -1;
+   server->stopFd= -1;
    server->name= name;
 
    ++server->refCnt;
@@ -1979,6 +3063,30 @@ static bool wstInitServiceServer( const char *name, WstServerCtx **newServer )
       goto exit;
    }
 
+   server->epollFd= epoll_create1( EPOLL_CLOEXEC );
+   if ( server->epollFd < 0 )
+   {
+      ERROR("wstInitServiceServer: Error: unable to create epoll: errno %d", errno );
+      goto exit;
+   }
+
+   server->stopFd= eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+   if ( server->stopFd < 0 )
+   {
+      ERROR("wstInitServiceServer: Error: unable to create stop eventfd: errno %d", errno );
+      goto exit;
+   }
+
+   /*
+    * The listening socket is registered with a null pointer, the stop eventfd
+    * with the server and connections with themselves
+    */
+   if ( !wstServiceServerWatch( server, server->socketFd, 0 ) ||
+        !wstServiceServerWatch( server, server->stopFd, server ) )
+   {
+      goto exit;
+   }
+
    *newServer= server;
 
    result= true;
@@ -2015,6 +3123,7 @@ static void wstTermServiceServer( WstServerCtx *server )
       if ( server->threadStarted )
       {
          server->threadStopRequested= true;
+         eventfd_write( server->stopFd, 1 );
          pthread_mutex_unlock( &server->mutex );
          pthread_join( server->threadId, NULL );
          pthread_mutex_lock( &server->mutex );
@@ -2026,6 +3135,18 @@ static void wstTermServiceServer( WstServerCtx *server )
          server->socketFd= -1;
       }
 
+      if ( server->epollFd >= 0 )
+      {
+         close(server->epollFd);
+         server->epollFd= -1;
+      }
+
+      if ( server->stopFd >= 0 )
+      {
+         close(server->stopFd);
+         server->stopFd= -1;
+      }
+
       if ( server->addr.sun_path )
       {
          (void)unlink( server->addr.sun_path );
@@ -2051,6 +3172,59 @@ static void wstTermServiceServer( WstServerCtx *server )
    }
 }
 
+static int wstServiceServerAccept( WstServerCtx *server )
+{
+   int fd;
+   struct sockaddr_un addr;
+   socklen_t addrLen= sizeof(addr);
+
+   fd= accept4( server->socketFd, (struct sockaddr *)&addr, &addrLen, SOCK_CLOEXEC );
+   if ( fd >= 0 )
+   {
+      if ( server->threadStopRequested )
+      {
+         close( fd );
+         fd= -1;
+      }
+   }
+   else
+   {
+      usleep( 10000 );
+   }
+
+   return fd;
+}
+
+static bool wstServiceServerWatch( WstServerCtx *server, int fd, void *ptr )
+{
+   bool result= false;
+   struct epoll_event ev;
+   int rc;
+
+   memset( &ev, 0, sizeof(ev) );
+   ev.events= EPOLLIN;
+   ev.data.ptr= ptr;
+   rc= epoll_ctl( server->epollFd, EPOLL_CTL_ADD, fd, &ev );
+   if ( rc == 0 )
+   {
+      result= true;
+   }
+   else
+   {
+      ERROR("wstServiceServerWatch: epoll_ctl add failed for fd %d: errno %d", fd, errno);
+   }
+
+   return result;
+}
+
+static void wstServiceServerUnwatch( WstServerCtx *server, int fd )
+{
+   if ( fd >= 0 )
+   {
+      epoll_ctl( server->epollFd, EPOLL_CTL_DEL, fd, NULL );
+   }
+}
+
 static bool wstInitVideoServer( VideoServerCtx *server )
 {
    bool result= false;
@@ -2089,7 +3263,7 @@ static void wstTermVideoServer( VideoServerCtx *server )
       wstTermServiceServer( server->server );
       server->server= 0;
 
-      for( i= 0; i < MAX_VIDEO_CONNECTIONS; ++i )
+      for( i= 0; i < server->connectionCount; ++i )
       {
          VideoServerConnection *conn= server->connections[i];
          if ( conn )
@@ -2100,6 +3274,8 @@ static void wstTermVideoServer( VideoServerCtx *server )
             server->connections[i]= 0;
          }
       }
+      server->connectionCount= 0;
+      free( server->connections );
       free( server );
    }
 }
@@ -2238,6 +3414,30 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
                            pthread_mutex_unlock( &gMutex );
                            sprintf( conn->response, "%d: video enable %d", 0, enabled );
                         }
+                        else if ( (tlen == 7) && !strncmp( tok, "fbcache", tlen ) )
+                        {
+                           unsigned int hits, misses, evictions;
+                           pthread_mutex_lock( &gMutex );
+                           hits= gCtx->videoFbCacheHits;
+                           misses= gCtx->videoFbCacheMisses;
+                           evictions= gCtx->videoFbCacheEvictions;
+                           pthread_mutex_unlock( &gMutex );
+                           sprintf( conn->response, "%d: video fbcache size %d hits %u misses %u evictions %u", 0,
+                                    gCtx->videoFbCacheSize, hits, misses, evictions );
+                        }
+                        else if ( (tlen == 6) && !strncmp( tok, "layout", tlen ) )
+                        {
+                           unsigned int hits, tests, failures;
+                           int count;
+                           pthread_mutex_lock( &gMutex );
+                           hits= gCtx->planeLayoutHits;
+                           tests= gCtx->planeLayoutTests;
+                           failures= gCtx->planeLayoutTestFailures;
+                           count= gCtx->planeLayoutCount;
+                           pthread_mutex_unlock( &gMutex );
+                           sprintf( conn->response, "%d: video layout enable %d count %d hits %u tests %u failures %u", 0,
+                                    gCtx->usePlaneTest, count, hits, tests, failures );
+                        }
                      }
                      else
                      {
@@ -2248,6 +3448,13 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
                   {
                      sprintf( conn->response, "%d: auto-frm-mode %d", 0, gCtx->autoFRMModeEnabled );
                   }
+                  else if ( (tlen == 3) && !strncmp( tok, "vrr", tlen) )
+                  {
+                     pthread_mutex_lock( &gMutex );
+                     sprintf( conn->response, "%d: vrr %d capable %d active %d min rate %d", 0,
+                              gCtx->vrrRequested, gCtx->vrrCapable, gCtx->vrrEnabled, gCtx->vrrMinRate );
+                     pthread_mutex_unlock( &gMutex );
+                  }
                   else if ( (tlen == 9) && !strncmp( tok, "zoom-mode", tlen) )
                   {
                      sprintf( conn->response, "%d: zoom-mode %d", 0, gCtx->zoomMode );
@@ -2441,6 +3648,10 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
                         {
                            pthread_mutex_lock( &gMutex );
                            gCtx->autoFRMModeEnabled= value;
+                           if ( !value && gCtx->frmModeActive )
+                           {
+                              wstRequestFrameRate( gCtx, 0, 0 );
+                           }
                            pthread_mutex_unlock( &gMutex );
                            sprintf( conn->response, "%d: auto-frm-mode %d", 0, gCtx->autoFRMModeEnabled );
                         }
@@ -2454,6 +3665,39 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
                         sprintf( conn->response, "%d: %s", -1, "set auto-frm-mode missing argument(s)" );
                      }
                   }
+                  else if ( (tlen == 3) && !strncmp( tok, "vrr", tlen) )
+                  {
+                     tok= strtok_r( 0, " ", &ctx );
+                     if ( tok )
+                     {
+                        int value= -1;
+                        tlen= strlen( tok );
+                        if ( (tlen == 1) && !strncmp( tok, "0", tlen) )
+                        {
+                           value= 0;
+                        }
+                        else if ( (tlen == 1) && !strncmp( tok, "1", tlen) )
+                        {
+                           value= 1;
+                        }
+                        if ( value >= 0 )
+                        {
+                           pthread_mutex_lock( &gMutex );
+                           gCtx->vrrRequested= value;
+                           gCtx->forceDirty= true;
+                           sprintf( conn->response, "%d: vrr %d capable %d", 0, gCtx->vrrRequested, gCtx->vrrCapable );
+                           pthread_mutex_unlock( &gMutex );
+                        }
+                        else
+                        {
+                           sprintf( conn->response, "%d: %s", -1, "set vrr invalid argument(s)" );
+                        }
+                     }
+                     else
+                     {
+                        sprintf( conn->response, "%d: %s", -1, "set vrr missing argument(s)" );
+                     }
+                  }
                   else if ( (tlen == 9) && !strncmp( tok, "zoom-mode", tlen) )
                   {
                      tok= strtok_r( 0, " ", &ctx );
@@ -2501,6 +3745,58 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
                }
                break;
             }
+            else if ( (tlen == 5) && !strncmp( tok, "trace", tlen ) )
+            {
+               tok= strtok_r( 0, " ", &ctx );
+               if ( tok )
+               {
+                  tlen= strlen( tok );
+                  if ( (tlen == 4) && !strncmp( tok, "dump", tlen ) )
+                  {
+                     const char *workingDir= getenv("XDG_RUNTIME_DIR");
+                     char path[TRACE_PATH_MAX];
+                     int eventCount= 0;
+                     if ( workingDir &&
+                          (snprintf( path, sizeof(path), "%s/westeros-trace-%d.json", workingDir, (int)getpid() ) < (int)sizeof(path)) )
+                     {
+                        if ( wstTraceDump( path, &eventCount ) )
+                        {
+                           sprintf( conn->response, "%d: trace dump %d events %s", 0, eventCount, path );
+                        }
+                        else
+                        {
+                           sprintf( conn->response, "%d: %s", -1, "trace dump failed" );
+                        }
+                     }
+                     else
+                     {
+                        sprintf( conn->response, "%d: %s", -1, "trace dump no runtime dir" );
+                     }
+                  }
+                  else if ( (tlen == 6) && !strncmp( tok, "enable", tlen ) )
+                  {
+                     tok= strtok_r( 0, " ", &ctx );
+                     if ( tok )
+                     {
+                        gTraceEnabled= (atoi( tok ) > 0 ? true : false);
+                        sprintf( conn->response, "%d: trace enable %d", 0, gTraceEnabled );
+                     }
+                     else
+                     {
+                        sprintf( conn->response, "%d: %s", -1, "trace enable missing argument(s)" );
+                     }
+                  }
+                  else
+                  {
+                     sprintf( conn->response, "%d: %s", -1, "trace bad argument(s)" );
+                  }
+               }
+               else
+               {
+                  sprintf( conn->response, "%d: %s", -1, "trace missing argument(s)" );
+               }
+               break;
+            }
             else
             {
                sprintf( conn->response, "%d: %s", -1, "unknown cmd" );
@@ -2516,144 +3812,81 @@ static void wstDisplayServerProcessMessage( DisplayServerConnection *conn, int m
    wstDisplayServerSendResponse( conn );
 }
 
-static void *wstDisplayServerConnectionThread( void *arg )
+static bool wstDisplayServerConnectionRead( DisplayServerConnection *conn )
 {
-   DisplayServerConnection *conn= (DisplayServerConnection*)arg;
+   bool result= true;
    struct msghdr msg;
    struct iovec iov[1];
    unsigned char mbody[256+3];
    int len;
 
-   DEBUG("wstDisplayServerConnectionThread: enter");
-
-   conn->threadStarted= true;
-   while( !conn->threadStopRequested )
-   {
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= sizeof(mbody);
+   iov[0].iov_base= (char*)mbody;
+   iov[0].iov_len= sizeof(mbody);
 
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
+   msg.msg_name= NULL;
+   msg.msg_namelen= 0;
+   msg.msg_iov= iov;
+   msg.msg_iovlen= 1;
+   msg.msg_control= 0;
+   msg.msg_controllen= 0;
+   msg.msg_flags= 0;
 
-      do
-      {
-         len= recvmsg( conn->socketFd, &msg, 0 );
-      }
-      while ( (len < 0) && (errno == EINTR));
+   do
+   {
+      len= recvmsg( conn->socketFd, &msg, 0 );
+   }
+   while ( (len < 0) && (errno == EINTR));
 
-      if ( len > 0 )
+   if ( len > 0 )
+   {
+      unsigned char *m= mbody;
+      while ( len >= 4 )
       {
-         unsigned char *m= mbody;
-         while ( len >= 4 )
+         if ( (m[0] == 'D') && (m[1] == 'S') )
          {
-            if ( (m[0] == 'D') && (m[1] == 'S') )
+            int mlen;
+            mlen= m[2];
+            if ( len >= (mlen+3) )
             {
-               int mlen, id;
-               mlen= m[2];
-               if ( len >= (mlen+3) )
-               {
-                  wstDisplayServerProcessMessage( conn, mlen, m+3 );
+               wstDisplayServerProcessMessage( conn, mlen, m+3 );
 
-                  m += (mlen+3);
-                  len -= (mlen+3);
-               }
-               else
-               {
-                  len= 0;
-               }
+               m += (mlen+3);
+               len -= (mlen+3);
             }
             else
             {
                len= 0;
             }
          }
-      }
-      else
-      {
-         DEBUG("display server peer disconnected");
-         break;
-      }
-
-      usleep( 10000 );
-   }
-
-   conn->threadStarted= false;
-
-   if ( !conn->threadStopRequested )
-   {
-      int i;
-      pthread_mutex_lock( &conn->server->server->mutex );
-      for( i= 0; i < MAX_DISPLAY_CONNECTIONS; ++i )
-      {
-         if ( conn->server->connections[i] == conn )
+         else
          {
-            conn->server->connections[i]= 0;
-            break;
+            len= 0;
          }
       }
-      pthread_mutex_unlock( &conn->server->server->mutex );
-
-      wstDestroyDisplayServerConnection( conn );
    }
-   DEBUG("wstDisplayServerConnectionThread: exit");
+   else
+   {
+      DEBUG("display server peer disconnected");
+      result= false;
+   }
 
-   return 0;
+   return result;
 }
 
 static DisplayServerConnection *wstCreateDisplayServerConnection( DisplayServerCtx *server, int fd )
 {
    DisplayServerConnection *conn= 0;
-   int rc;
-   bool error= false;
 
    conn= (DisplayServerConnection*)calloc( 1, sizeof(DisplayServerConnection) );
    if ( conn )
    {
-      pthread_attr_t attr;
       pthread_mutex_init( &conn->mutex, 0 );
       conn->socketFd= fd;
       conn->server= server;
+   }
 
-      rc= pthread_attr_init( &attr );
-      if ( rc )
-      {
-         ERROR("unable to init pthread attr: errno %d", errno);
-      }
-
-      rc= pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED);
-      if ( rc )
-      {
-         ERROR("unable to set pthread attr detached: errno %d", errno);
-      }
-
-      rc= pthread_create( &conn->threadId, &attr, wstDisplayServerConnectionThread, conn );
-      if ( rc )
-      {
-         ERROR("unable to start display connection thread: rc %d errno %d", rc, errno);
-         error= true;
-         goto exit;
-      }
-   }
-
-exit:
-
-   if ( error )
-   {
-      if ( conn )
-      {
-         pthread_mutex_destroy( &conn->mutex );
-         free( conn );
-         conn= 0;
-      }
-   }
-
-   return conn;
-}
+   return conn;
+}
 
 static void wstDestroyDisplayServerConnection( DisplayServerConnection *conn )
 {
@@ -2670,79 +3903,147 @@ static void wstDestroyDisplayServerConnection( DisplayServerConnection *conn )
          conn->socketFd= -1;
       }
 
-      if ( conn->threadStarted )
-      {
-         conn->threadStopRequested= true;
-         pthread_join( conn->threadId, NULL );
-      }
-
       pthread_mutex_destroy( &conn->mutex );
 
       free( conn );
    }
 }
 
-static void *wstDisplayServerThread( void *arg )
+static bool wstDisplayServerAddConnection( DisplayServerCtx *server, DisplayServerConnection *conn )
 {
-   int rc;
-   DisplayServerCtx *server= (DisplayServerCtx*)arg;
-
-   DEBUG("wstDisplayServerThread: enter");
+   bool result= false;
 
-   while( !server->server->threadStopRequested )
+   pthread_mutex_lock( &server->server->mutex );
+   if ( server->connectionCount < server->maxConnections )
    {
-      int fd;
-      struct sockaddr_un addr;
-      socklen_t addrLen= sizeof(addr);
-
-      DEBUG("waiting for connections...");
-      fd= accept4( server->server->socketFd, (struct sockaddr *)&addr, &addrLen, SOCK_CLOEXEC );
-      if ( fd >= 0 )
+      if ( server->connectionCount >= server->connectionCapacity )
       {
-         if ( !server->server->threadStopRequested )
+         DisplayServerConnection **connections;
+         int capacity= (server->connectionCapacity ? 2*server->connectionCapacity : CONNECTION_TABLE_INITIAL_SIZE);
+         if ( capacity > server->maxConnections )
+         {
+            capacity= server->maxConnections;
+         }
+         connections= (DisplayServerConnection**)realloc( server->connections, capacity*sizeof(DisplayServerConnection*) );
+         if ( connections )
+         {
+            server->connections= connections;
+            server->connectionCapacity= capacity;
+         }
+         else
          {
-            DisplayServerConnection *conn= 0;
+            ERROR("No memory for display connection table (capacity %d)", capacity);
+         }
+      }
+      if ( server->connectionCount < server->connectionCapacity )
+      {
+         server->connections[server->connectionCount++]= conn;
+         result= true;
+      }
+   }
+   else
+   {
+      ERROR("too many display connections (max %d)", server->maxConnections);
+   }
+   pthread_mutex_unlock( &server->server->mutex );
+
+   return result;
+}
 
-            DEBUG("display server received connection: fd %d", fd);
+static void wstDisplayServerRemoveConnection( DisplayServerCtx *server, DisplayServerConnection *conn )
+{
+   int i;
 
-            conn= wstCreateDisplayServerConnection( server, fd );
-            if ( conn )
-            {
-               int i;
-               DEBUG("created display server connection %p for fd %d", conn, fd );
-               pthread_mutex_lock( &server->server->mutex );
-               for( i= 0; i < MAX_DISPLAY_CONNECTIONS; ++i )
-               {
-                  if ( conn->server->connections[i] == 0 )
-                  {
-                     conn->server->connections[i]= conn;
-                     break;
-                  }
-               }
-               if ( i >= MAX_DISPLAY_CONNECTIONS )
-               {
-                  ERROR("too many display connections");
-                  wstDestroyDisplayServerConnection( conn );
-               }
-               pthread_mutex_unlock( &server->server->mutex );
-            }
-            else
+   pthread_mutex_lock( &server->server->mutex );
+   for( i= 0; i < server->connectionCount; ++i )
+   {
+      if ( server->connections[i] == conn )
+      {
+         server->connections[i]= server->connections[--server->connectionCount];
+         server->connections[server->connectionCount]= 0;
+         break;
+      }
+   }
+   pthread_mutex_unlock( &server->server->mutex );
+}
+
+static void wstDisplayServerAccept( DisplayServerCtx *server )
+{
+   int fd;
+
+   fd= wstServiceServerAccept( server->server );
+   if ( fd >= 0 )
+   {
+      DisplayServerConnection *conn= 0;
+
+      DEBUG("display server received connection: fd %d", fd);
+
+      conn= wstCreateDisplayServerConnection( server, fd );
+      if ( conn )
+      {
+         DEBUG("created display server connection %p for fd %d", conn, fd );
+         if ( wstDisplayServerAddConnection( server, conn ) )
+         {
+            if ( !wstServiceServerWatch( server->server, fd, conn ) )
             {
-               ERROR("failed to create video server connection for fd %d", fd);
+               wstDisplayServerRemoveConnection( server, conn );
+               wstDestroyDisplayServerConnection( conn );
             }
          }
          else
          {
-            close( fd );
+            wstDestroyDisplayServerConnection( conn );
          }
       }
       else
       {
-         usleep( 10000 );
+         ERROR("failed to create display server connection for fd %d", fd);
+         close( fd );
+      }
+   }
+}
+
+static void *wstDisplayServerThread( void *arg )
+{
+   DisplayServerCtx *server= (DisplayServerCtx*)arg;
+   struct epoll_event events[SERVER_EPOLL_EVENTS];
+   int i, count;
+
+   DEBUG("wstDisplayServerThread: enter");
+
+   DEBUG("waiting for connections...");
+   while( !server->server->threadStopRequested )
+   {
+      count= epoll_wait( server->server->epollFd, events, SERVER_EPOLL_EVENTS, -1 );
+      if ( count < 0 )
+      {
+         if ( errno != EINTR )
+         {
+            ERROR("wstDisplayServerThread: epoll_wait failed: errno %d", errno);
+            usleep( 10000 );
+         }
+         continue;
+      }
+      for( i= 0; i < count; ++i )
+      {
+         DisplayServerConnection *conn= (DisplayServerConnection*)events[i].data.ptr;
+         if ( server->server->threadStopRequested || (events[i].data.ptr == server->server) )
+         {
+            break;
+         }
+         if ( !conn )
+         {
+            wstDisplayServerAccept( server );
+         }
+         else if ( !wstDisplayServerConnectionRead( conn ) )
+         {
+            wstServiceServerUnwatch( server->server, conn->socketFd );
+            wstDisplayServerRemoveConnection( server, conn );
+            wstDestroyDisplayServerConnection( conn );
+         }
       }
    }
 
-exit:
    server->server->threadStarted= false;
    DEBUG("wstDisplayServerThread: exit");
 
@@ -2782,6 +4083,14 @@ static void wstTermDisplayServer( DisplayServerCtx *server )
 
       wstTermServiceServer( server->server );
       server->server= 0;
+
+      for( i= 0; i < server->connectionCount; ++i )
+      {
+         wstDestroyDisplayServerConnection( server->connections[i] );
+         server->connections[i]= 0;
+      }
+      server->connectionCount= 0;
+      free( server->connections );
       free( server );
    }
 }
@@ -2790,23 +4099,22 @@ static void wstDestroyVideoFrameManager( VideoFrameManager *vfm )
 {
    if ( vfm )
    {
+      int i, count;
+
       #ifdef WESTEROS_GL_AVSYNC
       wstAVSyncTerm( vfm );
       #endif
 
-      if ( vfm->queue )
+      count= wstVideoFrameManagerCount( vfm );
+      for( i= 0; i < count; ++i )
       {
-         int i;
-         for( i= 0; i < vfm->queueSize; ++i )
+         VideoFrame *f= wstVideoFrameManagerAt( vfm, i );
+         if ( vfm->bufferIdCurrent != f->bufferId )
          {
-            if ( vfm->bufferIdCurrent != vfm->queue[i].bufferId )
-            {
-               wstFreeVideoFrameResources( &vfm->queue[i] );
-               wstVideoServerSendBufferRelease( vfm->conn, vfm->queue[i].bufferId );
-            }
+            wstVideoFrameManagerRelease( vfm, f );
          }
-         free( vfm->queue );
       }
+      wstVideoFrameManagerFlushReleases( vfm );
       free( vfm );
    }
 }
@@ -2814,42 +4122,76 @@ static void wstDestroyVideoFrameManager( VideoFrameManager *vfm )
 static VideoFrameManager *wstCreateVideoFrameManager( VideoServerConnection *conn )
 {
    VideoFrameManager *vfm= 0;
-   bool error= false;
 
    vfm= (VideoFrameManager*)calloc( 1, sizeof(VideoFrameManager) );
    if ( vfm )
    {
-      int i;
-
       vfm->conn= conn;
-      vfm->queue= (VideoFrame*)calloc( VFM_QUEUE_CAPACITY, sizeof(VideoFrame) );
-      if ( !vfm->queue )
-      {
-         ERROR("No memory for vfm frame queue (capacity %d)", VFM_QUEUE_CAPACITY);
-         error= true;
-         goto exit;
-      }
-
-      vfm->queueCapacity= VFM_QUEUE_CAPACITY;
-      vfm->queueSize= 0;
+      vfm->queueHead= 0;
+      vfm->queueTail= 0;
       vfm->bufferIdCurrent= -1;
       vfm->syncSession= -1;
+   }
+   else
+   {
+      ERROR("No memory for vfm (queue capacity %d)", VFM_QUEUE_CAPACITY);
+   }
 
-      for( i= 0; i < vfm->queueCapacity; ++i )
-      {
-         vfm->queue[i].fd0= -1;
-         vfm->queue[i].fd1= -1;
-         vfm->queue[i].fd2= -1;
-         vfm->queue[i].bufferId= -1;
-      }
+   return vfm;
+}
+
+static int wstVideoFrameManagerCount( VideoFrameManager *vfm )
+{
+   return (int)(__atomic_load_n( &vfm->queueTail, __ATOMIC_ACQUIRE ) - vfm->queueHead);
+}
+
+static VideoFrame* wstVideoFrameManagerAt( VideoFrameManager *vfm, int i )
+{
+   return &vfm->queue[(vfm->queueHead+i) & (VFM_QUEUE_CAPACITY-1)];
+}
+
+/*
+ * Remove entry i by moving the entries ahead of it up one slot and advancing
+ * the head.  Entries are only removed near the head so at most a frame or two
+ * is moved.  Consumer side only.
+ */
+static void wstVideoFrameManagerRemove( VideoFrameManager *vfm, int i )
+{
+   for( ; i > 0; --i )
+   {
+      *wstVideoFrameManagerAt( vfm, i )= *wstVideoFrameManagerAt( vfm, i-1 );
    }
+   __atomic_store_n( &vfm->queueHead, vfm->queueHead+1, __ATOMIC_RELEASE );
+}
 
-exit:
-   if ( error )
+/*
+ * Frames removed from the queue are collected and their resources freed and
+ * buffers returned to the client together by wstVideoFrameManagerFlushReleases.
+ */
+static void wstVideoFrameManagerRelease( VideoFrameManager *vfm, VideoFrame *f )
+{
+   if ( vfm->releaseCount >= VFM_RELEASE_BATCH )
    {
-      wstDestroyVideoFrameManager( vfm );
+      wstVideoFrameManagerFlushReleases( vfm );
+   }
+   vfm->release[vfm->releaseCount++]= *f;
+}
+
+static void wstVideoFrameManagerFlushReleases( VideoFrameManager *vfm )
+{
+   int bufferIds[VFM_RELEASE_BATCH];
+   int i;
+
+   if ( vfm->releaseCount )
+   {
+      for( i= 0; i < vfm->releaseCount; ++i )
+      {
+         wstFreeVideoFrameResources( &vfm->release[i] );
+         bufferIds[i]= vfm->release[i].bufferId;
+      }
+      wstVideoServerSendBufferReleases( vfm->conn, bufferIds, vfm->releaseCount );
+      vfm->releaseCount= 0;
    }
-   return vfm;
 }
 
 static void wstVideoFrameManagerSetSyncType( VideoFrameManager *vfm, int type )
@@ -2864,45 +4206,30 @@ static void wstVideoFrameManagerSetSyncType( VideoFrameManager *vfm, int type )
 
 static void wstVideoFrameManagerUpdateRect( VideoFrameManager *vfm, int rectX, int rectY, int rectW, int rectH )
 {
-   int i;
-   for( i= 0; i < vfm->queueSize; ++i )
+   int i, count;
+   count= wstVideoFrameManagerCount( vfm );
+   for( i= 0; i < count; ++i )
    {
-      VideoFrame *vf= &vfm->queue[i];
+      VideoFrame *vf= wstVideoFrameManagerAt( vfm, i );
       wstSetVideoFrameRect( vf, rectX, rectY, rectW, rectH, NULL, NULL );
    }
 }
 
 static void wstVideoFrameManagerPushFrame( VideoFrameManager *vfm, VideoFrame *f )
 {
-   if ( vfm->queueSize+1 > vfm->queueCapacity )
+   unsigned int tail= vfm->queueTail;
+
+   if ( tail - __atomic_load_n( &vfm->queueHead, __ATOMIC_ACQUIRE ) >= VFM_QUEUE_CAPACITY )
    {
-      int newCapacity= 2*vfm->queueCapacity+1;
-      VideoFrame *newQueue= (VideoFrame*)calloc( newCapacity, sizeof(VideoFrame) );
-      if ( newQueue )
-      {
-         int i;
-         memcpy( newQueue, vfm->queue, vfm->queueSize*sizeof(VideoFrame) );
-         for( i= vfm->queueSize; i < newCapacity; ++i )
-         {
-            newQueue[i].fd0= -1;
-            newQueue[i].fd1= -1;
-            newQueue[i].fd2= -1;
-            newQueue[i].bufferId= -1;
-         }
-         FRAME("vfm expand queue capacity from %d to %d", vfm->queueCapacity, newCapacity);
-         free( vfm->queue );
-         vfm->queue= newQueue;
-         vfm->queueCapacity= newCapacity;
-      }
-      else
-      {
-         ERROR("vfm queue full: no memory to expand, dropping frame");
-         wstFreeVideoFrameResources( f );
-         return;
-      }
+      WARNING("vfm queue full: dropping frame %d buffer %d", f->frameNumber, f->bufferId);
+      wstFreeVideoFrameResources( f );
+      wstVideoServerSendBufferRelease( vfm->conn, f->bufferId );
+      __atomic_add_fetch( &vfm->pushDropCount, 1, __ATOMIC_RELEASE );
+      return;
    }
 
    FRAME("vfm push frame %d bufferId %d", f->frameNumber, f->bufferId);
+   wstTrace( TRACE_VFM_PUSH, f->frameNumber, f->bufferId, f->frameTime );
 
    #ifdef WESTEROS_GL_AVSYNC
    if ( !vfm->syncInit )
@@ -2916,7 +4243,8 @@ static void wstVideoFrameManagerPushFrame( VideoFrameManager *vfm, VideoFrame *f
    }
    #endif
 
-   vfm->queue[vfm->queueSize++]= *f;
+   vfm->queue[tail & (VFM_QUEUE_CAPACITY-1)]= *f;
+   __atomic_store_n( &vfm->queueTail, tail+1, __ATOMIC_RELEASE );
 }
 
 #define EXPIRELIMIT (83000)
@@ -2924,6 +4252,15 @@ static void wstVideoFrameManagerPushFrame( VideoFrameManager *vfm, VideoFrame *f
 static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
 {
    VideoFrame *f= 0;
+   int pushDropCount, dropCount= 0;
+
+   pushDropCount= __atomic_load_n( &vfm->pushDropCount, __ATOMIC_ACQUIRE );
+   if ( pushDropCount != vfm->pushDropCountSeen )
+   {
+      dropCount += (pushDropCount-vfm->pushDropCountSeen);
+      vfm->pushDropCountSeen= pushDropCount;
+   }
+
    #ifdef WESTEROS_GL_AVSYNC
    if ( vfm->sync )
    {
@@ -2941,17 +4278,18 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
          if ( f->canExpire && (vfm->vblankTime - vfm->flipTimeCurrent) > EXPIRELIMIT )
          {
             bool underflow= false;
-            if  ( vfm->queueSize <= 1 )
+            int count= wstVideoFrameManagerCount( vfm );
+            if  ( count <= 1 )
             {
                DEBUG("underflow: frame expired, queue size 1");
                underflow= true;
             }
             else
             {
-               long long frameGap= vfm->queue[1].frameTime - vfm->queue[0].frameTime;
+               long long frameGap= wstVideoFrameManagerAt( vfm, 1 )->frameTime - wstVideoFrameManagerAt( vfm, 0 )->frameTime;
                if ( frameGap > EXPIRELIMIT )
                {
-                  DEBUG("underflow: frame expired, queue size %d gap %lld us", vfm->queueSize, frameGap );
+                  DEBUG("underflow: frame expired, queue size %d gap %lld us", count, frameGap );
                   underflow= true;
                }
             }
@@ -2961,9 +4299,9 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
             }
          }
       }
-      else if ( vfm->paused && vfm->frameAdvance && (vfm->bufferIdCurrent == -1) && vfm->queueSize )
+      else if ( vfm->paused && vfm->frameAdvance && (vfm->bufferIdCurrent == -1) && wstVideoFrameManagerCount( vfm ) )
       {
-         f= &vfm->queue[0];
+         f= wstVideoFrameManagerAt( vfm, 0 );
          f->canExpire= false;
          vfm->frameAdvance= false;
       }
@@ -2972,20 +4310,21 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
    #endif
    if ( !vfm->paused || vfm->frameAdvance )
    {
-      int i;
-      if ( (vfm->queueSize && vfm->flipTimeBase) || (vfm->queueSize > 2) || vfm->frameAdvance )
+      int i, count;
+      count= wstVideoFrameManagerCount( vfm );
+      if ( (count && vfm->flipTimeBase) || (count > 2) || vfm->frameAdvance )
       {
          long long flipTime;
          if ( vfm->flipTimeBase == 0)
          {
             vfm->flipTimeBase= vfm->vblankTime;
-            vfm->frameTimeBase= vfm->queue[0].frameTime;
+            vfm->frameTimeBase= wstVideoFrameManagerAt( vfm, 0 )->frameTime;
             FRAME("set base: flipTimeBase %lld frameTimeBase %lld", vfm->flipTimeBase, vfm->frameTimeBase);
          }
          i= 0;
-         while ( i < vfm->queueSize )
+         while ( i < count )
          {
-            VideoFrame *fCheck= &vfm->queue[i];
+            VideoFrame *fCheck= wstVideoFrameManagerAt( vfm, i );
             flipTime= (fCheck->frameTime - vfm->frameTimeBase) + vfm->flipTimeBase;
             FRAME("i %d flipTime %lld flipTimeCurrent %lld frameTimeCurrent %lld frameTime %lld frameTimeBase %lld flipTimeBase %lld frameAdvance %d",
                   i, flipTime, vfm->flipTimeCurrent, vfm->frameTimeCurrent, fCheck->frameTime, vfm->frameTimeBase, vfm->flipTimeBase, vfm->frameAdvance);
@@ -3004,24 +4343,22 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
                   if ( i > 0 )
                   {
                      FRAME("  drop frame %d buffer %d", fCheck->frameNumber, fCheck->bufferId);
-                     vfm->dropFrameCount += 1;
-                  }
-                  wstFreeVideoFrameResources( fCheck );
-                  wstVideoServerSendBufferRelease( vfm->conn, fCheck->bufferId );
-                  if ( vfm->queueSize > i+1 )
-                  {
-                     memmove( &vfm->queue[i], &vfm->queue[i+1], (vfm->queueSize-(i+1))*sizeof(VideoFrame) );
+                     wstTrace( TRACE_VFM_DROP, fCheck->frameNumber, fCheck->bufferId, fCheck->frameTime );
+                     dropCount += 1;
                   }
-                  --vfm->queueSize;
+                  wstVideoFrameManagerRelease( vfm, fCheck );
+                  wstVideoFrameManagerRemove( vfm, i );
+                  count= wstVideoFrameManagerCount( vfm );
                   f= 0;
                   continue;
                }
                if ( i > 0 )
                {
-                  memmove( &vfm->queue[0], &vfm->queue[1], (vfm->queueSize-1)*sizeof(VideoFrame) );
-                  --vfm->queueSize;
+                  /* The head frame has been displayed and is released along with the plane's buffers */
+                  wstVideoFrameManagerRemove( vfm, 0 );
+                  count= wstVideoFrameManagerCount( vfm );
                   i= 0;
-                  f= &vfm->queue[0];
+                  f= wstVideoFrameManagerAt( vfm, 0 );
                }
                else
                {
@@ -3030,6 +4367,7 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
                if ( f->bufferId != vfm->bufferIdCurrent )
                {
                   FRAME("  time to flip frame %d buffer %d", f->frameNumber, f->bufferId);
+                  wstTrace( TRACE_VFM_FLIP, f->frameNumber, f->bufferId, f->frameTime );
                   f->canExpire= !vfm->frameAdvance;
                   vfm->adjust= ((vfm->flipTimeCurrent != 0) ? (vfm->vblankInterval-(f->frameTime-vfm->frameTimeCurrent)) : 0);
                   vfm->flipTimeCurrent= flipTime;
@@ -3043,6 +4381,8 @@ static VideoFrame* wstVideoFrameManagerPopFrame( VideoFrameManager *vfm )
       }
    }
 done:
+   vfm->dropFrameCount += dropCount;
+   wstVideoFrameManagerFlushReleases( vfm );
    if ( !f && !vfm->paused && (vfm->bufferIdCurrent != -1) && !vfm->underflowReported &&
         vfm->conn && vfm->conn->videoPlane && vfm->conn->videoPlane && (vfm->conn->videoPlane->videoFrame[FRAME_CURR].bufferId != -1) )
    {
@@ -3057,6 +4397,48 @@ done:
    return f;
 }
 
+/*
+ * Return the time the next new frame is due to be flipped, 0 if one is due
+ * now, or -1 if unknown.  Consumer side only; the queue is not modified.
+ */
+static long long wstVideoFrameManagerNextFlipTime( VideoFrameManager *vfm )
+{
+   long long flipTime= -1LL;
+   int i, count;
+
+   #ifdef WESTEROS_GL_AVSYNC
+   if ( vfm->sync )
+   {
+      goto exit;
+   }
+   #endif
+   if ( vfm->paused && !vfm->frameAdvance )
+   {
+      goto exit;
+   }
+   count= wstVideoFrameManagerCount( vfm );
+   if ( vfm->frameAdvance || (!vfm->flipTimeBase && (count > 2)) )
+   {
+      flipTime= 0;
+      goto exit;
+   }
+   if ( vfm->flipTimeBase )
+   {
+      for( i= 0; i < count; ++i )
+      {
+         VideoFrame *f= wstVideoFrameManagerAt( vfm, i );
+         if ( f->bufferId != vfm->bufferIdCurrent )
+         {
+            flipTime= (f->frameTime - vfm->frameTimeBase) + vfm->flipTimeBase;
+            break;
+         }
+      }
+   }
+
+exit:
+   return flipTime;
+}
+
 static void wstVideoFrameManagerPause( VideoFrameManager *vfm, bool pause )
 {
    FRAME("set pause: %d", pause);
@@ -3264,6 +4646,44 @@ static bool wstAcquireCrtcProperties( WstGLCtx *ctx )
    return !error;
 }
 
+/*
+ * Variable refresh needs a connector reporting vrr_capable and a crtc with a
+ * VRR_ENABLED property.  Commit pacing relies on flip events.
+ */
+static void wstUpdateVRRCapability( WstGLCtx *ctx )
+{
+   bool connectorCapable= false;
+   bool crtcCapable= false;
+   int i;
+
+   if ( ctx->haveAtomic && ctx->useFlipEvents && ctx->connectorProps && ctx->crtcProps )
+   {
+      for( i= 0; i < ctx->connectorProps->count_props; ++i )
+      {
+         if ( !strcmp( ctx->connectorPropRes[i]->name, "vrr_capable" ) )
+         {
+            connectorCapable= (ctx->connectorProps->prop_values[i] != 0);
+            break;
+         }
+      }
+      for( i= 0; i < ctx->crtcProps->count_props; ++i )
+      {
+         if ( !strcmp( ctx->crtcPropRes[i]->name, "VRR_ENABLED" ) )
+         {
+            crtcCapable= true;
+            break;
+         }
+      }
+   }
+
+   ctx->vrrCapable= (connectorCapable && crtcCapable);
+   if ( !ctx->vrrCapable && ctx->vrrEnabled )
+   {
+      ctx->vrrEnabled= false;
+   }
+   INFO("westeros-gl: vrr capable %d (connector %d crtc %d)", ctx->vrrCapable, connectorCapable, crtcCapable);
+}
+
 static void wstReleasePlaneProperties( WstGLCtx *ctx, WstOverlayPlane *plane )
 {
    int i;
@@ -3588,12 +5008,71 @@ static WstGLCtx *wstInitCtx( void )
          INFO("westeros-gl: no vblank");
          ctx->useVBlank= false;
       }
+      if ( getenv("WESTEROS_GL_USE_FLIP_EVENTS") )
+      {
+         ctx->useFlipEvents= true;
+      }
+      INFO("westeros-gl: use flip events: %d", ctx->useFlipEvents);
+      ctx->usePlaneTest= true;
+      if ( getenv("WESTEROS_GL_NO_PLANE_TEST") )
+      {
+         INFO("westeros-gl: no plane test commits");
+         ctx->usePlaneTest= false;
+      }
       env= getenv("WESTEROS_SECURE_GRAPHICS");
       if ( env && atoi(env) )
       {
          ctx->secureGraphics= true;
       }
       INFO("westeros-gl: secure graphics: %d", ctx->secureGraphics);
+      ctx->videoFbCacheSize= VIDEO_FB_CACHE_SIZE;
+      env= getenv("WESTEROS_GL_VIDEO_FB_CACHE_SIZE");
+      if ( env )
+      {
+         ctx->videoFbCacheSize= atoi(env);
+      }
+      INFO("westeros-gl: video fb cache size: %d", ctx->videoFbCacheSize);
+      if ( getenv("WESTEROS_GL_AUTO_FRM_MODE") )
+      {
+         ctx->autoFRMModeEnabled= true;
+      }
+      ctx->frmDelay= DEFAULT_FRM_DELAY;
+      env= getenv("WESTEROS_GL_FRM_DELAY");
+      if ( env && (atoi(env) >= 0) )
+      {
+         ctx->frmDelay= atoi(env);
+      }
+      INFO("westeros-gl: auto frm mode: %d delay %d ms", ctx->autoFRMModeEnabled, ctx->frmDelay);
+      if ( getenv("WESTEROS_GL_VRR") )
+      {
+         ctx->vrrRequested= true;
+      }
+      ctx->vrrMinRate= DEFAULT_VRR_MIN_RATE;
+      env= getenv("WESTEROS_GL_VRR_MIN_RATE");
+      if ( env && (atoi(env) > 0) )
+      {
+         ctx->vrrMinRate= atoi(env);
+      }
+      INFO("westeros-gl: vrr requested %d min rate %d", ctx->vrrRequested, ctx->vrrMinRate);
+      ctx->maxVideoConnections= DEFAULT_MAX_VIDEO_CONNECTIONS;
+      env= getenv("WESTEROS_GL_MAX_VIDEO_CONNECTIONS");
+      if ( env && (atoi(env) > 0) )
+      {
+         ctx->maxVideoConnections= atoi(env);
+      }
+      ctx->maxDisplayConnections= DEFAULT_MAX_DISPLAY_CONNECTIONS;
+      env= getenv("WESTEROS_GL_MAX_DISPLAY_CONNECTIONS");
+      if ( env && (atoi(env) > 0) )
+      {
+         ctx->maxDisplayConnections= atoi(env);
+      }
+      ctx->useVideoConnectionThreads= true;
+      if ( getenv("WESTEROS_GL_NO_VIDEO_CONNECTION_THREADS") )
+      {
+         ctx->useVideoConnectionThreads= false;
+      }
+      INFO("westeros-gl: max connections: video %d display %d video connection threads %d",
+           ctx->maxVideoConnections, ctx->maxDisplayConnections, ctx->useVideoConnectionThreads );
       #if (defined DRM_USE_OUT_FENCE || defined DRM_USE_NATIVE_FENCE)
       ctx->nativeOutputFenceFd= -1;
       #endif
@@ -3793,6 +5272,7 @@ static WstGLCtx *wstInitCtx( void )
          wstReleaseConnectorProperties( ctx );
          wstReleaseCrtcProperties( ctx );
       }
+      wstUpdateVRRCapability( ctx );
 
       #ifndef WESTEROS_GL_NO_PLANES
       if ( ctx->usePlanes && (crtc_idx >= 0) )
@@ -3964,6 +5444,7 @@ static WstGLCtx *wstInitCtx( void )
             gDisplayServer= (DisplayServerCtx*)calloc( 1, sizeof(DisplayServerCtx) );
             if ( gDisplayServer )
             {
+               gDisplayServer->maxConnections= ctx->maxDisplayConnections;
                if ( !wstInitDisplayServer( gDisplayServer ) )
                {
                   ERROR("wstInitCtx: failed to initialize display server");
@@ -3980,6 +5461,8 @@ static WstGLCtx *wstInitCtx( void )
                gVideoServer= (VideoServerCtx*)calloc( 1, sizeof(VideoServerCtx) );
                if ( gVideoServer )
                {
+                  gVideoServer->maxConnections= ctx->maxVideoConnections;
+                  gVideoServer->useConnectionThreads= ctx->useVideoConnectionThreads;
                   ctx->haveNativeFence= false;
                   if ( !wstInitVideoServer( gVideoServer ) )
                   {
@@ -4115,6 +5598,11 @@ static void wstTermCtx( WstGLCtx *ctx )
          close( ctx->drmFd );
          ctx->drmFd= -1;
       }
+      if ( ctx->primeHandles )
+      {
+         free( ctx->primeHandles );
+         ctx->primeHandles= 0;
+      }
       pthread_mutex_destroy( &ctx->mutex );
       free( ctx );
 
@@ -4213,6 +5701,7 @@ static void wstUpdateCtx( WstGLCtx *ctx )
             if ( ctx->haveAtomic )
             {
                wstAcquireConnectorProperties( ctx );
+               wstUpdateVRRCapability( ctx );
             }
 
             if ( !ctx->modeSet )
@@ -4317,20 +5806,52 @@ static void wstSelectMode( WstGLCtx *ctx, int width, int height )
    }
 }
 
-static void wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom )
+static long long wstModeRefreshMilliHz( drmModeModeInfo *mode )
 {
-   if ( ctx && ctx->modeSet )
-   {
-      int targetRate;
-      int miMatch= -1;
-      static bool policiesSet= false;
-      static bool policyTruncate= false;
+   long long milliHz;
 
-      if ( !policiesSet )
+   if ( mode->clock && mode->htotal && mode->vtotal )
+   {
+      milliHz= ((long long)mode->clock*1000000LL)/((long long)mode->htotal*mode->vtotal);
+      if ( mode->flags & DRM_MODE_FLAG_INTERLACE )
       {
-         const char *env;
-         env= getenv("WESTEROS_GL_FRM_TRUNCATE");
-         if ( env && atoi(env) )
+         milliHz *= 2;
+      }
+   }
+   else
+   {
+      milliHz= mode->vrefresh*1000LL;
+   }
+
+   return milliHz;
+}
+
+static bool wstModeIsEqual( drmModeModeInfo *mode1, drmModeModeInfo *mode2 )
+{
+   return ( (mode1->hdisplay == mode2->hdisplay) &&
+            (mode1->vdisplay == mode2->vdisplay) &&
+            (mode1->vrefresh == mode2->vrefresh) &&
+            (mode1->clock == mode2->clock) &&
+            (mode1->flags == mode2->flags) );
+}
+
+static bool wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom )
+{
+   bool result= false;
+
+   if ( ctx && ctx->modeSet )
+   {
+      int targetRate;
+      int miMatch= -1;
+      long long contentMilliHz, errorMatch= 0;
+      static bool policiesSet= false;
+      static bool policyTruncate= false;
+
+      if ( !policiesSet )
+      {
+         const char *env;
+         env= getenv("WESTEROS_GL_FRM_TRUNCATE");
+         if ( env && atoi(env) )
          {
             policyTruncate= true;
          }
@@ -4346,6 +5867,15 @@ static void wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom )
       {
          targetRate= (rateNum + rateDenom-1) / rateDenom;
       }
+      if ( targetRate <= 0 )
+      {
+         goto exit;
+      }
+      contentMilliHz= ((long long)rateNum*1000LL)/rateDenom;
+      if ( contentMilliHz <= 0 )
+      {
+         goto exit;
+      }
 
       if ( ctx->conn && (ctx->conn->count_modes > 1) )
       {
@@ -4360,26 +5890,53 @@ static void wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom )
             modeCheck= &ctx->conn->modes[i];
 
             if ( (modeCheck->hdisplay == ctx->modeInfo->hdisplay) &&
-                 (modeCheck->vdisplay == ctx->modeInfo->vdisplay) )
+                 (modeCheck->vdisplay == ctx->modeInfo->vdisplay) &&
+                 ((modeCheck->flags & DRM_MODE_FLAG_INTERLACE) == (ctx->modeInfo->flags & DRM_MODE_FLAG_INTERLACE)) )
             {
                DEBUG("wstSelectRate: check mode %d of %d: %dx%dx%d", i, ctx->conn->count_modes,
                      modeCheck->hdisplay, modeCheck->vdisplay, modeCheck->vrefresh );
 
                if ( modeCheck->vrefresh % targetRate == 0 )
                {
-                  if ( (miMatch >= 0) && (ctx->conn->modes[miMatch].vrefresh > modeCheck->vrefresh) )
+                  long long modeMilliHz, multiple, error;
+
+                  /* Prefer the mode whose exact refresh is closest to a multiple of the content rate */
+                  modeMilliHz= wstModeRefreshMilliHz( modeCheck );
+                  multiple= (modeMilliHz + contentMilliHz/2) / contentMilliHz;
+                  if ( multiple < 1 ) multiple= 1;
+                  error= modeMilliHz - multiple*contentMilliHz;
+                  if ( error < 0 ) error= -error;
+
+                  if ( miMatch >= 0 )
                   {
-                     continue;
+                     if ( error > errorMatch )
+                     {
+                        continue;
+                     }
+                     if ( (error == errorMatch) && (ctx->conn->modes[miMatch].vrefresh > modeCheck->vrefresh) )
+                     {
+                        continue;
+                     }
                   }
                   miMatch= i;
+                  errorMatch= error;
                }
             }
          }
       }
       if ( miMatch >= 0 )
       {
+         result= true;
+         if ( wstModeIsEqual( &ctx->conn->modes[miMatch], ctx->modeInfo ) )
+         {
+            DEBUG("wstSelectRate: current mode %dx%dx%d already matches target content rate %d",
+                  ctx->modeInfo->hdisplay, ctx->modeInfo->vdisplay, ctx->modeInfo->vrefresh, targetRate );
+            goto exit;
+         }
+
          ctx->modeNext= ctx->conn->modes[miMatch];
          ctx->modeSetPending= true;
+         ctx->forceDirty= true;
 
          INFO("wstSelectRate: requesting change to %dx%dx%d, target content rate %d",
               ctx->modeNext.hdisplay, ctx->modeNext.vdisplay, ctx->modeNext.vrefresh, targetRate );
@@ -4391,6 +5948,70 @@ static void wstSelectRate( WstGLCtx *ctx, int rateNum, int rateDenom )
                ctx->conn->count_modes );
       }
    }
+
+exit:
+   return result;
+}
+
+/*
+ * Record a content frame rate for auto frame rate matching.  A rate of
+ * zero requests the original mode be restored.  The request only takes
+ * effect once it has been stable for frmDelay ms so short clips and
+ * back to back clips do not cause mode switches.  Call with gMutex held.
+ */
+static void wstRequestFrameRate( WstGLCtx *ctx, int rateNum, int rateDenom )
+{
+   if ( (rateNum != ctx->frmRateNum) || (rateDenom != ctx->frmRateDenom) || !ctx->frmRequestPending )
+   {
+      FRAME("frm request rate %d/%d", rateNum, rateDenom);
+      ctx->frmRateNum= rateNum;
+      ctx->frmRateDenom= rateDenom;
+      ctx->frmRequestTime= getMonotonicTimeMicros();
+      ctx->frmRequestPending= true;
+   }
+}
+
+static void wstUpdateFrameRateMatching( WstGLCtx *ctx )
+{
+   if ( ctx->frmRequestPending && ctx->modeSet && !ctx->modeSetPending && ctx->modeInfo )
+   {
+      if ( getMonotonicTimeMicros()-ctx->frmRequestTime < ctx->frmDelay*1000LL )
+      {
+         return;
+      }
+      ctx->frmRequestPending= false;
+
+      if ( ctx->autoFRMModeEnabled && (ctx->frmRateNum > 0) )
+      {
+         drmModeModeInfo modeOriginal= *ctx->modeInfo;
+
+         if ( wstSelectRate( ctx, ctx->frmRateNum, ctx->frmRateDenom ) && ctx->modeSetPending )
+         {
+            if ( !ctx->frmModeActive )
+            {
+               ctx->frmModeOriginal= modeOriginal;
+               ctx->frmModeActive= true;
+            }
+            ctx->frmModeSelected= ctx->modeNext;
+         }
+      }
+      else if ( ctx->frmModeActive )
+      {
+         ctx->frmModeActive= false;
+
+         /* Leave any mode chosen by other means in place */
+         if ( wstModeIsEqual( ctx->modeInfo, &ctx->frmModeSelected ) &&
+              !wstModeIsEqual( ctx->modeInfo, &ctx->frmModeOriginal ) )
+         {
+            ctx->modeNext= ctx->frmModeOriginal;
+            ctx->modeSetPending= true;
+            ctx->forceDirty= true;
+
+            INFO("wstUpdateFrameRateMatching: restoring mode %dx%dx%d",
+                 ctx->modeNext.hdisplay, ctx->modeNext.vdisplay, ctx->modeNext.vrefresh );
+         }
+      }
+   }
 }
 
 static bool wstCheckPlanes( WstGLCtx *ctx, long long vblankTime, long long vblankInterval )
@@ -4431,7 +6052,10 @@ static bool wstCheckPlanes( WstGLCtx *ctx, long long vblankTime, long long vblan
             frame= wstVideoFrameManagerPopFrame( iter->vfm );
             if ( frame )
             {
-               if ( frame->fbId != iter->videoFrame[FRAME_CURR].fbId )
+               /* Cached fbs are reused across frames so a new frame can carry the fb
+                  already on screen */
+               if ( (frame->fbId != iter->videoFrame[FRAME_CURR].fbId) ||
+                    (frame->frameNumber != iter->videoFrame[FRAME_CURR].frameNumber) )
                {
                   iter->videoFrame[FRAME_NEXT]= *frame;
                   iter->dirty= true;
@@ -4464,6 +6088,130 @@ static bool wstCheckPlanes( WstGLCtx *ctx, long long vblankTime, long long vblan
    return dirty;
 }
 
+static void wstBoFbDestroy( struct gbm_bo *bo, void *userData )
+{
+   WstBoFb *boFb= (WstBoFb*)userData;
+   (void)bo;
+
+   if ( boFb )
+   {
+      if ( boFb->fbId )
+      {
+         wstUpdateResources( WSTRES_FB_GRAPHICS, false, boFb->fbId, __LINE__);
+         drmModeRmFB( boFb->drmFd, boFb->fbId );
+      }
+      free( boFb );
+   }
+}
+
+/*
+ * Return the framebuffer for a locked front buffer.  A gbm surface cycles
+ * through a small fixed set of bos so the fb is created once per bo and kept
+ * in the bo's user data, being recreated only if the size or format changes.
+ */
+static uint32_t wstBoGetFb( WstGLCtx *ctx, struct gbm_bo *bo, int width, int height, bool useModifiers )
+{
+   WstBoFb *boFb;
+   uint32_t format, handle, stride;
+   int rc;
+
+   format= gbm_bo_get_format(bo);
+
+   boFb= (WstBoFb*)gbm_bo_get_user_data(bo);
+   if ( boFb &&
+        ((boFb->width != width) || (boFb->height != height) || (boFb->format != format)) )
+   {
+      if ( boFb->fbId )
+      {
+         wstUpdateResources( WSTRES_FB_GRAPHICS, false, boFb->fbId, __LINE__);
+         drmModeRmFB( boFb->drmFd, boFb->fbId );
+         boFb->fbId= 0;
+      }
+   }
+   if ( !boFb )
+   {
+      boFb= (WstBoFb*)calloc( 1, sizeof(WstBoFb) );
+      if ( !boFb )
+      {
+         ERROR("wstBoGetFb: no memory for WstBoFb");
+         goto exit;
+      }
+      boFb->drmFd= ctx->drmFd;
+      gbm_bo_set_user_data( bo, boFb, wstBoFbDestroy );
+   }
+
+   if ( !boFb->fbId )
+   {
+      handle= gbm_bo_get_handle(bo).u32;
+      stride= gbm_bo_get_stride(bo);
+
+      #ifdef USE_GBM_MODIFIERS
+      if ( useModifiers )
+      {
+         uint32_t handles[4]= { handle,
+                                0,
+                                0,
+                                0 };
+         uint32_t strides[4]= { stride,
+                                0,
+                                0,
+                                0 };
+         uint32_t offsets[4]= { gbm_bo_get_offset(bo, 0),
+                                0,
+                                0,
+                                0};
+         uint64_t modifiers[4]= { gbm_bo_get_modifier(bo),
+                                  0,
+                                  0,
+                                  0 };
+         rc= drmModeAddFB2WithModifiers( ctx->drmFd,
+                                         width,
+                                         height,
+                                         format,
+                                         handles,
+                                         strides,
+                                         offsets,
+                                         modifiers,
+                                         &boFb->fbId,
+                                         DRM_MODE_FB_MODIFIERS );
+         if ( rc )
+         {
+            ERROR("wstBoGetFb: drmModeAddFB2WithModifiers rc %d errno %d", rc, errno);
+            boFb->fbId= 0;
+            goto exit;
+         }
+      }
+      else
+      #else
+      (void)useModifiers;
+      #endif
+      {
+         rc= drmModeAddFB( ctx->drmFd,
+                           width,
+                           height,
+                           32,
+                           32,
+                           stride,
+                           handle,
+                           &boFb->fbId );
+         if ( rc )
+         {
+            ERROR("wstBoGetFb: drmModeAddFB rc %d errno %d", rc, errno);
+            boFb->fbId= 0;
+            goto exit;
+         }
+      }
+      wstUpdateResources( WSTRES_FB_GRAPHICS, true, boFb->fbId, __LINE__);
+      boFb->width= width;
+      boFb->height= height;
+      boFb->format= format;
+   }
+
+exit:
+
+   return (boFb ? boFb->fbId : 0);
+}
+
 static void wstReleasePreviousBuffers( WstGLCtx *ctx )
 {
    NativeWindowItem *nw;
@@ -4472,14 +6220,12 @@ static void wstReleasePreviousBuffers( WstGLCtx *ctx )
    {
       if ( nw->prevBo )
       {
+         // The bo keeps its fb for reuse until the gbm surface destroys it
          struct gbm_surface* gs= (struct gbm_surface*)nw->nativeWindow;
-         wstUpdateResources( WSTRES_FB_GRAPHICS, false, nw->prevFbId, __LINE__);
-         drmModeRmFB( ctx->drmFd, nw->prevFbId );
          wstUpdateResources( WSTRES_BO_GRAPHICS, false, (long long)nw->prevBo, __LINE__);
          gbm_surface_release_buffer(gs, nw->prevBo);
       }
       nw->prevBo= 0;
-      nw->prevFbId= 0;
 
       nw= nw->next;
    }
@@ -4492,10 +6238,14 @@ static void wstReleasePreviousBuffers( WstGLCtx *ctx )
       {
          if ( iter->videoFrame[FRAME_FREE].fbId )
          {
-            wstUpdateResources( WSTRES_FB_VIDEO, false, iter->videoFrame[FRAME_FREE].fbId, __LINE__);
-            drmModeRmFB( ctx->drmFd, iter->videoFrame[FRAME_FREE].fbId );
+            wstReleaseVideoFb( ctx,
+                               iter->videoFrame[FRAME_FREE].fbId,
+                               iter->videoFrame[FRAME_FREE].handle0,
+                               iter->videoFrame[FRAME_FREE].handle1,
+                               iter->videoFrame[FRAME_FREE].fbCached,
+                               __LINE__ );
             iter->videoFrame[FRAME_FREE].fbId= 0;
-            wstClosePrimeFDHandles( ctx, iter->videoFrame[FRAME_FREE].handle0, iter->videoFrame[FRAME_FREE].handle1, __LINE__ );
+            iter->videoFrame[FRAME_FREE].fbCached= false;
             iter->videoFrame[FRAME_FREE].handle0= 0;
             iter->videoFrame[FRAME_FREE].handle1= 0;
             if ( iter->videoFrame[FRAME_FREE].fd0 >= 0 )
@@ -4565,6 +6315,377 @@ static void wstWindowsRefreshStop( WstGLCtx *ctx )
 }
 #endif
 
+/*
+ * Record the vblank at which a completed commit put each window's newly
+ * swapped content on the display.  Called with gMutex held.
+ */
+static void wstLatchNativeWindows( unsigned int sequence, long long latchTime )
+{
+   NativeWindowItem *nw;
+
+   if ( gCtx )
+   {
+      nw= gCtx->nwFirst;
+      while( nw )
+      {
+         if ( nw->pendingSwapCount )
+         {
+            WstPresentRecord *record= &nw->presented[nw->presentedIndex];
+            record->swapCount= nw->pendingSwapCount;
+            record->time= latchTime;
+            record->sequence= sequence;
+            nw->presentedIndex= (nw->presentedIndex+1) % PRESENT_HISTORY;
+            nw->pendingSwapCount= 0;
+            FRAME("nw %p swap %u latched: seq %u time %lld", nw, record->swapCount, sequence, latchTime);
+         }
+         nw= nw->next;
+      }
+   }
+}
+
+static void wstCancelNativeWindowLatch( void )
+{
+   NativeWindowItem *nw;
+
+   if ( gCtx )
+   {
+      nw= gCtx->nwFirst;
+      while( nw )
+      {
+         nw->pendingSwapCount= 0;
+         nw= nw->next;
+      }
+   }
+}
+
+/*
+ * A blocking commit returns once it has latched, so the current vblank is
+ * the one at which its content reached the display
+ */
+static void wstLatchNativeWindowsVBlank( WstGLCtx *ctx )
+{
+   int rc;
+   drmVBlank vbl;
+
+   vbl.request.type= DRM_VBLANK_RELATIVE;
+   vbl.request.sequence= 0;
+   vbl.request.signal= 0;
+   rc= drmWaitVBlank( ctx->drmFd, &vbl );
+   if ( !rc )
+   {
+      wstLatchNativeWindows( vbl.reply.sequence, vbl.reply.tval_sec*1000000LL + vbl.reply.tval_usec );
+   }
+   else
+   {
+      wstCancelNativeWindowLatch();
+   }
+}
+
+static void wstFlipEventHandler( int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data )
+{
+   WstGLCtx *ctx= (WstGLCtx*)data;
+   (void)fd;
+
+   if ( ctx->flipPending )
+   {
+      --ctx->flipPending;
+   }
+   wstLatchNativeWindows( frame, sec*1000000LL + usec );
+   ctx->lastVBlankTime= sec*1000000LL + usec;
+   ctx->lastVBlankSequence= frame;
+   FRAME("flip event: seq %u time %lld", frame, ctx->lastVBlankTime);
+   wstTrace( TRACE_FLIP_EVENT, (int)frame, 0, ctx->lastVBlankTime );
+}
+
+static void wstVBlankEventHandler( int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data )
+{
+   WstGLCtx *ctx= (WstGLCtx*)data;
+   (void)fd;
+
+   ctx->vblankEventPending= false;
+   ctx->lastVBlankTime= sec*1000000LL + usec;
+   ctx->lastVBlankSequence= frame;
+   FRAME("vblank event: seq %u time %lld", frame, ctx->lastVBlankTime);
+   wstTrace( TRACE_VBLANK_EVENT, (int)frame, 0, ctx->lastVBlankTime );
+}
+
+static void wstProcessDRMEvents( WstGLCtx *ctx, int timeoutMillis )
+{
+   int rc;
+   struct pollfd pfd;
+
+   pfd.fd= ctx->drmFd;
+   pfd.events= POLLIN;
+   pfd.revents= 0;
+
+   rc= poll( &pfd, 1, timeoutMillis );
+   if ( (rc > 0) && (pfd.revents & POLLIN) )
+   {
+      drmEventContext ev;
+      int flipPending;
+
+      memset( &ev, 0, sizeof(ev) );
+      ev.version= 2;
+      ev.vblank_handler= wstVBlankEventHandler;
+      ev.page_flip_handler= wstFlipEventHandler;
+
+      pthread_mutex_lock( &gMutex );
+      flipPending= ctx->flipPending;
+      drmHandleEvent( ctx->drmFd, &ev );
+      if ( ctx->flipPending < flipPending )
+      {
+         // The buffers replaced by the completed flip are no longer being scanned out
+         wstReleasePreviousBuffers( ctx );
+      }
+      pthread_mutex_unlock( &gMutex );
+   }
+   else if ( (rc < 0) && (errno != EINTR) )
+   {
+      ERROR("wstProcessDRMEvents: poll failed: errno %d", errno);
+      usleep( 1000 );
+   }
+}
+
+static void wstRequestVBlankEvent( WstGLCtx *ctx )
+{
+   int rc;
+   drmVBlank vbl;
+
+   vbl.request.type= (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT);
+   vbl.request.sequence= 1;
+   vbl.request.signal= (unsigned long)ctx;
+   rc= drmWaitVBlank( ctx->drmFd, &vbl );
+   if ( !rc )
+   {
+      ctx->vblankEventPending= true;
+   }
+   else
+   {
+      TRACE3("drmWaitVBlank event request failed: rc %d errno %d", rc, errno);
+   }
+}
+
+/*
+ * Commits must reach the kernel before the vblank they target.  The margin
+ * allowed is the slowest recent commit plus a guard for wakeup latency.
+ */
+static long long wstGetCommitMargin( WstGLCtx *ctx, long long refreshInterval )
+{
+   long long margin= 0;
+   int i;
+
+   for( i= 0; i < COMMIT_HISTORY; ++i )
+   {
+      if ( ctx->commitDuration[i] > margin )
+      {
+         margin= ctx->commitDuration[i];
+      }
+   }
+   margin += COMMIT_GUARD;
+   if ( margin > refreshInterval/2 )
+   {
+      margin= refreshInterval/2;
+   }
+
+   return margin;
+}
+
+/*
+ * With variable refresh the panel starts scanning out a frame when its flip
+ * arrives, provided it is within the panel's range.  Commit as soon as content
+ * is ready but no sooner than one mode refresh interval after the last flip.
+ * When nothing is ready the planes are still checked once per interval of the
+ * minimum rate so underflow and status reporting keep running.
+ */
+static long long wstGetVRRDeadline( WstGLCtx *ctx, long long refreshInterval, long long margin, long long now )
+{
+   long long earliest, latest, ready, last, maxInterval;
+   NativeWindowItem *nw;
+
+   maxInterval= 1000000LL/ctx->vrrMinRate;
+   if ( maxInterval < refreshInterval )
+   {
+      maxInterval= refreshInterval;
+   }
+   last= (ctx->vrrLastCheckTime > ctx->lastVBlankTime) ? ctx->vrrLastCheckTime : ctx->lastVBlankTime;
+   earliest= ctx->lastVBlankTime + refreshInterval - margin;
+   latest= last + maxInterval - margin;
+   ready= latest;
+
+   pthread_mutex_lock( &gMutex );
+   if ( ctx->forceDirty )
+   {
+      ready= now;
+   }
+   for( nw= gCtx->nwFirst; nw; nw= nw->next )
+   {
+      if ( nw->dirty )
+      {
+         ready= now;
+      }
+   }
+   pthread_mutex_lock( &ctx->mutex );
+   if ( ctx->overlayPlanes.usedCount )
+   {
+      WstOverlayPlane *iter;
+      for( iter= ctx->overlayPlanes.usedHead; iter; iter= iter->next )
+      {
+         if ( iter->vfm )
+         {
+            long long flipTime= wstVideoFrameManagerNextFlipTime( iter->vfm );
+            if ( (flipTime >= 0) && (flipTime-margin < ready) )
+            {
+               ready= flipTime-margin;
+            }
+         }
+      }
+   }
+   pthread_mutex_unlock( &ctx->mutex );
+   pthread_mutex_unlock( &gMutex );
+
+   if ( ready < earliest )
+   {
+      ready= earliest;
+   }
+
+   return ready;
+}
+
+/*
+ * One refresh period of the event driven scheduler: wait for the flip or
+ * vblank event of the previous period, sleep until just before the next
+ * vblank, then commit whatever is ready with a non-blocking commit whose
+ * completion is reported by a page flip event.  With variable refresh the
+ * commit time follows content readiness instead of a fixed vblank.
+ */
+static void wstRefreshEventIteration( WstGLCtx *ctx, long long refreshInterval )
+{
+   long long now, limit, nextVBlank, deadline, margin, commitStart;
+   bool dirty= false;
+   bool vrr;
+
+   // Commits request page flip events only while this loop is running to drain them
+   ctx->flipEventLoop= true;
+
+   if ( !ctx->flipPending && !ctx->vblankEventPending && !ctx->lastVBlankTime )
+   {
+      wstRequestVBlankEvent( ctx );
+   }
+
+   limit= getMonotonicTimeMicros() + 2*refreshInterval;
+   while( (ctx->flipPending || ctx->vblankEventPending) && !ctx->refreshThreadStopRequested )
+   {
+      now= getMonotonicTimeMicros();
+      if ( now >= limit )
+      {
+         WARNING("no drm event: flipPending %d vblankEventPending %d", ctx->flipPending, ctx->vblankEventPending);
+         ctx->flipPending= 0;
+         ctx->vblankEventPending= false;
+         pthread_mutex_lock( &gMutex );
+         wstCancelNativeWindowLatch();
+         pthread_mutex_unlock( &gMutex );
+         break;
+      }
+      wstProcessDRMEvents( ctx, (int)((limit-now+999)/1000) );
+   }
+
+   margin= wstGetCommitMargin( ctx, refreshInterval );
+   now= getMonotonicTimeMicros();
+   vrr= (ctx->vrrEnabled && ctx->lastVBlankTime);
+   if ( vrr )
+   {
+      deadline= wstGetVRRDeadline( ctx, refreshInterval, margin, now );
+   }
+   else
+   {
+      nextVBlank= (ctx->lastVBlankTime ? ctx->lastVBlankTime+refreshInterval : now+refreshInterval);
+      if ( nextVBlank-margin < now )
+      {
+         nextVBlank += ((now-(nextVBlank-margin))/refreshInterval + 1)*refreshInterval;
+      }
+      deadline= nextVBlank-margin;
+   }
+
+   for( ; ; )
+   {
+      long long wait;
+
+      now= getMonotonicTimeMicros();
+      if ( (now >= deadline) || ctx->refreshThreadStopRequested )
+      {
+         break;
+      }
+      wait= deadline-now;
+      if ( vrr && (wait > VRR_POLL_INTERVAL) )
+      {
+         wait= VRR_POLL_INTERVAL;
+      }
+      if ( wait >= 1000 )
+      {
+         wstProcessDRMEvents( ctx, (int)(wait/1000) );
+      }
+      else
+      {
+         usleep( wait );
+      }
+      if ( vrr )
+      {
+         deadline= wstGetVRRDeadline( ctx, refreshInterval, margin, getMonotonicTimeMicros() );
+      }
+   }
+   if ( vrr )
+   {
+      /* The flip lands as soon as the commit completes */
+      nextVBlank= now+margin;
+      ctx->vrrLastCheckTime= now;
+   }
+
+   if ( ctx->flipPending )
+   {
+      // The previous flip is late: leave content queued for the next period
+      FRAME("flip still pending at deadline");
+      return;
+   }
+
+   FRAME("refresh: deadline %lld next vblank %lld margin %lld", deadline, nextVBlank, margin);
+
+   commitStart= getMonotonicTimeMicros();
+   pthread_mutex_lock( &gMutex );
+   ctx->lastVBlankInterval= refreshInterval;
+   wstReleasePreviousBuffers( ctx );
+   wstUpdateFrameRateMatching( ctx );
+   if ( wstCheckPlanes( ctx, nextVBlank, refreshInterval ) )
+   {
+      TRACE3("refresh thread calling wstSwapDRMBuffers");
+      wstSwapDRMBuffers( ctx );
+      dirty= true;
+   }
+   #ifdef USE_REFRESH_LOCK
+   if ( g_useRefreshLock )
+   {
+      wstWindowsRefreshStart( ctx );
+      wstWindowsRefreshStop( ctx );
+   }
+   #endif
+   pthread_mutex_unlock( &gMutex );
+
+   if ( dirty )
+   {
+      ctx->commitDuration[ctx->commitDurationIndex]= getMonotonicTimeMicros()-commitStart;
+      ctx->commitDurationIndex= (ctx->commitDurationIndex+1) % COMMIT_HISTORY;
+   }
+
+   if ( !ctx->flipPending && !vrr )
+   {
+      // Nothing was flipped so track the vblank directly
+      wstRequestVBlankEvent( ctx );
+   }
+
+   #ifdef USE_UEVENT_HOTPLUG
+   wstProcessUEvent( ctx );
+   #endif
+}
+
 static void *wstRefreshThread( void *arg )
 {
    WstGLCtx *ctx= (WstGLCtx*)arg;
@@ -4578,6 +6699,40 @@ static void *wstRefreshThread( void *arg )
 
    while( !ctx->refreshThreadStopRequested )
    {
+      if ( ctx->useFlipEvents && ctx->haveAtomic && ctx->useVBlank &&
+           ctx->modeSet && ctx->conn && ctx->modeInfo && refreshInterval )
+      {
+         wstRefreshEventIteration( ctx, refreshInterval );
+         vblankTime= ctx->lastVBlankTime;
+         if ( ctx->modeInfo->vrefresh )
+         {
+            refreshInterval= (1000000LL+(ctx->modeInfo->vrefresh/2))/ctx->modeInfo->vrefresh;
+         }
+         continue;
+      }
+
+      if ( ctx->flipEventLoop )
+      {
+         long long limit= getMonotonicTimeMicros() + 100000LL;
+
+         // Falling back to vblank waits: complete flips requested by the event loop
+         ctx->flipEventLoop= false;
+         while( (ctx->flipPending || ctx->vblankEventPending) &&
+                (getMonotonicTimeMicros() < limit) && !ctx->refreshThreadStopRequested )
+         {
+            wstProcessDRMEvents( ctx, 10 );
+         }
+         if ( ctx->flipPending )
+         {
+            WARNING("no drm event: flipPending %d on leaving event loop", ctx->flipPending);
+            ctx->flipPending= 0;
+            pthread_mutex_lock( &gMutex );
+            wstCancelNativeWindowLatch();
+            pthread_mutex_unlock( &gMutex );
+         }
+         ctx->vblankEventPending= false;
+      }
+
       delay= 16667LL;
 
       vbl.request.type= DRM_VBLANK_RELATIVE;
@@ -4586,112 +6741,435 @@ static void *wstRefreshThread( void *arg )
 
       if ( !ctx->conn )
       {
-         wstUpdateCtx( ctx );
+         wstUpdateCtx( ctx );
+      }
+
+      vblankTime += refreshInterval;
+
+      FRAME("refresh: vblankTime %lld", vblankTime);
+      wstTrace( TRACE_REFRESH, 0, 0, vblankTime );
+
+      if ( ctx->conn && ctx->modeInfo )
+      {
+         pthread_mutex_lock( &gMutex );
+         if ( ctx->modeInfo->vrefresh )
+         {
+            refreshInterval= (1000000LL+(ctx->modeInfo->vrefresh/2))/ctx->modeInfo->vrefresh;
+         }
+         wstReleasePreviousBuffers( ctx );
+         wstUpdateFrameRateMatching( ctx );
+         if ( wstCheckPlanes( ctx, vblankTime, refreshInterval ) )
+         {
+            TRACE3("refresh thread calling wstSwapDRMBuffers");
+            wstSwapDRMBuffers( ctx );
+            delay= 3LL*refreshInterval/4LL;
+         }
+         #ifdef USE_REFRESH_LOCK
+         if ( g_useRefreshLock )
+         {
+            wstWindowsRefreshStart( ctx );
+            wstWindowsRefreshStop( ctx );
+         }
+         #endif
+         pthread_mutex_unlock( &gMutex );
+      }
+
+      #ifdef USE_UEVENT_HOTPLUG
+      wstProcessUEvent( ctx );
+      #endif
+
+      if ( ctx->modeSet && ctx->useVBlank )
+      {
+         int rc;
+
+         rc= drmWaitVBlank( ctx->drmFd, &vbl );
+         if ( !rc )
+         {
+            vblankTime= vbl.reply.tval_sec*1000000LL + vbl.reply.tval_usec;
+            if ( refreshInterval )
+            {
+               pthread_mutex_lock( &gMutex );
+               ctx->lastVBlankTime= vblankTime;
+               ctx->lastVBlankInterval= refreshInterval;
+               ctx->lastVBlankSequence= vbl.reply.sequence;
+               pthread_mutex_unlock( &gMutex );
+            }
+         }
+         else
+         {
+            TRACE3("drmWaitVBlank failed: rc %d errno %d", rc, errno);
+            if ( errno == 16 )
+            {
+               ERROR("drmWaitVBlank failed: rc %d errno %d - try running with 'export WESTEROS_GL_NO_VBLANK=1'", rc, errno);
+            }
+         }
+      }
+      else
+      {
+         if ( delay )
+         {
+            usleep( delay );
+         }
+      }
+   }
+   ctx->refreshThreadStarted= false;
+
+   DEBUG("refresh thread exit");
+   return NULL;
+}
+
+static void wstStartRefreshThread( WstGLCtx *ctx )
+{
+   int rc;
+   rc= pthread_create( &ctx->refreshThreadId, NULL, wstRefreshThread, ctx );
+   if ( rc )
+   {
+      ERROR("unable to start refresh thread: rc %d errno %d", rc, errno);
+   }
+}
+
+static void wstAtomicAddProperty( WstGLCtx *ctx, drmModeAtomicReq *req, uint32_t objectId,
+                                  int countProps, drmModePropertyRes **propRes, const char *name, uint64_t value )
+{
+   int rc;
+   int i;
+   uint32_t propId= 0;
+
+   for( i= 0; i < countProps; ++i )
+   {
+      if ( !strcmp( name, propRes[i]->name ) )
+      {
+         propId= propRes[i]->prop_id;
+         break;
+      }
+   }
+
+   if ( propId > 0 )
+   {
+      TRACE3("wstAtomicAddProperty: objectId %d: %s, %lld", objectId, name, value);
+      rc= drmModeAtomicAddProperty( req, objectId, propId, value );
+      if ( rc < 0 )
+      {
+         ERROR("wstAtomicAddProperty: drmModeAtomicAddProperty fail: obj %d prop %d (%s) value %lld: rc %d errno %d", objectId, propId, name, value, rc, errno );
+      }
+   }
+   else
+   {
+      WARNING("wstAtomicAddProperty: skip prop %s", name);
+   }
+}
+
+static void wstAtomicAddVideoPlane( WstGLCtx *ctx, drmModeAtomicReq *req, WstOverlayPlane *overlay,
+                                    uint32_t sx, uint32_t sy, uint32_t sw, uint32_t sh,
+                                    uint32_t dx, uint32_t dy, uint32_t dw, uint32_t dh )
+{
+   overlay->plane->crtc_id= ctx->overlayPlanes.primary->crtc_id;
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "FB_ID", overlay->videoFrame[FRAME_CURR].fbId );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "CRTC_ID", overlay->plane->crtc_id );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "SRC_X", sx<<16 );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "SRC_Y", sy<<16 );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "SRC_W", sw<<16 );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "SRC_H", sh<<16 );
+
+   if ( overlay->hide )
+   {
+      wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                            overlay->planeProps->count_props, overlay->planePropRes,
+                            "CRTC_X", ctx->modeInfo->hdisplay-2 );
+
+      wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                            overlay->planeProps->count_props, overlay->planePropRes,
+                            "CRTC_Y", ctx->modeInfo->vdisplay-2 );
+   }
+   else
+   {
+      wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                            overlay->planeProps->count_props, overlay->planePropRes,
+                            "CRTC_X", dx );
+
+      wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                            overlay->planeProps->count_props, overlay->planePropRes,
+                            "CRTC_Y", dy );
+   }
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "CRTC_W", dw );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "CRTC_H", dh );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "IN_FENCE_FD", -1 );
+}
+
+static void wstAtomicDisablePlane( WstGLCtx *ctx, drmModeAtomicReq *req, WstOverlayPlane *overlay )
+{
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "FB_ID", 0 );
+
+   wstAtomicAddProperty( ctx, req, overlay->plane->plane_id,
+                         overlay->planeProps->count_props, overlay->planePropRes,
+                         "CRTC_ID", 0 );
+}
+
+static bool wstAtomicTestCommit( WstGLCtx *ctx, drmModeAtomicReq *req, uint32_t flags )
+{
+   int rc;
+
+   flags &= ~(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+   flags |= DRM_MODE_ATOMIC_TEST_ONLY;
+
+   ++ctx->planeLayoutTests;
+   rc= drmModeAtomicCommit( ctx->drmFd, req, flags, 0 );
+   if ( rc )
+   {
+      ++ctx->planeLayoutTestFailures;
+      DEBUG("wstAtomicTestCommit: rejected: rc %d errno %d", rc, errno);
+   }
+
+   return (rc == 0);
+}
+
+static WstPlaneLayout *wstPlaneLayoutFind( WstGLCtx *ctx, WstPlaneLayout *key )
+{
+   WstPlaneLayout *layout= 0;
+   int i;
+
+   for( i= 0; i < ctx->planeLayoutCount; ++i )
+   {
+      WstPlaneLayout *iter= &ctx->planeLayouts[i];
+      if ( (iter->overlay == key->overlay) &&
+           (iter->modeWidth == key->modeWidth) &&
+           (iter->modeHeight == key->modeHeight) &&
+           (iter->modeRefresh == key->modeRefresh) &&
+           (iter->format == key->format) &&
+           (iter->scaled == key->scaled) )
+      {
+         layout= iter;
+         break;
+      }
+   }
+
+   return layout;
+}
+
+static void wstPlaneLayoutStore( WstGLCtx *ctx, WstPlaneLayout *key, uint32_t planeId )
+{
+   WstPlaneLayout *layout;
+
+   layout= wstPlaneLayoutFind( ctx, key );
+   if ( !layout )
+   {
+      if ( ctx->planeLayoutCount < PLANE_LAYOUT_CACHE_SIZE )
+      {
+         layout= &ctx->planeLayouts[ctx->planeLayoutCount++];
+      }
+      else
+      {
+         layout= &ctx->planeLayouts[ctx->planeLayoutNext];
+         ctx->planeLayoutNext= (ctx->planeLayoutNext+1) % PLANE_LAYOUT_CACHE_SIZE;
       }
+   }
+   *layout= *key;
+   layout->planeId= planeId;
+   layout->retry= PLANE_LAYOUT_RETRY;
 
-      vblankTime += refreshInterval;
+   INFO("plane layout: overlay %p mode %dx%d@%d format %.4s scaled %d: plane %u",
+        key->overlay, key->modeWidth, key->modeHeight, key->modeRefresh, (char*)&key->format, key->scaled, planeId);
+}
 
-      FRAME("refresh: vblankTime %lld", vblankTime);
+static void wstPlaneLayoutForget( WstGLCtx *ctx, WstOverlayPlane *overlay )
+{
+   int i, j;
 
-      if ( ctx->conn && ctx->modeInfo )
+   for( i= 0, j= 0; i < ctx->planeLayoutCount; ++i )
+   {
+      if ( ctx->planeLayouts[i].overlay != overlay )
       {
-         pthread_mutex_lock( &gMutex );
-         if ( ctx->modeInfo->vrefresh )
-         {
-            refreshInterval= (1000000LL+(ctx->modeInfo->vrefresh/2))/ctx->modeInfo->vrefresh;
-         }
-         wstReleasePreviousBuffers( ctx );
-         if ( wstCheckPlanes( ctx, vblankTime, refreshInterval ) )
-         {
-            TRACE3("refresh thread calling wstSwapDRMBuffers");
-            wstSwapDRMBuffers( ctx );
-            delay= 3LL*refreshInterval/4LL;
-         }
-         #ifdef USE_REFRESH_LOCK
-         if ( g_useRefreshLock )
+         if ( i != j )
          {
-            wstWindowsRefreshStart( ctx );
-            wstWindowsRefreshStop( ctx );
+            ctx->planeLayouts[j]= ctx->planeLayouts[i];
          }
-         #endif
-         pthread_mutex_unlock( &gMutex );
+         ++j;
       }
+   }
+   ctx->planeLayoutCount= j;
+   if ( ctx->planeLayoutNext >= ctx->planeLayoutCount )
+   {
+      ctx->planeLayoutNext= 0;
+   }
+}
 
-      #ifdef USE_UEVENT_HOTPLUG
-      wstProcessUEvent( ctx );
-      #endif
+static void wstPlaneLayoutKey( WstGLCtx *ctx, WstOverlayPlane *overlay, WstVideoPlacement *vp, WstPlaneLayout *key )
+{
+   memset( key, 0, sizeof(WstPlaneLayout) );
+   key->overlay= overlay;
+   key->modeWidth= ctx->modeInfo->hdisplay;
+   key->modeHeight= ctx->modeInfo->vdisplay;
+   key->modeRefresh= ctx->modeInfo->vrefresh;
+   key->format= overlay->videoFrame[FRAME_CURR].frameFormat;
+   key->scaled= ((vp->sw != vp->dw) || (vp->sh != vp->dh));
+}
 
-      if ( ctx->modeSet && ctx->useVBlank )
-      {
-         int rc;
+/*
+ * Place an overlay's current video frame into an atomic request using the
+ * layout cached for its (mode, format, scaling) combination.  Returns false
+ * if there is no usable cached layout, in which case the caller places the
+ * frame with wstAssignVideoPlane once the rest of the request is complete.
+ * Layouts are cached per overlay so concurrent overlays (eg. PiP) don't evict
+ * each other's results.  Caller must hold gCtx->mutex.
+ */
+static bool wstApplyVideoPlaneLayout( WstGLCtx *ctx, drmModeAtomicReq *req, WstVideoPlacement *vp, bool *placed )
+{
+   bool applied= false;
+   WstOverlayPlane *overlay= vp->overlay;
+   WstPlaneLayout key, *layout;
+   WstOverlayPlane *candidate;
 
-         rc= drmWaitVBlank( ctx->drmFd, &vbl );
-         if ( !rc )
-         {
-            vblankTime= vbl.reply.tval_sec*1000000LL + vbl.reply.tval_usec;
-         }
-         else
+   *placed= false;
+
+   if ( !ctx->usePlaneTest )
+   {
+      wstAtomicAddVideoPlane( ctx, req, overlay, vp->sx, vp->sy, vp->sw, vp->sh, vp->dx, vp->dy, vp->dw, vp->dh );
+      *placed= true;
+      return true;
+   }
+
+   wstPlaneLayoutKey( ctx, overlay, vp, &key );
+
+   layout= wstPlaneLayoutFind( ctx, &key );
+   if ( layout )
+   {
+      if ( layout->planeId == 0 )
+      {
+         if ( --layout->retry > 0 )
          {
-            TRACE3("drmWaitVBlank failed: rc %d errno %d", rc, errno);
-            if ( errno == 16 )
-            {
-               ERROR("drmWaitVBlank failed: rc %d errno %d - try running with 'export WESTEROS_GL_NO_VBLANK=1'", rc, errno);
-            }
+            ++ctx->planeLayoutHits;
+            wstAtomicDisablePlane( ctx, req, overlay );
+            applied= true;
          }
       }
-      else
+      else if ( layout->planeId == overlay->plane->plane_id )
       {
-         if ( delay )
-         {
-            usleep( delay );
-         }
+         ++ctx->planeLayoutHits;
+         wstAtomicAddVideoPlane( ctx, req, overlay, vp->sx, vp->sy, vp->sw, vp->sh, vp->dx, vp->dy, vp->dw, vp->dh );
+         *placed= true;
+         applied= true;
+      }
+      else if ( (candidate= wstOverlayFindUnused( &ctx->overlayPlanes, layout->planeId )) &&
+                (candidate != ctx->overlayPlanes.primary) )
+      {
+         ++ctx->planeLayoutHits;
+         wstOverlaySwapHardware( &ctx->overlayPlanes, overlay, candidate );
+         wstAtomicDisablePlane( ctx, req, candidate );
+         wstAtomicAddVideoPlane( ctx, req, overlay, vp->sx, vp->sy, vp->sw, vp->sh, vp->dx, vp->dy, vp->dw, vp->dh );
+         *placed= true;
+         applied= true;
       }
    }
-   ctx->refreshThreadStarted= false;
 
-   DEBUG("refresh thread exit");
-   return NULL;
+   return applied;
 }
 
-static void wstStartRefreshThread( WstGLCtx *ctx )
+/*
+ * Find a layout for an overlay's current video frame that the driver accepts.
+ * Called once everything else, including graphics, CRTC state and the other
+ * overlays, is in the request so the TEST_ONLY commits check what will really
+ * be committed.  Candidates are tried in order: the overlay's own plane, then
+ * any unused plane supporting the format, and finally leaving video out so
+ * that graphics still update.  The outcome is cached so later frames and
+ * later returns to the same combination commit without further testing.
+ * When video can't be placed the overlay's plane is disabled in the same
+ * request so no stale frame remains on screen.  Caller must hold gCtx->mutex.
+ */
+static bool wstAssignVideoPlane( WstGLCtx *ctx, drmModeAtomicReq *req, uint32_t flags, WstVideoPlacement *vp )
 {
-   int rc;
-   rc= pthread_create( &ctx->refreshThreadId, NULL, wstRefreshThread, ctx );
-   if ( rc )
-   {
-      ERROR("unable to start refresh thread: rc %d errno %d", rc, errno);
-   }
-}
+   bool placed= false;
+   WstOverlayPlane *overlay= vp->overlay;
+   WstPlaneLayout key;
+   WstOverlayPlane *candidate;
+   uint32_t candidates[PLANE_CANDIDATE_MAX];
+   int candidateCount= 0;
+   int cursor, i;
 
-static void wstAtomicAddProperty( WstGLCtx *ctx, drmModeAtomicReq *req, uint32_t objectId,
-                                  int countProps, drmModePropertyRes **propRes, const char *name, uint64_t value )
-{
-   int rc;
-   int i;
-   uint32_t propId= 0;
+   wstPlaneLayoutKey( ctx, overlay, vp, &key );
 
-   for( i= 0; i < countProps; ++i )
+   cursor= drmModeAtomicGetCursor( req );
+
+   wstAtomicAddVideoPlane( ctx, req, overlay, vp->sx, vp->sy, vp->sw, vp->sh, vp->dx, vp->dy, vp->dw, vp->dh );
+   if ( wstAtomicTestCommit( ctx, req, flags ) )
    {
-      if ( !strcmp( name, propRes[i]->name ) )
+      placed= true;
+   }
+   else
+   {
+      drmModeAtomicSetCursor( req, cursor );
+
+      candidate= ctx->overlayPlanes.availHead;
+      while( candidate && (candidateCount < PLANE_CANDIDATE_MAX) )
       {
-         propId= propRes[i]->prop_id;
-         break;
+         if ( (candidate != ctx->overlayPlanes.primary) &&
+              candidate->supportsVideo &&
+              wstOverlaySupportsFormat( candidate, key.format ) )
+         {
+            candidates[candidateCount++]= candidate->plane->plane_id;
+         }
+         candidate= candidate->next;
       }
-   }
 
-   if ( propId > 0 )
-   {
-      TRACE3("wstAtomicAddProperty: objectId %d: %s, %lld", objectId, name, value);
-      rc= drmModeAtomicAddProperty( req, objectId, propId, value );
-      if ( rc < 0 )
+      for( i= 0; (i < candidateCount) && !placed; ++i )
       {
-         ERROR("wstAtomicAddProperty: drmModeAtomicAddProperty fail: obj %d prop %d (%s) value %lld: rc %d errno %d", objectId, propId, name, value, rc, errno );
+         candidate= wstOverlayFindUnused( &ctx->overlayPlanes, candidates[i] );
+         if ( candidate && (candidate != ctx->overlayPlanes.primary) )
+         {
+            wstOverlaySwapHardware( &ctx->overlayPlanes, overlay, candidate );
+            wstAtomicDisablePlane( ctx, req, candidate );
+            wstAtomicAddVideoPlane( ctx, req, overlay, vp->sx, vp->sy, vp->sw, vp->sh, vp->dx, vp->dy, vp->dw, vp->dh );
+            if ( wstAtomicTestCommit( ctx, req, flags ) )
+            {
+               placed= true;
+            }
+            else
+            {
+               drmModeAtomicSetCursor( req, cursor );
+               wstOverlaySwapHardware( &ctx->overlayPlanes, overlay, candidate );
+            }
+         }
       }
    }
-   else
+
+   if ( !placed )
    {
-      WARNING("wstAtomicAddProperty: skip prop %s", name);
+      WARNING("no plane accepts video %dx%d format %.4s scaled %d at mode %dx%d: video not presented",
+              vp->sw, vp->sh, (char*)&key.format, key.scaled, key.modeWidth, key.modeHeight);
+      wstAtomicDisablePlane( ctx, req, overlay );
    }
+
+   wstPlaneLayoutStore( ctx, &key, (placed ? overlay->plane->plane_id : 0) );
+
+   return placed;
 }
 
 static void pageFlipEventHandler(int fd, unsigned int frame,
@@ -4699,10 +7177,12 @@ static void pageFlipEventHandler(int fd, unsigned int frame,
 				 void *data)
 {
    WstGLCtx *ctx= (WstGLCtx*)data;
+   (void)fd;
    if ( ctx->flipPending )
    {
       --ctx->flipPending;
    }
+   wstLatchNativeWindows( frame, sec*1000000LL + usec );
 }
 
 #ifdef DRM_USE_OUT_FENCE
@@ -4745,8 +7225,11 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
    uint32_t flags= 0;
    struct gbm_surface* gs;
    struct gbm_bo *bo;
-   uint32_t handle, stride;
    NativeWindowItem *nw;
+   bool vrrUpdate= false;
+   WstVideoPlacement probes[PLANE_CANDIDATE_MAX];
+   int probeCount= 0;
+   int i;
 
    TRACE3("wstSwapDRMBuffersAtomic: atomic start");
 
@@ -4822,6 +7305,20 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
          ERROR("wstSwapDRMBuffersAtomic: drmModeCreatePropertyBlob fail: rc %d errno %d", rc, errno);
       }
    }
+   else if ( ctx->flipEventLoop )
+   {
+      /* Completion is reported by a page flip event handled on the refresh thread */
+      flags |= (DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+   }
+
+   if ( ctx->outputEnable && ctx->vrrCapable &&
+        ((ctx->vrrRequested != ctx->vrrEnabled) || !ctx->modeSet) )
+   {
+      wstAtomicAddProperty( ctx, req, ctx->crtc->crtc_id,
+                            ctx->crtcProps->count_props, ctx->crtcPropRes,
+                            "VRR_ENABLED", ctx->vrrRequested );
+      vrrUpdate= true;
+   }
 
    if ( ctx->outputEnable &&
         (
@@ -4863,68 +7360,22 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
                   uint32_t fbId;
                   wstUpdateResources( WSTRES_BO_GRAPHICS, true, (long long)bo, __LINE__);
 
-                  handle= gbm_bo_get_handle(bo).u32;
-                  stride= gbm_bo_get_stride(bo);
-
                   #ifdef USE_GBM_MODIFIERS
-                  if ( gCtx->useGBMModifiers )
-                  {
-                     uint32_t handles[4]= { handle,
-                                            0,
-                                            0,
-                                            0 };
-                     uint32_t strides[4]= { stride,
-                                            0,
-                                            0,
-                                            0 };
-                     uint32_t offsets[4]= { gbm_bo_get_offset(bo, 0),
-                                            0,
-                                            0,
-                                            0};
-                     uint64_t modifiers[4]= { gbm_bo_get_modifier(bo),
-                                              0,
-                                              0,
-                                              0 };
-                     rc= drmModeAddFB2WithModifiers( ctx->drmFd,
-                                                     nw->width,
-                                                     nw->height,
-                                                     gbm_bo_get_format(bo),
-                                                     handles,
-                                                     strides,
-                                                     offsets,
-                                                     modifiers,
-                                                     &fbId,
-                                                     DRM_MODE_FB_MODIFIERS );
-                     if ( rc )
-                     {
-                        ERROR("wstSwapDRMBuffersAtomic: drmModeAddFB2WithModifiers rc %d errno %d", rc, errno);
-                        gbm_surface_release_buffer(gs, bo);
-                     }
-                  }
-                  else
+                  fbId= wstBoGetFb( ctx, bo, nw->width, nw->height, gCtx->useGBMModifiers );
+                  #else
+                  fbId= wstBoGetFb( ctx, bo, nw->width, nw->height, false );
                   #endif
+                  if ( !fbId )
                   {
-                     rc= drmModeAddFB( ctx->drmFd,
-                                       nw->width,
-                                       nw->height,
-                                       32,
-                                       32,
-                                       stride,
-                                       handle,
-                                       &fbId );
-                     if ( rc )
-                     {
-                        ERROR("wstSwapDRMBuffersAtomic: drmModeAddFB rc %d errno %d", rc, errno);
-                        gbm_surface_release_buffer(gs, bo);
-                     }
+                     wstUpdateResources( WSTRES_BO_GRAPHICS, false, (long long)bo, __LINE__);
+                     gbm_surface_release_buffer(gs, bo);
                   }
-                  if ( !rc )
+                  else
                   {
                      nw->prevBo= nw->bo;
-                     nw->prevFbId= nw->fbId;
                      nw->fbId= fbId;
-                     wstUpdateResources( WSTRES_FB_GRAPHICS, true, nw->fbId, __LINE__);
                      nw->bo= bo;
+                     nw->pendingSwapCount= nw->swapCount;
                   }
                }
             }
@@ -5042,6 +7493,7 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
                iter->videoFrame[FRAME_CURR]= iter->videoFrame[FRAME_NEXT];
 
                iter->videoFrame[FRAME_NEXT].fbId= 0;
+               iter->videoFrame[FRAME_NEXT].fbCached= false;
                iter->videoFrame[FRAME_NEXT].handle0= 0;
                iter->videoFrame[FRAME_NEXT].handle1= 0;
                iter->videoFrame[FRAME_NEXT].fd0= -1;
@@ -5117,64 +7569,36 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
 
                if ( ctx->outputEnable && ctx->videoEnable )
                {
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "FB_ID", iter->videoFrame[FRAME_CURR].fbId );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "CRTC_ID", iter->plane->crtc_id );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "SRC_X", sx<<16 );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "SRC_Y", sy<<16 );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "SRC_W", sw<<16 );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "SRC_H", sh<<16 );
-
-                  if ( iter->hide )
+                  WstVideoPlacement vp;
+                  bool placed;
+
+                  vp.overlay= iter;
+                  vp.sx= sx;
+                  vp.sy= sy;
+                  vp.sw= sw;
+                  vp.sh= sh;
+                  vp.dx= dx;
+                  vp.dy= dy;
+                  vp.dw= dw;
+                  vp.dh= dh;
+                  if ( wstApplyVideoPlaneLayout( ctx, req, &vp, &placed ) )
                   {
-                     wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                           iter->planeProps->count_props, iter->planePropRes,
-                                           "CRTC_X", ctx->modeInfo->hdisplay-2 );
-
-                     wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                           iter->planeProps->count_props, iter->planePropRes,
-                                           "CRTC_Y", ctx->modeInfo->vdisplay-2 );
+                     if ( !placed )
+                     {
+                        FRAME("frame %d not presented: no plane for layout", iter->videoFrame[FRAME_CURR].frameNumber);
+                     }
+                  }
+                  else if ( probeCount < PLANE_CANDIDATE_MAX )
+                  {
+                     probes[probeCount++]= vp;
                   }
                   else
                   {
-                     wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                           iter->planeProps->count_props, iter->planePropRes,
-                                           "CRTC_X", dx );
-
-                     wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                           iter->planeProps->count_props, iter->planePropRes,
-                                           "CRTC_Y", dy );
+                     wstAtomicDisablePlane( ctx, req, iter );
                   }
 
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "CRTC_W", dw );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "CRTC_H", dh );
-
-                  wstAtomicAddProperty( ctx, req, iter->plane->plane_id,
-                                        iter->planeProps->count_props, iter->planePropRes,
-                                        "IN_FENCE_FD", -1 );
-
                   FRAME("commit frame %d buffer %d", iter->videoFrame[FRAME_CURR].frameNumber, iter->videoFrame[FRAME_CURR].bufferId);
+                  wstTrace( TRACE_COMMIT, iter->videoFrame[FRAME_CURR].frameNumber, iter->videoFrame[FRAME_CURR].bufferId, iter->videoFrame[FRAME_CURR].frameTime );
                   avProgLog( iter->videoFrame[FRAME_CURR].frameTime*1000LL, 0, "WtoD", "");
                }
             }
@@ -5183,12 +7607,40 @@ static void wstSwapDRMBuffersAtomic( WstGLCtx *ctx )
          iter= iter->next;
       }
    }
+
+   /* New layouts are tested last so the test commits see the complete request */
+   for( i= 0; i < probeCount; ++i )
+   {
+      if ( !wstAssignVideoPlane( ctx, req, flags, &probes[i] ) )
+      {
+         FRAME("frame %d not presented: no plane for layout", probes[i].overlay->videoFrame[FRAME_CURR].frameNumber);
+      }
+   }
    pthread_mutex_unlock( &ctx->mutex );
 
-   rc= drmModeAtomicCommit( ctx->drmFd, req, flags, 0 );
+   rc= drmModeAtomicCommit( ctx->drmFd, req, flags, ctx );
    if ( rc )
    {
       ERROR("drmModeAtomicCommit failed: rc %d errno %d", rc, errno );
+      wstCancelNativeWindowLatch();
+   }
+   else
+   {
+      /* Only report the VRR state once the hardware has accepted it */
+      if ( vrrUpdate && (ctx->vrrRequested != ctx->vrrEnabled) )
+      {
+         INFO("wstSwapDRMBuffersAtomic: vrr enabled %d", ctx->vrrRequested);
+         ctx->vrrEnabled= ctx->vrrRequested;
+      }
+
+      if ( flags & DRM_MODE_PAGE_FLIP_EVENT )
+      {
+         ++ctx->flipPending;
+      }
+      else if ( ctx->useVBlank )
+      {
+         wstLatchNativeWindowsVBlank( ctx );
+      }
    }
 
    #ifdef DRM_USE_OUT_FENCE
@@ -5223,7 +7675,6 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
 {
    struct gbm_surface* gs;
    struct gbm_bo *bo;
-   uint32_t handle, stride;
    fd_set fds;
    drmEventContext ev;
    drmModePlane *plane= 0;
@@ -5265,31 +7716,19 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
          {
             TRACE3("nw %p dirty", nw);
             nw->prevBo= nw->bo;
-            nw->prevFbId= nw->fbId;
             gs= (struct gbm_surface*)nw->nativeWindow;
             if ( gs )
             {
                bo= gbm_surface_lock_front_buffer(gs);
                wstUpdateResources( WSTRES_BO_GRAPHICS, true, (long long)bo, __LINE__);
 
-               handle= gbm_bo_get_handle(bo).u32;
-               stride= gbm_bo_get_stride(bo);
-
-               rc= drmModeAddFB( ctx->drmFd,
-                                 ctx->modeInfo->hdisplay,
-                                 ctx->modeInfo->vdisplay,
-                                 32,
-                                 32,
-                                 stride,
-                                 handle,
-                                 &nw->fbId );
-                if ( rc )
-                {
-                   ERROR("wstSwapDRMBuffers: drmModeAddFB rc %d errno %d", rc, errno);
-                   goto exit;
-                }
-                wstUpdateResources( WSTRES_FB_GRAPHICS, true, nw->fbId, __LINE__);
-                nw->bo= bo;
+               nw->fbId= wstBoGetFb( ctx, bo, ctx->modeInfo->hdisplay, ctx->modeInfo->vdisplay, false );
+               if ( !nw->fbId )
+               {
+                  goto exit;
+               }
+               nw->bo= bo;
+               nw->pendingSwapCount= nw->swapCount;
 
                if ( !ctx->modeSet )
                {
@@ -5304,9 +7743,14 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                    if ( rc )
                    {
                       ERROR("wstSwapDRMBuffers: drmModeSetCrtc: rc %d errno %d", rc, errno);
+                      wstCancelNativeWindowLatch();
                       goto exit;
                    }
                    ctx->modeSet= true;
+                   if ( ctx->useVBlank )
+                   {
+                      wstLatchNativeWindowsVBlank( ctx );
+                   }
                }
                else if ( nw->windowPlane )
                {
@@ -5323,6 +7767,10 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                      ctx->flipPending++;
                      eventPending= true;
                   }
+                  else
+                  {
+                     nw->pendingSwapCount= 0;
+                  }
 
                   plane= nw->windowPlane->plane;
                   plane->crtc_id= ctx->enc->crtc_id;
@@ -5359,6 +7807,10 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                      ctx->flipPending++;
                      eventPending= true;
                   }
+                  else
+                  {
+                     nw->pendingSwapCount= 0;
+                  }
                }
             }
          }
@@ -5380,6 +7832,7 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                   uint32_t fbId= iter->videoFrame[FRAME_NEXT].fbId;
                   uint32_t handle0= iter->videoFrame[FRAME_NEXT].handle0;
                   uint32_t handle1= iter->videoFrame[FRAME_NEXT].handle1;
+                  bool fbCached= iter->videoFrame[FRAME_NEXT].fbCached;
                   int fd0= iter->videoFrame[FRAME_NEXT].fd0;
                   int fd1= iter->videoFrame[FRAME_NEXT].fd1;
                   int fd2= iter->videoFrame[FRAME_NEXT].fd2;
@@ -5398,6 +7851,7 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                   iter->videoFrame[FRAME_CURR]= iter->videoFrame[FRAME_NEXT];
 
                   iter->videoFrame[FRAME_NEXT].fbId= 0;
+                  iter->videoFrame[FRAME_NEXT].fbCached= false;
                   iter->videoFrame[FRAME_NEXT].handle0= 0;
                   iter->videoFrame[FRAME_NEXT].handle1= 0;
                   iter->videoFrame[FRAME_NEXT].fd0= -1;
@@ -5472,6 +7926,7 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                   if ( !rc )
                   {
                      iter->videoFrame[FRAME_CURR].fbId= fbId;
+                     iter->videoFrame[FRAME_CURR].fbCached= fbCached;
                      iter->videoFrame[FRAME_CURR].handle0= handle0;
                      iter->videoFrame[FRAME_CURR].handle1= handle1;
                      iter->videoFrame[FRAME_CURR].fd0= fd0;
@@ -5481,9 +7936,7 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                   }
                   else
                   {
-                     wstUpdateResources( WSTRES_FB_VIDEO, false, fbId, __LINE__);
-                     drmModeRmFB( gCtx->drmFd, fbId );
-                     wstClosePrimeFDHandles( ctx, handle0, handle1, __LINE__ );
+                     wstReleaseVideoFb( ctx, fbId, handle0, handle1, fbCached, __LINE__ );
                      if ( fd0 >= 0 )
                      {
                         wstUpdateResources( WSTRES_FD_VIDEO, false, fd0, __LINE__);
@@ -5526,6 +7979,7 @@ static void wstSwapDRMBuffers( WstGLCtx *ctx )
                      ERROR("wstSwapDRMBuffers: hiding plane: drmModeSetPlane rc %d errno %d", rc, errno );
                   }
                   iter->videoFrame[FRAME_CURR].fbId= 0;
+                  iter->videoFrame[FRAME_CURR].fbCached= false;
                   iter->videoFrame[FRAME_CURR].handle0= 0;
                   iter->videoFrame[FRAME_CURR].handle1= 0;
                   iter->videoFrame[FRAME_CURR].fd0= -1;
@@ -5914,9 +8368,17 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
          result= gRealEGLSwapBuffers( dpy, surface );
          if ( nwIter )
          {
+            pthread_mutex_unlock( &nwIter->mutexRefresh );
+
+            /* The refresh thread takes mutexRefresh while holding gMutex so take gMutex only after releasing it */
+            pthread_mutex_lock( &gMutex );
             gCtx->dirty= true;
             nwIter->dirty= true;
-            pthread_mutex_unlock( &nwIter->mutexRefresh );
+            if ( EGL_TRUE == result )
+            {
+               nwIter->swapCount= ++gCtx->swapCount;
+            }
+            pthread_mutex_unlock( &gMutex );
          }
       }
       else
@@ -5940,6 +8402,7 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
                   {
                      gCtx->dirty= true;
                      nwIter->dirty= true;
+                     nwIter->swapCount= ++gCtx->swapCount;
                      TRACE3("mark nw %p dirty", nwIter);
                      break;
                   }
@@ -5981,6 +8444,12 @@ WstGLCtx* WstGLInit()
       g_frameDebug= (level > 0 ? true : false);
    }
 
+   env= getenv( "WESTEROS_GL_NO_TRACE" );
+   if ( env )
+   {
+      gTraceEnabled= false;
+   }
+
    /*
     *  Establish the overloading of a subset of EGL methods
     */
@@ -6125,6 +8594,22 @@ bool _WstGLRemoveDisplaySizeListener( WstGLCtx *ctx, WstGLDisplaySizeCallback li
    return WstGLRemoveDisplaySizeListener( ctx, listener );
 }
 
+bool _WstGLGetVBlankInfo( WstGLCtx *ctx, long long *vblankTime, long long *vblankInterval, unsigned int *vblankSequence )
+{
+   return WstGLGetVBlankInfo( ctx, vblankTime, vblankInterval, vblankSequence );
+}
+
+unsigned int _WstGLGetSwapCount( WstGLCtx *ctx, void *nativeWindow )
+{
+   return WstGLGetSwapCount( ctx, nativeWindow );
+}
+
+int _WstGLGetPresentation( WstGLCtx *ctx, void *nativeWindow, unsigned int swapCount,
+                           long long *presentationTime, unsigned int *presentationSequence )
+{
+   return WstGLGetPresentation( ctx, nativeWindow, swapCount, presentationTime, presentationSequence );
+}
+
 bool WstGLGetDisplayCaps( WstGLCtx *ctx, unsigned int *caps )
 {
    bool result= false;
@@ -6473,6 +8958,102 @@ bool WstGLRemoveDisplaySizeListener( WstGLCtx *ctx, WstGLDisplaySizeCallback lis
    return result;
 }
 
+bool WstGLGetVBlankInfo( WstGLCtx *ctx, long long *vblankTime, long long *vblankInterval, unsigned int *vblankSequence )
+{
+   bool result= false;
+
+   if ( ctx && vblankTime && vblankInterval && vblankSequence )
+   {
+      // Times are CLOCK_MONOTONIC in microseconds.  Nothing is available when
+      // running without vblank waits (WESTEROS_GL_NO_VBLANK)
+      pthread_mutex_lock( &gMutex );
+      if ( ctx->lastVBlankTime && ctx->lastVBlankInterval )
+      {
+         *vblankTime= ctx->lastVBlankTime;
+         *vblankInterval= ctx->lastVBlankInterval;
+         *vblankSequence= ctx->lastVBlankSequence;
+         result= true;
+      }
+      pthread_mutex_unlock( &gMutex );
+   }
+
+   return result;
+}
+
+unsigned int WstGLGetSwapCount( WstGLCtx *ctx, void *nativeWindow )
+{
+   unsigned int swapCount= 0;
+   NativeWindowItem *nw;
+
+   // Presentation is only tracked when the vblank at which commits latch is known
+   if ( ctx && nativeWindow && ctx->useVBlank )
+   {
+      pthread_mutex_lock( &gMutex );
+      nw= ctx->nwFirst;
+      while( nw )
+      {
+         if ( nw->nativeWindow == nativeWindow )
+         {
+            swapCount= nw->swapCount;
+            break;
+         }
+         nw= nw->next;
+      }
+      pthread_mutex_unlock( &gMutex );
+   }
+
+   return swapCount;
+}
+
+int WstGLGetPresentation( WstGLCtx *ctx, void *nativeWindow, unsigned int swapCount,
+                          long long *presentationTime, unsigned int *presentationSequence )
+{
+   int result= WstGLPresentation_unknown;
+   NativeWindowItem *nw;
+
+   if ( ctx && nativeWindow && swapCount && presentationTime && presentationSequence )
+   {
+      pthread_mutex_lock( &gMutex );
+      nw= ctx->nwFirst;
+      while( nw )
+      {
+         if ( nw->nativeWindow == nativeWindow )
+         {
+            WstPresentRecord *newest= &nw->presented[(nw->presentedIndex+PRESENT_HISTORY-1) % PRESENT_HISTORY];
+            WstPresentRecord *oldest= &nw->presented[nw->presentedIndex];
+            int i;
+
+            if ( !newest->swapCount || ((int)(swapCount-newest->swapCount) > 0) )
+            {
+               result= WstGLPresentation_pending;
+               break;
+            }
+            for( i= 0; i < PRESENT_HISTORY; ++i )
+            {
+               if ( nw->presented[i].swapCount == swapCount )
+               {
+                  *presentationTime= nw->presented[i].time;
+                  *presentationSequence= nw->presented[i].sequence;
+                  result= WstGLPresentation_presented;
+                  break;
+               }
+            }
+            if ( (result == WstGLPresentation_unknown) &&
+                 (!oldest->swapCount || ((int)(swapCount-oldest->swapCount) > 0)) )
+            {
+               // Replaced by a later swap before any commit picked it up
+               result= WstGLPresentation_discarded;
+            }
+            break;
+         }
+         nw= nw->next;
+      }
+      pthread_mutex_unlock( &gMutex );
+   }
+
+   return result;
+}
+
 void* WstGLCreateNativeWindow( WstGLCtx *ctx, int x, int y, int width, int height )
 {
    void *nativeWindow= 0;
@@ -6621,9 +9202,7 @@ void WstGLDestroyNativeWindow( WstGLCtx *ctx, void *nativeWindow )
                if ( nwIter->prevBo )
                {
                   gbm_surface_release_buffer(gs, nwIter->prevBo);
-                  drmModeRmFB( ctx->drmFd, nwIter->prevFbId );
                   nwIter->prevBo= 0;
-                  nwIter->prevFbId= 0;
                }
                nwIter->nativeWindow= 0;
                if ( nwIter->windowPlane )
@@ -59,6 +59,18 @@ typedef struct _WstGLDisplayInfo
 
 typedef void (*WstGLDisplaySizeCallback)( void *userData, int width, int height );
 
+/*
+ * Presentation state of a swap as returned by WstGLGetPresentation.  The
+ * values match WstPresentation in westeros-render.h
+ */
+typedef enum _WstGLPresentation
+{
+   WstGLPresentation_unknown= 0,
+   WstGLPresentation_pending,
+   WstGLPresentation_presented,
+   WstGLPresentation_discarded
+} WstGLPresentation;
+
 WstGLCtx* WstGLInit();
 void WstGLTerm( WstGLCtx *ctx );
 bool WstGLGetDisplayCaps( WstGLCtx *ctx, unsigned int *caps );
@@ -67,6 +79,10 @@ bool WstGLGetDisplayInfo( WstGLCtx *ctx, WstGLDisplayInfo *displayInfo );
 bool WstGLGetDisplaySafeArea( WstGLCtx *ctx, int *x, int *y, int *w, int *h );
 bool WstGLAddDisplaySizeListener( WstGLCtx *ctx, void *userData, WstGLDisplaySizeCallback listener );
 bool WstGLRemoveDisplaySizeListener( WstGLCtx *ctx, WstGLDisplaySizeCallback listener );
+bool WstGLGetVBlankInfo( WstGLCtx *ctx, long long *vblankTime, long long *vblankInterval, unsigned int *vblankSequence );
+unsigned int WstGLGetSwapCount( WstGLCtx *ctx, void *nativeWindow );
+int WstGLGetPresentation( WstGLCtx *ctx, void *nativeWindow, unsigned int swapCount,
+                          long long *presentationTime, unsigned int *presentationSequence );
 void* WstGLCreateNativeWindow( WstGLCtx *ctx, int x, int y, int width, int height );
 void WstGLDestroyNativeWindow( WstGLCtx *ctx, void *nativeWindow );
 bool WstGLGetNativePixmap( WstGLCtx *ctx, void *nativeBuffer, void **nativePixmap );
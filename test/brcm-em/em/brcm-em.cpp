@@ -396,6 +396,7 @@ typedef struct _EMCTX
    GLint scissorBox[4];
    GLint viewport[4];
    bool scissorEnable;
+   bool blendEnable;
    GLuint currentProgramId;
    GLfloat textureWrapS;
    GLfloat textureWrapT;
@@ -425,6 +426,10 @@ typedef struct _EMCTX
    void *bufferPushedUserData;
    EMHolePunched holePunchedCB;
    void *holePunchedUserData;
+   EMTextureUpdated textureUpdatedCB;
+   void *textureUpdatedUserData;
+   EMDisplaySwap displaySwapCB;
+   void *displaySwapUserData;
 
    int deviceCount;
    int deviceNextFd;
@@ -803,12 +808,24 @@ void EMSetBufferPushedCallback( EMCTX *ctx, EMBufferPushed cb, void *userData )
    ctx->bufferPushedUserData= userData;
 }
 
+void EMSetTextureUpdatedCallback( EMCTX *ctx, EMTextureUpdated cb, void *userData )
+{
+   ctx->textureUpdatedCB= cb;
+   ctx->textureUpdatedUserData= userData;
+}
+
 void EMSetHolePunchedCallback( EMCTX *ctx, EMHolePunched cb, void *userData )
 {
    ctx->holePunchedCB= cb;
    ctx->holePunchedUserData= userData;
 }
 
+void EMSetDisplaySwapCallback( EMCTX *ctx, EMDisplaySwap cb, void *userData )
+{
+   ctx->displaySwapCB= cb;
+   ctx->displaySwapUserData= userData;
+}
+
 void EMPushGamepadEvent( EMCTX *ctx, int type, int id, int value )
 {
    for( int i= 0; i < EM_DEVICE_MAX; ++i )
@@ -4234,7 +4251,12 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay display, EGLSurface surface )
    }
    else
    {
-      // Emulated 'normal' render to screen.  Nothing to do.
+      // Emulated 'normal' render to screen.  Tests may hook it, eg. to stall the swap.
+      EMCTX *ctx= emGetContext();
+      if ( ctx && ctx->displaySwapCB )
+      {
+         ctx->displaySwapCB( ctx, ctx->displaySwapUserData );
+      }
    }
 
    result= EGL_TRUE;
@@ -4243,6 +4265,41 @@ exit:
    return result;
 }
 
+EGLAPI EGLBoolean EGLAPIENTRY eglQuerySurface( EGLDisplay display,
+                                 EGLSurface surface,
+                                 EGLint attribute,
+                                 EGLint *value )
+{
+   EGLBoolean result= EGL_FALSE;
+   EMEGLDisplay *dsp= (EMEGLDisplay*)display;
+
+   TRACE1("eglQuerySurface for %X", attribute );
+
+   if ( display == EGL_NO_DISPLAY )
+   {
+      gEGLError= EGL_BAD_DISPLAY;
+      goto exit;
+   }
+
+   if ( dsp->magic != EM_EGL_DISPLAY_MAGIC )
+   {
+      gEGLError= EGL_BAD_DISPLAY;
+      goto exit;
+   }   
+
+   if ( !dsp->initialized )
+   {
+      gEGLError= EGL_NOT_INITIALIZED;
+      goto exit;
+   }
+
+   // No surface attributes are currently emulated
+   gEGLError= EGL_BAD_ATTRIBUTE;
+
+exit:
+   return result;
+}
+
 EGLAPI EGLBoolean EGLAPIENTRY eglSwapInterval( EGLDisplay display,
                                  EGLint interval )
 {
@@ -5479,7 +5536,31 @@ GL_APICALL void GL_APIENTRY glDetachShader (GLuint program, GLuint shader)
 
 GL_APICALL void GL_APIENTRY glDisable (GLenum cap)
 {
+   EMCTX *ctx= 0;
+
    TRACE1("glDisable");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glDisable: emGetContext failed");
+      goto exit;
+   }
+
+   switch( cap )
+   {
+      case GL_SCISSOR_TEST:
+         ctx->scissorEnable= false;
+         break;
+      case GL_BLEND:
+         ctx->blendEnable= false;
+         break;
+      default:
+         break;
+   }
+
+exit:
+   return;
 }
 
 GL_APICALL void GL_APIENTRY glDisableVertexAttribArray (GLuint index)
@@ -5556,7 +5637,31 @@ GL_APICALL void GL_APIENTRY glEGLImageTargetTexture2DOES (GLenum target, GLeglIm
 
 GL_APICALL void GL_APIENTRY glEnable (GLenum cap)
 {
+   EMCTX *ctx= 0;
+
    TRACE1("glEnable");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glEnable: emGetContext failed");
+      goto exit;
+   }
+
+   switch( cap )
+   {
+      case GL_SCISSOR_TEST:
+         ctx->scissorEnable= true;
+         break;
+      case GL_BLEND:
+         ctx->blendEnable= true;
+         break;
+      default:
+         break;
+   }
+
+exit:
+   return;
 }
 
 GL_APICALL void GL_APIENTRY glEnableVertexAttribArray (GLuint index)
@@ -5858,6 +5963,9 @@ GL_APICALL GLboolean GL_APIENTRY glIsEnabled (GLenum cap)
       case GL_SCISSOR_TEST:
          result= ctx->scissorEnable;
          break;
+      case GL_BLEND:
+         result= ctx->blendEnable;
+         break;
       default:
          WARNING("glIsEnabled: unsupported cap: %x", cap);
          break;
@@ -5930,6 +6038,36 @@ exit:
    return;
 }
 
+GL_APICALL void GL_APIENTRY glTexSubImage2D (GLenum target,
+                                             GLint level,
+                                             GLint xoffset,
+                                             GLint yoffset,
+                                             GLsizei width,
+                                             GLsizei height,
+                                             GLenum format,
+                                             GLenum type,
+                                             const void *pixels)
+{
+   EMCTX *ctx= 0;
+
+   TRACE1("glTexSubImage2D");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glTexSubImage2D: emGetContext failed");
+      goto exit;
+   }
+
+   if ( ctx->textureUpdatedCB )
+   {
+      ctx->textureUpdatedCB( ctx, ctx->textureUpdatedUserData, xoffset, yoffset, width, height );
+   }
+
+exit:
+   return;
+}
+
 GL_APICALL void GL_APIENTRY glTexParameterf (GLenum target, GLenum pname, GLfloat param)
 {
    EMCTX *ctx= 0;
@@ -242,6 +242,8 @@ typedef enum _EM_DEVICE_TYPE
 
 #define EM_DRM_MODE_MAX (32)
 #define EM_DRM_HANDLE_MAX (32)
+#define EM_DRM_DUMB_PITCH_ALIGN (256)
+#define EM_DRM_BLOB_MAX (8)
 #define EM_V4L2_FMT_MAX (32)
 #define EM_V4L2_INBUFF_MAX (4)
 #define EM_V4L2_OUTBUFF_MAX (12)
@@ -265,6 +267,8 @@ typedef struct _EMDrmHandle
    uint32_t handle;
    int fd;
    uint32_t fbId;
+   bool dumb;
+   ino_t ino;
 } EMDrmHandle;
 
 typedef struct _EMDevice
@@ -299,6 +303,22 @@ typedef struct _EMDevice
          drmModePlane planes[3];
          EMSurfaceClient videoPlane[1];
          EMDrmHandle handles[EM_DRM_HANDLE_MAX];
+         int blobNext;
+         uint32_t blobIds[EM_DRM_BLOB_MAX];
+         drmModeModeInfo blobModes[EM_DRM_BLOB_MAX];
+         long long vblankBase;
+         bool vrrEnabled;
+         long long vrrLastFlipTime;
+         bool flipEventPending;
+         long long flipEventTime;
+         unsigned int flipEventSequence;
+         void *flipEventData;
+         bool vblankEventPending;
+         long long vblankEventTime;
+         unsigned int vblankEventSequence;
+         void *vblankEventData;
+         long long commitLatchTime;
+         unsigned int commitLatchSequence;
       } drm;
       struct _v4l2
       {
@@ -359,6 +379,8 @@ struct gbm_bo
    bool locked;
    union gbm_bo_handle handle;
    uint32_t fbId;
+   void *userData;
+   void (*destroyUserData)( struct gbm_bo *bo, void *userData );
 };
 
 struct gbm_surface
@@ -459,6 +481,7 @@ typedef struct _EMCTX
    GLint scissorBox[4];
    GLint viewport[4];
    bool scissorEnable;
+   bool blendEnable;
    GLuint currentProgramId;
    GLfloat textureWrapS;
    GLfloat textureWrapT;
@@ -477,9 +500,29 @@ typedef struct _EMCTX
    void *textureCreatedUserData;
    EMHolePunched holePunchedCB;
    void *holePunchedUserData;
+   EMTextureUpdated textureUpdatedCB;
+   void *textureUpdatedUserData;
+   EMDisplaySwap displaySwapCB;
+   void *displaySwapUserData;
 
    uint32_t nextGbmBuffHandle;
    std::vector<struct gbm_bo*> gbmBuffs;
+   int drmFlipEventCount;
+   int drmFlipEventHandledCount;
+   int drmFlipEventBusyCount;
+   long long drmFlipEventLastTime;
+   long long drmFlipEventMinInterval;
+   int drmTestCommitCount;
+   int drmTestCommitRejectCount;
+   bool drmRejectScaledVideo;
+   int drmVideoPlaneDisableCount;
+   int drmGemCloseErrorCount;
+   int drmModeScriptCount;
+   drmModeModeInfo drmModeScript[EM_DRM_MODE_MAX];
+   int drmModeSetCount;
+   int drmModeRate;
+   bool drmVrrCapable;
+   bool drmVrrEnabled;
 
    int deviceCount;
    int deviceNextFd;
@@ -669,6 +712,155 @@ long long EMGetCurrentTimeMicro(void)
    return utcCurrentTimeMicro;
 }
 
+static long long EMGetMonotonicTimeMicro(void)
+{
+   struct timespec tm;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+
+   return tm.tv_sec*1000000LL + tm.tv_nsec/1000LL;
+}
+
+int EMGetDrmFlipEventCount( EMCTX *ctx )
+{
+   return ctx->drmFlipEventCount;
+}
+
+int EMGetDrmFlipEventHandledCount( EMCTX *ctx )
+{
+   return ctx->drmFlipEventHandledCount;
+}
+
+int EMGetDrmFlipEventBusyCount( EMCTX *ctx )
+{
+   return ctx->drmFlipEventBusyCount;
+}
+
+long long EMGetDrmFlipEventMinInterval( EMCTX *ctx )
+{
+   return ctx->drmFlipEventMinInterval;
+}
+
+void EMResetDrmFlipEventStats( EMCTX *ctx )
+{
+   ctx->drmFlipEventHandledCount= 0;
+   ctx->drmFlipEventBusyCount= 0;
+   ctx->drmFlipEventLastTime= 0;
+   ctx->drmFlipEventMinInterval= 0;
+}
+
+void EMSetDrmRejectScaledVideo( EMCTX *ctx, bool reject )
+{
+   ctx->drmRejectScaledVideo= reject;
+}
+
+int EMGetDrmTestCommitCount( EMCTX *ctx )
+{
+   return ctx->drmTestCommitCount;
+}
+
+int EMGetDrmTestCommitRejectCount( EMCTX *ctx )
+{
+   return ctx->drmTestCommitRejectCount;
+}
+
+int EMGetDrmVideoPlaneDisableCount( EMCTX *ctx )
+{
+   return ctx->drmVideoPlaneDisableCount;
+}
+
+int EMGetDrmGemCloseErrorCount( EMCTX *ctx )
+{
+   return ctx->drmGemCloseErrorCount;
+}
+
+/*
+ * Replace the connector mode list of drm devices opened from now on.  The
+ * list is a comma separated set of modes of the form <w>x<h><p|i><rate>
+ * where rate may be fractional, eg. "1920x1080p60,1920x1080p23.976".  The
+ * first mode is the preferred mode.  A null or empty list restores the
+ * default modes.
+ */
+bool EMSetDrmModes( EMCTX *ctx, const char *modes )
+{
+   bool result= false;
+   char *list= 0, *tok, *save= 0;
+   int count= 0;
+
+   if ( modes && modes[0] )
+   {
+      list= strdup( modes );
+      if ( !list )
+      {
+         goto exit;
+      }
+      for( tok= strtok_r( list, ",", &save ); tok; tok= strtok_r( 0, ",", &save ) )
+      {
+         drmModeModeInfo *mode;
+         int width, height;
+         char scan;
+         float rate;
+
+         if ( count >= EM_DRM_MODE_MAX )
+         {
+            ERROR("EMSetDrmModes: too many modes");
+            goto exit;
+         }
+         if ( (sscanf( tok, "%dx%d%c%f", &width, &height, &scan, &rate ) != 4) ||
+              (width <= 0) || (height <= 0) || (rate <= 0.0) ||
+              ((scan != 'p') && (scan != 'i')) )
+         {
+            ERROR("EMSetDrmModes: bad mode (%s)", tok);
+            goto exit;
+         }
+
+         mode= &ctx->drmModeScript[count];
+         memset( mode, 0, sizeof(drmModeModeInfo) );
+         mode->hdisplay= width;
+         mode->vdisplay= height;
+         mode->htotal= width+280;
+         mode->vtotal= height+45;
+         mode->vrefresh= (int)(rate+0.5);
+         mode->clock= (int)((double)mode->htotal*mode->vtotal*rate/((scan == 'i') ? 2000.0 : 1000.0)+0.5);
+         mode->type= DRM_MODE_TYPE_DRIVER | (count == 0 ? DRM_MODE_TYPE_PREFERRED : 0);
+         mode->flags= DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC | ((scan == 'i') ? DRM_MODE_FLAG_INTERLACE : 0);
+         snprintf( mode->name, DRM_DISPLAY_MODE_LEN, "%dx%d%s", width, height, ((scan == 'i') ? "i" : "") );
+         ++count;
+      }
+   }
+
+   ctx->drmModeScriptCount= count;
+   result= true;
+
+exit:
+   if ( list )
+   {
+      free( list );
+   }
+
+   return result;
+}
+
+int EMGetDrmModeSetCount( EMCTX *ctx )
+{
+   return ctx->drmModeSetCount;
+}
+
+int EMGetDrmModeRate( EMCTX *ctx )
+{
+   return ctx->drmModeRate;
+}
+
+void EMSetDrmVrrCapable( EMCTX *ctx, bool capable )
+{
+   ctx->drmVrrCapable= capable;
+}
+
+bool EMGetDrmVrrEnabled( EMCTX *ctx )
+{
+   return ctx->drmVrrEnabled;
+}
+
 void EMSetVideoCodec( EMCTX *ctx, int codec )
 {
    ctx->videoCodec= codec;
@@ -803,12 +995,24 @@ void EMSetTextureCreatedCallback( EMCTX *ctx, EMTextureCreated cb, void *userDat
    ctx->textureCreatedUserData= userData;
 }
 
+void EMSetTextureUpdatedCallback( EMCTX *ctx, EMTextureUpdated cb, void *userData )
+{
+   ctx->textureUpdatedCB= cb;
+   ctx->textureUpdatedUserData= userData;
+}
+
 void EMSetHolePunchedCallback( EMCTX *ctx, EMHolePunched cb, void *userData )
 {
    ctx->holePunchedCB= cb;
    ctx->holePunchedUserData= userData;
 }
 
+void EMSetDisplaySwapCallback( EMCTX *ctx, EMDisplaySwap cb, void *userData )
+{
+   ctx->displaySwapCB= cb;
+   ctx->displaySwapUserData= userData;
+}
+
 void EMPushGamepadEvent( EMCTX *ctx, int type, int id, int value )
 {
    for( int i= 0; i < EM_DEVICE_MAX; ++i )
@@ -1000,7 +1204,9 @@ enum _EM_DRM_PROP_IDS
    EM_DRM_PROP_SRC_X,
    EM_DRM_PROP_SRC_Y,
    EM_DRM_PROP_SRC_W,
-   EM_DRM_PROP_SRC_H
+   EM_DRM_PROP_SRC_H,
+   EM_DRM_PROP_VRR_CAPABLE,
+   EM_DRM_PROP_VRR_ENABLED
 };
 
 static void EMDrmDeviceInit( EMDevice *d )
@@ -1095,6 +1301,16 @@ static void EMDrmDeviceInit( EMDevice *d )
 
    d->dev.drm.countModes= i;
 
+   if ( d->ctx->drmModeScriptCount > 0 )
+   {
+      TRACE1("EMDrmDeviceInit: using scripted mode list of %d modes", d->ctx->drmModeScriptCount);
+      for( i= 0; i < d->ctx->drmModeScriptCount; ++i )
+      {
+         d->dev.drm.modes[i]= d->ctx->drmModeScript[i];
+      }
+      d->dev.drm.countModes= i;
+   }
+
    d->dev.drm.countCrtcs= 1;
    d->dev.drm.crtcs[0].crtc_id= ++d->dev.drm.nextId;
    d->dev.drm.crtcs[0].mode_valid= 1;
@@ -1111,6 +1327,10 @@ static void EMDrmDeviceInit( EMDevice *d )
       }
    }
 
+   d->dev.drm.vblankBase= EMGetMonotonicTimeMicro();
+   d->dev.drm.flipEventPending= false;
+   d->dev.drm.vblankEventPending= false;
+
    d->dev.drm.countEncoders= 1;
    d->dev.drm.encoders[0].encoder_id= ++d->dev.drm.nextId;
    d->dev.drm.encoders[0].crtc_id= d->dev.drm.crtcs[0].crtc_id;
@@ -1224,6 +1444,12 @@ static void EMDrmDeviceInit( EMDevice *d )
    d->dev.drm.properties[i].prop_id= ++d->dev.drm.nextId;
    strcpy( d->dev.drm.properties[i].name, "SRC_H" );
    ++i;
+   d->dev.drm.properties[i].prop_id= ++d->dev.drm.nextId;
+   strcpy( d->dev.drm.properties[i].name, "vrr_capable" );
+   ++i;
+   d->dev.drm.properties[i].prop_id= ++d->dev.drm.nextId;
+   strcpy( d->dev.drm.properties[i].name, "VRR_ENABLED" );
+   ++i;
    d->dev.drm.countProperties= i;
 
    for( i= 0; i < EM_DRM_HANDLE_MAX; ++i )
@@ -1231,6 +1457,8 @@ static void EMDrmDeviceInit( EMDevice *d )
       d->dev.drm.handles[i].handle= i+1;
       d->dev.drm.handles[i].fd= -1;
       d->dev.drm.handles[i].fbId= 0;
+      d->dev.drm.handles[i].dumb= false;
+      d->dev.drm.handles[i].ino= 0;
    }
 
    if ( gDrmOpenCount == 0 )
@@ -1262,6 +1490,15 @@ static void EMDrmDeviceInit( EMDevice *d )
 static void EMDrmDeviceTerm( EMDevice *d )
 {
    TRACE1("EMDrmDeviceTerm");
+   for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
+   {
+      if ( d->dev.drm.handles[i].dumb )
+      {
+         close( d->dev.drm.handles[i].fd );
+         d->dev.drm.handles[i].fd= -1;
+         d->dev.drm.handles[i].dumb= false;
+      }
+   }
    if ( gDrmOpenCount > 0 )
    {
       --gDrmOpenCount;
@@ -1839,8 +2076,66 @@ static int EMDrmIOctl( EMDevice *dev, int fd, int request, void *arg )
             {
                if ( dev->dev.drm.handles[i].handle == close->handle )
                {
+                  if ( dev->dev.drm.handles[i].fd == -1 )
+                  {
+                     /* Closing a handle that is not open fails as on a real device */
+                     ++dev->ctx->drmGemCloseErrorCount;
+                     errno= EINVAL;
+                     break;
+                  }
                   dev->dev.drm.handles[i].fd= -1;
                   dev->dev.drm.handles[i].fbId= 0;
+                  dev->dev.drm.handles[i].ino= 0;
+                  rc= 0;
+                  break;
+               }
+            }
+         }
+         break;
+      case DRM_IOCTL_MODE_CREATE_DUMB:
+         {
+            struct drm_mode_create_dumb *createDumb= (struct drm_mode_create_dumb *)arg;
+            /* Pad the pitch more than clients align to so they must use the pitch returned */
+            createDumb->pitch= ((createDumb->width*((createDumb->bpp+7)/8))+EM_DRM_DUMB_PITCH_ALIGN-1)&~(EM_DRM_DUMB_PITCH_ALIGN-1);
+            createDumb->size= (uint64_t)createDumb->pitch*createDumb->height;
+            TRACE1("DRM_IOCTL_MODE_CREATE_DUMB: %dx%d bpp %d pitch %d", createDumb->width, createDumb->height, createDumb->bpp, createDumb->pitch );
+            for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
+            {
+               if ( dev->dev.drm.handles[i].fd == -1 )
+               {
+                  int memFd= memfd_create( "em-dumb", MFD_CLOEXEC );
+                  if ( memFd >= 0 )
+                  {
+                     if ( ftruncate( memFd, createDumb->size ) == 0 )
+                     {
+                        dev->dev.drm.handles[i].fd= memFd;
+                        dev->dev.drm.handles[i].fbId= 0;
+                        dev->dev.drm.handles[i].dumb= true;
+                        createDumb->handle= dev->dev.drm.handles[i].handle;
+                        rc= 0;
+                     }
+                     else
+                     {
+                        close( memFd );
+                     }
+                  }
+                  break;
+               }
+            }
+         }
+         break;
+      case DRM_IOCTL_MODE_DESTROY_DUMB:
+         {
+            struct drm_mode_destroy_dumb *destroyDumb= (struct drm_mode_destroy_dumb *)arg;
+            TRACE1("DRM_IOCTL_MODE_DESTROY_DUMB: handle %u", destroyDumb->handle );
+            for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
+            {
+               if ( (dev->dev.drm.handles[i].handle == destroyDumb->handle) && dev->dev.drm.handles[i].dumb )
+               {
+                  close( dev->dev.drm.handles[i].fd );
+                  dev->dev.drm.handles[i].fd= -1;
+                  dev->dev.drm.handles[i].fbId= 0;
+                  dev->dev.drm.handles[i].dumb= false;
                   rc= 0;
                   break;
                }
@@ -2843,6 +3138,106 @@ exit:
    return rc;
 }
 
+/*
+ * Emulated vblanks occur at fixed intervals of the current crtc mode's
+ * refresh period measured from device initialization
+ */
+static long long EMDrmGetVBlank( EMDevice *dev, long long t, int count, unsigned int *sequence )
+{
+   long long interval;
+   long long index;
+   int vrefresh= dev->dev.drm.crtcs[0].mode.vrefresh;
+
+   interval= 1000000LL/(vrefresh ? vrefresh : 60);
+   index= (t-dev->dev.drm.vblankBase)/interval + count;
+   if ( sequence )
+   {
+      *sequence= (unsigned int)index;
+   }
+
+   return dev->dev.drm.vblankBase + index*interval;
+}
+
+/*
+ * A flip normally completes at the next vblank.  With variable refresh the
+ * panel starts a new frame as soon as a flip arrives, limited by the mode's
+ * refresh rate.
+ */
+static long long EMDrmGetFlipTime( EMDevice *dev, long long t, unsigned int *sequence )
+{
+   long long flipTime;
+
+   if ( dev->dev.drm.vrrEnabled )
+   {
+      int vrefresh= dev->dev.drm.crtcs[0].mode.vrefresh;
+      long long interval= 1000000LL/(vrefresh ? vrefresh : 60);
+
+      flipTime= dev->dev.drm.vrrLastFlipTime + interval;
+      if ( flipTime < t )
+      {
+         flipTime= t;
+      }
+      *sequence= dev->dev.drm.flipEventSequence+1;
+   }
+   else
+   {
+      flipTime= EMDrmGetVBlank( dev, t, 1, sequence );
+   }
+   dev->dev.drm.vrrLastFlipTime= flipTime;
+
+   return flipTime;
+}
+
+static int EMDrmPoll( EMDevice *dev, struct pollfd *fds, int nfds, int timeout )
+{
+   int rc= 0;
+   long long now, due= 0;
+
+   if ( dev->dev.drm.flipEventPending )
+   {
+      due= dev->dev.drm.flipEventTime;
+   }
+   if ( dev->dev.drm.vblankEventPending )
+   {
+      if ( !due || (dev->dev.drm.vblankEventTime < due) )
+      {
+         due= dev->dev.drm.vblankEventTime;
+      }
+   }
+
+   now= EMGetMonotonicTimeMicro();
+   if ( due )
+   {
+      if ( (due > now) && (timeout >= 0) && (due-now > timeout*1000LL) )
+      {
+         usleep( timeout*1000LL );
+      }
+      else
+      {
+         if ( due > now )
+         {
+            usleep( due-now );
+         }
+         for( int i= 0; i < nfds; ++i )
+         {
+            if ( fds[i].fd == dev->fd )
+            {
+               TRACE1("EMDrmPoll: POLLIN");
+               fds[i].revents |= POLLIN;
+               rc= 1;
+               break;
+            }
+         }
+      }
+   }
+   else if ( timeout > 0 )
+   {
+      usleep( timeout*1000LL );
+   }
+
+   return rc;
+}
+
 static int EMDevicePoll( struct pollfd *fds, int nfds, int timeout )
 {
    int rc= -1;
@@ -2864,6 +3259,7 @@ static int EMDevicePoll( struct pollfd *fds, int nfds, int timeout )
          switch( ctx->devices[i].type )
          {
             case EM_DEVICE_TYPE_DRM:
+               rc= EMDrmPoll( &ctx->devices[i], fds, nfds, timeout );
                break;
             case EM_DEVICE_TYPE_V4L2:
                rc= EMV4l2Poll( &ctx->devices[i], fds, nfds, timeout );
@@ -3277,14 +3673,58 @@ int drmWaitVBlank( int fd, drmVBlankPtr vbl )
 {
    int rc= 0;
 
+   static unsigned int sequence= 0;
+
    TRACE1("drmWaitVBlank");
 
+   if ( vbl && (vbl->request.type & DRM_VBLANK_EVENT) )
+   {
+      EMDevice *dev= EMDrmGetDevice(fd);
+      if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) )
+      {
+         long long now= EMGetMonotonicTimeMicro();
+         int count= (vbl->request.type & DRM_VBLANK_RELATIVE) ? vbl->request.sequence : 1;
+         dev->dev.drm.vblankEventTime= EMDrmGetVBlank( dev, now, (count > 0 ? count : 1), &dev->dev.drm.vblankEventSequence );
+         dev->dev.drm.vblankEventData= (void*)vbl->request.signal;
+         dev->dev.drm.vblankEventPending= true;
+         vbl->reply.sequence= dev->dev.drm.vblankEventSequence;
+         vbl->reply.tval_sec= 0;
+         vbl->reply.tval_usec= 0;
+      }
+      else
+      {
+         errno= EINVAL;
+         rc= -1;
+      }
+      goto exit;
+   }
+
+   if ( vbl && (vbl->request.type & DRM_VBLANK_RELATIVE) && (vbl->request.sequence == 0) )
+   {
+      EMDevice *dev= EMDrmGetDevice(fd);
+      if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) )
+      {
+         // Query of the current vblank: completes without waiting.  A blocking
+         // commit would only have returned after its latch vblank.
+         long long t= EMDrmGetVBlank( dev, EMGetMonotonicTimeMicro(), 0, &vbl->reply.sequence );
+         if ( dev->dev.drm.commitLatchTime > t )
+         {
+            t= dev->dev.drm.commitLatchTime;
+            vbl->reply.sequence= dev->dev.drm.commitLatchSequence;
+         }
+         vbl->reply.tval_sec= t / 1000000LL;
+         vbl->reply.tval_usec= t % 1000000LL;
+         goto exit;
+      }
+   }
+
    usleep( 16000 );
 
    if ( vbl )
    {
       int rc;
       struct timespec tm;
+      vbl->reply.sequence= ++sequence;
       rc= clock_gettime( CLOCK_MONOTONIC, &tm );
       if ( !rc )
       {
@@ -3303,6 +3743,57 @@ int drmWaitVBlank( int fd, drmVBlankPtr vbl )
       }
    }
 
+exit:
+   return rc;
+}
+
+int drmHandleEvent( int fd, drmEventContextPtr evctx )
+{
+   int rc= -1;
+   EMDevice *dev= 0;
+
+   TRACE1("drmHandleEvent");
+
+   dev= EMDrmGetDevice(fd);
+   if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) && evctx )
+   {
+      long long now= EMGetMonotonicTimeMicro();
+      if ( dev->dev.drm.vblankEventPending && (dev->dev.drm.vblankEventTime <= now) )
+      {
+         long long t= dev->dev.drm.vblankEventTime;
+         dev->dev.drm.vblankEventPending= false;
+         if ( evctx->vblank_handler )
+         {
+            evctx->vblank_handler( fd, dev->dev.drm.vblankEventSequence,
+                                   (unsigned int)(t / 1000000LL), (unsigned int)(t % 1000000LL),
+                                   dev->dev.drm.vblankEventData );
+         }
+      }
+      if ( dev->dev.drm.flipEventPending && (dev->dev.drm.flipEventTime <= now) )
+      {
+         EMCTX *ctx= emGetContext();
+         long long t= dev->dev.drm.flipEventTime;
+         dev->dev.drm.flipEventPending= false;
+         if ( ctx )
+         {
+            if ( ctx->drmFlipEventHandledCount &&
+                 (!ctx->drmFlipEventMinInterval || (t-ctx->drmFlipEventLastTime < ctx->drmFlipEventMinInterval)) )
+            {
+               ctx->drmFlipEventMinInterval= t-ctx->drmFlipEventLastTime;
+            }
+            ctx->drmFlipEventLastTime= t;
+            ++ctx->drmFlipEventHandledCount;
+         }
+         if ( evctx->page_flip_handler )
+         {
+            evctx->page_flip_handler( fd, dev->dev.drm.flipEventSequence,
+                                      (unsigned int)(t / 1000000LL), (unsigned int)(t % 1000000LL),
+                                      dev->dev.drm.flipEventData );
+         }
+      }
+      rc= 0;
+   }
+
    return rc;
 }
 
@@ -3510,7 +4001,7 @@ drmModeObjectPropertiesPtr drmModeObjectGetProperties( int fd, uint32_t objectId
                   props= (drmModeObjectProperties*)calloc( 1, sizeof(drmModeObjectProperties));
                   if ( props )
                   {
-                     props->count_props= 1;
+                     props->count_props= 2;
                      props->props= (uint32_t*)calloc( props->count_props, sizeof(uint32_t) );
                      props->prop_values= (uint64_t*)calloc( props->count_props, sizeof(uint64_t) );
                      if ( props->props && props->prop_values )
@@ -3518,10 +4009,12 @@ drmModeObjectPropertiesPtr drmModeObjectGetProperties( int fd, uint32_t objectId
                         if ( props->props )
                         {
                            props->props[0]= dev->dev.drm.properties[EM_DRM_PROP_CRTC_ID].prop_id;
+                           props->props[1]= dev->dev.drm.properties[EM_DRM_PROP_VRR_CAPABLE].prop_id;
                         }
                         if ( props->prop_values )
                         {               
                            props->prop_values[0]= dev->dev.drm.crtcs[0].crtc_id;
+                           props->prop_values[1]= (dev->ctx->drmVrrCapable ? 1 : 0);
                         }
                      }
                      else
@@ -3542,7 +4035,7 @@ drmModeObjectPropertiesPtr drmModeObjectGetProperties( int fd, uint32_t objectId
                   props= (drmModeObjectProperties*)calloc( 1, sizeof(drmModeObjectProperties));
                   if ( props )
                   {
-                     props->count_props= 3;
+                     props->count_props= 4;
                      props->props= (uint32_t*)calloc( props->count_props, sizeof(uint32_t) );
                      props->prop_values= (uint64_t*)calloc( props->count_props, sizeof(uint64_t) );
                      if ( props->props && props->prop_values )
@@ -3552,12 +4045,14 @@ drmModeObjectPropertiesPtr drmModeObjectGetProperties( int fd, uint32_t objectId
                            props->props[0]= dev->dev.drm.properties[EM_DRM_PROP_ACTIVE].prop_id;
                            props->props[1]= dev->dev.drm.properties[EM_DRM_PROP_MODE_ID].prop_id;
                            props->props[2]= dev->dev.drm.properties[EM_DRM_PROP_OUT_FENCE_PTR].prop_id;
+                           props->props[3]= dev->dev.drm.properties[EM_DRM_PROP_VRR_ENABLED].prop_id;
                         }
                         if ( props->prop_values )
                         {               
                            props->prop_values[0]= 1;
                            props->prop_values[1]= 0;
                            props->prop_values[2]= dev->dev.drm.crtcOutFenceFd;
+                           props->prop_values[3]= (dev->dev.drm.vrrEnabled ? 1 : 0);
                         }
                      }
                      else
@@ -3793,12 +4288,24 @@ int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
    int rc= -1;
    EMDevice *dev= 0;
    uint32_t hndl= 0;
+   struct stat st;
 
    TRACE1("drmPrimeFDToHandle: fd %d prime_fd %d", fd, prime_fd);
 
    dev= EMDrmGetDevice(fd);
-   if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) )
+   if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) && (fstat( prime_fd, &st ) == 0) )
    {
+      /* Importing a buffer that already has a handle returns that handle */
+      for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
+      {
+         if ( (dev->dev.drm.handles[i].fd != -1) && !dev->dev.drm.handles[i].dumb &&
+              (dev->dev.drm.handles[i].ino == st.st_ino) )
+         {
+            hndl= dev->dev.drm.handles[i].handle;
+            rc= 0;
+            goto exit;
+         }
+      }
       for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
       {
          if ( dev->dev.drm.handles[i].fd == -1 )
@@ -3806,17 +4313,48 @@ int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
             hndl= dev->dev.drm.handles[i].handle;
             dev->dev.drm.handles[i].fd= prime_fd;
             dev->dev.drm.handles[i].fbId= 0;
+            dev->dev.drm.handles[i].ino= st.st_ino;
             rc= 0;
             break;
          }
       }
    }
 
+exit:
+
    *handle= hndl;
 
    return rc;
 }
 
+int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd)
+{
+   int rc= -1;
+   EMDevice *dev= 0;
+
+   TRACE1("drmPrimeHandleToFD: fd %d handle %u", fd, handle);
+
+   dev= EMDrmGetDevice(fd);
+   if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) )
+   {
+      for( int i= 0; i < EM_DRM_HANDLE_MAX; ++i )
+      {
+         if ( (dev->dev.drm.handles[i].handle == handle) && dev->dev.drm.handles[i].dumb )
+         {
+            /* The exported fd shares the dumb buffer's memory and outlives its handle */
+            *prime_fd= fcntl( dev->dev.drm.handles[i].fd, (flags & DRM_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0 );
+            if ( *prime_fd >= 0 )
+            {
+               rc= 0;
+            }
+            break;
+         }
+      }
+   }
+
+   return rc;
+}
+
 int drmModeAddFB( int fd, uint32_t width, uint32_t height,
                   uint8_t depth, uint8_t bpp, uint32_t pitch,
                   uint32_t bo_handle, uint32_t *buf_id )
@@ -3969,9 +4507,19 @@ int drmModeRmFB( int fd, uint32_t bufferId )
 }
 
 #define EM_DRM_ATOMIC_MAGIC (0x98126527)
+#define EM_DRM_ATOMIC_MAX_ITEMS (256)
+typedef struct _EMDrmAtomicItem
+{
+   uint32_t objectId;
+   uint32_t propertyId;
+   uint64_t value;
+} EMDrmAtomicItem;
+
 struct _drmModeAtomicReq
 {
    uint32_t magic;
+   int cursor;
+   EMDrmAtomicItem items[EM_DRM_ATOMIC_MAX_ITEMS];
 };
 
 drmModeAtomicReqPtr drmModeAtomicAlloc(void)
@@ -4007,37 +4555,61 @@ int drmModeAtomicAddProperty( drmModeAtomicReqPtr req,
    TRACE1("drmModeAtomicAddProperty: req %p objectId %u propertyId %u value %llu", req, objectId, propertyId, value);
    if ( req )
    {
-      EMDevice *dev= gDrmMasterDev;
-      if ( dev )
+      if ( req->cursor < EM_DRM_ATOMIC_MAX_ITEMS )
+      {
+         req->items[req->cursor].objectId= objectId;
+         req->items[req->cursor].propertyId= propertyId;
+         req->items[req->cursor].value= value;
+         ++req->cursor;
+         rc= req->cursor;
+      }
+      else
       {
-         if ( objectId == dev->dev.drm.planes[1].plane_id )
+         errno= ENOSPC;
+      }
+   }
+   return rc;
+}
+
+int drmModeAtomicGetCursor( drmModeAtomicReqPtr req )
+{
+   return (req ? req->cursor : 0);
+}
+
+void drmModeAtomicSetCursor( drmModeAtomicReqPtr req, int cursor )
+{
+   if ( req && (cursor >= 0) && (cursor <= req->cursor) )
+   {
+      req->cursor= cursor;
+   }
+}
+
+/*
+ * Gather the state a request assigns to the video plane.  Returns a mask
+ * of the properties present.
+ */
+static uint32_t EMDrmAtomicGetVideoPlane( EMDevice *dev, drmModeAtomicReqPtr req, uint64_t *v )
+{
+   uint32_t found= 0;
+   uint32_t planeId= dev->dev.drm.planes[1].plane_id;
+
+   for( int i= 0; i < req->cursor; ++i )
+   {
+      if ( req->items[i].objectId == planeId )
+      {
+         for( int p= EM_DRM_PROP_CRTC_ID; p <= EM_DRM_PROP_SRC_H; ++p )
          {
-            if ( propertyId == dev->dev.drm.properties[EM_DRM_PROP_CRTC_X].prop_id )
-            {
-               dev->dev.drm.videoPlane[0].positionIsPending= true;
-               dev->dev.drm.videoPlane[0].vxPending= (int)value;
-            }
-            else if ( propertyId == dev->dev.drm.properties[EM_DRM_PROP_CRTC_Y].prop_id )
-            {
-               dev->dev.drm.videoPlane[0].positionIsPending= true;
-               dev->dev.drm.videoPlane[0].vyPending= (int)value;
-            }
-            else if ( propertyId == dev->dev.drm.properties[EM_DRM_PROP_CRTC_W].prop_id )
+            if ( req->items[i].propertyId == dev->dev.drm.properties[p].prop_id )
             {
-               dev->dev.drm.videoPlane[0].positionIsPending= true;
-               dev->dev.drm.videoPlane[0].vwPending= (int)value;
-            }
-            else if ( propertyId == dev->dev.drm.properties[EM_DRM_PROP_CRTC_H].prop_id )
-            {
-               dev->dev.drm.videoPlane[0].positionIsPending= true;
-               dev->dev.drm.videoPlane[0].vhPending= (int)value;
+               v[p]= req->items[i].value;
+               found |= (1<<p);
+               break;
             }
          }
       }
-
-      rc= 0;
    }
-   return rc;
+
+   return found;
 }
 
 int drmModeCreatePropertyBlob( int fd, const void *data, size_t size, uint32_t *id )
@@ -4050,6 +4622,13 @@ int drmModeCreatePropertyBlob( int fd, const void *data, size_t size, uint32_t *
    if ( dev && (dev->type == EM_DEVICE_TYPE_DRM) )
    {
       *id= ++dev->dev.drm.nextId;
+      if ( data && (size == sizeof(drmModeModeInfo)) )
+      {
+         int i= dev->dev.drm.blobNext;
+         dev->dev.drm.blobIds[i]= *id;
+         dev->dev.drm.blobModes[i]= *((drmModeModeInfo*)data);
+         dev->dev.drm.blobNext= (i+1) % EM_DRM_BLOB_MAX;
+      }
       rc= 0;
    }   
 
@@ -4067,6 +4646,114 @@ int drmModeAtomicCommit( int fd, drmModeAtomicReqPtr req, uint32_t flags, void *
    {
       if ( req && (req->magic == EM_DRM_ATOMIC_MAGIC) )
       {
+         EMCTX *ctx= emGetContext();
+         uint64_t v[EM_DRM_PROP_SRC_H+1];
+         uint32_t videoProps;
+
+         memset( v, 0, sizeof(v) );
+         videoProps= EMDrmAtomicGetVideoPlane( dev, req, v );
+
+         if ( flags & DRM_MODE_ATOMIC_TEST_ONLY )
+         {
+            if ( ctx )
+            {
+               ++ctx->drmTestCommitCount;
+               if ( ctx->drmRejectScaledVideo && v[EM_DRM_PROP_FB_ID] &&
+                    (((v[EM_DRM_PROP_SRC_W]>>16) != v[EM_DRM_PROP_CRTC_W]) ||
+                     ((v[EM_DRM_PROP_SRC_H]>>16) != v[EM_DRM_PROP_CRTC_H])) )
+               {
+                  ++ctx->drmTestCommitRejectCount;
+                  errno= EINVAL;
+                  goto exit;
+               }
+            }
+            rc= 0;
+            goto exit;
+         }
+         if ( (flags & DRM_MODE_PAGE_FLIP_EVENT) && dev->dev.drm.flipEventPending )
+         {
+            if ( ctx )
+            {
+               ++ctx->drmFlipEventBusyCount;
+            }
+            errno= EBUSY;
+            goto exit;
+         }
+         if ( ctx && (videoProps & (1<<EM_DRM_PROP_FB_ID)) && !v[EM_DRM_PROP_FB_ID] )
+         {
+            ++ctx->drmVideoPlaneDisableCount;
+         }
+         if ( videoProps & (1<<EM_DRM_PROP_CRTC_X) )
+         {
+            dev->dev.drm.videoPlane[0].positionIsPending= true;
+            dev->dev.drm.videoPlane[0].vxPending= (int)v[EM_DRM_PROP_CRTC_X];
+         }
+         if ( videoProps & (1<<EM_DRM_PROP_CRTC_Y) )
+         {
+            dev->dev.drm.videoPlane[0].positionIsPending= true;
+            dev->dev.drm.videoPlane[0].vyPending= (int)v[EM_DRM_PROP_CRTC_Y];
+         }
+         if ( videoProps & (1<<EM_DRM_PROP_CRTC_W) )
+         {
+            dev->dev.drm.videoPlane[0].positionIsPending= true;
+            dev->dev.drm.videoPlane[0].vwPending= (int)v[EM_DRM_PROP_CRTC_W];
+         }
+         if ( videoProps & (1<<EM_DRM_PROP_CRTC_H) )
+         {
+            dev->dev.drm.videoPlane[0].positionIsPending= true;
+            dev->dev.drm.videoPlane[0].vhPending= (int)v[EM_DRM_PROP_CRTC_H];
+         }
+         for( int i= 0; i < req->cursor; ++i )
+         {
+            if ( (req->items[i].objectId == dev->dev.drm.crtcs[0].crtc_id) &&
+                 (req->items[i].propertyId == dev->dev.drm.properties[EM_DRM_PROP_VRR_ENABLED].prop_id) )
+            {
+               dev->dev.drm.vrrEnabled= (req->items[i].value != 0);
+               if ( ctx )
+               {
+                  ctx->drmVrrEnabled= dev->dev.drm.vrrEnabled;
+               }
+            }
+         }
+         if ( flags & DRM_MODE_PAGE_FLIP_EVENT )
+         {
+            dev->dev.drm.flipEventTime= EMDrmGetFlipTime( dev, EMGetMonotonicTimeMicro(), &dev->dev.drm.flipEventSequence );
+            dev->dev.drm.flipEventData= user_data;
+            dev->dev.drm.flipEventPending= true;
+            if ( ctx )
+            {
+               ++ctx->drmFlipEventCount;
+            }
+         }
+         else if ( !(flags & DRM_MODE_ATOMIC_NONBLOCK) )
+         {
+            // Blocking commits return at once but are treated as latching at the next vblank
+            dev->dev.drm.commitLatchTime= EMDrmGetFlipTime( dev, EMGetMonotonicTimeMicro(), &dev->dev.drm.commitLatchSequence );
+         }
+         for( int i= 0; i < req->cursor; ++i )
+         {
+            if ( (req->items[i].objectId == dev->dev.drm.crtcs[0].crtc_id) &&
+                 (req->items[i].propertyId == dev->dev.drm.properties[EM_DRM_PROP_MODE_ID].prop_id) &&
+                 req->items[i].value )
+            {
+               for( int j= 0; j < EM_DRM_BLOB_MAX; ++j )
+               {
+                  if ( dev->dev.drm.blobIds[j] == (uint32_t)req->items[i].value )
+                  {
+                     TRACE1("drmModeAtomicCommit: mode %dx%dx%d",
+                            dev->dev.drm.blobModes[j].hdisplay, dev->dev.drm.blobModes[j].vdisplay, dev->dev.drm.blobModes[j].vrefresh);
+                     dev->dev.drm.crtcs[0].mode_valid= 1;
+                     dev->dev.drm.crtcs[0].mode= dev->dev.drm.blobModes[j];
+                     if ( ctx )
+                     {
+                        ++ctx->drmModeSetCount;
+                        ctx->drmModeRate= dev->dev.drm.blobModes[j].vrefresh;
+                     }
+                     break;
+                  }
+               }
+            }
+         }
          if ( dev->dev.drm.videoPlane[0].positionIsPending )
          {
             dev->dev.drm.videoPlane[0].positionIsPending= false;
@@ -4079,6 +4766,7 @@ int drmModeAtomicCommit( int fd, drmModeAtomicReqPtr req, uint32_t flags, void *
       }
    }
 
+exit:
    return rc;
 }
 
@@ -4225,6 +4913,10 @@ void gbm_surface_destroy( struct gbm_surface *surface )
       TRACE1("gbm_surface_destroy: gbm_surface %p gbm %p dev %p", surface, surface->gbm), surface->gbm->dev;
       for( int i= 0; i < 3; ++i )
       {
+         if ( surface->buffers[i].destroyUserData )
+         {
+            surface->buffers[i].destroyUserData( &surface->buffers[i], surface->buffers[i].userData );
+         }
          for( std::vector<struct gbm_bo*>::iterator it= surface->gbm->dev->ctx->gbmBuffs.begin();
               it != surface->gbm->dev->ctx->gbmBuffs.end();
               ++it )
@@ -4358,6 +5050,35 @@ uint32_t gbm_bo_get_offset(struct gbm_bo *bo, int plane)
    return offset;
 }
 
+uint32_t gbm_bo_get_format( struct gbm_bo *bo )
+{
+   uint32_t format= 0;
+   if ( bo->surface->nw.magic == EM_WINDOW_MAGIC )
+   {
+      format= bo->surface->nw.format;
+   }
+   else
+   {
+      ERROR("gbm_bo_get_format: bad gbm_bo %p", bo);
+   }
+
+   return format;
+}
+
+void gbm_bo_set_user_data( struct gbm_bo *bo, void *data,
+                           void (*destroy_user_data)(struct gbm_bo *, void *) )
+{
+   TRACE1("gbm_bo_set_user_data: bo %p data %p", bo, data);
+
+   bo->userData= data;
+   bo->destroyUserData= destroy_user_data;
+}
+
+void *gbm_bo_get_user_data( struct gbm_bo *bo )
+{
+   return bo->userData;
+}
+
 uint64_t gbm_bo_get_modifier(struct gbm_bo *bo)
 {
    uint64_t modifier= 0;
@@ -5141,7 +5862,12 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay display, EGLSurface surface )
    }
    else
    {
-      // Emulated 'normal' render to screen.  Nothing to do.
+      // Emulated 'normal' render to screen.  Tests may hook it, eg. to stall the swap.
+      EMCTX *ctx= emGetContext();
+      if ( ctx && ctx->displaySwapCB )
+      {
+         ctx->displaySwapCB( ctx, ctx->displaySwapUserData );
+      }
    }
 
    result= EGL_TRUE;
@@ -5151,6 +5877,41 @@ exit:
    return result;
 }
 
+EGLAPI EGLBoolean EGLAPIENTRY eglQuerySurface( EGLDisplay display,
+                                 EGLSurface surface,
+                                 EGLint attribute,
+                                 EGLint *value )
+{
+   EGLBoolean result= EGL_FALSE;
+   EMEGLDisplay *dsp= (EMEGLDisplay*)display;
+
+   TRACE1("eglQuerySurface for %X", attribute );
+
+   if ( display == EGL_NO_DISPLAY )
+   {
+      gEGLError= EGL_BAD_DISPLAY;
+      goto exit;
+   }
+
+   if ( dsp->magic != EM_EGL_DISPLAY_MAGIC )
+   {
+      gEGLError= EGL_BAD_DISPLAY;
+      goto exit;
+   }   
+
+   if ( !dsp->initialized )
+   {
+      gEGLError= EGL_NOT_INITIALIZED;
+      goto exit;
+   }
+
+   // No surface attributes are currently emulated
+   gEGLError= EGL_BAD_ATTRIBUTE;
+
+exit:
+   return result;
+}
+
 EGLAPI EGLBoolean EGLAPIENTRY eglSwapInterval( EGLDisplay display,
                                  EGLint interval )
 {
@@ -6267,7 +7028,31 @@ GL_APICALL void GL_APIENTRY glDetachShader (GLuint program, GLuint shader)
 
 GL_APICALL void GL_APIENTRY glDisable (GLenum cap)
 {
+   EMCTX *ctx= 0;
+
    TRACE1("glDisable");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glDisable: emGetContext failed");
+      goto exit;
+   }
+
+   switch( cap )
+   {
+      case GL_SCISSOR_TEST:
+         ctx->scissorEnable= false;
+         break;
+      case GL_BLEND:
+         ctx->blendEnable= false;
+         break;
+      default:
+         break;
+   }
+
+exit:
+   return;
 }
 
 GL_APICALL void GL_APIENTRY glDisableVertexAttribArray (GLuint index)
@@ -6353,7 +7138,31 @@ GL_APICALL void GL_APIENTRY glEGLImageTargetTexture2DOES (GLenum target, GLeglIm
 
 GL_APICALL void GL_APIENTRY glEnable (GLenum cap)
 {
+   EMCTX *ctx= 0;
+
    TRACE1("glEnable");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glEnable: emGetContext failed");
+      goto exit;
+   }
+
+   switch( cap )
+   {
+      case GL_SCISSOR_TEST:
+         ctx->scissorEnable= true;
+         break;
+      case GL_BLEND:
+         ctx->blendEnable= true;
+         break;
+      default:
+         break;
+   }
+
+exit:
+   return;
 }
 
 GL_APICALL void GL_APIENTRY glEnableVertexAttribArray (GLuint index)
@@ -6655,6 +7464,9 @@ GL_APICALL GLboolean GL_APIENTRY glIsEnabled (GLenum cap)
       case GL_SCISSOR_TEST:
          result= ctx->scissorEnable;
          break;
+      case GL_BLEND:
+         result= ctx->blendEnable;
+         break;
       default:
          WARNING("glIsEnabled: unsupported cap: %x", cap);
          break;
@@ -6727,6 +7539,41 @@ exit:
    return;
 }
 
+GL_APICALL void GL_APIENTRY glTexSubImage2D (GLenum target,
+                                             GLint level,
+                                             GLint xoffset,
+                                             GLint yoffset,
+                                             GLsizei width,
+                                             GLsizei height,
+                                             GLenum format,
+                                             GLenum type,
+                                             const void *pixels)
+{
+   EMCTX *ctx= 0;
+
+   TRACE1("glTexSubImage2D");
+
+   ctx= emGetContext();
+   if ( !ctx )
+   {
+      ERROR("glTexSubImage2D: emGetContext failed");
+      goto exit;
+   }
+
+   if ( ctx->textureUpdatedCB )
+   {
+      ctx->textureUpdatedCB( ctx, ctx->textureUpdatedUserData, xoffset, yoffset, width, height );
+   }
+
+exit:
+   return;
+}
+
+GL_APICALL void GL_APIENTRY glPixelStorei (GLenum pname, GLint param)
+{
+   TRACE1("glPixelStorei");
+}
+
 GL_APICALL void GL_APIENTRY glTexParameterf (GLenum target, GLenum pname, GLfloat param)
 {
    EMCTX *ctx= 0;
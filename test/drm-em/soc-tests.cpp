@@ -20,14 +20,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <linux/input.h>
 #include <xkbcommon/xkbcommon.h>
 
 #include <glib.h>
 #include <gst/gst.h>
+#include <gst/check/gsttestclock.h>
 
 #include <linux/videodev2.h>
 
@@ -45,9 +50,17 @@
 #include "simpleshell-client-protocol.h"
 
 #include "westeros-gl.h"
+extern "C" {
+#include "westeros-gl-console-helper.h"
+}
 #include "westeros-compositor.h"
 #include "westeros-render.h"
 
+#include "../../westeros-sink/westeros-sink-sw-probe.h"
+#include "../../westeros-sink/westeros-sink-sw-sched.h"
+#include "../../westeros-sink/westeros-sink-sw-buffer.h"
+#include "../../westeros-sink/raw/westeros-sink-drm-pool.h"
+
 #define WINDOW_WIDTH 640
 #define WINDOW_HEIGHT 480
 
@@ -77,6 +90,20 @@ static bool testCaseSocSinkFrameAdvanceWithCompositor( EMCTX *ctx );
 static bool testCaseSocSinkBasicPipelineGfx( EMCTX *ctx );
 static bool testCaseSocEssosDualMediaPlayback( EMCTX *emctx );
 static bool testCaseSocSinkVideoPosition( EMCTX *emctx );
+static bool testCaseSocEssosFlipEvents( EMCTX *emctx );
+static bool testCaseSocSinkPlaneLayout( EMCTX *emctx );
+static bool testCaseSocSinkFrameRateMatching( EMCTX *emctx );
+static bool testCaseSocEssosVariableRefresh( EMCTX *emctx );
+static bool testCaseSocSinkSWCodecProbe( EMCTX *emctx );
+static bool testCaseSocSinkSWSchedule( EMCTX *emctx );
+static bool testCaseSocSinkSWDirectBuffer( EMCTX *emctx );
+static bool testCaseSocSinkDrmBufferPool( EMCTX *emctx );
+static bool testCaseSocGLPresentation( EMCTX *emctx );
+static bool testCaseSocGLTrace( EMCTX *emctx );
+static bool testCaseSocGLVideoFbCache( EMCTX *emctx );
+static bool testCaseSocGLVideoServerFraming( EMCTX *emctx );
+static bool testCaseSocGLVideoReleaseBatch( EMCTX *emctx );
+static bool testCaseSocGLServerConnections( EMCTX *emctx );
 
 TESTCASE socTests[]=
 {
@@ -176,6 +203,62 @@ TESTCASE socTests[]=
      "Test westerossink video positioning",
      testCaseSocSinkVideoPosition
    },
+   { "testSocEssosFlipEvents",
+     "Test event driven atomic commits with Essos",
+     testCaseSocEssosFlipEvents
+   },
+   { "testSocSinkPlaneLayout",
+     "Test video plane layout validation with test commits",
+     testCaseSocSinkPlaneLayout
+   },
+   { "testSocSinkFrameRateMatching",
+     "Test display mode matching to video frame rate",
+     testCaseSocSinkFrameRateMatching
+   },
+   { "testSocEssosVariableRefresh",
+     "Test variable refresh rate commits with Essos",
+     testCaseSocEssosVariableRefresh
+   },
+   { "testSocSinkSWCodecProbe",
+     "Test software decode codec selection and sequence header probing",
+     testCaseSocSinkSWCodecProbe
+   },
+   { "testSocSinkSWSchedule",
+     "Test software decode frame scheduling, late frame drops and qos",
+     testCaseSocSinkSWSchedule
+   },
+   { "testSocSinkSWDirectBuffer",
+     "Test software decode display buffer lending and release",
+     testCaseSocSinkSWDirectBuffer
+   },
+   { "testSocSinkDrmBufferPool",
+     "Test raw sink drm buffer pool layout and size",
+     testCaseSocSinkDrmBufferPool
+   },
+   { "testSocGLPresentation",
+     "Test presentation time reporting for swapped frames",
+     testCaseSocGLPresentation
+   },
+   { "testSocGLTrace",
+     "Test westeros-gl trace enable and dump through the display server",
+     testCaseSocGLTrace
+   },
+   { "testSocGLVideoFbCache",
+     "Test video fb cache hits and handle sharing for a repeated dmabuf",
+     testCaseSocGLVideoFbCache
+   },
+   { "testSocGLVideoServerFraming",
+     "Test video server handling of split messages and bad headers",
+     testCaseSocGLVideoServerFraming
+   },
+   { "testSocGLVideoReleaseBatch",
+     "Test video frame queue overflow and batched buffer releases",
+     testCaseSocGLVideoReleaseBatch
+   },
+   { "testSocGLServerConnections",
+     "Test server connection limits and shutdown with clients connected",
+     testCaseSocGLServerConnections
+   },
    {
      "", "", (TESTCASEFUNC)0
    }
@@ -186,6 +269,316 @@ TESTCASE getSocTest( int index )
    return socTests[index];
 }
 
+static bool testCaseSocSinkDrmBufferPool( EMCTX *emctx )
+{
+   bool testResult= false;
+   int argc= 0;
+   char **argv= 0;
+   GstBufferPool *pool= 0;
+   GstCaps *caps= 0;
+   GstBuffer *buffer= 0;
+   GstVideoMeta *meta;
+   GstVideoInfo info;
+   guint size;
+   int drmFd, i, width, height, rows;
+   struct
+   {
+      int width;
+      int height;
+   } sizes[]=
+   {
+      { 1920, 1080 },
+      { 1280, 721 },
+      { 720, 480 }
+   };
+
+   gst_init( &argc, &argv );
+
+   drmFd= open( "/dev/dri/card0", O_RDWR );
+   if ( drmFd < 0 )
+   {
+      EMERROR("Unable to open drm device");
+      goto exit;
+   }
+   pool= wstDrmBufferPoolNew( drmFd );
+   caps= gst_caps_new_simple( "video/x-raw",
+                              "format", G_TYPE_STRING, "I420",
+                              "width", G_TYPE_INT, 1920,
+                              "height", G_TYPE_INT, 1080,
+                              NULL );
+   if ( wstDrmBufferPoolConfigure( pool, caps, WST_DRM_POOL_MIN_BUFFERS, &size ) )
+   {
+      EMERROR("Pool accepted I420");
+      goto exit;
+   }
+   gst_caps_unref( caps );
+   caps= 0;
+   gst_object_unref( pool );
+   pool= 0;
+
+   for( i= 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i )
+   {
+      width= sizes[i].width;
+      height= sizes[i].height;
+
+      drmFd= open( "/dev/dri/card0", O_RDWR );
+      if ( drmFd < 0 )
+      {
+         EMERROR("Unable to open drm device");
+         goto exit;
+      }
+      pool= wstDrmBufferPoolNew( drmFd );
+
+      caps= gst_caps_new_simple( "video/x-raw",
+                                 "format", G_TYPE_STRING, "NV12",
+                                 "width", G_TYPE_INT, width,
+                                 "height", G_TYPE_INT, height,
+                                 NULL );
+      if ( !gst_video_info_from_caps( &info, caps ) )
+      {
+         EMERROR("Bad caps %dx%d", width, height);
+         goto exit;
+      }
+
+      if ( !wstDrmBufferPoolConfigure( pool, caps, WST_DRM_POOL_MIN_BUFFERS, &size ) )
+      {
+         EMERROR("Unable to configure pool for %dx%d", width, height);
+         goto exit;
+      }
+
+      if ( !gst_buffer_pool_set_active( pool, TRUE ) )
+      {
+         EMERROR("Unable to activate pool for %dx%d", width, height);
+         goto exit;
+      }
+
+      if ( gst_buffer_pool_acquire_buffer( pool, &buffer, NULL ) != GST_FLOW_OK )
+      {
+         EMERROR("Unable to acquire buffer for %dx%d", width, height);
+         goto exit;
+      }
+
+      meta= gst_buffer_get_video_meta( buffer );
+      if ( !meta || (meta->n_planes != 2) )
+      {
+         EMERROR("Bad video meta for %dx%d", width, height);
+         goto exit;
+      }
+
+      /* Chroma follows luma in the same dumb buffer at the driver's pitch */
+      rows= height + (height+1)/2;
+      if ( (meta->stride[0] < ((width+63)&~63)) ||
+           (meta->stride[1] != meta->stride[0]) ||
+           (meta->offset[0] != 0) ||
+           (meta->offset[1] != (gsize)meta->stride[0]*height) )
+      {
+         EMERROR("Bad layout for %dx%d: strides (%d,%d) offsets (%d,%d)",
+                 width, height, meta->stride[0], meta->stride[1], (int)meta->offset[0], (int)meta->offset[1]);
+         goto exit;
+      }
+
+      if ( (size != (guint)meta->stride[0]*rows) || (size < info.size) )
+      {
+         EMERROR("Pool size %u for %dx%d does not match pitch %d (frame size %d)",
+                 size, width, height, meta->stride[0], (int)info.size);
+         goto exit;
+      }
+
+      if ( gst_buffer_get_size( buffer ) < size )
+      {
+         EMERROR("Buffer size %d smaller than pool size %u", (int)gst_buffer_get_size( buffer ), size);
+         goto exit;
+      }
+
+      gst_buffer_pool_release_buffer( pool, buffer );
+      buffer= 0;
+      gst_buffer_pool_set_active( pool, FALSE );
+      gst_object_unref( pool );
+      pool= 0;
+      gst_caps_unref( caps );
+      caps= 0;
+   }
+
+   testResult= true;
+
+exit:
+   if ( buffer )
+   {
+      gst_buffer_pool_release_buffer( pool, buffer );
+   }
+   if ( pool )
+   {
+      gst_buffer_pool_set_active( pool, FALSE );
+      gst_object_unref( pool );
+   }
+   if ( caps )
+   {
+      gst_caps_unref( caps );
+   }
+
+   return testResult;
+}
+
+#define SW_TEST_DIRECT_BUFFERS (3)
+
+/*
+ * Models the soc side of software decode buffer lending: a fixed set of
+ * display buffers marked in use from swAllocBuffer until swFreeBuffer.
+ */
+typedef struct _SWTestSoc
+{
+   bool inUse[SW_TEST_DIRECT_BUFFERS];
+   int freeCount;
+   int lastFreed;
+} SWTestSoc;
+
+static int testSWAllocBuffer( SWTestSoc *soc )
+{
+   int bufferId= -1;
+   int i;
+
+   for( i= 0; i < SW_TEST_DIRECT_BUFFERS; ++i )
+   {
+      if ( !soc->inUse[i] )
+      {
+         soc->inUse[i]= true;
+         bufferId= i;
+         break;
+      }
+   }
+
+   return bufferId;
+}
+
+static void testSWFreeBuffer( void *ctx, int bufferId )
+{
+   SWTestSoc *soc= (SWTestSoc*)ctx;
+
+   if ( (bufferId >= 0) && (bufferId < SW_TEST_DIRECT_BUFFERS) )
+   {
+      soc->inUse[bufferId]= false;
+   }
+   soc->freeCount++;
+   soc->lastFreed= bufferId;
+}
+
+static bool testCaseSocSinkSWDirectBuffer( EMCTX *emctx )
+{
+   bool testResult= false;
+   SWTestSoc soc;
+   SWDirectBuffer *direct[SW_TEST_DIRECT_BUFFERS];
+   SWDirectBuffer *found;
+   struct
+   {
+      unsigned int magic;
+      int data[8];
+   } foreign;
+   int i, bufferId;
+
+   memset( &soc, 0, sizeof(soc) );
+   soc.lastFreed= -1;
+   memset( &foreign, 0, sizeof(foreign) );
+
+   if ( wstsw_direct_create( testSWFreeBuffer, &soc, -1, 2 ) )
+   {
+      EMERROR("Direct buffer created without a display buffer");
+      goto exit;
+   }
+
+   if ( wstsw_direct_get( 0 ) || wstsw_direct_get( &foreign ) )
+   {
+      EMERROR("Decoder owned memory taken for a direct buffer");
+      goto exit;
+   }
+
+   /* Lend every display buffer: one ref for luma and one for chroma */
+   for( i= 0; i < SW_TEST_DIRECT_BUFFERS; ++i )
+   {
+      bufferId= testSWAllocBuffer( &soc );
+      if ( bufferId != i )
+      {
+         EMERROR("Unexpected display buffer: expected %d actual %d", i, bufferId);
+         goto exit;
+      }
+      direct[i]= wstsw_direct_create( testSWFreeBuffer, &soc, bufferId, 2 );
+      if ( !direct[i] )
+      {
+         EMERROR("Unable to create direct buffer %d", i);
+         goto exit;
+      }
+      found= wstsw_direct_get( direct[i] );
+      if ( (found != direct[i]) || (found->bufferId != bufferId) )
+      {
+         EMERROR("Direct buffer %d lookup failed: %p id %d", i, found, found ? found->bufferId : -1);
+         goto exit;
+      }
+   }
+
+   if ( testSWAllocBuffer( &soc ) >= 0 )
+   {
+      EMERROR("Display buffer allocated while all are lent");
+      goto exit;
+   }
+
+   /* The decoder drops the frame while display still holds its luma ref */
+   wstsw_direct_unref( direct[1] );
+   if ( (soc.freeCount != 0) || !soc.inUse[1] )
+   {
+      EMERROR("Display buffer released while display holds it: frees %d", soc.freeCount);
+      goto exit;
+   }
+
+   /* Display releases the frame reference */
+   wstsw_direct_unref( direct[1] );
+   if ( (soc.freeCount != 1) || (soc.lastFreed != 1) || soc.inUse[1] )
+   {
+      EMERROR("Display buffer not released: frees %d last %d", soc.freeCount, soc.lastFreed);
+      goto exit;
+   }
+
+   bufferId= testSWAllocBuffer( &soc );
+   if ( bufferId != 1 )
+   {
+      EMERROR("Released display buffer not reused: %d", bufferId);
+      goto exit;
+   }
+   direct[1]= wstsw_direct_create( testSWFreeBuffer, &soc, bufferId, 2 );
+   if ( !direct[1] )
+   {
+      EMERROR("Unable to recreate direct buffer");
+      goto exit;
+   }
+
+   /* Refs may be dropped in either order */
+   for( i= 0; i < SW_TEST_DIRECT_BUFFERS; ++i )
+   {
+      wstsw_direct_unref( direct[i] );
+   }
+   for( i= SW_TEST_DIRECT_BUFFERS-1; i >= 0; --i )
+   {
+      wstsw_direct_unref( direct[i] );
+   }
+   if ( soc.freeCount != 1+SW_TEST_DIRECT_BUFFERS )
+   {
+      EMERROR("Unexpected display buffer releases: expected %d actual %d", 1+SW_TEST_DIRECT_BUFFERS, soc.freeCount);
+      goto exit;
+   }
+   for( i= 0; i < SW_TEST_DIRECT_BUFFERS; ++i )
+   {
+      if ( soc.inUse[i] )
+      {
+         EMERROR("Display buffer %d still in use", i);
+         goto exit;
+      }
+   }
+
+   testResult= true;
+
+exit:
+
+   return testResult;
+}
+
 static gint64 getSegmentStart( EMSimpleVideoDecoder *dec, gint64 time )
 {
    bool startAtZero= EMSimpleVideoDecoderGetSegmentsStartAtZero( dec );
@@ -3885,3 +4278,2135 @@ exit:
    return testResult;
 }
 
+static bool testCaseSocEssosFlipEvents( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int i, flipCount, requested, handled;
+   long long minInterval;
+   int iterations= 30;
+
+   setenv( "WESTEROS_GL_USE_FLIP_EVENTS", "1", 1 );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   // Let the refresh thread settle into the event loop
+   for( i= 0; i < 5; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+
+   flipCount= EMGetDrmFlipEventCount( emctx );
+   EMResetDrmFlipEventStats( emctx );
+
+   for( i= 0; i < iterations; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+
+   // Stop updating and allow outstanding flips to complete
+   usleep( 100000 );
+
+   requested= EMGetDrmFlipEventCount( emctx )-flipCount;
+   handled= EMGetDrmFlipEventHandledCount( emctx );
+   minInterval= EMGetDrmFlipEventMinInterval( emctx );
+
+   if ( requested <= 0 )
+   {
+      EMERROR("No page flip events requested: count %d", EMGetDrmFlipEventCount( emctx ));
+      goto exit;
+   }
+
+   // Every requested flip event is drained, leaving no flip pending
+   if ( handled < requested )
+   {
+      EMERROR("Flip events not drained: requested %d handled %d", requested, handled );
+      goto exit;
+   }
+
+   if ( EMGetDrmFlipEventBusyCount( emctx ) )
+   {
+      EMERROR("Commits rejected with a flip pending: %d", EMGetDrmFlipEventBusyCount( emctx ) );
+      goto exit;
+   }
+
+   // One flip per refresh: frames are paced to vblanks and most updates are shown
+   if ( (minInterval > 0) && (minInterval < 16000LL) )
+   {
+      EMERROR("Flips not paced to refresh: min interval %lld us", minInterval );
+      goto exit;
+   }
+
+   if ( requested < iterations/2 )
+   {
+      EMERROR("Too few flips for updates: updates %d flips %d", iterations, requested );
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   unsetenv( "WESTEROS_GL_USE_FLIP_EVENTS" );
+
+   return testResult;
+}
+
+static bool testCaseSocSinkPlaneLayout( EMCTX *emctx )
+{
+   bool testResult= false;
+   int argc= 0;
+   char **argv= 0;
+   bool result;
+   GstElement *pipeline= 0;
+   GstElement *src= 0;
+   GstElement *sink= 0;
+   EMSimpleVideoDecoder *videoDecoder= 0;
+   EGLBoolean b;
+   TestEGLCtx eglCtx;
+   int windowWidth= 1920;
+   int windowHeight= 1080;
+   WstGLCtx *glCtx= 0;
+   void  *nativeWindow= 0;
+   int testCount, rejectCount, disableCount;
+
+   memset( &eglCtx, 0, sizeof(TestEGLCtx) );
+
+   EMStart( emctx );
+
+   result= testSetupEGL( &eglCtx, 0 );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
+
+   glCtx= WstGLInit();
+   if ( !glCtx )
+   {
+      EMERROR("Unable to create westeros-gl context");
+      goto exit;
+   }
+
+   nativeWindow= WstGLCreateNativeWindow( glCtx, 0, 0, windowWidth, windowHeight );
+   if ( !nativeWindow )
+   {
+      EMERROR("Unable to create westeros-gl native window");
+      goto exit;
+   }
+
+   eglCtx.eglSurfaceWindow= eglCreateWindowSurface( eglCtx.eglDisplay,
+                                                  eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)nativeWindow,
+                                                  NULL );
+
+   b= eglMakeCurrent( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow, eglCtx.eglSurfaceWindow, eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( eglCtx.eglDisplay, 1 );
+   eglSwapBuffers(eglCtx.eglDisplay, eglCtx.eglSurfaceWindow);
+   usleep( 34000 );
+
+   videoDecoder= EMGetSimpleVideoDecoder( emctx, EM_TUNERID_MAIN );
+   if ( !videoDecoder )
+   {
+      EMERROR("Failed to obtain test video decoder");
+      goto exit;
+   }
+
+   EMSetVideoCodec( emctx, V4L2_PIX_FMT_H264 );
+   EMSimpleVideoDecoderSetVideoSize( videoDecoder, 1920, 1080 );
+   EMSimpleVideoDecoderSetFrameRate( videoDecoder, 60.0 );
+
+   // Have the emulated driver reject scaled video so the fallback layout is exercised
+   EMSetDrmRejectScaledVideo( emctx, true );
+   testCount= EMGetDrmTestCommitCount( emctx );
+   rejectCount= EMGetDrmTestCommitRejectCount( emctx );
+   disableCount= EMGetDrmVideoPlaneDisableCount( emctx );
+
+   gst_init( &argc, &argv );
+
+   pipeline= gst_pipeline_new("pipeline");
+   if ( !pipeline )
+   {
+      EMERROR("Failed to create pipeline instance");
+      goto exit;
+   }
+
+   src= createVideoSrc( emctx, videoDecoder );
+   if ( !src )
+   {
+      EMERROR("Failed to create src instance");
+      goto exit;
+   }
+
+   sink= gst_element_factory_make( "westerossink", "vsink" );
+   if ( !sink )
+   {
+      EMERROR("Failed to create sink instance");
+      goto exit;
+   }
+
+   gst_bin_add_many( GST_BIN(pipeline), src, sink, NULL );
+
+   if ( gst_element_link( src, sink ) != TRUE )
+   {
+      EMERROR("Failed to link src and sink");
+      goto exit;
+   }
+
+   gst_element_set_state( pipeline, GST_STATE_PLAYING );
+
+   g_object_set( G_OBJECT(sink), "rectangle", "0,0,640,360", NULL );
+
+   // Allow pipeline to run briefly
+   usleep( 1000000 );
+
+   gst_element_set_state( pipeline, GST_STATE_NULL );
+
+   if ( EMGetDrmTestCommitCount( emctx ) <= testCount )
+   {
+      EMERROR("No test commits made for video plane layout");
+      goto exit;
+   }
+
+   if ( EMGetDrmTestCommitRejectCount( emctx ) <= rejectCount )
+   {
+      EMERROR("Scaled video layout was not validated");
+      goto exit;
+   }
+
+   if ( EMGetDrmVideoPlaneDisableCount( emctx ) <= disableCount )
+   {
+      EMERROR("Video plane not disabled when no layout was accepted");
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+   EMSetDrmRejectScaledVideo( emctx, false );
+   if ( pipeline )
+   {
+      gst_object_unref( pipeline );
+   }
+   if ( eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow );
+      eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+   if ( nativeWindow )
+   {
+      WstGLDestroyNativeWindow( glCtx, nativeWindow );
+   }
+   if ( glCtx )
+   {
+      WstGLTerm( glCtx );
+   }
+   testTermEGL( &eglCtx );
+
+   return testResult;
+}
+
+static bool testCaseSocSinkFrameRateMatching( EMCTX *emctx )
+{
+   bool testResult= false;
+   int argc= 0;
+   char **argv= 0;
+   bool result;
+   GstElement *pipeline= 0;
+   GstElement *src= 0;
+   GstElement *sink= 0;
+   EMSimpleVideoDecoder *videoDecoder= 0;
+   EGLBoolean b;
+   TestEGLCtx eglCtx;
+   int windowWidth= 1920;
+   int windowHeight= 1080;
+   WstGLCtx *glCtx= 0;
+   void  *nativeWindow= 0;
+   int modeSetCount, rate;
+
+   memset( &eglCtx, 0, sizeof(TestEGLCtx) );
+
+   if ( !EMSetDrmModes( emctx, "1920x1080p60,1920x1080p50,1920x1080p24,1920x1080p23.976,1280x720p60" ) )
+   {
+      EMERROR("Failed to set drm mode list");
+      goto exit;
+   }
+   EMSetDisplaySize( emctx, windowWidth, windowHeight );
+   setenv( "WESTEROS_GL_AUTO_FRM_MODE", "1", true );
+   setenv( "WESTEROS_GL_FRM_DELAY", "500", true );
+
+   EMStart( emctx );
+
+   result= testSetupEGL( &eglCtx, 0 );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
+
+   glCtx= WstGLInit();
+   if ( !glCtx )
+   {
+      EMERROR("Unable to create westeros-gl context");
+      goto exit;
+   }
+
+   nativeWindow= WstGLCreateNativeWindow( glCtx, 0, 0, windowWidth, windowHeight );
+   if ( !nativeWindow )
+   {
+      EMERROR("Unable to create westeros-gl native window");
+      goto exit;
+   }
+
+   eglCtx.eglSurfaceWindow= eglCreateWindowSurface( eglCtx.eglDisplay,
+                                                  eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)nativeWindow,
+                                                  NULL );
+
+   b= eglMakeCurrent( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow, eglCtx.eglSurfaceWindow, eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( eglCtx.eglDisplay, 1 );
+   eglSwapBuffers(eglCtx.eglDisplay, eglCtx.eglSurfaceWindow);
+   usleep( 34000 );
+
+   rate= EMGetDrmModeRate( emctx );
+   if ( rate != 60 )
+   {
+      EMERROR("Unexpected initial mode rate: expected 60 actual %d", rate);
+      goto exit;
+   }
+
+   videoDecoder= EMGetSimpleVideoDecoder( emctx, EM_TUNERID_MAIN );
+   if ( !videoDecoder )
+   {
+      EMERROR("Failed to obtain test video decoder");
+      goto exit;
+   }
+
+   EMSetVideoCodec( emctx, V4L2_PIX_FMT_H264 );
+   EMSimpleVideoDecoderSetVideoSize( videoDecoder, 1920, 1080 );
+   EMSimpleVideoDecoderSetFrameRate( videoDecoder, 24.0 );
+
+   gst_init( &argc, &argv );
+
+   pipeline= gst_pipeline_new("pipeline");
+   if ( !pipeline )
+   {
+      EMERROR("Failed to create pipeline instance");
+      goto exit;
+   }
+
+   src= createVideoSrc( emctx, videoDecoder );
+   if ( !src )
+   {
+      EMERROR("Failed to create src instance");
+      goto exit;
+   }
+
+   sink= gst_element_factory_make( "westerossink", "vsink" );
+   if ( !sink )
+   {
+      EMERROR("Failed to create sink instance");
+      goto exit;
+   }
+
+   gst_bin_add_many( GST_BIN(pipeline), src, sink, NULL );
+
+   if ( gst_element_link( src, sink ) != TRUE )
+   {
+      EMERROR("Failed to link src and sink");
+      goto exit;
+   }
+
+   // A clip shorter than the matching delay must not switch modes
+   modeSetCount= EMGetDrmModeSetCount( emctx );
+
+   gst_element_set_state( pipeline, GST_STATE_PLAYING );
+   usleep( 200000 );
+   gst_element_set_state( pipeline, GST_STATE_NULL );
+   usleep( 1000000 );
+
+   if ( EMGetDrmModeSetCount( emctx ) != modeSetCount )
+   {
+      EMERROR("Short clip caused a mode switch");
+      goto exit;
+   }
+
+   // A longer clip must switch to a matching mode
+   gst_element_set_state( pipeline, GST_STATE_PLAYING );
+   usleep( 1500000 );
+
+   rate= EMGetDrmModeRate( emctx );
+   if ( rate != 24 )
+   {
+      EMERROR("Mode not matched to content: expected rate 24 actual %d", rate);
+      goto exit;
+   }
+
+   // The original mode must be restored once video stops
+   gst_element_set_state( pipeline, GST_STATE_NULL );
+   usleep( 1500000 );
+
+   rate= EMGetDrmModeRate( emctx );
+   if ( rate != 60 )
+   {
+      EMERROR("Original mode not restored: expected rate 60 actual %d", rate);
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+   if ( pipeline )
+   {
+      gst_element_set_state( pipeline, GST_STATE_NULL );
+      gst_object_unref( pipeline );
+   }
+   if ( eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow );
+      eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+   if ( nativeWindow )
+   {
+      WstGLDestroyNativeWindow( glCtx, nativeWindow );
+   }
+   if ( glCtx )
+   {
+      WstGLTerm( glCtx );
+   }
+   testTermEGL( &eglCtx );
+
+   unsetenv( "WESTEROS_GL_AUTO_FRM_MODE" );
+   unsetenv( "WESTEROS_GL_FRM_DELAY" );
+   EMSetDrmModes( emctx, 0 );
+
+   return testResult;
+}
+
+static bool testCaseSocEssosVariableRefresh( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int i, flipCount;
+
+   setenv( "WESTEROS_GL_USE_FLIP_EVENTS", "1", 0 );
+   setenv( "WESTEROS_GL_VRR", "1", 0 );
+   EMSetDrmVrrCapable( emctx, true );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   flipCount= EMGetDrmFlipEventCount( emctx );
+
+   // Update at a rate that does not divide the mode refresh rate
+   for( i= 0; i < 10; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 25000 );
+   }
+
+   if ( !EMGetDrmVrrEnabled( emctx ) )
+   {
+      EMERROR("VRR not enabled on capable connector");
+      goto exit;
+   }
+
+   if ( EMGetDrmFlipEventCount( emctx ) <= flipCount )
+   {
+      EMERROR("No page flip events requested with VRR: count %d", EMGetDrmFlipEventCount( emctx ));
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   EMSetDrmVrrCapable( emctx, false );
+   unsetenv( "WESTEROS_GL_VRR" );
+   unsetenv( "WESTEROS_GL_USE_FLIP_EVENTS" );
+
+   return testResult;
+}
+
+/*
+ * Sequence headers for the software decode probe test: an AUD followed by a
+ * high profile 1080p SPS, a main profile 720p VPS and SPS, a 640x360 VP9 key
+ * frame header and inter frame header, and an AV1 temporal delimiter followed
+ * by a 720p sequence header.
+ */
+static const unsigned char gSWProbeH264[]=
+{
+   0x00, 0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x00, 0x01, 0x67, 0x64,
+   0x00, 0x28, 0xAC, 0xCA, 0x50, 0x1E, 0x00, 0x89, 0xF9, 0x50, 0x00, 0x00,
+   0x00, 0x01, 0x68, 0xEE, 0x3C, 0x80
+};
+
+static const unsigned char gSWProbeH265[]=
+{
+   0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01, 0xFF, 0xFF, 0x01, 0x60,
+   0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+   0x5D, 0x95, 0x98, 0x09, 0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01,
+   0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+   0x00, 0x5D, 0xA0, 0x02, 0x80, 0x80, 0x2D, 0x16, 0x58
+};
+
+static const unsigned char gSWProbeVP9[]=
+{
+   0x82, 0x49, 0x83, 0x42, 0x20, 0x27, 0xF0, 0x16, 0x70, 0x00, 0x00, 0x00,
+   0x00
+};
+
+static const unsigned char gSWProbeVP9Inter[]=
+{
+   0x86, 0x00, 0x00, 0x00
+};
+
+static const unsigned char gSWProbeAV1[]=
+{
+   0x12, 0x00, 0x0A, 0x09, 0x00, 0x00, 0x00, 0x42, 0xA6, 0x7F, 0xD9, 0xE8,
+   0x82, 0x32, 0x01, 0x10
+};
+
+static bool testCaseSocSinkSWCodecProbe( EMCTX *emctx )
+{
+   bool testResult= false;
+   int i, offset, width, height;
+   struct
+   {
+      const char *mime;
+      int codec;
+      const unsigned char *data;
+      int len;
+      int expectedOffset;
+      int expectedWidth;
+      int expectedHeight;
+   } probes[]=
+   {
+      { "video/x-h264", SWCodec_h264, gSWProbeH264, sizeof(gSWProbeH264), 6, 1920, 1080 },
+      { "video/x-h265", SWCodec_h265, gSWProbeH265, sizeof(gSWProbeH265), 0, 1280, 720 },
+      { "video/x-vp9", SWCodec_vp9, gSWProbeVP9, sizeof(gSWProbeVP9), 0, 640, 360 },
+      { "video/x-vp9", SWCodec_vp9, gSWProbeVP9Inter, sizeof(gSWProbeVP9Inter), -1, -1, -1 },
+      { "video/x-av1", SWCodec_av1, gSWProbeAV1, sizeof(gSWProbeAV1), 0, 1280, 720 }
+   };
+
+   if ( wstsw_codec_from_mime( "video/mpeg" ) != SWCodec_none )
+   {
+      EMERROR("Unexpected software codec for video/mpeg");
+      goto exit;
+   }
+
+   for( i= 0; i < (int)(sizeof(probes)/sizeof(probes[0])); ++i )
+   {
+      if ( wstsw_codec_from_mime( probes[i].mime ) != probes[i].codec )
+      {
+         EMERROR("Wrong software codec for %s: expected %d", probes[i].mime, probes[i].codec);
+         goto exit;
+      }
+
+      offset= wstsw_probe_sequence_header( probes[i].codec, probes[i].data, probes[i].len, &width, &height );
+      if ( (offset != probes[i].expectedOffset) ||
+           (width != probes[i].expectedWidth) ||
+           (height != probes[i].expectedHeight) )
+      {
+         EMERROR("Bad %s probe %d: offset %d (%d) size %dx%d (%dx%d)",
+                 wstsw_codec_name( probes[i].codec ), i,
+                 offset, probes[i].expectedOffset,
+                 width, height, probes[i].expectedWidth, probes[i].expectedHeight );
+         goto exit;
+      }
+
+      /* A truncated header must not yield a start point with a bogus size */
+      offset= wstsw_probe_sequence_header( probes[i].codec, probes[i].data, probes[i].len/2, &width, &height );
+      if ( (offset >= 0) && (width >= 0) &&
+           ((width != probes[i].expectedWidth) || (height != probes[i].expectedHeight)) )
+      {
+         EMERROR("Bad truncated %s probe %d: size %dx%d", wstsw_codec_name( probes[i].codec ), i, width, height );
+         goto exit;
+      }
+   }
+
+   /* Data from the wrong codec is never a start point */
+   if ( wstsw_probe_sequence_header( SWCodec_h264, gSWProbeH265, sizeof(gSWProbeH265), &width, &height ) >= 0 )
+   {
+      EMERROR("h265 data accepted as h264");
+      goto exit;
+   }
+   if ( wstsw_probe_sequence_header( SWCodec_av1, gSWProbeVP9, sizeof(gSWProbeVP9), &width, &height ) >= 0 )
+   {
+      EMERROR("vp9 data accepted as av1");
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   return testResult;
+}
+
+typedef struct _SWScheduleFrame
+{
+   SWSched *sched;
+   GstSegment *segment;
+   GstClockTime pts;
+   bool display;
+   GThread *thread;
+} SWScheduleFrame;
+
+static int gSWQosCount= 0;
+static GstQOSType gSWQosType;
+static GstClockTimeDiff gSWQosJitter;
+static GstClockTime gSWQosTimestamp;
+
+static gboolean testSWScheduleUpstreamEvent( GstPad *pad, GstObject *parent, GstEvent *event )
+{
+   if ( GST_EVENT_TYPE(event) == GST_EVENT_QOS )
+   {
+      gdouble proportion;
+
+      gst_event_parse_qos( event, &gSWQosType, &proportion, &gSWQosJitter, &gSWQosTimestamp );
+      ++gSWQosCount;
+   }
+   gst_event_unref( event );
+
+   return TRUE;
+}
+
+static gpointer testSWScheduleFrameThread( gpointer data )
+{
+   SWScheduleFrame *frame= (SWScheduleFrame*)data;
+
+   frame->display= wstsw_sched_frame( frame->sched, frame->segment, frame->pts );
+
+   return NULL;
+}
+
+static void testSWScheduleStart( SWScheduleFrame *frame, SWSched *sched, GstSegment *segment, GstClockTime pts )
+{
+   frame->sched= sched;
+   frame->segment= segment;
+   frame->pts= pts;
+   frame->display= false;
+   frame->thread= g_thread_new( "sw-sched", testSWScheduleFrameThread, frame );
+}
+
+/*
+ * Release the frame's clock wait once it is pending on the test clock and
+ * collect the scheduling decision.  Returns the time waited for.
+ */
+static GstClockTime testSWScheduleFinish( GstTestClock *clock, SWScheduleFrame *frame )
+{
+   GstClockID pendingId= 0;
+   GstClockID processedId;
+   GstClockTime waitTime;
+
+   gst_test_clock_wait_for_next_pending_id( clock, &pendingId );
+   waitTime= gst_clock_id_get_time( pendingId );
+   gst_clock_id_unref( pendingId );
+
+   processedId= gst_test_clock_process_next_clock_id( clock );
+   if ( processedId )
+   {
+      gst_clock_id_unref( processedId );
+   }
+
+   g_thread_join( frame->thread );
+   frame->thread= 0;
+
+   return waitTime;
+}
+
+static bool testCaseSocSinkSWSchedule( EMCTX *emctx )
+{
+   bool testResult= false;
+   int argc= 0;
+   char **argv= 0;
+   GstElement *sink= 0;
+   GstPad *srcPad= 0;
+   GstPad *sinkPad= 0;
+   GstClock *clock= 0;
+   GstSegment segment;
+   GMutex lock;
+   SWSched sched;
+   bool schedInit= false;
+   SWScheduleFrame frame;
+   GstClockTime waitTime;
+   int i, qosCount;
+   struct
+   {
+      GstClockTime pts;
+      bool display;
+      GstClockTimeDiff jitter;
+   } frames[]=
+   {
+      { 500*GST_MSECOND, true, 500*GST_MSECOND }, // late, but the first frame after a flush is always shown
+      { 900*GST_MSECOND, false, 100*GST_MSECOND }, // later than max-lateness
+      { 990*GST_MSECOND, true, 10*GST_MSECOND }, // within max-lateness
+      { 1100*GST_MSECOND, true, -100*GST_MSECOND } // early
+   };
+
+   gst_init( &argc, &argv );
+   g_mutex_init( &lock );
+   gSWQosCount= 0;
+
+   sink= gst_element_factory_make( "fakesink", "schedsink" );
+   if ( !sink )
+   {
+      EMERROR("Failed to create sink instance");
+      goto exit;
+   }
+   g_object_set( G_OBJECT(sink), "async", FALSE, NULL );
+   gst_base_sink_set_qos_enabled( GST_BASE_SINK(sink), TRUE );
+   gst_base_sink_set_max_lateness( GST_BASE_SINK(sink), SW_DEFAULT_MAX_LATENESS );
+
+   srcPad= gst_pad_new( "src", GST_PAD_SRC );
+   gst_pad_set_event_function( srcPad, testSWScheduleUpstreamEvent );
+   gst_pad_set_active( srcPad, TRUE );
+   sinkPad= gst_element_get_static_pad( sink, "sink" );
+   if ( gst_pad_link( srcPad, sinkPad ) != GST_PAD_LINK_OK )
+   {
+      EMERROR("Failed to link upstream pad to sink");
+      goto exit;
+   }
+
+   if ( gst_element_set_state( sink, GST_STATE_PAUSED ) == GST_STATE_CHANGE_FAILURE )
+   {
+      EMERROR("Failed to pause sink");
+      goto exit;
+   }
+
+   clock= gst_test_clock_new_with_start_time( GST_SECOND );
+   gst_element_set_clock( sink, clock );
+   gst_element_set_base_time( sink, 0 );
+   gst_segment_init( &segment, GST_FORMAT_TIME );
+
+   wstsw_sched_init( &sched, GST_BASE_SINK(sink), &lock );
+   schedInit= true;
+
+   g_mutex_lock( &lock );
+   wstsw_sched_set_active( &sched, true );
+   wstsw_sched_set_playing( &sched, true );
+   g_mutex_unlock( &lock );
+
+   for( i= 0; i < (int)(sizeof(frames)/sizeof(frames[0])); ++i )
+   {
+      qosCount= gSWQosCount;
+      testSWScheduleStart( &frame, &sched, &segment, frames[i].pts );
+      waitTime= testSWScheduleFinish( GST_TEST_CLOCK(clock), &frame );
+      if ( waitTime != frames[i].pts )
+      {
+         EMERROR("Frame %d: waited for %" GST_TIME_FORMAT " expected %" GST_TIME_FORMAT,
+                 i, GST_TIME_ARGS(waitTime), GST_TIME_ARGS(frames[i].pts) );
+         goto exit;
+      }
+      if ( frame.display != frames[i].display )
+      {
+         EMERROR("Frame %d: jitter %" G_GINT64_FORMAT ": display %d expected %d",
+                 i, frames[i].jitter, frame.display, frames[i].display );
+         goto exit;
+      }
+      if ( gSWQosCount != qosCount+1 )
+      {
+         EMERROR("Frame %d: no qos event", i );
+         goto exit;
+      }
+      if ( (gSWQosJitter != frames[i].jitter) ||
+           (gSWQosTimestamp != frames[i].pts) ||
+           (gSWQosType != ((frames[i].jitter > 0) ? GST_QOS_TYPE_UNDERFLOW : GST_QOS_TYPE_OVERFLOW)) )
+      {
+         EMERROR("Frame %d: bad qos event: type %d jitter %" G_GINT64_FORMAT " timestamp %" GST_TIME_FORMAT,
+                 i, gSWQosType, gSWQosJitter, GST_TIME_ARGS(gSWQosTimestamp) );
+         goto exit;
+      }
+   }
+   if ( sched.framesDropped != 1 )
+   {
+      EMERROR("Unexpected dropped frame count: expected 1 actual %d", sched.framesDropped );
+      goto exit;
+   }
+
+   // A run of late frames is broken by showing one so the display keeps updating
+   for( i= 0; i <= SW_MAX_CONSECUTIVE_DROPS; ++i )
+   {
+      testSWScheduleStart( &frame, &sched, &segment, 1000*GST_MSECOND );
+      testSWScheduleFinish( GST_TEST_CLOCK(clock), &frame );
+      if ( frame.display != (i == SW_MAX_CONSECUTIVE_DROPS) )
+      {
+         EMERROR("Late frame %d: display %d", i, frame.display );
+         goto exit;
+      }
+   }
+
+   // While paused a frame waits to resume without a clock wait
+   g_mutex_lock( &lock );
+   wstsw_sched_set_playing( &sched, false );
+   g_mutex_unlock( &lock );
+   testSWScheduleStart( &frame, &sched, &segment, 1200*GST_MSECOND );
+   usleep( 50000 );
+   if ( gst_test_clock_peek_id_count( GST_TEST_CLOCK(clock) ) != 0 )
+   {
+      EMERROR("Clock wait scheduled while paused");
+      g_mutex_lock( &lock );
+      wstsw_sched_set_playing( &sched, true );
+      g_mutex_unlock( &lock );
+      testSWScheduleFinish( GST_TEST_CLOCK(clock), &frame );
+      goto exit;
+   }
+   g_mutex_lock( &lock );
+   wstsw_sched_set_playing( &sched, true );
+   g_mutex_unlock( &lock );
+   testSWScheduleFinish( GST_TEST_CLOCK(clock), &frame );
+   if ( !frame.display )
+   {
+      EMERROR("Frame held during pause not shown after resume");
+      goto exit;
+   }
+
+   // A flush cancels a pending wait
+   testSWScheduleStart( &frame, &sched, &segment, 2*GST_SECOND );
+   gst_test_clock_wait_for_next_pending_id( GST_TEST_CLOCK(clock), NULL );
+   g_mutex_lock( &lock );
+   wstsw_sched_flush( &sched, true );
+   g_mutex_unlock( &lock );
+   g_thread_join( frame.thread );
+   frame.thread= 0;
+   if ( frame.display )
+   {
+      EMERROR("Frame shown after its wait was flushed");
+      goto exit;
+   }
+   g_mutex_lock( &lock );
+   wstsw_sched_flush( &sched, false );
+   g_mutex_unlock( &lock );
+
+   testResult= true;
+
+exit:
+   if ( schedInit )
+   {
+      wstsw_sched_term( &sched );
+   }
+   if ( sink )
+   {
+      gst_element_set_state( sink, GST_STATE_NULL );
+   }
+   if ( sinkPad )
+   {
+      gst_object_unref( sinkPad );
+   }
+   if ( srcPad )
+   {
+      gst_object_unref( srcPad );
+   }
+   if ( sink )
+   {
+      gst_object_unref( sink );
+   }
+   if ( clock )
+   {
+      gst_object_unref( clock );
+   }
+   g_mutex_clear( &lock );
+
+   return testResult;
+}
+
+static long long getMonotonicTimeMicros( void )
+{
+   struct timespec tm;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+
+   return tm.tv_sec*1000000LL+(tm.tv_nsec/1000LL);
+}
+
+static bool testCaseSocGLPresentation( EMCTX *emctx )
+{
+   bool testResult= false;
+   EGLBoolean b;
+   TestEGLCtx eglCtx;
+   int windowWidth= 1920;
+   int windowHeight= 1080;
+   WstGLCtx *glCtx= 0;
+   void  *nativeWindow= 0;
+   unsigned int swapCount, sequence;
+   long long swapTime, presentationTime, now;
+   int state, i;
+
+   memset( &eglCtx, 0, sizeof(TestEGLCtx) );
+
+   EMStart( emctx );
+
+   if ( !testSetupEGL( &eglCtx, 0 ) )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
+
+   glCtx= WstGLInit();
+   if ( !glCtx )
+   {
+      EMERROR("Unable to create westeros-gl context");
+      goto exit;
+   }
+
+   nativeWindow= WstGLCreateNativeWindow( glCtx, 0, 0, windowWidth, windowHeight );
+   if ( !nativeWindow )
+   {
+      EMERROR("Unable to create westeros-gl native window");
+      goto exit;
+   }
+
+   eglCtx.eglSurfaceWindow= eglCreateWindowSurface( eglCtx.eglDisplay,
+                                                  eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)nativeWindow,
+                                                  NULL );
+
+   b= eglMakeCurrent( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow, eglCtx.eglSurfaceWindow, eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( eglCtx.eglDisplay, 1 );
+
+   for( i= 0; i < 3; ++i )
+   {
+      swapTime= getMonotonicTimeMicros();
+      eglSwapBuffers(eglCtx.eglDisplay, eglCtx.eglSurfaceWindow);
+
+      swapCount= WstGLGetSwapCount( glCtx, nativeWindow );
+      if ( !swapCount )
+      {
+         EMERROR("No swap count for native window");
+         goto exit;
+      }
+
+      // The frame is reported once the commit carrying it has latched
+      state= WstGLPresentation_pending;
+      for( int j= 0; (j < 20) && (state == WstGLPresentation_pending); ++j )
+      {
+         usleep( 17000 );
+         state= WstGLGetPresentation( glCtx, nativeWindow, swapCount, &presentationTime, &sequence );
+      }
+      if ( state != WstGLPresentation_presented )
+      {
+         EMERROR("Swap %u not presented: state %d", swapCount, state );
+         goto exit;
+      }
+
+      // Content reaches the display at a vblank after it was swapped
+      now= getMonotonicTimeMicros();
+      if ( (presentationTime <= swapTime) || (presentationTime > now+17000LL) || !sequence )
+      {
+         EMERROR("Unexpected presentation: swap %lld presented %lld seq %u now %lld", swapTime, presentationTime, sequence, now );
+         goto exit;
+      }
+   }
+
+   testResult= true;
+
+exit:
+   if ( eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( eglCtx.eglDisplay, eglCtx.eglSurfaceWindow );
+      eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+   if ( nativeWindow )
+   {
+      WstGLDestroyNativeWindow( glCtx, nativeWindow );
+   }
+   if ( glCtx )
+   {
+      WstGLTerm( glCtx );
+   }
+   testTermEGL( &eglCtx );
+
+   return testResult;
+}
+
+
+/*
+ * Dump the westeros-gl trace rings through the display server and return
+ * the event count and the time of the newest event in the dump.
+ */
+static bool socTraceDump( EMCTX *emctx, int *eventCount, long long *lastTime )
+{
+   bool result= false;
+   char cmd[]= "trace dump";
+   char *rsp= 0;
+   char path[256];
+   FILE *f= 0;
+   int rc, c;
+
+   *eventCount= 0;
+   *lastTime= 0;
+
+   rc= WstGLConsoleCommand( cmd, &rsp );
+   if ( (rc != 0) || !rsp )
+   {
+      EMERROR("trace dump failed: rc %d (%s)", rc, (rsp ? rsp : "") );
+      goto exit;
+   }
+
+   if ( sscanf( rsp, "%*d: trace dump %d events %255s", eventCount, path ) != 2 )
+   {
+      EMERROR("Unexpected trace dump response (%s)", rsp );
+      goto exit;
+   }
+
+   f= fopen( path, "rt" );
+   if ( !f )
+   {
+      EMERROR("Unable to open trace dump (%s)", path );
+      goto exit;
+   }
+
+   // Scan for "ts":<time> in each event
+   while ( (c= fgetc( f )) != EOF )
+   {
+      long long ts;
+      if ( (c == '"') && (fscanf( f, "ts\":%lld", &ts ) == 1) && (ts > *lastTime) )
+      {
+         *lastTime= ts;
+      }
+   }
+
+   result= true;
+
+exit:
+   if ( f )
+   {
+      fclose( f );
+      unlink( path );
+   }
+   if ( rsp )
+   {
+      free( rsp );
+   }
+
+   return result;
+}
+
+static bool socTraceEnable( EMCTX *emctx, bool enable )
+{
+   bool result= false;
+   char cmd[32];
+   char *rsp= 0;
+   int rc;
+
+   sprintf( cmd, "trace enable %d", (enable ? 1 : 0) );
+   rc= WstGLConsoleCommand( cmd, &rsp );
+   if ( rc != 0 )
+   {
+      EMERROR("%s failed: rc %d (%s)", cmd, rc, (rsp ? rsp : "") );
+   }
+   else
+   {
+      result= true;
+   }
+   if ( rsp )
+   {
+      free( rsp );
+   }
+
+   return result;
+}
+
+static bool testCaseSocGLTrace( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int i, eventCount;
+   char path[256];
+   long long startTime, lastTime;
+   char cmd[]= "trace dump /tmp/westeros-trace-escape.json";
+   char *rsp= 0;
+
+   // Tracing starts off when WESTEROS_GL_NO_TRACE is set
+   setenv( "WESTEROS_GL_NO_TRACE", "1", 1 );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   startTime= getMonotonicTimeMicros();
+   for( i= 0; i < 10; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+
+   if ( !socTraceDump( emctx, &eventCount, &lastTime ) )
+   {
+      goto exit;
+   }
+   if ( lastTime >= startTime )
+   {
+      EMERROR("Events traced with WESTEROS_GL_NO_TRACE: last %lld start %lld", lastTime, startTime );
+      goto exit;
+   }
+
+   // Enabling records refresh events for every vblank
+   if ( !socTraceEnable( emctx, true ) )
+   {
+      goto exit;
+   }
+
+   startTime= getMonotonicTimeMicros();
+   for( i= 0; i < 10; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+
+   if ( !socTraceDump( emctx, &eventCount, &lastTime ) )
+   {
+      goto exit;
+   }
+   if ( (eventCount <= 0) || (lastTime < startTime) )
+   {
+      EMERROR("No events traced when enabled: count %d last %lld start %lld", eventCount, lastTime, startTime );
+      goto exit;
+   }
+   // Disabling stops recording
+   if ( !socTraceEnable( emctx, false ) )
+   {
+      goto exit;
+   }
+
+   startTime= getMonotonicTimeMicros()+20000LL;
+   for( i= 0; i < 10; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+
+   if ( !socTraceDump( emctx, &eventCount, &lastTime ) )
+   {
+      goto exit;
+   }
+   if ( lastTime >= startTime )
+   {
+      EMERROR("Events traced when disabled: last %lld stop %lld", lastTime, startTime );
+      goto exit;
+   }
+
+   // The dump location is fixed: a client supplied path is ignored
+   unlink( "/tmp/westeros-trace-escape.json" );
+   if ( (WstGLConsoleCommand( cmd, &rsp ) != 0) || !rsp ||
+        (sscanf( rsp, "%*d: trace dump %d events %255s", &eventCount, path ) != 2) )
+   {
+      EMERROR("Unexpected trace dump response (%s)", (rsp ? rsp : "") );
+      goto exit;
+   }
+   unlink( path );
+   if ( strstr( path, "westeros-trace-escape" ) )
+   {
+      EMERROR("trace dump used a client supplied path (%s)", path );
+      goto exit;
+   }
+   if ( access( "/tmp/westeros-trace-escape.json", F_OK ) == 0 )
+   {
+      EMERROR("trace dump wrote to a client supplied path");
+      unlink( "/tmp/westeros-trace-escape.json" );
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( rsp )
+   {
+      free( rsp );
+   }
+
+   if ( ctx )
+   {
+      socTraceEnable( emctx, true );
+      EssContextDestroy( ctx );
+   }
+
+   unsetenv( "WESTEROS_GL_NO_TRACE" );
+
+   return testResult;
+}
+
+/*
+ * Minimal westeros-gl video server client used to drive the server
+ * directly with hand built messages
+ */
+static int socVideoClientPutU32( unsigned char *p, unsigned n )
+{
+   p[0]= (n>>24);
+   p[1]= (n>>16);
+   p[2]= (n>>8);
+   p[3]= (n&0xFF);
+
+   return 4;
+}
+
+static int socVideoClientPutS64( unsigned char *p, long long n )
+{
+   socVideoClientPutU32( p, (((unsigned long long)n)>>32) );
+   socVideoClientPutU32( p+4, (n&0xFFFFFFFF) );
+
+   return 8;
+}
+
+static bool socVideoClientSend( EMCTX *emctx, int fd, unsigned char *m, int len, int *fds, int fdCount )
+{
+   bool result= false;
+   struct msghdr msg;
+   struct cmsghdr *cmsg;
+   struct iovec iov[1];
+   char cmbody[CMSG_SPACE(3*sizeof(int))];
+   int sentLen;
+
+   iov[0].iov_base= (char*)m;
+   iov[0].iov_len= len;
+
+   memset( &msg, 0, sizeof(msg) );
+   msg.msg_iov= iov;
+   msg.msg_iovlen= 1;
+   if ( fdCount > 0 )
+   {
+      memset( cmbody, 0, sizeof(cmbody) );
+      cmsg= (struct cmsghdr*)cmbody;
+      cmsg->cmsg_len= CMSG_LEN(fdCount*sizeof(int));
+      cmsg->cmsg_level= SOL_SOCKET;
+      cmsg->cmsg_type= SCM_RIGHTS;
+      memcpy( CMSG_DATA(cmsg), fds, fdCount*sizeof(int) );
+      msg.msg_control= cmsg;
+      msg.msg_controllen= cmsg->cmsg_len;
+   }
+
+   do
+   {
+      sentLen= sendmsg( fd, &msg, MSG_NOSIGNAL );
+   }
+   while ( (sentLen < 0) && (errno == EINTR) );
+
+   if ( sentLen != len )
+   {
+      EMERROR("video client send failed: len %d sent %d errno %d", len, sentLen, errno );
+      goto exit;
+   }
+
+   result= true;
+
+exit:
+   return result;
+}
+
+static int socServerConnect( EMCTX *emctx, const char *name )
+{
+   int fd= -1;
+   const char *workingDir;
+   struct sockaddr_un addr;
+   int rc;
+
+   workingDir= getenv("XDG_RUNTIME_DIR");
+   if ( !workingDir )
+   {
+      EMERROR("XDG_RUNTIME_DIR is not set");
+      goto exit;
+   }
+
+   memset( &addr, 0, sizeof(addr) );
+   addr.sun_family= AF_LOCAL;
+   snprintf( addr.sun_path, sizeof(addr.sun_path), "%s/%s", workingDir, name );
+
+   fd= socket( PF_LOCAL, SOCK_STREAM|SOCK_CLOEXEC, 0 );
+   if ( fd < 0 )
+   {
+      EMERROR("Unable to open %s client socket: errno %d", name, errno );
+      goto exit;
+   }
+
+   rc= connect( fd, (struct sockaddr *)&addr, sizeof(addr) );
+   if ( rc < 0 )
+   {
+      EMERROR("Unable to connect to %s server (%s): errno %d", name, addr.sun_path, errno );
+      close( fd );
+      fd= -1;
+   }
+
+exit:
+   return fd;
+}
+
+static int socVideoClientConnect( EMCTX *emctx )
+{
+   int fd;
+   unsigned char mbody[5];
+
+   fd= socServerConnect( emctx, "video" );
+   if ( fd >= 0 )
+   {
+      mbody[0]= 'V';
+      mbody[1]= 'S';
+      mbody[2]= 2;
+      mbody[3]= 'V';
+      mbody[4]= 2;
+      if ( !socVideoClientSend( emctx, fd, mbody, sizeof(mbody), 0, 0 ) )
+      {
+         close( fd );
+         fd= -1;
+      }
+   }
+
+   return fd;
+}
+
+/* Build an NV12 frame message with both planes in one buffer: returns the message length */
+static int socVideoClientFrame( unsigned char *mbody, int width, int height, int offset1, int bufferId, long long frameTime )
+{
+   int i= 0;
+
+   mbody[i++]= 'V';
+   mbody[i++]= 'S';
+   mbody[i++]= 65;
+   mbody[i++]= 'F';
+   i += socVideoClientPutU32( &mbody[i], width );
+   i += socVideoClientPutU32( &mbody[i], height );
+   i += socVideoClientPutU32( &mbody[i], V4L2_PIX_FMT_NV12 );
+   i += socVideoClientPutU32( &mbody[i], 0 );
+   i += socVideoClientPutU32( &mbody[i], 0 );
+   i += socVideoClientPutU32( &mbody[i], WINDOW_WIDTH );
+   i += socVideoClientPutU32( &mbody[i], WINDOW_HEIGHT );
+   i += socVideoClientPutU32( &mbody[i], 0 );
+   i += socVideoClientPutU32( &mbody[i], width );
+   i += socVideoClientPutU32( &mbody[i], offset1 );
+   i += socVideoClientPutU32( &mbody[i], width );
+   i += socVideoClientPutU32( &mbody[i], 0 );
+   i += socVideoClientPutU32( &mbody[i], 0 );
+   i += socVideoClientPutU32( &mbody[i], bufferId );
+   i += socVideoClientPutS64( &mbody[i], frameTime );
+
+   return i;
+}
+
+static unsigned socVideoClientGetU32( unsigned char *p )
+{
+   return (((unsigned)p[0])<<24)|(((unsigned)p[1])<<16)|(((unsigned)p[2])<<8)|((unsigned)p[3]);
+}
+
+static bool socVideoClientPause( EMCTX *emctx, int fd, bool pause )
+{
+   unsigned char mbody[5];
+
+   mbody[0]= 'V';
+   mbody[1]= 'S';
+   mbody[2]= 2;
+   mbody[3]= 'P';
+   mbody[4]= (pause ? 1 : 0);
+
+   return socVideoClientSend( emctx, fd, mbody, sizeof(mbody), 0, 0 );
+}
+
+/*
+ * Read everything the server has sent and count the buffer releases per id,
+ * both single 'B' releases and batched 'X' releases.  Other messages are skipped.
+ */
+static bool socVideoClientReadReleases( EMCTX *emctx, int fd, int *releaseCount, int bufferIdLimit, int *batchCount )
+{
+   bool result= false;
+   unsigned char mbody[1024];
+   int len= 0, moff, n, i;
+
+   for( ; ; )
+   {
+      n= recv( fd, mbody+len, sizeof(mbody)-len, MSG_DONTWAIT );
+      if ( n <= 0 )
+      {
+         if ( (n < 0) && (errno == EINTR) )
+         {
+            continue;
+         }
+         break;
+      }
+      len += n;
+
+      moff= 0;
+      while ( len-moff >= 4 )
+      {
+         unsigned char *m= mbody+moff;
+         int mlen, id;
+         if ( (m[0] != 'V') || (m[1] != 'S') )
+         {
+            EMERROR("Bad message header from video server");
+            goto exit;
+         }
+         mlen= m[2];
+         id= m[3];
+         if ( len-moff < mlen+3 )
+         {
+            break;
+         }
+         if ( id == 'B' )
+         {
+            int bufferId= (int)socVideoClientGetU32( m+4 );
+            if ( (bufferId < 0) || (bufferId >= bufferIdLimit) )
+            {
+               EMERROR("Release of unknown buffer %d", bufferId );
+               goto exit;
+            }
+            ++releaseCount[bufferId];
+         }
+         else if ( id == 'X' )
+         {
+            int count= m[4];
+            if ( mlen != 2+count*4 )
+            {
+               EMERROR("Bad batched release: mlen %d count %d", mlen, count );
+               goto exit;
+            }
+            for( i= 0; i < count; ++i )
+            {
+               int bufferId= (int)socVideoClientGetU32( m+5+i*4 );
+               if ( (bufferId < 0) || (bufferId >= bufferIdLimit) )
+               {
+                  EMERROR("Release of unknown buffer %d", bufferId );
+                  goto exit;
+               }
+               ++releaseCount[bufferId];
+            }
+            if ( count > 1 )
+            {
+               ++(*batchCount);
+            }
+         }
+         moff += (mlen+3);
+      }
+      len -= moff;
+      if ( len > 0 )
+      {
+         memmove( mbody, mbody+moff, len );
+      }
+   }
+
+   result= true;
+
+exit:
+   return result;
+}
+
+static bool socVideoFbCacheStats( EMCTX *emctx, unsigned int *hits, unsigned int *misses )
+{
+   bool result= false;
+   char cmd[]= "get video fbcache";
+   char *rsp= 0;
+   int rc, size;
+   unsigned int evictions;
+
+   rc= WstGLConsoleCommand( cmd, &rsp );
+   if ( (rc != 0) || !rsp ||
+        (sscanf( rsp, "%*d: video fbcache size %d hits %u misses %u evictions %u", &size, hits, misses, &evictions ) != 4) )
+   {
+      EMERROR("Unexpected fbcache response: rc %d (%s)", rc, (rsp ? rsp : "") );
+      goto exit;
+   }
+
+   result= true;
+
+exit:
+   if ( rsp )
+   {
+      free( rsp );
+   }
+
+   return result;
+}
+
+static void socRunDisplay( EssCtx *ctx, int iterations )
+{
+   for( int i= 0; i < iterations; ++i )
+   {
+      EssContextUpdateDisplay( ctx );
+      EssContextRunEventLoopOnce( ctx );
+      usleep( 17000 );
+   }
+}
+
+static bool testCaseSocGLVideoFbCache( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int videoFd= -1;
+   int frameFd= -1;
+   int frameWidth= 320;
+   int frameHeight= 240;
+   int closeErrors;
+   unsigned int hits0, misses0, hits, misses;
+   unsigned char mbody[4+64];
+   int i, len, offset1;
+
+   // With a single entry a second layout of the buffer can't be cached while the first is on screen
+   setenv( "WESTEROS_GL_VIDEO_FB_CACHE_SIZE", "1", 1 );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   socRunDisplay( ctx, 5 );
+
+   frameFd= memfd_create( "soc-video-frame", MFD_CLOEXEC );
+   if ( (frameFd < 0) || (ftruncate( frameFd, 2*frameWidth*frameHeight ) != 0) )
+   {
+      EMERROR("Unable to create frame buffer: errno %d", errno );
+      goto exit;
+   }
+
+   if ( !socVideoFbCacheStats( emctx, &hits0, &misses0 ) )
+   {
+      goto exit;
+   }
+   closeErrors= EMGetDrmGemCloseErrorCount( emctx );
+
+   videoFd= socVideoClientConnect( emctx );
+   if ( videoFd < 0 )
+   {
+      goto exit;
+   }
+
+   // The same dmabuf twice with the same layout: one miss then one hit
+   for( i= 0; i < 2; ++i )
+   {
+      len= socVideoClientFrame( mbody, frameWidth, frameHeight, frameWidth*frameHeight, i, i*16667LL );
+      if ( !socVideoClientSend( emctx, videoFd, mbody, len, &frameFd, 1 ) )
+      {
+         goto exit;
+      }
+      socRunDisplay( ctx, 3 );
+   }
+
+   if ( !socVideoFbCacheStats( emctx, &hits, &misses ) )
+   {
+      goto exit;
+   }
+   if ( (hits-hits0 != 1) || (misses-misses0 != 1) )
+   {
+      EMERROR("Unexpected fbcache stats: hits %u misses %u expected 1 and 1", hits-hits0, misses-misses0 );
+      goto exit;
+   }
+
+   // Other layouts of the same dmabuf import the same GEM handle as the cached fb
+   for( i= 2; i < 6; ++i )
+   {
+      offset1= frameWidth*frameHeight + ((i & 1) ? frameWidth : 0);
+      len= socVideoClientFrame( mbody, frameWidth, frameHeight, offset1, i, i*16667LL );
+      if ( !socVideoClientSend( emctx, videoFd, mbody, len, &frameFd, 1 ) )
+      {
+         goto exit;
+      }
+      socRunDisplay( ctx, 3 );
+   }
+
+   if ( !socVideoFbCacheStats( emctx, &hits, &misses ) )
+   {
+      goto exit;
+   }
+   if ( misses-misses0 < 2 )
+   {
+      EMERROR("Unexpected fbcache stats: misses %u expected at least 2", misses-misses0 );
+      goto exit;
+   }
+
+   // Disconnecting frees the remaining frames and purges the cache
+   close( videoFd );
+   videoFd= -1;
+   socRunDisplay( ctx, 5 );
+
+   if ( EMGetDrmGemCloseErrorCount( emctx ) != closeErrors )
+   {
+      EMERROR("Shared GEM handle closed while in use: %d failed closes",
+              EMGetDrmGemCloseErrorCount( emctx )-closeErrors );
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( videoFd >= 0 )
+   {
+      close( videoFd );
+   }
+
+   if ( frameFd >= 0 )
+   {
+      close( frameFd );
+   }
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   unsetenv( "WESTEROS_GL_VIDEO_FB_CACHE_SIZE" );
+
+   return testResult;
+}
+
+static bool testCaseSocGLVideoServerFraming( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int videoFd= -1;
+   int frameFd[2]= { -1, -1 };
+   int frameWidth= 320;
+   int frameHeight= 240;
+   unsigned int hits0, misses0, hits, misses;
+   unsigned char mbody[4+64];
+   unsigned char badHeader[]= { 'X', 'Y', 8, 'F', 0, 0, 0, 0 };
+   int i, len;
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   socRunDisplay( ctx, 5 );
+
+   for( i= 0; i < 2; ++i )
+   {
+      frameFd[i]= memfd_create( "soc-video-frame", MFD_CLOEXEC );
+      if ( (frameFd[i] < 0) || (ftruncate( frameFd[i], 2*frameWidth*frameHeight ) != 0) )
+      {
+         EMERROR("Unable to create frame buffer: errno %d", errno );
+         goto exit;
+      }
+   }
+
+   videoFd= socVideoClientConnect( emctx );
+   if ( videoFd < 0 )
+   {
+      goto exit;
+   }
+
+   if ( !socVideoFbCacheStats( emctx, &hits0, &misses0 ) )
+   {
+      goto exit;
+   }
+
+   // A frame split over two writes is processed once the rest arrives
+   len= socVideoClientFrame( mbody, frameWidth, frameHeight, frameWidth*frameHeight, 0, 0LL );
+   if ( !socVideoClientSend( emctx, videoFd, mbody, 10, &frameFd[0], 1 ) )
+   {
+      goto exit;
+   }
+   socRunDisplay( ctx, 2 );
+   if ( !socVideoFbCacheStats( emctx, &hits, &misses ) )
+   {
+      goto exit;
+   }
+   if ( misses != misses0 )
+   {
+      EMERROR("Partial frame message was processed");
+      goto exit;
+   }
+   if ( !socVideoClientSend( emctx, videoFd, mbody+10, len-10, 0, 0 ) )
+   {
+      goto exit;
+   }
+   socRunDisplay( ctx, 3 );
+   if ( !socVideoFbCacheStats( emctx, &hits, &misses ) )
+   {
+      goto exit;
+   }
+   if ( (misses-misses0 != 1) || (hits != hits0) )
+   {
+      EMERROR("Split frame not processed: hits %u misses %u", hits-hits0, misses-misses0 );
+      goto exit;
+   }
+
+   // Fds sent with a bad header are dropped with it and not given to the next frame
+   if ( !socVideoClientSend( emctx, videoFd, badHeader, sizeof(badHeader), &frameFd[1], 1 ) )
+   {
+      goto exit;
+   }
+   socRunDisplay( ctx, 2 );
+   len= socVideoClientFrame( mbody, frameWidth, frameHeight, frameWidth*frameHeight, 1, 16667LL );
+   if ( !socVideoClientSend( emctx, videoFd, mbody, len, &frameFd[0], 1 ) )
+   {
+      goto exit;
+   }
+   socRunDisplay( ctx, 3 );
+   if ( !socVideoFbCacheStats( emctx, &hits, &misses ) )
+   {
+      goto exit;
+   }
+   if ( (hits-hits0 != 1) || (misses-misses0 != 1) )
+   {
+      EMERROR("Frame after bad header used the wrong buffer: hits %u misses %u", hits-hits0, misses-misses0 );
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( videoFd >= 0 )
+   {
+      close( videoFd );
+   }
+
+   for( i= 0; i < 2; ++i )
+   {
+      if ( frameFd[i] >= 0 )
+      {
+         close( frameFd[i] );
+      }
+   }
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   return testResult;
+}
+
+#define SOC_VIDEO_QUEUE_CAPACITY (32)
+#define SOC_VIDEO_FRAME_COUNT (SOC_VIDEO_QUEUE_CAPACITY+8)
+
+static bool testCaseSocGLVideoReleaseBatch( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int videoFd= -1;
+   int frameFd= -1;
+   int frameWidth= 320;
+   int frameHeight= 240;
+   int releaseCount[SOC_VIDEO_FRAME_COUNT];
+   int batchCount= 0;
+   unsigned char mbody[4+64];
+   int i, len;
+
+   memset( releaseCount, 0, sizeof(releaseCount) );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   socRunDisplay( ctx, 5 );
+
+   frameFd= memfd_create( "soc-video-frame", MFD_CLOEXEC );
+   if ( (frameFd < 0) || (ftruncate( frameFd, 2*frameWidth*frameHeight ) != 0) )
+   {
+      EMERROR("Unable to create frame buffer: errno %d", errno );
+      goto exit;
+   }
+
+   videoFd= socVideoClientConnect( emctx );
+   if ( videoFd < 0 )
+   {
+      goto exit;
+   }
+
+   // While paused nothing is consumed: frames past the queue capacity are returned at once
+   if ( !socVideoClientPause( emctx, videoFd, true ) )
+   {
+      goto exit;
+   }
+   for( i= 0; i < SOC_VIDEO_FRAME_COUNT; ++i )
+   {
+      len= socVideoClientFrame( mbody, frameWidth, frameHeight, frameWidth*frameHeight, i, i*1000LL );
+      if ( !socVideoClientSend( emctx, videoFd, mbody, len, &frameFd, 1 ) )
+      {
+         goto exit;
+      }
+   }
+   socRunDisplay( ctx, 5 );
+
+   if ( !socVideoClientReadReleases( emctx, videoFd, releaseCount, SOC_VIDEO_FRAME_COUNT, &batchCount ) )
+   {
+      goto exit;
+   }
+   for( i= 0; i < SOC_VIDEO_FRAME_COUNT; ++i )
+   {
+      if ( releaseCount[i] != ((i < SOC_VIDEO_QUEUE_CAPACITY) ? 0 : 1) )
+      {
+         EMERROR("Paused queue: buffer %d released %d times", i, releaseCount[i] );
+         goto exit;
+      }
+   }
+
+   // Frames 1ms apart are mostly dropped on resume and their releases sent in batches
+   if ( !socVideoClientPause( emctx, videoFd, false ) )
+   {
+      goto exit;
+   }
+   socRunDisplay( ctx, 10 );
+
+   if ( !socVideoClientReadReleases( emctx, videoFd, releaseCount, SOC_VIDEO_FRAME_COUNT, &batchCount ) )
+   {
+      goto exit;
+   }
+   for( i= 0; i < SOC_VIDEO_FRAME_COUNT; ++i )
+   {
+      // The last queued frame is on screen and the one before may still be held by the plane
+      if ( (releaseCount[i] > 1) || ((releaseCount[i] == 0) && (i < SOC_VIDEO_QUEUE_CAPACITY-2)) )
+      {
+         EMERROR("Buffer %d released %d times", i, releaseCount[i] );
+         goto exit;
+      }
+   }
+   if ( batchCount == 0 )
+   {
+      EMERROR("No batched releases for dropped frames");
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( videoFd >= 0 )
+   {
+      close( videoFd );
+   }
+
+   if ( frameFd >= 0 )
+   {
+      close( frameFd );
+   }
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   return testResult;
+}
+
+/* Returns the recv result, or -1 if nothing arrived within the timeout */
+static int socReadTimeout( int fd, unsigned char *buf, int len, int timeoutMs )
+{
+   int rc;
+   struct pollfd pfd;
+
+   pfd.fd= fd;
+   pfd.events= POLLIN;
+   pfd.revents= 0;
+   rc= poll( &pfd, 1, timeoutMs );
+   if ( rc > 0 )
+   {
+      rc= recv( fd, buf, len, 0 );
+   }
+   else
+   {
+      rc= -1;
+   }
+
+   return rc;
+}
+
+#define SOC_MAX_DISPLAY_CONNECTIONS (6)
+
+static bool testCaseSocGLServerConnections( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   EssCtx *ctx= 0;
+   int displayFd[SOC_MAX_DISPLAY_CONNECTIONS+1];
+   int videoFd= -1;
+   char cmd[]= "get video fbcache";
+   unsigned char mbody[256+4];
+   long long startTime, duration;
+   int i, len;
+
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS+1; ++i )
+   {
+      displayFd[i]= -1;
+   }
+
+   // More than the four connections the tables used to hold, but still limited
+   setenv( "WESTEROS_GL_MAX_DISPLAY_CONNECTIONS", "6", 1 );
+
+   ctx= EssContextCreate();
+   if ( !ctx )
+   {
+      EMERROR("EssContextCreate failed");
+      goto exit;
+   }
+
+   result= EssContextSetUseWayland( ctx, false );
+   if ( result == false )
+   {
+      EMERROR("EssContextSetUseWayland failed");
+      goto exit;
+   }
+
+   result= EssContextStart( ctx );
+   if ( result == false )
+   {
+      EMERROR("EssContextStart failed");
+      goto exit;
+   }
+
+   socRunDisplay( ctx, 5 );
+
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS; ++i )
+   {
+      displayFd[i]= socServerConnect( emctx, "display" );
+      if ( displayFd[i] < 0 )
+      {
+         goto exit;
+      }
+   }
+   socRunDisplay( ctx, 2 );
+
+   // A connection past the limit is closed by the server
+   displayFd[i]= socServerConnect( emctx, "display" );
+   if ( displayFd[i] < 0 )
+   {
+      goto exit;
+   }
+   if ( socReadTimeout( displayFd[i], mbody, sizeof(mbody), 1000 ) != 0 )
+   {
+      EMERROR("Display connection past the limit was not closed");
+      goto exit;
+   }
+   close( displayFd[i] );
+   displayFd[i]= -1;
+
+   // Every connection within the limit is served while all are open
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS; ++i )
+   {
+      len= 0;
+      mbody[len++]= 'D';
+      mbody[len++]= 'S';
+      mbody[len++]= strlen(cmd)+1;
+      strcpy( (char*)&mbody[len], cmd );
+      len += strlen(cmd)+1;
+      if ( send( displayFd[i], mbody, len, MSG_NOSIGNAL ) != len )
+      {
+         EMERROR("Unable to send on display connection %d: errno %d", i, errno );
+         goto exit;
+      }
+   }
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS; ++i )
+   {
+      memset( mbody, 0, sizeof(mbody) );
+      len= socReadTimeout( displayFd[i], mbody, sizeof(mbody)-1, 1000 );
+      if ( (len < 4) || (mbody[0] != 'D') || (mbody[1] != 'S') || strncmp( (char*)&mbody[3], "0:", 2 ) )
+      {
+         EMERROR("No response on display connection %d: len %d", i, len );
+         goto exit;
+      }
+   }
+
+   videoFd= socVideoClientConnect( emctx );
+   if ( videoFd < 0 )
+   {
+      goto exit;
+   }
+   if ( socReadTimeout( videoFd, mbody, sizeof(mbody), 1000 ) <= 0 )
+   {
+      EMERROR("No version response from video server");
+      goto exit;
+   }
+
+   // Shutdown wakes the server threads and closes connected clients
+   startTime= getMonotonicTimeMicros();
+   EssContextDestroy( ctx );
+   ctx= 0;
+   duration= getMonotonicTimeMicros()-startTime;
+   if ( duration > 1000000LL )
+   {
+      EMERROR("Shutdown with clients connected took %lld us", duration );
+      goto exit;
+   }
+
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS; ++i )
+   {
+      if ( socReadTimeout( displayFd[i], mbody, sizeof(mbody), 1000 ) != 0 )
+      {
+         EMERROR("Display connection %d not closed on shutdown", i );
+         goto exit;
+      }
+   }
+   for( ; ; )
+   {
+      len= socReadTimeout( videoFd, mbody, sizeof(mbody), 1000 );
+      if ( len <= 0 )
+      {
+         break;
+      }
+   }
+   if ( len != 0 )
+   {
+      EMERROR("Video connection not closed on shutdown");
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   for( i= 0; i < SOC_MAX_DISPLAY_CONNECTIONS+1; ++i )
+   {
+      if ( displayFd[i] >= 0 )
+      {
+         close( displayFd[i] );
+      }
+   }
+
+   if ( videoFd >= 0 )
+   {
+      close( videoFd );
+   }
+
+   if ( ctx )
+   {
+      EssContextDestroy( ctx );
+   }
+
+   unsetenv( "WESTEROS_GL_MAX_DISPLAY_CONNECTIONS" );
+
+   return testResult;
+}
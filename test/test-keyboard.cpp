@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <linux/input.h>
 
@@ -572,6 +573,261 @@ exit:
    return testResult;
 }
 
+static long long getMonotonicTimeMillis()
+{
+   struct timespec tm;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+
+   return tm.tv_sec*1000LL+(tm.tv_nsec/1000000LL);
+}
+
+bool testCaseKeyboardImmediateDispatch( EMCTX *emctx )
+{
+   bool testResult= false;
+   bool result;
+   WstCompositor *wctx= 0;
+   const char *displayName= "test0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   EGLBoolean b;
+   int keys[4]= { KEY_A, KEY_B, KEY_C, KEY_D };
+   long long start, latency;
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   // A long frame period so input delivered by the display timer would be noticeably late
+   result= WstCompositorSetFrameRate( wctx, 2 );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetFrameRate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   display= wl_display_connect(displayName);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor || !ctx->seat || !ctx->keyboard || !ctx->pointer )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+   printf("wl_egl_window %p\n", ctx->wlEglWindow);
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+   for( int i= 0; i < 100; ++i )
+   {
+      wl_display_roundtrip(display);
+      if ( ctx->keyboardEnter )
+      {
+         break;
+      }
+      usleep( 10000 );
+   }
+
+   if ( !ctx->keyboardMap || !ctx->keyboardEnter )
+   {
+      EMERROR("Did not get expected keyboard events: map %d entered %d",
+               ctx->keyboardMap, ctx->keyboardEnter );
+      goto exit;
+   }
+
+   // Each key must reach the client well within one frame period with no repaint pending
+   for( int k= 0; k < 4; ++k )
+   {
+      start= getMonotonicTimeMillis();
+
+      WstCompositorKeyEvent( wctx, keys[k], WstKeyboard_keyState_depressed, 0 );
+
+      for( int i= 0; i < 250; ++i )
+      {
+         wl_display_roundtrip(display);
+         if ( ctx->keyPressed == keys[k] )
+         {
+            break;
+         }
+         usleep( 2000 );
+      }
+
+      latency= getMonotonicTimeMillis()-start;
+
+      if ( ctx->keyPressed != keys[k] )
+      {
+         EMERROR("Did not get expected key event: expected/actual: key %d/%d", keys[k], ctx->keyPressed );
+         goto exit;
+      }
+
+      if ( latency > 100 )
+      {
+         EMERROR("Key event delivered late: key %d latency %lld ms", keys[k], latency );
+         goto exit;
+      }
+
+      WstCompositorKeyEvent( wctx, keys[k], WstKeyboard_keyState_released, 0 );
+
+      for( int i= 0; i < 250; ++i )
+      {
+         wl_display_roundtrip(display);
+         if ( ctx->keyPressed == 0 )
+         {
+            break;
+         }
+         usleep( 2000 );
+      }
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->keyboard )
+   {
+      wl_keyboard_destroy(ctx->keyboard);
+      ctx->keyboard= 0;
+   }
+
+   if ( ctx->pointer )
+   {
+      wl_pointer_destroy(ctx->pointer);
+      ctx->pointer= 0;
+   }
+
+   if ( ctx->seat )
+   {
+      wl_seat_destroy(ctx->seat);
+      ctx->seat= 0;
+   }
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctx );
+
+   return testResult;
+}
+
 bool testCaseKeyboardBasicKeyInputRepeater( EMCTX *emctx )
 {
    bool testResult= false;
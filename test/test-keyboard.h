@@ -23,6 +23,7 @@
 
 bool testCaseKeyboardBasicKeyInput( EMCTX *emctx );
 bool testCaseKeyboardBasicKeyInputRepeater( EMCTX *emctx );
+bool testCaseKeyboardImmediateDispatch( EMCTX *emctx );
 
 #endif
 
@@ -320,6 +320,14 @@ TESTCASE genericTests[]=
      "Test compositor basic composition",
      testCaseRenderBasicComposition
    },
+   { "testRenderThreadStalledSwap",
+     "Test clients are serviced while the render thread swap is stalled",
+     testCaseRenderThreadStalledSwap
+   },
+   { "testRenderFrameCallbackCommit",
+     "Test frame callbacks take effect when their surface is committed",
+     testCaseRenderFrameCallbackCommit
+   },
    { "testRenderBasicCompositionEmbedded",
      "Test embedded compositor basic composition",
      testCaseRenderBasicCompositionEmbedded
@@ -344,6 +352,26 @@ TESTCASE genericTests[]=
      "Test repeating compositor shm rendering",
      testCaseRenderShmRepeater
    },
+   { "testRenderShmDamage",
+     "Test shm surface damage limits texture upload",
+     testCaseRenderShmDamage
+   },
+   { "testRenderShmEarlyRelease",
+     "Test shm buffers are released once their content is taken at commit",
+     testCaseRenderShmEarlyRelease
+   },
+   { "testRenderShmEarlyReleaseRenderThread",
+     "Test shm buffers are released once the render thread has taken their content",
+     testCaseRenderShmEarlyReleaseRenderThread
+   },
+   { "testRenderPresentationFeedback",
+     "Test wp_presentation feedback for shm surface commits",
+     testCaseRenderPresentationFeedback
+   },
+   { "testRenderOpaqueOcclusion",
+     "Test surfaces covered by an opaque surface are culled from composition",
+     testCaseRenderOpaqueOcclusion
+   },
    { "testRenderWaylandThreading",
      "Test compositor for wayland threading issues",
      testCaseRenderWaylandThreading
@@ -360,10 +388,18 @@ TESTCASE genericTests[]=
      "Test basic keyboard input with repeating compositor",
      testCaseKeyboardBasicKeyInputRepeater
    },
+   { "testKeyboardImmediateDispatch",
+     "Test key input reaches clients without waiting for the next frame",
+     testCaseKeyboardImmediateDispatch
+   },
    { "testPointerEnterLeave",
      "Test pointer entering and leaving a surface",
      testCasePointerEnterLeave
    },
+   { "testPointerInputRegion",
+     "Test pointer focus honours the surface input region",
+     testCasePointerInputRegion
+   },
    { "testPointerBasicFocus",
      "Test changing focus with pointer",
      testCasePointerBasicFocus
@@ -365,6 +365,234 @@ exit:
    return testResult;
 }
 
+bool testCasePointerInputRegion( EMCTX *emctx )
+{
+   using namespace PointerEnterLeave;
+
+   bool testResult= false;
+   bool result;
+   WstCompositor *wctx= 0;
+   const char *displayName= "test0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   struct wl_region *region= 0;
+   EGLBoolean b;
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   display= wl_display_connect(displayName);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor || !ctx->seat || !ctx->pointer )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);   
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+   
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+   printf("wl_egl_window %p\n", ctx->wlEglWindow);
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   region= wl_compositor_create_region( ctx->compositor );
+   if ( !region )
+   {
+      EMERROR("error: unable to create region");
+      goto exit;
+   }
+   wl_region_add( region, 0, 0, WINDOW_WIDTH/2, WINDOW_HEIGHT/2 );
+   wl_surface_set_input_region( ctx->surface, region );
+   wl_region_destroy( region );
+   region= 0;
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+   wl_display_roundtrip(display);
+
+   usleep( 17000 );
+
+   printf("calling WstCompositorPointerEnter\n");
+   WstCompositorPointerEnter( wctx );
+
+   printf("calling WstCompositorPointerMoveEvent\n");
+   WstCompositorPointerMoveEvent( wctx, WINDOW_WIDTH/4, WINDOW_HEIGHT/4 );
+
+   wl_display_roundtrip(display);
+
+   usleep( 17000 );
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->pointerEntered )
+   {
+      EMERROR("did not get pointer enter");
+      goto exit;
+   }
+
+   printf("calling WstCompositorPointerMoveEvent\n");
+   WstCompositorPointerMoveEvent( wctx, (WINDOW_WIDTH*3)/4, (WINDOW_HEIGHT*3)/4 );
+
+   wl_display_roundtrip(display);
+
+   usleep( 17000 );
+
+   wl_display_roundtrip(display);
+
+   if ( ctx->pointerEntered )
+   {
+      EMERROR("did not get pointer leave outside input region");
+      goto exit;
+   }
+
+   WstCompositorPointerLeave( wctx );
+
+   if ( ctx->pointerEntered )
+   {
+      EMERROR("unexpected pointer enter");
+      goto exit;
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->pointer )
+   {
+      wl_pointer_destroy(ctx->pointer);
+      ctx->pointer= 0;
+   }
+
+   if ( ctx->seat )
+   {
+      wl_seat_destroy(ctx->seat);
+      ctx->seat= 0;
+   }
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctx );
+
+   return testResult;
+}
+
 namespace PointerFocus
 {
 
@@ -22,6 +22,7 @@
 #include "westeros-ut-em.h"
 
 bool testCasePointerEnterLeave( EMCTX *emctx );
+bool testCasePointerInputRegion( EMCTX *emctx );
 bool testCasePointerBasicFocus( EMCTX *emctx );
 bool testCasePointerBasicFocusRepeater( EMCTX *emctx );
 
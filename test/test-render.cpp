@@ -27,6 +27,8 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <poll.h>
 
 #include "test-render.h"
 #include "test-egl.h"
@@ -35,6 +37,7 @@
 #include "westeros-gl.h"
 #include "wayland-client.h"
 #include "wayland-egl.h"
+#include "presentation-time-client-protocol.h"
 
 static bool checkForRepeatingSupport( void )
 {
@@ -73,8 +76,73 @@ typedef struct _TestCtx
    int windowHeight;
    int textureCallbackCount;
    int lastTextureBufferId;
+   int textureUpdateCount;
+   int lastTextureUpdateY;
+   int lastTextureUpdateHeight;
+   struct wp_presentation *presentation;
+   uint32_t presentationClockId;
+   int presentedCount;
+   int discardedCount;
+   long long lastPresentedTime;
+   uint32_t lastPresentedFlags;
+   int bufferReleaseCount;
 } TestCtx;
 
+static void bufferRelease( void *data, struct wl_buffer *buffer )
+{
+   TestCtx *ctx= (TestCtx*)data;
+
+   ++ctx->bufferReleaseCount;
+}
+
+static const struct wl_buffer_listener bufferListener=
+{
+   bufferRelease
+};
+
+static void presentationClockId( void *data, struct wp_presentation *presentation, uint32_t clockId )
+{
+   TestCtx *ctx= (TestCtx*)data;
+
+   ctx->presentationClockId= clockId;
+}
+
+static const struct wp_presentation_listener presentationListener=
+{
+   presentationClockId
+};
+
+static void feedbackSyncOutput( void *data, struct wp_presentation_feedback *feedback, struct wl_output *output )
+{
+}
+
+static void feedbackPresented( void *data, struct wp_presentation_feedback *feedback,
+                               uint32_t secHi, uint32_t secLo, uint32_t nsec, uint32_t refresh,
+                               uint32_t seqHi, uint32_t seqLo, uint32_t flags )
+{
+   TestCtx *ctx= (TestCtx*)data;
+
+   ++ctx->presentedCount;
+   ctx->lastPresentedTime= ((((long long)secHi)<<32)|secLo)*1000000LL+(nsec/1000);
+   ctx->lastPresentedFlags= flags;
+   wp_presentation_feedback_destroy( feedback );
+}
+
+static void feedbackDiscarded( void *data, struct wp_presentation_feedback *feedback )
+{
+   TestCtx *ctx= (TestCtx*)data;
+
+   ++ctx->discardedCount;
+   wp_presentation_feedback_destroy( feedback );
+}
+
+static const struct wp_presentation_feedback_listener feedbackListener=
+{
+   feedbackSyncOutput,
+   feedbackPresented,
+   feedbackDiscarded
+};
+
 static void registryHandleGlobal(void *data, 
                                  struct wl_registry *registry, uint32_t id,
                                  const char *interface, uint32_t version)
@@ -91,6 +159,10 @@ static void registryHandleGlobal(void *data,
    else if ( (len==6) && !strncmp(interface, "wl_shm", len)) {
       ctx->shm= (struct wl_shm*)wl_registry_bind(registry, id, &wl_shm_interface, 1);
    }
+   else if ( (len==15) && !strncmp(interface, "wp_presentation", len)) {
+      ctx->presentation= (struct wp_presentation*)wl_registry_bind(registry, id, &wp_presentation_interface, 1);
+      wp_presentation_add_listener(ctx->presentation, &presentationListener, ctx);
+   }
 }
 
 static void registryHandleGlobalRemove(void *data, 
@@ -113,6 +185,15 @@ void textureCreated( EMCTX *ctx, void *userData, int bufferId )
    testCtx->lastTextureBufferId= bufferId;
 }
 
+void textureUpdated( EMCTX *ctx, void *userData, int x, int y, int w, int h )
+{
+   TestCtx *testCtx= (TestCtx*)userData;
+
+   ++testCtx->textureUpdateCount;
+   testCtx->lastTextureUpdateY= y;
+   testCtx->lastTextureUpdateHeight= h;
+}
+
 } // namespace RenderTests
 
 #define WINDOW_WIDTH 640
@@ -310,7 +391,143 @@ exit:
    return testResult;
 }
 
-bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
+namespace RenderTests
+{
+
+typedef struct _StallCtx
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   bool stall;
+   bool stalled;
+   int swapCount;
+} StallCtx;
+
+static void displaySwap( EMCTX *emctx, void *userData )
+{
+   StallCtx *stallCtx= (StallCtx*)userData;
+
+   // Called on the render thread: hold the swap until the test releases it
+   pthread_mutex_lock( &stallCtx->mutex );
+   ++stallCtx->swapCount;
+   if ( stallCtx->stall )
+   {
+      stallCtx->stalled= true;
+      pthread_cond_broadcast( &stallCtx->cond );
+      while( stallCtx->stall )
+      {
+         pthread_cond_wait( &stallCtx->cond, &stallCtx->mutex );
+      }
+      stallCtx->stalled= false;
+   }
+   pthread_mutex_unlock( &stallCtx->mutex );
+}
+
+static bool waitForStall( StallCtx *stallCtx, int timeoutMillis )
+{
+   bool stalled;
+   struct timespec deadline;
+
+   clock_gettime( CLOCK_REALTIME, &deadline );
+   deadline.tv_sec += timeoutMillis/1000;
+   deadline.tv_nsec += (timeoutMillis%1000)*1000000L;
+   if ( deadline.tv_nsec >= 1000000000L )
+   {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+   }
+
+   pthread_mutex_lock( &stallCtx->mutex );
+   while( !stallCtx->stalled )
+   {
+      if ( pthread_cond_timedwait( &stallCtx->cond, &stallCtx->mutex, &deadline ) != 0 )
+      {
+         break;
+      }
+   }
+   stalled= stallCtx->stalled;
+   pthread_mutex_unlock( &stallCtx->mutex );
+
+   return stalled;
+}
+
+static void releaseStall( StallCtx *stallCtx )
+{
+   pthread_mutex_lock( &stallCtx->mutex );
+   stallCtx->stall= false;
+   pthread_cond_broadcast( &stallCtx->cond );
+   pthread_mutex_unlock( &stallCtx->mutex );
+}
+
+static void callbackDone( void *data, struct wl_callback *callback, uint32_t time )
+{
+   int *count= (int*)data;
+
+   ++(*count);
+   wl_callback_destroy( callback );
+}
+
+static const struct wl_callback_listener callbackListener=
+{
+   callbackDone
+};
+
+/*
+ * Dispatch client events until count reaches target.  Unlike
+ * wl_display_roundtrip this gives up after a timeout so an unresponsive
+ * compositor fails the test rather than hanging it.
+ */
+static bool dispatchUntil( struct wl_display *display, int *count, int target, int timeoutMillis )
+{
+   struct timespec tm;
+   long long deadline, now;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+   deadline= tm.tv_sec*1000LL+(tm.tv_nsec/1000000LL)+timeoutMillis;
+
+   while( *count < target )
+   {
+      struct pollfd pfd;
+
+      while( wl_display_prepare_read( display ) != 0 )
+      {
+         wl_display_dispatch_pending( display );
+      }
+      if ( *count >= target )
+      {
+         wl_display_cancel_read( display );
+         break;
+      }
+      wl_display_flush( display );
+
+      clock_gettime( CLOCK_MONOTONIC, &tm );
+      now= tm.tv_sec*1000LL+(tm.tv_nsec/1000000LL);
+      if ( now >= deadline )
+      {
+         wl_display_cancel_read( display );
+         break;
+      }
+
+      pfd.fd= wl_display_get_fd( display );
+      pfd.events= POLLIN;
+      pfd.revents= 0;
+      if ( poll( &pfd, 1, (int)(deadline-now) ) > 0 )
+      {
+         wl_display_read_events( display );
+      }
+      else
+      {
+         wl_display_cancel_read( display );
+      }
+      wl_display_dispatch_pending( display );
+   }
+
+   return (*count >= target);
+}
+
+} // namespace RenderTests
+
+bool testCaseRenderThreadStalledSwap( EMCTX *emctx )
 {
    using namespace RenderTests;
 
@@ -320,28 +537,22 @@ bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
    const char *displayName= "test0";
    struct wl_display *display= 0;
    struct wl_registry *registry= 0;
+   struct wl_surface *otherSurface= 0;
+   struct wl_callback *callback;
    TestCtx testCtx;
    TestCtx *ctx= &testCtx;
+   StallCtx stallCtx;
    EGLBoolean b;
-   std::vector<WstRect> rects;
-   float matrix[16];
-   float alpha= 1.0;
-   bool needHolePunch;
-   int hints;
-   int bufferIdBase= 500;
-   int bufferIdCount= 3;
-   int expectedBufferId= bufferIdBase;
+   int syncCount= 0;
+   int frameCount= 0;
+   int swapCount;
 
    EMStart( emctx );
 
    memset( &testCtx, 0, sizeof(TestCtx) );
-
-   result= testSetupEGL( &ctx->eglCtxS, 0 );
-   if ( !result )
-   {
-      EMERROR("testSetupEGL failed for compositor");
-      goto exit;
-   }
+   memset( &stallCtx, 0, sizeof(StallCtx) );
+   pthread_mutex_init( &stallCtx.mutex, 0 );
+   pthread_cond_init( &stallCtx.cond, 0 );
 
    wctx= WstCompositorCreate();
    if ( !wctx )
@@ -357,20 +568,29 @@ bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
       goto exit;
    }
 
-   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_embedded.so.0.0.0" );
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
    if ( result == false )
    {
       EMERROR( "WstCompositorSetRendererModule failed" );
       goto exit;
    }
 
-   result= WstCompositorSetIsEmbedded( wctx, true );
+   result= WstCompositorSetUseRenderThread( wctx, true );
    if ( result == false )
    {
-      EMERROR( "WstCompositorSetIsEmbedded failed" );
+      EMERROR( "WstCompositorSetUseRenderThread failed" );
       goto exit;
    }
 
+   result= WstCompositorSetHiddenFrameRate( wctx, 30 );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetHiddenFrameRate failed" );
+      goto exit;
+   }
+
+   EMSetDisplaySwapCallback( emctx, displaySwap, &stallCtx );
+
    result= WstCompositorStart( wctx );
    if ( result == false )
    {
@@ -378,8 +598,6 @@ bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
       goto exit;
    }
 
-   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
-
    display= wl_display_connect(displayName);
    if ( !display )
    {
@@ -408,36 +626,32 @@ bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
    result= testSetupEGL( &ctx->eglCtx, display );
    if ( !result )
    {
-      EMERROR("testSetupEGL failed");
+      EMERROR("testSetupEGL failed for client");
       goto exit;
    }
 
    ctx->surface= wl_compositor_create_surface(ctx->compositor);
-   printf("surface=%p\n", ctx->surface);   
-   if ( !ctx->surface )
+   otherSurface= wl_compositor_create_surface(ctx->compositor);
+   if ( !ctx->surface || !otherSurface )
    {
-      EMERROR("error: unable to create wayland surface");
+      EMERROR("error: unable to create wayland surfaces");
       goto exit;
    }
 
    ctx->windowWidth= WINDOW_WIDTH;
    ctx->windowHeight= WINDOW_HEIGHT;
-   
+
    ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
    if ( !ctx->wlEglWindow )
    {
       EMERROR("error: unable to create wl_egl_window");
       goto exit;
    }
-   printf("wl_egl_window %p\n", ctx->wlEglWindow);
-
-   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
 
    ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
                                                   ctx->eglCtx.eglConfig,
                                                   (EGLNativeWindowType)ctx->wlEglWindow,
                                                   NULL );
-   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
 
    b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
    if ( !b )
@@ -451,42 +665,86 @@ bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
    eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
 
    wl_display_roundtrip(display);
+   usleep( 100000 );
 
-   hints= WstHints_noRotation;
-   for( int i= 0; i < 20; ++i )
+   pthread_mutex_lock( &stallCtx.mutex );
+   swapCount= stallCtx.swapCount;
+   stallCtx.stall= true;
+   pthread_mutex_unlock( &stallCtx.mutex );
+
+   if ( swapCount == 0 )
    {
-      usleep( 17000 );
+      EMERROR("No display swap for initial frame");
+      goto exit;
+   }
 
-      WstCompositorComposeEmbedded( wctx,
-                                    0, // x
-                                    0, // y
-                                    WINDOW_WIDTH, // width
-                                    WINDOW_HEIGHT, // height
-                                    matrix,
-                                    alpha,
-                                    hints,
-                                    &needHolePunch,
-                                    rects );
-                                    
-      if ( ctx->lastTextureBufferId != expectedBufferId )
+   // The next composed frame stalls the render thread in its swap.  Client
+   // eglSwapBuffers is not used again until the stall is released since on
+   // some platforms it shares a lock with the display swap.
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   wl_display_flush(display);
+
+   if ( !waitForStall( &stallCtx, 2000 ) )
+   {
+      EMERROR("Render thread swap did not stall");
+      goto exit;
+   }
+
+   // Requests from clients must still be serviced by the display thread
+   for( int i= 0; i < 3; ++i )
+   {
+      callback= wl_display_sync( display );
+      wl_callback_add_listener( callback, &callbackListener, &syncCount );
+      if ( !dispatchUntil( display, &syncCount, i+1, 1000 ) )
       {
-         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
+         EMERROR("Client round trip %d did not complete during stalled swap", i );
          goto exit;
       }
-                                    
-      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   }
 
-      expectedBufferId += 1;
-      if ( expectedBufferId >= bufferIdBase+bufferIdCount )
+   // Surfaces that are not part of the stalled frame keep getting frame callbacks
+   for( int i= 0; i < 3; ++i )
+   {
+      callback= wl_surface_frame( otherSurface );
+      wl_callback_add_listener( callback, &callbackListener, &frameCount );
+      wl_surface_commit( otherSurface );
+      if ( !dispatchUntil( display, &frameCount, i+1, 1000 ) )
       {
-         expectedBufferId= bufferIdBase;
+         EMERROR("Frame callback %d for other surface not received during stalled swap", i );
+         goto exit;
       }
    }
 
+   pthread_mutex_lock( &stallCtx.mutex );
+   result= stallCtx.stalled;
+   pthread_mutex_unlock( &stallCtx.mutex );
+   if ( !result )
+   {
+      EMERROR("Swap stall ended early");
+      goto exit;
+   }
+
+   releaseStall( &stallCtx );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   wl_display_roundtrip(display);
+   usleep( 100000 );
+
+   pthread_mutex_lock( &stallCtx.mutex );
+   result= (stallCtx.swapCount > swapCount+1);
+   pthread_mutex_unlock( &stallCtx.mutex );
+   if ( !result )
+   {
+      EMERROR("Render thread did not resume after stalled swap");
+      goto exit;
+   }
+
    testResult= true;
 
 exit:
 
+   releaseStall( &stallCtx );
+
    if ( ctx->eglCtx.eglSurfaceWindow )
    {
       eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
@@ -499,6 +757,12 @@ exit:
       ctx->wlEglWindow= 0;
    }
 
+   if ( otherSurface )
+   {
+      wl_surface_destroy( otherSurface );
+      otherSurface= 0;
+   }
+
    if ( ctx->surface )
    {
       wl_surface_destroy( ctx->surface );
@@ -528,126 +792,236 @@ exit:
 
    WstCompositorDestroy( wctx );
 
-   testTermEGL( &ctx->eglCtxS );
+   EMSetDisplaySwapCallback( emctx, 0, 0 );
+   pthread_cond_destroy( &stallCtx.cond );
+   pthread_mutex_destroy( &stallCtx.mutex );
 
    return testResult;
 }
 
-namespace EmbeddedVirtual
-{
-
-typedef struct _ClientStatusCtx
+bool testCaseRenderFrameCallbackCommit( EMCTX *emctx )
 {
-   int clientStatus;
-   int clientPid;
-   int detail;
-   bool started;
-   bool connected;
-   bool disconnected;
-   bool stoppedNormal;
-   bool stoppedAbnormal;
-   bool firstFrame;
-} ClientStatusCtx;
+   using namespace RenderTests;
 
-typedef struct _LaunchCtx
-{
-   EMCTX *emctx;
-   WstCompositor *wctx;
-   const char *launchCmd;
-   bool launchThreadStarted;
-   bool launchError;
-} LaunchCtx;
+   bool testResult= false;
+   bool result;
+   WstCompositor *wctx= 0;
+   const char *displayName= "test0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   struct wl_surface *otherSurface= 0;
+   struct wl_callback *callback;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   EGLBoolean b;
+   int frameCount= 0;
 
-static void clientStatus( WstCompositor *ctx, int status, int clientPID, int detail, void *userData )
-{
-   using namespace RenderTests;
+   EMStart( emctx );
 
-   ClientStatusCtx *csctx= (ClientStatusCtx*)userData;
+   memset( &testCtx, 0, sizeof(TestCtx) );
 
-   csctx->clientStatus= status;
-   csctx->clientPid= clientPID;
-   switch( status )
+   wctx= WstCompositorCreate();
+   if ( !wctx )
    {
-      case WstClient_started:
-         csctx->started= true;
-         break;
-      case WstClient_stoppedNormal:
-         csctx->stoppedNormal= true;
-         break;
-      case WstClient_stoppedAbnormal:
-         csctx->stoppedAbnormal= true;
-         csctx->detail= detail;
-         break;
-      case WstClient_connected:
-         csctx->connected= true;
-         break;
-      case WstClient_disconnected:
-         csctx->disconnected= true;
-         break;
-      case WstClient_firstFrame:
-         csctx->firstFrame= true;
-         break;
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
    }
-}
 
-static void* clientLaunchThread( void *arg )
-{
-   using namespace RenderTests;
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
 
-   LaunchCtx *lctx= (LaunchCtx*)arg;
-   EMCTX *emctx= lctx->emctx;
-   bool result;
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
 
-   lctx->launchThreadStarted= true;
+   result= WstCompositorSetHiddenFrameRate( wctx, 30 );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetHiddenFrameRate failed" );
+      goto exit;
+   }
 
-   result= WstCompositorLaunchClient( lctx->wctx, lctx->launchCmd );
+   result= WstCompositorStart( wctx );
    if ( result == false )
    {
-      lctx->launchError= true;
-      EMERROR( "WstCompositorLaunchClient failed" );
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   display= wl_display_connect(displayName);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed for client");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   otherSurface= wl_compositor_create_surface(ctx->compositor);
+   if ( !ctx->surface || !otherSurface )
+   {
+      EMERROR("error: unable to create wayland surfaces");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   wl_display_roundtrip(display);
+
+   // A frame request takes effect at the next commit of its surface, so
+   // frames composed for other surfaces meanwhile must not complete it
+   callback= wl_surface_frame( otherSurface );
+   wl_callback_add_listener( callback, &callbackListener, &frameCount );
+   for( int i= 0; i < 10; ++i )
+   {
+      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+      dispatchUntil( display, &frameCount, 1, 50 );
+   }
+   if ( frameCount != 0 )
+   {
+      EMERROR("Frame callback done before its surface was committed");
+      goto exit;
+   }
+
+   wl_surface_commit( otherSurface );
+   if ( !dispatchUntil( display, &frameCount, 1, 1000 ) )
+   {
+      EMERROR("Frame callback not done after its surface was committed");
       goto exit;
    }
 
+   testResult= true;
+
 exit:
-   lctx->launchThreadStarted= false;
 
-   return 0;
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( otherSurface )
+   {
+      wl_surface_destroy( otherSurface );
+      otherSurface= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctx );
+
+   return testResult;
 }
-} // namespace EmbeddedVirtual
 
-bool testCaseRenderBasicCompositionEmbeddedVirtual( EMCTX *emctx )
+bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx )
 {
    using namespace RenderTests;
-   using namespace EmbeddedVirtual;
 
    bool testResult= false;
    bool result;
-   WstCompositor *master= 0;
-   WstCompositor *virt1= 0;
-   WstCompositor *virt2= 0;
+   WstCompositor *wctx= 0;
+   const char *displayName= "test0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
    TestCtx testCtx;
    TestCtx *ctx= &testCtx;
-   pthread_t clientLaunchThreadId1= 0;
-   ClientStatusCtx csctx1;
-   LaunchCtx lctx1;
-   pthread_t clientLaunchThreadId2= 0;
-   ClientStatusCtx csctx2;
-   LaunchCtx lctx2;
    EGLBoolean b;
-   int rc, retryCount;
-   int callbackCount;
    std::vector<WstRect> rects;
    float matrix[16];
    float alpha= 1.0;
    bool needHolePunch;
    int hints;
-   bool firstFrameVirt1;
-   bool firstFrameVirt2;
+   int bufferIdBase= 500;
+   int bufferIdCount= 3;
+   int expectedBufferId= bufferIdBase;
 
    EMStart( emctx );
 
-   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
-
    memset( &testCtx, 0, sizeof(TestCtx) );
 
    result= testSetupEGL( &ctx->eglCtxS, 0 );
@@ -657,116 +1031,121 @@ bool testCaseRenderBasicCompositionEmbeddedVirtual( EMCTX *emctx )
       goto exit;
    }
 
-   virt1= WstCompositorCreateVirtualEmbedded( NULL );
-   if ( !virt1 )
+   wctx= WstCompositorCreate();
+   if ( !wctx )
    {
-      EMERROR("WstCreateVirtualEmbedded failed for virt1");
+      EMERROR( "WstCompositorCreate failed" );
       goto exit;
    }
 
-   memset( &csctx1, 0, sizeof(csctx1) );
-   result= WstCompositorSetClientStatusCallback( virt1, clientStatus, (void*)&csctx1 );
-   if ( !result )
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
    {
-      EMERROR( "WstCompositorSetClientStatusCallback failed" );
+      EMERROR( "WstCompositorSetDisplayName failed" );
       goto exit;
    }
 
-   memset( &lctx1, 0, sizeof(lctx1) );
-   lctx1.emctx= emctx;
-   lctx1.wctx= virt1;
-   lctx1.launchCmd= "./westeros-unittest -x clientApp 600";
-
-   rc= pthread_create( &clientLaunchThreadId1, NULL, clientLaunchThread, &lctx1 );
-   if ( rc )
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_embedded.so.0.0.0" );
+   if ( result == false )
    {
-      EMERROR("unable to start client launch thread");
+      EMERROR( "WstCompositorSetRendererModule failed" );
       goto exit;
    }
 
-   virt2= WstCompositorCreateVirtualEmbedded( NULL );
-   if ( !virt2 )
+   result= WstCompositorSetIsEmbedded( wctx, true );
+   if ( result == false )
    {
-      EMERROR("WstCreateVirtualEmbedded failed for virt2");
+      EMERROR( "WstCompositorSetIsEmbedded failed" );
       goto exit;
    }
 
-   memset( &csctx2, 0, sizeof(csctx2) );
-   result= WstCompositorSetClientStatusCallback( virt2, clientStatus, (void*)&csctx2 );
-   if ( !result )
+   result= WstCompositorStart( wctx );
+   if ( result == false )
    {
-      EMERROR( "WstCompositorSetClientStatusCallback failed" );
+      EMERROR( "WstCompositorStart failed" );
       goto exit;
    }
 
-   memset( &lctx2, 0, sizeof(lctx2) );
-   lctx2.emctx= emctx;
-   lctx2.wctx= virt2;
-   lctx2.launchCmd= "./westeros-unittest -x clientApp 700";
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
 
-   rc= pthread_create( &clientLaunchThreadId2, NULL, clientLaunchThread, &lctx2 );
-   if ( rc )
+   display= wl_display_connect(displayName);
+   if ( !display )
    {
-      EMERROR("unable to start client launch thread");
+      EMERROR( "wl_display_connect failed" );
       goto exit;
    }
+   ctx->display= display;
 
-   ctx->glCtx= WstGLInit();
-   if ( !ctx->glCtx )
+   registry= wl_display_get_registry(display);
+   if ( !registry )
    {
-      EMERROR("Unable to create westeros-gl context");
+      EMERROR( "wl_display_get_registrty failed" );
       goto exit;
    }
 
-   ctx->windowWidth= WINDOW_WIDTH;
-   ctx->windowHeight= WINDOW_HEIGHT;
-
-   ctx->eglNativeWindow= WstGLCreateNativeWindow( ctx->glCtx, 0, 0, ctx->windowWidth, ctx->windowHeight );
-   if ( !ctx->eglNativeWindow )
-   {
-      EMERROR("error: unable to create egl native window");
-      goto exit;
-   }
-   printf("eglNativeWindow %p\n", ctx->eglNativeWindow);
+   wl_registry_add_listener(registry, &registryListener, ctx);
 
-   ctx->eglCtxS.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtxS.eglDisplay,
-                                                  ctx->eglCtxS.eglConfig,
-                                                  (EGLNativeWindowType)ctx->eglNativeWindow,
-                                                  NULL );
-   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtxS.eglSurfaceWindow );
+   wl_display_roundtrip(display);
 
-   b= eglMakeCurrent( ctx->eglCtxS.eglDisplay, ctx->eglCtxS.eglSurfaceWindow, ctx->eglCtxS.eglSurfaceWindow, ctx->eglCtxS.eglContext );
-   if ( !b )
+   if ( !ctx->compositor )
    {
-      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      EMERROR("Failed to acquire needed compositor items");
       goto exit;
    }
 
-   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed");
+      goto exit;
+   }
 
-   retryCount= 0;
-   while( !csctx1.connected && !csctx2.connected )
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);   
+   if ( !ctx->surface )
    {
-      usleep( 300000 );
-      ++retryCount;
-      if ( retryCount > 50 )
-      {
-         EMERROR("Client failed to connect");
-         goto exit;
-      }
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
    }
 
-   firstFrameVirt1= false;
-   firstFrameVirt2= false;
-   callbackCount=-1;
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+   
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+   printf("wl_egl_window %p\n", ctx->wlEglWindow);
+
+   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+   wl_display_roundtrip(display);
+
    hints= WstHints_noRotation;
    for( int i= 0; i < 20; ++i )
    {
-      usleep( 32000 );
+      usleep( 17000 );
 
-      csctx1.firstFrame= false;
-      csctx2.firstFrame= false;
-      WstCompositorComposeEmbedded( virt1,
+      WstCompositorComposeEmbedded( wctx,
                                     0, // x
                                     0, // y
                                     WINDOW_WIDTH, // width
@@ -776,161 +1155,1533 @@ bool testCaseRenderBasicCompositionEmbeddedVirtual( EMCTX *emctx )
                                     hints,
                                     &needHolePunch,
                                     rects );
-      if ( (callbackCount != ctx->textureCallbackCount) &&
-           ((ctx->lastTextureBufferId < 600) || (ctx->lastTextureBufferId > 603)) )
-      {
-         EMERROR("Unexpected last texture bufferId: expected(600-603) actual(%d) iteration %d", ctx->lastTextureBufferId, i );
-         goto exit;
-      }
-      if ( (callbackCount != ctx->textureCallbackCount) &&
-           (
-             (!firstFrameVirt1 && !csctx1.firstFrame) ||
-             (!firstFrameVirt2 && csctx2.firstFrame)
-           ) )
+                                    
+      if ( ctx->lastTextureBufferId != expectedBufferId )
       {
-         EMERROR("Unexpected first frame: firstFrame1 %d firstFrame2 %d firstFrameVirt1 %d firstFrameVirt2 %d",
-                  csctx1.firstFrame, csctx2.firstFrame, firstFrameVirt1, firstFrameVirt2 );
+         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
          goto exit;
       }
-      if ( (callbackCount != ctx->textureCallbackCount) && csctx1.firstFrame  )
+                                    
+      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+      expectedBufferId += 1;
+      if ( expectedBufferId >= bufferIdBase+bufferIdCount )
       {
-         firstFrameVirt1= csctx1.firstFrame;
+         expectedBufferId= bufferIdBase;
       }
+   }
 
-      callbackCount= ctx->textureCallbackCount;
+   testResult= true;
 
-      csctx1.firstFrame= false;
-      csctx2.firstFrame= false;
-      WstCompositorComposeEmbedded( virt2,
-                                    0, // x
-                                    0, // y
-                                    WINDOW_WIDTH, // width
-                                    WINDOW_HEIGHT, // height
-                                    matrix,
-                                    alpha,
-                                    hints,
-                                    &needHolePunch,
-                                    rects );
-      if ( (callbackCount != ctx->textureCallbackCount) &&
-           ((ctx->lastTextureBufferId < 700) || (ctx->lastTextureBufferId > 703)) )
-      {
-         EMERROR("Unexpected last texture bufferId: expected(700-703) actual(%d) iteration %d", ctx->lastTextureBufferId, i );
-         goto exit;
-      }
-      if ( (callbackCount != ctx->textureCallbackCount) &&
-           (
-             (!firstFrameVirt1 && csctx1.firstFrame) ||
-             (!firstFrameVirt2 && !csctx2.firstFrame)
-           ) )
-      {
-         EMERROR("Unexpected first frame: firstFrame1 %d firstFrame2 %d firstFrameVirt1 %d firstFrameVirt2 %d",
-                  csctx1.firstFrame, csctx2.firstFrame, firstFrameVirt1, firstFrameVirt2 );
-         goto exit;
-      }
-      if ( (callbackCount != ctx->textureCallbackCount) && csctx2.firstFrame  )
-      {
-         firstFrameVirt2= csctx2.firstFrame;
-      }
+exit:
+
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctx );
+
+   testTermEGL( &ctx->eglCtxS );
+
+   return testResult;
+}
+
+namespace EmbeddedVirtual
+{
+
+typedef struct _ClientStatusCtx
+{
+   int clientStatus;
+   int clientPid;
+   int detail;
+   bool started;
+   bool connected;
+   bool disconnected;
+   bool stoppedNormal;
+   bool stoppedAbnormal;
+   bool firstFrame;
+} ClientStatusCtx;
+
+typedef struct _LaunchCtx
+{
+   EMCTX *emctx;
+   WstCompositor *wctx;
+   const char *launchCmd;
+   bool launchThreadStarted;
+   bool launchError;
+} LaunchCtx;
+
+static void clientStatus( WstCompositor *ctx, int status, int clientPID, int detail, void *userData )
+{
+   using namespace RenderTests;
+
+   ClientStatusCtx *csctx= (ClientStatusCtx*)userData;
+
+   csctx->clientStatus= status;
+   csctx->clientPid= clientPID;
+   switch( status )
+   {
+      case WstClient_started:
+         csctx->started= true;
+         break;
+      case WstClient_stoppedNormal:
+         csctx->stoppedNormal= true;
+         break;
+      case WstClient_stoppedAbnormal:
+         csctx->stoppedAbnormal= true;
+         csctx->detail= detail;
+         break;
+      case WstClient_connected:
+         csctx->connected= true;
+         break;
+      case WstClient_disconnected:
+         csctx->disconnected= true;
+         break;
+      case WstClient_firstFrame:
+         csctx->firstFrame= true;
+         break;
+   }
+}
+
+static void* clientLaunchThread( void *arg )
+{
+   using namespace RenderTests;
+
+   LaunchCtx *lctx= (LaunchCtx*)arg;
+   EMCTX *emctx= lctx->emctx;
+   bool result;
+
+   lctx->launchThreadStarted= true;
+
+   result= WstCompositorLaunchClient( lctx->wctx, lctx->launchCmd );
+   if ( result == false )
+   {
+      lctx->launchError= true;
+      EMERROR( "WstCompositorLaunchClient failed" );
+      goto exit;
+   }
+
+exit:
+   lctx->launchThreadStarted= false;
+
+   return 0;
+}
+} // namespace EmbeddedVirtual
+
+bool testCaseRenderBasicCompositionEmbeddedVirtual( EMCTX *emctx )
+{
+   using namespace RenderTests;
+   using namespace EmbeddedVirtual;
+
+   bool testResult= false;
+   bool result;
+   WstCompositor *master= 0;
+   WstCompositor *virt1= 0;
+   WstCompositor *virt2= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   pthread_t clientLaunchThreadId1= 0;
+   ClientStatusCtx csctx1;
+   LaunchCtx lctx1;
+   pthread_t clientLaunchThreadId2= 0;
+   ClientStatusCtx csctx2;
+   LaunchCtx lctx2;
+   EGLBoolean b;
+   int rc, retryCount;
+   int callbackCount;
+   std::vector<WstRect> rects;
+   float matrix[16];
+   float alpha= 1.0;
+   bool needHolePunch;
+   int hints;
+   bool firstFrameVirt1;
+   bool firstFrameVirt2;
+
+   EMStart( emctx );
+
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   result= testSetupEGL( &ctx->eglCtxS, 0 );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed for compositor");
+      goto exit;
+   }
+
+   virt1= WstCompositorCreateVirtualEmbedded( NULL );
+   if ( !virt1 )
+   {
+      EMERROR("WstCreateVirtualEmbedded failed for virt1");
+      goto exit;
+   }
+
+   memset( &csctx1, 0, sizeof(csctx1) );
+   result= WstCompositorSetClientStatusCallback( virt1, clientStatus, (void*)&csctx1 );
+   if ( !result )
+   {
+      EMERROR( "WstCompositorSetClientStatusCallback failed" );
+      goto exit;
+   }
+
+   memset( &lctx1, 0, sizeof(lctx1) );
+   lctx1.emctx= emctx;
+   lctx1.wctx= virt1;
+   lctx1.launchCmd= "./westeros-unittest -x clientApp 600";
+
+   rc= pthread_create( &clientLaunchThreadId1, NULL, clientLaunchThread, &lctx1 );
+   if ( rc )
+   {
+      EMERROR("unable to start client launch thread");
+      goto exit;
+   }
+
+   virt2= WstCompositorCreateVirtualEmbedded( NULL );
+   if ( !virt2 )
+   {
+      EMERROR("WstCreateVirtualEmbedded failed for virt2");
+      goto exit;
+   }
+
+   memset( &csctx2, 0, sizeof(csctx2) );
+   result= WstCompositorSetClientStatusCallback( virt2, clientStatus, (void*)&csctx2 );
+   if ( !result )
+   {
+      EMERROR( "WstCompositorSetClientStatusCallback failed" );
+      goto exit;
+   }
+
+   memset( &lctx2, 0, sizeof(lctx2) );
+   lctx2.emctx= emctx;
+   lctx2.wctx= virt2;
+   lctx2.launchCmd= "./westeros-unittest -x clientApp 700";
+
+   rc= pthread_create( &clientLaunchThreadId2, NULL, clientLaunchThread, &lctx2 );
+   if ( rc )
+   {
+      EMERROR("unable to start client launch thread");
+      goto exit;
+   }
+
+   ctx->glCtx= WstGLInit();
+   if ( !ctx->glCtx )
+   {
+      EMERROR("Unable to create westeros-gl context");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+
+   ctx->eglNativeWindow= WstGLCreateNativeWindow( ctx->glCtx, 0, 0, ctx->windowWidth, ctx->windowHeight );
+   if ( !ctx->eglNativeWindow )
+   {
+      EMERROR("error: unable to create egl native window");
+      goto exit;
+   }
+   printf("eglNativeWindow %p\n", ctx->eglNativeWindow);
+
+   ctx->eglCtxS.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtxS.eglDisplay,
+                                                  ctx->eglCtxS.eglConfig,
+                                                  (EGLNativeWindowType)ctx->eglNativeWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtxS.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtxS.eglDisplay, ctx->eglCtxS.eglSurfaceWindow, ctx->eglCtxS.eglSurfaceWindow, ctx->eglCtxS.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   retryCount= 0;
+   while( !csctx1.connected && !csctx2.connected )
+   {
+      usleep( 300000 );
+      ++retryCount;
+      if ( retryCount > 50 )
+      {
+         EMERROR("Client failed to connect");
+         goto exit;
+      }
+   }
+
+   firstFrameVirt1= false;
+   firstFrameVirt2= false;
+   callbackCount=-1;
+   hints= WstHints_noRotation;
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 32000 );
+
+      csctx1.firstFrame= false;
+      csctx2.firstFrame= false;
+      WstCompositorComposeEmbedded( virt1,
+                                    0, // x
+                                    0, // y
+                                    WINDOW_WIDTH, // width
+                                    WINDOW_HEIGHT, // height
+                                    matrix,
+                                    alpha,
+                                    hints,
+                                    &needHolePunch,
+                                    rects );
+      if ( (callbackCount != ctx->textureCallbackCount) &&
+           ((ctx->lastTextureBufferId < 600) || (ctx->lastTextureBufferId > 603)) )
+      {
+         EMERROR("Unexpected last texture bufferId: expected(600-603) actual(%d) iteration %d", ctx->lastTextureBufferId, i );
+         goto exit;
+      }
+      if ( (callbackCount != ctx->textureCallbackCount) &&
+           (
+             (!firstFrameVirt1 && !csctx1.firstFrame) ||
+             (!firstFrameVirt2 && csctx2.firstFrame)
+           ) )
+      {
+         EMERROR("Unexpected first frame: firstFrame1 %d firstFrame2 %d firstFrameVirt1 %d firstFrameVirt2 %d",
+                  csctx1.firstFrame, csctx2.firstFrame, firstFrameVirt1, firstFrameVirt2 );
+         goto exit;
+      }
+      if ( (callbackCount != ctx->textureCallbackCount) && csctx1.firstFrame  )
+      {
+         firstFrameVirt1= csctx1.firstFrame;
+      }
+
+      callbackCount= ctx->textureCallbackCount;
+
+      csctx1.firstFrame= false;
+      csctx2.firstFrame= false;
+      WstCompositorComposeEmbedded( virt2,
+                                    0, // x
+                                    0, // y
+                                    WINDOW_WIDTH, // width
+                                    WINDOW_HEIGHT, // height
+                                    matrix,
+                                    alpha,
+                                    hints,
+                                    &needHolePunch,
+                                    rects );
+      if ( (callbackCount != ctx->textureCallbackCount) &&
+           ((ctx->lastTextureBufferId < 700) || (ctx->lastTextureBufferId > 703)) )
+      {
+         EMERROR("Unexpected last texture bufferId: expected(700-703) actual(%d) iteration %d", ctx->lastTextureBufferId, i );
+         goto exit;
+      }
+      if ( (callbackCount != ctx->textureCallbackCount) &&
+           (
+             (!firstFrameVirt1 && csctx1.firstFrame) ||
+             (!firstFrameVirt2 && !csctx2.firstFrame)
+           ) )
+      {
+         EMERROR("Unexpected first frame: firstFrame1 %d firstFrame2 %d firstFrameVirt1 %d firstFrameVirt2 %d",
+                  csctx1.firstFrame, csctx2.firstFrame, firstFrameVirt1, firstFrameVirt2 );
+         goto exit;
+      }
+      if ( (callbackCount != ctx->textureCallbackCount) && csctx2.firstFrame  )
+      {
+         firstFrameVirt2= csctx2.firstFrame;
+      }
+
+      callbackCount= ctx->textureCallbackCount;
+
+      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   }
+
+   master= WstCompositorGetMasterEmbedded();
+   if ( !master )
+   {
+      EMERROR("WstCompositorGetMasterEmbedded failed");
+      goto exit;
+   }
+
+   if ( clientLaunchThreadId1 && csctx1.clientPid )
+   {
+      kill( csctx1.clientPid, 6 );
+      pthread_join( clientLaunchThreadId1, NULL );
+      clientLaunchThreadId1= 0;
+   }
+   if ( clientLaunchThreadId2 && csctx2.clientPid )
+   {
+      kill( csctx2.clientPid, 6 );
+      pthread_join( clientLaunchThreadId2, NULL );
+      clientLaunchThreadId2= 0;
+   }
+
+   WstCompositorDestroy( virt1 );
+   WstCompositorDestroy( virt2 );
+   WstCompositorDestroy( master );
+
+   retryCount= 0;
+   while( !csctx1.disconnected || !csctx2.disconnected )
+   {
+      usleep( 300000 );
+      ++retryCount;
+      if ( retryCount > 50 )
+      {
+         EMERROR("Client failed to disconnect");
+         goto exit;
+      }
+   }
+
+   retryCount= 0;
+   while( !(csctx1.stoppedNormal || csctx1.stoppedAbnormal) ||
+          !(csctx2.stoppedNormal || csctx2.stoppedAbnormal) )
+   {
+      usleep( 300000 );
+      ++retryCount;
+      if ( retryCount > 50 )
+      {
+         EMERROR("Client failed to stop");
+         goto exit;
+      }
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->eglCtxS.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtxS.eglDisplay, ctx->eglCtxS.eglSurfaceWindow );
+      ctx->eglCtxS.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->eglNativeWindow )
+   {
+      WstGLDestroyNativeWindow( ctx->glCtx, ctx->eglNativeWindow );
+      ctx->eglNativeWindow= 0;
+   }
+
+   if ( ctx->glCtx )
+   {
+      WstGLTerm( ctx->glCtx );
+      ctx->glCtx= 0;
+   }
+
+   testTermEGL( &ctx->eglCtxS );
+
+   return testResult;
+}
+
+bool testCaseRenderBasicCompositionNested( EMCTX *emctx )
+{
+   using namespace RenderTests;
+
+   bool testResult= false;
+   bool result;
+   WstCompositor *wctx= 0;
+   WstCompositor *wctxNested= 0;
+   const char *displayName= "test0";
+   const char *displayNameNested= "nested0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   EGLBoolean b;
+   int bufferIdBase= 500;
+   int bufferIdCount= 3;
+   int expectedBufferId= 1;
+
+   EMStart( emctx );
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+
+   wctxNested= WstCompositorCreate();
+   if ( !wctxNested )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctxNested, displayNameNested );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctxNested, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetIsNested( wctxNested, true );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetIsNested failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetNestedDisplayName( wctxNested, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctxNested );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+
+   display= wl_display_connect(displayNameNested);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed for client");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);   
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+   
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+   printf("wl_egl_window %p\n", ctx->wlEglWindow);
+
+   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+   wl_display_roundtrip(display);
+
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 17000 );
+
+      if ( ctx->lastTextureBufferId != expectedBufferId )
+      {
+         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
+         goto exit;
+      }
+
+      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+      expectedBufferId += 1;
+      if ( expectedBufferId >= bufferIdCount+1 )
+      {
+         expectedBufferId= 1;
+      }
+
+      wl_display_dispatch( display );
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctxNested );
+
+   WstCompositorDestroy( wctx );
+
+   return testResult;
+}
+
+bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx )
+{
+   using namespace RenderTests;
+
+   bool testResult= false;
+   bool result;
+   WstCompositor *wctx= 0;
+   WstCompositor *wctxRepeater= 0;
+   const char *displayName= "test0";
+   const char *displayNameNested= "nested0";
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   EGLBoolean b;
+   int bufferIdBase= 500;
+   int bufferIdCount= 3;
+   int expectedBufferId;
+
+   EMStart( emctx );
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   if ( !checkForRepeatingSupport() )
+   {
+      // If we cannot repeat, expect default buffer id range
+      bufferIdBase= 1;
+   }
+   expectedBufferId= bufferIdBase;
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+
+   wctxRepeater= WstCompositorCreate();
+   if ( !wctxRepeater )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctxRepeater, displayNameNested );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetIsRepeater( wctxRepeater, true );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetIsNested failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetNestedDisplayName( wctxRepeater, displayName );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctxRepeater );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+
+   display= wl_display_connect(displayNameNested);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   result= testSetupEGL( &ctx->eglCtx, display );
+   if ( !result )
+   {
+      EMERROR("testSetupEGL failed for client");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);   
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   ctx->windowWidth= WINDOW_WIDTH;
+   ctx->windowHeight= WINDOW_HEIGHT;
+   
+   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->wlEglWindow )
+   {
+      EMERROR("error: unable to create wl_egl_window");
+      goto exit;
+   }
+   printf("wl_egl_window %p\n", ctx->wlEglWindow);
+
+   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
+
+   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
+                                                  ctx->eglCtx.eglConfig,
+                                                  (EGLNativeWindowType)ctx->wlEglWindow,
+                                                  NULL );
+   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+
+   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
+   if ( !b )
+   {
+      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      goto exit;
+   }
+
+   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+
+   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+   wl_display_roundtrip(display);
+
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 17000 );
+
+      if ( ctx->lastTextureBufferId != expectedBufferId )
+      {
+         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
+         goto exit;
+      }
+
+      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+
+      expectedBufferId += 1;
+      if ( expectedBufferId >= bufferIdBase+bufferIdCount )
+      {
+         expectedBufferId= bufferIdBase;
+      }
+
+      wl_display_dispatch( display );
+   }
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->eglCtx.eglSurfaceWindow )
+   {
+      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
+      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->wlEglWindow )
+   {
+      wl_egl_window_destroy( ctx->wlEglWindow );
+      ctx->wlEglWindow= 0;
+   }
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   testTermEGL( &ctx->eglCtx );
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   WstCompositorDestroy( wctxRepeater );
+
+   WstCompositorDestroy( wctx );
+
+   return testResult;
+}
+
+static void terminatedCallback( WstCompositor *ctx, void *userData )
+{
+   bool *terminated= (bool*)userData;
+
+   *terminated= true;
+}
+
+bool testCaseRenderShmRepeater( EMCTX *emctx )
+{
+   using namespace RenderTests;
+
+   bool testResult= false;
+   bool result;
+   const char *displayName= "display0";
+   const char *displayName2= "display1";
+   WstCompositor *wctx= 0;
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   bool repeatingSupported;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   unsigned char *imgData= 0;
+   int imgWidth, imgHeight;
+   int imgDataSize;
+   char filename[32];
+   int fd= -1;
+   int lenDidWrite;
+   void *data= 0;
+   struct wl_shm_pool *shmPool= 0;
+   struct wl_buffer *buffer= 0;
+   int expectedBufferId;
+   int pid;
+
+   EMStart( emctx );
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   repeatingSupported= checkForRepeatingSupport();
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( !result )
+   {
+      EMERROR( "WstCompositorSetIsNested failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   pid= fork();
+   if ( pid == 0 )
+   {
+      EMCTX *emctx2= 0;
+      WstCompositor *wctx2= 0;
+      bool terminated= false;
+
+      emctx2= EMCreateContext();
+      if ( !emctx2 )
+      {
+         goto repeater_exit;
+      }
+
+      wctx2= WstCompositorCreate();
+      if ( !wctx2 )
+      {
+         EMERROR( "WstCompositorCreate failed" );
+         goto repeater_exit;
+      }
+
+      result= WstCompositorSetDisplayName( wctx2, displayName2 );
+      if ( !result )
+      {
+         EMERROR( "WstCompositorSetDisplayName failed" );
+         goto repeater_exit;
+      }
+
+      result= WstCompositorSetIsRepeater( wctx2, true );
+      if ( !result )
+      {
+         EMERROR( "WstCompositorSetIsRepeater failed" );
+         goto repeater_exit;
+      }
+
+      result= WstCompositorSetNestedDisplayName( wctx2, displayName );
+      if ( !result )
+      {
+         EMERROR( "WstCompositorSetNestedDisplayName failed" );
+         goto repeater_exit;
+      }
+
+      result= WstCompositorSetTerminatedCallback( wctx2, terminatedCallback, &terminated );
+      if ( result == false )
+      {
+         EMERROR( "WstCompositorSetTerminatedCallback failed" );
+         goto repeater_exit;
+      }
+
+      result= WstCompositorStart( wctx2 );
+      if ( result == false )
+      {
+         EMERROR( "WstCompositorStart failed" );
+         goto repeater_exit;
+      }
+
+      while( !terminated )
+      {
+         usleep( 10000 );
+      }
+      printf("repeater ending\n");
+
+   repeater_exit:
+      if ( wctx2 )
+      {
+         WstCompositorDestroy( wctx2 );
+      }
+      if ( emctx2 )
+      {
+         EMDestroyContext( emctx2 );
+      }
+      printf("repeater ended\n");
+      exit(0);
+   }
+   else if ( pid == -1 )
+   {
+      EMERROR( "Failed to fork to start repeater" );
+      goto exit;
+   }
+   else
+   {
+      // wait for repeater to start
+      usleep( 100000 );
+   }
+
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+
+   display= wl_display_connect(displayName2);
+   if ( !display )
+   {
+      int retries= 10;
+
+      while( retries-- > 0 )
+      {
+         display= wl_display_connect(displayName2);
+         if ( display )
+         {
+            break;
+         }
+         usleep( 100000 );
+      }
+      if ( !display )
+      {
+         EMERROR( "wl_display_connect failed" );
+         goto exit;
+      }
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor || !ctx->shm )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   printf("surface=%p\n", ctx->surface);
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   wl_display_roundtrip(display);
+
+   imgWidth= 32;
+   imgHeight= 32;
+   imgDataSize= imgWidth*imgHeight*4;
+
+   imgData= (unsigned char*)calloc( 1, imgDataSize );
+   if ( !imgData )
+   {
+      EMERROR("No memory for image data");
+      goto exit;
+   }
+
+   strcpy( filename, "/tmp/westeros-XXXXXX" );
+   fd= mkostemp( filename, O_CLOEXEC );
+   if ( fd < 0 )
+   {
+      EMERROR("Unable to create temp file");
+      goto exit;
+   }
+
+   lenDidWrite= write( fd, imgData, imgDataSize );
+   if ( lenDidWrite != imgDataSize )
+   {
+      EMERROR("Unable to write image data to temp file");
+      goto exit;
+   }
+
+   data= mmap(NULL, imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if ( data == MAP_FAILED )
+   {
+      EMERROR("Unable to mmap image data");
+      goto exit;
+   }
+
+   memcpy( data, imgData, imgDataSize );
+
+   shmPool= wl_shm_create_pool(ctx->shm, fd, imgDataSize);
+   if ( shmPool == 0 )
+   {
+      EMERROR("Unable to create shm pool");
+      goto exit;
+   }
+   wl_display_roundtrip(display);
+
+   buffer= wl_shm_pool_create_buffer(shmPool,
+                                     0, //offset
+                                     imgWidth,
+                                     imgHeight,
+                                     imgWidth*4, //stride
+                                     WL_SHM_FORMAT_ARGB8888 );
+   wl_display_roundtrip(display);
+   if ( !buffer )
+   {
+      EMERROR("Unable to create shm buffer");
+      goto exit;
+   }
+
+   expectedBufferId= repeatingSupported ? (imgWidth<<16)|imgHeight : 2;
+
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
+
+   usleep( 17000 );
+
+   if ( ctx->lastTextureBufferId != expectedBufferId )
+   {
+      EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d)", expectedBufferId, ctx->lastTextureBufferId );
+      goto exit;
+   }
+
+
+   testResult= true;
+
+exit:
+
+   if ( ctx->surface )
+   {
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   if ( shmPool )
+   {
+      wl_shm_pool_destroy( shmPool);
+   }
+
+   if ( ctx->shm )
+   {
+      wl_shm_destroy( ctx->shm );
+      ctx->shm= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   if ( data )
+   {
+      munmap( data, imgDataSize );
+   }
+
+   if ( imgData )
+   {
+      free( imgData );
+   }
+
+   if ( fd != -1 )
+   {
+      close( fd );
+      remove( filename );
+   }
+
+   if ( wctx )
+   {
+      WstCompositorDestroy( wctx );
+   }
+
+   return testResult;
+}
+
+bool testCaseRenderShmDamage( EMCTX *emctx )
+{
+   using namespace RenderTests;
+
+   bool testResult= false;
+   bool result;
+   const char *displayName= "display0";
+   WstCompositor *wctx= 0;
+   struct wl_display *display= 0;
+   struct wl_registry *registry= 0;
+   TestCtx testCtx;
+   TestCtx *ctx= &testCtx;
+   int imgWidth, imgHeight;
+   int imgDataSize;
+   char filename[32];
+   int fd= -1;
+   void *data= 0;
+   struct wl_shm_pool *shmPool= 0;
+   struct wl_buffer *buffer= 0;
+
+   EMStart( emctx );
+
+   memset( &testCtx, 0, sizeof(TestCtx) );
+
+   wctx= WstCompositorCreate();
+   if ( !wctx )
+   {
+      EMERROR( "WstCompositorCreate failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetDisplayName( wctx, displayName );
+   if ( !result )
+   {
+      EMERROR( "WstCompositorSetDisplayName failed" );
+      goto exit;
+   }
+
+   result= WstCompositorSetRendererModule( wctx, "libwesteros_render_gl.so.0.0.0" );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorSetRendererModule failed" );
+      goto exit;
+   }
+
+   result= WstCompositorStart( wctx );
+   if ( result == false )
+   {
+      EMERROR( "WstCompositorStart failed" );
+      goto exit;
+   }
+
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+   EMSetTextureUpdatedCallback( emctx, textureUpdated, ctx );
+
+   display= wl_display_connect(displayName);
+   if ( !display )
+   {
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
+   }
+   ctx->display= display;
+
+   registry= wl_display_get_registry(display);
+   if ( !registry )
+   {
+      EMERROR( "wl_display_get_registrty failed" );
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor || !ctx->shm )
+   {
+      EMERROR("Failed to acquire needed compositor items");
+      goto exit;
+   }
+
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   if ( !ctx->surface )
+   {
+      EMERROR("error: unable to create wayland surface");
+      goto exit;
+   }
+
+   wl_display_roundtrip(display);
+
+   imgWidth= 32;
+   imgHeight= 32;
+   imgDataSize= imgWidth*imgHeight*4;
+
+   strcpy( filename, "/tmp/westeros-XXXXXX" );
+   fd= mkostemp( filename, O_CLOEXEC );
+   if ( fd < 0 )
+   {
+      EMERROR("Unable to create temp file");
+      goto exit;
+   }
 
-      callbackCount= ctx->textureCallbackCount;
+   if ( ftruncate( fd, imgDataSize ) < 0 )
+   {
+      EMERROR("Unable to size temp file");
+      goto exit;
+   }
 
-      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   data= mmap(NULL, imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if ( data == MAP_FAILED )
+   {
+      data= 0;
+      EMERROR("Unable to mmap image data");
+      goto exit;
    }
 
-   master= WstCompositorGetMasterEmbedded();
-   if ( !master )
+   memset( data, 0, imgDataSize );
+
+   shmPool= wl_shm_create_pool(ctx->shm, fd, imgDataSize);
+   if ( shmPool == 0 )
    {
-      EMERROR("WstCompositorGetMasterEmbedded failed");
+      EMERROR("Unable to create shm pool");
       goto exit;
    }
+   wl_display_roundtrip(display);
 
-   if ( clientLaunchThreadId1 && csctx1.clientPid )
+   buffer= wl_shm_pool_create_buffer(shmPool,
+                                     0, //offset
+                                     imgWidth,
+                                     imgHeight,
+                                     imgWidth*4, //stride
+                                     WL_SHM_FORMAT_ARGB8888 );
+   wl_display_roundtrip(display);
+   if ( !buffer )
    {
-      kill( csctx1.clientPid, 6 );
-      pthread_join( clientLaunchThreadId1, NULL );
-      clientLaunchThreadId1= 0;
+      EMERROR("Unable to create shm buffer");
+      goto exit;
    }
-   if ( clientLaunchThreadId2 && csctx2.clientPid )
+
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
+
+   usleep( 34000 );
+
+   if ( ctx->lastTextureBufferId != ((imgWidth<<16)|imgHeight) )
    {
-      kill( csctx2.clientPid, 6 );
-      pthread_join( clientLaunchThreadId2, NULL );
-      clientLaunchThreadId2= 0;
+      EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d)", ((imgWidth<<16)|imgHeight), ctx->lastTextureBufferId );
+      goto exit;
    }
 
-   WstCompositorDestroy( virt1 );
-   WstCompositorDestroy( virt2 );
-   WstCompositorDestroy( master );
+   // Change a band of rows and post only that as damage
+   memset( ((unsigned char*)data)+8*imgWidth*4, 0xFF, 4*imgWidth*4 );
 
-   retryCount= 0;
-   while( !csctx1.disconnected || !csctx2.disconnected )
+   ctx->textureCallbackCount= 0;
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 8, imgWidth, 4);
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
+
+   usleep( 34000 );
+
+   if ( ctx->textureCallbackCount != 0 )
    {
-      usleep( 300000 );
-      ++retryCount;
-      if ( retryCount > 50 )
-      {
-         EMERROR("Client failed to disconnect");
-         goto exit;
-      }
+      EMERROR("Unexpected full texture upload for partial damage");
+      goto exit;
    }
 
-   retryCount= 0;
-   while( !(csctx1.stoppedNormal || csctx1.stoppedAbnormal) ||
-          !(csctx2.stoppedNormal || csctx2.stoppedAbnormal) )
+   if ( ctx->textureUpdateCount < 1 )
    {
-      usleep( 300000 );
-      ++retryCount;
-      if ( retryCount > 50 )
-      {
-         EMERROR("Client failed to stop");
-         goto exit;
-      }
+      EMERROR("Expected partial texture update");
+      goto exit;
+   }
+
+   if ( (ctx->lastTextureUpdateY != 8) || (ctx->lastTextureUpdateHeight != 4) )
+   {
+      EMERROR("Unexpected texture update rows: expected(8,4) actual(%d,%d)", ctx->lastTextureUpdateY, ctx->lastTextureUpdateHeight );
+      goto exit;
    }
 
    testResult= true;
 
 exit:
 
-   if ( ctx->eglCtxS.eglSurfaceWindow )
+   EMSetTextureUpdatedCallback( emctx, 0, 0 );
+
+   if ( buffer )
    {
-      eglDestroySurface( ctx->eglCtxS.eglDisplay, ctx->eglCtxS.eglSurfaceWindow );
-      ctx->eglCtxS.eglSurfaceWindow= EGL_NO_SURFACE;
+      wl_buffer_destroy( buffer );
    }
 
-   if ( ctx->eglNativeWindow )
+   if ( ctx->surface )
    {
-      WstGLDestroyNativeWindow( ctx->glCtx, ctx->eglNativeWindow );
-      ctx->eglNativeWindow= 0;
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
    }
 
-   if ( ctx->glCtx )
+   if ( shmPool )
    {
-      WstGLTerm( ctx->glCtx );
-      ctx->glCtx= 0;
+      wl_shm_pool_destroy( shmPool);
    }
 
-   testTermEGL( &ctx->eglCtxS );
+   if ( ctx->shm )
+   {
+      wl_shm_destroy( ctx->shm );
+      ctx->shm= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
+   if ( display )
+   {
+      wl_display_roundtrip(display);
+      wl_display_disconnect(display);
+      display= 0;
+   }
+
+   if ( data )
+   {
+      munmap( data, imgDataSize );
+   }
+
+   if ( fd != -1 )
+   {
+      close( fd );
+      remove( filename );
+   }
+
+   if ( wctx )
+   {
+      WstCompositorDestroy( wctx );
+   }
 
    return testResult;
 }
 
-bool testCaseRenderBasicCompositionNested( EMCTX *emctx )
+static bool testShmEarlyRelease( EMCTX *emctx, bool useRenderThread )
 {
    using namespace RenderTests;
 
    bool testResult= false;
    bool result;
+   const char *displayName= "display0";
    WstCompositor *wctx= 0;
-   WstCompositor *wctxNested= 0;
-   const char *displayName= "test0";
-   const char *displayNameNested= "nested0";
    struct wl_display *display= 0;
    struct wl_registry *registry= 0;
    TestCtx testCtx;
    TestCtx *ctx= &testCtx;
-   EGLBoolean b;
-   int bufferIdBase= 500;
-   int bufferIdCount= 3;
-   int expectedBufferId= 1;
+   int imgWidth, imgHeight;
+   int imgDataSize;
+   char filename[32];
+   int fd= -1;
+   void *data= 0;
+   struct wl_shm_pool *shmPool= 0;
+   struct wl_buffer *buffer= 0;
 
    EMStart( emctx );
 
@@ -944,7 +2695,7 @@ bool testCaseRenderBasicCompositionNested( EMCTX *emctx )
    }
 
    result= WstCompositorSetDisplayName( wctx, displayName );
-   if ( result == false )
+   if ( !result )
    {
       EMERROR( "WstCompositorSetDisplayName failed" );
       goto exit;
@@ -957,165 +2708,184 @@ bool testCaseRenderBasicCompositionNested( EMCTX *emctx )
       goto exit;
    }
 
-   result= WstCompositorStart( wctx );
+   result= WstCompositorSetUseRenderThread( wctx, useRenderThread );
    if ( result == false )
    {
-      EMERROR( "WstCompositorStart failed" );
+      EMERROR( "WstCompositorSetUseRenderThread failed" );
       goto exit;
    }
 
-
-   wctxNested= WstCompositorCreate();
-   if ( !wctxNested )
+   result= WstCompositorStart( wctx );
+   if ( result == false )
    {
-      EMERROR( "WstCompositorCreate failed" );
+      EMERROR( "WstCompositorStart failed" );
       goto exit;
    }
 
-   result= WstCompositorSetDisplayName( wctxNested, displayNameNested );
-   if ( result == false )
+   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
+   EMSetTextureUpdatedCallback( emctx, textureUpdated, ctx );
+
+   display= wl_display_connect(displayName);
+   if ( !display )
    {
-      EMERROR( "WstCompositorSetDisplayName failed" );
+      EMERROR( "wl_display_connect failed" );
       goto exit;
    }
+   ctx->display= display;
 
-   result= WstCompositorSetRendererModule( wctxNested, "libwesteros_render_gl.so.0.0.0" );
-   if ( result == false )
+   registry= wl_display_get_registry(display);
+   if ( !registry )
    {
-      EMERROR( "WstCompositorSetRendererModule failed" );
+      EMERROR( "wl_display_get_registrty failed" );
       goto exit;
    }
 
-   result= WstCompositorSetIsNested( wctxNested, true );
-   if ( result == false )
+   wl_registry_add_listener(registry, &registryListener, ctx);
+
+   wl_display_roundtrip(display);
+
+   if ( !ctx->compositor || !ctx->shm )
    {
-      EMERROR( "WstCompositorSetIsNested failed" );
+      EMERROR("Failed to acquire needed compositor items");
       goto exit;
    }
 
-   result= WstCompositorSetNestedDisplayName( wctxNested, displayName );
-   if ( result == false )
+   ctx->surface= wl_compositor_create_surface(ctx->compositor);
+   if ( !ctx->surface )
    {
-      EMERROR( "WstCompositorSetDisplayName failed" );
+      EMERROR("error: unable to create wayland surface");
       goto exit;
    }
 
-   result= WstCompositorStart( wctxNested );
-   if ( result == false )
+   wl_display_roundtrip(display);
+
+   imgWidth= 32;
+   imgHeight= 32;
+   imgDataSize= imgWidth*imgHeight*4;
+
+   strcpy( filename, "/tmp/westeros-XXXXXX" );
+   fd= mkostemp( filename, O_CLOEXEC );
+   if ( fd < 0 )
    {
-      EMERROR( "WstCompositorStart failed" );
+      EMERROR("Unable to create temp file");
       goto exit;
    }
 
-   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
-
-   display= wl_display_connect(displayNameNested);
-   if ( !display )
+   if ( ftruncate( fd, imgDataSize ) < 0 )
    {
-      EMERROR( "wl_display_connect failed" );
+      EMERROR("Unable to size temp file");
       goto exit;
    }
-   ctx->display= display;
 
-   registry= wl_display_get_registry(display);
-   if ( !registry )
+   data= mmap(NULL, imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if ( data == MAP_FAILED )
    {
-      EMERROR( "wl_display_get_registrty failed" );
+      data= 0;
+      EMERROR("Unable to mmap image data");
       goto exit;
    }
 
-   wl_registry_add_listener(registry, &registryListener, ctx);
-
-   wl_display_roundtrip(display);
+   memset( data, 0, imgDataSize );
 
-   if ( !ctx->compositor )
+   shmPool= wl_shm_create_pool(ctx->shm, fd, imgDataSize);
+   if ( shmPool == 0 )
    {
-      EMERROR("Failed to acquire needed compositor items");
+      EMERROR("Unable to create shm pool");
       goto exit;
    }
+   wl_display_roundtrip(display);
 
-   result= testSetupEGL( &ctx->eglCtx, display );
-   if ( !result )
+   buffer= wl_shm_pool_create_buffer(shmPool,
+                                     0, //offset
+                                     imgWidth,
+                                     imgHeight,
+                                     imgWidth*4, //stride
+                                     WL_SHM_FORMAT_ARGB8888 );
+   wl_display_roundtrip(display);
+   if ( !buffer )
    {
-      EMERROR("testSetupEGL failed for client");
+      EMERROR("Unable to create shm buffer");
       goto exit;
    }
 
-   ctx->surface= wl_compositor_create_surface(ctx->compositor);
-   printf("surface=%p\n", ctx->surface);   
-   if ( !ctx->surface )
+   wl_buffer_add_listener( buffer, &bufferListener, ctx );
+
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
+
+   usleep( 34000 );
+
+   wl_display_roundtrip(display);
+
+   if ( ctx->lastTextureBufferId != ((imgWidth<<16)|imgHeight) )
    {
-      EMERROR("error: unable to create wayland surface");
+      EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d)", ((imgWidth<<16)|imgHeight), ctx->lastTextureBufferId );
       goto exit;
    }
 
-   ctx->windowWidth= WINDOW_WIDTH;
-   ctx->windowHeight= WINDOW_HEIGHT;
-   
-   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
-   if ( !ctx->wlEglWindow )
+   // The content was taken at commit, or when the render thread latched the
+   // commit, so the buffer is released without another attach
+   if ( ctx->bufferReleaseCount != 1 )
    {
-      EMERROR("error: unable to create wl_egl_window");
+      EMERROR("Unexpected buffer release count: expected(1) actual(%d)", ctx->bufferReleaseCount );
       goto exit;
    }
-   printf("wl_egl_window %p\n", ctx->wlEglWindow);
 
-   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
+   // A commit without a fresh attach must keep the content of the released buffer
+   ctx->textureCallbackCount= 0;
+   ctx->textureUpdateCount= 0;
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
 
-   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
-                                                  ctx->eglCtx.eglConfig,
-                                                  (EGLNativeWindowType)ctx->wlEglWindow,
-                                                  NULL );
-   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+   usleep( 34000 );
 
-   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
-   if ( !b )
+   if ( (ctx->textureCallbackCount != 0) || (ctx->textureUpdateCount != 0) )
    {
-      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      EMERROR("Unexpected texture upload for commit without attach");
       goto exit;
    }
 
-   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
-
-   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   // The client may now reuse the buffer for its next frame
+   memset( ((unsigned char*)data)+8*imgWidth*4, 0xFF, 4*imgWidth*4 );
 
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 8, imgWidth, 4);
+   wl_surface_commit( ctx->surface );
    wl_display_roundtrip(display);
 
-   for( int i= 0; i < 20; ++i )
-   {
-      usleep( 17000 );
+   usleep( 34000 );
 
-      if ( ctx->lastTextureBufferId != expectedBufferId )
-      {
-         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
-         goto exit;
-      }
+   wl_display_roundtrip(display);
 
-      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   if ( ctx->textureCallbackCount != 0 )
+   {
+      EMERROR("Unexpected full texture upload for partial damage");
+      goto exit;
+   }
 
-      expectedBufferId += 1;
-      if ( expectedBufferId >= bufferIdCount+1 )
-      {
-         expectedBufferId= 1;
-      }
+   if ( (ctx->lastTextureUpdateY != 8) || (ctx->lastTextureUpdateHeight != 4) )
+   {
+      EMERROR("Unexpected texture update rows: expected(8,4) actual(%d,%d)", ctx->lastTextureUpdateY, ctx->lastTextureUpdateHeight );
+      goto exit;
+   }
 
-      wl_display_dispatch( display );
+   if ( ctx->bufferReleaseCount != 2 )
+   {
+      EMERROR("Unexpected buffer release count: expected(2) actual(%d)", ctx->bufferReleaseCount );
+      goto exit;
    }
 
    testResult= true;
 
 exit:
 
-   if ( ctx->eglCtx.eglSurfaceWindow )
-   {
-      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
-      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
-   }
+   EMSetTextureUpdatedCallback( emctx, 0, 0 );
 
-   if ( ctx->wlEglWindow )
+   if ( buffer )
    {
-      wl_egl_window_destroy( ctx->wlEglWindow );
-      ctx->wlEglWindow= 0;
+      wl_buffer_destroy( buffer );
    }
 
    if ( ctx->surface )
@@ -1124,12 +2894,15 @@ exit:
       ctx->surface= 0;
    }
 
-   testTermEGL( &ctx->eglCtx );
+   if ( shmPool )
+   {
+      wl_shm_pool_destroy( shmPool);
+   }
 
-   if ( ctx->compositor )
+   if ( ctx->shm )
    {
-      wl_compositor_destroy( ctx->compositor );
-      ctx->compositor= 0;
+      wl_shm_destroy( ctx->shm );
+      ctx->shm= 0;
    }
 
    if ( registry )
@@ -1138,6 +2911,12 @@ exit:
       registry= 0;
    }
 
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
    if ( display )
    {
       wl_display_roundtrip(display);
@@ -1145,43 +2924,62 @@ exit:
       display= 0;
    }
 
-   WstCompositorDestroy( wctxNested );
+   if ( data )
+   {
+      munmap( data, imgDataSize );
+   }
 
-   WstCompositorDestroy( wctx );
+   if ( fd != -1 )
+   {
+      close( fd );
+      remove( filename );
+   }
+
+   if ( wctx )
+   {
+      WstCompositorDestroy( wctx );
+   }
 
    return testResult;
 }
 
-bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx )
+bool testCaseRenderShmEarlyRelease( EMCTX *emctx )
+{
+   return testShmEarlyRelease( emctx, false );
+}
+
+bool testCaseRenderShmEarlyReleaseRenderThread( EMCTX *emctx )
+{
+   return testShmEarlyRelease( emctx, true );
+}
+
+bool testCaseRenderPresentationFeedback( EMCTX *emctx )
 {
    using namespace RenderTests;
 
    bool testResult= false;
    bool result;
+   const char *displayName= "display0";
    WstCompositor *wctx= 0;
-   WstCompositor *wctxRepeater= 0;
-   const char *displayName= "test0";
-   const char *displayNameNested= "nested0";
    struct wl_display *display= 0;
    struct wl_registry *registry= 0;
    TestCtx testCtx;
    TestCtx *ctx= &testCtx;
-   EGLBoolean b;
-   int bufferIdBase= 500;
-   int bufferIdCount= 3;
-   int expectedBufferId;
+   int imgWidth, imgHeight;
+   int imgDataSize;
+   char filename[32];
+   int fd= -1;
+   void *data= 0;
+   struct wl_shm_pool *shmPool= 0;
+   struct wl_buffer *buffer= 0;
+   struct wp_presentation_feedback *feedback;
+   struct timespec tm;
+   long long now;
 
    EMStart( emctx );
 
    memset( &testCtx, 0, sizeof(TestCtx) );
 
-   if ( !checkForRepeatingSupport() )
-   {
-      // If we cannot repeat, expect default buffer id range
-      bufferIdBase= 1;
-   }
-   expectedBufferId= bufferIdBase;
-
    wctx= WstCompositorCreate();
    if ( !wctx )
    {
@@ -1190,7 +2988,7 @@ bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx )
    }
 
    result= WstCompositorSetDisplayName( wctx, displayName );
-   if ( result == false )
+   if ( !result )
    {
       EMERROR( "WstCompositorSetDisplayName failed" );
       goto exit;
@@ -1210,45 +3008,7 @@ bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx )
       goto exit;
    }
 
-
-   wctxRepeater= WstCompositorCreate();
-   if ( !wctxRepeater )
-   {
-      EMERROR( "WstCompositorCreate failed" );
-      goto exit;
-   }
-
-   result= WstCompositorSetDisplayName( wctxRepeater, displayNameNested );
-   if ( result == false )
-   {
-      EMERROR( "WstCompositorSetDisplayName failed" );
-      goto exit;
-   }
-
-   result= WstCompositorSetIsRepeater( wctxRepeater, true );
-   if ( result == false )
-   {
-      EMERROR( "WstCompositorSetIsNested failed" );
-      goto exit;
-   }
-
-   result= WstCompositorSetNestedDisplayName( wctxRepeater, displayName );
-   if ( result == false )
-   {
-      EMERROR( "WstCompositorSetDisplayName failed" );
-      goto exit;
-   }
-
-   result= WstCompositorStart( wctxRepeater );
-   if ( result == false )
-   {
-      EMERROR( "WstCompositorStart failed" );
-      goto exit;
-   }
-
-   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
-
-   display= wl_display_connect(displayNameNested);
+   display= wl_display_connect(displayName);
    if ( !display )
    {
       EMERROR( "wl_display_connect failed" );
@@ -1265,110 +3025,159 @@ bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx )
 
    wl_registry_add_listener(registry, &registryListener, ctx);
 
+   wl_display_roundtrip(display);
    wl_display_roundtrip(display);
 
-   if ( !ctx->compositor )
+   if ( !ctx->compositor || !ctx->shm || !ctx->presentation )
    {
       EMERROR("Failed to acquire needed compositor items");
       goto exit;
    }
 
-   result= testSetupEGL( &ctx->eglCtx, display );
-   if ( !result )
+   if ( ctx->presentationClockId != CLOCK_MONOTONIC )
    {
-      EMERROR("testSetupEGL failed for client");
+      EMERROR("Unexpected presentation clock: expected(%d) actual(%d)", CLOCK_MONOTONIC, ctx->presentationClockId );
       goto exit;
    }
 
    ctx->surface= wl_compositor_create_surface(ctx->compositor);
-   printf("surface=%p\n", ctx->surface);   
    if ( !ctx->surface )
    {
       EMERROR("error: unable to create wayland surface");
       goto exit;
    }
 
-   ctx->windowWidth= WINDOW_WIDTH;
-   ctx->windowHeight= WINDOW_HEIGHT;
-   
-   ctx->wlEglWindow= wl_egl_window_create(ctx->surface, ctx->windowWidth, ctx->windowHeight);
-   if ( !ctx->wlEglWindow )
+   wl_display_roundtrip(display);
+
+   imgWidth= 32;
+   imgHeight= 32;
+   imgDataSize= imgWidth*imgHeight*4;
+
+   strcpy( filename, "/tmp/westeros-XXXXXX" );
+   fd= mkostemp( filename, O_CLOEXEC );
+   if ( fd < 0 )
    {
-      EMERROR("error: unable to create wl_egl_window");
+      EMERROR("Unable to create temp file");
       goto exit;
    }
-   printf("wl_egl_window %p\n", ctx->wlEglWindow);
 
-   EMWLEGLWindowSetBufferRange( ctx->wlEglWindow, bufferIdBase, bufferIdCount );
+   if ( ftruncate( fd, imgDataSize ) < 0 )
+   {
+      EMERROR("Unable to size temp file");
+      goto exit;
+   }
 
-   ctx->eglCtx.eglSurfaceWindow= eglCreateWindowSurface( ctx->eglCtx.eglDisplay,
-                                                  ctx->eglCtx.eglConfig,
-                                                  (EGLNativeWindowType)ctx->wlEglWindow,
-                                                  NULL );
-   printf("eglCreateWindowSurface: eglSurfaceWindow %p\n", ctx->eglCtx.eglSurfaceWindow );
+   data= mmap(NULL, imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if ( data == MAP_FAILED )
+   {
+      data= 0;
+      EMERROR("Unable to mmap image data");
+      goto exit;
+   }
 
-   b= eglMakeCurrent( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglSurfaceWindow, ctx->eglCtx.eglContext );
-   if ( !b )
+   memset( data, 0, imgDataSize );
+
+   shmPool= wl_shm_create_pool(ctx->shm, fd, imgDataSize);
+   if ( shmPool == 0 )
    {
-      EMERROR("error: eglMakeCurrent failed: %X", eglGetError() );
+      EMERROR("Unable to create shm pool");
       goto exit;
    }
+   wl_display_roundtrip(display);
 
-   eglSwapInterval( ctx->eglCtx.eglDisplay, 1 );
+   buffer= wl_shm_pool_create_buffer(shmPool,
+                                     0, //offset
+                                     imgWidth,
+                                     imgHeight,
+                                     imgWidth*4, //stride
+                                     WL_SHM_FORMAT_ARGB8888 );
+   wl_display_roundtrip(display);
+   if ( !buffer )
+   {
+      EMERROR("Unable to create shm buffer");
+      goto exit;
+   }
 
-   eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   // The first content update is superseded by the second before it can be composed
+   feedback= wp_presentation_feedback( ctx->presentation, ctx->surface );
+   wp_presentation_feedback_add_listener( feedback, &feedbackListener, ctx );
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
 
+   feedback= wp_presentation_feedback( ctx->presentation, ctx->surface );
+   wp_presentation_feedback_add_listener( feedback, &feedbackListener, ctx );
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
    wl_display_roundtrip(display);
 
    for( int i= 0; i < 20; ++i )
    {
       usleep( 17000 );
-
-      if ( ctx->lastTextureBufferId != expectedBufferId )
+      wl_display_roundtrip(display);
+      if ( ctx->presentedCount )
       {
-         EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d) iteration %d", expectedBufferId, ctx->lastTextureBufferId, i );
-         goto exit;
+         break;
       }
+   }
 
-      eglSwapBuffers(ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow);
+   if ( ctx->discardedCount != 1 )
+   {
+      EMERROR("Unexpected discarded count: expected(1) actual(%d)", ctx->discardedCount );
+      goto exit;
+   }
 
-      expectedBufferId += 1;
-      if ( expectedBufferId >= bufferIdBase+bufferIdCount )
-      {
-         expectedBufferId= bufferIdBase;
-      }
+   if ( ctx->presentedCount != 1 )
+   {
+      EMERROR("Unexpected presented count: expected(1) actual(%d)", ctx->presentedCount );
+      goto exit;
+   }
 
-      wl_display_dispatch( display );
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+   now= tm.tv_sec*1000000LL+(tm.tv_nsec/1000LL);
+   if ( (ctx->lastPresentedTime > now) || (ctx->lastPresentedTime < now-1000000LL) )
+   {
+      EMERROR("Unexpected presentation time: %lld now %lld", ctx->lastPresentedTime, now );
+      goto exit;
+   }
+
+   if ( ctx->lastPresentedFlags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY )
+   {
+      EMERROR("Unexpected zero copy presentation flag");
+      goto exit;
    }
 
    testResult= true;
 
 exit:
 
-   if ( ctx->eglCtx.eglSurfaceWindow )
+   if ( buffer )
    {
-      eglDestroySurface( ctx->eglCtx.eglDisplay, ctx->eglCtx.eglSurfaceWindow );
-      ctx->eglCtx.eglSurfaceWindow= EGL_NO_SURFACE;
+      wl_buffer_destroy( buffer );
    }
 
-   if ( ctx->wlEglWindow )
+   if ( ctx->surface )
    {
-      wl_egl_window_destroy( ctx->wlEglWindow );
-      ctx->wlEglWindow= 0;
+      wl_surface_destroy( ctx->surface );
+      ctx->surface= 0;
+   }
+
+   if ( shmPool )
+   {
+      wl_shm_pool_destroy( shmPool);
    }
 
-   if ( ctx->surface )
+   if ( ctx->presentation )
    {
-      wl_surface_destroy( ctx->surface );
-      ctx->surface= 0;
+      wp_presentation_destroy( ctx->presentation );
+      ctx->presentation= 0;
    }
 
-   testTermEGL( &ctx->eglCtx );
-
-   if ( ctx->compositor )
+   if ( ctx->shm )
    {
-      wl_compositor_destroy( ctx->compositor );
-      ctx->compositor= 0;
+      wl_shm_destroy( ctx->shm );
+      ctx->shm= 0;
    }
 
    if ( registry )
@@ -1377,6 +3186,12 @@ exit:
       registry= 0;
    }
 
+   if ( ctx->compositor )
+   {
+      wl_compositor_destroy( ctx->compositor );
+      ctx->compositor= 0;
+   }
+
    if ( display )
    {
       wl_display_roundtrip(display);
@@ -1384,52 +3199,53 @@ exit:
       display= 0;
    }
 
-   WstCompositorDestroy( wctxRepeater );
-
-   WstCompositorDestroy( wctx );
+   if ( data )
+   {
+      munmap( data, imgDataSize );
+   }
 
-   return testResult;
-}
+   if ( fd != -1 )
+   {
+      close( fd );
+      remove( filename );
+   }
 
-static void terminatedCallback( WstCompositor *ctx, void *userData )
-{
-   bool *terminated= (bool*)userData;
+   if ( wctx )
+   {
+      WstCompositorDestroy( wctx );
+   }
 
-   *terminated= true;
+   return testResult;
 }
 
-bool testCaseRenderShmRepeater( EMCTX *emctx )
+bool testCaseRenderOpaqueOcclusion( EMCTX *emctx )
 {
    using namespace RenderTests;
 
    bool testResult= false;
    bool result;
    const char *displayName= "display0";
-   const char *displayName2= "display1";
    WstCompositor *wctx= 0;
    struct wl_display *display= 0;
    struct wl_registry *registry= 0;
-   bool repeatingSupported;
    TestCtx testCtx;
    TestCtx *ctx= &testCtx;
-   unsigned char *imgData= 0;
    int imgWidth, imgHeight;
    int imgDataSize;
    char filename[32];
    int fd= -1;
-   int lenDidWrite;
    void *data= 0;
    struct wl_shm_pool *shmPool= 0;
    struct wl_buffer *buffer= 0;
-   int expectedBufferId;
-   int pid;
+   struct wl_buffer *bufferTop= 0;
+   struct wl_surface *surfaceTop= 0;
+   struct wl_region *region= 0;
+   struct wp_presentation_feedback *feedback;
 
    EMStart( emctx );
 
    memset( &testCtx, 0, sizeof(TestCtx) );
 
-   repeatingSupported= checkForRepeatingSupport();
-
    wctx= WstCompositorCreate();
    if ( !wctx )
    {
@@ -1440,7 +3256,7 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
    result= WstCompositorSetDisplayName( wctx, displayName );
    if ( !result )
    {
-      EMERROR( "WstCompositorSetIsNested failed" );
+      EMERROR( "WstCompositorSetDisplayName failed" );
       goto exit;
    }
 
@@ -1458,111 +3274,11 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
       goto exit;
    }
 
-   pid= fork();
-   if ( pid == 0 )
-   {
-      EMCTX *emctx2= 0;
-      WstCompositor *wctx2= 0;
-      bool terminated= false;
-
-      emctx2= EMCreateContext();
-      if ( !emctx2 )
-      {
-         goto repeater_exit;
-      }
-
-      wctx2= WstCompositorCreate();
-      if ( !wctx2 )
-      {
-         EMERROR( "WstCompositorCreate failed" );
-         goto repeater_exit;
-      }
-
-      result= WstCompositorSetDisplayName( wctx2, displayName2 );
-      if ( !result )
-      {
-         EMERROR( "WstCompositorSetDisplayName failed" );
-         goto repeater_exit;
-      }
-
-      result= WstCompositorSetIsRepeater( wctx2, true );
-      if ( !result )
-      {
-         EMERROR( "WstCompositorSetIsRepeater failed" );
-         goto repeater_exit;
-      }
-
-      result= WstCompositorSetNestedDisplayName( wctx2, displayName );
-      if ( !result )
-      {
-         EMERROR( "WstCompositorSetNestedDisplayName failed" );
-         goto repeater_exit;
-      }
-
-      result= WstCompositorSetTerminatedCallback( wctx2, terminatedCallback, &terminated );
-      if ( result == false )
-      {
-         EMERROR( "WstCompositorSetTerminatedCallback failed" );
-         goto repeater_exit;
-      }
-
-      result= WstCompositorStart( wctx2 );
-      if ( result == false )
-      {
-         EMERROR( "WstCompositorStart failed" );
-         goto repeater_exit;
-      }
-
-      while( !terminated )
-      {
-         usleep( 10000 );
-      }
-      printf("repeater ending\n");
-
-   repeater_exit:
-      if ( wctx2 )
-      {
-         WstCompositorDestroy( wctx2 );
-      }
-      if ( emctx2 )
-      {
-         EMDestroyContext( emctx2 );
-      }
-      printf("repeater ended\n");
-      exit(0);
-   }
-   else if ( pid == -1 )
-   {
-      EMERROR( "Failed to fork to start repeater" );
-      goto exit;
-   }
-   else
-   {
-      // wait for repeater to start
-      usleep( 100000 );
-   }
-
-   EMSetTextureCreatedCallback( emctx, textureCreated, ctx );
-
-   display= wl_display_connect(displayName2);
+   display= wl_display_connect(displayName);
    if ( !display )
    {
-      int retries= 10;
-
-      while( retries-- > 0 )
-      {
-         display= wl_display_connect(displayName2);
-         if ( display )
-         {
-            break;
-         }
-         usleep( 100000 );
-      }
-      if ( !display )
-      {
-         EMERROR( "wl_display_connect failed" );
-         goto exit;
-      }
+      EMERROR( "wl_display_connect failed" );
+      goto exit;
    }
    ctx->display= display;
 
@@ -1575,17 +3291,19 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
 
    wl_registry_add_listener(registry, &registryListener, ctx);
 
+   wl_display_roundtrip(display);
    wl_display_roundtrip(display);
 
-   if ( !ctx->compositor || !ctx->shm )
+   if ( !ctx->compositor || !ctx->shm || !ctx->presentation )
    {
       EMERROR("Failed to acquire needed compositor items");
       goto exit;
    }
 
+   // Surfaces of equal z-order are stacked in creation order
    ctx->surface= wl_compositor_create_surface(ctx->compositor);
-   printf("surface=%p\n", ctx->surface);
-   if ( !ctx->surface )
+   surfaceTop= wl_compositor_create_surface(ctx->compositor);
+   if ( !ctx->surface || !surfaceTop )
    {
       EMERROR("error: unable to create wayland surface");
       goto exit;
@@ -1597,13 +3315,6 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
    imgHeight= 32;
    imgDataSize= imgWidth*imgHeight*4;
 
-   imgData= (unsigned char*)calloc( 1, imgDataSize );
-   if ( !imgData )
-   {
-      EMERROR("No memory for image data");
-      goto exit;
-   }
-
    strcpy( filename, "/tmp/westeros-XXXXXX" );
    fd= mkostemp( filename, O_CLOEXEC );
    if ( fd < 0 )
@@ -1612,23 +3323,23 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
       goto exit;
    }
 
-   lenDidWrite= write( fd, imgData, imgDataSize );
-   if ( lenDidWrite != imgDataSize )
+   if ( ftruncate( fd, 2*imgDataSize ) < 0 )
    {
-      EMERROR("Unable to write image data to temp file");
+      EMERROR("Unable to size temp file");
       goto exit;
    }
 
-   data= mmap(NULL, imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   data= mmap(NULL, 2*imgDataSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
    if ( data == MAP_FAILED )
    {
+      data= 0;
       EMERROR("Unable to mmap image data");
       goto exit;
    }
 
-   memcpy( data, imgData, imgDataSize );
+   memset( data, 0, 2*imgDataSize );
 
-   shmPool= wl_shm_create_pool(ctx->shm, fd, imgDataSize);
+   shmPool= wl_shm_create_pool(ctx->shm, fd, 2*imgDataSize);
    if ( shmPool == 0 )
    {
       EMERROR("Unable to create shm pool");
@@ -1642,33 +3353,144 @@ bool testCaseRenderShmRepeater( EMCTX *emctx )
                                      imgHeight,
                                      imgWidth*4, //stride
                                      WL_SHM_FORMAT_ARGB8888 );
+   bufferTop= wl_shm_pool_create_buffer(shmPool,
+                                        imgDataSize, //offset
+                                        imgWidth,
+                                        imgHeight,
+                                        imgWidth*4, //stride
+                                        WL_SHM_FORMAT_ARGB8888 );
    wl_display_roundtrip(display);
-   if ( !buffer )
+   if ( !buffer || !bufferTop )
    {
       EMERROR("Unable to create shm buffer");
       goto exit;
    }
 
-   expectedBufferId= repeatingSupported ? (imgWidth<<16)|imgHeight : 2;
+   // A translucent surface on top leaves the one below it visible
+   feedback= wp_presentation_feedback( ctx->presentation, ctx->surface );
+   wp_presentation_feedback_add_listener( feedback, &feedbackListener, ctx );
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
+
+   wl_surface_attach( surfaceTop, bufferTop, 0, 0 );
+   wl_surface_damage( surfaceTop, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( surfaceTop );
+   wl_display_roundtrip(display);
+
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 17000 );
+      wl_display_roundtrip(display);
+      if ( ctx->presentedCount+ctx->discardedCount )
+      {
+         break;
+      }
+   }
 
+   if ( (ctx->presentedCount != 1) || (ctx->discardedCount != 0) )
+   {
+      EMERROR("Covered surface not presented: presented(%d) discarded(%d)", ctx->presentedCount, ctx->discardedCount );
+      goto exit;
+   }
+
+   // Once the top surface declares itself opaque the surface below is culled
+   region= wl_compositor_create_region(ctx->compositor);
+   if ( !region )
+   {
+      EMERROR("Unable to create region");
+      goto exit;
+   }
+   wl_region_add( region, 0, 0, imgWidth, imgHeight );
+   wl_surface_set_opaque_region( surfaceTop, region );
+   wl_surface_attach( surfaceTop, bufferTop, 0, 0 );
+   wl_surface_damage( surfaceTop, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( surfaceTop );
+   wl_display_roundtrip(display);
+
+   usleep( 34000 );
+   wl_display_roundtrip(display);
+
+   feedback= wp_presentation_feedback( ctx->presentation, ctx->surface );
+   wp_presentation_feedback_add_listener( feedback, &feedbackListener, ctx );
    wl_surface_attach( ctx->surface, buffer, 0, 0 );
    wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
    wl_surface_commit( ctx->surface );
    wl_display_roundtrip(display);
 
-   usleep( 17000 );
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 17000 );
+      wl_display_roundtrip(display);
+      if ( ctx->presentedCount+ctx->discardedCount > 1 )
+      {
+         break;
+      }
+   }
 
-   if ( ctx->lastTextureBufferId != expectedBufferId )
+   if ( (ctx->presentedCount != 1) || (ctx->discardedCount != 1) )
    {
-      EMERROR("Unexpected last texture bufferId: expected(%d) actual(%d)", expectedBufferId, ctx->lastTextureBufferId );
+      EMERROR("Occluded surface not culled: presented(%d) discarded(%d)", ctx->presentedCount, ctx->discardedCount );
       goto exit;
    }
 
+   // Clearing the opaque region makes the lower surface visible again
+   wl_surface_set_opaque_region( surfaceTop, NULL );
+   wl_surface_attach( surfaceTop, bufferTop, 0, 0 );
+   wl_surface_damage( surfaceTop, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( surfaceTop );
+   wl_display_roundtrip(display);
+
+   usleep( 34000 );
+   wl_display_roundtrip(display);
+
+   feedback= wp_presentation_feedback( ctx->presentation, ctx->surface );
+   wp_presentation_feedback_add_listener( feedback, &feedbackListener, ctx );
+   wl_surface_attach( ctx->surface, buffer, 0, 0 );
+   wl_surface_damage( ctx->surface, 0, 0, imgWidth, imgHeight);
+   wl_surface_commit( ctx->surface );
+   wl_display_roundtrip(display);
+
+   for( int i= 0; i < 20; ++i )
+   {
+      usleep( 17000 );
+      wl_display_roundtrip(display);
+      if ( ctx->presentedCount+ctx->discardedCount > 2 )
+      {
+         break;
+      }
+   }
+
+   if ( (ctx->presentedCount != 2) || (ctx->discardedCount != 1) )
+   {
+      EMERROR("Uncovered surface not presented: presented(%d) discarded(%d)", ctx->presentedCount, ctx->discardedCount );
+      goto exit;
+   }
 
    testResult= true;
 
 exit:
 
+   if ( region )
+   {
+      wl_region_destroy( region );
+   }
+
+   if ( bufferTop )
+   {
+      wl_buffer_destroy( bufferTop );
+   }
+
+   if ( buffer )
+   {
+      wl_buffer_destroy( buffer );
+   }
+
+   if ( surfaceTop )
+   {
+      wl_surface_destroy( surfaceTop );
+   }
+
    if ( ctx->surface )
    {
       wl_surface_destroy( ctx->surface );
@@ -1680,6 +3502,12 @@ exit:
       wl_shm_pool_destroy( shmPool);
    }
 
+   if ( ctx->presentation )
+   {
+      wp_presentation_destroy( ctx->presentation );
+      ctx->presentation= 0;
+   }
+
    if ( ctx->shm )
    {
       wl_shm_destroy( ctx->shm );
@@ -1707,12 +3535,7 @@ exit:
 
    if ( data )
    {
-      munmap( data, imgDataSize );
-   }
-
-   if ( imgData )
-   {
-      free( imgData );
+      munmap( data, 2*imgDataSize );
    }
 
    if ( fd != -1 )
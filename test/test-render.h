@@ -22,11 +22,18 @@
 #include "westeros-ut-em.h"
 
 bool testCaseRenderBasicComposition( EMCTX *emctx );
+bool testCaseRenderThreadStalledSwap( EMCTX *emctx );
+bool testCaseRenderFrameCallbackCommit( EMCTX *emctx );
 bool testCaseRenderBasicCompositionEmbedded( EMCTX *emctx );
 bool testCaseRenderBasicCompositionEmbeddedVirtual( EMCTX *emctx );
 bool testCaseRenderBasicCompositionNested( EMCTX *emctx );
 bool testCaseRenderBasicCompositionRepeating( EMCTX *emctx );
 bool testCaseRenderShmRepeater( EMCTX *emctx );
+bool testCaseRenderShmDamage( EMCTX *emctx );
+bool testCaseRenderShmEarlyRelease( EMCTX *emctx );
+bool testCaseRenderShmEarlyReleaseRenderThread( EMCTX *emctx );
+bool testCaseRenderPresentationFeedback( EMCTX *emctx );
+bool testCaseRenderOpaqueOcclusion( EMCTX *emctx );
 bool testCaseRenderWaylandThreading( EMCTX *emctx );
 bool testCaseRenderWaylandThreadingEmbedded( EMCTX *emctx );
 bool testCaseRenderBasicCompositionEmbeddedRepeater( EMCTX *emctx );
@@ -42,8 +42,10 @@ typedef enum _EM_TUNERID
 } EM_TUNERID;
 
 typedef void (*EMTextureCreated)( EMCTX *ctx, void *userData, int bufferId );
+typedef void (*EMTextureUpdated)( EMCTX *ctx, void *userData, int x, int y, int w, int h );
 typedef void (*EMBufferPushed)( EMCTX *ctx, void *userData, int bufferId );
 typedef void (*EMHolePunched)( EMCTX *ctx, void *userData, int x, int y, int w, int h );
+typedef void (*EMDisplaySwap)( EMCTX *ctx, void *userData );
 
 EMCTX* EMCreateContext( void );
 void EMDestroyContext( EMCTX* ctx );
@@ -62,6 +64,21 @@ void EMSetStcChannel( EMCTX *ctx, void *stcChannel );
 void* EMGetStcChannel( EMCTX *ctx );
 void EMSetVideoCodec( EMCTX *ctx, int codec );
 int EMGetVideoCodec( EMCTX *ctx );
+int EMGetDrmFlipEventCount( EMCTX *ctx );
+int EMGetDrmFlipEventHandledCount( EMCTX *ctx );
+int EMGetDrmFlipEventBusyCount( EMCTX *ctx );
+long long EMGetDrmFlipEventMinInterval( EMCTX *ctx );
+void EMResetDrmFlipEventStats( EMCTX *ctx );
+void EMSetDrmRejectScaledVideo( EMCTX *ctx, bool reject );
+int EMGetDrmTestCommitCount( EMCTX *ctx );
+int EMGetDrmTestCommitRejectCount( EMCTX *ctx );
+int EMGetDrmVideoPlaneDisableCount( EMCTX *ctx );
+int EMGetDrmGemCloseErrorCount( EMCTX *ctx );
+bool EMSetDrmModes( EMCTX *ctx, const char *modes );
+int EMGetDrmModeSetCount( EMCTX *ctx );
+int EMGetDrmModeRate( EMCTX *ctx );
+void EMSetDrmVrrCapable( EMCTX *ctx, bool capable );
+bool EMGetDrmVrrEnabled( EMCTX *ctx );
 void EMSetVideoPidChannel( EMCTX *ctx, void *videoPidChannel );
 void* EMGetVideoPidChannel( EMCTX *ctx );
 
@@ -98,8 +115,10 @@ int EMSimpleVideoDecoderGetHdrEotf( EMSimpleVideoDecoder *dec );
 int EMWLEGLWindowGetSwapCount( struct wl_egl_window *w );
 void EMWLEGLWindowSetBufferRange( struct wl_egl_window *w, int base, int count );
 void EMSetTextureCreatedCallback( EMCTX *ctx, EMTextureCreated cb, void *userData );
+void EMSetTextureUpdatedCallback( EMCTX *ctx, EMTextureUpdated cb, void *userData );
 void EMSetBufferPushedCallback( EMCTX *ctx, EMBufferPushed cb, void *userData );
 void EMSetHolePunchedCallback( EMCTX *ctx, EMHolePunched cb, void *userData );
+void EMSetDisplaySwapCallback( EMCTX *ctx, EMDisplaySwap cb, void *userData );
 
 void EMPushGamepadEvent( EMCTX *ctx, int type, int id, int value );
 #endif
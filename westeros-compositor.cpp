@@ -25,12 +25,14 @@
 #include <memory.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <fcntl.h>
@@ -65,6 +67,7 @@
 #include "xdg-shell-server-protocol.h"
 #include "vpc-client-protocol.h"
 #include "vpc-server-protocol.h"
+#include "presentation-time-server-protocol.h"
 
 #include "westeros-version.h"
 
@@ -79,11 +82,16 @@
 #define MAX_NESTED_NAME_LEN (32)
 
 #define DEFAULT_FRAME_RATE (60)
+#define DEFAULT_HIDDEN_FRAME_RATE (1)
 #define DEFAULT_OUTPUT_WIDTH (1280)
 #define DEFAULT_OUTPUT_HEIGHT (720)
 #define DEFAULT_NESTED_WIDTH (1280)
 #define DEFAULT_NESTED_HEIGHT (720)
 
+#define DEFAULT_COMPOSE_BUDGET (4000)
+#define MIN_COMPOSE_BUDGET (1000)
+#define COMPOSE_BUDGET_MARGIN (1000)
+
 #define DEFAULT_KEY_REPEAT_DELAY (1000)
 #define DEFAULT_KEY_REPEAT_RATE  (5)
 
@@ -94,6 +102,7 @@
 #define WESTEROS_UNUSED(x) ((void)(x))
 
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
 
 #define INT_FATAL(FORMAT, ...)      printf("Westeros Fatal: " FORMAT "\n", ##__VA_ARGS__)
 #define INT_ERROR(FORMAT, ...)      printf("Westeros Error: " FORMAT "\n", ##__VA_ARGS__)
@@ -287,6 +296,7 @@ typedef struct _WstRegion
    struct wl_resource *resource;
 
    WstCompositor *compositor;
+   std::vector<WstRect> rects;
 } WstRegion;
 
 typedef struct _WstSurfaceFrameCallback
@@ -295,6 +305,25 @@ typedef struct _WstSurfaceFrameCallback
    struct wl_list link;
 } WstSurfaceFrameCallback;
 
+typedef struct _WstPresentationFeedback
+{
+   struct wl_resource *resource;
+   struct wl_list link;
+   unsigned int frame;
+   long long presentationTime;
+   unsigned int sequence;
+   long long refresh;
+   uint32_t flags;
+} WstPresentationFeedback;
+
+typedef struct _WstBufferRelease
+{
+   struct wl_resource *resource;
+   struct wl_listener destroyListener;
+   unsigned int generation;
+   struct wl_list link;
+} WstBufferRelease;
+
 typedef struct _WstSurface
 {
    struct wl_resource *resource;
@@ -308,6 +337,8 @@ typedef struct _WstSurface
    WstVpcSurface *vpcSurface;
    struct wl_surface *surfaceNested;
    const char *roleName;
+   bool isCursorRole;
+   bool isXdgSurfaceRole;
    
    bool visible;
    int x;
@@ -323,11 +354,36 @@ typedef struct _WstSurface
    
    struct wl_resource *attachedBufferResource;
    struct wl_resource *detachedBufferResource;
+   bool bufferConsumed;
    int attachedX;
    int attachedY;
    bool vpcBridgeSignal;
-   
+   bool damagePending;
+   WstRect damage;
+   bool opaqueRegionPending;
+   std::vector<WstRect> pendingOpaqueRegion;
+   std::vector<WstRect> opaqueRegion;
+   bool inputRegionPending;
+   bool pendingHaveInputRegion;
+   bool haveInputRegion;
+   std::vector<WstRect> pendingInputRegion;
+   std::vector<WstRect> inputRegion;
+
+   // Compositor side copy of the renderer geometry used for hit testing
+   bool geometryStale;
+   WstRect geometry;
+
+   // Scene generations, when using a render thread, in which the last
+   // commit and the buffer it replaced stop being used by the renderer
+   unsigned int commitGeneration;
+   unsigned int detachedGeneration;
+   
+   struct wl_list frameCallbackPendingList;
    struct wl_list frameCallbackList;
+   struct wl_list frameCallbackLink;
+   uint32_t lastFrameCallbackTime;
+   struct wl_list feedbackPendingList;
+   struct wl_list feedbackCommittedList;
    struct wl_listener attachedBufferDestroyListener;
    struct wl_listener detachedBufferDestroyListener;
    
@@ -363,6 +419,25 @@ typedef struct _WstOutput
    
 } WstOutput;
 
+#define WST_HIT_GRID_DIM (16)
+
+typedef struct _WstHitEntry
+{
+   WstSurface *surface;
+   WstRect rect;
+} WstHitEntry;
+
+typedef struct _WstHitIndex
+{
+   bool dirty;
+   WstRect bounds;
+   int cellWidth;
+   int cellHeight;
+   std::vector<WstHitEntry> entries;
+   std::vector<int> cells[WST_HIT_GRID_DIM*WST_HIT_GRID_DIM];
+   std::vector<WstCompositor*> roleCompositors;
+} WstHitIndex;
+
 typedef bool (*WstModuleInit)( WstCompositor *wctx, struct wl_display* );
 typedef void (*WstModuleTerm)( WstCompositor *wctx );
 
@@ -380,7 +455,10 @@ typedef struct _WstContext
    const char *displayName;
    unsigned int frameRate;
    int framePeriodMillis;
+   unsigned int hiddenFrameRate;
+   int hiddenFramePeriodMillis;
    const char *rendererModule;
+   bool useRenderThread;
    bool isNested;
    bool isRepeater;
    bool isEmbedded;
@@ -446,6 +524,8 @@ typedef struct _WstContext
    #endif
    struct wl_simple_shell *simpleShell;
    struct wl_event_source *displayTimer;
+   int inputEventFd;
+   struct wl_event_source *inputEventSource;
 
    #if defined (WESTEROS_HAVE_WAYLAND_EGL)
    EGLDisplay eglDisplay;
@@ -466,10 +546,28 @@ typedef struct _WstContext
    std::map<int32_t, WstSurface*> surfaceMap;
    std::map<struct wl_client*, WstClientInfo*> clientInfoMap;
    std::map<struct wl_resource*, WstSurfaceInfo*> surfaceInfoMap;
+   WstHitIndex hitIndex;
 
    bool needRepaint;
    bool allowImmediateRepaint;
    bool outputSizeChanged;
+
+   bool haveVBlank;
+   long long nextVBlankTime;
+   long long vblankInterval;
+   long long composeBudget;
+
+   bool vblankReported;
+   unsigned int composedFrame;
+   struct wl_list feedbackPresentList;
+
+   // Surfaces with frame callbacks waiting to be fired
+   struct wl_list frameCallbackSurfaceList;
+
+   // Scenes published to, and composed by, the render thread
+   unsigned int sceneGeneration;
+   unsigned int renderedGeneration;
+   struct wl_list bufferReleaseList;
    
    struct wl_display *dcDisplay;
    struct wl_registry *dcRegistry;
@@ -530,17 +628,32 @@ static bool wstCompositorCreateRenderer( WstContext *ctx );
 static void wstCompositorReleaseResources( WstContext *ctx );
 static void* wstCompositorThread( void *arg );
 static long long wstGetCurrentTimeMillis(void);
+static long long wstGetMonotonicTimeMicros(void);
 static bool wstCompositorCheckForRepeaterSupport( WstContext *ctx );
 static void wstCompositorDestroyVirtual( WstCompositor *wctx );
 static void wstCompositorProcessEvents( WstCompositor *wctx );
 static void wstContextProcessEvents( WstContext *ctx );
+static void wstContextSignalInput( WstContext *ctx );
+static int wstCompositorInputEvent( int fd, uint32_t mask, void *data );
 static void wstCompositorComposeFrame( WstContext *ctx, uint32_t frameTime );
+static void wstCompositorFireFrameCallbacks( WstContext *ctx, uint32_t frameTime, bool frameComposed );
 static void wstContextInvokeDispatchCB( WstContext *ctx );
 static void wstContextInvokeInvalidateCB( WstContext *ctx );
 static void wstContextInvokeHidePointerCB( WstContext *ctx, bool hidePointer );
 static int wstCompositorDisplayTimeOut( void *data );
+static void wstCompositorVBlank( void *userData, unsigned int frame,
+                                 long long nextVBlankTime, long long vblankInterval );
+static long long wstCompositorGetVBlankDelay( WstContext *ctx );
 static void wstCompositorScheduleRepaint( WstContext *ctx );
 static void wstCompositorReleaseDetachedBuffers( WstContext *ctx );
+static void wstCompositorReleaseConsumedBuffers( WstContext *ctx );
+static void wstSurfaceReleaseConsumedBuffer( WstSurface *surface );
+static void wstCompositorRenderThreadVBlank( void *userData, unsigned int frame,
+                                             long long nextVBlankTime, long long vblankInterval );
+static void wstCompositorFrameDone( void *userData, unsigned int generation );
+static void wstCompositorDeferBufferRelease( WstContext *ctx, struct wl_resource *resource, unsigned int generation );
+static void wstBufferReleaseDestroyCallback( struct wl_listener *listener, void *data );
+static void wstCompositorReleaseDeferredBuffers( WstContext *ctx, bool all );
 static void wstShmBind( struct wl_client *client, void *data, uint32_t version, uint32_t id);
 static bool wstShmInit( WstContext *ctx );
 static void wstShmTerm( WstContext *ctx );
@@ -570,6 +683,11 @@ static bool wstSurfaceSetRole( WstSurface *surface, const char *roleName,
 static void wstSurfaceInsertSurface( WstContext *ctx, WstSurface *surface );
 static WstSurface* wstGetSurfaceFromSurfaceId( WstContext *ctx, int32_t surfaceId );
 static WstSurface* wstGetSurfaceFromPoint( WstCompositor *wctx, int x, int y );
+static void wstSurfaceSetCachedGeometry( WstSurface *surface, int x, int y, int width, int height );
+static void wstSurfaceInvalidateGeometry( WstSurface *surface );
+static void wstCompositorRefreshGeometry( WstContext *ctx );
+static void wstHitIndexBuild( WstContext *ctx );
+static void wstHitIndexRelease( WstHitIndex *index );
 static WstSurfaceInfo* wstGetSurfaceInfo( WstContext *ctx, struct wl_resource *resource );
 static void wstUpdateClientInfo( WstContext *ctx, struct wl_client *client, struct wl_resource *resource );
 static void wstISurfaceDestroy(struct wl_client *client, struct wl_resource *resource);
@@ -579,6 +697,10 @@ static void wstISurfaceAttach(struct wl_client *client,
 static void wstISurfaceDamage(struct wl_client *client,
                               struct wl_resource *resource,
                               int32_t x, int32_t y, int32_t width, int32_t height);
+static void wstISurfaceDamageBuffer(struct wl_client *client,
+                                    struct wl_resource *resource,
+                                    int32_t x, int32_t y, int32_t width, int32_t height);
+static void wstSurfaceAddDamage( WstSurface *surface, int32_t x, int32_t y, int32_t width, int32_t height );
 static void wstISurfaceFrame(struct wl_client *client,
                              struct wl_resource *resource, uint32_t callback);
 static void wstISurfaceSetOpaqueRegion(struct wl_client *client,
@@ -809,6 +931,14 @@ static void wstIPointerSetCursor( struct wl_client *client,
 static void wstIPointerRelease( struct wl_client *client, struct wl_resource *resource );
 static void wstITouchRelease( struct wl_client *client, struct wl_resource *resource );
 static void wstVpcBind( struct wl_client *client, void *data, uint32_t version, uint32_t id);
+static void wstPresentationBind( struct wl_client *client, void *data, uint32_t version, uint32_t id);
+static void wstIPresentationDestroy( struct wl_client *client, struct wl_resource *resource );
+static void wstIPresentationFeedback( struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *surfaceResource, uint32_t id );
+static void wstDestroyPresentationFeedbackCallback(struct wl_resource *resource);
+static void wstPresentationDiscardFeedback( struct wl_list *feedbackList );
+static void wstCompositorLatchFeedback( WstCompositor *wctx );
+static void wstCompositorSendFeedback( WstContext *ctx );
 static void wstIVpcGetVpcSurface( struct wl_client *client, struct wl_resource *resource, 
                                   uint32_t id, struct wl_resource *surfaceResource);
 static void wstDestroyVpcSurfaceCallback(struct wl_resource *resource);
@@ -878,8 +1008,16 @@ WstCompositor* WstCompositorCreate()
       {
          pthread_mutex_init( &ctx->mutex, 0 );
 
+         wl_list_init( &ctx->feedbackPresentList );
+         wl_list_init( &ctx->frameCallbackSurfaceList );
+         wl_list_init( &ctx->bufferReleaseList );
+
          ctx->frameRate= DEFAULT_FRAME_RATE;
          ctx->framePeriodMillis= (1000/ctx->frameRate);
+         ctx->hiddenFrameRate= DEFAULT_HIDDEN_FRAME_RATE;
+         ctx->hiddenFramePeriodMillis= (1000/ctx->hiddenFrameRate);
+
+         ctx->inputEventFd= -1;
 
          ctx->nestedWidth= DEFAULT_NESTED_WIDTH;
          ctx->nestedHeight= DEFAULT_NESTED_HEIGHT;
@@ -1020,6 +1158,8 @@ void WstCompositorDestroy( WstCompositor *wctx )
          }
       }
 
+      wstHitIndexRelease( &ctx->hitIndex );
+
       pthread_mutex_destroy( &ctx->mutex );
       
       free( ctx );
@@ -1212,6 +1352,43 @@ exit:
    return result;
 }
 
+bool WstCompositorSetHiddenFrameRate( WstCompositor *wctx, unsigned int frameRate )
+{
+   bool result= false;
+   
+   if ( wctx && wctx->ctx )
+   {
+      WstContext *ctx= wctx->ctx;
+
+      if ( wctx->isVirtual )
+      {
+         sprintf( wctx->lastErrorDetail,
+                  "Invalid argument.  Cannot set hidden frame rate of virtual embedded compositor" );
+         goto exit;
+      }
+
+      if ( frameRate == 0 )
+      {
+         sprintf( wctx->lastErrorDetail,
+                  "Invalid argument.  The frameRate (%u) must be greater than 0 fps", frameRate );
+         goto exit;      
+      }
+
+      pthread_mutex_lock( &ctx->mutex );
+      
+      ctx->hiddenFrameRate= frameRate;
+      ctx->hiddenFramePeriodMillis= (1000/frameRate);
+      
+      pthread_mutex_unlock( &ctx->mutex );
+      
+      result= true;
+   }
+
+exit:
+   
+   return result;
+}
+
 bool WstCompositorSetNativeWindow( WstCompositor *wctx, void *nativeWindow )
 {
    bool result= false;
@@ -1433,6 +1610,42 @@ exit:
    return result;
 }
 
+bool WstCompositorSetUseRenderThread( WstCompositor *wctx, bool useRenderThread )
+{
+   bool result= false;
+   
+   if ( wctx && wctx->ctx )
+   {
+      WstContext *ctx= wctx->ctx;
+
+      if ( wctx->isVirtual )
+      {
+         sprintf( wctx->lastErrorDetail,
+                  "Invalid argument.  Cannot set render thread for virtual embedded compositor" );
+         goto exit;
+      }
+
+      if ( ctx->running )
+      {
+         sprintf( wctx->lastErrorDetail,
+                  "Bad state.  Cannot set useRenderThread while compositor is running" );
+         goto exit;
+      }
+                     
+      pthread_mutex_lock( &ctx->mutex );
+      
+      ctx->useRenderThread= useRenderThread;
+               
+      pthread_mutex_unlock( &ctx->mutex );
+            
+      result= true;
+   }
+
+exit:
+   
+   return result;
+}
+
 /**
  * WstCompositorSetVpcBridge
  *
@@ -2542,7 +2755,10 @@ bool WstCompositorComposeEmbedded( WstCompositor *wctx,
 
          if ( !(hints & WstHints_hidden) )
          {
+            ctx->vblankReported= false;
             WstRendererUpdateScene( ctx->renderer );
+            wstCompositorRefreshGeometry( ctx );
+            wstCompositorLatchFeedback( wctx );
             if ( possibleFirstFrame && wctx->clientCommit && !wctx->clientFirstFrame )
             {
                wctx->clientFirstFrame= true;
@@ -2820,6 +3036,8 @@ void WstCompositorKeyEvent( WstCompositor *wctx, int keyCode, unsigned int keySt
          
          ++wctx->eventIndex;
          assert( wctx->eventIndex < WST_EVENT_QUEUE_SIZE );
+
+         wstContextSignalInput( ctx );
       }
 
       pthread_mutex_unlock( &ctx->mutex );
@@ -2844,6 +3062,8 @@ void WstCompositorPointerEnter( WstCompositor *wctx )
          
          ++wctx->eventIndex;
          assert( wctx->eventIndex < WST_EVENT_QUEUE_SIZE );
+
+         wstContextSignalInput( ctx );
       }
 
       pthread_mutex_unlock( &ctx->mutex );
@@ -2866,6 +3086,8 @@ void WstCompositorPointerLeave( WstCompositor *wctx )
          
          ++wctx->eventIndex;
          assert( wctx->eventIndex < WST_EVENT_QUEUE_SIZE );
+
+         wstContextSignalInput( ctx );
       }
 
       pthread_mutex_unlock( &ctx->mutex );
@@ -2889,6 +3111,8 @@ void WstCompositorPointerMoveEvent( WstCompositor *wctx, int x, int y )
          
          ++wctx->eventIndex;
          assert( wctx->eventIndex < WST_EVENT_QUEUE_SIZE );
+
+         wstContextSignalInput( ctx );
       }
 
       pthread_mutex_unlock( &ctx->mutex );
@@ -2913,6 +3137,8 @@ void WstCompositorPointerButtonEvent( WstCompositor *wctx, unsigned int button,
          
          ++wctx->eventIndex;
          assert( wctx->eventIndex < WST_EVENT_QUEUE_SIZE );
+
+         wstContextSignalInput( ctx );
       }
 
       pthread_mutex_unlock( &ctx->mutex );
@@ -2979,6 +3205,11 @@ void WstCompositorTouchEvent( WstCompositor *wctx, WstTouchSet *touchSet )
 
       wctx->eventIndex= eventIndex;
 
+      if ( queuedEvents )
+      {
+         wstContextSignalInput( ctx );
+      }
+
       pthread_mutex_unlock( &ctx->mutex );
    }
 }
@@ -3482,6 +3713,9 @@ static void simpleShellSetGeometry( void* userData, uint32_t surfaceId, int x, i
          else
          {
             WstRendererSurfaceSetGeometry( ctx->renderer, surface->surface, x, y, width, height );
+            pthread_mutex_lock( &ctx->mutex );
+            wstSurfaceSetCachedGeometry( surface, x, y, width, height );
+            pthread_mutex_unlock( &ctx->mutex );
          }
          if ( surface->vpcSurface && !surface->vpcSurface->sizeOverride )
          {
@@ -3697,7 +3931,7 @@ static void* wstCompositorThread( void *arg )
       goto exit;
    }
 
-   if (!wl_global_create(ctx->display, &wl_compositor_interface, 3, ctx, wstCompositorBind))
+   if (!wl_global_create(ctx->display, &wl_compositor_interface, 4, ctx, wstCompositorBind))
    {
       ERROR("unable to create wl_compositor interface");
       goto exit;
@@ -3726,6 +3960,15 @@ static void* wstCompositorThread( void *arg )
       ERROR("unable to create wl_vpc interface");
       goto exit;
    }
+
+   if ( !ctx->isRepeater )
+   {
+      if (!wl_global_create(ctx->display, &wp_presentation_interface, 1, ctx, wstPresentationBind ))
+      {
+         ERROR("unable to create wp_presentation interface");
+         goto exit;
+      }
+   }
    
    if ( !wstOutputInit(ctx) )
    {
@@ -3883,6 +4126,17 @@ static void* wstCompositorThread( void *arg )
    wl_event_source_timer_update( ctx->displayTimer, ctx->framePeriodMillis );
    pthread_mutex_unlock( &ctx->mutex );
 
+   // Input is delivered to clients as soon as it is queued rather than at the next frame tick
+   ctx->inputEventFd= eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+   if ( ctx->inputEventFd >= 0 )
+   {
+      ctx->inputEventSource= wl_event_loop_add_fd( loop, ctx->inputEventFd, WL_EVENT_READABLE, wstCompositorInputEvent, ctx );
+   }
+   if ( !ctx->inputEventSource )
+   {
+      WARNING("unable to create input event source: input will be dispatched at frame rate");
+   }
+
    for ( std::vector<WstModule*>::iterator it= ctx->modules.begin();
          it != ctx->modules.end();
          ++it )
@@ -3980,6 +4234,20 @@ exit:
       wl_event_source_remove( ctx->displayTimer );
       ctx->displayTimer= 0;
    }
+
+   if ( ctx->inputEventSource )
+   {
+      wl_event_source_remove( ctx->inputEventSource );
+      ctx->inputEventSource= 0;
+   }
+
+   pthread_mutex_lock( &ctx->mutex );
+   if ( ctx->inputEventFd >= 0 )
+   {
+      close( ctx->inputEventFd );
+      ctx->inputEventFd= -1;
+   }
+   pthread_mutex_unlock( &ctx->mutex );
       
    return NULL;
 }
@@ -4022,13 +4290,42 @@ static bool wstCompositorCreateRenderer( WstContext *ctx )
       }
    }
 
-   ctx->renderer= WstRendererCreate( ctx->rendererModule, argc, (char **)argv, ctx->display, ctx->nc );
+   if ( ctx->useRenderThread && (ctx->isEmbedded || ctx->isNested || ctx->isRepeater || ctx->hasVpcBridge) )
+   {
+      WARNING("render thread is not supported for nested, repeating or embedded composition: ignoring");
+      ctx->useRenderThread= false;
+   }
+
+   if ( ctx->useRenderThread )
+   {
+      ctx->renderer= WstRendererCreateThreaded( ctx->rendererModule, argc, (char **)argv, ctx->display, ctx->nc );
+   }
+   else
+   {
+      ctx->renderer= WstRendererCreate( ctx->rendererModule, argc, (char **)argv, ctx->display, ctx->nc );
+   }
    if ( !ctx->renderer )
    {
       ERROR("unable to initialize renderer module");
       goto exit;
    }
 
+   if ( !ctx->isEmbedded && !ctx->isRepeater )
+   {
+      ctx->composeBudget= DEFAULT_COMPOSE_BUDGET;
+      ctx->renderer->vblankUserData= ctx;
+      if ( ctx->useRenderThread )
+      {
+         ctx->renderer->vblankCB= wstCompositorRenderThreadVBlank;
+         ctx->renderer->frameDoneUserData= ctx;
+         ctx->renderer->frameDoneCB= wstCompositorFrameDone;
+      }
+      else
+      {
+         ctx->renderer->vblankCB= wstCompositorVBlank;
+      }
+   }
+
    result= true;
 
 exit:
@@ -4090,6 +4387,8 @@ static void wstCompositorReleaseResources( WstContext *ctx )
       WstRendererDestroy( ctx->renderer );
       ctx->renderer= 0;
    }
+
+   wstCompositorReleaseDeferredBuffers( ctx, true );
    
    if ( ctx->shm )
    {
@@ -4207,6 +4506,17 @@ static long long wstGetCurrentTimeMillis(void)
    return utcCurrentTimeMillis;
 }
 
+static long long wstGetMonotonicTimeMicros(void)
+{
+   struct timespec tm;
+   long long timeMicros;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+   timeMicros= tm.tv_sec*1000000LL+(tm.tv_nsec/1000LL);
+
+   return timeMicros;
+}
+
 static void wstCompositorDestroyVirtual( WstCompositor *wctx )
 {
    WstContext *ctx= wctx->ctx;
@@ -4520,25 +4830,93 @@ static void wstContextProcessEvents( WstContext *ctx )
    pthread_mutex_unlock( &ctx->mutex );
 }
 
+static void wstContextSignalInput( WstContext *ctx )
+{
+   // Called with ctx->mutex held
+   if ( ctx->inputEventFd >= 0 )
+   {
+      eventfd_write( ctx->inputEventFd, 1 );
+   }
+}
+
+static int wstCompositorInputEvent( int fd, uint32_t mask, void *data )
+{
+   WstContext *ctx= (WstContext*)data;
+   eventfd_t count;
+   WESTEROS_UNUSED(mask);
+
+   eventfd_read( fd, &count );
+
+   wstContextProcessEvents( ctx );
+
+   wl_display_flush_clients( ctx->display );
+
+   return 0;
+}
+
 static void wstCompositorComposeFrame( WstContext *ctx, uint32_t frameTime )
 {
    pthread_mutex_lock( &ctx->mutex );
 
    ctx->needRepaint= false;
 
-   if ( !ctx->isEmbedded && !ctx->isRepeater )
+   if ( ctx->useRenderThread )
    {
+      // Publish the scene to the render thread.  Work that depends on the
+      // frame being composed is done in wstCompositorFrameDone.
+      ++ctx->sceneGeneration;
       WstRendererUpdateScene( ctx->renderer );
-      wstCompositorReleaseDetachedBuffers( ctx );
+
+      // Surfaces not in the scene don't wait on the render thread
+      wstCompositorFireFrameCallbacks( ctx, frameTime, false );
+   }
+   else
+   {
+      if ( !ctx->isEmbedded && !ctx->isRepeater )
+      {
+         ctx->vblankReported= false;
+         WstRendererUpdateScene( ctx->renderer );
+         wstCompositorRefreshGeometry( ctx );
+         wstCompositorLatchFeedback( ctx->wctx );
+         wstCompositorReleaseDetachedBuffers( ctx );
+      }
+
+      wstCompositorFireFrameCallbacks( ctx, frameTime, true );
    }
    
-   for( std::map<struct wl_resource*, WstSurfaceInfo*>::iterator it= ctx->surfaceInfoMap.begin(); it != ctx->surfaceInfoMap.end(); ++it )
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void wstCompositorFireFrameCallbacks( WstContext *ctx, uint32_t frameTime, bool frameComposed )
+{
+   WstSurface *surface, *temp;
+   WstSurfaceFrameCallback *fcb;
+
+   // Called with ctx->mutex held.  Surfaces that were part of the composed output
+   // get their callbacks with each frame.  Surfaces that are hidden, occluded or
+   // off-screen are throttled to the hidden frame rate so their clients don't keep
+   // rendering at full rate.
+   wl_list_for_each_safe( surface, temp, &ctx->frameCallbackSurfaceList, frameCallbackLink )
    {
-      WstSurfaceFrameCallback *fcb;
-      WstSurface *surface;
-      WstSurfaceInfo *surfaceInfo= it->second;
-      
-      surface= surfaceInfo->surface;
+      bool composed= true;
+
+      if ( surface->surface )
+      {
+         WstRendererSurfaceGetComposed( ctx->renderer, surface->surface, &composed );
+      }
+
+      if ( composed )
+      {
+         if ( !frameComposed )
+         {
+            continue;
+         }
+      }
+      else if ( (frameTime-surface->lastFrameCallbackTime) < (uint32_t)ctx->hiddenFramePeriodMillis )
+      {
+         continue;
+      }
+
       while( !wl_list_empty( &surface->frameCallbackList ) )
       {
          fcb= wl_container_of( surface->frameCallbackList.next, fcb, link);
@@ -4547,9 +4925,11 @@ static void wstCompositorComposeFrame( WstContext *ctx, uint32_t frameTime )
          wl_resource_destroy( fcb->resource );
          free(fcb);
       }
+      surface->lastFrameCallbackTime= frameTime;
+
+      wl_list_remove( &surface->frameCallbackLink );
+      wl_list_init( &surface->frameCallbackLink );
    }
-   
-   pthread_mutex_unlock( &ctx->mutex );
 }
 
 static void wstContextInvokeDispatchCB( WstContext *ctx )
@@ -4617,6 +4997,7 @@ static int wstCompositorDisplayTimeOut( void *data )
    WstContext *ctx= (WstContext*)data;
    long long frameTime, now;
    long long nextFrameDelay;
+   long long composeStart, composeTime;
    
    frameTime= wstGetCurrentTimeMillis();   
    
@@ -4628,13 +5009,31 @@ static int wstCompositorDisplayTimeOut( void *data )
    {
       ctx->allowImmediateRepaint= false;
 
+      composeStart= wstGetMonotonicTimeMicros();
+
       wstCompositorComposeFrame( ctx, (uint32_t)frameTime );
+
+      composeTime= wstGetMonotonicTimeMicros()-composeStart;
+      pthread_mutex_lock( &ctx->mutex );
+      if ( ctx->haveVBlank && !ctx->useRenderThread )
+      {
+         // Track a smoothed compose time, with margin, as the budget we start
+         // composing ahead of the target vblank
+         ctx->composeBudget= ((ctx->composeBudget*7)+composeTime+COMPOSE_BUDGET_MARGIN)/8;
+         if ( ctx->composeBudget < MIN_COMPOSE_BUDGET ) ctx->composeBudget= MIN_COMPOSE_BUDGET;
+         if ( ctx->composeBudget > ctx->vblankInterval ) ctx->composeBudget= ctx->vblankInterval;
+      }
+      pthread_mutex_unlock( &ctx->mutex );
       
       wstContextInvokeInvalidateCB( ctx );
    }
    else
    {
       ctx->allowImmediateRepaint= true;
+
+      pthread_mutex_lock( &ctx->mutex );
+      wstCompositorFireFrameCallbacks( ctx, (uint32_t)frameTime, false );
+      pthread_mutex_unlock( &ctx->mutex );
    }
 
    now= wstGetCurrentTimeMillis();
@@ -4643,67 +5042,230 @@ static int wstCompositorDisplayTimeOut( void *data )
    if ( nextFrameDelay > ctx->framePeriodMillis ) nextFrameDelay= ctx->framePeriodMillis;
 
    pthread_mutex_lock( &ctx->mutex );
+   wstCompositorSendFeedback( ctx );
+   if ( ctx->haveVBlank )
+   {
+      nextFrameDelay= wstCompositorGetVBlankDelay( ctx );
+   }
    wl_event_source_timer_update( ctx->displayTimer, nextFrameDelay );
    pthread_mutex_unlock( &ctx->mutex );
    
    return 0;
 }
 
-static void wstCompositorScheduleRepaint( WstContext *ctx )
+static void wstCompositorVBlank( void *userData, unsigned int frame,
+                                 long long nextVBlankTime, long long vblankInterval )
 {
-   if ( !ctx->needRepaint )
+   WstContext *ctx= (WstContext*)userData;
+
+   // Called by the renderer from within WstRendererUpdateScene with ctx->mutex held
+   if ( vblankInterval > 0 )
    {
-      ctx->needRepaint= true;
-      #if ((WAYLAND_VERSION_MAJOR == 1) && \
-           ((WAYLAND_VERSION_MINOR < 17) || ((WAYLAND_VERSION_MINOR == 17) && (WAYLAND_VERSION_MICRO < 91))) )
-      if ( ctx->allowImmediateRepaint && ctx->displayTimer )
+      if ( !ctx->haveVBlank )
       {
-         wl_event_source_timer_update( ctx->displayTimer, 1 );
+         INFO("display %s: repaint following vblank, interval %lld us", ctx->displayName, vblankInterval);
       }
-      #endif
+      ctx->haveVBlank= true;
+      ctx->nextVBlankTime= nextVBlankTime;
+      ctx->vblankInterval= vblankInterval;
+      ctx->vblankReported= true;
+      ctx->composedFrame= frame;
    }
 }
 
-static void wstCompositorReleaseDetachedBuffers( WstContext *ctx )
+static void wstCompositorRenderThreadVBlank( void *userData, unsigned int frame,
+                                             long long nextVBlankTime, long long vblankInterval )
 {
-   for ( std::vector<WstSurface*>::iterator it= ctx->surfaces.begin();
-         it != ctx->surfaces.end();
-         ++it )
-   {
-      WstSurface *surface= (*it);
-      if ( surface->detachedBufferResource )
-      {
-         wl_list_remove(&surface->detachedBufferDestroyListener.link);
-         wl_buffer_send_release( surface->detachedBufferResource );
-         surface->detachedBufferResource= 0;
-      }
-   }
+   WstContext *ctx= (WstContext*)userData;
+
+   // With a render thread vblanks are reported from the display thread once
+   // the frame is done, without ctx->mutex held
+   pthread_mutex_lock( &ctx->mutex );
+   wstCompositorVBlank( ctx, frame, nextVBlankTime, vblankInterval );
+   pthread_mutex_unlock( &ctx->mutex );
 }
 
-static const struct wl_shm_interface shm_interface=
+static void wstCompositorFrameDone( void *userData, unsigned int generation )
 {
-   wstIShmCreatePool
-};
+   WstContext *ctx= (WstContext*)userData;
 
-static const struct wl_shm_pool_interface shm_pool_interface= {
-   wstIShmPoolCreateBuffer,
-   wstIShmPoolDestroy,
-   wstIShmPoolResize
-};
+   // Called on the display thread once the render thread has composed the
+   // scene of the given generation.  Buffers and feedback for content that
+   // has not yet been composed are left for a later frame.
+   pthread_mutex_lock( &ctx->mutex );
 
-static const struct wl_buffer_interface shm_buffer_interface = {
-   wstIShmBufferDestroy
-};
+   ctx->renderedGeneration= generation;
 
-static const struct wl_compositor_interface compositor_interface= 
+   wstCompositorRefreshGeometry( ctx );
+   wstCompositorLatchFeedback( ctx->wctx );
+   ctx->vblankReported= false;
+   wstCompositorReleaseDetachedBuffers( ctx );
+   wstCompositorReleaseDeferredBuffers( ctx, false );
+   wstCompositorReleaseConsumedBuffers( ctx );
+   wstCompositorFireFrameCallbacks( ctx, (uint32_t)wstGetCurrentTimeMillis(), true );
+
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void wstCompositorDeferBufferRelease( WstContext *ctx, struct wl_resource *resource, unsigned int generation )
 {
-   wstICompositorCreateSurface,
-   wstICompositorCreateRegion
-};
+   WstBufferRelease *release;
 
-static const struct wl_surface_interface surface_interface= 
+   release= (WstBufferRelease*)calloc( 1, sizeof(WstBufferRelease) );
+   if ( !release )
+   {
+      wl_buffer_send_release( resource );
+      return;
+   }
+
+   release->resource= resource;
+   release->generation= generation;
+   release->destroyListener.notify= wstBufferReleaseDestroyCallback;
+   wl_resource_add_destroy_listener( resource, &release->destroyListener );
+   wl_list_insert( ctx->bufferReleaseList.prev, &release->link );
+}
+
+static void wstBufferReleaseDestroyCallback( struct wl_listener *listener, void *data )
 {
-   wstISurfaceDestroy,
+   WstBufferRelease *release= wl_container_of(listener, release, destroyListener );
+   WESTEROS_UNUSED(data);
+
+   wl_list_remove( &release->link );
+   free( release );
+}
+
+static void wstCompositorReleaseDeferredBuffers( WstContext *ctx, bool all )
+{
+   WstBufferRelease *release, *temp;
+
+   wl_list_for_each_safe( release, temp, &ctx->bufferReleaseList, link )
+   {
+      if ( all || (release->generation <= ctx->renderedGeneration) )
+      {
+         wl_list_remove( &release->destroyListener.link );
+         wl_list_remove( &release->link );
+         wl_buffer_send_release( release->resource );
+         free( release );
+      }
+   }
+}
+
+static long long wstCompositorGetVBlankDelay( WstContext *ctx )
+{
+   long long now, period, target, delay;
+   int vblanksPerFrame;
+
+   // Compose at the first vblank of the frame period, less the compose budget,
+   // that is still ahead of us.  When the frame rate is below the refresh rate
+   // frames are composed every vblanksPerFrame vblanks.
+   vblanksPerFrame= (int)(((ctx->framePeriodMillis*1000LL)+(ctx->vblankInterval/2))/ctx->vblankInterval);
+   if ( vblanksPerFrame < 1 ) vblanksPerFrame= 1;
+   period= vblanksPerFrame*ctx->vblankInterval;
+
+   now= wstGetMonotonicTimeMicros();
+   target= ctx->nextVBlankTime+(period-ctx->vblankInterval)-ctx->composeBudget;
+   if ( target <= now )
+   {
+      target += (((now-target)/period)+1)*period;
+   }
+
+   delay= (target-now)/1000LL;
+   if ( delay < 1 ) delay= 1;
+
+   return delay;
+}
+
+static void wstCompositorScheduleRepaint( WstContext *ctx )
+{
+   if ( !ctx->needRepaint )
+   {
+      ctx->needRepaint= true;
+      #if ((WAYLAND_VERSION_MAJOR == 1) && \
+           ((WAYLAND_VERSION_MINOR < 17) || ((WAYLAND_VERSION_MINOR == 17) && (WAYLAND_VERSION_MICRO < 91))) )
+      if ( ctx->allowImmediateRepaint && ctx->displayTimer && !ctx->haveVBlank )
+      {
+         wl_event_source_timer_update( ctx->displayTimer, 1 );
+      }
+      #endif
+   }
+}
+
+static void wstCompositorReleaseDetachedBuffers( WstContext *ctx )
+{
+   for ( std::vector<WstSurface*>::iterator it= ctx->surfaces.begin();
+         it != ctx->surfaces.end();
+         ++it )
+   {
+      WstSurface *surface= (*it);
+      if ( surface->detachedBufferResource )
+      {
+         if ( ctx->useRenderThread && (surface->detachedGeneration > ctx->renderedGeneration) )
+         {
+            continue;
+         }
+         wl_list_remove(&surface->detachedBufferDestroyListener.link);
+         wl_buffer_send_release( surface->detachedBufferResource );
+         surface->detachedBufferResource= 0;
+      }
+   }
+}
+
+static void wstCompositorReleaseConsumedBuffers( WstContext *ctx )
+{
+   // With a render thread buffers are consumed when the render thread latches
+   // their commit rather than during wl_surface.commit
+   for ( std::vector<WstSurface*>::iterator it= ctx->surfaces.begin();
+         it != ctx->surfaces.end();
+         ++it )
+   {
+      WstSurface *surface= (*it);
+      if ( surface->attachedBufferResource && !surface->bufferConsumed )
+      {
+         wstSurfaceReleaseConsumedBuffer( surface );
+      }
+   }
+}
+
+static void wstSurfaceReleaseConsumedBuffer( WstSurface *surface )
+{
+   bool consumed= false;
+
+   if ( surface->attachedBufferResource && surface->surface &&
+        WstRendererSurfaceGetBufferConsumed( surface->renderer, surface->surface, &consumed ) && consumed )
+   {
+      // The renderer kept its own copy of the content so the client can
+      // reuse the buffer right away rather than after the next attach
+      wl_list_remove(&surface->attachedBufferDestroyListener.link);
+      wl_buffer_send_release( surface->attachedBufferResource );
+      surface->attachedBufferResource= 0;
+      surface->bufferConsumed= true;
+   }
+}
+
+static const struct wl_shm_interface shm_interface=
+{
+   wstIShmCreatePool
+};
+
+static const struct wl_shm_pool_interface shm_pool_interface= {
+   wstIShmPoolCreateBuffer,
+   wstIShmPoolDestroy,
+   wstIShmPoolResize
+};
+
+static const struct wl_buffer_interface shm_buffer_interface = {
+   wstIShmBufferDestroy
+};
+
+static const struct wl_compositor_interface compositor_interface= 
+{
+   wstICompositorCreateSurface,
+   wstICompositorCreateRegion
+};
+
+static const struct wl_surface_interface surface_interface= 
+{
+   wstISurfaceDestroy,
    wstISurfaceAttach,
    wstISurfaceDamage,
    wstISurfaceFrame,
@@ -4711,7 +5273,8 @@ static const struct wl_surface_interface surface_interface=
    wstISurfaceSetInputRegion,
    wstISurfaceCommit,
    wstISurfaceSetBufferTransform,
-   wstISurfaceSetBufferScale
+   wstISurfaceSetBufferScale,
+   wstISurfaceDamageBuffer
 };
 
 static const struct wl_region_interface region_interface=
@@ -4832,6 +5395,12 @@ static const struct wl_vpc_surface_interface vpc_surface_interface=
    wstIVpcSurfaceSetGeometryWithCrop
 };
 
+static const struct wp_presentation_interface presentation_interface_impl=
+{
+   wstIPresentationDestroy,
+   wstIPresentationFeedback
+};
+
 static void wstShmBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
 {
    WstShm *shm= (WstShm*)data;
@@ -5199,7 +5768,7 @@ static void wstCompositorBind( struct wl_client *client, void *data, uint32_t ve
    
    resource= wl_resource_create(client, 
                                 &wl_compositor_interface,
-                                MIN(version, 3), 
+                                MIN(version, 4), 
                                 id);
    if (!resource) 
    {
@@ -5346,8 +5915,6 @@ static void wstICompositorCreateRegion(struct wl_client *client, struct wl_resou
    WstCompositor *wctx= 0;
    WstRegion *region;
 
-   WARNING("wstICompositorCreateRegion: wl_region is currently a stub impl");
-
    wctx= wstGetCompositorFromClient( ctx, client );
    if ( !wctx )
    {
@@ -5433,7 +6000,11 @@ static WstSurface* wstSurfaceCreate( WstCompositor *wctx)
       surface->surfaceId= ctx->nextSurfaceId++;
       ctx->surfaceMap.insert( std::pair<int32_t,WstSurface*>( surface->surfaceId, surface ) );
 
+      wl_list_init(&surface->frameCallbackPendingList);
       wl_list_init(&surface->frameCallbackList);
+      wl_list_init(&surface->frameCallbackLink);
+      wl_list_init(&surface->feedbackPendingList);
+      wl_list_init(&surface->feedbackCommittedList);
 
       surface->attachedBufferDestroyListener.notify= wstAttachedBufferDestroyCallback;
       surface->detachedBufferDestroyListener.notify= wstDetachedBufferDestroyCallback;
@@ -5464,6 +6035,9 @@ static WstSurface* wstSurfaceCreate( WstCompositor *wctx)
          if ( surface )
          {
             WstRendererSurfaceGetZOrder( ctx->renderer, surface->surface, &surface->zorder );
+            WstRendererSurfaceGetGeometry( ctx->renderer, surface->surface,
+                                           &surface->geometry.x, &surface->geometry.y,
+                                           &surface->geometry.width, &surface->geometry.height );
          }
       }
 
@@ -5547,6 +6121,7 @@ static void wstSurfaceDestroy( WstSurface *surface )
          break;
       }
    }
+   ctx->hitIndex.dirty= true;
 
    // Remove from surface map
    for( std::map<int32_t, WstSurface*>::iterator it= ctx->surfaceMap.begin(); it != ctx->surfaceMap.end(); ++it )
@@ -5611,6 +6186,9 @@ static void wstSurfaceDestroy( WstSurface *surface )
    }
    
    // Cleanup any pending frame callbacks for this surface
+   wl_list_remove( &surface->frameCallbackLink );
+   wl_list_insert_list( &surface->frameCallbackList, &surface->frameCallbackPendingList );
+   wl_list_init( &surface->frameCallbackPendingList );
    while( !wl_list_empty( &surface->frameCallbackList ) )
    {
       fcb= wl_container_of( surface->frameCallbackList.next, fcb, link);
@@ -5619,7 +6197,16 @@ static void wstSurfaceDestroy( WstSurface *surface )
       free(fcb);      
    }
 
+   // Content updates of a destroyed surface are never presented
+   wstPresentationDiscardFeedback( &surface->feedbackPendingList );
+   wstPresentationDiscardFeedback( &surface->feedbackCommittedList );
+
    assert(surface->resource == NULL);
+
+   std::vector<WstRect>().swap( surface->pendingOpaqueRegion );
+   std::vector<WstRect>().swap( surface->opaqueRegion );
+   std::vector<WstRect>().swap( surface->pendingInputRegion );
+   std::vector<WstRect>().swap( surface->inputRegion );
    
    free(surface);
 
@@ -5648,6 +6235,9 @@ static bool wstSurfaceSetRole( WstSurface *surface, const char *roleName,
         ((lenCur == lenNew) && !strncmp( surface->roleName, roleName, lenCur )) )
    {
       surface->roleName= roleName;
+      surface->isCursorRole= !strcmp( roleName, "wl_pointer-cursor" );
+      surface->isXdgSurfaceRole= !strcmp( roleName, "xdg_surface" );
+      surface->compositor->ctx->hitIndex.dirty= true;
       result= true;
    }
    else
@@ -5688,6 +6278,8 @@ static void wstSurfaceInsertSurface( WstContext *ctx, WstSurface *surface )
       ++it;
    }
    ctx->surfaces.insert(it,surface);
+
+   ctx->hitIndex.dirty= true;
 }
 
 static WstSurface* wstGetSurfaceFromSurfaceId( WstContext *ctx, int32_t surfaceId )
@@ -5706,75 +6298,251 @@ static WstSurface* wstGetSurfaceFromSurfaceId( WstContext *ctx, int32_t surfaceI
 static WstSurface* wstGetSurfaceFromPoint( WstCompositor *wctx, int x, int y )
 {
    WstSurface *surface= 0;
-   int sx=0, sy=0, sw=0, sh=0;
    bool haveRoles= false;
    WstSurface *surfaceNoRole= 0;
    WstContext *ctx= wctx->ctx;
+   WstHitIndex *index= &ctx->hitIndex;
 
-   // Identify top-most surface containing the pointer position
-   for ( std::vector<WstSurface*>::reverse_iterator it= ctx->surfaces.rbegin();
-         it != ctx->surfaces.rend();
-         ++it )
+   if ( index->dirty )
    {
-      surface= (*it);
-
-      if ( surface->compositor != wctx ) continue;
+      wstHitIndexBuild( ctx );
+   }
 
-      WstRendererSurfaceGetGeometry( ctx->renderer, surface->surface, &sx, &sy, &sw, &sh );
+   // Identify top-most surface containing the pointer position.  The candidates
+   // in each grid cell are held in top to bottom order.
+   if ( (x >= index->bounds.x) && (x < index->bounds.x+index->bounds.width) &&
+        (y >= index->bounds.y) && (y < index->bounds.y+index->bounds.height) )
+   {
+      int cx= (x-index->bounds.x)/index->cellWidth;
+      int cy= (y-index->bounds.y)/index->cellHeight;
+      std::vector<int> &cell= index->cells[cy*WST_HIT_GRID_DIM+cx];
 
-      // If this client is using surfaces with roles (eg xdg shell surfaces) then we only
-      // want to assign focus to surfaces with appropriate roles.  However, we take note of
-      // the best choice of surfaces with no role.  If we don't find a hit with a roled surface
-      // and there was no use of roles, then we set focus on the best hit with  a surface
-      // with no role.  This will happen if the client is a nested compositor instance.
-      if ( surface->roleName )
+      for ( std::vector<int>::iterator it= cell.begin(); it != cell.end(); ++it )
       {
-         int len= strlen(surface->roleName );
-         if ( !((len == 17) && !strncmp( surface->roleName, "wl_pointer-cursor", len )) )
+         WstHitEntry *entry= &index->entries[*it];
+         WstSurface *candidate= entry->surface;
+
+         if ( candidate->compositor != wctx ) continue;
+
+         if ( (x < entry->rect.x) || (x >= entry->rect.x+entry->rect.width) ||
+              (y < entry->rect.y) || (y >= entry->rect.y+entry->rect.height) )
          {
-            haveRoles= true;
+            continue;
          }
-      }
 
-      if ( (x >= sx) && (x < sx+sw) && (y >= sy) && (y < sy+sh) )
-      {
-         bool eligible= true;
-
-         if ( surface->roleName )
+         if ( candidate->haveInputRegion )
          {
-            int len= strlen(surface->roleName );
-            if ( (len == 17) && !strncmp( surface->roleName, "wl_pointer-cursor", len ) )
+            int lx= x-entry->rect.x;
+            int ly= y-entry->rect.y;
+            bool inside= false;
+
+            for ( std::vector<WstRect>::iterator itR= candidate->inputRegion.begin();
+                  itR != candidate->inputRegion.end();
+                  ++itR )
             {
-               eligible= false;
+               if ( (lx >= itR->x) && (lx < itR->x+itR->width) &&
+                    (ly >= itR->y) && (ly < itR->y+itR->height) )
+               {
+                  inside= true;
+                  break;
+               }
             }
+            if ( !inside ) continue;
          }
-         else if ( surface->vpcSurface )
+
+         // Cursor surfaces are never entered in the index so any surface with a
+         // role here is eligible for focus
+         if ( candidate->roleName )
          {
-            eligible= false;
+            surface= candidate;
+            break;
          }
-         else
+         else if ( !candidate->vpcSurface && !surfaceNoRole )
+         {
+            surfaceNoRole= candidate;
+         }
+      }
+   }
+
+   // If this client is using surfaces with roles (eg xdg shell surfaces) then we only
+   // want to assign focus to surfaces with appropriate roles.  However, we take note of
+   // the best choice of surfaces with no role.  If we don't find a hit with a roled surface
+   // and there was no use of roles, then we set focus on the best hit with  a surface
+   // with no role.  This will happen if the client is a nested compositor instance.
+   if ( !surface )
+   {
+      for ( std::vector<WstCompositor*>::iterator it= index->roleCompositors.begin();
+            it != index->roleCompositors.end();
+            ++it )
+      {
+         if ( (*it) == wctx )
          {
-            if ( !surfaceNoRole )
+            haveRoles= true;
+            break;
+         }
+      }
+      if ( !haveRoles )
+      {
+         surface= surfaceNoRole;
+      }
+   }
+
+   return surface;
+}
+
+static void wstSurfaceSetCachedGeometry( WstSurface *surface, int x, int y, int width, int height )
+{
+   if ( (surface->geometry.x != x) || (surface->geometry.y != y) ||
+        (surface->geometry.width != width) || (surface->geometry.height != height) )
+   {
+      surface->geometry.x= x;
+      surface->geometry.y= y;
+      surface->geometry.width= width;
+      surface->geometry.height= height;
+
+      // The pointer surface follows every pointer motion but never takes focus
+      if ( !surface->isCursorRole )
+      {
+         surface->compositor->ctx->hitIndex.dirty= true;
+      }
+   }
+}
+
+static void wstSurfaceInvalidateGeometry( WstSurface *surface )
+{
+   // The renderer may size the surface from its buffer when the next frame is
+   // composed so re-read its geometry once that has happened
+   surface->geometryStale= true;
+}
+
+static void wstCompositorRefreshGeometry( WstContext *ctx )
+{
+   for ( std::vector<WstSurface*>::iterator it= ctx->surfaces.begin();
+         it != ctx->surfaces.end();
+         ++it )
+   {
+      WstSurface *surface= (*it);
+
+      if ( ctx->useRenderThread && (surface->commitGeneration > ctx->renderedGeneration) )
+      {
+         continue;
+      }
+
+      if ( surface->geometryStale && surface->surface )
+      {
+         int sx=0, sy=0, sw=0, sh=0;
+
+         WstRendererSurfaceGetGeometry( ctx->renderer, surface->surface, &sx, &sy, &sw, &sh );
+         wstSurfaceSetCachedGeometry( surface, sx, sy, sw, sh );
+      }
+      surface->geometryStale= false;
+   }
+}
+
+static void wstHitIndexBuild( WstContext *ctx )
+{
+   WstHitIndex *index= &ctx->hitIndex;
+   int i, cx, cy, cx0, cy0, cx1, cy1;
+   int x0= 0, y0= 0, x1= 0, y1= 0;
+
+   index->entries.clear();
+   index->roleCompositors.clear();
+   for ( i= 0; i < WST_HIT_GRID_DIM*WST_HIT_GRID_DIM; ++i )
+   {
+      index->cells[i].clear();
+   }
+
+   for ( std::vector<WstSurface*>::reverse_iterator it= ctx->surfaces.rbegin();
+         it != ctx->surfaces.rend();
+         ++it )
+   {
+      WstSurface *surface= (*it);
+
+      if ( surface->roleName && !surface->isCursorRole )
+      {
+         bool found= false;
+         for ( std::vector<WstCompositor*>::iterator itC= index->roleCompositors.begin();
+               itC != index->roleCompositors.end();
+               ++itC )
+         {
+            if ( (*itC) == surface->compositor )
             {
-               surfaceNoRole= surface;
+               found= true;
+               break;
             }
-            eligible= false;
          }
-         if ( eligible )
+         if ( !found )
          {
-            break;
+            index->roleCompositors.push_back( surface->compositor );
          }
       }
 
-      surface= 0;
+      if ( surface->isCursorRole ||
+           (surface->roleName == 0 && surface->vpcSurface) ||
+           (surface->geometry.width <= 0) ||
+           (surface->geometry.height <= 0) )
+      {
+         continue;
+      }
+
+      WstHitEntry entry;
+      entry.surface= surface;
+      entry.rect= surface->geometry;
+
+      if ( index->entries.empty() )
+      {
+         x0= entry.rect.x;
+         y0= entry.rect.y;
+         x1= entry.rect.x+entry.rect.width;
+         y1= entry.rect.y+entry.rect.height;
+      }
+      else
+      {
+         if ( entry.rect.x < x0 ) x0= entry.rect.x;
+         if ( entry.rect.y < y0 ) y0= entry.rect.y;
+         if ( entry.rect.x+entry.rect.width > x1 ) x1= entry.rect.x+entry.rect.width;
+         if ( entry.rect.y+entry.rect.height > y1 ) y1= entry.rect.y+entry.rect.height;
+      }
+      index->entries.push_back( entry );
    }
 
-   if ( !surface && !haveRoles )
+   index->bounds.x= x0;
+   index->bounds.y= y0;
+   index->bounds.width= x1-x0;
+   index->bounds.height= y1-y0;
+   index->cellWidth= MAX( 1, (index->bounds.width+WST_HIT_GRID_DIM-1)/WST_HIT_GRID_DIM );
+   index->cellHeight= MAX( 1, (index->bounds.height+WST_HIT_GRID_DIM-1)/WST_HIT_GRID_DIM );
+
+   for ( i= 0; i < (int)index->entries.size(); ++i )
    {
-      surface= surfaceNoRole;
+      WstRect *rect= &index->entries[i].rect;
+
+      cx0= (rect->x-x0)/index->cellWidth;
+      cy0= (rect->y-y0)/index->cellHeight;
+      cx1= MIN( WST_HIT_GRID_DIM-1, (rect->x+rect->width-1-x0)/index->cellWidth );
+      cy1= MIN( WST_HIT_GRID_DIM-1, (rect->y+rect->height-1-y0)/index->cellHeight );
+      for ( cy= cy0; cy <= cy1; ++cy )
+      {
+         for ( cx= cx0; cx <= cx1; ++cx )
+         {
+            index->cells[cy*WST_HIT_GRID_DIM+cx].push_back( i );
+         }
+      }
    }
 
-   return surface;
+   index->dirty= false;
+}
+
+static void wstHitIndexRelease( WstHitIndex *index )
+{
+   int i;
+
+   std::vector<WstHitEntry>().swap( index->entries );
+   std::vector<WstCompositor*>().swap( index->roleCompositors );
+   for ( i= 0; i < WST_HIT_GRID_DIM*WST_HIT_GRID_DIM; ++i )
+   {
+      std::vector<int>().swap( index->cells[i] );
+   }
 }
 
 static WstSurfaceInfo* wstGetSurfaceInfo( WstContext *ctx, struct wl_resource *resource )
@@ -5853,12 +6621,21 @@ static void wstISurfaceAttach(struct wl_client *client,
    WstContext *ctx= surface->compositor->ctx;
 
    pthread_mutex_lock( &ctx->mutex );
+   surface->bufferConsumed= false;
    if ( surface->attachedBufferResource != bufferResource )
    {
       if ( surface->detachedBufferResource )
       {
          wl_list_remove(&surface->detachedBufferDestroyListener.link);
-         wl_buffer_send_release( surface->detachedBufferResource );
+         if ( ctx->useRenderThread && (surface->detachedGeneration > ctx->renderedGeneration) )
+         {
+            // The render thread may still be using it
+            wstCompositorDeferBufferRelease( ctx, surface->detachedBufferResource, surface->detachedGeneration );
+         }
+         else
+         {
+            wl_buffer_send_release( surface->detachedBufferResource );
+         }
       }
       if ( surface->attachedBufferResource )
       {
@@ -5868,6 +6645,7 @@ static void wstISurfaceAttach(struct wl_client *client,
       if ( surface->detachedBufferResource )
       {
          wl_resource_add_destroy_listener( surface->detachedBufferResource, &surface->detachedBufferDestroyListener );
+         surface->detachedGeneration= ctx->sceneGeneration+1;
       }
       surface->attachedBufferResource= 0;
    }
@@ -5893,12 +6671,59 @@ static void wstISurfaceDamage(struct wl_client *client,
                               int32_t x, int32_t y, int32_t width, int32_t height)
 {
    WstSurface *surface= (WstSurface*)wl_resource_get_user_data(resource);
-   WESTEROS_UNUSED(x);
-   WESTEROS_UNUSED(y);
-   WESTEROS_UNUSED(width);
-   WESTEROS_UNUSED(height);
+   WstContext *ctx= surface->compositor->ctx;
 
-   // Ignored for now - assume damage includes entire surface
+   // Buffer scale and transform are not supported so surface and buffer co-ordinates are the same
+   pthread_mutex_lock( &ctx->mutex );
+   wstSurfaceAddDamage( surface, x, y, width, height );
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void wstISurfaceDamageBuffer(struct wl_client *client,
+                                    struct wl_resource *resource,
+                                    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   WstSurface *surface= (WstSurface*)wl_resource_get_user_data(resource);
+   WstContext *ctx= surface->compositor->ctx;
+
+   pthread_mutex_lock( &ctx->mutex );
+   wstSurfaceAddDamage( surface, x, y, width, height );
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void wstSurfaceAddDamage( WstSurface *surface, int32_t x, int32_t y, int32_t width, int32_t height )
+{
+   int64_t x0, y0, x1, y1;
+
+   if ( (width <= 0) || (height <= 0) )
+   {
+      return;
+   }
+
+   x0= x;
+   y0= y;
+   x1= (int64_t)x+width;
+   y1= (int64_t)y+height;
+   if ( surface->damagePending )
+   {
+      x0= MIN( x0, surface->damage.x );
+      y0= MIN( y0, surface->damage.y );
+      x1= MAX( x1, (int64_t)surface->damage.x+surface->damage.width );
+      y1= MAX( y1, (int64_t)surface->damage.y+surface->damage.height );
+   }
+   if ( x0 < 0 ) x0= 0;
+   if ( y0 < 0 ) y0= 0;
+   if ( x1 > INT_MAX ) x1= INT_MAX;
+   if ( y1 > INT_MAX ) y1= INT_MAX;
+   if ( (x1 <= x0) || (y1 <= y0) )
+   {
+      return;
+   }
+   surface->damage.x= (int)x0;
+   surface->damage.y= (int)y0;
+   surface->damage.width= (int)(x1-x0);
+   surface->damage.height= (int)(y1-y0);
+   surface->damagePending= true;
 }
 
 static void wstISurfaceFrame(struct wl_client *client,
@@ -5906,6 +6731,7 @@ static void wstISurfaceFrame(struct wl_client *client,
 {
    WstSurfaceFrameCallback *fcb= 0;
    WstSurface *surface= (WstSurface*)wl_resource_get_user_data(resource);
+   WstContext *ctx= surface->compositor->ctx;
    
    fcb= (WstSurfaceFrameCallback*)malloc( sizeof(WstSurfaceFrameCallback) );
    if ( !fcb )
@@ -5922,27 +6748,57 @@ static void wstISurfaceFrame(struct wl_client *client,
       return;
    }
    
-   wl_list_insert( surface->frameCallbackList.prev, &fcb->link );
+   // Frame callbacks are double buffered state that takes effect at the next commit
+   pthread_mutex_lock( &ctx->mutex );
+   wl_list_insert( surface->frameCallbackPendingList.prev, &fcb->link );
+   pthread_mutex_unlock( &ctx->mutex );
 }
 
 static void wstISurfaceSetOpaqueRegion(struct wl_client *client,
                                        struct wl_resource *resource,
                                        struct wl_resource *regionResource)
 {
+   WstSurface *surface= (WstSurface*)wl_resource_get_user_data(resource);
+   WstContext *ctx= surface->compositor->ctx;
    WESTEROS_UNUSED(client);
-   WESTEROS_UNUSED(resource);
-   WESTEROS_UNUSED(regionResource);
-   TRACE("wstISurfaceSetOpaqueRegion: not supported");
+
+   pthread_mutex_lock( &ctx->mutex );
+   if ( regionResource )
+   {
+      WstRegion *region= (WstRegion*)wl_resource_get_user_data(regionResource);
+      surface->pendingOpaqueRegion= region->rects;
+   }
+   else
+   {
+      surface->pendingOpaqueRegion.clear();
+   }
+   surface->opaqueRegionPending= true;
+   pthread_mutex_unlock( &ctx->mutex );
 }
 
 static void wstISurfaceSetInputRegion(struct wl_client *client,
                                       struct wl_resource *resource,
                                       struct wl_resource *regionResource)
 {
+   WstSurface *surface= (WstSurface*)wl_resource_get_user_data(resource);
+   WstContext *ctx= surface->compositor->ctx;
    WESTEROS_UNUSED(client);
-   WESTEROS_UNUSED(resource);
-   WESTEROS_UNUSED(regionResource);
-   WARNING("wstISurfaceSetInputRegion: not supported");
+
+   pthread_mutex_lock( &ctx->mutex );
+   if ( regionResource )
+   {
+      WstRegion *region= (WstRegion*)wl_resource_get_user_data(regionResource);
+      surface->pendingInputRegion= region->rects;
+      surface->pendingHaveInputRegion= true;
+   }
+   else
+   {
+      // A null region means the whole surface accepts input
+      surface->pendingInputRegion.clear();
+      surface->pendingHaveInputRegion= false;
+   }
+   surface->inputRegionPending= true;
+   pthread_mutex_unlock( &ctx->mutex );
 }
 
 static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *resource)
@@ -5953,6 +6809,57 @@ static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *reso
 
    pthread_mutex_lock( &ctx->mutex );
 
+   if ( surface->opaqueRegionPending )
+   {
+      surface->opaqueRegion.swap( surface->pendingOpaqueRegion );
+      surface->pendingOpaqueRegion.clear();
+      surface->opaqueRegionPending= false;
+      if ( surface->renderer )
+      {
+         WstRendererSurfaceSetOpaqueRegion( surface->renderer, surface->surface, surface->opaqueRegion );
+      }
+   }
+
+   if ( surface->inputRegionPending )
+   {
+      surface->inputRegion.swap( surface->pendingInputRegion );
+      surface->pendingInputRegion.clear();
+      surface->haveInputRegion= surface->pendingHaveInputRegion;
+      surface->inputRegionPending= false;
+      ctx->hitIndex.dirty= true;
+   }
+
+   // Feedback for an earlier commit that was never composed is superseded by this one
+   wstPresentationDiscardFeedback( &surface->feedbackCommittedList );
+   wl_list_insert_list( &surface->feedbackCommittedList, &surface->feedbackPendingList );
+   wl_list_init( &surface->feedbackPendingList );
+
+   if ( !wl_list_empty( &surface->frameCallbackPendingList ) )
+   {
+      wl_list_insert_list( surface->frameCallbackList.prev, &surface->frameCallbackPendingList );
+      wl_list_init( &surface->frameCallbackPendingList );
+      if ( wl_list_empty( &surface->frameCallbackLink ) )
+      {
+         wl_list_insert( ctx->frameCallbackSurfaceList.prev, &surface->frameCallbackLink );
+      }
+   }
+
+   if ( surface->attachedBufferResource )
+   {
+      wstSurfaceInvalidateGeometry( surface );
+   }
+
+   if ( ctx->useRenderThread )
+   {
+      // This commit reaches the renderer with the next scene published, as
+      // does the replacement of any detached buffer
+      surface->commitGeneration= ctx->sceneGeneration+1;
+      if ( surface->detachedBufferResource )
+      {
+         surface->detachedGeneration= surface->commitGeneration;
+      }
+   }
+
    committedBufferResource= surface->attachedBufferResource;
    if ( surface->attachedBufferResource )
    {
@@ -6141,7 +7048,10 @@ static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *reso
       }
       else
       {
-         WstRendererSurfaceCommit( surface->renderer, surface->surface, surface->attachedBufferResource );
+         // A client that attaches without posting damage gets the whole buffer refreshed
+         WstRendererSurfaceCommit( surface->renderer, surface->surface, surface->attachedBufferResource,
+                                   (surface->damagePending ? &surface->damage : 0) );
+         wstSurfaceReleaseConsumedBuffer( surface );
          if ( ctx->hasVpcBridge && surface->vpcSurface && surface->surfaceNested )
          {
             WstNestedConnectionAttachAndCommit( ctx->nc,
@@ -6155,7 +7065,7 @@ static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *reso
          }
       }      
    }
-   else
+   else if ( !surface->bufferConsumed )
    {
       int attachX, attachY;
 
@@ -6175,7 +7085,7 @@ static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *reso
       }
       else
       {
-         WstRendererSurfaceCommit( surface->renderer, surface->surface, 0 );
+         WstRendererSurfaceCommit( surface->renderer, surface->surface, 0, 0 );
          if ( ctx->hasVpcBridge && surface->vpcSurface && surface->surfaceNested )
          {
             WstNestedConnectionAttachAndCommit( ctx->nc,
@@ -6205,6 +7115,8 @@ static void wstISurfaceCommit(struct wl_client *client, struct wl_resource *reso
       }
    }
 
+   surface->damagePending= false;
+
    wstCompositorScheduleRepaint( ctx );
 
    pthread_mutex_unlock( &ctx->mutex );
@@ -6245,6 +7157,7 @@ static WstRegion *wstRegionCreate( WstCompositor *wctx )
 static void wstRegionDestroy( WstRegion *region )
 {
    assert(region->resource == NULL);
+   std::vector<WstRect>().swap( region->rects );
    free( region );
 }
 
@@ -6267,24 +7180,87 @@ static void wstIRegionAdd( struct wl_client *client,
                            struct wl_resource *resource,
                            int32_t x, int32_t y, int32_t width, int32_t height )
 {
+   WstRegion *region= (WstRegion*)wl_resource_get_user_data(resource);
    WESTEROS_UNUSED(client);
-   WESTEROS_UNUSED(resource);
-   WESTEROS_UNUSED(x);
-   WESTEROS_UNUSED(y);
-   WESTEROS_UNUSED(width);
-   WESTEROS_UNUSED(height);
+
+   if ( (width > 0) && (height > 0) )
+   {
+      WstRect r;
+
+      // Rectangles may overlap: the region is the union of all of them
+      r.x= x;
+      r.y= y;
+      r.width= width;
+      r.height= height;
+      region->rects.push_back( r );
+   }
 }
                            
 static void wstIRegionSubtract( struct wl_client *client,
                                 struct wl_resource *resource,
                                 int32_t x, int32_t y, int32_t width, int32_t height )
 {
+   WstRegion *region= (WstRegion*)wl_resource_get_user_data(resource);
+   std::vector<WstRect> result;
+   int sx0, sy0, sx1, sy1;
    WESTEROS_UNUSED(client);
-   WESTEROS_UNUSED(resource);
-   WESTEROS_UNUSED(x);
-   WESTEROS_UNUSED(y);
-   WESTEROS_UNUSED(width);
-   WESTEROS_UNUSED(height);
+
+   if ( (width <= 0) || (height <= 0) )
+   {
+      return;
+   }
+
+   sx0= x;
+   sy0= y;
+   sx1= x+width;
+   sy1= y+height;
+
+   // Split each rectangle into the up to four pieces lying outside the subtracted one
+   for( std::vector<WstRect>::iterator it= region->rects.begin(); it != region->rects.end(); ++it )
+   {
+      WstRect r= (*it);
+      int rx1= r.x+r.width;
+      int ry1= r.y+r.height;
+      WstRect piece;
+
+      if ( (sx0 >= rx1) || (sx1 <= r.x) || (sy0 >= ry1) || (sy1 <= r.y) )
+      {
+         result.push_back( r );
+         continue;
+      }
+      if ( sy0 > r.y )
+      {
+         piece.x= r.x;
+         piece.y= r.y;
+         piece.width= r.width;
+         piece.height= sy0-r.y;
+         result.push_back( piece );
+      }
+      if ( sy1 < ry1 )
+      {
+         piece.x= r.x;
+         piece.y= sy1;
+         piece.width= r.width;
+         piece.height= ry1-sy1;
+         result.push_back( piece );
+      }
+      piece.y= MAX( r.y, sy0 );
+      piece.height= MIN( ry1, sy1 )-piece.y;
+      if ( sx0 > r.x )
+      {
+         piece.x= r.x;
+         piece.width= sx0-r.x;
+         result.push_back( piece );
+      }
+      if ( sx1 < rx1 )
+      {
+         piece.x= sx1;
+         piece.width= rx1-sx1;
+         result.push_back( piece );
+      }
+   }
+
+   region->rects.swap( result );
 }
 
 static bool wstOutputInit( WstContext *ctx )
@@ -6463,13 +7439,9 @@ static void wstOutputChangeSize( WstCompositor *wctx )
          {
             continue;
          }
-         if ( surface->roleName )
+         if ( surface->isXdgSurfaceRole )
          {
-            int len= strlen( surface->roleName );
-            if ( (len == 11) && !strncmp( "xdg_surface", surface->roleName, len) )
-            {
-               wstXdgSurfaceSendConfigure( wctx, surface, XDG_SURFACE_STATE_FULLSCREEN );
-            }
+            wstXdgSurfaceSendConfigure( wctx, surface, XDG_SURFACE_STATE_FULLSCREEN );
          }
       }
    }
@@ -8423,7 +9395,10 @@ static void wstIVpcGetVpcSurface( struct wl_client *client, struct wl_resource *
    surface->width= DEFAULT_OUTPUT_WIDTH;
    surface->height= DEFAULT_OUTPUT_HEIGHT;
    
+   pthread_mutex_lock( &compositor->ctx->mutex );
    surface->vpcSurface= vpcSurface;
+   compositor->ctx->hitIndex.dirty= true;
+   pthread_mutex_unlock( &compositor->ctx->mutex );
 
    if ( compositor->ctx->isNested || compositor->ctx->hasVpcBridge )
    {
@@ -8501,6 +9476,10 @@ static void wstVpcSurfaceDestroy( WstVpcSurface *vpcSurface )
    if ( vpcSurface->surface )
    {
       vpcSurface->surface->vpcSurface= 0;
+      if ( vpcSurface->compositor )
+      {
+         vpcSurface->compositor->ctx->hitIndex.dirty= true;
+      }
    }
    
    assert(vpcSurface->resource == NULL);
@@ -8535,6 +9514,9 @@ static void wstIVpcSurfaceSetGeometry( struct wl_client *client, struct wl_resou
          if ( surface->compositor->ctx->renderer )
          {
             WstRendererSurfaceSetGeometry( surface->compositor->ctx->renderer, surface->surface, x, y, width, height );
+            pthread_mutex_lock( &surface->compositor->ctx->mutex );
+            wstSurfaceSetCachedGeometry( surface, x, y, width, height );
+            pthread_mutex_unlock( &surface->compositor->ctx->mutex );
          }
       }
    }
@@ -8574,6 +9556,9 @@ static void wstIVpcSurfaceSetGeometryWithCrop( struct wl_client *client, struct
             ch= (float)cropH/(float)WL_VPC_SURFACE_CROP_DENOM;
             WstRendererSurfaceSetGeometry( surface->compositor->ctx->renderer, surface->surface, x, y, width, height );
             WstRendererSurfaceSetCrop( surface->compositor->ctx->renderer, surface->surface, cx, cy, cw, ch );
+            pthread_mutex_lock( &surface->compositor->ctx->mutex );
+            wstSurfaceSetCachedGeometry( surface, x, y, width, height );
+            pthread_mutex_unlock( &surface->compositor->ctx->mutex );
          }
       }
    }
@@ -8773,11 +9758,214 @@ static void wstUpdateVPCSurfaces( WstCompositor *wctx, std::vector<WstRect> &rec
                                            surface->y,
                                            surface->width*sizeFactorX,
                                            surface->height*sizeFactorY );
+            wstSurfaceInvalidateGeometry( surface );
          }
       }
    }
 }
 
+static void wstPresentationBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+   WstContext *ctx= (WstContext*)data;
+   struct wl_resource *resource;
+
+   resource= wl_resource_create(client, 
+                                &wp_presentation_interface,
+                                MIN(version, 1), 
+                                id);
+   if (!resource)
+   {
+      wl_client_post_no_memory(client);
+      return;
+   }
+
+   wl_resource_set_implementation(resource, &presentation_interface_impl, ctx, NULL);
+
+   // Presentation times are derived from CLOCK_MONOTONIC vblank timestamps
+   wp_presentation_send_clock_id( resource, CLOCK_MONOTONIC );
+}
+
+static void wstIPresentationDestroy( struct wl_client *client, struct wl_resource *resource )
+{
+   WESTEROS_UNUSED(client);
+   wl_resource_destroy( resource );
+}
+
+static void wstIPresentationFeedback( struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *surfaceResource, uint32_t id )
+{
+   WstSurface *surface= (WstSurface*)wl_resource_get_user_data(surfaceResource);
+   WstContext *ctx= surface->compositor->ctx;
+   WstPresentationFeedback *feedback= 0;
+
+   feedback= (WstPresentationFeedback*)calloc( 1, sizeof(WstPresentationFeedback) );
+   if ( !feedback )
+   {
+      wl_resource_post_no_memory(resource);
+      return;
+   }
+
+   feedback->resource= wl_resource_create( client, &wp_presentation_feedback_interface, wl_resource_get_version(resource), id );
+   if ( !feedback->resource )
+   {
+      wl_resource_post_no_memory(resource);
+      free(feedback);
+      return;
+   }
+
+   wl_resource_set_implementation(feedback->resource, NULL, feedback, wstDestroyPresentationFeedbackCallback);
+
+   pthread_mutex_lock( &ctx->mutex );
+   wl_list_insert( surface->feedbackPendingList.prev, &feedback->link );
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void wstDestroyPresentationFeedbackCallback(struct wl_resource *resource)
+{
+   WstPresentationFeedback *feedback= (WstPresentationFeedback*)wl_resource_get_user_data(resource);
+
+   if ( feedback )
+   {
+      wl_list_remove( &feedback->link );
+      free( feedback );
+   }
+}
+
+static void wstPresentationDiscardFeedback( struct wl_list *feedbackList )
+{
+   WstPresentationFeedback *feedback;
+
+   while( !wl_list_empty( feedbackList ) )
+   {
+      feedback= wl_container_of( feedbackList->next, feedback, link);
+      wp_presentation_feedback_send_discarded( feedback->resource );
+      wl_resource_destroy( feedback->resource );
+   }
+}
+
+static void wstCompositorLatchFeedback( WstCompositor *wctx )
+{
+   WstContext *ctx= wctx->ctx;
+   unsigned int frame;
+   long long presentationTime, refresh;
+
+   // Called with ctx->mutex held just after the renderer has composed the scene.
+   // Feedback is tied to the frame the renderer swapped and completed once the
+   // platform reports the vblank at which that frame reached the display.
+   // Content is always copied into the composition so zero_copy is never reported.
+   frame= (ctx->vblankReported ? ctx->composedFrame : 0);
+   presentationTime= wstGetMonotonicTimeMicros();
+   refresh= (ctx->haveVBlank ? ctx->vblankInterval*1000LL : 0);
+
+   for ( std::vector<WstSurface*>::iterator it= ctx->surfaces.begin();
+         it != ctx->surfaces.end();
+         ++it )
+   {
+      WstSurface *surface= (*it);
+      WstPresentationFeedback *feedback;
+      bool composed= false;
+
+      if ( (surface->compositor != wctx) || wl_list_empty( &surface->feedbackCommittedList ) )
+      {
+         continue;
+      }
+
+      if ( ctx->useRenderThread && (surface->commitGeneration > ctx->renderedGeneration) )
+      {
+         continue;
+      }
+
+      // Hidden, fully occluded and off-screen content was not part of the output
+      if ( surface->surface )
+      {
+         WstRendererSurfaceGetComposed( ctx->renderer, surface->surface, &composed );
+      }
+      if ( !composed )
+      {
+         wstPresentationDiscardFeedback( &surface->feedbackCommittedList );
+         continue;
+      }
+
+      wl_list_for_each( feedback, &surface->feedbackCommittedList, link )
+      {
+         feedback->frame= frame;
+         feedback->presentationTime= presentationTime;
+         feedback->sequence= 0;
+         feedback->refresh= refresh;
+         feedback->flags= 0;
+      }
+      wl_list_insert_list( ctx->feedbackPresentList.prev, &surface->feedbackCommittedList );
+      wl_list_init( &surface->feedbackCommittedList );
+   }
+}
+
+static void wstCompositorSendFeedback( WstContext *ctx )
+{
+   WstPresentationFeedback *feedback, *temp;
+   long long seconds;
+   uint32_t nanoSeconds;
+
+   // Called with ctx->mutex held.  Feedback for tracked frames is held back until
+   // the platform has seen the frame latched by a page flip or vblank, whose
+   // timestamp and sequence are then reported.  Frames that can't be tracked are
+   // reported as presented at compose time with no hardware flags.
+   wl_list_for_each_safe( feedback, temp, &ctx->feedbackPresentList, link )
+   {
+      if ( feedback->frame )
+      {
+         long long presentationTime;
+         unsigned int sequence;
+
+         switch( WstRendererQueryPresentation( ctx->renderer, feedback->frame, &presentationTime, &sequence ) )
+         {
+            case WstPresentation_pending:
+               continue;
+            case WstPresentation_presented:
+               if ( presentationTime > wstGetMonotonicTimeMicros() )
+               {
+                  continue;
+               }
+               feedback->presentationTime= presentationTime;
+               feedback->sequence= sequence;
+               feedback->flags= WP_PRESENTATION_FEEDBACK_KIND_VSYNC|
+                                WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK|
+                                WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+               break;
+            case WstPresentation_discarded:
+               wp_presentation_feedback_send_discarded( feedback->resource );
+               wl_resource_destroy( feedback->resource );
+               continue;
+            default:
+               break;
+         }
+      }
+
+      if ( ctx->output )
+      {
+         struct wl_resource *outputResource;
+
+         outputResource= wl_resource_find_for_client( &ctx->output->resourceList,
+                                                      wl_resource_get_client( feedback->resource ) );
+         if ( outputResource )
+         {
+            wp_presentation_feedback_send_sync_output( feedback->resource, outputResource );
+         }
+      }
+
+      seconds= feedback->presentationTime/1000000LL;
+      nanoSeconds= (uint32_t)((feedback->presentationTime%1000000LL)*1000LL);
+      wp_presentation_feedback_send_presented( feedback->resource,
+                                               (uint32_t)(seconds >> 32),
+                                               (uint32_t)(seconds & 0xFFFFFFFF),
+                                               nanoSeconds,
+                                               (uint32_t)feedback->refresh,
+                                               0,
+                                               feedback->sequence,
+                                               feedback->flags );
+      wl_resource_destroy( feedback->resource );
+   }
+}
+
 #define TEMPFILE_PREFIX "westeros-"
 #define TEMPFILE_TEMPLATE "/tmp/" TEMPFILE_PREFIX "%d-XXXXXX"
 
@@ -9064,13 +10252,9 @@ static void wstKeyboardCheckFocus( WstKeyboard *keyboard, WstSurface *surface )
       wstUpdateClientInfo( compositor->ctx, surfaceClient, 0 );
       if ( compositor->ctx->clientInfoMap[surfaceClient]->usesXdgShell )
       {
-         if ( surface->roleName )
+         if ( surface->isXdgSurfaceRole )
          {
-            int len= strlen(surface->roleName );
-            if ( (len == 11) && !strncmp( surface->roleName, "xdg_surface", len ) )
-            {
-               giveFocus= true;
-            }
+            giveFocus= true;
          }
       }
       else
@@ -9337,7 +10521,7 @@ static void wstProcessPointerMoveEvent( WstPointer *pointer, int32_t x, int32_t
    WstCompositor *compositor= pointer->compositor;
    WstContext *ctx= compositor->ctx;
    WstSurface *surface= 0;
-   int sx=0, sy=0, sw=0, sh=0;
+   int sx=0, sy=0;
    uint32_t time;
    struct wl_resource *resource;
 
@@ -9367,7 +10551,8 @@ static void wstProcessPointerMoveEvent( WstPointer *pointer, int32_t x, int32_t
          {
             wl_fixed_t xFixed, yFixed;
 
-            WstRendererSurfaceGetGeometry( ctx->renderer, pointer->focus->surface, &sx, &sy, &sw, &sh );
+            sx= pointer->focus->geometry.x;
+            sy= pointer->focus->geometry.y;
             
             xFixed= wl_fixed_from_int( x-sx );
             yFixed= wl_fixed_from_int( y-sy );
@@ -9428,12 +10613,13 @@ static void wstPointerCheckFocus( WstPointer *pointer, int32_t x, int32_t y )
       
       if ( pointer->focus != surface )
       {
-         int sx= 0, sy= 0, sw, sh;
+         int sx= 0, sy= 0;
          wl_fixed_t xFixed, yFixed;
 
          if ( surface )
          {
-            WstRendererSurfaceGetGeometry( compositor->ctx->renderer, surface->surface, &sx, &sy, &sw, &sh );
+            sx= surface->geometry.x;
+            sy= surface->geometry.y;
          }
 
          xFixed= wl_fixed_from_int( x-sx );
@@ -9558,7 +10744,7 @@ static void wstProcessTouchDownEvent( WstTouch *touch, uint32_t time, int id, in
    WstContext *ctx= touch->compositor->ctx;
    uint32_t serial;
    struct wl_resource *resource;
-   int sx=0, sy=0, sw=0, sh=0;
+   int sx=0, sy=0;
 
    if ( ctx->isNested )
    {
@@ -9607,7 +10793,8 @@ static void wstProcessTouchDownEvent( WstTouch *touch, uint32_t time, int id, in
       }
       else
       {
-         WstRendererSurfaceGetGeometry( ctx->renderer, touch->focus->surface, &sx, &sy, &sw, &sh );
+         sx= touch->focus->geometry.x;
+         sy= touch->focus->geometry.y;
       }
 
       xFixed= wl_fixed_from_int( x-sx );
@@ -9648,7 +10835,7 @@ static void wstProcessTouchMotionEvent( WstTouch *touch, uint32_t time, int id,
    WstContext *ctx= touch->compositor->ctx;
    uint32_t serial;
    struct wl_resource *resource;
-   int sx, sy, sw, sh;
+   int sx, sy;
 
    if ( touch->focus )
    {
@@ -9660,7 +10847,8 @@ static void wstProcessTouchMotionEvent( WstTouch *touch, uint32_t time, int id,
       }
       else
       {
-         WstRendererSurfaceGetGeometry( ctx->renderer, touch->focus->surface, &sx, &sy, &sw, &sh );
+         sx= touch->focus->geometry.x;
+         sy= touch->focus->geometry.y;
       }
 
       xFixed= wl_fixed_from_int( x-sx );
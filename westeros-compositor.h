@@ -203,6 +203,17 @@ bool WstCompositorSetDisplayName( WstCompositor *wctx, const char *displayName )
  */
 bool WstCompositorSetFrameRate( WstCompositor *wctx, unsigned int frameRate );
 
+/**
+ * WstCompositorSetHiddenFrameRate
+ *
+ * Specify the rate in frames per second (fps) at which frame callbacks
+ * are delivered to surfaces that are hidden, fully occluded, or off-screen.
+ * Surfaces that are part of the composited output receive frame callbacks
+ * at the compositor frame rate.  The default is 1 fps.  This can be 
+ * called at any time.
+ */
+bool WstCompositorSetHiddenFrameRate( WstCompositor *wctx, unsigned int frameRate );
+
 /**
  * WstCompositorSetNativeWindow
  *
@@ -259,6 +270,17 @@ bool WstCompositorSetIsRepeater( WstCompositor *wctx, bool isRepeater );
  */
 bool WstCompositorSetIsEmbedded( WstCompositor *wctx, bool isEmbedded );
 
+/**
+ * WstCompositorSetUseRenderThread
+ *
+ * Specify if the compositor should compose and swap its output on a
+ * dedicated render thread.  Client requests are then processed while a
+ * frame is being rendered rather than waiting for the swap to complete.
+ * This applies only to a compositor that is not nested, repeating or
+ * embedded, and must be called prior to WstCompositorStart.
+ */
+bool WstCompositorSetUseRenderThread( WstCompositor *wctx, bool useRenderThread );
+
 /**
  * WstCompositorSetVpcBridge
  *
@@ -143,9 +143,11 @@ static void showUsage()
    printf("where [options] are:\n" );
    printf("  --renderer <module> : renderer module to use\n" );
    printf("  --framerate <rate> : frame rate in fps\n" );
+   printf("  --hiddenFramerate <rate> : frame callback rate in fps for hidden or occluded surfaces\n" );
    printf("  --display <name> : name of wayland display created by compositor\n" );
    printf("  --embedded : operate as an embedded compositor\n" );
    printf("  --repeater : operate as a repeating nested compositor\n" );
+   printf("  --renderThread : compose and swap output on a dedicated render thread\n" );
    printf("  --nested : operate as a nested compositor\n" );
    printf("  --nestedDisplay <name> : name of wayland display to connect to for nested composition\n" );
    printf("  --nestedInput : register nested input listeners\n" ); 
@@ -2139,6 +2141,25 @@ int main( int argc, char** argv)
          }
       }
       else
+      if ( (len == 17) && !strncmp( (const char*)argv[i], "--hiddenFramerate", len) )
+      {
+         if ( i < argc-1 )
+         {
+            int frameRate;
+            
+            ++i;
+            frameRate= atoi(argv[i]);
+            if ( frameRate > 0 )
+            {
+               if ( !WstCompositorSetHiddenFrameRate( wctx, frameRate ) )
+               {
+                  error= true;
+                  break;
+               }
+            }
+         }
+      }
+      else
       if ( (len == 9) && !strncmp( (const char*)argv[i], "--display", len) )
       {
          if ( i < argc-1)
@@ -2174,6 +2195,15 @@ int main( int argc, char** argv)
          repeater= true;
       }
       else
+      if ( (len == 14) && !strncmp( (const char*)argv[i], "--renderThread", len) )
+      {
+         if ( !WstCompositorSetUseRenderThread( wctx, true) )
+         {
+            error= true;
+            break;
+         }
+      }
+      else
       if ( (len == 8) && !strncmp( (const char*)argv[i], "--nested", len) )
       {
          if ( !WstCompositorSetIsNested( wctx, true) )
@@ -60,6 +60,12 @@
 
 #include <vector>
 
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //#define WST_DEBUG
 
 #ifdef WST_DEBUG
@@ -75,6 +81,10 @@
 #define DEFAULT_SURFACE_WIDTH (0)
 #define DEFAULT_SURFACE_HEIGHT (0)
 
+#ifndef GL_UNPACK_ROW_LENGTH_EXT
+#define GL_UNPACK_ROW_LENGTH_EXT (0x0CF2)
+#endif
+
 #ifndef DRM_FORMAT_R8
 #define DRM_FORMAT_R8 (0x20203852)
 #endif
@@ -107,6 +117,23 @@ static const char *fShaderText =
   "  gl_FragColor= texture2D(texture, txv) * alpha;\n"
   "}\n";
 
+/*
+ * Variant of fShaderText used for shm buffers whose byte order does not match
+ * a format GL can sample directly.  It is compiled with one of the
+ * fShaderTextConvertDefine prefixes which defines the CONVERT swizzle.
+ */
+static const char *fShaderTextConvert =
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "uniform float alpha;\n"
+  "varying vec2 txv;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor= CONVERT(texture2D(texture, txv)) * alpha;\n"
+  "}\n";
+
 static const char *vShaderText =
   "uniform vec2 resolution;\n"
   "uniform mat4 matrix;\n"
@@ -202,6 +229,27 @@ typedef enum _WstShaderType
    WstShaderType_external
 } WstShaderType;
 
+typedef enum _WstPixelConvert
+{
+   WstPixelConvert_none= 0,
+   WstPixelConvert_fillAlpha= (1<<0),
+   WstPixelConvert_swapRB= (1<<1),
+   WstPixelConvert_rotate= (1<<2)
+} WstPixelConvert;
+
+#define MAX_PIXEL_CONVERT (6)
+
+// Indexed by WstPixelConvert flags: swapRB takes BGRA to RGBA, rotate takes ARGB to RGBA
+static const char *fShaderTextConvertDefine[MAX_PIXEL_CONVERT] =
+{
+  "#define CONVERT(c) (c)\n",
+  "#define CONVERT(c) vec4((c).rgb, 1.0)\n",
+  "#define CONVERT(c) ((c).bgra)\n",
+  "#define CONVERT(c) vec4((c).bgr, 1.0)\n",
+  "#define CONVERT(c) ((c).gbar)\n",
+  "#define CONVERT(c) vec4((c).gba, 1.0)\n"
+};
+
 typedef struct _WstShader
 {
    bool isYUV;
@@ -224,6 +272,9 @@ static bool emitFPS= false;
 
 #define MAX_TEXTURES (2)
 
+// Maximum number of opaque areas tested against when culling hidden surfaces
+#define MAX_OCCLUDERS (8)
+
 struct _WstRenderSurface
 {
    int textureCount;
@@ -242,9 +293,26 @@ struct _WstRenderSurface
    bool memDirty;
    int memWidth;
    int memHeight;
+   int memStride;
    GLint memFormatGL;
    GLenum memType;
+   int memDirtyY0;
+   int memDirtyY1;
+   bool memTextureValid;
+   int memConvert;
+   bool memConverted;
+   int drawConvert;
+   bool bufferConsumed;
+
+   bool haveCommitDamage;
+   WstRect commitDamage;
    
+   bool formatOpaque;
+   bool haveOpaqueRect;
+   WstRect opaqueRect;
+   bool occluded;
+   bool drawOpaque;
+
    int x;
    int y;
    int width;
@@ -288,6 +356,7 @@ typedef struct _WstRendererEMB
    bool haveDmaBufImport;
    bool haveDmaBufImportModifiers;
    bool haveExternalImage;
+   bool haveUnpackSubimage;
 
    #if defined (WESTEROS_HAVE_WAYLAND_EGL)
    bool haveWaylandEGL;
@@ -303,6 +372,8 @@ typedef struct _WstRendererEMB
    WstShader *textureShader;
    WstShader *textureShaderYUV;
    WstShader *textureShaderExternal;
+   WstShader *textureShaderConvert[MAX_PIXEL_CONVERT];
+   bool haveShaderConvert;
    
    std::vector<WstRenderSurface*> surfaces;
    std::vector<GLuint> deadTextures;
@@ -336,7 +407,13 @@ static void wstRendererEMBCommitDispmanx( WstRendererEMB *renderer, WstRenderSur
                                          EGLint format, int bufferWidth, int bufferHeight );
 #endif                                         
 static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurface *surface );
-static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shaderType );
+static bool wstRendererEMBGetOpaqueRect( WstRenderSurface *surface, WstRect *rect );
+static void wstRendererEMBComputeOcclusion( WstRendererEMB *renderer );
+static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shaderType, int convert );
+static void wstRendererEMBConvertPixels( unsigned char *mem, int stride, int width, int y0, int y1, int convert );
+static bool wstRendererEMBUploadShm( WstRendererEMB *renderer, WstRenderSurface *surface, unsigned char *data,
+                                  int width, int height, int stride, int bpp, GLint formatGL, GLenum type, int convert );
+static void wstRendererEMBConvertSurfaces( WstRendererEMB *renderer );
 static void wstRendererEMBDestroyShader( WstShader *shader );
 static void wstRendererEMBShaderDraw( WstShader *shader,
                                       int width, int height, float* matrix, float alpha,
@@ -369,6 +446,7 @@ static WstRendererEMB* wstRendererEMBCreate( WstRenderer *renderer )
 
       rendererEMB->outputWidth= renderer->outputWidth;
       rendererEMB->outputHeight= renderer->outputHeight;
+      rendererEMB->haveShaderConvert= true;
       
       rendererEMB->renderer= renderer;
       rendererEMB->surfaces= std::vector<WstRenderSurface*>();
@@ -467,11 +545,16 @@ static WstRendererEMB* wstRendererEMBCreate( WstRenderer *renderer )
             rendererEMB->haveExternalImage= true;
          }
          #endif
+         if ( strstr( extensions, "GL_EXT_unpack_subimage" ) )
+         {
+            rendererEMB->haveUnpackSubimage= true;
+         }
       }
       printf("have wayland-egl: %d\n", rendererEMB->haveWaylandEGL );
       printf("have dmabuf import: %d\n", rendererEMB->haveDmaBufImport );
       printf("have dmabuf import modifiers: %d\n", rendererEMB->haveDmaBufImportModifiers );
       printf("have external image: %d\n", rendererEMB->haveExternalImage );
+      printf("have unpack subimage: %d\n", rendererEMB->haveUnpackSubimage );
       #endif
    }
 
@@ -504,6 +587,14 @@ static void wstRendererEMBDestroy( WstRendererEMB *renderer )
          wstRendererEMBDestroyShader( renderer->textureShaderYUV );
          renderer->textureShaderYUV= 0;
       }
+      for( int i= 0; i < MAX_PIXEL_CONVERT; ++i )
+      {
+         if ( renderer->textureShaderConvert[i] )
+         {
+            wstRendererEMBDestroyShader( renderer->textureShaderConvert[i] );
+            renderer->textureShaderConvert[i]= 0;
+         }
+      }
       #if defined (WESTEROS_PLATFORM_EMBEDDED)
       if ( renderer->glCtx )
       {
@@ -604,6 +695,11 @@ static void wstRendererEMBFlushSurface( WstRendererEMB *renderer, WstRenderSurfa
            free( surface->mem );
            surface->mem= 0;
         }
+        surface->memDirty= false;
+        surface->memTextureValid= false;
+        surface->memConvert= WstPixelConvert_none;
+        surface->memConverted= false;
+        surface->drawConvert= WstPixelConvert_none;
     }
 }
 
@@ -806,12 +902,10 @@ static void wstRendererEMBPrepareResource( WstRendererEMB *renderer, WstRenderSu
 static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface *surface, struct wl_resource *resource )
 {
    struct wl_shm_buffer *shmBuffer;
-   int width, height, stride;
+   int width, height, stride, memStride, bpp;
    GLint formatGL;
    GLenum type;
-   bool transformPixelsA= false;
-   bool transformPixelsB= false;
-   bool fillAlpha= false;
+   int convert= WstPixelConvert_none;
    void *data;
 
    shmBuffer= wl_shm_buffer_get( resource );
@@ -831,7 +925,7 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
          case WL_SHM_FORMAT_ARGB8888:
             #ifdef BIG_ENDIAN_CPU
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #else
                #if defined (WESTEROS_HAVE_WAYLAND_EGL)
                if ( renderer->haveWaylandEGL )
@@ -841,13 +935,13 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #endif
             type= GL_UNSIGNED_BYTE;
@@ -855,7 +949,7 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
          case WL_SHM_FORMAT_XRGB8888:
             #ifdef BIG_ENDIAN_CPU
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #else
                #if defined (WESTEROS_HAVE_WAYLAND_EGL)
                if ( renderer->haveWaylandEGL )
@@ -865,17 +959,17 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #endif
             type= GL_UNSIGNED_BYTE;
-            fillAlpha= true;
+            convert |= WstPixelConvert_fillAlpha;
             break;
          case WL_SHM_FORMAT_BGRA8888:
             #ifdef BIG_ENDIAN_CPU
@@ -887,17 +981,17 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #else
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #endif
             type= GL_UNSIGNED_BYTE;
             break;
@@ -911,20 +1005,20 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #else
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #endif
             type= GL_UNSIGNED_BYTE;
-            fillAlpha= true;
+            convert |= WstPixelConvert_fillAlpha;
             break;
          case WL_SHM_FORMAT_RGB565:
             formatGL= GL_RGB;
@@ -941,92 +1035,348 @@ static void wstRendererEMBCommitShm( WstRendererEMB *renderer, WstRenderSurface
 
       if ( formatGL != GL_NONE )
       {
+         surface->formatOpaque= ((convert & WstPixelConvert_fillAlpha) || (type == GL_UNSIGNED_SHORT_5_6_5));
+
+         // Rows are held tightly packed since GLES2 has no GL_UNPACK_ROW_LENGTH
+         bpp= ((type == GL_UNSIGNED_BYTE) ? 4 : 2);
+         memStride= ((width*bpp)+3)&~3;
+
          wl_shm_buffer_begin_access(shmBuffer);
          data= wl_shm_buffer_get_data(shmBuffer);
          
-         if ( surface->mem &&
-              (
-                (surface->memWidth != width) ||
-                (surface->memHeight != height) ||
-                (surface->memFormatGL != formatGL) ||
-                (surface->memType != type)
-              )
-            )
+         if ( wstRendererEMBUploadShm( renderer, surface, (unsigned char*)data, width, height, stride, bpp, formatGL, type, convert ) )
          {
-            free( surface->mem );
-            surface->mem= 0;
+            surface->bufferConsumed= true;
          }
-         if ( !surface->mem )
-         {
-            surface->mem= (unsigned char*)malloc( stride*height );
-         }
-         if ( surface->mem )
+         else
          {
-            memcpy( surface->mem, data, stride*height );
-            
-            if ( transformPixelsA )
+            if ( surface->mem &&
+                 (
+                   (surface->memWidth != width) ||
+                   (surface->memHeight != height) ||
+                   (surface->memFormatGL != formatGL) ||
+                   (surface->memType != type) ||
+                   (surface->memConvert != convert)
+                 )
+               )
             {
-               // transform ARGB to RGBA
-               unsigned int pixel, alpha;
-               unsigned int *pixdata= (unsigned int*)surface->mem;
-               for( int y= 0; y < height; ++y )
-               {
-                  for( int x= 0; x < width; ++x )
-                  {
-                     pixel= pixdata[y*width+x];
-                     alpha= (fillAlpha ? 0xFF : (pixel>>24));
-                     pixel= (pixel<<8)|alpha;
-                     pixdata[y*width+x]= pixel;
-                  }
-               }
+               free( surface->mem );
+               surface->mem= 0;
             }
-            else if ( transformPixelsB )
+            int y0= 0;
+            int y1= height;
+            if ( !surface->mem )
             {
-               // transform BGRA to RGBA
-               unsigned char *pixdata= (unsigned char*)surface->mem;
-               for( int y= 0; y < height; ++y )
-               {
-                  for( int x= 0; x < width; ++x )
-                  {
-                     if ( fillAlpha )
-                     {
-                        pixdata[y*width*4 + x*4 +3]= 0xFF;
-                     }
-                     unsigned char temp= pixdata[y*width*4 + x*4 +2];
-                     pixdata[y*width*4 + x*4 +2]= pixdata[y*width*4 + x*4 +0];
-                     pixdata[y*width*4 + x*4 +0]= temp;
-                  }
-               }
+               surface->mem= (unsigned char*)malloc( memStride*height );
+               surface->memTextureValid= false;
             }
-            else if ( fillAlpha )
+            else if ( surface->haveCommitDamage )
             {
-               if ( fillAlpha )
+               // Only the damaged rows differ from the content we already hold
+               y0= surface->commitDamage.y;
+               y1= surface->commitDamage.y+surface->commitDamage.height;
+               if ( y1 > height ) y1= height;
+               if ( y0 > y1 ) y0= y1;
+            }
+            if ( surface->mem )
+            {
+               unsigned char *src= ((unsigned char*)data)+y0*stride;
+               unsigned char *dest= surface->mem+y0*memStride;
+               if ( stride == memStride )
                {
-                  unsigned char *pixdata= (unsigned char*)surface->mem;
-                  for( int y= 0; y < height; ++y )
+                  memcpy( dest, src, (y1-y0)*stride );
+               }
+               else
+               {
+                  for( int y= y0; y < y1; ++y )
                   {
-                     for( int x= 0; x < width; ++x )
-                     {
-                        pixdata[y*width*4 + x*4 +3]= 0xFF;
-                     }
+                     memcpy( dest, src, width*bpp );
+                     src += stride;
+                     dest += memStride;
                   }
                }
+
+               // Byte order conversion is normally done by the fragment shader at draw time
+               surface->memConverted= false;
+               if ( (convert != WstPixelConvert_none) && !renderer->haveShaderConvert )
+               {
+                  wstRendererEMBConvertPixels( surface->mem, memStride, width, y0, y1, convert );
+                  surface->memConverted= true;
+               }
+               surface->drawConvert= (surface->memConverted ? (int)WstPixelConvert_none : convert);
+               surface->bufferConsumed= true;
+
+               if ( surface->memDirty )
+               {
+                  if ( y0 < surface->memDirtyY0 ) surface->memDirtyY0= y0;
+                  if ( y1 > surface->memDirtyY1 ) surface->memDirtyY1= y1;
+               }
+               else
+               {
+                  surface->memDirtyY0= y0;
+                  surface->memDirtyY1= y1;
+               }
+
+               surface->bufferWidth= width;
+               surface->bufferHeight= height;
+               surface->memWidth= width;
+               surface->memHeight= height;
+               surface->memStride= memStride;
+               surface->memFormatGL= formatGL;
+               surface->memType= type;
+               surface->memConvert= convert;
+               surface->memDirty= true;
             }
-            
-            surface->bufferWidth= width;
-            surface->bufferHeight= height;
-            surface->memWidth= width;
-            surface->memHeight= height;
-            surface->memFormatGL= formatGL;
-            surface->memType= type;
-            surface->memDirty= true;
-         }      
-         
+         }
+
          wl_shm_buffer_end_access(shmBuffer);
       }
    }
 }
 
+static bool wstRendererEMBUploadShm( WstRendererEMB *renderer, WstRenderSurface *surface, unsigned char *data,
+                                  int width, int height, int stride, int bpp, GLint formatGL, GLenum type, int convert )
+{
+   bool uploaded= false;
+   int rowLength= 0;
+   int y0, y1;
+
+   // Uploading straight from the client's buffer is only possible from the thread
+   // our context is current on, once the shaders that will draw it exist
+   if ( !renderer->textureShader ||
+        !renderer->eglContext ||
+        (eglGetCurrentContext() != renderer->eglContext) )
+   {
+      goto exit;
+   }
+
+   // The client's pixels can't be converted in place
+   if ( (convert != WstPixelConvert_none) && !renderer->haveShaderConvert )
+   {
+      goto exit;
+   }
+
+   if ( surface->externalImage )
+   {
+      goto exit;
+   }
+   #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+   if ( surface->eglImage[0] )
+   {
+      goto exit;
+   }
+   #endif
+
+   if ( stride != (((width*bpp)+3)&~3) )
+   {
+      if ( !renderer->haveUnpackSubimage || (stride & 3) )
+      {
+         goto exit;
+      }
+      rowLength= stride/bpp;
+   }
+
+   if ( surface->mem )
+   {
+      // Unless it lags the staging copy the texture can still take partial updates
+      free( surface->mem );
+      surface->mem= 0;
+      if ( surface->memDirty || surface->memConverted )
+      {
+         surface->memTextureValid= false;
+      }
+      surface->memDirty= false;
+   }
+   if ( (surface->memWidth != width) ||
+        (surface->memHeight != height) ||
+        (surface->memFormatGL != formatGL) ||
+        (surface->memType != type) ||
+        (surface->memConvert != convert) )
+   {
+      surface->memTextureValid= false;
+   }
+   if ( surface->textureId[0] == GL_NONE )
+   {
+      glGenTextures(1, &surface->textureId[0] );
+      surface->memTextureValid= false;
+   }
+
+   y0= 0;
+   y1= height;
+   if ( surface->memTextureValid && surface->haveCommitDamage )
+   {
+      y0= surface->commitDamage.y;
+      y1= surface->commitDamage.y+surface->commitDamage.height;
+      if ( y1 > height ) y1= height;
+      if ( y0 > y1 ) y0= y1;
+   }
+
+   glActiveTexture(GL_TEXTURE1);
+   glBindTexture(GL_TEXTURE_2D, surface->textureId[0] );
+   if ( rowLength )
+   {
+      glPixelStorei( GL_UNPACK_ROW_LENGTH_EXT, rowLength );
+   }
+   if ( surface->memTextureValid )
+   {
+      if ( y1 > y0 )
+      {
+         glTexSubImage2D( GL_TEXTURE_2D,
+                          0, //level
+                          0, //xoffset
+                          y0, //yoffset
+                          width,
+                          y1-y0,
+                          formatGL, //format
+                          type,
+                          data+y0*stride );
+      }
+   }
+   else
+   {
+      glTexImage2D( GL_TEXTURE_2D,
+                    0, //level
+                    formatGL, //internalFormat
+                    width,
+                    height,
+                    0, // border
+                    formatGL, //format
+                    type,
+                    data );
+      surface->memTextureValid= true;
+   }
+   if ( rowLength )
+   {
+      glPixelStorei( GL_UNPACK_ROW_LENGTH_EXT, 0 );
+   }
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+   surface->bufferWidth= width;
+   surface->bufferHeight= height;
+   surface->memWidth= width;
+   surface->memHeight= height;
+   surface->memFormatGL= formatGL;
+   surface->memType= type;
+   surface->memConvert= convert;
+   surface->memConverted= false;
+   surface->drawConvert= convert;
+
+   uploaded= true;
+
+exit:
+
+   return uploaded;
+}
+
+static void wstRendererEMBConvertPixels( unsigned char *mem, int stride, int width, int y0, int y1, int convert )
+{
+   for( int y= y0; y < y1; ++y )
+   {
+      unsigned char *row= mem+y*stride;
+      int x= 0;
+
+      #if defined (__ARM_NEON) || defined (__ARM_NEON__)
+      for( ; x+16 <= width; x += 16 )
+      {
+         uint8x16x4_t pix= vld4q_u8( row+x*4 );
+         uint8x16_t temp;
+         if ( convert & WstPixelConvert_swapRB )
+         {
+            temp= pix.val[0];
+            pix.val[0]= pix.val[2];
+            pix.val[2]= temp;
+         }
+         else if ( convert & WstPixelConvert_rotate )
+         {
+            temp= pix.val[0];
+            pix.val[0]= pix.val[1];
+            pix.val[1]= pix.val[2];
+            pix.val[2]= pix.val[3];
+            pix.val[3]= temp;
+         }
+         if ( convert & WstPixelConvert_fillAlpha )
+         {
+            pix.val[3]= vdupq_n_u8( 0xFF );
+         }
+         vst4q_u8( row+x*4, pix );
+      }
+      #elif defined (__SSE2__) && !defined (BIG_ENDIAN_CPU)
+      {
+         const __m128i maskGA= _mm_set1_epi32( (int)0xFF00FF00 );
+         const __m128i maskLow= _mm_set1_epi32( 0x000000FF );
+         const __m128i maskAlpha= _mm_set1_epi32( (int)0xFF000000 );
+         for( ; x+4 <= width; x += 4 )
+         {
+            __m128i pix= _mm_loadu_si128( (__m128i*)(row+x*4) );
+            if ( convert & WstPixelConvert_swapRB )
+            {
+               pix= _mm_or_si128( _mm_and_si128( pix, maskGA ),
+                                  _mm_or_si128( _mm_and_si128( _mm_srli_epi32( pix, 16 ), maskLow ),
+                                                _mm_slli_epi32( _mm_and_si128( pix, maskLow ), 16 ) ) );
+            }
+            else if ( convert & WstPixelConvert_rotate )
+            {
+               pix= _mm_or_si128( _mm_srli_epi32( pix, 8 ), _mm_slli_epi32( pix, 24 ) );
+            }
+            if ( convert & WstPixelConvert_fillAlpha )
+            {
+               pix= _mm_or_si128( pix, maskAlpha );
+            }
+            _mm_storeu_si128( (__m128i*)(row+x*4), pix );
+         }
+      }
+      #endif
+
+      // Scalar reference path: also handles the tail of each row
+      for( ; x < width; ++x )
+      {
+         unsigned char *pix= row+x*4;
+         unsigned char temp;
+         if ( convert & WstPixelConvert_swapRB )
+         {
+            temp= pix[0];
+            pix[0]= pix[2];
+            pix[2]= temp;
+         }
+         else if ( convert & WstPixelConvert_rotate )
+         {
+            temp= pix[0];
+            pix[0]= pix[1];
+            pix[1]= pix[2];
+            pix[2]= pix[3];
+            pix[3]= temp;
+         }
+         if ( convert & WstPixelConvert_fillAlpha )
+         {
+            pix[3]= 0xFF;
+         }
+      }
+   }
+}
+
+static void wstRendererEMBConvertSurfaces( WstRendererEMB *renderer )
+{
+   for ( std::vector<WstRenderSurface*>::iterator it= renderer->surfaces.begin();
+         it != renderer->surfaces.end();
+         ++it )
+   {
+      WstRenderSurface *surface= (*it);
+      if ( surface->mem && (surface->memConvert != WstPixelConvert_none) && !surface->memConverted )
+      {
+         wstRendererEMBConvertPixels( surface->mem, surface->memStride, surface->memWidth,
+                                   0, surface->memHeight, surface->memConvert );
+         surface->memConverted= true;
+         surface->drawConvert= WstPixelConvert_none;
+         surface->memDirty= true;
+         surface->memDirtyY0= 0;
+         surface->memDirtyY1= surface->memHeight;
+      }
+   }
+}
+
 #if defined (WESTEROS_HAVE_WAYLAND_EGL)
 static void wstRendererEMBCommitWaylandEGL( WstRendererEMB *renderer, WstRenderSurface *surface, 
                                            struct wl_resource *resource, EGLint format )
@@ -1052,6 +1402,8 @@ static void wstRendererEMBCommitWaylandEGL( WstRendererEMB *renderer, WstRenderS
       bufferHeight= value;
    }                                                        
    
+   surface->formatOpaque= (format != EGL_TEXTURE_RGBA);
+
    #if defined (WESTEROS_PLATFORM_RPI)
    /* 
     * The Userland wayland-egl implementation used on RPI isn't complete in that it does not
@@ -1505,6 +1857,7 @@ static void wstRendererEMBCommitDispmanx( WstRendererEMB *renderer, WstRenderSur
                if ( !surface->mem )
                {
                   surface->mem= (unsigned char*)malloc( stride*bufferHeight );
+                  surface->memTextureValid= false;
                }
                if ( surface->mem )
                {
@@ -1526,8 +1879,13 @@ static void wstRendererEMBCommitDispmanx( WstRendererEMB *renderer, WstRenderSur
                      surface->bufferHeight= bufferHeight;
                      surface->memWidth= bufferWidth;
                      surface->memHeight= bufferHeight;
+                     surface->memStride= stride;
                      surface->memFormatGL= formatGL;
                      surface->memType= type;
+                     surface->memConvert= WstPixelConvert_none;
+                     surface->memConverted= false;
+                     surface->memDirtyY0= 0;
+                     surface->memDirtyY1= bufferHeight;
                      surface->memDirty= true;
                   }
                }            
@@ -1563,6 +1921,10 @@ static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurf
          if ( surface->textureId[i] == GL_NONE )
          {
             glGenTextures(1, &surface->textureId[i] );
+            if ( i == 0 )
+            {
+               surface->memTextureValid= false;
+            }
          }
        
          /* Bind the egl image as a texture */
@@ -1583,6 +1945,7 @@ static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurf
             #ifdef GL_OES_EGL_image_external
             }
             #endif
+            surface->memTextureValid= false;
          }
          else 
          #endif
@@ -1590,15 +1953,34 @@ static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurf
          {
             if ( surface->mem )
             {
-               glTexImage2D( GL_TEXTURE_2D,
-                             0, //level
-                             surface->memFormatGL, //internalFormat
-                             surface->memWidth,
-                             surface->memHeight,
-                             0, // border
-                             surface->memFormatGL, //format
-                             surface->memType,
-                             surface->mem );
+               if ( surface->memTextureValid )
+               {
+                  if ( surface->memDirtyY1 > surface->memDirtyY0 )
+                  {
+                     glTexSubImage2D( GL_TEXTURE_2D,
+                                      0, //level
+                                      0, //xoffset
+                                      surface->memDirtyY0, //yoffset
+                                      surface->memWidth,
+                                      surface->memDirtyY1-surface->memDirtyY0,
+                                      surface->memFormatGL, //format
+                                      surface->memType,
+                                      surface->mem+surface->memDirtyY0*surface->memStride );
+                  }
+               }
+               else
+               {
+                  glTexImage2D( GL_TEXTURE_2D,
+                                0, //level
+                                surface->memFormatGL, //internalFormat
+                                surface->memWidth,
+                                surface->memHeight,
+                                0, // border
+                                surface->memFormatGL, //format
+                                surface->memType,
+                                surface->mem );
+                  surface->memTextureValid= true;
+               }
                surface->memDirty= false;
             }
          }
@@ -1681,7 +2063,16 @@ static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurf
 
    if ( surface->textureCount == 1 )
    {
-      wstRendererEMBShaderDraw( surface->externalImage ? renderer->textureShaderExternal : renderer->textureShader,
+      WstShader *shader= renderer->textureShader;
+      if ( surface->externalImage )
+      {
+         shader= renderer->textureShaderExternal;
+      }
+      else if ( surface->drawConvert && renderer->textureShaderConvert[surface->drawConvert] )
+      {
+         shader= renderer->textureShaderConvert[surface->drawConvert];
+      }
+      wstRendererEMBShaderDraw( shader,
                                 resW,
                                 resH,
                                 (float*)matrix,
@@ -1707,14 +2098,145 @@ static void wstRendererEMBRenderSurface( WstRendererEMB *renderer, WstRenderSurf
    }
 }
 
-static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shaderType )
+static bool wstRendererEMBGetOpaqueRect( WstRenderSurface *surface, WstRect *rect )
+{
+   long long ox0, oy0, ox1, oy1;
+   long long bw= surface->bufferWidth;
+   long long bh= surface->bufferHeight;
+
+   rect->x= surface->x;
+   rect->y= surface->y;
+   rect->width= surface->width;
+   rect->height= surface->height;
+
+   if ( surface->formatOpaque || (surface->textureCount == 2) )
+   {
+      return true;
+   }
+
+   // A cropped surface shows only part of its buffer so the region can't be mapped directly
+   if ( !surface->haveOpaqueRect || surface->haveCrop || (bw <= 0) || (bh <= 0) )
+   {
+      return false;
+   }
+
+   ox0= surface->opaqueRect.x;
+   oy0= surface->opaqueRect.y;
+   ox1= ox0+surface->opaqueRect.width;
+   oy1= oy0+surface->opaqueRect.height;
+   if ( ox0 < 0 ) ox0= 0;
+   if ( oy0 < 0 ) oy0= 0;
+   if ( ox1 > bw ) ox1= bw;
+   if ( oy1 > bh ) oy1= bh;
+   if ( (ox1 <= ox0) || (oy1 <= oy0) )
+   {
+      return false;
+   }
+   if ( (ox0 == 0) && (oy0 == 0) && (ox1 == bw) && (oy1 == bh) )
+   {
+      return true;
+   }
+   if ( surface->invertedY )
+   {
+      long long temp= oy0;
+      oy0= bh-oy1;
+      oy1= bh-temp;
+   }
+
+   // Round inwards so partially covered output pixels are never treated as opaque
+   rect->x= surface->x+(int)((ox0*surface->width+bw-1)/bw);
+   rect->y= surface->y+(int)((oy0*surface->height+bh-1)/bh);
+   rect->width= surface->x+(int)((ox1*surface->width)/bw)-rect->x;
+   rect->height= surface->y+(int)((oy1*surface->height)/bh)-rect->y;
+
+   return ((rect->width > 0) && (rect->height > 0));
+}
+
+static void wstRendererEMBComputeOcclusion( WstRendererEMB *renderer )
+{
+   WstRect occluders[MAX_OCCLUDERS];
+   int occluderCount= 0;
+   bool canCull;
+
+   // With a global alpha applied every surface is translucent over the host content
+   canCull= !((renderer->renderer->hints & WstHints_applyTransform) && (renderer->renderer->alpha < 1.0f));
+
+   /*
+    * Walk surfaces from top to bottom collecting the areas covered by opaque
+    * content.  All surfaces share the same transform so the test can be done
+    * in surface co-ordinates.
+    */
+   for( int i= renderer->surfaces.size()-1; i >= 0; --i )
+   {
+      WstRenderSurface *surface= renderer->surfaces[i];
+      WstRect opaque;
+
+      surface->occluded= false;
+      surface->drawOpaque= false;
+
+      if ( !surface->sizeOverride )
+      {
+         surface->width= surface->bufferWidth;
+         surface->height= surface->bufferHeight;
+      }
+
+      if ( !canCull ||
+           !surface->visible ||
+           (surface->width <= 0) ||
+           (surface->height <= 0) ||
+           !(
+              #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+              surface->eglImage[0] ||
+              #endif
+              surface->memDirty ||
+              (surface->textureId[0] != GL_NONE)
+            )
+         )
+      {
+         continue;
+      }
+
+      for( int j= 0; j < occluderCount; ++j )
+      {
+         if ( (surface->x >= occluders[j].x) &&
+              (surface->y >= occluders[j].y) &&
+              (surface->x+surface->width <= occluders[j].x+occluders[j].width) &&
+              (surface->y+surface->height <= occluders[j].y+occluders[j].height) )
+         {
+            surface->occluded= true;
+            break;
+         }
+      }
+      if ( surface->occluded || (surface->opacity < 1.0f) )
+      {
+         continue;
+      }
+
+      if ( wstRendererEMBGetOpaqueRect( surface, &opaque ) )
+      {
+         surface->drawOpaque= ( (opaque.x == surface->x) &&
+                                (opaque.y == surface->y) &&
+                                (opaque.width == surface->width) &&
+                                (opaque.height == surface->height) );
+         if ( occluderCount < MAX_OCCLUDERS )
+         {
+            occluders[occluderCount++]= opaque;
+         }
+      }
+   }
+}
+
+static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shaderType, int convert )
 {
    WstShader *shaderNew= 0;
    GLuint type;
    const char *typeName= 0, *src= 0;
+   const char *srcList[2];
+   int srcCount;
    GLint shader, status, len;
    bool yuv= (shaderType == WstShaderType_yuv);
    bool noalpha;
+   bool valid= false;
 
    shaderNew= (WstShader*)calloc( 1, sizeof(WstShader));
    if ( !shaderNew )
@@ -1748,6 +2270,11 @@ static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shad
          {
             src= fShaderTextExternal;
          }
+         else if ( convert != WstPixelConvert_none )
+         {
+            src= fShaderTextConvert;
+            noalpha= false;
+         }
          else
          {
             src= fShaderText;
@@ -1760,13 +2287,19 @@ static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shad
          typeName= "vertex";
          src= ( yuv ? vShaderTextYUV : vShaderText );
       }
+      srcCount= 0;
+      if ( (i == 0) && (src == fShaderTextConvert) )
+      {
+         srcList[srcCount++]= fShaderTextConvertDefine[convert];
+      }
+      srcList[srcCount++]= src;
       shader= glCreateShader(type);
       if ( !shader )
       {
          printf("wstRendererEMBCreateShader: glCreateShader (%s) error: %d\n", typeName, glGetError());
          goto exit;
       }
-      glShaderSource(shader, 1, &src, NULL );
+      glShaderSource(shader, srcCount, srcList, NULL );
       glCompileShader(shader);
       glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
       if ( !status )
@@ -1848,8 +2381,17 @@ static WstShader* wstRendererEMBCreateShader( WstRendererEMB *renderer, int shad
       }
    }
 
+   valid= true;
+
 exit:
 
+   if ( !valid && (convert != WstPixelConvert_none) )
+   {
+      // Conversion variants are optional: let the caller fall back to the cpu
+      wstRendererEMBDestroyShader( shaderNew );
+      shaderNew= 0;
+   }
+
    return shaderNew;
 }
 
@@ -2021,15 +2563,32 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
 
    if ( !rendererEMB->textureShader )
    {
-      rendererEMB->textureShader= wstRendererEMBCreateShader( rendererEMB, WstShaderType_rgb );
-      rendererEMB->textureShaderYUV= wstRendererEMBCreateShader( rendererEMB, WstShaderType_yuv );
+      rendererEMB->textureShader= wstRendererEMBCreateShader( rendererEMB, WstShaderType_rgb, WstPixelConvert_none );
+      rendererEMB->textureShaderYUV= wstRendererEMBCreateShader( rendererEMB, WstShaderType_yuv, WstPixelConvert_none );
       if ( rendererEMB->haveExternalImage )
       {
-         rendererEMB->textureShaderExternal= wstRendererEMBCreateShader( rendererEMB, WstShaderType_external );
+         rendererEMB->textureShaderExternal= wstRendererEMBCreateShader( rendererEMB, WstShaderType_external, WstPixelConvert_none );
+      }
+      for( int i= WstPixelConvert_none+1; i < MAX_PIXEL_CONVERT; ++i )
+      {
+         rendererEMB->textureShaderConvert[i]= wstRendererEMBCreateShader( rendererEMB, WstShaderType_rgb, i );
+         if ( !rendererEMB->textureShaderConvert[i] )
+         {
+            rendererEMB->haveShaderConvert= false;
+         }
+      }
+      if ( !rendererEMB->haveShaderConvert )
+      {
+         printf("wstRendererEMBUpdateScene: no format conversion shaders: converting shm pixels on the cpu\n");
+         wstRendererEMBConvertSurfaces( rendererEMB );
       }
       rendererEMB->eglContext= eglGetCurrentContext();
    }
 
+   wstRendererEMBComputeOcclusion( rendererEMB );
+
+   GLboolean blendEnabled= glIsEnabled( GL_BLEND );
+
    /*
     * Render surfaces from bottom to top
     */   
@@ -2048,7 +2607,20 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
           )
         )
       {
-         wstRendererEMBRenderSurface( rendererEMB, surface );
+         if ( surface->occluded )
+         {
+            continue;
+         }
+         if ( surface->drawOpaque && blendEnabled )
+         {
+            glDisable( GL_BLEND );
+            wstRendererEMBRenderSurface( rendererEMB, surface );
+            glEnable( GL_BLEND );
+         }
+         else
+         {
+            wstRendererEMBRenderSurface( rendererEMB, surface );
+         }
       }
    }
 
@@ -2132,6 +2704,9 @@ static void wstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *s
 
    if ( resource )
    {
+      surface->formatOpaque= false;
+      surface->drawConvert= WstPixelConvert_none;
+      surface->bufferConsumed= false;
       if ( wl_shm_buffer_get( resource ) )
       {
          wstRendererEMBCommitShm( rendererEMB, surface, resource );
@@ -2169,6 +2744,50 @@ static void wstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *s
    }
 }
 
+static void wstRendererSurfaceSetDamage( WstRenderer *renderer, WstRenderSurface *surface, WstRect *damage )
+{
+   WstRendererEMB *rendererEMB= (WstRendererEMB*)renderer->renderer;
+
+   if ( surface )
+   {
+      if ( damage )
+      {
+         surface->haveCommitDamage= true;
+         surface->commitDamage= *damage;
+      }
+      else
+      {
+         surface->haveCommitDamage= false;
+      }
+      if ( rendererEMB->rendererFast && rendererEMB->rendererFast->surfaceSetDamage && surface->surfaceFast )
+      {
+         rendererEMB->rendererFast->surfaceSetDamage( rendererEMB->rendererFast, surface->surfaceFast, damage );
+      }
+   }
+}
+
+static void wstRendererSurfaceSetOpaqueRegion( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects )
+{
+   long long area, maxArea= 0;
+   WST_UNUSED(renderer);
+
+   if ( surface )
+   {
+      // Only the largest rectangle of the region is used for culling
+      surface->haveOpaqueRect= false;
+      for( std::vector<WstRect>::iterator it= rects.begin(); it != rects.end(); ++it )
+      {
+         area= (long long)(*it).width*(long long)(*it).height;
+         if ( area > maxArea )
+         {
+            maxArea= area;
+            surface->opaqueRect= (*it);
+            surface->haveOpaqueRect= true;
+         }
+      }
+   }
+}
+
 static void wstRendererSurfaceSetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool visible )
 {
    WstRendererEMB *rendererEMB= (WstRendererEMB*)renderer->renderer;
@@ -2208,6 +2827,40 @@ static bool wstRendererSurfaceGetVisible( WstRenderer *renderer, WstRenderSurfac
    return isVisible;   
 }
 
+static bool wstRendererSurfaceGetBufferConsumed( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed )
+{
+   WST_UNUSED(renderer);
+
+   if ( surface )
+   {
+      // Shm content is copied or uploaded during commit and never read from the client's buffer again
+      *consumed= surface->bufferConsumed;
+   }
+
+   return true;
+}
+
+static bool wstRendererSurfaceGetComposed( WstRenderer *renderer, WstRenderSurface *surface, bool *composed )
+{
+   bool isComposed= false;
+   WstRendererEMB *rendererEMB= (WstRendererEMB*)renderer->renderer;
+
+   if ( surface )
+   {
+      if ( rendererEMB->fastPathActive )
+      {
+         // Occlusion is not computed when the fast path renders the scene
+         return wstRendererSurfaceGetVisible( renderer, surface, composed );
+      }
+
+      isComposed= ( surface->visible && !surface->occluded );
+
+      *composed= isComposed;
+   }
+
+   return isComposed;
+}
+
 static void wstRendererSurfaceSetGeometry( WstRenderer *renderer, WstRenderSurface *surface, int x, int y, int width, int height )
 {
    WstRendererEMB *rendererEMB= (WstRendererEMB*)renderer->renderer;
@@ -2709,6 +3362,10 @@ int renderer_init( WstRenderer *renderer, int argc, char **argv )
       renderer->queryDmabufModifiers= wstRendererQueryDmabufModifiers;
       #endif
       renderer->holePunch= wstRendererHolePunch;
+      renderer->surfaceSetDamage= wstRendererSurfaceSetDamage;
+      renderer->surfaceSetOpaqueRegion= wstRendererSurfaceSetOpaqueRegion;
+      renderer->surfaceGetComposed= wstRendererSurfaceGetComposed;
+      renderer->surfaceGetBufferConsumed= wstRendererSurfaceGetBufferConsumed;
       
       wstRendererInitFastPath( rendererEMB );
    }
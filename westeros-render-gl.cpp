@@ -20,6 +20,8 @@
 #include <stdio.h>
 #include <memory.h>
 #include <assert.h>
+#include <dlfcn.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include <EGL/egl.h>
@@ -38,6 +40,10 @@
 
 #if defined (WESTEROS_PLATFORM_EMBEDDED)
   #include "westeros-gl.h"
+  typedef bool (*PFNWSTGLGETVBLANKINFO)( WstGLCtx *ctx, long long *vblankTime, long long *vblankInterval, unsigned int *vblankSequence );
+  typedef unsigned int (*PFNWSTGLGETSWAPCOUNT)( WstGLCtx *ctx, void *nativeWindow );
+  typedef int (*PFNWSTGLGETPRESENTATION)( WstGLCtx *ctx, void *nativeWindow, unsigned int swapCount,
+                                          long long *presentationTime, unsigned int *presentationSequence );
 #endif
 
 #if defined (WESTEROS_PLATFORM_RPI)
@@ -59,6 +65,12 @@
 
 #include <vector>
 
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //#define WST_DEBUG
 
 #ifdef WST_DEBUG
@@ -74,6 +86,10 @@
 #define DEFAULT_SURFACE_WIDTH (0)
 #define DEFAULT_SURFACE_HEIGHT (0)
 
+#ifndef GL_UNPACK_ROW_LENGTH_EXT
+#define GL_UNPACK_ROW_LENGTH_EXT (0x0CF2)
+#endif
+
 #ifndef DRM_FORMAT_R8
 #define DRM_FORMAT_R8 (0x20203852)
 #endif
@@ -106,6 +122,23 @@ static const char *fShaderText =
   "  gl_FragColor= texture2D(texture, txv) * alpha;\n"
   "}\n";
 
+/*
+ * Variant of fShaderText used for shm buffers whose byte order does not match
+ * a format GL can sample directly.  It is compiled with one of the
+ * fShaderTextConvertDefine prefixes which defines the CONVERT swizzle.
+ */
+static const char *fShaderTextConvert =
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "uniform float alpha;\n"
+  "varying vec2 txv;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor= CONVERT(texture2D(texture, txv)) * alpha;\n"
+  "}\n";
+
 static const char *vShaderText =
   "uniform vec2 resolution;\n"
   "uniform mat4 matrix;\n"
@@ -201,6 +234,27 @@ typedef enum _WstShaderType
    WstShaderType_external
 } WstShaderType;
 
+typedef enum _WstPixelConvert
+{
+   WstPixelConvert_none= 0,
+   WstPixelConvert_fillAlpha= (1<<0),
+   WstPixelConvert_swapRB= (1<<1),
+   WstPixelConvert_rotate= (1<<2)
+} WstPixelConvert;
+
+#define MAX_PIXEL_CONVERT (6)
+
+// Indexed by WstPixelConvert flags: swapRB takes BGRA to RGBA, rotate takes ARGB to RGBA
+static const char *fShaderTextConvertDefine[MAX_PIXEL_CONVERT] =
+{
+  "#define CONVERT(c) (c)\n",
+  "#define CONVERT(c) vec4((c).rgb, 1.0)\n",
+  "#define CONVERT(c) ((c).bgra)\n",
+  "#define CONVERT(c) vec4((c).bgr, 1.0)\n",
+  "#define CONVERT(c) ((c).gbar)\n",
+  "#define CONVERT(c) vec4((c).gba, 1.0)\n"
+};
+
 typedef struct _WstShader
 {
    bool isYUV;
@@ -221,6 +275,12 @@ static char message[1024];
 
 #define MAX_TEXTURES (2)
 
+// Number of previous frames of output damage retained for use with EGL_EXT_buffer_age
+#define DAMAGE_HISTORY_SIZE (4)
+
+// Maximum number of opaque areas tested against when culling hidden surfaces
+#define MAX_OCCLUDERS (8)
+
 struct _WstRenderSurface
 {
    void *nativePixmap;
@@ -236,8 +296,33 @@ struct _WstRenderSurface
    bool memDirty;
    int memWidth;
    int memHeight;
+   int memStride;
    GLint memFormatGL;
    GLenum memType;
+   int memDirtyY0;
+   int memDirtyY1;
+   bool memTextureValid;
+   int memConvert;
+   bool memConverted;
+   int drawConvert;
+   bool bufferConsumed;
+
+   bool haveCommitDamage;
+   WstRect commitDamage;
+   bool contentDirty;
+   bool contentDirtyFull;
+   WstRect contentDamage;
+
+   bool drawn;
+   WstRect drawnRect;
+   float drawnOpacity;
+   float drawnZOrder;
+
+   bool formatOpaque;
+   bool haveOpaqueRect;
+   WstRect opaqueRect;
+   bool occluded;
+   bool drawOpaque;
 
    int x;
    int y;
@@ -260,11 +345,16 @@ typedef struct _WstRendererGL
    WstShader *textureShader;
    WstShader *textureShaderYUV;
    WstShader *textureShaderExternal;
+   WstShader *textureShaderConvert[MAX_PIXEL_CONVERT];
+   bool haveShaderConvert;
 
    void *nativeWindow;
 
    #if defined (WESTEROS_PLATFORM_EMBEDDED)
    WstGLCtx *glCtx;
+   PFNWSTGLGETVBLANKINFO getVBlankInfo;
+   PFNWSTGLGETSWAPCOUNT getSwapCount;
+   PFNWSTGLGETPRESENTATION getPresentation;
    #endif
    
    EGLDisplay eglDisplay;
@@ -284,6 +374,7 @@ typedef struct _WstRendererGL
    bool haveDmaBufImport;
    bool haveDmaBufImportModifiers;
    bool haveExternalImage;
+   bool haveUnpackSubimage;
 
    #if defined (WESTEROS_HAVE_WAYLAND_EGL)
    bool haveWaylandEGL;
@@ -296,6 +387,19 @@ typedef struct _WstRendererGL
    PFNEGLQUERYDMABUFMODIFIERSEXTPROC eglQueryDmaBufModifiersEXT;
    #endif
 
+   bool haveBufferAge;
+   bool forceFullRepaint;
+   bool needFullRepaint;
+   #ifdef EGL_KHR_partial_update
+   PFNEGLSETDAMAGEREGIONKHRPROC eglSetDamageRegionKHR;
+   #endif
+   #ifdef EGL_EXT_swap_buffers_with_damage
+   PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC eglSwapBuffersWithDamageEXT;
+   #endif
+   WstRect pendingDamage;
+   int damageHistoryIndex;
+   WstRect damageHistory[DAMAGE_HISTORY_SIZE];
+
    std::vector<WstRenderSurface*> surfaces;
 } WstRendererGL;
 
@@ -322,10 +426,21 @@ static void wstRendererGLCommitDispmanx( WstRendererGL *rendererGL, WstRenderSur
                                          EGLint format, int bufferWidth, int bufferHeight );
 #endif                                         
 static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurface *surface );
+static void wstRendererGLUnionRect( WstRect *rect, int x, int y, int width, int height );
+static void wstRendererGLComputeDamage( WstRendererGL *renderer, WstRect *damage );
+#if defined (WESTEROS_PLATFORM_EMBEDDED)
+static void wstRendererGLReportVBlank( WstRendererGL *renderer );
+#endif
+static bool wstRendererGLGetOpaqueRect( WstRenderSurface *surface, WstRect *rect );
+static void wstRendererGLComputeOcclusion( WstRendererGL *renderer );
 
 static bool wstRendererGLSetupEGL( WstRendererGL *renderer );
 static void wstRendererGLDestroyShader( WstShader *shader );
-static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shaderType );
+static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shaderType, int convert );
+static void wstRendererGLConvertPixels( unsigned char *mem, int stride, int width, int y0, int y1, int convert );
+static bool wstRendererGLUploadShm( WstRendererGL *renderer, WstRenderSurface *surface, unsigned char *data,
+                                  int width, int height, int stride, int bpp, GLint formatGL, GLenum type, int convert );
+static void wstRendererGLConvertSurfaces( WstRendererGL *renderer );
 static void wstRendererGLShaderDraw( WstShader *shader,
                                       int width, int height, float* matrix, float alpha,
                                       GLuint textureId, GLuint textureUVId,
@@ -347,9 +462,23 @@ static WstRendererGL* wstRendererGLCreate( WstRenderer *renderer )
 
       rendererGL->outputWidth= renderer->outputWidth;
       rendererGL->outputHeight= renderer->outputHeight;
+      rendererGL->haveShaderConvert= true;
 
       #if defined (WESTEROS_PLATFORM_EMBEDDED)
       rendererGL->glCtx= WstGLInit();
+      {
+         // Vblank timing is an optional platform capability
+         void *module= dlopen( "libwesteros_gl.so.0.0.0", RTLD_NOW );
+         if ( module )
+         {
+            rendererGL->getVBlankInfo= (PFNWSTGLGETVBLANKINFO)dlsym( module, "_WstGLGetVBlankInfo" );
+            printf( "_WstGLGetVBlankInfo %p\n", rendererGL->getVBlankInfo );
+            rendererGL->getSwapCount= (PFNWSTGLGETSWAPCOUNT)dlsym( module, "_WstGLGetSwapCount" );
+            rendererGL->getPresentation= (PFNWSTGLGETPRESENTATION)dlsym( module, "_WstGLGetPresentation" );
+            printf( "_WstGLGetPresentation %p\n", rendererGL->getPresentation );
+            dlclose( module );
+         }
+      }
       #endif
       
       rendererGL->renderer= renderer;
@@ -431,12 +560,50 @@ static WstRendererGL* wstRendererGLCreate( WstRenderer *renderer )
             rendererGL->haveExternalImage= true;
          }
          #endif
+         if ( strstr( extensions, "GL_EXT_unpack_subimage" ) )
+         {
+            rendererGL->haveUnpackSubimage= true;
+         }
       }
       printf("have wayland-egl: %d\n", rendererGL->haveWaylandEGL );
       printf("have dmabuf import: %d\n", rendererGL->haveDmaBufImport );
       printf("have dmabuf import modifiers: %d\n", rendererGL->haveDmaBufImportModifiers );
       printf("have external image: %d\n", rendererGL->haveExternalImage );
+      printf("have unpack subimage: %d\n", rendererGL->haveUnpackSubimage );
+      #endif
+
+      #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+      if ( getenv("WESTEROS_RENDER_GL_FULL_REPAINT") )
+      {
+         rendererGL->forceFullRepaint= true;
+      }
+      const char *eglExtensions= eglQueryString( rendererGL->eglDisplay, EGL_EXTENSIONS );
+      if ( eglExtensions )
+      {
+         #ifdef EGL_EXT_buffer_age
+         if ( strstr( eglExtensions, "EGL_EXT_buffer_age" ) )
+         {
+            rendererGL->haveBufferAge= true;
+         }
+         #endif
+         #ifdef EGL_KHR_partial_update
+         if ( strstr( eglExtensions, "EGL_KHR_partial_update" ) )
+         {
+            rendererGL->eglSetDamageRegionKHR= (PFNEGLSETDAMAGEREGIONKHRPROC)eglGetProcAddress("eglSetDamageRegionKHR");
+            printf( "eglSetDamageRegionKHR %p\n", rendererGL->eglSetDamageRegionKHR );
+         }
+         #endif
+         #ifdef EGL_EXT_swap_buffers_with_damage
+         if ( strstr( eglExtensions, "EGL_EXT_swap_buffers_with_damage" ) )
+         {
+            rendererGL->eglSwapBuffersWithDamageEXT= (PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+            printf( "eglSwapBuffersWithDamageEXT %p\n", rendererGL->eglSwapBuffersWithDamageEXT );
+         }
+         #endif
+      }
+      printf("have buffer age: %d\n", rendererGL->haveBufferAge );
       #endif
+      rendererGL->needFullRepaint= true;
    }
    
    return rendererGL;
@@ -464,6 +631,14 @@ static void wstRendererGLDestroy( WstRendererGL *renderer )
          wstRendererGLDestroyShader( renderer->textureShaderYUV );
          renderer->textureShaderYUV= 0;
       }
+      for( int i= 0; i < MAX_PIXEL_CONVERT; ++i )
+      {
+         if ( renderer->textureShaderConvert[i] )
+         {
+            wstRendererGLDestroyShader( renderer->textureShaderConvert[i] );
+            renderer->textureShaderConvert[i]= 0;
+         }
+      }
       
       if ( renderer->eglSurface )
       {
@@ -565,7 +740,13 @@ static void wstRendererGLFlushSurface( WstRendererGL *renderer, WstRenderSurface
         if ( surface->mem )
         {
            free( surface->mem );
+           surface->mem= 0;
         }
+        surface->memDirty= false;
+        surface->memTextureValid= false;
+        surface->memConvert= WstPixelConvert_none;
+        surface->memConverted= false;
+        surface->drawConvert= WstPixelConvert_none;
     }
 }
 
@@ -768,12 +949,10 @@ static void wstRendererGLPrepareResource( WstRendererGL *renderer, WstRenderSurf
 static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface *surface, struct wl_resource *resource )
 {
    struct wl_shm_buffer *shmBuffer;
-   int width, height, stride;
+   int width, height, stride, memStride, bpp;
    GLint formatGL;
    GLenum type;
-   bool transformPixelsA= false;
-   bool transformPixelsB= false;
-   bool fillAlpha= false;
+   int convert= WstPixelConvert_none;
    void *data;
 
    shmBuffer= wl_shm_buffer_get( resource );
@@ -793,7 +972,7 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
          case WL_SHM_FORMAT_ARGB8888:
             #ifdef BIG_ENDIAN_CPU
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #else
                #if defined (WESTEROS_HAVE_WAYLAND_EGL)
                if ( rendererGL->haveWaylandEGL )
@@ -803,13 +982,13 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #endif
             type= GL_UNSIGNED_BYTE;
@@ -817,7 +996,7 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
          case WL_SHM_FORMAT_XRGB8888:
             #ifdef BIG_ENDIAN_CPU
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #else
                #if defined (WESTEROS_HAVE_WAYLAND_EGL)
                if ( rendererGL->haveWaylandEGL )
@@ -827,17 +1006,17 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #endif
             type= GL_UNSIGNED_BYTE;
-            fillAlpha= true;
+            convert |= WstPixelConvert_fillAlpha;
             break;
          case WL_SHM_FORMAT_BGRA8888:
             #ifdef BIG_ENDIAN_CPU
@@ -849,17 +1028,17 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #else
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #endif
             type= GL_UNSIGNED_BYTE;
             break;
@@ -873,20 +1052,20 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
                else
                {
                   formatGL= GL_RGBA;
-                  transformPixelsB= true;
+                  convert |= WstPixelConvert_swapRB;
                }
                #elif defined (WESTEROS_PLATFORM_EMBEDDED)
                formatGL= GL_BGRA_EXT;
                #else
                formatGL= GL_RGBA;
-               transformPixelsB= true;
+               convert |= WstPixelConvert_swapRB;
                #endif
             #else
                formatGL= GL_RGBA;
-               transformPixelsA= true;
+               convert |= WstPixelConvert_rotate;
             #endif
             type= GL_UNSIGNED_BYTE;
-            fillAlpha= true;
+            convert |= WstPixelConvert_fillAlpha;
             break;
          case WL_SHM_FORMAT_RGB565:
             formatGL= GL_RGB;
@@ -903,92 +1082,342 @@ static void wstRendererGLCommitShm( WstRendererGL *rendererGL, WstRenderSurface
 
       if ( formatGL != GL_NONE )
       {
+         surface->formatOpaque= ((convert & WstPixelConvert_fillAlpha) || (type == GL_UNSIGNED_SHORT_5_6_5));
+
+         // Rows are held tightly packed since GLES2 has no GL_UNPACK_ROW_LENGTH
+         bpp= ((type == GL_UNSIGNED_BYTE) ? 4 : 2);
+         memStride= ((width*bpp)+3)&~3;
+
          wl_shm_buffer_begin_access(shmBuffer);
          data= wl_shm_buffer_get_data(shmBuffer);
          
-         if ( surface->mem &&
-              (
-                (surface->memWidth != width) ||
-                (surface->memHeight != height) ||
-                (surface->memFormatGL != formatGL) ||
-                (surface->memType != type)
-              )
-            )
+         if ( wstRendererGLUploadShm( rendererGL, surface, (unsigned char*)data, width, height, stride, bpp, formatGL, type, convert ) )
          {
-            free( surface->mem );
-            surface->mem= 0;
+            surface->bufferConsumed= true;
          }
-         if ( !surface->mem )
-         {
-            surface->mem= (unsigned char*)malloc( stride*height );
-         }
-         if ( surface->mem )
+         else
          {
-            memcpy( surface->mem, data, stride*height );
-            
-            if ( transformPixelsA )
+            if ( surface->mem &&
+                 (
+                   (surface->memWidth != width) ||
+                   (surface->memHeight != height) ||
+                   (surface->memFormatGL != formatGL) ||
+                   (surface->memType != type) ||
+                   (surface->memConvert != convert)
+                 )
+               )
             {
-               // transform ARGB to RGBA
-               unsigned int pixel, alpha;
-               unsigned int *pixdata= (unsigned int*)surface->mem;
-               for( int y= 0; y < height; ++y )
-               {
-                  for( int x= 0; x < width; ++x )
-                  {
-                     pixel= pixdata[y*width+x];
-                     alpha= (fillAlpha ? 0xFF : (pixel>>24));
-                     pixel= (pixel<<8)|alpha;
-                     pixdata[y*width+x]= pixel;
-                  }
-               }
+               free( surface->mem );
+               surface->mem= 0;
             }
-            else if ( transformPixelsB )
+            int y0= 0;
+            int y1= height;
+            if ( !surface->mem )
             {
-               // transform BGRA to RGBA
-               unsigned char *pixdata= (unsigned char*)surface->mem;
-               for( int y= 0; y < height; ++y )
-               {
-                  for( int x= 0; x < width; ++x )
-                  {
-                     if ( fillAlpha )
-                     {
-                        pixdata[y*width*4 + x*4 +3]= 0xFF;
-                     }
-                     unsigned char temp= pixdata[y*width*4 + x*4 +2];
-                     pixdata[y*width*4 + x*4 +2]= pixdata[y*width*4 + x*4 +0];
-                     pixdata[y*width*4 + x*4 +0]= temp;
-                  }
-               }
+               surface->mem= (unsigned char*)malloc( memStride*height );
+               surface->memTextureValid= false;
             }
-            else if ( fillAlpha )
+            else if ( surface->haveCommitDamage )
             {
-               if ( fillAlpha )
+               // Only the damaged rows differ from the content we already hold
+               y0= surface->commitDamage.y;
+               y1= surface->commitDamage.y+surface->commitDamage.height;
+               if ( y1 > height ) y1= height;
+               if ( y0 > y1 ) y0= y1;
+            }
+            if ( surface->mem )
+            {
+               unsigned char *src= ((unsigned char*)data)+y0*stride;
+               unsigned char *dest= surface->mem+y0*memStride;
+               if ( stride == memStride )
+               {
+                  memcpy( dest, src, (y1-y0)*stride );
+               }
+               else
                {
-                  unsigned char *pixdata= (unsigned char*)surface->mem;
-                  for( int y= 0; y < height; ++y )
+                  for( int y= y0; y < y1; ++y )
                   {
-                     for( int x= 0; x < width; ++x )
-                     {
-                        pixdata[y*width*4 + x*4 +3]= 0xFF;
-                     }
+                     memcpy( dest, src, width*bpp );
+                     src += stride;
+                     dest += memStride;
                   }
                }
+
+               // Byte order conversion is normally done by the fragment shader at draw time
+               surface->memConverted= false;
+               if ( (convert != WstPixelConvert_none) && !rendererGL->haveShaderConvert )
+               {
+                  wstRendererGLConvertPixels( surface->mem, memStride, width, y0, y1, convert );
+                  surface->memConverted= true;
+               }
+               surface->drawConvert= (surface->memConverted ? (int)WstPixelConvert_none : convert);
+               surface->bufferConsumed= true;
+
+               if ( surface->memDirty )
+               {
+                  if ( y0 < surface->memDirtyY0 ) surface->memDirtyY0= y0;
+                  if ( y1 > surface->memDirtyY1 ) surface->memDirtyY1= y1;
+               }
+               else
+               {
+                  surface->memDirtyY0= y0;
+                  surface->memDirtyY1= y1;
+               }
+
+               surface->bufferWidth= width;
+               surface->bufferHeight= height;
+               surface->memWidth= width;
+               surface->memHeight= height;
+               surface->memStride= memStride;
+               surface->memFormatGL= formatGL;
+               surface->memType= type;
+               surface->memConvert= convert;
+               surface->memDirty= true;
             }
-            
-            surface->bufferWidth= width;
-            surface->bufferHeight= height;
-            surface->memWidth= width;
-            surface->memHeight= height;
-            surface->memFormatGL= formatGL;
-            surface->memType= type;
-            surface->memDirty= true;
-         }      
-         
+         }
+
          wl_shm_buffer_end_access(shmBuffer);
       }
    }
 }
 
+static bool wstRendererGLUploadShm( WstRendererGL *renderer, WstRenderSurface *surface, unsigned char *data,
+                                  int width, int height, int stride, int bpp, GLint formatGL, GLenum type, int convert )
+{
+   bool uploaded= false;
+   int rowLength= 0;
+   int y0, y1;
+
+   // Uploading straight from the client's buffer is only possible from the thread
+   // our context is current on, once the shaders that will draw it exist
+   if ( !renderer->textureShader ||
+        !renderer->eglContext ||
+        (eglGetCurrentContext() != renderer->eglContext) )
+   {
+      goto exit;
+   }
+
+   // The client's pixels can't be converted in place
+   if ( (convert != WstPixelConvert_none) && !renderer->haveShaderConvert )
+   {
+      goto exit;
+   }
+
+   if ( surface->externalImage || surface->eglImage[0] )
+   {
+      goto exit;
+   }
+
+   if ( stride != (((width*bpp)+3)&~3) )
+   {
+      if ( !renderer->haveUnpackSubimage || (stride & 3) )
+      {
+         goto exit;
+      }
+      rowLength= stride/bpp;
+   }
+
+   if ( surface->mem )
+   {
+      // Unless it lags the staging copy the texture can still take partial updates
+      free( surface->mem );
+      surface->mem= 0;
+      if ( surface->memDirty || surface->memConverted )
+      {
+         surface->memTextureValid= false;
+      }
+      surface->memDirty= false;
+   }
+   if ( (surface->memWidth != width) ||
+        (surface->memHeight != height) ||
+        (surface->memFormatGL != formatGL) ||
+        (surface->memType != type) ||
+        (surface->memConvert != convert) )
+   {
+      surface->memTextureValid= false;
+   }
+   if ( surface->textureId[0] == GL_NONE )
+   {
+      glGenTextures(1, &surface->textureId[0] );
+      surface->memTextureValid= false;
+   }
+
+   y0= 0;
+   y1= height;
+   if ( surface->memTextureValid && surface->haveCommitDamage )
+   {
+      y0= surface->commitDamage.y;
+      y1= surface->commitDamage.y+surface->commitDamage.height;
+      if ( y1 > height ) y1= height;
+      if ( y0 > y1 ) y0= y1;
+   }
+
+   glActiveTexture(GL_TEXTURE1);
+   glBindTexture(GL_TEXTURE_2D, surface->textureId[0] );
+   if ( rowLength )
+   {
+      glPixelStorei( GL_UNPACK_ROW_LENGTH_EXT, rowLength );
+   }
+   if ( surface->memTextureValid )
+   {
+      if ( y1 > y0 )
+      {
+         glTexSubImage2D( GL_TEXTURE_2D,
+                          0, //level
+                          0, //xoffset
+                          y0, //yoffset
+                          width,
+                          y1-y0,
+                          formatGL, //format
+                          type,
+                          data+y0*stride );
+      }
+   }
+   else
+   {
+      glTexImage2D( GL_TEXTURE_2D,
+                    0, //level
+                    formatGL, //internalFormat
+                    width,
+                    height,
+                    0, // border
+                    formatGL, //format
+                    type,
+                    data );
+      surface->memTextureValid= true;
+   }
+   if ( rowLength )
+   {
+      glPixelStorei( GL_UNPACK_ROW_LENGTH_EXT, 0 );
+   }
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+   surface->bufferWidth= width;
+   surface->bufferHeight= height;
+   surface->memWidth= width;
+   surface->memHeight= height;
+   surface->memFormatGL= formatGL;
+   surface->memType= type;
+   surface->memConvert= convert;
+   surface->memConverted= false;
+   surface->drawConvert= convert;
+
+   uploaded= true;
+
+exit:
+
+   return uploaded;
+}
+
+static void wstRendererGLConvertPixels( unsigned char *mem, int stride, int width, int y0, int y1, int convert )
+{
+   for( int y= y0; y < y1; ++y )
+   {
+      unsigned char *row= mem+y*stride;
+      int x= 0;
+
+      #if defined (__ARM_NEON) || defined (__ARM_NEON__)
+      for( ; x+16 <= width; x += 16 )
+      {
+         uint8x16x4_t pix= vld4q_u8( row+x*4 );
+         uint8x16_t temp;
+         if ( convert & WstPixelConvert_swapRB )
+         {
+            temp= pix.val[0];
+            pix.val[0]= pix.val[2];
+            pix.val[2]= temp;
+         }
+         else if ( convert & WstPixelConvert_rotate )
+         {
+            temp= pix.val[0];
+            pix.val[0]= pix.val[1];
+            pix.val[1]= pix.val[2];
+            pix.val[2]= pix.val[3];
+            pix.val[3]= temp;
+         }
+         if ( convert & WstPixelConvert_fillAlpha )
+         {
+            pix.val[3]= vdupq_n_u8( 0xFF );
+         }
+         vst4q_u8( row+x*4, pix );
+      }
+      #elif defined (__SSE2__) && !defined (BIG_ENDIAN_CPU)
+      {
+         const __m128i maskGA= _mm_set1_epi32( (int)0xFF00FF00 );
+         const __m128i maskLow= _mm_set1_epi32( 0x000000FF );
+         const __m128i maskAlpha= _mm_set1_epi32( (int)0xFF000000 );
+         for( ; x+4 <= width; x += 4 )
+         {
+            __m128i pix= _mm_loadu_si128( (__m128i*)(row+x*4) );
+            if ( convert & WstPixelConvert_swapRB )
+            {
+               pix= _mm_or_si128( _mm_and_si128( pix, maskGA ),
+                                  _mm_or_si128( _mm_and_si128( _mm_srli_epi32( pix, 16 ), maskLow ),
+                                                _mm_slli_epi32( _mm_and_si128( pix, maskLow ), 16 ) ) );
+            }
+            else if ( convert & WstPixelConvert_rotate )
+            {
+               pix= _mm_or_si128( _mm_srli_epi32( pix, 8 ), _mm_slli_epi32( pix, 24 ) );
+            }
+            if ( convert & WstPixelConvert_fillAlpha )
+            {
+               pix= _mm_or_si128( pix, maskAlpha );
+            }
+            _mm_storeu_si128( (__m128i*)(row+x*4), pix );
+         }
+      }
+      #endif
+
+      // Scalar reference path: also handles the tail of each row
+      for( ; x < width; ++x )
+      {
+         unsigned char *pix= row+x*4;
+         unsigned char temp;
+         if ( convert & WstPixelConvert_swapRB )
+         {
+            temp= pix[0];
+            pix[0]= pix[2];
+            pix[2]= temp;
+         }
+         else if ( convert & WstPixelConvert_rotate )
+         {
+            temp= pix[0];
+            pix[0]= pix[1];
+            pix[1]= pix[2];
+            pix[2]= pix[3];
+            pix[3]= temp;
+         }
+         if ( convert & WstPixelConvert_fillAlpha )
+         {
+            pix[3]= 0xFF;
+         }
+      }
+   }
+}
+
+static void wstRendererGLConvertSurfaces( WstRendererGL *renderer )
+{
+   for ( std::vector<WstRenderSurface*>::iterator it= renderer->surfaces.begin();
+         it != renderer->surfaces.end();
+         ++it )
+   {
+      WstRenderSurface *surface= (*it);
+      if ( surface->mem && (surface->memConvert != WstPixelConvert_none) && !surface->memConverted )
+      {
+         wstRendererGLConvertPixels( surface->mem, surface->memStride, surface->memWidth,
+                                   0, surface->memHeight, surface->memConvert );
+         surface->memConverted= true;
+         surface->drawConvert= WstPixelConvert_none;
+         surface->memDirty= true;
+         surface->memDirtyY0= 0;
+         surface->memDirtyY1= surface->memHeight;
+      }
+   }
+}
+
 #if defined (WESTEROS_HAVE_WAYLAND_EGL)
 static void wstRendererGLCommitWaylandEGL( WstRendererGL *rendererGL, WstRenderSurface *surface, 
                                            struct wl_resource *resource, EGLint format )
@@ -1030,6 +1459,8 @@ static void wstRendererGLCommitWaylandEGL( WstRendererGL *rendererGL, WstRenderS
       }
    }
 
+   surface->formatOpaque= (format != EGL_TEXTURE_RGBA);
+
    #if defined (WESTEROS_PLATFORM_RPI)
    /* 
     * The Userland wayland-egl implementation used on RPI isn't complete in that it does not
@@ -1464,6 +1895,7 @@ static void wstRendererGLCommitDispmanx( WstRendererGL *rendererGL, WstRenderSur
                if ( !surface->mem )
                {
                   surface->mem= (unsigned char*)malloc( stride*bufferHeight );
+                  surface->memTextureValid= false;
                }
                if ( surface->mem )
                {
@@ -1485,8 +1917,13 @@ static void wstRendererGLCommitDispmanx( WstRendererGL *rendererGL, WstRenderSur
                      surface->bufferHeight= bufferHeight;
                      surface->memWidth= bufferWidth;
                      surface->memHeight= bufferHeight;
+                     surface->memStride= stride;
                      surface->memFormatGL= formatGL;
                      surface->memType= type;
+                     surface->memConvert= WstPixelConvert_none;
+                     surface->memConverted= false;
+                     surface->memDirtyY0= 0;
+                     surface->memDirtyY1= bufferHeight;
                      surface->memDirty= true;
                   }
                }            
@@ -1522,6 +1959,10 @@ static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurfac
          if ( surface->textureId[i] == GL_NONE )
          {
             glGenTextures(1, &surface->textureId[i] );
+            if ( i == 0 )
+            {
+               surface->memTextureValid= false;
+            }
          }
        
          /* Bind the egl image as a texture */
@@ -1542,6 +1983,7 @@ static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurfac
             #ifdef GL_OES_EGL_image_external
             }
             #endif
+            surface->memTextureValid= false;
          }
          else
          #endif
@@ -1549,15 +1991,34 @@ static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurfac
          {
             if ( surface->mem )
             {
-               glTexImage2D( GL_TEXTURE_2D,
-                             0, //level
-                             surface->memFormatGL, //internalFormat
-                             surface->memWidth,
-                             surface->memHeight,
-                             0, // border
-                             surface->memFormatGL, //format
-                             surface->memType,
-                             surface->mem );
+               if ( surface->memTextureValid )
+               {
+                  if ( surface->memDirtyY1 > surface->memDirtyY0 )
+                  {
+                     glTexSubImage2D( GL_TEXTURE_2D,
+                                      0, //level
+                                      0, //xoffset
+                                      surface->memDirtyY0, //yoffset
+                                      surface->memWidth,
+                                      surface->memDirtyY1-surface->memDirtyY0,
+                                      surface->memFormatGL, //format
+                                      surface->memType,
+                                      surface->mem+surface->memDirtyY0*surface->memStride );
+                  }
+               }
+               else
+               {
+                  glTexImage2D( GL_TEXTURE_2D,
+                                0, //level
+                                surface->memFormatGL, //internalFormat
+                                surface->memWidth,
+                                surface->memHeight,
+                                0, // border
+                                surface->memFormatGL, //format
+                                surface->memType,
+                                surface->mem );
+                  surface->memTextureValid= true;
+               }
                surface->memDirty= false;
             }
          }
@@ -1618,7 +2079,16 @@ static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurfac
 
    if ( surface->textureCount == 1 )
    {
-      wstRendererGLShaderDraw( surface->externalImage ? renderer->textureShaderExternal : renderer->textureShader,
+      WstShader *shader= renderer->textureShader;
+      if ( surface->externalImage )
+      {
+         shader= renderer->textureShaderExternal;
+      }
+      else if ( surface->drawConvert && renderer->textureShaderConvert[surface->drawConvert] )
+      {
+         shader= renderer->textureShaderConvert[surface->drawConvert];
+      }
+      wstRendererGLShaderDraw( shader,
                                resW,
                                resH,
                                (float*)matrix,
@@ -1644,6 +2114,288 @@ static void wstRendererGLRenderSurface( WstRendererGL *renderer, WstRenderSurfac
    }
 }
 
+static void wstRendererGLUnionRect( WstRect *rect, int x, int y, int width, int height )
+{
+   if ( (width > 0) && (height > 0) )
+   {
+      if ( (rect->width > 0) && (rect->height > 0) )
+      {
+         int x1= rect->x+rect->width;
+         int y1= rect->y+rect->height;
+         if ( x < rect->x ) rect->x= x;
+         if ( y < rect->y ) rect->y= y;
+         if ( x+width > x1 ) x1= x+width;
+         if ( y+height > y1 ) y1= y+height;
+         rect->width= x1-rect->x;
+         rect->height= y1-rect->y;
+      }
+      else
+      {
+         rect->x= x;
+         rect->y= y;
+         rect->width= width;
+         rect->height= height;
+      }
+   }
+}
+
+static void wstRendererGLComputeDamage( WstRendererGL *renderer, WstRect *damage )
+{
+   *damage= renderer->pendingDamage;
+   memset( &renderer->pendingDamage, 0, sizeof(WstRect) );
+
+   for( std::vector<WstRenderSurface*>::iterator it= renderer->surfaces.begin();
+        it != renderer->surfaces.end();
+        ++it )
+   {
+      WstRenderSurface *surface= (*it);
+      bool drawable= surface->visible &&
+                     (
+                       #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+                       surface->eglImage[0] ||
+                       #endif
+                       surface->memDirty ||
+                       (surface->textureId[0] != GL_NONE)
+                     );
+
+      if ( !surface->sizeOverride )
+      {
+         surface->width= surface->bufferWidth;
+         surface->height= surface->bufferHeight;
+      }
+
+      if ( (drawable != surface->drawn) ||
+           (surface->x != surface->drawnRect.x) ||
+           (surface->y != surface->drawnRect.y) ||
+           (surface->width != surface->drawnRect.width) ||
+           (surface->height != surface->drawnRect.height) ||
+           (surface->opacity != surface->drawnOpacity) ||
+           (surface->zorder != surface->drawnZOrder) )
+      {
+         if ( surface->drawn )
+         {
+            wstRendererGLUnionRect( damage, surface->drawnRect.x, surface->drawnRect.y, surface->drawnRect.width, surface->drawnRect.height );
+         }
+         if ( drawable )
+         {
+            wstRendererGLUnionRect( damage, surface->x, surface->y, surface->width, surface->height );
+         }
+      }
+      else if ( drawable && surface->contentDirty )
+      {
+         if ( surface->contentDirtyFull || (surface->bufferWidth <= 0) || (surface->bufferHeight <= 0) )
+         {
+            wstRendererGLUnionRect( damage, surface->x, surface->y, surface->width, surface->height );
+         }
+         else
+         {
+            long long bx0, by0, bx1, by1;
+            int x0, y0, x1, y1;
+
+            // Map buffer damage to output co-ordinates allowing a pixel either side for filtering
+            bx0= surface->contentDamage.x;
+            by0= surface->contentDamage.y;
+            bx1= bx0+surface->contentDamage.width;
+            by1= by0+surface->contentDamage.height;
+            if ( bx1 > surface->bufferWidth ) bx1= surface->bufferWidth;
+            if ( by1 > surface->bufferHeight ) by1= surface->bufferHeight;
+            if ( surface->invertedY )
+            {
+               long long temp= by0;
+               by0= surface->bufferHeight-by1;
+               by1= surface->bufferHeight-temp;
+            }
+            x0= surface->x+(int)((bx0*surface->width)/surface->bufferWidth)-1;
+            y0= surface->y+(int)((by0*surface->height)/surface->bufferHeight)-1;
+            x1= surface->x+(int)((bx1*surface->width+surface->bufferWidth-1)/surface->bufferWidth)+1;
+            y1= surface->y+(int)((by1*surface->height+surface->bufferHeight-1)/surface->bufferHeight)+1;
+            wstRendererGLUnionRect( damage, x0, y0, x1-x0, y1-y0 );
+         }
+      }
+
+      surface->drawn= drawable;
+      surface->drawnRect.x= surface->x;
+      surface->drawnRect.y= surface->y;
+      surface->drawnRect.width= surface->width;
+      surface->drawnRect.height= surface->height;
+      surface->drawnOpacity= surface->opacity;
+      surface->drawnZOrder= surface->zorder;
+      surface->contentDirty= false;
+      surface->contentDirtyFull= false;
+      memset( &surface->contentDamage, 0, sizeof(WstRect) );
+   }
+
+   if ( (damage->width > 0) && (damage->height > 0) )
+   {
+      int x1= damage->x+damage->width;
+      int y1= damage->y+damage->height;
+      if ( damage->x < 0 ) damage->x= 0;
+      if ( damage->y < 0 ) damage->y= 0;
+      if ( x1 > renderer->outputWidth ) x1= renderer->outputWidth;
+      if ( y1 > renderer->outputHeight ) y1= renderer->outputHeight;
+      damage->width= x1-damage->x;
+      damage->height= y1-damage->y;
+   }
+   if ( (damage->width <= 0) || (damage->height <= 0) )
+   {
+      memset( damage, 0, sizeof(WstRect) );
+   }
+}
+
+#if defined (WESTEROS_PLATFORM_EMBEDDED)
+static void wstRendererGLReportVBlank( WstRendererGL *renderer )
+{
+   long long vblankTime, vblankInterval;
+   unsigned int vblankSequence;
+
+   if ( renderer->getVBlankInfo( renderer->glCtx, &vblankTime, &vblankInterval, &vblankSequence ) && (vblankInterval > 0) )
+   {
+      struct timespec tm;
+      long long now, nextVBlankTime;
+      unsigned int frame= 0;
+
+      clock_gettime( CLOCK_MONOTONIC, &tm );
+      now= tm.tv_sec*1000000LL+(tm.tv_nsec/1000LL);
+
+      // The frame just swapped can reach the display no earlier than the first
+      // vblank after now.  When it actually does is reported per swap through
+      // queryPresentation.
+      nextVBlankTime= vblankTime;
+      if ( nextVBlankTime <= now )
+      {
+         nextVBlankTime += (((now-nextVBlankTime)/vblankInterval)+1)*vblankInterval;
+      }
+      nextVBlankTime += vblankInterval;
+
+      if ( renderer->getSwapCount && renderer->getPresentation )
+      {
+         frame= renderer->getSwapCount( renderer->glCtx, renderer->nativeWindow );
+      }
+
+      renderer->renderer->vblankCB( renderer->renderer->vblankUserData,
+                                    frame,
+                                    nextVBlankTime,
+                                    vblankInterval );
+   }
+}
+#endif
+
+static bool wstRendererGLGetOpaqueRect( WstRenderSurface *surface, WstRect *rect )
+{
+   long long ox0, oy0, ox1, oy1;
+   long long bw= surface->bufferWidth;
+   long long bh= surface->bufferHeight;
+
+   rect->x= surface->x;
+   rect->y= surface->y;
+   rect->width= surface->width;
+   rect->height= surface->height;
+
+   if ( surface->formatOpaque || (surface->textureCount == 2) )
+   {
+      return true;
+   }
+
+   if ( !surface->haveOpaqueRect || (bw <= 0) || (bh <= 0) )
+   {
+      return false;
+   }
+
+   ox0= surface->opaqueRect.x;
+   oy0= surface->opaqueRect.y;
+   ox1= ox0+surface->opaqueRect.width;
+   oy1= oy0+surface->opaqueRect.height;
+   if ( ox0 < 0 ) ox0= 0;
+   if ( oy0 < 0 ) oy0= 0;
+   if ( ox1 > bw ) ox1= bw;
+   if ( oy1 > bh ) oy1= bh;
+   if ( (ox1 <= ox0) || (oy1 <= oy0) )
+   {
+      return false;
+   }
+   if ( (ox0 == 0) && (oy0 == 0) && (ox1 == bw) && (oy1 == bh) )
+   {
+      return true;
+   }
+   if ( surface->invertedY )
+   {
+      long long temp= oy0;
+      oy0= bh-oy1;
+      oy1= bh-temp;
+   }
+
+   // Round inwards so partially covered output pixels are never treated as opaque
+   rect->x= surface->x+(int)((ox0*surface->width+bw-1)/bw);
+   rect->y= surface->y+(int)((oy0*surface->height+bh-1)/bh);
+   rect->width= surface->x+(int)((ox1*surface->width)/bw)-rect->x;
+   rect->height= surface->y+(int)((oy1*surface->height)/bh)-rect->y;
+
+   return ((rect->width > 0) && (rect->height > 0));
+}
+
+static void wstRendererGLComputeOcclusion( WstRendererGL *renderer )
+{
+   WstRect occluders[MAX_OCCLUDERS];
+   int occluderCount= 0;
+
+   /*
+    * Walk surfaces from top to bottom collecting the areas covered by opaque
+    * content.  Surfaces lying entirely within one of those areas can't be seen
+    * and are skipped, and fully opaque surfaces are drawn without blending.
+    */
+   for( int i= renderer->surfaces.size()-1; i >= 0; --i )
+   {
+      WstRenderSurface *surface= renderer->surfaces[i];
+      WstRect opaque;
+
+      surface->occluded= false;
+      surface->drawOpaque= false;
+
+      if ( !surface->visible ||
+           (surface->width <= 0) ||
+           (surface->height <= 0) ||
+           !(
+              #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+              surface->eglImage[0] ||
+              #endif
+              surface->memDirty ||
+              (surface->textureId[0] != GL_NONE)
+            )
+         )
+      {
+         continue;
+      }
+
+      for( int j= 0; j < occluderCount; ++j )
+      {
+         if ( (surface->x >= occluders[j].x) &&
+              (surface->y >= occluders[j].y) &&
+              (surface->x+surface->width <= occluders[j].x+occluders[j].width) &&
+              (surface->y+surface->height <= occluders[j].y+occluders[j].height) )
+         {
+            surface->occluded= true;
+            break;
+         }
+      }
+      if ( surface->occluded || (surface->opacity < 1.0f) )
+      {
+         continue;
+      }
+
+      if ( wstRendererGLGetOpaqueRect( surface, &opaque ) )
+      {
+         surface->drawOpaque= ( (opaque.x == surface->x) &&
+                                (opaque.y == surface->y) &&
+                                (opaque.width == surface->width) &&
+                                (opaque.height == surface->height) );
+         if ( occluderCount < MAX_OCCLUDERS )
+         {
+            occluders[occluderCount++]= opaque;
+         }
+      }
+   }
+}
+
 #define RED_SIZE (8)
 #define GREEN_SIZE (8)
 #define BLUE_SIZE (8)
@@ -1819,14 +2571,17 @@ exit:
    return result;
 }
 
-static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shaderType )
+static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shaderType, int convert )
 {
    WstShader *shaderNew= 0;
    GLuint type;
    const char *typeName= 0, *src= 0;
+   const char *srcList[2];
+   int srcCount;
    GLint shader, status, len;
    bool yuv= (shaderType == WstShaderType_yuv);
    bool noalpha;
+   bool valid= false;
 
    shaderNew= (WstShader*)calloc( 1, sizeof(WstShader));
    if ( !shaderNew )
@@ -1860,6 +2615,11 @@ static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shader
          {
             src= fShaderTextExternal;
          }
+         else if ( convert != WstPixelConvert_none )
+         {
+            src= fShaderTextConvert;
+            noalpha= false;
+         }
          else
          {
             src= fShaderText;
@@ -1872,13 +2632,19 @@ static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shader
          typeName= "vertex";
          src= ( yuv ? vShaderTextYUV : vShaderText );
       }
+      srcCount= 0;
+      if ( (i == 0) && (src == fShaderTextConvert) )
+      {
+         srcList[srcCount++]= fShaderTextConvertDefine[convert];
+      }
+      srcList[srcCount++]= src;
       shader= glCreateShader(type);
       if ( !shader )
       {
          printf("wstRendererGLCreateShader: glCreateShader (%s) error: %d\n", typeName, glGetError());
          goto exit;
       }
-      glShaderSource(shader, 1, &src, NULL );
+      glShaderSource(shader, srcCount, srcList, NULL );
       glCompileShader(shader);
       glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
       if ( !status )
@@ -1960,8 +2726,17 @@ static WstShader* wstRendererGLCreateShader( WstRendererGL *renderer, int shader
       }
    }
 
+   valid= true;
+
 exit:
 
+   if ( !valid && (convert != WstPixelConvert_none) )
+   {
+      // Conversion variants are optional: let the caller fall back to the cpu
+      wstRendererGLDestroyShader( shaderNew );
+      shaderNew= 0;
+   }
+
    return shaderNew;
 }
 
@@ -2072,6 +2847,7 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
    {
       rendererGL->outputWidth= renderer->outputWidth;
       rendererGL->outputHeight= renderer->outputHeight;
+      rendererGL->needFullRepaint= true;
       if ( renderer->displayNested )
       {
          if ( rendererGL->nativeWindow )
@@ -2092,16 +2868,103 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
 
    if ( !rendererGL->textureShader )
    {
-      rendererGL->textureShader= wstRendererGLCreateShader( rendererGL, WstShaderType_rgb );
-      rendererGL->textureShaderYUV= wstRendererGLCreateShader( rendererGL, WstShaderType_yuv );
+      rendererGL->textureShader= wstRendererGLCreateShader( rendererGL, WstShaderType_rgb, WstPixelConvert_none );
+      rendererGL->textureShaderYUV= wstRendererGLCreateShader( rendererGL, WstShaderType_yuv, WstPixelConvert_none );
       if ( rendererGL->haveExternalImage )
       {
-         rendererGL->textureShaderExternal= wstRendererGLCreateShader( rendererGL, WstShaderType_external );
+         rendererGL->textureShaderExternal= wstRendererGLCreateShader( rendererGL, WstShaderType_external, WstPixelConvert_none );
+      }
+      for( int i= WstPixelConvert_none+1; i < MAX_PIXEL_CONVERT; ++i )
+      {
+         rendererGL->textureShaderConvert[i]= wstRendererGLCreateShader( rendererGL, WstShaderType_rgb, i );
+         if ( !rendererGL->textureShaderConvert[i] )
+         {
+            rendererGL->haveShaderConvert= false;
+         }
+      }
+      if ( !rendererGL->haveShaderConvert )
+      {
+         printf("wstRendererGLUpdateScene: no format conversion shaders: converting shm pixels on the cpu\n");
+         wstRendererGLConvertSurfaces( rendererGL );
       }
       rendererGL->eglContext= eglGetCurrentContext();
    }
 
+   /*
+    * Determine what part of the output needs to be redrawn.  When the EGL surface
+    * reports its buffer age we only need to repaint what has changed since the
+    * back buffer was last presented, otherwise repaint everything.
+    */
+   WstRect frameDamage, repaint;
+   EGLint age= 0;
+   bool fullRepaint= (rendererGL->forceFullRepaint || rendererGL->needFullRepaint);
+
+   rendererGL->needFullRepaint= false;
+   wstRendererGLComputeDamage( rendererGL, &frameDamage );
+   if ( fullRepaint )
+   {
+      frameDamage.x= 0;
+      frameDamage.y= 0;
+      frameDamage.width= renderer->outputWidth;
+      frameDamage.height= renderer->outputHeight;
+   }
+   #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+   #ifdef EGL_EXT_buffer_age
+   if ( !fullRepaint && rendererGL->haveBufferAge )
+   {
+      if ( !eglQuerySurface( rendererGL->eglDisplay, rendererGL->eglSurface, EGL_BUFFER_AGE_EXT, &age ) )
+      {
+         age= 0;
+      }
+   }
+   #endif
+   #endif
+   repaint= frameDamage;
+   if ( (age > 0) && (age <= DAMAGE_HISTORY_SIZE) )
+   {
+      for( int i= 1; i < age; ++i )
+      {
+         WstRect *prev= &rendererGL->damageHistory[(rendererGL->damageHistoryIndex+DAMAGE_HISTORY_SIZE-i)%DAMAGE_HISTORY_SIZE];
+         wstRendererGLUnionRect( &repaint, prev->x, prev->y, prev->width, prev->height );
+      }
+   }
+   else
+   {
+      fullRepaint= true;
+      repaint.x= 0;
+      repaint.y= 0;
+      repaint.width= renderer->outputWidth;
+      repaint.height= renderer->outputHeight;
+   }
+   rendererGL->damageHistory[rendererGL->damageHistoryIndex]= frameDamage;
+   rendererGL->damageHistoryIndex= (rendererGL->damageHistoryIndex+1)%DAMAGE_HISTORY_SIZE;
+
+   wstRendererGLComputeOcclusion( rendererGL );
+
+   #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+   #ifdef EGL_KHR_partial_update
+   if ( !fullRepaint && rendererGL->eglSetDamageRegionKHR )
+   {
+      EGLint rect[4];
+      rect[0]= repaint.x;
+      rect[1]= renderer->outputHeight-(repaint.y+repaint.height);
+      rect[2]= repaint.width;
+      rect[3]= repaint.height;
+      rendererGL->eglSetDamageRegionKHR( rendererGL->eglDisplay, rendererGL->eglSurface, rect, 1 );
+   }
+   #endif
+   #endif
+
    glViewport( 0, 0, renderer->outputWidth, renderer->outputHeight );
+   if ( fullRepaint )
+   {
+      glDisable(GL_SCISSOR_TEST);
+   }
+   else
+   {
+      glEnable(GL_SCISSOR_TEST);
+      glScissor( repaint.x, renderer->outputHeight-(repaint.y+repaint.height), repaint.width, repaint.height );
+   }
    glClearColor( 0.0, 0.0, 0.0, 0.0 );
    glClear( GL_COLOR_BUFFER_BIT );
    
@@ -2110,7 +2973,6 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
    glDisable(GL_STENCIL_TEST);
    glDisable(GL_DEPTH_TEST);
    glDisable(GL_CULL_FACE);
-   glDisable(GL_SCISSOR_TEST);
    glBlendFuncSeparate( GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE );
 
    /*
@@ -2131,9 +2993,29 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
           )
         )
       {
-         wstRendererGLRenderSurface( rendererGL, surface );
+         if ( surface->occluded ||
+              ( !fullRepaint &&
+                ( (surface->x >= repaint.x+repaint.width) ||
+                  (surface->y >= repaint.y+repaint.height) ||
+                  (surface->x+surface->width <= repaint.x) ||
+                  (surface->y+surface->height <= repaint.y) ) ) )
+         {
+            continue;
+         }
+         if ( surface->drawOpaque )
+         {
+            glDisable(GL_BLEND);
+            wstRendererGLRenderSurface( rendererGL, surface );
+            glEnable(GL_BLEND);
+         }
+         else
+         {
+            wstRendererGLRenderSurface( rendererGL, surface );
+         }
       }
    }
+
+   glDisable(GL_SCISSOR_TEST);
  
    #if defined (WESTEROS_PLATFORM_NEXUS )
    {
@@ -2150,8 +3032,27 @@ static void wstRendererUpdateScene( WstRenderer *renderer )
    #endif
 
    #if defined (WESTEROS_PLATFORM_EMBEDDED) || defined (WESTEROS_HAVE_WAYLAND_EGL)
+   #ifdef EGL_EXT_swap_buffers_with_damage
+   if ( !fullRepaint && (frameDamage.width > 0) && rendererGL->eglSwapBuffersWithDamageEXT )
+   {
+      EGLint rect[4];
+      rect[0]= frameDamage.x;
+      rect[1]= renderer->outputHeight-(frameDamage.y+frameDamage.height);
+      rect[2]= frameDamage.width;
+      rect[3]= frameDamage.height;
+      rendererGL->eglSwapBuffersWithDamageEXT( rendererGL->eglDisplay, rendererGL->eglSurface, rect, 1 );
+   }
+   else
+   #endif
    eglSwapBuffers(rendererGL->eglDisplay, rendererGL->eglSurface);
    #endif
+
+   #if defined (WESTEROS_PLATFORM_EMBEDDED)
+   if ( renderer->vblankCB && rendererGL->getVBlankInfo )
+   {
+      wstRendererGLReportVBlank( rendererGL );
+   }
+   #endif
 }
 
 static WstRenderSurface* wstRendererSurfaceCreate( WstRenderer *renderer )
@@ -2189,6 +3090,13 @@ static void wstRendererSurfaceDestroy( WstRenderer *renderer, WstRenderSurface *
          break;   
       }
    }   
+
+   if ( surface->drawn )
+   {
+      wstRendererGLUnionRect( &rendererGL->pendingDamage,
+                              surface->drawnRect.x, surface->drawnRect.y,
+                              surface->drawnRect.width, surface->drawnRect.height );
+   }
    
    wstRendererGLDestroySurface( rendererGL, surface );
 }
@@ -2200,6 +3108,9 @@ static void wstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *s
 
    if ( resource )
    {
+      surface->formatOpaque= false;
+      surface->drawConvert= WstPixelConvert_none;
+      surface->bufferConsumed= false;
       if ( wl_shm_buffer_get( resource ) )
       {
          wstRendererGLCommitShm( rendererGL, surface, resource );
@@ -2237,6 +3148,49 @@ static void wstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *s
    }
 }
 
+static void wstRendererSurfaceSetDamage( WstRenderer *renderer, WstRenderSurface *surface, WstRect *damage )
+{
+   WST_UNUSED(renderer);
+
+   if ( surface )
+   {
+      if ( damage )
+      {
+         surface->haveCommitDamage= true;
+         surface->commitDamage= *damage;
+         wstRendererGLUnionRect( &surface->contentDamage, damage->x, damage->y, damage->width, damage->height );
+      }
+      else
+      {
+         surface->haveCommitDamage= false;
+         surface->contentDirtyFull= true;
+      }
+      surface->contentDirty= true;
+   }
+}
+
+static void wstRendererSurfaceSetOpaqueRegion( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects )
+{
+   long long area, maxArea= 0;
+   WST_UNUSED(renderer);
+
+   if ( surface )
+   {
+      // Only the largest rectangle of the region is used for culling
+      surface->haveOpaqueRect= false;
+      for( std::vector<WstRect>::iterator it= rects.begin(); it != rects.end(); ++it )
+      {
+         area= (long long)(*it).width*(long long)(*it).height;
+         if ( area > maxArea )
+         {
+            maxArea= area;
+            surface->opaqueRect= (*it);
+            surface->haveOpaqueRect= true;
+         }
+      }
+   }
+}
+
 static void wstRendererSurfaceSetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool visible )
 {
    WstRendererGL *rendererGL= (WstRendererGL*)renderer->renderer;
@@ -2262,6 +3216,58 @@ static bool wstRendererSurfaceGetVisible( WstRenderer *renderer, WstRenderSurfac
    return isVisible;   
 }
 
+static bool wstRendererSurfaceGetBufferConsumed( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed )
+{
+   WST_UNUSED(renderer);
+
+   if ( surface )
+   {
+      // Shm content is copied or uploaded during commit and never read from the client's buffer again
+      *consumed= surface->bufferConsumed;
+   }
+
+   return true;
+}
+
+static bool wstRendererSurfaceGetComposed( WstRenderer *renderer, WstRenderSurface *surface, bool *composed )
+{
+   bool isComposed= false;
+
+   if ( surface )
+   {
+      // Reflects the occlusion computed by the most recent scene update
+      isComposed= ( surface->visible &&
+                    !surface->occluded &&
+                    (surface->x < renderer->outputWidth) &&
+                    (surface->y < renderer->outputHeight) &&
+                    (surface->x+surface->width > 0) &&
+                    (surface->y+surface->height > 0) );
+
+      *composed= isComposed;
+   }
+
+   return isComposed;
+}
+
+#if defined (WESTEROS_PLATFORM_EMBEDDED)
+static WstPresentation wstRendererQueryPresentation( WstRenderer *renderer, unsigned int frame,
+                                                     long long *presentationTime, unsigned int *presentationSequence )
+{
+   WstRendererGL *rendererGL= (WstRendererGL*)renderer->renderer;
+   WstPresentation result= WstPresentation_unknown;
+   int rc;
+
+   rc= rendererGL->getPresentation( rendererGL->glCtx, rendererGL->nativeWindow, frame,
+                                    presentationTime, presentationSequence );
+   if ( (rc > WstPresentation_unknown) && (rc <= WstPresentation_discarded) )
+   {
+      result= (WstPresentation)rc;
+   }
+
+   return result;
+}
+#endif
+
 static void wstRendererSurfaceSetGeometry( WstRenderer *renderer, WstRenderSurface *surface, int x, int y, int width, int height )
 {
    WstRendererGL *rendererGL= (WstRendererGL*)renderer->renderer;
@@ -2489,6 +3495,7 @@ static void wstRendererResolutionChangeEnd( WstRenderer *renderer )
       }
       #endif
       #endif
+      rendererGL->needFullRepaint= true;
    }
 }
 #endif
@@ -2526,6 +3533,16 @@ int renderer_init( WstRenderer *renderer, int argc, char **argv )
       renderer->resolutionChangeBegin= wstRendererResolutionChangeBegin;
       renderer->resolutionChangeEnd= wstRendererResolutionChangeEnd;
       #endif
+      renderer->surfaceSetDamage= wstRendererSurfaceSetDamage;
+      renderer->surfaceSetOpaqueRegion= wstRendererSurfaceSetOpaqueRegion;
+      renderer->surfaceGetComposed= wstRendererSurfaceGetComposed;
+      renderer->surfaceGetBufferConsumed= wstRendererSurfaceGetBufferConsumed;
+      #if defined (WESTEROS_PLATFORM_EMBEDDED)
+      if ( rendererGL->getPresentation )
+      {
+         renderer->queryPresentation= wstRendererQueryPresentation;
+      }
+      #endif
    }
    else
    {
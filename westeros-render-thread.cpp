@@ -0,0 +1,1062 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <vector>
+
+#include "wayland-server.h"
+#include "westeros-render.h"
+
+#define WESTEROS_UNUSED(x) ((void)(x))
+
+#define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+/*
+ * Threaded renderer
+ *
+ * Wraps a renderer module so that all of its work, including buffer upload
+ * and buffer swap, is done on a dedicated render thread.  The compositor
+ * drives the wrapper exactly as it would the module.  Surface setters and
+ * commits are recorded as pending state.  Each call to updateScene publishes
+ * the pending state as a snapshot for the next frame and wakes the render
+ * thread which latches the snapshot into the module and composes.  Snapshots
+ * published while the render thread is busy are merged so the protocol thread
+ * never waits on a swap.  Once a frame has been composed the render thread
+ * signals the protocol thread which then invokes vblankCB and frameDoneCB.
+ */
+
+#define WST_SURFACE_DIRTY_GEOMETRY    (1<<0)
+#define WST_SURFACE_DIRTY_VISIBLE     (1<<1)
+#define WST_SURFACE_DIRTY_OPACITY     (1<<2)
+#define WST_SURFACE_DIRTY_ZORDER      (1<<3)
+#define WST_SURFACE_DIRTY_CROP        (1<<4)
+#define WST_SURFACE_DIRTY_OPAQUE      (1<<5)
+
+#define DEFAULT_SURFACE_WIDTH (0)
+#define DEFAULT_SURFACE_HEIGHT (0)
+
+typedef struct _WstRendererThread WstRendererThread;
+
+typedef struct _WstThreadSurfaceState
+{
+   unsigned int dirty;
+   bool visible;
+   int x;
+   int y;
+   int width;
+   int height;
+   float opacity;
+   float zorder;
+   float cropX;
+   float cropY;
+   float cropWidth;
+   float cropHeight;
+   std::vector<WstRect> opaqueRegion;
+} WstThreadSurfaceState;
+
+typedef struct _WstThreadSurfaceCommit
+{
+   bool pending;
+   bool dropped;
+   struct wl_resource *resource;
+   bool fullDamage;
+   WstRect damage;
+   struct wl_listener resourceDestroyListener;
+} WstThreadSurfaceCommit;
+
+typedef struct _WstThreadSurface
+{
+   WstRendererThread *rt;
+   bool destroyed;
+
+   // Written by the protocol thread, read back from the module after each frame
+   WstThreadSurfaceState pending;
+   WstThreadSurfaceCommit pendingCommit;
+   bool composed;
+   unsigned int commitSerial;
+   unsigned int consumedSerial;
+
+   // Snapshot to be latched by the render thread for the next frame
+   WstThreadSurfaceState published;
+   WstThreadSurfaceCommit publishedCommit;
+   unsigned int publishedSerial;
+
+   // Only accessed by the render thread
+   WstRenderSurface *surface;
+} WstThreadSurface;
+
+typedef struct _WstRendererThread
+{
+   WstRenderer *renderer;
+   WstRenderer *real;
+   const char *moduleName;
+   int argc;
+   char **argv;
+   struct wl_display *display;
+
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   pthread_t threadId;
+   bool threadStarted;
+   bool initDone;
+   bool initFailed;
+   bool stopRequested;
+
+   std::vector<WstThreadSurface*> surfaces;
+   bool scenePending;
+   bool cleanupPending;
+   bool resolutionChangeBeginPending;
+   bool resolutionChangeEndPending;
+   int outputWidth;
+   int outputHeight;
+   unsigned int publishCount;
+   unsigned int renderedGeneration;
+
+   bool vblankReported;
+   unsigned int frame;
+   long long nextVBlankTime;
+   long long vblankInterval;
+
+   int frameDoneFd;
+   struct wl_event_source *frameDoneSource;
+} WstRendererThread;
+
+static void wstThreadSurfaceInitState( WstThreadSurfaceState *state );
+static void wstThreadSurfaceAddDamage( WstThreadSurfaceCommit *commit, bool fullDamage, WstRect *damage );
+static void wstThreadSurfaceSetResource( WstThreadSurfaceCommit *commit, struct wl_resource *resource );
+static void wstThreadSurfaceClearCommit( WstThreadSurfaceCommit *commit );
+static void wstThreadSurfacePendingResourceDestroyed( struct wl_listener *listener, void *data );
+static void wstThreadSurfacePublishedResourceDestroyed( struct wl_listener *listener, void *data );
+static void wstThreadSurfaceFree( WstThreadSurface *ts );
+static bool wstRendererThreadLatch( WstRendererThread *rt );
+static void wstRendererThreadReadBack( WstRendererThread *rt );
+static void wstRendererThreadDestroySurfaces( WstRendererThread *rt, bool all );
+static void* wstRendererThread( void *arg );
+static void wstRendererThreadVBlank( void *userData, unsigned int frame,
+                                     long long nextVBlankTime, long long vblankInterval );
+static int wstRendererThreadFrameDone( int fd, uint32_t mask, void *data );
+
+
+static void wstThreadSurfaceInitState( WstThreadSurfaceState *state )
+{
+   state->dirty= 0;
+   state->visible= true;
+   state->x= 0;
+   state->y= 0;
+   state->width= DEFAULT_SURFACE_WIDTH;
+   state->height= DEFAULT_SURFACE_HEIGHT;
+   state->opacity= 1.0;
+   state->zorder= 0.5;
+   state->cropX= 0.0;
+   state->cropY= 0.0;
+   state->cropWidth= 1.0;
+   state->cropHeight= 1.0;
+}
+
+static void wstThreadSurfaceAddDamage( WstThreadSurfaceCommit *commit, bool fullDamage, WstRect *damage )
+{
+   int x0, y0, x1, y1;
+
+   // A commit that supersedes one that was never latched must also
+   // refresh everything the earlier one would have.  Damage is relative
+   // to the previous buffer so after a dropped commit it is not enough.
+   if ( !commit->pending )
+   {
+      commit->fullDamage= (fullDamage || commit->dropped);
+      commit->damage= *damage;
+   }
+   else if ( commit->fullDamage || fullDamage )
+   {
+      commit->fullDamage= true;
+   }
+   else
+   {
+      x0= MIN( commit->damage.x, damage->x );
+      y0= MIN( commit->damage.y, damage->y );
+      x1= MAX( commit->damage.x+commit->damage.width, damage->x+damage->width );
+      y1= MAX( commit->damage.y+commit->damage.height, damage->y+damage->height );
+      commit->damage.x= x0;
+      commit->damage.y= y0;
+      commit->damage.width= x1-x0;
+      commit->damage.height= y1-y0;
+   }
+}
+
+static void wstThreadSurfaceSetResource( WstThreadSurfaceCommit *commit, struct wl_resource *resource )
+{
+   if ( commit->resource )
+   {
+      wl_list_remove( &commit->resourceDestroyListener.link );
+   }
+   commit->resource= resource;
+   if ( commit->resource )
+   {
+      wl_resource_add_destroy_listener( commit->resource, &commit->resourceDestroyListener );
+   }
+   commit->pending= true;
+}
+
+static void wstThreadSurfaceClearCommit( WstThreadSurfaceCommit *commit )
+{
+   if ( commit->resource )
+   {
+      wl_list_remove( &commit->resourceDestroyListener.link );
+      commit->resource= 0;
+   }
+   commit->pending= false;
+   commit->dropped= false;
+   commit->fullDamage= false;
+}
+
+static void wstThreadSurfacePendingResourceDestroyed( struct wl_listener *listener, void *data )
+{
+   WstThreadSurface *ts= wl_container_of(listener, ts, pendingCommit.resourceDestroyListener );
+   WstRendererThread *rt= ts->rt;
+   WESTEROS_UNUSED(data);
+
+   // The buffer is gone before it could be composed so drop the commit
+   pthread_mutex_lock( &rt->mutex );
+   ts->pendingCommit.resource= 0;
+   ts->pendingCommit.pending= false;
+   ts->pendingCommit.dropped= true;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstThreadSurfacePublishedResourceDestroyed( struct wl_listener *listener, void *data )
+{
+   WstThreadSurface *ts= wl_container_of(listener, ts, publishedCommit.resourceDestroyListener );
+   WstRendererThread *rt= ts->rt;
+   WESTEROS_UNUSED(data);
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->publishedCommit.resource= 0;
+   ts->publishedCommit.pending= false;
+   ts->publishedCommit.dropped= true;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstThreadSurfaceFree( WstThreadSurface *ts )
+{
+   wstThreadSurfaceClearCommit( &ts->pendingCommit );
+   wstThreadSurfaceClearCommit( &ts->publishedCommit );
+   delete ts;
+}
+
+static bool wstRendererThreadLatch( WstRendererThread *rt )
+{
+   WstRenderer *real= rt->real;
+   bool latched= false;
+
+   // Called on the render thread with rt->mutex held
+   if ( (real->outputWidth != rt->outputWidth) || (real->outputHeight != rt->outputHeight) )
+   {
+      real->outputWidth= rt->outputWidth;
+      real->outputHeight= rt->outputHeight;
+   }
+
+   if ( rt->resolutionChangeBeginPending )
+   {
+      rt->resolutionChangeBeginPending= false;
+      WstRendererResolutionChangeBegin( real );
+   }
+
+   if ( rt->resolutionChangeEndPending )
+   {
+      rt->resolutionChangeEndPending= false;
+      WstRendererResolutionChangeEnd( real );
+   }
+
+   if ( rt->cleanupPending )
+   {
+      rt->cleanupPending= false;
+      wstRendererThreadDestroySurfaces( rt, false );
+   }
+
+   if ( !rt->scenePending )
+   {
+      goto exit;
+   }
+   rt->scenePending= false;
+
+   for ( std::vector<WstThreadSurface*>::iterator it= rt->surfaces.begin();
+         it != rt->surfaces.end();
+         ++it )
+   {
+      WstThreadSurface *ts= (*it);
+      WstThreadSurfaceState *state= &ts->published;
+
+      if ( !ts->surface )
+      {
+         ts->surface= WstRendererSurfaceCreate( real );
+         if ( !ts->surface )
+         {
+            continue;
+         }
+
+         // Adopt the module's defaults for anything not yet set
+         if ( !((ts->pending.dirty|state->dirty) & WST_SURFACE_DIRTY_VISIBLE) )
+         {
+            WstRendererSurfaceGetVisible( real, ts->surface, &ts->pending.visible );
+         }
+         if ( !((ts->pending.dirty|state->dirty) & WST_SURFACE_DIRTY_OPACITY) )
+         {
+            WstRendererSurfaceGetOpacity( real, ts->surface, &ts->pending.opacity );
+         }
+         if ( !((ts->pending.dirty|state->dirty) & WST_SURFACE_DIRTY_ZORDER) )
+         {
+            WstRendererSurfaceGetZOrder( real, ts->surface, &ts->pending.zorder );
+         }
+      }
+
+      if ( state->dirty & WST_SURFACE_DIRTY_GEOMETRY )
+      {
+         WstRendererSurfaceSetGeometry( real, ts->surface, state->x, state->y, state->width, state->height );
+      }
+      if ( state->dirty & WST_SURFACE_DIRTY_VISIBLE )
+      {
+         WstRendererSurfaceSetVisible( real, ts->surface, state->visible );
+      }
+      if ( state->dirty & WST_SURFACE_DIRTY_OPACITY )
+      {
+         WstRendererSurfaceSetOpacity( real, ts->surface, state->opacity );
+      }
+      if ( state->dirty & WST_SURFACE_DIRTY_ZORDER )
+      {
+         WstRendererSurfaceSetZOrder( real, ts->surface, state->zorder );
+      }
+      if ( state->dirty & WST_SURFACE_DIRTY_CROP )
+      {
+         WstRendererSurfaceSetCrop( real, ts->surface, state->cropX, state->cropY, state->cropWidth, state->cropHeight );
+      }
+      if ( state->dirty & WST_SURFACE_DIRTY_OPAQUE )
+      {
+         WstRendererSurfaceSetOpaqueRegion( real, ts->surface, state->opaqueRegion );
+      }
+      state->dirty= 0;
+
+      if ( ts->publishedCommit.pending )
+      {
+         bool consumed= false;
+
+         WstRendererSurfaceCommit( real, ts->surface, ts->publishedCommit.resource,
+                                   (ts->publishedCommit.fullDamage ? 0 : &ts->publishedCommit.damage) );
+         if ( WstRendererSurfaceGetBufferConsumed( real, ts->surface, &consumed ) && consumed )
+         {
+            ts->consumedSerial= ts->publishedSerial;
+         }
+         wstThreadSurfaceClearCommit( &ts->publishedCommit );
+      }
+   }
+
+   latched= true;
+
+exit:
+   return latched;
+}
+
+static void wstRendererThreadReadBack( WstRendererThread *rt )
+{
+   WstRenderer *real= rt->real;
+
+   // Called on the render thread with rt->mutex held.  The module may size a
+   // surface from its buffer so geometry is read back unless a newer value
+   // is waiting to be latched.
+   for ( std::vector<WstThreadSurface*>::iterator it= rt->surfaces.begin();
+         it != rt->surfaces.end();
+         ++it )
+   {
+      WstThreadSurface *ts= (*it);
+
+      if ( ts->destroyed || !ts->surface )
+      {
+         continue;
+      }
+
+      if ( !((ts->pending.dirty|ts->published.dirty) & WST_SURFACE_DIRTY_GEOMETRY) )
+      {
+         WstRendererSurfaceGetGeometry( real, ts->surface,
+                                        &ts->pending.x, &ts->pending.y,
+                                        &ts->pending.width, &ts->pending.height );
+      }
+      WstRendererSurfaceGetComposed( real, ts->surface, &ts->composed );
+   }
+}
+
+static void wstRendererThreadDestroySurfaces( WstRendererThread *rt, bool all )
+{
+   std::vector<WstThreadSurface*>::iterator it= rt->surfaces.begin();
+   while ( it != rt->surfaces.end() )
+   {
+      WstThreadSurface *ts= (*it);
+      if ( all || ts->destroyed )
+      {
+         if ( ts->surface )
+         {
+            WstRendererSurfaceDestroy( rt->real, ts->surface );
+            ts->surface= 0;
+         }
+         if ( ts->destroyed )
+         {
+            wstThreadSurfaceFree( ts );
+            it= rt->surfaces.erase( it );
+            continue;
+         }
+      }
+      ++it;
+   }
+}
+
+static void* wstRendererThread( void *arg )
+{
+   WstRendererThread *rt= (WstRendererThread*)arg;
+   WstRenderer *real;
+   unsigned int generation;
+
+   // The module is created, used and destroyed on this thread so that any
+   // graphics context it makes current belongs to this thread
+   real= WstRendererCreate( rt->moduleName, rt->argc, rt->argv, rt->display, 0 );
+
+   pthread_mutex_lock( &rt->mutex );
+   rt->real= real;
+   if ( real )
+   {
+      real->vblankUserData= rt;
+      real->vblankCB= wstRendererThreadVBlank;
+      rt->outputWidth= real->outputWidth;
+      rt->outputHeight= real->outputHeight;
+   }
+   else
+   {
+      rt->initFailed= true;
+   }
+   rt->initDone= true;
+   pthread_cond_signal( &rt->cond );
+
+   while ( real && !rt->stopRequested )
+   {
+      if ( !rt->scenePending &&
+           !rt->cleanupPending &&
+           !rt->resolutionChangeBeginPending &&
+           !rt->resolutionChangeEndPending )
+      {
+         pthread_cond_wait( &rt->cond, &rt->mutex );
+         continue;
+      }
+
+      if ( !wstRendererThreadLatch( rt ) )
+      {
+         continue;
+      }
+      generation= rt->publishCount;
+
+      pthread_mutex_unlock( &rt->mutex );
+
+      WstRendererUpdateScene( real );
+
+      pthread_mutex_lock( &rt->mutex );
+
+      wstRendererThreadReadBack( rt );
+      rt->renderedGeneration= generation;
+
+      eventfd_write( rt->frameDoneFd, 1 );
+   }
+
+   if ( real )
+   {
+      wstRendererThreadDestroySurfaces( rt, true );
+      rt->real= 0;
+   }
+   pthread_mutex_unlock( &rt->mutex );
+
+   if ( real )
+   {
+      WstRendererDestroy( real );
+   }
+
+   return NULL;
+}
+
+static void wstRendererThreadVBlank( void *userData, unsigned int frame,
+                                     long long nextVBlankTime, long long vblankInterval )
+{
+   WstRendererThread *rt= (WstRendererThread*)userData;
+
+   // Called on the render thread from within the module's updateScene
+   pthread_mutex_lock( &rt->mutex );
+   rt->vblankReported= true;
+   rt->frame= frame;
+   rt->nextVBlankTime= nextVBlankTime;
+   rt->vblankInterval= vblankInterval;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static int wstRendererThreadFrameDone( int fd, uint32_t mask, void *data )
+{
+   WstRendererThread *rt= (WstRendererThread*)data;
+   WstRenderer *renderer= rt->renderer;
+   eventfd_t count;
+   bool vblankReported;
+   long long nextVBlankTime, vblankInterval;
+   unsigned int frame, generation;
+   WESTEROS_UNUSED(mask);
+
+   // Runs on the protocol thread
+   eventfd_read( fd, &count );
+
+   pthread_mutex_lock( &rt->mutex );
+   vblankReported= rt->vblankReported;
+   frame= rt->frame;
+   nextVBlankTime= rt->nextVBlankTime;
+   vblankInterval= rt->vblankInterval;
+   rt->vblankReported= false;
+   generation= rt->renderedGeneration;
+   pthread_mutex_unlock( &rt->mutex );
+
+   if ( vblankReported && renderer->vblankCB )
+   {
+      renderer->vblankCB( renderer->vblankUserData, frame, nextVBlankTime, vblankInterval );
+   }
+
+   if ( renderer->frameDoneCB )
+   {
+      renderer->frameDoneCB( renderer->frameDoneUserData, generation );
+   }
+
+   return 0;
+}
+
+static void wstRendererThreadTerm( WstRenderer *renderer )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   if ( rt )
+   {
+      if ( rt->threadStarted )
+      {
+         pthread_mutex_lock( &rt->mutex );
+         rt->stopRequested= true;
+         pthread_cond_signal( &rt->cond );
+         pthread_mutex_unlock( &rt->mutex );
+         pthread_join( rt->threadId, NULL );
+         rt->threadStarted= false;
+      }
+
+      for ( std::vector<WstThreadSurface*>::iterator it= rt->surfaces.begin();
+            it != rt->surfaces.end();
+            ++it )
+      {
+         wstThreadSurfaceFree( (*it) );
+      }
+      rt->surfaces.clear();
+
+      if ( rt->frameDoneSource )
+      {
+         wl_event_source_remove( rt->frameDoneSource );
+         rt->frameDoneSource= 0;
+      }
+      if ( rt->frameDoneFd >= 0 )
+      {
+         close( rt->frameDoneFd );
+         rt->frameDoneFd= -1;
+      }
+
+      pthread_cond_destroy( &rt->cond );
+      pthread_mutex_destroy( &rt->mutex );
+
+      delete rt;
+      renderer->renderer= 0;
+   }
+}
+
+static void wstRendererThreadUpdateScene( WstRenderer *renderer )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   // Publish everything set since the last frame as the snapshot for the
+   // next frame.  Snapshots not yet latched are merged.
+   pthread_mutex_lock( &rt->mutex );
+   for ( std::vector<WstThreadSurface*>::iterator it= rt->surfaces.begin();
+         it != rt->surfaces.end();
+         ++it )
+   {
+      WstThreadSurface *ts= (*it);
+      WstThreadSurfaceState *pending= &ts->pending;
+      WstThreadSurfaceState *published= &ts->published;
+
+      if ( ts->destroyed )
+      {
+         continue;
+      }
+
+      if ( pending->dirty & WST_SURFACE_DIRTY_GEOMETRY )
+      {
+         published->x= pending->x;
+         published->y= pending->y;
+         published->width= pending->width;
+         published->height= pending->height;
+      }
+      if ( pending->dirty & WST_SURFACE_DIRTY_VISIBLE )
+      {
+         published->visible= pending->visible;
+      }
+      if ( pending->dirty & WST_SURFACE_DIRTY_OPACITY )
+      {
+         published->opacity= pending->opacity;
+      }
+      if ( pending->dirty & WST_SURFACE_DIRTY_ZORDER )
+      {
+         published->zorder= pending->zorder;
+      }
+      if ( pending->dirty & WST_SURFACE_DIRTY_CROP )
+      {
+         published->cropX= pending->cropX;
+         published->cropY= pending->cropY;
+         published->cropWidth= pending->cropWidth;
+         published->cropHeight= pending->cropHeight;
+      }
+      if ( pending->dirty & WST_SURFACE_DIRTY_OPAQUE )
+      {
+         published->opaqueRegion= pending->opaqueRegion;
+      }
+      published->dirty |= pending->dirty;
+      pending->dirty= 0;
+
+      if ( ts->pendingCommit.pending )
+      {
+         wstThreadSurfaceAddDamage( &ts->publishedCommit, ts->pendingCommit.fullDamage, &ts->pendingCommit.damage );
+         wstThreadSurfaceSetResource( &ts->publishedCommit, ts->pendingCommit.resource );
+         wstThreadSurfaceClearCommit( &ts->pendingCommit );
+         ts->publishedSerial= ts->commitSerial;
+      }
+   }
+   rt->outputWidth= renderer->outputWidth;
+   rt->outputHeight= renderer->outputHeight;
+   ++rt->publishCount;
+   rt->scenePending= true;
+   pthread_cond_signal( &rt->cond );
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static WstRenderSurface* wstRendererThreadSurfaceCreate( WstRenderer *renderer )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts;
+
+   ts= new WstThreadSurface();
+   if ( ts )
+   {
+      ts->rt= rt;
+      ts->destroyed= false;
+      ts->composed= false;
+      ts->commitSerial= 0;
+      ts->consumedSerial= 0;
+      ts->publishedSerial= 0;
+      ts->surface= 0;
+      wstThreadSurfaceInitState( &ts->pending );
+      wstThreadSurfaceInitState( &ts->published );
+      memset( &ts->pendingCommit, 0, sizeof(WstThreadSurfaceCommit) );
+      memset( &ts->publishedCommit, 0, sizeof(WstThreadSurfaceCommit) );
+      ts->pendingCommit.resourceDestroyListener.notify= wstThreadSurfacePendingResourceDestroyed;
+      ts->publishedCommit.resourceDestroyListener.notify= wstThreadSurfacePublishedResourceDestroyed;
+
+      pthread_mutex_lock( &rt->mutex );
+      rt->surfaces.push_back( ts );
+      pthread_mutex_unlock( &rt->mutex );
+   }
+
+   return (WstRenderSurface*)ts;
+}
+
+static void wstRendererThreadSurfaceDestroy( WstRenderer *renderer, WstRenderSurface *surface )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   // The module surface is destroyed by the render thread
+   pthread_mutex_lock( &rt->mutex );
+   wstThreadSurfaceClearCommit( &ts->pendingCommit );
+   wstThreadSurfaceClearCommit( &ts->publishedCommit );
+   ts->destroyed= true;
+   rt->cleanupPending= true;
+   pthread_cond_signal( &rt->cond );
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceCommit( WstRenderer *renderer, WstRenderSurface *surface, struct wl_resource *resource )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   wstThreadSurfaceSetResource( &ts->pendingCommit, resource );
+   ++ts->commitSerial;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceSetDamage( WstRenderer *renderer, WstRenderSurface *surface, WstRect *damage )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+   WstRect full= { 0, 0, 0, 0 };
+
+   // Damage for a commit is supplied just before the commit itself
+   pthread_mutex_lock( &rt->mutex );
+   wstThreadSurfaceAddDamage( &ts->pendingCommit, (damage == 0), (damage ? damage : &full) );
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceSetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool visible )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.visible= visible;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_VISIBLE;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static bool wstRendererThreadSurfaceGetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool *visible )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+   bool isVisible;
+
+   pthread_mutex_lock( &rt->mutex );
+   isVisible= ts->pending.visible;
+   pthread_mutex_unlock( &rt->mutex );
+
+   *visible= isVisible;
+
+   return isVisible;
+}
+
+static void wstRendererThreadSurfaceSetGeometry( WstRenderer *renderer, WstRenderSurface *surface, int x, int y, int width, int height )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.x= x;
+   ts->pending.y= y;
+   ts->pending.width= width;
+   ts->pending.height= height;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_GEOMETRY;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceGetGeometry( WstRenderer *renderer, WstRenderSurface *surface, int *x, int *y, int *width, int *height )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   *x= ts->pending.x;
+   *y= ts->pending.y;
+   *width= ts->pending.width;
+   *height= ts->pending.height;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceSetOpacity( WstRenderer *renderer, WstRenderSurface *surface, float opacity )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.opacity= opacity;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_OPACITY;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static float wstRendererThreadSurfaceGetOpacity( WstRenderer *renderer, WstRenderSurface *surface, float *opacity )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+   float opacityLevel;
+
+   pthread_mutex_lock( &rt->mutex );
+   opacityLevel= ts->pending.opacity;
+   pthread_mutex_unlock( &rt->mutex );
+
+   *opacity= opacityLevel;
+
+   return opacityLevel;
+}
+
+static void wstRendererThreadSurfaceSetZOrder( WstRenderer *renderer, WstRenderSurface *surface, float z )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.zorder= z;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_ZORDER;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static float wstRendererThreadSurfaceGetZOrder( WstRenderer *renderer, WstRenderSurface *surface, float *z )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+   float zLevel;
+
+   pthread_mutex_lock( &rt->mutex );
+   zLevel= ts->pending.zorder;
+   pthread_mutex_unlock( &rt->mutex );
+
+   *z= zLevel;
+
+   return zLevel;
+}
+
+static void wstRendererThreadSurfaceSetCrop( WstRenderer *renderer, WstRenderSurface *surface, float x, float y, float width, float height )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.cropX= x;
+   ts->pending.cropY= y;
+   ts->pending.cropWidth= width;
+   ts->pending.cropHeight= height;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_CROP;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadSurfaceSetOpaqueRegion( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   pthread_mutex_lock( &rt->mutex );
+   ts->pending.opaqueRegion= rects;
+   ts->pending.dirty |= WST_SURFACE_DIRTY_OPAQUE;
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static bool wstRendererThreadSurfaceGetComposed( WstRenderer *renderer, WstRenderSurface *surface, bool *composed )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+   bool isComposed;
+
+   // Reflects the most recent frame the render thread composed
+   pthread_mutex_lock( &rt->mutex );
+   isComposed= ts->composed;
+   pthread_mutex_unlock( &rt->mutex );
+
+   *composed= isComposed;
+
+   return isComposed;
+}
+
+static bool wstRendererThreadSurfaceGetBufferConsumed( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+   WstThreadSurface *ts= (WstThreadSurface*)surface;
+
+   // True once the render thread has latched the most recent commit and the
+   // module kept its own copy of the buffer
+   pthread_mutex_lock( &rt->mutex );
+   *consumed= (ts->commitSerial && (ts->consumedSerial == ts->commitSerial));
+   pthread_mutex_unlock( &rt->mutex );
+
+   return true;
+}
+
+static void wstRendererThreadQueryDmabufFormats( WstRenderer *renderer, int **formats, int *num_formats )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   WstRendererQueryDmabufFormats( rt->real, formats, num_formats );
+}
+
+static void wstRendererThreadQueryDmabufModifiers( WstRenderer *renderer, int format, uint64_t **modifiers, int *num_modifiers )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   WstRendererQueryDmabufModifiers( rt->real, format, modifiers, num_modifiers );
+}
+
+static WstPresentation wstRendererThreadQueryPresentation( WstRenderer *renderer, unsigned int frame,
+                                                           long long *presentationTime, unsigned int *presentationSequence )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   // Presentation state is kept by the platform and is safe to query from the protocol thread
+   return WstRendererQueryPresentation( rt->real, frame, presentationTime, presentationSequence );
+}
+
+static void wstRendererThreadResolutionChangeBegin( WstRenderer *renderer )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   pthread_mutex_lock( &rt->mutex );
+   rt->resolutionChangeBeginPending= true;
+   pthread_cond_signal( &rt->cond );
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+static void wstRendererThreadResolutionChangeEnd( WstRenderer *renderer )
+{
+   WstRendererThread *rt= (WstRendererThread*)renderer->renderer;
+
+   pthread_mutex_lock( &rt->mutex );
+   rt->outputWidth= renderer->outputWidth;
+   rt->outputHeight= renderer->outputHeight;
+   rt->resolutionChangeEndPending= true;
+   pthread_cond_signal( &rt->cond );
+   pthread_mutex_unlock( &rt->mutex );
+}
+
+WstRenderer* WstRendererCreateThreaded( const char *moduleName, int argc, char **argv,
+                                        struct wl_display *display, WstNestedConnection *nc )
+{
+   bool error= false;
+   WstRenderer *renderer= 0;
+   WstRendererThread *rt= 0;
+   struct wl_event_loop *loop;
+   int rc;
+
+   if ( nc )
+   {
+      printf("WstRendererCreateThreaded: threaded rendering is not supported for nested composition\n");
+      goto exit;
+   }
+
+   renderer= (WstRenderer*)calloc( 1, sizeof(WstRenderer) );
+   if ( !renderer )
+   {
+      goto exit;
+   }
+
+   rt= new WstRendererThread();
+   if ( !rt )
+   {
+      error= true;
+      goto exit;
+   }
+   rt->renderer= renderer;
+   rt->moduleName= moduleName;
+   rt->argc= argc;
+   rt->argv= argv;
+   rt->display= display;
+   rt->frameDoneFd= -1;
+   pthread_mutex_init( &rt->mutex, 0 );
+   pthread_cond_init( &rt->cond, 0 );
+
+   renderer->display= display;
+   renderer->renderer= rt;
+   renderer->renderTerm= wstRendererThreadTerm;
+   renderer->updateScene= wstRendererThreadUpdateScene;
+   renderer->surfaceCreate= wstRendererThreadSurfaceCreate;
+   renderer->surfaceDestroy= wstRendererThreadSurfaceDestroy;
+   renderer->surfaceCommit= wstRendererThreadSurfaceCommit;
+   renderer->surfaceSetVisible= wstRendererThreadSurfaceSetVisible;
+   renderer->surfaceGetVisible= wstRendererThreadSurfaceGetVisible;
+   renderer->surfaceSetGeometry= wstRendererThreadSurfaceSetGeometry;
+   renderer->surfaceGetGeometry= wstRendererThreadSurfaceGetGeometry;
+   renderer->surfaceSetOpacity= wstRendererThreadSurfaceSetOpacity;
+   renderer->surfaceGetOpacity= wstRendererThreadSurfaceGetOpacity;
+   renderer->surfaceSetZOrder= wstRendererThreadSurfaceSetZOrder;
+   renderer->surfaceGetZOrder= wstRendererThreadSurfaceGetZOrder;
+   renderer->surfaceSetCrop= wstRendererThreadSurfaceSetCrop;
+   renderer->resolutionChangeBegin= wstRendererThreadResolutionChangeBegin;
+   renderer->resolutionChangeEnd= wstRendererThreadResolutionChangeEnd;
+   renderer->surfaceSetDamage= wstRendererThreadSurfaceSetDamage;
+   renderer->surfaceSetOpaqueRegion= wstRendererThreadSurfaceSetOpaqueRegion;
+   renderer->surfaceGetComposed= wstRendererThreadSurfaceGetComposed;
+   renderer->surfaceGetBufferConsumed= wstRendererThreadSurfaceGetBufferConsumed;
+
+   rt->frameDoneFd= eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+   if ( rt->frameDoneFd < 0 )
+   {
+      printf("WstRendererCreateThreaded: unable to create frame done eventfd\n");
+      error= true;
+      goto exit;
+   }
+
+   loop= wl_display_get_event_loop( display );
+   rt->frameDoneSource= wl_event_loop_add_fd( loop, rt->frameDoneFd, WL_EVENT_READABLE,
+                                              wstRendererThreadFrameDone, rt );
+   if ( !rt->frameDoneSource )
+   {
+      printf("WstRendererCreateThreaded: unable to add frame done source\n");
+      error= true;
+      goto exit;
+   }
+
+   pthread_mutex_lock( &rt->mutex );
+   rc= pthread_create( &rt->threadId, NULL, wstRendererThread, rt );
+   if ( rc )
+   {
+      pthread_mutex_unlock( &rt->mutex );
+      printf("WstRendererCreateThreaded: unable to start render thread: %d\n", rc );
+      error= true;
+      goto exit;
+   }
+   rt->threadStarted= true;
+   while ( !rt->initDone )
+   {
+      pthread_cond_wait( &rt->cond, &rt->mutex );
+   }
+   if ( rt->initFailed )
+   {
+      pthread_mutex_unlock( &rt->mutex );
+      error= true;
+      goto exit;
+   }
+   rt->argc= 0;
+   rt->argv= 0;
+   renderer->outputWidth= rt->outputWidth;
+   renderer->outputHeight= rt->outputHeight;
+   renderer->nativeWindow= rt->real->nativeWindow;
+   if ( rt->real->queryDmabufFormats )
+   {
+      renderer->queryDmabufFormats= wstRendererThreadQueryDmabufFormats;
+   }
+   if ( rt->real->queryDmabufModifiers )
+   {
+      renderer->queryDmabufModifiers= wstRendererThreadQueryDmabufModifiers;
+   }
+   if ( rt->real->queryPresentation )
+   {
+      renderer->queryPresentation= wstRendererThreadQueryPresentation;
+   }
+   pthread_mutex_unlock( &rt->mutex );
+
+   printf("WstRendererCreateThreaded: module (%s) running on render thread\n", moduleName );
+
+exit:
+
+   if ( error )
+   {
+      WstRendererDestroy( renderer );
+      renderer= 0;
+   }
+
+   return renderer;
+}
@@ -179,8 +179,12 @@ void WstRendererSurfaceDestroy( WstRenderer *renderer, WstRenderSurface *surface
    renderer->surfaceDestroy( renderer, surface );
 }
 
-void WstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *surface, struct wl_resource *resource )
+void WstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *surface, struct wl_resource *resource, WstRect *damage )
 {
+   if ( renderer->surfaceSetDamage )
+   {
+      renderer->surfaceSetDamage( renderer, surface, damage );
+   }
    renderer->surfaceCommit( renderer, surface, resource );
 }
 
@@ -280,3 +284,43 @@ void WstRendererResolutionChangeEnd( WstRenderer *renderer )
    }
 }
 
+void WstRendererSurfaceSetOpaqueRegion( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects )
+{
+   if ( renderer->surfaceSetOpaqueRegion )
+   {
+      renderer->surfaceSetOpaqueRegion( renderer, surface, rects );
+   }
+}
+
+bool WstRendererSurfaceGetComposed( WstRenderer *renderer, WstRenderSurface *surface, bool *composed )
+{
+   // Renderers that don't track what they drew treat every visible surface as composed
+   if ( renderer->surfaceGetComposed )
+   {
+      return renderer->surfaceGetComposed( renderer, surface, composed );
+   }
+   return renderer->surfaceGetVisible( renderer, surface, composed );
+}
+
+bool WstRendererSurfaceGetBufferConsumed( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed )
+{
+   // True when the renderer kept its own copy of the last committed buffer and
+   // no longer needs the client's storage
+   if ( renderer->surfaceGetBufferConsumed )
+   {
+      return renderer->surfaceGetBufferConsumed( renderer, surface, consumed );
+   }
+   return false;
+}
+
+WstPresentation WstRendererQueryPresentation( WstRenderer *renderer, unsigned int frame,
+                                              long long *presentationTime, unsigned int *presentationSequence )
+{
+   // Frame is the value passed to vblankCB when the frame was swapped
+   if ( renderer->queryPresentation && frame )
+   {
+      return renderer->queryPresentation( renderer, frame, presentationTime, presentationSequence );
+   }
+   return WstPresentation_unknown;
+}
+
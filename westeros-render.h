@@ -65,6 +65,15 @@ typedef enum _WstHints
    WstHints_hidden= (1<<5),
 } WstHints;
 
+// Presentation state of a composed frame as reported by queryPresentation
+typedef enum _WstPresentation
+{
+   WstPresentation_unknown= 0,
+   WstPresentation_pending,
+   WstPresentation_presented,
+   WstPresentation_discarded
+} WstPresentation;
+
 typedef struct _WstRenderer WstRenderer;
 typedef struct _WstRenderSurface WstRenderSurface;
 typedef struct _WstNestedConnection WstNestedConnection;
@@ -90,6 +99,18 @@ typedef void (*WSTMethodDelegateUpdateScene)( WstRenderer *renderer, std::vector
 typedef void (*WSTMethodHolePunch)( WstRenderer *renderr, int x, int y, int width, int height );
 typedef void (*WSTMethodResolutionChangeBegin)( WstRenderer *renderer );
 typedef void (*WSTMethodResolutionChangeEnd)( WstRenderer *renderer );
+typedef void (*WSTMethodSurfaceSetDamage)( WstRenderer *renderer, WstRenderSurface *surface, WstRect *damage );
+typedef void (*WSTMethodSurfaceSetOpaqueRegion)( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects );
+typedef bool (*WSTMethodSurfaceGetComposed)( WstRenderer *renderer, WstRenderSurface *surface, bool *composed );
+typedef bool (*WSTMethodSurfaceGetBufferConsumed)( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed );
+typedef WstPresentation (*WSTMethodQueryPresentation)( WstRenderer *renderer, unsigned int frame,
+                                                      long long *presentationTime, unsigned int *presentationSequence );
+
+// Times are CLOCK_MONOTONIC in microseconds.  frame identifies the frame just
+// swapped for queryPresentation, or is 0 if its presentation can't be tracked.
+typedef void (*WSTCallbackVBlank)( void *userData, unsigned int frame,
+                                   long long nextVBlankTime, long long vblankInterval );
+typedef void (*WSTCallbackFrameDone)( void *userData, unsigned int generation );
 
 typedef struct _WstRenderer
 {
@@ -119,6 +140,11 @@ typedef struct _WstRenderer
    WSTMethodHolePunch holePunch;
    WSTMethodResolutionChangeBegin resolutionChangeBegin;
    WSTMethodResolutionChangeEnd resolutionChangeEnd;
+   WSTMethodSurfaceSetDamage surfaceSetDamage;
+   WSTMethodSurfaceSetOpaqueRegion surfaceSetOpaqueRegion;
+   WSTMethodSurfaceGetComposed surfaceGetComposed;
+   WSTMethodSurfaceGetBufferConsumed surfaceGetBufferConsumed;
+   WSTMethodQueryPresentation queryPresentation;
 
    // For nested composition
    WstNestedConnection *nc;
@@ -134,16 +160,29 @@ typedef struct _WstRenderer
    int hints;
    bool needHolePunch;
    std::vector<WstRect> rects;
+
+   // For display synchronized repaint.  Renderers able to determine vblank
+   // timing invoke this after each swap.
+   void *vblankUserData;
+   WSTCallbackVBlank vblankCB;
+
+   // For threaded rendering.  Invoked on the thread running the wayland
+   // display once the scene published by the generation'th call to
+   // updateScene has been composed.
+   void *frameDoneUserData;
+   WSTCallbackFrameDone frameDoneCB;
 } WstRenderer;
 
 WstRenderer* WstRendererCreate( const char *moduleName, int argc, char **argv, 
                                 struct wl_display *display, WstNestedConnection *nc );
 void WstRendererDestroy( WstRenderer *renderer );
+WstRenderer* WstRendererCreateThreaded( const char *moduleName, int argc, char **argv,
+                                        struct wl_display *display, WstNestedConnection *nc );
 
 void WstRendererUpdateScene( WstRenderer *renderer );
 WstRenderSurface* WstRendererSurfaceCreate( WstRenderer *renderer );
 void WstRendererSurfaceDestroy( WstRenderer *renderer, WstRenderSurface *surface );
-void WstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *surface, struct wl_resource *resource );
+void WstRendererSurfaceCommit( WstRenderer *renderer, WstRenderSurface *surface, struct wl_resource *resource, WstRect *damage );
 void WstRendererSurfaceSetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool visible );
 bool WstRendererSurfaceGetVisible( WstRenderer *renderer, WstRenderSurface *surface, bool *visible );
 void WstRendererSurfaceSetGeometry( WstRenderer *renderer, WstRenderSurface *surface, int x, int y, int width, int height );
@@ -158,6 +197,11 @@ void WstRendererQueryDmabufModifiers( WstRenderer *renderer, int format, uint64_
 void WstRendererDelegateUpdateScene( WstRenderer *renderer, std::vector<WstRect> &rects );
 void WstRendererResolutionChangeBegin( WstRenderer *renderer );
 void WstRendererResolutionChangeEnd( WstRenderer *renderer );
+void WstRendererSurfaceSetOpaqueRegion( WstRenderer *renderer, WstRenderSurface *surface, std::vector<WstRect> &rects );
+bool WstRendererSurfaceGetComposed( WstRenderer *renderer, WstRenderSurface *surface, bool *composed );
+bool WstRendererSurfaceGetBufferConsumed( WstRenderer *renderer, WstRenderSurface *surface, bool *consumed );
+WstPresentation WstRendererQueryPresentation( WstRenderer *renderer, unsigned int frame,
+                                              long long *presentationTime, unsigned int *presentationSequence );
 
 #endif
 
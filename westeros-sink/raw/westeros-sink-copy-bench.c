@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2020 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "westeros-sink-copy.h"
+
+/*
+ * Micro-benchmark for the raw sink copy engine.  Converts I420 frames
+ * into NV12 with the same pitch alignment the sink uses for its dumb
+ * buffers, comparing the scalar reference against the engine selected
+ * for this CPU.
+ *
+ * usage: westeros-sink-copy-bench [iterations]
+ */
+
+#define DEFAULT_ITERATIONS (200)
+
+typedef struct _BenchRes
+{
+   const char *name;
+   int width;
+   int height;
+} BenchRes;
+
+static BenchRes gRes[]=
+{
+   { "720p", 1280, 720 },
+   { "1080p", 1920, 1080 },
+   { "4K", 3840, 2160 }
+};
+
+static long long getCurrentTimeMicro(void)
+{
+   struct timespec tm;
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+   return tm.tv_sec*1000000LL + tm.tv_nsec/1000LL;
+}
+
+static void runFrame( const WstCopyEngine *engine,
+                      unsigned char *destY, unsigned char *destUV, int pitch,
+                      unsigned char *srcY, int width, int height )
+{
+   int Ystride= ((width + 3) & ~3);
+   int Ustride= Ystride/2;
+   unsigned char *srcU= srcY + Ystride*height;
+   unsigned char *srcV= srcU + Ustride*height/2;
+
+   engine->copyPlane( destY, pitch, srcY, Ystride, width, height );
+   engine->interleavePlanes( destUV, pitch, srcU, Ustride, srcV, Ustride, (width+1)/2, height/2 );
+}
+
+static double benchEngine( const WstCopyEngine *engine, int iterations,
+                           unsigned char *destY, unsigned char *destUV, int pitch,
+                           unsigned char *srcY, int width, int height )
+{
+   long long t1, t2;
+   int i;
+
+   /* warm caches and page tables */
+   runFrame( engine, destY, destUV, pitch, srcY, width, height );
+
+   t1= getCurrentTimeMicro();
+   for( i= 0; i < iterations; ++i )
+   {
+      runFrame( engine, destY, destUV, pitch, srcY, width, height );
+   }
+   t2= getCurrentTimeMicro();
+
+   return (double)(t2-t1)/(1000.0*iterations);
+}
+
+int main( int argc, char **argv )
+{
+   int result= -1;
+   int iterations= DEFAULT_ITERATIONS;
+   const WstCopyEngine *scalar, *best;
+   unsigned char *src= 0, *destY= 0, *destUV= 0, *refY= 0, *refUV= 0;
+   int r, i;
+
+   if ( argc > 1 )
+   {
+      iterations= atoi( argv[1] );
+      if ( iterations <= 0 )
+      {
+         printf("usage: %s [iterations]\n", argv[0] );
+         goto exit;
+      }
+   }
+
+   scalar= wstCopyEngineScalar();
+   best= wstCopyEngineGet();
+   printf("copy engine: %s, %d iterations\n", best->name, iterations );
+
+   for( r= 0; r < (int)(sizeof(gRes)/sizeof(gRes[0])); ++r )
+   {
+      int width= gRes[r].width;
+      int height= gRes[r].height;
+      int pitch= ((width+63)&~63);
+      int srcSize= ((width + 3) & ~3)*height*3/2;
+      double msScalar, msBest;
+
+      src= (unsigned char*)malloc( srcSize );
+      destY= (unsigned char*)calloc( 1, pitch*height );
+      destUV= (unsigned char*)calloc( 1, pitch*height/2 );
+      refY= (unsigned char*)calloc( 1, pitch*height );
+      refUV= (unsigned char*)calloc( 1, pitch*height/2 );
+      if ( !src || !destY || !destUV || !refY || !refUV )
+      {
+         printf("Error: no memory for %s buffers\n", gRes[r].name );
+         goto exit;
+      }
+      for( i= 0; i < srcSize; ++i )
+      {
+         src[i]= (unsigned char)(i*7+(i>>11));
+      }
+
+      msScalar= benchEngine( scalar, iterations, refY, refUV, pitch, src, width, height );
+      msBest= benchEngine( best, iterations, destY, destUV, pitch, src, width, height );
+
+      if ( memcmp( refY, destY, pitch*height ) || memcmp( refUV, destUV, pitch*height/2 ) )
+      {
+         printf("Error: %s output of %s differs from scalar reference\n", gRes[r].name, best->name );
+         goto exit;
+      }
+
+      printf("%-6s (%dx%d): scalar %.3f ms/frame  %s %.3f ms/frame  speedup %.2fx\n",
+             gRes[r].name, width, height,
+             msScalar, best->name, msBest,
+             (msBest > 0.0) ? msScalar/msBest : 0.0 );
+
+      free( src ); src= 0;
+      free( destY ); destY= 0;
+      free( destUV ); destUV= 0;
+      free( refY ); refY= 0;
+      free( refUV ); refUV= 0;
+   }
+
+   result= 0;
+
+exit:
+   free( src );
+   free( destY );
+   free( destUV );
+   free( refY );
+   free( refUV );
+
+   return result;
+}
+
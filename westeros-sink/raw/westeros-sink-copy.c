@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2020 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define WST_COPY_SSE2
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WST_COPY_NEON
+#if defined(__arm__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1<<12)
+#endif
+#endif
+#endif
+
+#include "westeros-sink-copy.h"
+
+static void wstCopyPlane( unsigned char *dest, int destStride,
+                          const unsigned char *src, int srcStride,
+                          int width, int height )
+{
+   int row;
+
+   /* libc memcpy is already vectorized, so the only win left is avoiding per row calls */
+   if ( (destStride == width) && (srcStride == width) )
+   {
+      memcpy( dest, src, width*height );
+   }
+   else
+   {
+      for( row= 0; row < height; ++row )
+      {
+         memcpy( dest, src, width );
+         dest += destStride;
+         src += srcStride;
+      }
+   }
+}
+
+static void wstInterleavePlanesScalar( unsigned char *dest, int destStride,
+                                       const unsigned char *srcU, int srcUStride,
+                                       const unsigned char *srcV, int srcVStride,
+                                       int width, int height )
+{
+   int row, col;
+   unsigned char *d;
+   const unsigned char *u, *v;
+
+   for( row= 0; row < height; ++row )
+   {
+      d= dest;
+      u= srcU;
+      v= srcV;
+      for( col= 0; col < width; ++col )
+      {
+         *d++= *u++;
+         *d++= *v++;
+      }
+      dest += destStride;
+      srcU += srcUStride;
+      srcV += srcVStride;
+   }
+}
+
+#ifdef WST_COPY_SSE2
+static void wstInterleavePlanesSSE2( unsigned char *dest, int destStride,
+                                     const unsigned char *srcU, int srcUStride,
+                                     const unsigned char *srcV, int srcVStride,
+                                     int width, int height )
+{
+   int row, col;
+   int widthSimd= (width & ~15);
+   unsigned char *d;
+   const unsigned char *u, *v;
+
+   for( row= 0; row < height; ++row )
+   {
+      d= dest;
+      u= srcU;
+      v= srcV;
+      for( col= 0; col < widthSimd; col += 16 )
+      {
+         __m128i U= _mm_loadu_si128( (const __m128i*)u );
+         __m128i V= _mm_loadu_si128( (const __m128i*)v );
+         _mm_storeu_si128( (__m128i*)d, _mm_unpacklo_epi8( U, V ) );
+         _mm_storeu_si128( (__m128i*)(d+16), _mm_unpackhi_epi8( U, V ) );
+         d += 32;
+         u += 16;
+         v += 16;
+      }
+      for( ; col < width; ++col )
+      {
+         *d++= *u++;
+         *d++= *v++;
+      }
+      dest += destStride;
+      srcU += srcUStride;
+      srcV += srcVStride;
+   }
+}
+#endif
+
+#ifdef WST_COPY_NEON
+static void wstInterleavePlanesNEON( unsigned char *dest, int destStride,
+                                     const unsigned char *srcU, int srcUStride,
+                                     const unsigned char *srcV, int srcVStride,
+                                     int width, int height )
+{
+   int row, col;
+   int widthSimd= (width & ~15);
+   unsigned char *d;
+   const unsigned char *u, *v;
+
+   for( row= 0; row < height; ++row )
+   {
+      d= dest;
+      u= srcU;
+      v= srcV;
+      for( col= 0; col < widthSimd; col += 16 )
+      {
+         uint8x16x2_t UV;
+         UV.val[0]= vld1q_u8( u );
+         UV.val[1]= vld1q_u8( v );
+         vst2q_u8( d, UV );
+         d += 32;
+         u += 16;
+         v += 16;
+      }
+      for( ; col < width; ++col )
+      {
+         *d++= *u++;
+         *d++= *v++;
+      }
+      dest += destStride;
+      srcU += srcUStride;
+      srcV += srcVStride;
+   }
+}
+#endif
+
+static const WstCopyEngine gCopyEngineScalar=
+{
+   "scalar",
+   wstCopyPlane,
+   wstInterleavePlanesScalar
+};
+
+#ifdef WST_COPY_SSE2
+static const WstCopyEngine gCopyEngineSSE2=
+{
+   "sse2",
+   wstCopyPlane,
+   wstInterleavePlanesSSE2
+};
+#endif
+
+#ifdef WST_COPY_NEON
+static const WstCopyEngine gCopyEngineNEON=
+{
+   "neon",
+   wstCopyPlane,
+   wstInterleavePlanesNEON
+};
+#endif
+
+const WstCopyEngine *wstCopyEngineScalar( void )
+{
+   return &gCopyEngineScalar;
+}
+
+const WstCopyEngine *wstCopyEngineGet( void )
+{
+   const WstCopyEngine *engine= &gCopyEngineScalar;
+
+   if ( getenv("WESTEROS_SINK_NO_SIMD") )
+   {
+      goto exit;
+   }
+
+   #if defined(WST_COPY_NEON)
+   #if defined(__arm__)
+   if ( getauxval( AT_HWCAP ) & HWCAP_NEON )
+   #endif
+   {
+      engine= &gCopyEngineNEON;
+   }
+   #elif defined(WST_COPY_SSE2)
+   __builtin_cpu_init();
+   if ( __builtin_cpu_supports("sse2") )
+   {
+      engine= &gCopyEngineSSE2;
+   }
+   #endif
+
+exit:
+   return engine;
+}
+
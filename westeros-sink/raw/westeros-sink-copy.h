@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2020 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WESTEROS_SINK_COPY_H__
+#define __WESTEROS_SINK_COPY_H__
+
+/*
+ * Plane copy engine used by the raw sink to move decoded frames into
+ * DRM dumb buffers.  copyPlane copies 'width' bytes from each of 'height'
+ * rows.  interleavePlanes merges separate U and V planes into a single
+ * UV plane (I420 to NV12), 'width' being the number of chroma samples
+ * per row.
+ */
+typedef struct _WstCopyEngine
+{
+   const char *name;
+   void (*copyPlane)( unsigned char *dest, int destStride,
+                      const unsigned char *src, int srcStride,
+                      int width, int height );
+   void (*interleavePlanes)( unsigned char *dest, int destStride,
+                             const unsigned char *srcU, int srcUStride,
+                             const unsigned char *srcV, int srcVStride,
+                             int width, int height );
+} WstCopyEngine;
+
+/* Portable reference implementation */
+const WstCopyEngine *wstCopyEngineScalar( void );
+
+/*
+ * Returns the fastest engine supported by the running CPU.  Setting
+ * WESTEROS_SINK_NO_SIMD forces the scalar engine.
+ */
+const WstCopyEngine *wstCopyEngineGet( void );
+
+#endif
+
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <xf86drm.h>
+
+#include "westeros-sink-drm-pool.h"
+
+#ifndef WESTEROS_UNUSED
+#define WESTEROS_UNUSED(x) ((void)(x))
+#endif
+
+static gboolean drmBufferPoolCreateDumb( GstWesterosDrmBufferPool *drmPool, struct drm_mode_create_dumb *createDumb );
+static void drmBufferPoolDestroyDumb( GstWesterosDrmBufferPool *drmPool, uint32_t handle );
+
+G_DEFINE_TYPE (GstWesterosDrmBufferPool, gst_westeros_drm_buffer_pool, GST_TYPE_BUFFER_POOL);
+
+static const gchar **drmBufferPoolGetOptions( GstBufferPool *pool )
+{
+   static const gchar *options[]= { GST_BUFFER_POOL_OPTION_VIDEO_META, NULL };
+
+   WESTEROS_UNUSED(pool);
+
+   return options;
+}
+
+/*
+ * Both planes share one dumb buffer, the same layout as a contiguous NV12 frame
+ */
+static gboolean drmBufferPoolCreateDumb( GstWesterosDrmBufferPool *drmPool, struct drm_mode_create_dumb *createDumb )
+{
+   gboolean result= FALSE;
+   GstVideoInfo *info= &drmPool->info;
+   int height, rc;
+
+   height= GST_VIDEO_INFO_HEIGHT(info);
+
+   memset( createDumb, 0, sizeof(*createDumb) );
+   if ( drmPool->useVideoMeta )
+   {
+      createDumb->width= ((GST_VIDEO_INFO_WIDTH(info)+63)&~63);
+   }
+   else
+   {
+      createDumb->width= GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+   }
+   createDumb->height= height + (height+1)/2;
+   createDumb->bpp= 8;
+   rc= ioctl( drmPool->drmFd, DRM_IOCTL_MODE_CREATE_DUMB, createDumb );
+   if ( rc )
+   {
+      GST_ERROR("DRM_IOCTL_MODE_CREATE_DUMB failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
+
+   result= TRUE;
+
+exit:
+   return result;
+}
+
+static void drmBufferPoolDestroyDumb( GstWesterosDrmBufferPool *drmPool, uint32_t handle )
+{
+   struct drm_mode_destroy_dumb destroyDumb;
+
+   memset( &destroyDumb, 0, sizeof(destroyDumb) );
+   destroyDumb.handle= handle;
+   ioctl( drmPool->drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyDumb );
+}
+
+static gboolean drmBufferPoolSetConfig( GstBufferPool *pool, GstStructure *config )
+{
+   gboolean result= FALSE;
+   GstWesterosDrmBufferPool *drmPool= GST_WESTEROS_DRM_BUFFER_POOL_CAST(pool);
+   GstCaps *caps= 0;
+   GstVideoInfo info;
+   struct drm_mode_create_dumb createDumb;
+   guint minBuffers, maxBuffers, size;
+
+   if ( !gst_buffer_pool_config_get_params( config, &caps, NULL, &minBuffers, &maxBuffers ) || !caps )
+   {
+      GST_WARNING_OBJECT(pool, "no caps in config");
+      goto exit;
+   }
+
+   if ( !gst_video_info_from_caps( &info, caps ) )
+   {
+      GST_WARNING_OBJECT(pool, "unable to get video info from caps %" GST_PTR_FORMAT, caps);
+      goto exit;
+   }
+
+   switch( GST_VIDEO_INFO_FORMAT(&info) )
+   {
+      case GST_VIDEO_FORMAT_NV12:
+      case GST_VIDEO_FORMAT_NV21:
+         break;
+      default:
+         GST_WARNING_OBJECT(pool, "unsupported format %s", gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&info)));
+         goto exit;
+   }
+
+   drmPool->info= info;
+   drmPool->haveInfo= TRUE;
+
+   /*
+    * Upstream that understands video meta gets the pitch chosen by the driver for each
+    * buffer.  Anything else writes with default strides so lay the planes out that way.
+    */
+   drmPool->useVideoMeta= gst_buffer_pool_config_has_option( config, GST_BUFFER_POOL_OPTION_VIDEO_META );
+
+   /* Buffers are larger than info.size when the driver pads the pitch so size the pool from a real one */
+   if ( !drmBufferPoolCreateDumb( drmPool, &createDumb ) )
+   {
+      goto exit;
+   }
+   drmBufferPoolDestroyDumb( drmPool, createDumb.handle );
+   size= createDumb.pitch*createDumb.height;
+   gst_buffer_pool_config_set_params( config, caps, size, minBuffers, maxBuffers );
+
+   GST_DEBUG_OBJECT(pool, "config %dx%d video meta %d pitch %d size %u",
+                    info.width, info.height, drmPool->useVideoMeta, createDumb.pitch, size);
+
+   result= GST_BUFFER_POOL_CLASS(gst_westeros_drm_buffer_pool_parent_class)->set_config( pool, config );
+
+exit:
+   return result;
+}
+
+static GstFlowReturn drmBufferPoolAllocBuffer( GstBufferPool *pool, GstBuffer **buffer, GstBufferPoolAcquireParams *params )
+{
+   GstFlowReturn result= GST_FLOW_ERROR;
+   GstWesterosDrmBufferPool *drmPool= GST_WESTEROS_DRM_BUFFER_POOL_CAST(pool);
+   struct drm_mode_create_dumb createDumb;
+   GstBuffer *buff= 0;
+   GstMemory *mem;
+   GstVideoInfo *info= &drmPool->info;
+   gsize offset[GST_VIDEO_MAX_PLANES];
+   gint stride[GST_VIDEO_MAX_PLANES];
+   int width, height, fd= -1, rc;
+
+   WESTEROS_UNUSED(params);
+
+   if ( !drmPool->haveInfo )
+   {
+      GST_ERROR_OBJECT(pool, "pool not configured");
+      goto exit;
+   }
+
+   width= GST_VIDEO_INFO_WIDTH(info);
+   height= GST_VIDEO_INFO_HEIGHT(info);
+
+   if ( !drmBufferPoolCreateDumb( drmPool, &createDumb ) )
+   {
+      goto exit;
+   }
+
+   /* The exported fd holds a reference so the handle is not needed beyond this */
+   rc= drmPrimeHandleToFD( drmPool->drmFd, createDumb.handle, DRM_CLOEXEC | DRM_RDWR, &fd );
+   drmBufferPoolDestroyDumb( drmPool, createDumb.handle );
+   if ( rc )
+   {
+      GST_ERROR("drmPrimeHandleToFD failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
+
+   mem= gst_dmabuf_allocator_alloc( drmPool->allocator, fd, createDumb.size );
+   if ( !mem )
+   {
+      GST_ERROR("gst_dmabuf_allocator_alloc failed");
+      close( fd );
+      goto exit;
+   }
+
+   if ( drmPool->useVideoMeta )
+   {
+      stride[0]= stride[1]= createDumb.pitch;
+      offset[0]= 0;
+      offset[1]= createDumb.pitch*height;
+   }
+   else
+   {
+      stride[0]= GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+      stride[1]= GST_VIDEO_INFO_PLANE_STRIDE(info, 1);
+      offset[0]= GST_VIDEO_INFO_PLANE_OFFSET(info, 0);
+      offset[1]= GST_VIDEO_INFO_PLANE_OFFSET(info, 1);
+   }
+
+   buff= gst_buffer_new();
+   gst_buffer_append_memory( buff, mem );
+   gst_buffer_add_video_meta_full( buff,
+                                   GST_VIDEO_FRAME_FLAG_NONE,
+                                   GST_VIDEO_INFO_FORMAT(info),
+                                   width,
+                                   height,
+                                   2,
+                                   offset,
+                                   stride );
+
+   GST_LOG_OBJECT(pool, "alloc buffer %p: fd %d size %d pitch %d", buff, fd, (int)createDumb.size, stride[0]);
+
+   *buffer= buff;
+   result= GST_FLOW_OK;
+
+exit:
+   return result;
+}
+
+static void drmBufferPoolFinalize( GObject *object )
+{
+   GstWesterosDrmBufferPool *drmPool= GST_WESTEROS_DRM_BUFFER_POOL_CAST(object);
+
+   if ( drmPool->allocator )
+   {
+      gst_object_unref( drmPool->allocator );
+      drmPool->allocator= 0;
+   }
+   if ( drmPool->drmFd >= 0 )
+   {
+      close( drmPool->drmFd );
+      drmPool->drmFd= -1;
+   }
+
+   G_OBJECT_CLASS(gst_westeros_drm_buffer_pool_parent_class)->finalize( object );
+}
+
+static void gst_westeros_drm_buffer_pool_class_init( GstWesterosDrmBufferPoolClass *klass )
+{
+   GObjectClass *gobject_class= (GObjectClass*)klass;
+   GstBufferPoolClass *bufferpool_class= (GstBufferPoolClass*)klass;
+
+   bufferpool_class->get_options= drmBufferPoolGetOptions;
+   bufferpool_class->set_config= drmBufferPoolSetConfig;
+   bufferpool_class->alloc_buffer= drmBufferPoolAllocBuffer;
+   gobject_class->finalize= drmBufferPoolFinalize;
+}
+
+static void gst_westeros_drm_buffer_pool_init( GstWesterosDrmBufferPool *drmPool )
+{
+   drmPool->allocator= gst_dmabuf_allocator_new();
+   drmPool->drmFd= -1;
+   drmPool->haveInfo= FALSE;
+   drmPool->useVideoMeta= FALSE;
+}
+
+GstBufferPool *wstDrmBufferPoolNew( int drmFd )
+{
+   GstWesterosDrmBufferPool *drmPool= 0;
+
+   drmPool= (GstWesterosDrmBufferPool*)g_object_new( GST_TYPE_WESTEROS_DRM_BUFFER_POOL, NULL );
+   gst_object_ref_sink( drmPool );
+   drmPool->drmFd= drmFd;
+
+   return GST_BUFFER_POOL_CAST(drmPool);
+}
+
+gboolean wstDrmBufferPoolConfigure( GstBufferPool *pool, GstCaps *caps, guint minBuffers, guint *size )
+{
+   gboolean result= FALSE;
+   GstStructure *config;
+
+   /* Configure for the video meta layout, set_config replaces the size with that of a real buffer */
+   config= gst_buffer_pool_get_config( pool );
+   gst_buffer_pool_config_set_params( config, caps, 0, minBuffers, 0 );
+   gst_buffer_pool_config_add_option( config, GST_BUFFER_POOL_OPTION_VIDEO_META );
+   if ( !gst_buffer_pool_set_config( pool, config ) )
+   {
+      GST_WARNING_OBJECT(pool, "failed to set pool config");
+      goto exit;
+   }
+
+   config= gst_buffer_pool_get_config( pool );
+   result= gst_buffer_pool_config_get_params( config, NULL, size, NULL, NULL );
+   gst_structure_free( config );
+
+exit:
+   return result;
+}
+
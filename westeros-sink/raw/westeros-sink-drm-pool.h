@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WESTEROS_SINK_DRM_POOL_H__
+#define __WESTEROS_SINK_DRM_POOL_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+#include <gst/allocators/gstdmabuf.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * Buffer pool offered to upstream in ALLOCATION queries.  Each buffer is
+ * one DRM dumb buffer exported as a single dma-buf memory holding both
+ * planes, with chroma following luma at the driver's pitch, so upstream
+ * decodes straight into scanout memory and the render path imports it
+ * by fd without a copy.
+ */
+#define GST_TYPE_WESTEROS_DRM_BUFFER_POOL (gst_westeros_drm_buffer_pool_get_type())
+#define GST_WESTEROS_DRM_BUFFER_POOL_CAST(obj) ((GstWesterosDrmBufferPool*)(obj))
+#define WST_DRM_POOL_MIN_BUFFERS (4)
+
+typedef struct _GstWesterosDrmBufferPool
+{
+   GstBufferPool parent;
+   GstAllocator *allocator;
+   int drmFd;
+   GstVideoInfo info;
+   gboolean haveInfo;
+   gboolean useVideoMeta;
+} GstWesterosDrmBufferPool;
+
+typedef struct _GstWesterosDrmBufferPoolClass
+{
+   GstBufferPoolClass parent_class;
+} GstWesterosDrmBufferPoolClass;
+
+GType gst_westeros_drm_buffer_pool_get_type(void);
+
+/*
+ * Create a pool allocating from drmFd.  The pool owns drmFd and closes it
+ * when finalized.
+ */
+GstBufferPool *wstDrmBufferPoolNew( int drmFd );
+
+/*
+ * Configure the pool for caps with the video meta layout.  On success
+ * size is set to the size of the pool's buffers, which is larger than
+ * the caps' frame size when the driver pads the pitch.
+ */
+gboolean wstDrmBufferPoolConfigure( GstBufferPool *pool, GstCaps *caps, guint minBuffers, guint *size );
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif
+
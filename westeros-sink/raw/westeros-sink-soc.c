@@ -122,6 +122,9 @@ static bool drmUnlockAllBuffers( GstWesterosSink *sink );
 #ifdef USE_GST_ALLOCATORS
 static WstDrmBuffer *drmImportBuffer( GstWesterosSink *sink, GstBuffer *buffer );
 #endif
+#ifdef USE_DRM_BUFFER_POOL
+static gboolean drmProposeAllocation( GstWesterosSink *sink, GstQuery *query );
+#endif
 static WstDrmBuffer *drmGetBuffer( GstWesterosSink *sink, int width, int height );
 static void drmReleaseBuffer( GstWesterosSink *sink, int buffIndex );
 static int sinkAcquireResources( GstWesterosSink *sink );
@@ -427,6 +430,8 @@ gboolean gst_westeros_sink_soc_init( GstWesterosSink *sink )
          sink->soc.drmBuffer[i].fd[1]= -1;
          sink->soc.drmBuffer[i].handle[0]= 0;
          sink->soc.drmBuffer[i].handle[1]= 0;
+         sink->soc.drmBuffer[i].mapAddr[0]= 0;
+         sink->soc.drmBuffer[i].mapAddr[1]= 0;
          sink->soc.drmBuffer[i].gstbuf= 0;
          sink->soc.drmBuffer[i].localAlloc= false;
       }
@@ -472,6 +477,16 @@ gboolean gst_westeros_sink_soc_init( GstWesterosSink *sink )
       g_frameDebug= (level > 0 ? true : false);
    }
 
+   sink->soc.copyEngine= wstCopyEngineGet();
+   GST_DEBUG("using %s copy engine", sink->soc.copyEngine->name);
+
+   sink->soc.useDrmPool= TRUE;
+   if ( getenv("WESTEROS_SINK_NO_DRM_POOL") )
+   {
+      sink->soc.useDrmPool= FALSE;
+      printf("westeros-sink: drm buffer pool disabled\n");
+   }
+
    result= TRUE;
 
    return result;
@@ -1020,7 +1035,6 @@ void gst_westeros_sink_soc_render( GstWesterosSink *sink, GstBuffer *buffer )
 
             if ( !importedBuffer )
             {
-               unsigned char *data;
                unsigned char *Y, *U, *V;
                int Ystride, Ustride, Vstride;
                #ifdef USE_GST_VIDEO
@@ -1067,7 +1081,7 @@ void gst_westeros_sink_soc_render( GstWesterosSink *sink, GstBuffer *buffer )
                         Vstride= Ystride/2;
                      }
                      U= Y + Ystride*sink->soc.frameHeight;
-                     V= U + Ustride*sink->soc.frameHeight/2;
+                     V= U + Ustride*((sink->soc.frameHeight+1)/2);
                      break;
                   default:
                      Y= U= V= 0;
@@ -1076,62 +1090,18 @@ void gst_westeros_sink_soc_render( GstWesterosSink *sink, GstBuffer *buffer )
 
                if ( Y )
                {
-                  data= (unsigned char*)mmap( NULL, drmBuff->size[0], PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, drmBuff->offset[0] );
-                  if ( data )
-                  {
-                     int row;
-                     unsigned char *destRow= data;
-                     unsigned char *srcYRow= Y;
-                     for( row= 0; row < sink->soc.frameHeight; ++row )
-                     {
-                        memcpy( destRow, srcYRow, Ystride );
-                        destRow += drmBuff->pitch[0];
-                        srcYRow += Ystride;
-                     }
-                     munmap( data, drmBuff->size[0] );
-                  }
+                  const WstCopyEngine *engine= sink->soc.copyEngine;
+                  int width= sink->soc.frameWidth;
+                  int height= sink->soc.frameHeight;
+
+                  engine->copyPlane( drmBuff->mapAddr[0], drmBuff->pitch[0], Y, Ystride, width, height );
                   if ( U && !V )
                   {
-                     data= (unsigned char*)mmap( NULL, drmBuff->size[1], PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, drmBuff->offset[1] );
-                     if ( data )
-                     {
-                        int row;
-                        unsigned char *destRow= data;
-                        unsigned char *srcURow= U;
-                        for( row= 0; row < sink->soc.frameHeight; row += 2 )
-                        {
-                           memcpy( destRow, srcURow, Ustride );
-                           destRow += drmBuff->pitch[1];
-                           srcURow += Ustride;
-                        }
-                        munmap( data, drmBuff->size[1] );
-                     }
+                     engine->copyPlane( drmBuff->mapAddr[1], drmBuff->pitch[1], U, Ustride, ((width+1)&~1), (height+1)/2 );
                   }
                   if ( U && V )
                   {
-                     data= (unsigned char*)mmap( NULL, drmBuff->size[1], PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, drmBuff->offset[1] );
-                     if ( data )
-                     {
-                        int row, col;
-                        unsigned char *dest, *destRow= data;
-                        unsigned char *srcU, *srcURow= U;
-                        unsigned char *srcV, *srcVRow= V;
-                        for( row= 0; row < sink->soc.frameHeight; row += 2 )
-                        {
-                           dest= destRow;
-                           srcU= srcURow;
-                           srcV= srcVRow;
-                           for( col= 0; col < sink->soc.frameWidth; col += 2 )
-                           {
-                              *dest++= *srcU++;
-                              *dest++= *srcV++;
-                           }
-                           destRow += drmBuff->pitch[1];
-                           srcURow += Ustride;
-                           srcVRow += Vstride;
-                        }
-                        munmap( data, drmBuff->size[1] );
-                     }
+                     engine->interleavePlanes( drmBuff->mapAddr[1], drmBuff->pitch[1], U, Ustride, V, Vstride, (width+1)/2, (height+1)/2 );
                   }
                }
             }
@@ -1434,6 +1404,20 @@ void gst_westeros_sink_soc_update_video_position( GstWesterosSink *sink )
 
 gboolean gst_westeros_sink_soc_query( GstWesterosSink *sink, GstQuery *query )
 {
+   gboolean result= FALSE;
+
+   switch( GST_QUERY_TYPE(query) )
+   {
+      #ifdef USE_DRM_BUFFER_POOL
+      case GST_QUERY_ALLOCATION:
+         result= drmProposeAllocation( sink, query );
+         break;
+      #endif
+      default:
+         break;
+   }
+
+   return result;
 }
 
 static void wstSinkSocStopVideo( GstWesterosSink *sink )
@@ -2473,7 +2457,11 @@ static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, i
          stride1= sink->soc.drmBuffer[buffIndex].pitch[1];
          if ( frameFd1 < 0 )
          {
-            offset1= sink->soc.frameWidth*sink->soc.frameHeight;
+            offset1= sink->soc.drmBuffer[buffIndex].offset[1];
+            if ( offset1 == 0 )
+            {
+               offset1= sink->soc.frameWidth*sink->soc.frameHeight;
+            }
             stride1= stride0;
          }
 
@@ -2778,6 +2766,7 @@ static bool drmAllocBuffer( GstWesterosSink *sink, int buffIndex, int width, int
 
       drmBuff->width= width;
       drmBuff->height= height;
+      drmBuff->localAlloc= true;
       GST_LOG("drmAllocBuffer: (%dx%d)", width, height);
 
       width= ((width+63)&~63);
@@ -2805,6 +2794,15 @@ static bool drmAllocBuffer( GstWesterosSink *sink, int buffIndex, int width, int
       drmBuff->size[0]= createDumb.size;
       drmBuff->offset[0]= mapDumb.offset;
 
+      /* Keep the buffer mapped for its lifetime rather than mapping each frame */
+      drmBuff->mapAddr[0]= (unsigned char*)mmap( NULL, drmBuff->size[0], PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, drmBuff->offset[0] );
+      if ( drmBuff->mapAddr[0] == MAP_FAILED )
+      {
+         GST_ERROR("mmap failed: errno %d", errno);
+         drmBuff->mapAddr[0]= 0;
+         goto exit;
+      }
+
       rc= drmPrimeHandleToFD( sink->soc.drmFd, drmBuff->handle[0], DRM_CLOEXEC | DRM_RDWR, &drmBuff->fd[0] );
       if ( rc )
       {
@@ -2814,7 +2812,7 @@ static bool drmAllocBuffer( GstWesterosSink *sink, int buffIndex, int width, int
 
       memset( &createDumb, 0, sizeof(createDumb) );
       createDumb.width= width;
-      createDumb.height= height/2;
+      createDumb.height= (height+1)/2;
       createDumb.bpp= 8;
       rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createDumb );
       if ( rc )
@@ -2835,6 +2833,14 @@ static bool drmAllocBuffer( GstWesterosSink *sink, int buffIndex, int width, int
       drmBuff->size[1]= createDumb.size;
       drmBuff->offset[1]= mapDumb.offset;
 
+      drmBuff->mapAddr[1]= (unsigned char*)mmap( NULL, drmBuff->size[1], PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, drmBuff->offset[1] );
+      if ( drmBuff->mapAddr[1] == MAP_FAILED )
+      {
+         GST_ERROR("mmap failed: errno %d", errno);
+         drmBuff->mapAddr[1]= 0;
+         goto exit;
+      }
+
       rc= drmPrimeHandleToFD( sink->soc.drmFd, drmBuff->handle[1], DRM_CLOEXEC | DRM_RDWR, &drmBuff->fd[1] );
       if ( rc )
       {
@@ -2843,7 +2849,6 @@ static bool drmAllocBuffer( GstWesterosSink *sink, int buffIndex, int width, int
       }
 
       drmBuff->bufferId= buffIndex;
-      drmBuff->localAlloc= true;
 
       result= true;
    }
@@ -2875,6 +2880,11 @@ static void drmFreeBuffer( GstWesterosSink *sink, int buffIndex )
          int *fd, *handle;
          fd= &drmBuff->fd[i];
          handle= &drmBuff->handle[i];
+         if ( drmBuff->mapAddr[i] )
+         {
+            munmap( drmBuff->mapAddr[i], drmBuff->size[i] );
+            drmBuff->mapAddr[i]= 0;
+         }
          if ( *fd >= 0 )
          {
             close( *fd );
@@ -2888,6 +2898,9 @@ static void drmFreeBuffer( GstWesterosSink *sink, int buffIndex )
             *handle= 0;
          }
       }
+      drmBuff->localAlloc= false;
+      drmBuff->width= -1;
+      drmBuff->height= -1;
    }
    else if ( drmBuff->gstbuf )
    {
@@ -2895,6 +2908,8 @@ static void drmFreeBuffer( GstWesterosSink *sink, int buffIndex )
       drmBuff->gstbuf= 0;
       drmBuff->fd[0]= -1;
       drmBuff->fd[1]= -1;
+      drmBuff->width= -1;
+      drmBuff->height= -1;
    }
 }
 
@@ -2970,6 +2985,10 @@ static WstDrmBuffer *drmImportBuffer( GstWesterosSink *sink, GstBuffer *buffer )
          #ifdef USE_GST_VIDEO
          GstVideoMeta *meta= gst_buffer_get_video_meta(buffer);
          #endif
+         if ( drmBuff->localAlloc )
+         {
+            drmFreeBuffer( sink, buffIndex );
+         }
          drmBuff->width= sink->soc.frameWidth;
          drmBuff->height= sink->soc.frameHeight;
          imax= gst_buffer_n_memory( buffer );
@@ -3010,6 +3029,21 @@ static WstDrmBuffer *drmImportBuffer( GstWesterosSink *sink, GstBuffer *buffer )
                drmBuff->pitch[i]= 0;
             }
          }
+         for( ; i < WST_MAX_PLANE; ++i )
+         {
+            /* Plane shares the memory of plane 0, eg. buffers from our own pool */
+            drmBuff->fd[i]= -1;
+            drmBuff->size[i]= 0;
+            drmBuff->offset[i]= 0;
+            drmBuff->pitch[i]= drmBuff->pitch[0];
+            #ifdef USE_GST_VIDEO
+            if ( meta && (i < meta->n_planes) )
+            {
+               drmBuff->offset[i]= meta->offset[i];
+               drmBuff->pitch[i]= meta->stride[i];
+            }
+            #endif
+         }
          drmBuff->bufferId= buffIndex;
          drmBuff->localAlloc= false;
          drmBuff->gstbuf= gst_buffer_ref(buffer);
@@ -3024,6 +3058,75 @@ static WstDrmBuffer *drmImportBuffer( GstWesterosSink *sink, GstBuffer *buffer )
 }
 #endif
 
+#ifdef USE_DRM_BUFFER_POOL
+#include "westeros-sink-drm-pool.c"
+
+static gboolean drmProposeAllocation( GstWesterosSink *sink, GstQuery *query )
+{
+   gboolean result= FALSE;
+   GstCaps *caps= 0;
+   gboolean needPool= FALSE;
+   GstVideoInfo info;
+   GstBufferPool *pool= 0;
+   guint size;
+   int fd;
+
+   gst_query_parse_allocation( query, &caps, &needPool );
+   if ( !caps )
+   {
+      GST_DEBUG("drmProposeAllocation: no caps");
+      goto exit;
+   }
+
+   if ( !gst_video_info_from_caps( &info, caps ) )
+   {
+      GST_DEBUG("drmProposeAllocation: invalid caps");
+      goto exit;
+   }
+
+   /* Strides and plane offsets of input buffers are taken from video meta */
+   gst_query_add_allocation_meta( query, GST_VIDEO_META_API_TYPE, NULL );
+   result= TRUE;
+
+   if (
+        !needPool ||
+        !sink->soc.useDrmPool ||
+        (sink->soc.drmFd < 0) ||
+        ((GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12) &&
+         (GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV21))
+      )
+   {
+      /* Other formats are converted to NV12 while copying so gain nothing from a pool */
+      goto exit;
+   }
+
+   /* The pool keeps its own drm fd since buffers can outlive the sink's */
+   fd= fcntl( sink->soc.drmFd, F_DUPFD_CLOEXEC, 0 );
+   if ( fd < 0 )
+   {
+      GST_ERROR("drmProposeAllocation: failed to dup drm fd: errno %d", errno);
+      goto exit;
+   }
+
+   pool= wstDrmBufferPoolNew( fd );
+   if ( !wstDrmBufferPoolConfigure( pool, caps, WST_DRM_POOL_MIN_BUFFERS, &size ) )
+   {
+      GST_WARNING("drmProposeAllocation: failed to configure pool");
+      goto exit;
+   }
+
+   GST_DEBUG("drmProposeAllocation: offering drm buffer pool %p (%dx%d) size %u", pool, info.width, info.height, size);
+   gst_query_add_allocation_pool( query, pool, size, WST_DRM_POOL_MIN_BUFFERS, 0 );
+
+exit:
+   if ( pool )
+   {
+      gst_object_unref( pool );
+   }
+   return result;
+}
+#endif
+
 static WstDrmBuffer *drmGetBuffer( GstWesterosSink *sink, int width, int height )
 {
    WstDrmBuffer *drmBuff= 0;
@@ -26,6 +26,12 @@
 #include <sys/un.h>
 
 #include "simplebuffer-client-protocol.h"
+#include "westeros-sink-copy.h"
+
+#if defined(USE_GST1) && defined(USE_GST_ALLOCATORS) && defined(USE_GST_VIDEO)
+#define USE_DRM_BUFFER_POOL
+#include "westeros-sink-drm-pool.h"
+#endif
 
 #define WESTEROS_SINK_CAPS \
       "video/x-raw, " \
@@ -41,6 +47,7 @@ typedef struct _WstVideoClientConnection
    gint64 serverRefreshPeriod;
 } WstVideoClientConnection;
 
+
 #define WST_NUM_DRM_BUFFERS (20)
 #define WST_MAX_PLANE (2)
 typedef struct _WstDrmBuffer
@@ -52,6 +59,7 @@ typedef struct _WstDrmBuffer
    gsize size[WST_MAX_PLANE];
    gsize offset[WST_MAX_PLANE];
    gsize pitch[WST_MAX_PLANE];
+   unsigned char *mapAddr[WST_MAX_PLANE];
    gint64 frameTime; /* in microseconds */
    int buffIndex;
    int frameNumber;
@@ -132,6 +140,8 @@ struct _GstWesterosSinkSoc
    GThread *firstFrameThread;
    GThread *underflowThread;
    WstDrmBuffer drmBuffer[WST_NUM_DRM_BUFFERS];
+   const WstCopyEngine *copyEngine;
+   gboolean useDrmPool;
 
    #ifdef GLIB_VERSION_2_32 
    GMutex mutex;
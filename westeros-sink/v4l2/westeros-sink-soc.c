@@ -155,6 +155,7 @@ static bool wstUnlockOutputBuffer( GstWesterosSink *sink, int buffIndex );
 static void wstRequeueOutputBuffer( GstWesterosSink *sink, int buffIndex );
 static WstVideoClientConnection *wstCreateVideoClientConnection( GstWesterosSink *sink, const char *name );
 static void wstDestroyVideoClientConnection( WstVideoClientConnection *conn );
+static void wstSendVersionVideoClientConnection( WstVideoClientConnection *conn );
 static void wstSendFlushVideoClientConnection( WstVideoClientConnection *conn );
 static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, int buffIndex );
 static void wstDecoderReset( GstWesterosSink *sink, bool hard );
@@ -178,6 +179,8 @@ static void swLink( GstWesterosSink *sink );
 static void swUnLink( GstWesterosSink *sink );
 static void swEvent( GstWesterosSink *sink, int id, int p1, void *p2 );
 static void swDisplay( GstWesterosSink *sink, SWFrame *frame );
+static bool swAllocBuffer( GstWesterosSink *sink, SWBuffer *buffer );
+static void swFreeBuffer( GstWesterosSink *sink, int bufferId );
 #endif
 static int sinkAcquireResources( GstWesterosSink *sink );
 static void sinkReleaseResources( GstWesterosSink *sink );
@@ -700,6 +703,9 @@ gboolean gst_westeros_sink_soc_init( GstWesterosSink *sink )
    sink->swUnLink= swUnLink;
    sink->swEvent= swEvent;
    sink->swDisplay= swDisplay;
+   sink->swAllocBuffer= swAllocBuffer;
+   sink->swFreeBuffer= swFreeBuffer;
+   sink->soc.swTextureRef= 0;
    {
       int i;
       for( i= 0; i < WST_NUM_SW_BUFFERS; ++i )
@@ -710,6 +716,23 @@ gboolean gst_westeros_sink_soc_init( GstWesterosSink *sink )
          sink->soc.swBuffer[i].fd1= -1;
          sink->soc.swBuffer[i].handle0= 0;
          sink->soc.swBuffer[i].handle1= 0;
+         sink->soc.swBuffer[i].data0= 0;
+         sink->soc.swBuffer[i].data1= 0;
+         sink->soc.swBuffer[i].chroma= 0;
+         sink->soc.swBuffer[i].inUse= false;
+      }
+      for( i= 0; i < WST_NUM_SW_DIRECT_BUFFERS; ++i )
+      {
+         sink->soc.swDirectBuffer[i].width= -1;
+         sink->soc.swDirectBuffer[i].height= -1;
+         sink->soc.swDirectBuffer[i].fd0= -1;
+         sink->soc.swDirectBuffer[i].fd1= -1;
+         sink->soc.swDirectBuffer[i].handle0= 0;
+         sink->soc.swDirectBuffer[i].handle1= 0;
+         sink->soc.swDirectBuffer[i].data0= 0;
+         sink->soc.swDirectBuffer[i].data1= 0;
+         sink->soc.swDirectBuffer[i].chroma= 0;
+         sink->soc.swDirectBuffer[i].inUse= false;
       }
    }
    #endif
@@ -3407,6 +3430,10 @@ static WstVideoClientConnection *wstCreateVideoClientConnection( GstWesterosSink
          goto exit;
       }
 
+      /* Protocol 1 is used until the server answers with its version */
+      conn->protocolVersion= 1;
+      wstSendVersionVideoClientConnection( conn );
+
       error= false;
    }
 
@@ -3486,23 +3513,126 @@ static int putS64( unsigned char *p,  gint64 n )
    return 8;
 }
 
+static bool wstSendMessageVideoClientConnection( WstVideoClientConnection *conn, unsigned char *mbody, int len,
+                                                 int *fds, int fdCount, bool defer )
+{
+   bool result= false;
+
+   if ( conn )
+   {
+      if ( defer &&
+           (conn->protocolVersion >= 2) &&
+           (conn->pendingLen+len <= WST_VIDEO_PENDING_MAX) )
+      {
+         /* Held until the next send so it shares a single sendmsg with the next frame */
+         memcpy( &conn->pending[conn->pendingLen], mbody, len );
+         conn->pendingLen += len;
+         result= true;
+      }
+      else
+      {
+         struct msghdr msg;
+         struct cmsghdr *cmsg;
+         struct iovec iov[2];
+         char cmbody[CMSG_SPACE(3*sizeof(int))];
+         int iovCount= 0;
+         int totalLen= 0;
+         int sentLen;
+
+         if ( conn->pendingLen > 0 )
+         {
+            iov[iovCount].iov_base= (char*)conn->pending;
+            iov[iovCount].iov_len= conn->pendingLen;
+            totalLen += conn->pendingLen;
+            ++iovCount;
+         }
+         if ( len > 0 )
+         {
+            iov[iovCount].iov_base= (char*)mbody;
+            iov[iovCount].iov_len= len;
+            totalLen += len;
+            ++iovCount;
+         }
+
+         msg.msg_name= NULL;
+         msg.msg_namelen= 0;
+         msg.msg_iov= iov;
+         msg.msg_iovlen= iovCount;
+         msg.msg_control= 0;
+         msg.msg_controllen= 0;
+         msg.msg_flags= 0;
+
+         if ( fdCount > 0 )
+         {
+            if ( fdCount > 3 )
+            {
+               fdCount= 3;
+            }
+            cmsg= (struct cmsghdr*)cmbody;
+            cmsg->cmsg_len= CMSG_LEN(fdCount*sizeof(int));
+            cmsg->cmsg_level= SOL_SOCKET;
+            cmsg->cmsg_type= SCM_RIGHTS;
+            memcpy( CMSG_DATA(cmsg), fds, fdCount*sizeof(int) );
+
+            msg.msg_control= cmsg;
+            msg.msg_controllen= cmsg->cmsg_len;
+         }
+
+         if ( totalLen > 0 )
+         {
+            do
+            {
+               sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
+            }
+            while ( (sentLen < 0) && (errno == EINTR));
+
+            result= (sentLen == totalLen);
+         }
+         conn->pendingLen= 0;
+      }
+   }
+
+   return result;
+}
+
+static void wstFlushMessagesVideoClientConnection( WstVideoClientConnection *conn )
+{
+   if ( conn && (conn->pendingLen > 0) )
+   {
+      if ( wstSendMessageVideoClientConnection( conn, 0, 0, 0, 0, false ) )
+      {
+         FRAME("sent pending updates to video server");
+      }
+   }
+}
+
+static void wstSendVersionVideoClientConnection( WstVideoClientConnection *conn )
+{
+   if ( conn )
+   {
+      unsigned char mbody[5];
+      int len;
+
+      len= 0;
+      mbody[len++]= 'V';
+      mbody[len++]= 'S';
+      mbody[len++]= 2;
+      mbody[len++]= 'V';
+      mbody[len++]= WST_VIDEO_PROTOCOL_VERSION;
+
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, false ) )
+      {
+         GST_DEBUG("sent protocol version %d to video server", WST_VIDEO_PROTOCOL_VERSION);
+      }
+   }
+}
+
 static void wstSendFlushVideoClientConnection( WstVideoClientConnection *conn )
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[4];
       int len;
-      int sentLen;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
 
       len= 0;
       mbody[len++]= 'V';
@@ -3510,16 +3640,7 @@ static void wstSendFlushVideoClientConnection( WstVideoClientConnection *conn )
       mbody[len++]= 1;
       mbody[len++]= 'S';
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, false ) )
       {
          GST_LOG("sent flush to video server");
          FRAME("sent flush to video server");
@@ -3531,19 +3652,8 @@ static void wstSendPauseVideoClientConnection( WstVideoClientConnection *conn, b
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[7];
       int len;
-      int sentLen;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
 
       len= 0;
       mbody[len++]= 'V';
@@ -3552,16 +3662,7 @@ static void wstSendPauseVideoClientConnection( WstVideoClientConnection *conn, b
       mbody[len++]= 'P';
       mbody[len++]= (pause ? 1 : 0);
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, false ) )
       {
          GST_LOG("sent pause %d to video server", pause);
          FRAME("sent pause %d to video server", pause);
@@ -3569,23 +3670,12 @@ static void wstSendPauseVideoClientConnection( WstVideoClientConnection *conn, b
    }
 }
 
-static void wstSendHideVideoClientConnection( WstVideoClientConnection *conn, bool hide )
+static void wstSendHideVideoClientConnection( WstVideoClientConnection *conn, bool hide, bool defer )
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[7];
       int len;
-      int sentLen;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
 
       len= 0;
       mbody[len++]= 'V';
@@ -3594,16 +3684,7 @@ static void wstSendHideVideoClientConnection( WstVideoClientConnection *conn, bo
       mbody[len++]= 'H';
       mbody[len++]= (hide ? 1 : 0);
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, defer ) )
       {
          GST_LOG("sent hide %d to video server", hide);
          FRAME("sent hide %d to video server", hide);
@@ -3616,19 +3697,8 @@ static void wstSendSessionInfoVideoClientConnection( WstVideoClientConnection *c
    if ( conn )
    {
       GstWesterosSink *sink= conn->sink;
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[9];
       int len;
-      int sentLen;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
 
       len= 0;
       mbody[len++]= 'V';
@@ -3638,16 +3708,7 @@ static void wstSendSessionInfoVideoClientConnection( WstVideoClientConnection *c
       mbody[len++]= sink->soc.syncType;
       len += putU32( &mbody[len], conn->sink->soc.sessionId );
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, false ) )
       {
          GST_DEBUG("sent session info: type %d sessionId %d to video server", sink->soc.syncType, sink->soc.sessionId);
          g_print("sent session info: type %d sessionId %d to video server\n", sink->soc.syncType, sink->soc.sessionId);
@@ -3659,19 +3720,8 @@ static void wstSendFrameAdvanceVideoClientConnection( WstVideoClientConnection *
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[4];
       int len;
-      int sentLen;
-
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
 
       len= 0;
       mbody[len++]= 'V';
@@ -3679,16 +3729,7 @@ static void wstSendFrameAdvanceVideoClientConnection( WstVideoClientConnection *
       mbody[len++]= 1;
       mbody[len++]= 'A';
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, false ) )
       {
          GST_LOG("sent frame adavnce to video server");
          FRAME("sent frame advance to video server");
@@ -3696,15 +3737,12 @@ static void wstSendFrameAdvanceVideoClientConnection( WstVideoClientConnection *
    }
 }
 
-static void wstSendRectVideoClientConnection( WstVideoClientConnection *conn )
+static void wstSendRectVideoClientConnection( WstVideoClientConnection *conn, bool defer )
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[20];
       int len;
-      int sentLen;
       int vx, vy, vw, vh;
       GstWesterosSink *sink= conn->sink;
 
@@ -3717,14 +3755,6 @@ static void wstSendRectVideoClientConnection( WstVideoClientConnection *conn )
          wstGetVideoBounds( sink, &vx, &vy, &vw, &vh );
       }
 
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
-
       len= 0;
       mbody[len++]= 'V';
       mbody[len++]= 'S';
@@ -3735,16 +3765,7 @@ static void wstSendRectVideoClientConnection( WstVideoClientConnection *conn )
       len += putU32( &mbody[len], vw );
       len += putU32( &mbody[len], vh );
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, defer ) )
       {
          GST_LOG("sent position to video server");
          FRAME("sent position to video server");
@@ -3752,25 +3773,14 @@ static void wstSendRectVideoClientConnection( WstVideoClientConnection *conn )
    }
 }
 
-static void wstSendRateVideoClientConnection( WstVideoClientConnection *conn )
+static void wstSendRateVideoClientConnection( WstVideoClientConnection *conn, bool defer )
 {
    if ( conn )
    {
-      struct msghdr msg;
-      struct iovec iov[1];
       unsigned char mbody[12];
       int len;
-      int sentLen;
       GstWesterosSink *sink= conn->sink;
 
-      msg.msg_name= NULL;
-      msg.msg_namelen= 0;
-      msg.msg_iov= iov;
-      msg.msg_iovlen= 1;
-      msg.msg_control= 0;
-      msg.msg_controllen= 0;
-      msg.msg_flags= 0;
-
       len= 0;
       mbody[len++]= 'V';
       mbody[len++]= 'S';
@@ -3779,16 +3789,7 @@ static void wstSendRateVideoClientConnection( WstVideoClientConnection *conn )
       len += putU32( &mbody[len], sink->soc.frameRateFractionNum );
       len += putU32( &mbody[len], sink->soc.frameRateFractionDenom );
 
-      iov[0].iov_base= (char*)mbody;
-      iov[0].iov_len= len;
-
-      do
-      {
-         sentLen= sendmsg( conn->socketFd, &msg, MSG_NOSIGNAL );
-      }
-      while ( (sentLen < 0) && (errno == EINTR));
-
-      if ( sentLen == len )
+      if ( wstSendMessageVideoClientConnection( conn, mbody, len, 0, 0, defer ) )
       {
          GST_LOG("sent frame rate to video server");
          FRAME("sent frame rate to video server");
@@ -3964,187 +3965,206 @@ static void wstSetSessionInfo( GstWesterosSink *sink )
    #endif
 }
 
+static void wstReleaseBufferVideoClientConnection( WstVideoClientConnection *conn, int bid )
+{
+   GstWesterosSink *sink= conn->sink;
+
+   if ( (bid >= sink->soc.bufferIdOutBase) && (bid < sink->soc.bufferIdOutBase+sink->soc.numBuffersOut) )
+   {
+      int bi= bid-sink->soc.bufferIdOutBase;
+      if ( sink->soc.outBuffers[bi].locked )
+      {
+         FRAME("out:       release received for buffer %d (%d)", bid, bi);
+         if ( sink->soc.useGfxSync &&
+              !sink->soc.videoPaused &&
+              (bi != sink->soc.pauseGfxBuffIndex) &&
+              (sink->soc.enableTextureSignal ||
+               (sink->soc.captureEnabled && sink->soc.sb)) )
+         {
+            int buffIndex= wstFindVideoBuffer( sink, sink->soc.outBuffers[bi].frameNumber+3 );
+            if ( buffIndex >= 0 )
+            {
+               if ( sink->soc.enableTextureSignal )
+               {
+                  wstProcessTextureSignal( sink, buffIndex );
+               }
+               else if ( sink->soc.captureEnabled && sink->soc.sb )
+               {
+                  wstProcessTextureWayland( sink, buffIndex );
+               }
+            }
+         }
+         if ( wstUnlockOutputBuffer( sink, bi ) )
+         {
+            wstRequeueOutputBuffer( sink, bi );
+         }
+      }
+      else
+      {
+         GST_ERROR("release received for non-locked buffer %d (%d)\n", bid, bi );
+         FRAME("out:       error: release received for non-locked buffer %d (%d)", bid, bi);
+      }
+   }
+   else
+   {
+      GST_DEBUG("release received for stale buffer %d\n", bid );
+      FRAME("out:       note: release received for stale buffer %d", bid);
+   }
+}
+
 static void wstProcessMessagesVideoClientConnection( WstVideoClientConnection *conn )
 {
    if ( conn )
    {
       GstWesterosSink *sink= conn->sink;
-      struct pollfd pfd;
-      int rc;
-
-      pfd.fd= conn->socketFd;
-      pfd.events= POLLIN;
-      pfd.revents= 0;
-
-      rc= poll( &pfd, 1, 0);
-      if ( rc == 1 )
-      {
-         struct msghdr msg;
-         struct iovec iov[1];
-         unsigned char mbody[256];
-         unsigned char *m= mbody;
-         int len;
+      struct msghdr msg;
+      struct iovec iov[1];
+      unsigned char mbody[256];
+      unsigned char *m= mbody;
+      int len;
 
-         iov[0].iov_base= (char*)mbody;
-         iov[0].iov_len= sizeof(mbody);
+      iov[0].iov_base= (char*)mbody;
+      iov[0].iov_len= sizeof(mbody);
 
-         msg.msg_name= NULL;
-         msg.msg_namelen= 0;
-         msg.msg_iov= iov;
-         msg.msg_iovlen= 1;
-         msg.msg_control= 0;
-         msg.msg_controllen= 0;
-         msg.msg_flags= 0;
+      msg.msg_name= NULL;
+      msg.msg_namelen= 0;
+      msg.msg_iov= iov;
+      msg.msg_iovlen= 1;
+      msg.msg_control= 0;
+      msg.msg_controllen= 0;
+      msg.msg_flags= 0;
 
-         do
-         {
-            len= recvmsg( conn->socketFd, &msg, 0 );
-         }
-         while ( (len < 0) && (errno == EINTR));
+      /* A non-blocking read avoids a poll before the read on each frame */
+      do
+      {
+         len= recvmsg( conn->socketFd, &msg, MSG_DONTWAIT );
+      }
+      while ( (len < 0) && (errno == EINTR));
 
-         while ( len >= 4 )
+      while ( len >= 4 )
+      {
+         if ( (m[0] == 'V') && (m[1] == 'S') )
          {
-            if ( (m[0] == 'V') && (m[1] == 'S') )
+            int mlen, id;
+            mlen= m[2];
+            if ( len >= (mlen+3) )
             {
-               int mlen, id;
-               mlen= m[2];
-               if ( len >= (mlen+3) )
+               id= m[3];
+               switch( id )
                {
-                  id= m[3];
-                  switch( id )
-                  {
-                     case 'R':
-                        if ( mlen >= 5)
-                        {
-                          int rate= getU32( &m[4] );
-                          GST_DEBUG("got rate %d from video server", rate);
-                          conn->serverRefreshRate= rate;
-                          if ( rate )
-                          {
-                             conn->serverRefreshPeriod= 1000000LL/rate;
-                          }
-                          FRAME("got rate %d (period %lld us) from video server", rate, conn->serverRefreshPeriod);
-                        }
-                        break;
-                     case 'B':
-                        if ( mlen >= 5)
-                        {
-                          int bid= getU32( &m[4] );
-                          if ( (bid >= sink->soc.bufferIdOutBase) && (bid < sink->soc.bufferIdOutBase+sink->soc.numBuffersOut) )
-                          {
-                             int bi= bid-sink->soc.bufferIdOutBase;
-                             if ( sink->soc.outBuffers[bi].locked )
-                             {
-                                FRAME("out:       release received for buffer %d (%d)", bid, bi);
-                                if ( sink->soc.useGfxSync &&
-                                     !sink->soc.videoPaused &&
-                                     (bi != sink->soc.pauseGfxBuffIndex) &&
-                                     (sink->soc.enableTextureSignal ||
-                                      (sink->soc.captureEnabled && sink->soc.sb)) )
-                                {
-                                   int buffIndex= wstFindVideoBuffer( sink, sink->soc.outBuffers[bi].frameNumber+3 );
-                                   if ( buffIndex >= 0 )
-                                   {
-                                      if ( sink->soc.enableTextureSignal )
-                                      {
-                                         wstProcessTextureSignal( sink, buffIndex );
-                                      }
-                                      else if ( sink->soc.captureEnabled && sink->soc.sb )
-                                      {
-                                         wstProcessTextureWayland( sink, buffIndex );
-                                      }
-                                   }
-                                }
-                                if ( wstUnlockOutputBuffer( sink, bi ) )
-                                {
-                                   wstRequeueOutputBuffer( sink, bi );
-                                }
-                             }
-                             else
-                             {
-                                GST_ERROR("release received for non-locked buffer %d (%d)\n", bid, bi );
-                                FRAME("out:       error: release received for non-locked buffer %d (%d)", bid, bi);
-                             }
-                          }
-                          else
-                          {
-                             GST_DEBUG("release received for stale buffer %d\n", bid );
-                             FRAME("out:       note: release received for stale buffer %d", bid);
-                          }
-                        }
-                        break;
-                     case 'S':
-                        if ( mlen >= 13)
+                  case 'R':
+                     if ( mlen >= 5)
+                     {
+                       int rate= getU32( &m[4] );
+                       GST_DEBUG("got rate %d from video server", rate);
+                       conn->serverRefreshRate= rate;
+                       if ( rate )
+                       {
+                          conn->serverRefreshPeriod= 1000000LL/rate;
+                       }
+                       FRAME("got rate %d (period %lld us) from video server", rate, conn->serverRefreshPeriod);
+                     }
+                     break;
+                  case 'B':
+                     if ( mlen >= 5)
+                     {
+                       int bid= getU32( &m[4] );
+                       wstReleaseBufferVideoClientConnection( conn, bid );
+                     }
+                     break;
+                  case 'X':
+                     if ( mlen >= 2 )
+                     {
+                        int i, count= m[4];
+                        if ( mlen >= 2+count*4 )
                         {
-                           /* set position from frame currently presented by the video server */
-                           guint64 frameTime= getS64( &m[4] );
-                           sink->soc.numDropped= getU32( &m[12] );
-                           FRAME( "out:       status received: frameTime %lld numDropped %d", frameTime, sink->soc.numDropped);
-                           if ( sink->prevPositionSegmentStart != 0xFFFFFFFFFFFFFFFFLL )
+                           FRAME("out:       release received for %d buffers", count);
+                           for( i= 0; i < count; ++i )
                            {
-                              gint64 currentNano= frameTime*1000LL;
-                              gint64 firstNano= ((sink->firstPTS/90LL)*GST_MSECOND)+((sink->firstPTS%90LL)*GST_MSECOND/90LL);
-                              sink->position= sink->positionSegmentStart + currentNano - firstNano;
-                              sink->currentPTS= currentNano / (GST_SECOND/90000LL);
-                              GST_LOG("receive frameTime: %lld position %lld", currentNano, sink->position);
-                              if (sink->soc.frameDisplayCount == 0)
-                              {
-                                  sink->soc.emitFirstFrameSignal= TRUE;
-                              }
-                              ++sink->soc.frameDisplayCount;
-                              if ( sink->timeCodePresent && sink->enableTimeCodeSignal )
-                              {
-                                 sink->timeCodePresent( sink, sink->position, g_signals[SIGNAL_TIMECODE] );
-                              }
+                              wstReleaseBufferVideoClientConnection( conn, getU32( &m[5+i*4] ) );
                            }
                         }
-                        break;
-                     case 'U':
-                        if ( mlen >= 9 )
+                     }
+                     break;
+                  case 'V':
+                     if ( mlen >= 2 )
+                     {
+                        int version= m[4];
+                        GST_DEBUG("got protocol version %d from video server", version);
+                        conn->protocolVersion= ((version < WST_VIDEO_PROTOCOL_VERSION) ? version : WST_VIDEO_PROTOCOL_VERSION);
+                     }
+                     break;
+                  case 'S':
+                     if ( mlen >= 13)
+                     {
+                        /* set position from frame currently presented by the video server */
+                        guint64 frameTime= getS64( &m[4] );
+                        sink->soc.numDropped= getU32( &m[12] );
+                        FRAME( "out:       status received: frameTime %lld numDropped %d", frameTime, sink->soc.numDropped);
+                        if ( sink->prevPositionSegmentStart != 0xFFFFFFFFFFFFFFFFLL )
                         {
-                           guint64 frameTime= getS64( &m[4] );
-                           GST_INFO( "underflow received: frameTime %lld eosEventSeen %d", frameTime, sink->eosEventSeen);
-                           FRAME( "out:       underflow received: frameTime %lld", frameTime);
-                           if ( !sink->eosEventSeen )
+                           gint64 currentNano= frameTime*1000LL;
+                           gint64 firstNano= ((sink->firstPTS/90LL)*GST_MSECOND)+((sink->firstPTS%90LL)*GST_MSECOND/90LL);
+                           sink->position= sink->positionSegmentStart + currentNano - firstNano;
+                           sink->currentPTS= currentNano / (GST_SECOND/90000LL);
+                           GST_LOG("receive frameTime: %lld position %lld", currentNano, sink->position);
+                           if (sink->soc.frameDisplayCount == 0)
+                           {
+                               sink->soc.emitFirstFrameSignal= TRUE;
+                           }
+                           ++sink->soc.frameDisplayCount;
+                           if ( sink->timeCodePresent && sink->enableTimeCodeSignal )
                            {
-                              sink->soc.emitUnderflowSignal= TRUE;
+                              sink->timeCodePresent( sink, sink->position, g_signals[SIGNAL_TIMECODE] );
                            }
                         }
-                        break;
-                     case 'Z':
-                        if ( mlen >= 5)
+                     }
+                     break;
+                  case 'U':
+                     if ( mlen >= 9 )
+                     {
+                        guint64 frameTime= getS64( &m[4] );
+                        GST_INFO( "underflow received: frameTime %lld eosEventSeen %d", frameTime, sink->eosEventSeen);
+                        FRAME( "out:       underflow received: frameTime %lld", frameTime);
+                        if ( !sink->eosEventSeen )
                         {
-                          int zoomMode= getU32( &m[4] );
-                          GST_DEBUG("got zoom-mode %d from video server", zoomMode);
-                          if ( sink->soc.zoomModeUser == FALSE )
-                          {
-                             if ( (zoomMode >= ZOOM_NONE) && (zoomMode <= ZOOM_ZOOM) )
-                             {
-                                sink->soc.zoomMode= zoomMode;
-                             }
-                          }
-                          else
+                           sink->soc.emitUnderflowSignal= TRUE;
+                        }
+                     }
+                     break;
+                  case 'Z':
+                     if ( mlen >= 5)
+                     {
+                       int zoomMode= getU32( &m[4] );
+                       GST_DEBUG("got zoom-mode %d from video server", zoomMode);
+                       if ( sink->soc.zoomModeUser == FALSE )
+                       {
+                          if ( (zoomMode >= ZOOM_NONE) && (zoomMode <= ZOOM_ZOOM) )
                           {
-                             GST_DEBUG("user zoom mode set: ignore server value");
+                             sink->soc.zoomMode= zoomMode;
                           }
-                        }
-                        break;
-                     default:
-                        break;
-                  }
-                  m += (mlen+3);
-                  len -= (mlen+3);
-               }
-               else
-               {
-                  len= 0;
+                       }
+                       else
+                       {
+                          GST_DEBUG("user zoom mode set: ignore server value");
+                       }
+                     }
+                     break;
+                  default:
+                     break;
                }
+               m += (mlen+3);
+               len -= (mlen+3);
             }
             else
             {
                len= 0;
             }
          }
+         else
+         {
+            len= 0;
+         }
       }
    }
 }
@@ -4153,20 +4173,14 @@ static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, i
 {
    bool result= false;
    GstWesterosSink *sink= conn->sink;
-   int sentLen;
 
    if ( conn  )
    {
-      struct msghdr msg;
-      struct cmsghdr *cmsg;
-      struct iovec iov[1];
       unsigned char mbody[4+64];
-      char cmbody[CMSG_SPACE(3*sizeof(int))];
-      int i, len;
-      int *fd;
+      int i;
+      int fdToSend[3];
       int numFdToSend;
       int frameFd0= -1, frameFd1= -1, frameFd2= -1;
-      int fdToSend0= -1, fdToSend1= -1, fdToSend2= -1;
       int offset0, offset1, offset2;
       int stride0, stride1, stride2;
       uint32_t pixelFormat;
@@ -4181,7 +4195,6 @@ static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, i
 
          bufferId= sink->soc.outBuffers[buffIndex].bufferId;
 
-         numFdToSend= 1;
          offset0= offset1= offset2= 0;
          stride0= stride1= stride2= sink->soc.frameWidth;
          if ( sink->soc.outBuffers[buffIndex].planeCount > 1 )
@@ -4230,31 +4243,16 @@ static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, i
                break;
          }
 
-         fdToSend0= fcntl( frameFd0, F_DUPFD_CLOEXEC, 0 );
-         if ( fdToSend0 < 0 )
-         {
-            GST_ERROR("wstSendFrameVideoClientConnection: failed to dup fd0");
-            goto exit;
-         }
+         /* SCM_RIGHTS takes its own references to the descriptors so they need no dup */
+         numFdToSend= 0;
+         fdToSend[numFdToSend++]= frameFd0;
          if ( frameFd1 >= 0 )
          {
-            fdToSend1= fcntl( frameFd1, F_DUPFD_CLOEXEC, 0 );
-            if ( fdToSend1 < 0 )
-            {
-               GST_ERROR("wstSendFrameVideoClientConnection: failed to dup fd1");
-               goto exit;
-            }
-            ++numFdToSend;
+            fdToSend[numFdToSend++]= frameFd1;
          }
          if ( frameFd2 >= 0 )
          {
-            fdToSend2= fcntl( frameFd2, F_DUPFD_CLOEXEC, 0 );
-            if ( fdToSend2 < 0 )
-            {
-               GST_ERROR("wstSendFrameVideoClientConnection: failed to dup fd2");
-               goto exit;
-            }
-            ++numFdToSend;
+            fdToSend[numFdToSend++]= frameFd2;
          }
 
          vx= sink->soc.videoX;
@@ -4287,70 +4285,23 @@ static bool wstSendFrameVideoClientConnection( WstVideoClientConnection *conn, i
          i += putU32( &mbody[i], bufferId );
          i += putS64( &mbody[i], sink->soc.outBuffers[buffIndex].frameTime );
 
-         iov[0].iov_base= (char*)mbody;
-         iov[0].iov_len= i;
-
-         cmsg= (struct cmsghdr*)cmbody;
-         cmsg->cmsg_len= CMSG_LEN(numFdToSend*sizeof(int));
-         cmsg->cmsg_level= SOL_SOCKET;
-         cmsg->cmsg_type= SCM_RIGHTS;
-
-         msg.msg_name= NULL;
-         msg.msg_namelen= 0;
-         msg.msg_iov= iov;
-         msg.msg_iovlen= 1;
-         msg.msg_control= cmsg;
-         msg.msg_controllen= cmsg->cmsg_len;
-         msg.msg_flags= 0;
-
-         fd= (int*)CMSG_DATA(cmsg);
-         fd[0]= fdToSend0;
-         if ( fdToSend1 >= 0 )
-         {
-            fd[1]= fdToSend1;
-         }
-         if ( fdToSend2 >= 0 )
-         {
-            fd[2]= fdToSend2;
-         }
-         GST_LOG( "%lld: send frame: %d, fd (%d, %d, %d [%d, %d, %d])", getCurrentTimeMillis(), buffIndex, frameFd0, frameFd1, frameFd2, fdToSend0, fdToSend1, fdToSend2);
+         GST_LOG( "%lld: send frame: %d, fd (%d, %d, %d)", getCurrentTimeMillis(), buffIndex, frameFd0, frameFd1, frameFd2);
          wstLockOutputBuffer( sink, buffIndex );
          FRAME("out:       send frame %d buffer %d (%d)", conn->sink->soc.frameOutCount-1, conn->sink->soc.outBuffers[buffIndex].bufferId, buffIndex);
 
          avProgLog( sink->soc.outBuffers[buffIndex].frameTime*1000L, 0, "WtoW", "");
 
-         do
-         {
-            sentLen= sendmsg( conn->socketFd, &msg, 0 );
-         }
-         while ( (sentLen < 0) && (errno == EINTR));
+         /* Any held position, rate or hide updates go out in the same send as the frame */
+         result= wstSendMessageVideoClientConnection( conn, mbody, i, fdToSend, numFdToSend, false );
 
          conn->sink->soc.outBuffers[buffIndex].frameNumber= conn->sink->soc.frameOutCount-1;
 
-         if ( sentLen == iov[0].iov_len )
-         {
-            result= true;
-         }
-         else
+         if ( !result )
          {
             FRAME("out:       failed send frame %d buffer %d (%d)", conn->sink->soc.frameOutCount-1, conn->sink->soc.outBuffers[buffIndex].bufferId, buffIndex);
             wstUnlockOutputBuffer( sink, buffIndex );
          }
       }
-
-exit:
-      if ( fdToSend0 >= 0 )
-      {
-         close( fdToSend0 );
-      }
-      if ( fdToSend1 >= 0 )
-      {
-         close( fdToSend1 );
-      }
-      if ( fdToSend2 >= 0 )
-      {
-         close( fdToSend2 );
-      }
    }
    return result;
 }
@@ -4411,6 +4362,9 @@ typedef struct bufferInfo
    GstWesterosSink *sink;
    int buffIndex;
    int cohort;
+   #ifdef ENABLE_SW_DECODE
+   void *swRef;
+   #endif
 } bufferInfo;
 
 static void buffer_release( void *data, struct wl_buffer *buffer )
@@ -4441,6 +4395,14 @@ static void buffer_release( void *data, struct wl_buffer *buffer )
       UNLOCK(sink);
    }
 
+   #ifdef ENABLE_SW_DECODE
+   if ( binfo->swRef )
+   {
+      wstsw_release_frame( sink, binfo->swRef );
+      binfo->swRef= 0;
+   }
+   #endif
+
    --sink->soc.activeBuffers;
    wl_buffer_destroy( buffer );
 
@@ -4825,6 +4787,9 @@ static bool wstProcessTextureWayland( GstWesterosSink *sink, int buffIndex )
       binfo->sink= sink;
       binfo->buffIndex= buffIndex;
       binfo->cohort= sink->soc.bufferCohort;
+      #ifdef ENABLE_SW_DECODE
+      binfo->swRef= 0;
+      #endif
 
       struct wl_buffer *wlbuff;
 
@@ -4909,7 +4874,7 @@ static bool wstProcessTextureWayland( GstWesterosSink *sink, int buffIndex )
          {
             if ( --sink->soc.framesBeforeHideVideo == 0 )
             {
-               wstSendHideVideoClientConnection( sink->soc.conn, true );
+               wstSendHideVideoClientConnection( sink->soc.conn, true, false );
                if ( !sink->soc.useGfxSync )
                {
                   wstSendFlushVideoClientConnection( sink->soc.conn );
@@ -5147,13 +5112,17 @@ capture_start:
          LOCK(sink);
          wstProcessMessagesVideoClientConnection( sink->soc.conn );
 
+         /*
+          * With event driven capture these updates are held and sent with the next frame,
+          * or flushed on their own if no frame is ready.
+          */
          if ( sink->windowChange )
          {
             sink->windowChange= false;
             gst_westeros_sink_soc_update_video_position( sink );
             if ( !sink->soc.captureEnabled )
             {
-               wstSendRectVideoClientConnection(sink->soc.conn);
+               wstSendRectVideoClientConnection( sink->soc.conn, sink->soc.hasEvents );
             }
          }
          if ( sink->soc.showChanged )
@@ -5161,13 +5130,13 @@ capture_start:
             sink->soc.showChanged= FALSE;
             if ( !sink->soc.captureEnabled )
             {
-               wstSendHideVideoClientConnection( sink->soc.conn, !sink->show );
+               wstSendHideVideoClientConnection( sink->soc.conn, !sink->show, sink->soc.hasEvents );
             }
          }
          if ( sink->soc.frameRateChanged )
          {
             sink->soc.frameRateChanged= FALSE;
-            wstSendRateVideoClientConnection( sink->soc.conn );
+            wstSendRateVideoClientConnection( sink->soc.conn, sink->soc.hasEvents );
          }
          if ( wasPaused && !sink->soc.videoPaused )
          {
@@ -5224,6 +5193,7 @@ capture_start:
                      goto exit;
                   }
                }
+               wstFlushMessagesVideoClientConnection( sink->soc.conn );
                usleep( 1000 );
                continue;
             }
@@ -5258,6 +5228,7 @@ capture_start:
             if ( wstLocalRateControl( sink, buffIndex ) )
             {
                wstRequeueOutputBuffer( sink, buffIndex );
+               wstFlushMessagesVideoClientConnection( sink->soc.conn );
                UNLOCK(sink);
                continue;
             }
@@ -5326,7 +5297,7 @@ capture_start:
                      LOCK(sink);
                      if ( sink->show )
                      {
-                        wstSendHideVideoClientConnection( sink->soc.conn, false );
+                        wstSendHideVideoClientConnection( sink->soc.conn, false, false );
                      }
                   }
                }
@@ -5371,6 +5342,7 @@ capture_start:
                sink->soc.frameAdvance= FALSE;
                wstSendFrameAdvanceVideoClientConnection( sink->soc.conn );
             }
+            wstFlushMessagesVideoClientConnection( sink->soc.conn );
             UNLOCK(sink);
          }
       }
@@ -5646,21 +5618,36 @@ static bool swIsSWDecode( GstWesterosSink *sink )
 }
 
 #ifdef ENABLE_SW_DECODE
-static void swFreeSWBuffer( GstWesterosSink *sink, int buffIndex )
+static void swFreeSWBuffer( GstWesterosSink *sink, WstSWBuffer *swBuff )
 {
    int i;
+   if ( swBuff->data0 )
+   {
+      munmap( swBuff->data0, swBuff->size0 );
+      swBuff->data0= 0;
+   }
+   if ( swBuff->data1 )
+   {
+      munmap( swBuff->data1, swBuff->size1 );
+      swBuff->data1= 0;
+   }
+   if ( swBuff->chroma )
+   {
+      free( swBuff->chroma );
+      swBuff->chroma= 0;
+   }
    for( i= 0; i < 2; ++i )
    {
       int *fd, *handle;
       if ( i == 0 )
       {
-         fd= &sink->soc.swBuffer[buffIndex].fd0;
-         handle= &sink->soc.swBuffer[buffIndex].handle0;
+         fd= &swBuff->fd0;
+         handle= &swBuff->handle0;
       }
       else
       {
-         fd= &sink->soc.swBuffer[buffIndex].fd1;
-         handle= &sink->soc.swBuffer[buffIndex].handle1;
+         fd= &swBuff->fd1;
+         handle= &swBuff->handle1;
       }
       if ( *fd >= 0 )
       {
@@ -5675,89 +5662,103 @@ static void swFreeSWBuffer( GstWesterosSink *sink, int buffIndex )
          *handle= 0;
       }
    }
+   swBuff->width= -1;
+   swBuff->height= -1;
 }
 
-static bool swAllocSWBuffer( GstWesterosSink *sink, int buffIndex, int width, int height )
+static bool swAllocSWBuffer( GstWesterosSink *sink, WstSWBuffer *swBuff, int width, int height )
 {
    bool result= false;
-   WstSWBuffer *swBuff= 0;
-   if ( buffIndex < WST_NUM_SW_BUFFERS )
-   {
-      struct drm_mode_create_dumb createDumb;
-      struct drm_mode_map_dumb mapDumb;
-      int i, rc;
+   struct drm_mode_create_dumb createDumb;
+   struct drm_mode_map_dumb mapDumb;
+   void *data;
+   int rc;
 
-      swBuff= &sink->soc.swBuffer[buffIndex];
+   swBuff->width= width;
+   swBuff->height= height;
 
-      swBuff->width= width;
-      swBuff->height= height;
+   memset( &createDumb, 0, sizeof(createDumb) );
+   createDumb.width= width;
+   createDumb.height= height;
+   createDumb.bpp= 8;
+   rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createDumb );
+   if ( rc )
+   {
+      GST_ERROR("DRM_IOCTL_MODE_CREATE_DUMB failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
+   swBuff->handle0= createDumb.handle;
+   swBuff->pitch0= createDumb.pitch;
+   swBuff->size0= createDumb.size;
+   memset( &mapDumb, 0, sizeof(mapDumb) );
+   mapDumb.handle= createDumb.handle;
+   rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapDumb );
+   if ( rc )
+   {
+      GST_ERROR("DRM_IOCTL_MODE_MAP_DUMB failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
+   swBuff->offset0= mapDumb.offset;
 
-      memset( &createDumb, 0, sizeof(createDumb) );
-      createDumb.width= width;
-      createDumb.height= height;
-      createDumb.bpp= 8;
-      rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createDumb );
-      if ( rc )
-      {
-         GST_ERROR("DRM_IOCTL_MODE_CREATE_DUMB failed: rc %d errno %d", rc, errno);
-         goto exit;
-      }
-      memset( &mapDumb, 0, sizeof(mapDumb) );
-      mapDumb.handle= createDumb.handle;
-      rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapDumb );
-      if ( rc )
-      {
-         GST_ERROR("DRM_IOCTL_MODE_MAP_DUMB failed: rc %d errno %d", rc, errno);
-         goto exit;
-      }
-      swBuff->handle0= createDumb.handle;
-      swBuff->pitch0= createDumb.pitch;
-      swBuff->size0= createDumb.size;
-      swBuff->offset0= mapDumb.offset;
+   rc= drmPrimeHandleToFD( sink->soc.drmFd, swBuff->handle0, DRM_CLOEXEC | DRM_RDWR, &swBuff->fd0 );
+   if ( rc )
+   {
+      GST_ERROR("drmPrimeHandleToFD failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
 
-      rc= drmPrimeHandleToFD( sink->soc.drmFd, swBuff->handle0, DRM_CLOEXEC | DRM_RDWR, &swBuff->fd0 );
-      if ( rc )
-      {
-         GST_ERROR("drmPrimeHandleToFD failed: rc %d errno %d", rc, errno);
-         goto exit;
-      }
+   data= mmap( NULL, swBuff->size0, PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, swBuff->offset0 );
+   if ( data == MAP_FAILED )
+   {
+      GST_ERROR("mmap of luma buffer failed: errno %d", errno);
+      goto exit;
+   }
+   swBuff->data0= (unsigned char*)data;
 
-      memset( &createDumb, 0, sizeof(createDumb) );
-      createDumb.width= width;
-      createDumb.height= height/2;
-      createDumb.bpp= 8;
-      rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createDumb );
-      if ( rc )
-      {
-         GST_ERROR("DRM_IOCTL_MODE_CREATE_DUMB failed: rc %d errno %d\n", rc, errno);
-         goto exit;
-      }
-      memset( &mapDumb, 0, sizeof(mapDumb) );
-      mapDumb.handle= createDumb.handle;
-      rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapDumb );
-      if ( rc )
-      {
-         GST_ERROR("DRM_IOCTL_MODE_MAP_DUMB failed: rc %d errno %d", rc, errno);
-         goto exit;
-      }
-      swBuff->handle1= createDumb.handle;
-      swBuff->pitch1= createDumb.pitch;
-      swBuff->size1= createDumb.size;
-      swBuff->offset1= mapDumb.offset;
+   memset( &createDumb, 0, sizeof(createDumb) );
+   createDumb.width= width;
+   createDumb.height= height/2;
+   createDumb.bpp= 8;
+   rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createDumb );
+   if ( rc )
+   {
+      GST_ERROR("DRM_IOCTL_MODE_CREATE_DUMB failed: rc %d errno %d\n", rc, errno);
+      goto exit;
+   }
+   swBuff->handle1= createDumb.handle;
+   swBuff->pitch1= createDumb.pitch;
+   swBuff->size1= createDumb.size;
+   memset( &mapDumb, 0, sizeof(mapDumb) );
+   mapDumb.handle= createDumb.handle;
+   rc= ioctl( sink->soc.drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapDumb );
+   if ( rc )
+   {
+      GST_ERROR("DRM_IOCTL_MODE_MAP_DUMB failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
+   swBuff->offset1= mapDumb.offset;
 
-      rc= drmPrimeHandleToFD( sink->soc.drmFd, swBuff->handle1, DRM_CLOEXEC | DRM_RDWR, &swBuff->fd1 );
-      if ( rc )
-      {
-         GST_ERROR("drmPrimeHandleToFD failed: rc %d errno %d", rc, errno);
-         goto exit;
-      }
+   rc= drmPrimeHandleToFD( sink->soc.drmFd, swBuff->handle1, DRM_CLOEXEC | DRM_RDWR, &swBuff->fd1 );
+   if ( rc )
+   {
+      GST_ERROR("drmPrimeHandleToFD failed: rc %d errno %d", rc, errno);
+      goto exit;
+   }
 
-      result= true;
+   data= mmap( NULL, swBuff->size1, PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, swBuff->offset1 );
+   if ( data == MAP_FAILED )
+   {
+      GST_ERROR("mmap of chroma buffer failed: errno %d", errno);
+      goto exit;
    }
+   swBuff->data1= (unsigned char*)data;
+
+   result= true;
+
 exit:
    if ( !result )
    {
-      swFreeSWBuffer( sink, buffIndex );
+      swFreeSWBuffer( sink, swBuff );
    }
    return result;
 }
@@ -5770,8 +5771,8 @@ WstSWBuffer *swGetSWBuffer( GstWesterosSink *sink, int buffIndex, int width, int
       swBuff= &sink->soc.swBuffer[buffIndex];
       if ( (swBuff->width != width) || (swBuff->height != height) )
       {
-         swFreeSWBuffer( sink, buffIndex );
-         if ( !swAllocSWBuffer( sink, buffIndex, width, height ) )
+         swFreeSWBuffer( sink, swBuff );
+         if ( !swAllocSWBuffer( sink, swBuff, width, height ) )
          {
             swBuff= 0;
          }
@@ -5781,6 +5782,92 @@ WstSWBuffer *swGetSWBuffer( GstWesterosSink *sink, int buffIndex, int width, int
    return swBuff;
 }
 
+/*
+ * Supply the decoder with a buffer to render into.  The renderers only
+ * accept NV12 so luma is decoded straight into the display buffer while
+ * chroma goes to side memory and is interleaved when the frame is shown.
+ * Called from decoder threads.
+ */
+static bool swAllocBuffer( GstWesterosSink *sink, SWBuffer *buffer )
+{
+   bool result= false;
+   WstSWBuffer *swBuff= 0;
+   int width, height, i;
+
+   width= ((buffer->width+63)&~63);
+   height= ((buffer->height+1)&~1);
+
+   LOCK(sink);
+   if ( sink->soc.drmFd < 0 )
+   {
+      goto exit;
+   }
+   for( i= 0; i < WST_NUM_SW_DIRECT_BUFFERS; ++i )
+   {
+      WstSWBuffer *iter= &sink->soc.swDirectBuffer[i];
+      if ( !iter->inUse )
+      {
+         if ( (iter->width == width) && (iter->height == height) )
+         {
+            swBuff= iter;
+            break;
+         }
+         if ( !swBuff )
+         {
+            swBuff= iter;
+         }
+      }
+   }
+   if ( !swBuff )
+   {
+      goto exit;
+   }
+   if ( (swBuff->width != width) || (swBuff->height != height) )
+   {
+      void *chroma= 0;
+
+      swFreeSWBuffer( sink, swBuff );
+      if ( !swAllocSWBuffer( sink, swBuff, width, height ) )
+      {
+         goto exit;
+      }
+      swBuff->chromaStride= ((width/2+63)&~63);
+      if ( posix_memalign( &chroma, 64, swBuff->chromaStride*height ) )
+      {
+         GST_ERROR("swAllocBuffer: no memory for chroma planes");
+         swFreeSWBuffer( sink, swBuff );
+         goto exit;
+      }
+      swBuff->chroma= (unsigned char*)chroma;
+   }
+   swBuff->inUse= true;
+
+   buffer->bufferId= swBuff-sink->soc.swDirectBuffer;
+   buffer->Y= swBuff->data0;
+   buffer->Ystride= swBuff->pitch0;
+   buffer->U= swBuff->chroma;
+   buffer->Ustride= swBuff->chromaStride;
+   buffer->V= swBuff->chroma+swBuff->chromaStride*(height/2);
+   buffer->Vstride= swBuff->chromaStride;
+
+   result= true;
+
+exit:
+   UNLOCK(sink);
+
+   return result;
+}
+
+static void swFreeBuffer( GstWesterosSink *sink, int bufferId )
+{
+   if ( (bufferId >= 0) && (bufferId < WST_NUM_SW_DIRECT_BUFFERS) )
+   {
+      LOCK(sink);
+      sink->soc.swDirectBuffer[bufferId].inUse= false;
+      UNLOCK(sink);
+   }
+}
+
 static gpointer swFirstFrameThread(gpointer data)
 {
    GstWesterosSink *sink= (GstWesterosSink*)data;
@@ -5826,15 +5913,27 @@ static void swTerm( GstWesterosSink *sink )
       g_thread_join( sink->soc.dispatchThread );
       sink->soc.dispatchThread= NULL;
    }
+   if ( sink->soc.swTextureRef )
+   {
+      wstsw_release_frame( sink, sink->soc.swTextureRef );
+      sink->soc.swTextureRef= 0;
+   }
+   LOCK(sink);
    for( i= 0; i < WST_NUM_SW_BUFFERS; ++i )
    {
-      swFreeSWBuffer( sink, i );
+      swFreeSWBuffer( sink, &sink->soc.swBuffer[i] );
+   }
+   for( i= 0; i < WST_NUM_SW_DIRECT_BUFFERS; ++i )
+   {
+      swFreeSWBuffer( sink, &sink->soc.swDirectBuffer[i] );
+      sink->soc.swDirectBuffer[i].inUse= false;
    }
    if ( sink->soc.drmFd >= 0 )
    {
       close( sink->soc.drmFd );
-      sink->soc.drmFd= 1;
+      sink->soc.drmFd= -1;
    }
+   UNLOCK(sink);
 }
 
 static void swLink( GstWesterosSink *sink )
@@ -5897,53 +5996,56 @@ void swDisplay( GstWesterosSink *sink, SWFrame *frame )
       sink->soc.eosDetectionThread= g_thread_new("westeros_sink_eos", wstEOSDetectionThread, sink);
    }
 
-   bi= sink->soc.nextSWBuffer;
-   if ( ++sink->soc.nextSWBuffer >= WST_NUM_SW_BUFFERS )
+   if ( (frame->bufferId >= 0) && (frame->bufferId < WST_NUM_SW_DIRECT_BUFFERS) )
    {
-      sink->soc.nextSWBuffer= 0;
+      /* Luma was decoded in place, only chroma needs interleaving */
+      swBuff= &sink->soc.swDirectBuffer[frame->bufferId];
+      if ( !swBuff->data1 )
+      {
+         swBuff= 0;
+      }
    }
-
-   swBuff= swGetSWBuffer( sink, bi, frame->width, frame->height );
-   if ( swBuff )
+   else
    {
-      unsigned char *data;
+      bi= sink->soc.nextSWBuffer;
+      if ( ++sink->soc.nextSWBuffer >= WST_NUM_SW_BUFFERS )
+      {
+         sink->soc.nextSWBuffer= 0;
+      }
 
-      data= (unsigned char*)mmap( NULL, swBuff->size0, PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, swBuff->offset0 );
-      if ( data )
+      swBuff= swGetSWBuffer( sink, bi, frame->width, frame->height );
+      if ( swBuff )
       {
          int row;
-         unsigned char *destRow= data;
+         unsigned char *destRow= swBuff->data0;
          unsigned char *srcYRow= frame->Y;
          for( row= 0; row < frame->height; ++row )
          {
-            memcpy( destRow, srcYRow, frame->Ystride );
+            memcpy( destRow, srcYRow, frame->width );
             destRow += swBuff->pitch0;
             srcYRow += frame->Ystride;
          }
-         munmap( data, swBuff->size0 );
       }
-      data= (unsigned char*)mmap( NULL, swBuff->size1, PROT_READ | PROT_WRITE, MAP_SHARED, sink->soc.drmFd, swBuff->offset1 );
-      if ( data )
+   }
+   if ( swBuff )
+   {
+      int row, col;
+      unsigned char *dest, *destRow= swBuff->data1;
+      unsigned char *srcU, *srcURow= frame->U;
+      unsigned char *srcV, *srcVRow= frame->V;
+      for( row= 0; row < frame->height; row += 2 )
       {
-         int row, col;
-         unsigned char *dest, *destRow= data;
-         unsigned char *srcU, *srcURow= frame->U;
-         unsigned char *srcV, *srcVRow= frame->V;
-         for( row= 0; row < frame->height; row += 2 )
+         dest= destRow;
+         srcU= srcURow;
+         srcV= srcVRow;
+         for( col= 0; col < frame->width; col += 2 )
          {
-            dest= destRow;
-            srcU= srcURow;
-            srcV= srcVRow;
-            for( col= 0; col < frame->width; col += 2 )
-            {
-               *dest++= *srcU++;
-               *dest++= *srcV++;
-            }
-            destRow += swBuff->pitch1;
-            srcURow += frame->Ustride;
-            srcVRow += frame->Vstride;
+            *dest++= *srcU++;
+            *dest++= *srcV++;
          }
-         munmap( data, swBuff->size1 );
+         destRow += swBuff->pitch1;
+         srcURow += frame->Ustride;
+         srcVRow += frame->Vstride;
       }
 
       if ( frame->frameNumber == 0 )
@@ -5992,6 +6094,14 @@ void swDisplay( GstWesterosSink *sink, SWFrame *frame )
                         fd1, l1, s1, p1,
                         fd2, l2, s2, p2
                       );
+
+         /* Keep the most recent direct frame until the next one replaces it */
+         if ( sink->soc.swTextureRef )
+         {
+            wstsw_release_frame( sink, sink->soc.swTextureRef );
+         }
+         sink->soc.swTextureRef= frame->ref;
+         frame->ref= 0;
       }
       else if ( sink->soc.sb )
       {
@@ -6010,14 +6120,16 @@ void swDisplay( GstWesterosSink *sink, SWFrame *frame )
             stride1= swBuff->pitch1;
 
             binfo->sink= sink;
-            binfo->buffIndex= bi;
+            binfo->buffIndex= -1;
+            binfo->cohort= sink->soc.bufferCohort;
+            binfo->swRef= frame->ref;
 
             wlbuff= wl_sb_create_planar_buffer_fd2( sink->soc.sb,
                                                     fd0,
                                                     fd1,
                                                     fd2,
-                                                    swBuff->width,
-                                                    swBuff->height,
+                                                    frame->width,
+                                                    frame->height,
                                                     WL_SB_FORMAT_NV12,
                                                     0, /* offset0 */
                                                     offset1, /* offset1 */
@@ -6033,6 +6145,7 @@ void swDisplay( GstWesterosSink *sink, SWFrame *frame )
                wl_surface_damage( sink->surface, 0, 0, sink->windowWidth, sink->windowHeight );
                wl_surface_commit( sink->surface );
                wl_display_flush(sink->display);
+               frame->ref= 0;
             }
             else
             {
@@ -6041,6 +6154,11 @@ void swDisplay( GstWesterosSink *sink, SWFrame *frame )
          }
       }
    }
+   if ( frame->ref )
+   {
+      wstsw_release_frame( sink, frame->ref );
+      frame->ref= 0;
+   }
    LOCK(sink);
    ++sink->soc.frameOutCount;
    UNLOCK(sink);
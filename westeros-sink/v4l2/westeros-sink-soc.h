@@ -39,6 +39,9 @@
       "systemstream = (boolean) false, " \
       "width=(int) [1,MAX], " "height=(int) [1,MAX]" 
 
+#define WST_VIDEO_PROTOCOL_VERSION (2)
+#define WST_VIDEO_PENDING_MAX (64)
+
 typedef struct _WstVideoClientConnection
 {
    GstWesterosSink *sink;
@@ -47,6 +50,9 @@ typedef struct _WstVideoClientConnection
    int socketFd;
    int serverRefreshRate;
    gint64 serverRefreshPeriod;
+   int protocolVersion;
+   int pendingLen;
+   unsigned char pending[WST_VIDEO_PENDING_MAX];
 } WstVideoClientConnection;
 
 typedef struct _WstPlaneInfo
@@ -91,6 +97,7 @@ typedef struct _WstBufferInfo
 
 #ifdef ENABLE_SW_DECODE
 #define WST_NUM_SW_BUFFERS (4)
+#define WST_NUM_SW_DIRECT_BUFFERS (24)
 typedef struct _WstSWBuffer
 {
    int width;
@@ -105,6 +112,11 @@ typedef struct _WstSWBuffer
    int offset1;
    int pitch0;
    int pitch1;
+   unsigned char *data0;
+   unsigned char *data1;
+   unsigned char *chroma;
+   int chromaStride;
+   bool inUse;
 } WstSWBuffer;
 #endif
 
@@ -244,6 +256,8 @@ struct _GstWesterosSinkSoc
    GThread *firstFrameThread;
    int nextSWBuffer;
    WstSWBuffer swBuffer[WST_NUM_SW_BUFFERS];
+   WstSWBuffer swDirectBuffer[WST_NUM_SW_DIRECT_BUFFERS];
+   void *swTextureRef;
    #endif
 
    #ifdef GLIB_VERSION_2_32 
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "westeros-sink-sw-buffer.h"
+
+SWDirectBuffer *wstsw_direct_create( SWDirectRelease release, void *ctx, int bufferId, int refCount )
+{
+   SWDirectBuffer *direct= 0;
+
+   if ( release && (bufferId >= 0) && (refCount > 0) )
+   {
+      direct= (SWDirectBuffer*)calloc( 1, sizeof(SWDirectBuffer) );
+      if ( direct )
+      {
+         direct->magic= SW_DIRECT_MAGIC;
+         direct->refCount= refCount;
+         direct->bufferId= bufferId;
+         direct->release= release;
+         direct->ctx= ctx;
+      }
+   }
+
+   return direct;
+}
+
+SWDirectBuffer *wstsw_direct_get( void *opaque )
+{
+   SWDirectBuffer *direct= (SWDirectBuffer*)opaque;
+
+   if ( direct && (direct->magic != SW_DIRECT_MAGIC) )
+   {
+      direct= 0;
+   }
+
+   return direct;
+}
+
+void wstsw_direct_unref( SWDirectBuffer *direct )
+{
+   if ( direct )
+   {
+      if ( g_atomic_int_dec_and_test( &direct->refCount ) )
+      {
+         direct->release( direct->ctx, direct->bufferId );
+         direct->magic= 0;
+         free( direct );
+      }
+   }
+}
+
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WESTEROS_SINK_SW_BUFFER_H__
+#define __WESTEROS_SINK_SW_BUFFER_H__
+
+#include <stdbool.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SW_DIRECT_MAGIC (0x53574442)
+
+typedef void (*SWDirectRelease)( void *ctx, int bufferId );
+
+/*
+ * A soc display buffer lent to the decoder.  It is the opaque of every
+ * buffer ref the decoder holds on the display buffer's planes, so the
+ * buffer id stays with the frame's data however the decoder copies or
+ * reorders frames.  The display buffer is released to the soc when the
+ * last plane ref is dropped.
+ */
+typedef struct _SWDirectBuffer
+{
+   unsigned int magic;
+   int refCount;
+   int bufferId;
+   SWDirectRelease release;
+   void *ctx;
+} SWDirectBuffer;
+
+/*
+ * Create a direct buffer holding refCount references.
+ */
+SWDirectBuffer *wstsw_direct_create( SWDirectRelease release, void *ctx, int bufferId, int refCount );
+
+/*
+ * Returns the direct buffer for a buffer ref opaque, or null if the
+ * opaque belongs to decoder owned memory.
+ */
+SWDirectBuffer *wstsw_direct_get( void *opaque );
+
+/*
+ * Drop one reference.  The last one releases the display buffer and
+ * frees the direct buffer.  May be called from any thread.
+ */
+void wstsw_direct_unref( SWDirectBuffer *direct );
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif
+
@@ -0,0 +1,633 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "westeros-sink-sw-probe.h"
+
+#define SW_PROBE_MAX_NAL (512)
+
+#define H264_NAL_SPS (7)
+#define H265_NAL_VPS (32)
+#define H265_NAL_SPS (33)
+#define AV1_OBU_SEQUENCE_HEADER (1)
+#define AV1_OBU_TEMPORAL_DELIMITER (2)
+
+typedef struct _SWBitReader
+{
+   const unsigned char *data;
+   int len;
+   int bitOffset;
+   bool error;
+} SWBitReader;
+
+static void swBitsInit( SWBitReader *br, const unsigned char *data, int len )
+{
+   br->data= data;
+   br->len= len;
+   br->bitOffset= 0;
+   br->error= false;
+}
+
+static unsigned int swBitsRead( SWBitReader *br, int count )
+{
+   unsigned int value= 0;
+   int i;
+   for( i= 0; i < count; ++i )
+   {
+      int byteOffset= (br->bitOffset >> 3);
+      if ( byteOffset >= br->len )
+      {
+         br->error= true;
+         return 0;
+      }
+      value= (value << 1) | ((br->data[byteOffset] >> (7-(br->bitOffset & 7))) & 1);
+      ++br->bitOffset;
+   }
+   return value;
+}
+
+static void swBitsSkip( SWBitReader *br, int count )
+{
+   br->bitOffset += count;
+   if ( (br->bitOffset >> 3) > br->len )
+   {
+      br->error= true;
+   }
+}
+
+static unsigned int swBitsReadUE( SWBitReader *br )
+{
+   int leadingZeros= 0;
+   while( !swBitsRead( br, 1 ) )
+   {
+      if ( br->error || (++leadingZeros >= 32) )
+      {
+         br->error= true;
+         return 0;
+      }
+   }
+   return (1U << leadingZeros) - 1 + swBitsRead( br, leadingZeros );
+}
+
+static int swBitsReadSE( SWBitReader *br )
+{
+   unsigned int value= swBitsReadUE( br );
+   return (value & 1) ? (int)((value+1)/2) : -(int)(value/2);
+}
+
+/*
+ * Copy the start of a NAL payload removing emulation prevention bytes
+ */
+static int swUnescapeNal( const unsigned char *nal, int nalLen, unsigned char *dest, int destLen )
+{
+   int i, zeros= 0, count= 0;
+   for( i= 0; (i < nalLen) && (count < destLen); ++i )
+   {
+      if ( (zeros >= 2) && (nal[i] == 3) )
+      {
+         zeros= 0;
+         continue;
+      }
+      zeros= (nal[i] == 0) ? zeros+1 : 0;
+      dest[count++]= nal[i];
+   }
+   return count;
+}
+
+/*
+ * Find the next Annex B start code at or after offset.  Returns the offset
+ * of the first byte of the start code and sets the payload offset.
+ */
+static int swFindStartCode( const unsigned char *data, int len, int offset, int *payload )
+{
+   int i;
+   for( i= offset; i+3 <= len; ++i )
+   {
+      if ( (data[i] == 0) && (data[i+1] == 0) && (data[i+2] == 1) )
+      {
+         *payload= i+3;
+         if ( (i > offset) && (data[i-1] == 0) )
+         {
+            return i-1;
+         }
+         return i;
+      }
+   }
+   return -1;
+}
+
+static bool swParseH264SPS( const unsigned char *nal, int nalLen, int *width, int *height )
+{
+   unsigned char rbsp[SW_PROBE_MAX_NAL];
+   SWBitReader br;
+   unsigned int profile, chromaFormat= 1, separateColorPlane= 0;
+   unsigned int pocType, widthMbs, heightMapUnits, frameMbsOnly;
+   unsigned int cropLeft= 0, cropRight= 0, cropTop= 0, cropBottom= 0;
+   int cropUnitX, cropUnitY;
+   int i, j;
+
+   swBitsInit( &br, rbsp, swUnescapeNal( nal, nalLen, rbsp, sizeof(rbsp) ) );
+   swBitsSkip( &br, 8 ); /* nal header */
+   profile= swBitsRead( &br, 8 );
+   swBitsSkip( &br, 16 ); /* constraint flags, level */
+   swBitsReadUE( &br ); /* sps id */
+   if ( (profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) ||
+        (profile == 44) || (profile == 83) || (profile == 86) || (profile == 118) ||
+        (profile == 128) || (profile == 138) || (profile == 139) || (profile == 134) ||
+        (profile == 135) )
+   {
+      chromaFormat= swBitsReadUE( &br );
+      if ( chromaFormat == 3 )
+      {
+         separateColorPlane= swBitsRead( &br, 1 );
+      }
+      swBitsReadUE( &br ); /* bit depth luma */
+      swBitsReadUE( &br ); /* bit depth chroma */
+      swBitsSkip( &br, 1 ); /* qpprime y zero transform bypass */
+      if ( swBitsRead( &br, 1 ) )
+      {
+         int listCount= (chromaFormat != 3) ? 8 : 12;
+         for( i= 0; (i < listCount) && !br.error; ++i )
+         {
+            if ( swBitsRead( &br, 1 ) )
+            {
+               int size= (i < 6) ? 16 : 64;
+               int lastScale= 8, nextScale= 8;
+               for( j= 0; (j < size) && !br.error; ++j )
+               {
+                  if ( nextScale != 0 )
+                  {
+                     nextScale= (lastScale + swBitsReadSE( &br ) + 256) % 256;
+                  }
+                  lastScale= (nextScale == 0) ? lastScale : nextScale;
+               }
+            }
+         }
+      }
+   }
+   swBitsReadUE( &br ); /* log2 max frame num */
+   pocType= swBitsReadUE( &br );
+   if ( pocType == 0 )
+   {
+      swBitsReadUE( &br );
+   }
+   else if ( pocType == 1 )
+   {
+      unsigned int cycle;
+      swBitsSkip( &br, 1 );
+      swBitsReadSE( &br );
+      swBitsReadSE( &br );
+      cycle= swBitsReadUE( &br );
+      for( i= 0; (i < (int)cycle) && !br.error; ++i )
+      {
+         swBitsReadSE( &br );
+      }
+   }
+   swBitsReadUE( &br ); /* max num ref frames */
+   swBitsSkip( &br, 1 ); /* gaps in frame num allowed */
+   widthMbs= swBitsReadUE( &br )+1;
+   heightMapUnits= swBitsReadUE( &br )+1;
+   frameMbsOnly= swBitsRead( &br, 1 );
+   if ( !frameMbsOnly )
+   {
+      swBitsSkip( &br, 1 );
+   }
+   swBitsSkip( &br, 1 ); /* direct 8x8 inference */
+   if ( swBitsRead( &br, 1 ) )
+   {
+      cropLeft= swBitsReadUE( &br );
+      cropRight= swBitsReadUE( &br );
+      cropTop= swBitsReadUE( &br );
+      cropBottom= swBitsReadUE( &br );
+   }
+   if ( br.error )
+   {
+      return false;
+   }
+
+   if ( separateColorPlane || (chromaFormat == 0) )
+   {
+      cropUnitX= 1;
+      cropUnitY= 2-frameMbsOnly;
+   }
+   else
+   {
+      cropUnitX= (chromaFormat == 3) ? 1 : 2;
+      cropUnitY= ((chromaFormat == 1) ? 2 : 1) * (2-frameMbsOnly);
+   }
+   *width= widthMbs*16 - cropUnitX*(cropLeft+cropRight);
+   *height= (2-frameMbsOnly)*heightMapUnits*16 - cropUnitY*(cropTop+cropBottom);
+
+   return true;
+}
+
+static bool swParseH265SPS( const unsigned char *nal, int nalLen, int *width, int *height )
+{
+   unsigned char rbsp[SW_PROBE_MAX_NAL];
+   SWBitReader br;
+   unsigned int maxSubLayers, chromaFormat, picWidth, picHeight;
+   unsigned int confLeft= 0, confRight= 0, confTop= 0, confBottom= 0;
+   bool subProfilePresent[8], subLevelPresent[8];
+   int subWidth, subHeight;
+   int i;
+
+   swBitsInit( &br, rbsp, swUnescapeNal( nal, nalLen, rbsp, sizeof(rbsp) ) );
+   swBitsSkip( &br, 16 ); /* nal header */
+   swBitsSkip( &br, 4 ); /* vps id */
+   maxSubLayers= swBitsRead( &br, 3 );
+   swBitsSkip( &br, 1 ); /* temporal id nesting */
+
+   /* profile_tier_level */
+   swBitsSkip( &br, 88 );
+   swBitsSkip( &br, 8 ); /* general level */
+   for( i= 0; i < (int)maxSubLayers; ++i )
+   {
+      subProfilePresent[i]= swBitsRead( &br, 1 );
+      subLevelPresent[i]= swBitsRead( &br, 1 );
+   }
+   if ( maxSubLayers > 0 )
+   {
+      swBitsSkip( &br, 2*(8-maxSubLayers) );
+   }
+   for( i= 0; i < (int)maxSubLayers; ++i )
+   {
+      if ( subProfilePresent[i] )
+      {
+         swBitsSkip( &br, 88 );
+      }
+      if ( subLevelPresent[i] )
+      {
+         swBitsSkip( &br, 8 );
+      }
+   }
+
+   swBitsReadUE( &br ); /* sps id */
+   chromaFormat= swBitsReadUE( &br );
+   if ( chromaFormat == 3 )
+   {
+      if ( swBitsRead( &br, 1 ) )
+      {
+         chromaFormat= 0;
+      }
+   }
+   picWidth= swBitsReadUE( &br );
+   picHeight= swBitsReadUE( &br );
+   if ( swBitsRead( &br, 1 ) )
+   {
+      confLeft= swBitsReadUE( &br );
+      confRight= swBitsReadUE( &br );
+      confTop= swBitsReadUE( &br );
+      confBottom= swBitsReadUE( &br );
+   }
+   if ( br.error )
+   {
+      return false;
+   }
+
+   subWidth= ((chromaFormat == 1) || (chromaFormat == 2)) ? 2 : 1;
+   subHeight= (chromaFormat == 1) ? 2 : 1;
+   *width= picWidth - subWidth*(confLeft+confRight);
+   *height= picHeight - subHeight*(confTop+confBottom);
+
+   return true;
+}
+
+static int swProbeH26x( int codec, const unsigned char *data, int len, int *width, int *height )
+{
+   int offset= -1;
+   int start, payload, next, nextPayload;
+
+   start= swFindStartCode( data, len, 0, &payload );
+   while( start >= 0 )
+   {
+      int nalType;
+
+      next= swFindStartCode( data, len, payload, &nextPayload );
+      if ( payload >= len )
+      {
+         break;
+      }
+      if ( codec == SWCodec_h264 )
+      {
+         nalType= (data[payload] & 0x1F);
+         if ( nalType == H264_NAL_SPS )
+         {
+            swParseH264SPS( data+payload, ((next >= 0) ? next : len)-payload, width, height );
+            offset= start;
+            break;
+         }
+      }
+      else
+      {
+         nalType= ((data[payload] >> 1) & 0x3F);
+         if ( (nalType == H265_NAL_VPS) && (offset < 0) )
+         {
+            offset= start;
+         }
+         else if ( nalType == H265_NAL_SPS )
+         {
+            swParseH265SPS( data+payload, ((next >= 0) ? next : len)-payload, width, height );
+            if ( offset < 0 )
+            {
+               offset= start;
+            }
+            break;
+         }
+      }
+      start= next;
+      payload= nextPayload;
+   }
+
+   return offset;
+}
+
+static int swProbeVP9( const unsigned char *data, int len, int *width, int *height )
+{
+   SWBitReader br;
+   unsigned int profile, colorSpace;
+
+   swBitsInit( &br, data, len );
+   if ( swBitsRead( &br, 2 ) != 2 )
+   {
+      return -1;
+   }
+   profile= swBitsRead( &br, 1 );
+   profile |= (swBitsRead( &br, 1 ) << 1);
+   if ( profile == 3 )
+   {
+      swBitsSkip( &br, 1 );
+   }
+   if ( swBitsRead( &br, 1 ) )
+   {
+      /* show existing frame */
+      return -1;
+   }
+   if ( swBitsRead( &br, 1 ) != 0 )
+   {
+      /* not a key frame */
+      return -1;
+   }
+   swBitsSkip( &br, 2 ); /* show frame, error resilient */
+   if ( (swBitsRead( &br, 8 ) != 0x49) ||
+        (swBitsRead( &br, 8 ) != 0x83) ||
+        (swBitsRead( &br, 8 ) != 0x42) )
+   {
+      return -1;
+   }
+   if ( profile >= 2 )
+   {
+      swBitsSkip( &br, 1 ); /* ten or twelve bit */
+   }
+   colorSpace= swBitsRead( &br, 3 );
+   if ( colorSpace != 7 )
+   {
+      swBitsSkip( &br, 1 ); /* color range */
+      if ( (profile == 1) || (profile == 3) )
+      {
+         swBitsSkip( &br, 3 ); /* subsampling x, y, reserved */
+      }
+   }
+   else if ( (profile == 1) || (profile == 3) )
+   {
+      swBitsSkip( &br, 1 );
+   }
+   *width= swBitsRead( &br, 16 )+1;
+   *height= swBitsRead( &br, 16 )+1;
+   if ( br.error )
+   {
+      *width= *height= -1;
+   }
+
+   return 0;
+}
+
+static bool swParseAV1SequenceHeader( const unsigned char *obu, int obuLen, int *width, int *height )
+{
+   SWBitReader br;
+   unsigned int reducedHeader, decoderModelInfoPresent= 0, initialDisplayDelayPresent;
+   unsigned int bufferDelayLength= 0, operatingPoints, widthBits, heightBits;
+   int i;
+
+   swBitsInit( &br, obu, obuLen );
+   swBitsSkip( &br, 3 ); /* seq profile */
+   swBitsSkip( &br, 1 ); /* still picture */
+   reducedHeader= swBitsRead( &br, 1 );
+   if ( reducedHeader )
+   {
+      swBitsSkip( &br, 5 ); /* seq level idx */
+   }
+   else
+   {
+      if ( swBitsRead( &br, 1 ) )
+      {
+         /* timing info */
+         swBitsSkip( &br, 64 );
+         if ( swBitsRead( &br, 1 ) )
+         {
+            int leadingZeros= 0;
+            while( !swBitsRead( &br, 1 ) && !br.error && (leadingZeros < 32) )
+            {
+               ++leadingZeros;
+            }
+            swBitsSkip( &br, leadingZeros );
+         }
+         decoderModelInfoPresent= swBitsRead( &br, 1 );
+         if ( decoderModelInfoPresent )
+         {
+            bufferDelayLength= swBitsRead( &br, 5 )+1;
+            swBitsSkip( &br, 32+5+5 );
+         }
+      }
+      initialDisplayDelayPresent= swBitsRead( &br, 1 );
+      operatingPoints= swBitsRead( &br, 5 )+1;
+      for( i= 0; (i < (int)operatingPoints) && !br.error; ++i )
+      {
+         swBitsSkip( &br, 12 ); /* operating point idc */
+         if ( swBitsRead( &br, 5 ) > 7 )
+         {
+            swBitsSkip( &br, 1 ); /* seq tier */
+         }
+         if ( decoderModelInfoPresent && swBitsRead( &br, 1 ) )
+         {
+            swBitsSkip( &br, 2*bufferDelayLength+1 );
+         }
+         if ( initialDisplayDelayPresent && swBitsRead( &br, 1 ) )
+         {
+            swBitsSkip( &br, 4 );
+         }
+      }
+   }
+   widthBits= swBitsRead( &br, 4 )+1;
+   heightBits= swBitsRead( &br, 4 )+1;
+   *width= swBitsRead( &br, widthBits )+1;
+   *height= swBitsRead( &br, heightBits )+1;
+
+   return !br.error;
+}
+
+static int swProbeAV1( const unsigned char *data, int len, int *width, int *height )
+{
+   int offset= 0, tuOffset= -1;
+
+   while( offset < len )
+   {
+      int obuType, headerLen, payloadLen, i;
+      unsigned long long size;
+
+      if ( data[offset] & 0x80 )
+      {
+         /* forbidden bit set */
+         break;
+      }
+      obuType= ((data[offset] >> 3) & 0x0F);
+      headerLen= (data[offset] & 0x04) ? 2 : 1;
+      if ( data[offset] & 0x02 )
+      {
+         size= 0;
+         for( i= 0; i < 8; ++i )
+         {
+            if ( offset+headerLen >= len )
+            {
+               return -1;
+            }
+            size |= ((unsigned long long)(data[offset+headerLen] & 0x7F) << (i*7));
+            ++headerLen;
+            if ( !(data[offset+headerLen-1] & 0x80) )
+            {
+               break;
+            }
+         }
+         if ( size > (unsigned long long)len )
+         {
+            break;
+         }
+         payloadLen= (int)size;
+      }
+      else
+      {
+         payloadLen= len-offset-headerLen;
+      }
+      if ( (payloadLen < 0) || (offset+headerLen+payloadLen > len) )
+      {
+         break;
+      }
+
+      if ( obuType == AV1_OBU_TEMPORAL_DELIMITER )
+      {
+         tuOffset= offset;
+      }
+      else if ( obuType == AV1_OBU_SEQUENCE_HEADER )
+      {
+         if ( !swParseAV1SequenceHeader( data+offset+headerLen, payloadLen, width, height ) )
+         {
+            *width= *height= -1;
+         }
+         return (tuOffset >= 0) ? tuOffset : offset;
+      }
+      offset += headerLen+payloadLen;
+   }
+
+   return -1;
+}
+
+int wstsw_codec_from_mime( const char *mime )
+{
+   int codec= SWCodec_none;
+   if ( mime )
+   {
+      if ( !strcmp( mime, "video/x-h264" ) )
+      {
+         codec= SWCodec_h264;
+      }
+      else if ( !strcmp( mime, "video/x-h265" ) )
+      {
+         codec= SWCodec_h265;
+      }
+      else if ( !strcmp( mime, "video/x-vp9" ) )
+      {
+         codec= SWCodec_vp9;
+      }
+      else if ( !strcmp( mime, "video/x-av1" ) )
+      {
+         codec= SWCodec_av1;
+      }
+   }
+   return codec;
+}
+
+const char *wstsw_codec_name( int codec )
+{
+   const char *name;
+   switch( codec )
+   {
+      case SWCodec_h264:
+         name= "h264";
+         break;
+      case SWCodec_h265:
+         name= "h265";
+         break;
+      case SWCodec_vp9:
+         name= "vp9";
+         break;
+      case SWCodec_av1:
+         name= "av1";
+         break;
+      default:
+         name= "none";
+         break;
+   }
+   return name;
+}
+
+int wstsw_probe_sequence_header( int codec, const unsigned char *data, int len, int *width, int *height )
+{
+   int offset= -1;
+   int w= -1, h= -1;
+
+   if ( data && (len > 0) )
+   {
+      switch( codec )
+      {
+         case SWCodec_h264:
+         case SWCodec_h265:
+            offset= swProbeH26x( codec, data, len, &w, &h );
+            break;
+         case SWCodec_vp9:
+            offset= swProbeVP9( data, len, &w, &h );
+            break;
+         case SWCodec_av1:
+            offset= swProbeAV1( data, len, &w, &h );
+            break;
+         default:
+            break;
+      }
+   }
+   if ( width )
+   {
+      *width= w;
+   }
+   if ( height )
+   {
+      *height= h;
+   }
+
+   return offset;
+}
+
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WESTEROS_SINK_SW_PROBE_H__
+#define __WESTEROS_SINK_SW_PROBE_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _SWCodec
+{
+   SWCodec_none= 0,
+   SWCodec_h264,
+   SWCodec_h265,
+   SWCodec_vp9,
+   SWCodec_av1
+} SWCodec;
+
+/*
+ * Map a caps structure name such as "video/x-h265" to a codec.  Returns
+ * SWCodec_none for anything the software path can't decode.
+ */
+int wstsw_codec_from_mime( const char *mime );
+const char *wstsw_codec_name( int codec );
+
+/*
+ * Look for a point in an elementary stream buffer where decoding can
+ * start: an H.264 SPS, an H.265 VPS or SPS, a VP9 key frame or an AV1
+ * temporal unit carrying a sequence header.  Returns the byte offset
+ * to start decoding from or -1 if there is none.  When width and
+ * height are not null they receive the coded picture size from the
+ * header, or -1 if it could not be parsed.
+ */
+int wstsw_probe_sequence_header( int codec, const unsigned char *data, int len, int *width, int *height );
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif
+
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "westeros-sink-sw-sched.h"
+
+static void swSchedSignal( SWSched *sched );
+static void swSchedWaitPlaying( SWSched *sched );
+static void swSchedSendQOS( SWSched *sched, GstClockTime runningTime, GstClockTimeDiff jitter );
+
+void wstsw_sched_init( SWSched *sched, GstBaseSink *sink, GMutex *lock )
+{
+   memset( sched, 0, sizeof(SWSched) );
+   sched->sink= sink;
+   sched->lock= lock;
+   #ifdef GLIB_VERSION_2_32
+   g_cond_init( &sched->cond );
+   #else
+   sched->cond= g_cond_new();
+   #endif
+   sched->frameRate= 60.0;
+   sched->prevFrameTime= -1LL;
+   sched->firstPTS= -1LL;
+   sched->qosProportion= 1.0;
+}
+
+void wstsw_sched_term( SWSched *sched )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_cond_clear( &sched->cond );
+   #else
+   g_cond_free( sched->cond );
+   sched->cond= 0;
+   #endif
+}
+
+void wstsw_sched_set_active( SWSched *sched, bool active )
+{
+   sched->active= active;
+   if ( !active && sched->clockId )
+   {
+      gst_clock_id_unschedule( sched->clockId );
+   }
+   swSchedSignal( sched );
+}
+
+void wstsw_sched_set_playing( SWSched *sched, bool playing )
+{
+   sched->playing= playing;
+   sched->paused= !playing;
+   if ( !playing && sched->clockId )
+   {
+      gst_clock_id_unschedule( sched->clockId );
+   }
+   swSchedSignal( sched );
+}
+
+void wstsw_sched_flush( SWSched *sched, bool start )
+{
+   if ( start )
+   {
+      sched->flushing= true;
+      if ( sched->clockId )
+      {
+         gst_clock_id_unschedule( sched->clockId );
+      }
+      swSchedSignal( sched );
+   }
+   else
+   {
+      sched->flushing= false;
+      sched->firstPTS= -1LL;
+      sched->prevFrameTime= -1LL;
+      sched->framesSinceFlush= 0;
+      sched->consecutiveDrops= 0;
+   }
+}
+
+bool wstsw_sched_wait_unpaused( SWSched *sched )
+{
+   bool active;
+
+   g_mutex_lock( sched->lock );
+   while( sched->paused && sched->active )
+   {
+      #ifdef GLIB_VERSION_2_32
+      g_cond_wait( &sched->cond, sched->lock );
+      #else
+      g_cond_wait( sched->cond, sched->lock );
+      #endif
+   }
+   active= sched->active;
+   g_mutex_unlock( sched->lock );
+
+   return active;
+}
+
+bool wstsw_sched_frame( SWSched *sched, const GstSegment *segment, GstClockTime pts )
+{
+   bool display= true;
+   bool preroll, cancelled;
+   GstClock *clock= 0;
+   GstClockTime runningTime= GST_CLOCK_TIME_NONE;
+   GstClockTime baseTime= 0;
+   GstClockTime renderDelay;
+   GstClockTimeDiff jitter= 0, offset;
+   GstClockReturn clockRet= GST_CLOCK_OK;
+   gint64 maxLateness;
+
+   if ( GST_CLOCK_TIME_IS_VALID(pts) && (segment->format == GST_FORMAT_TIME) )
+   {
+      runningTime= gst_segment_to_running_time( segment, GST_FORMAT_TIME, pts );
+      if ( !GST_CLOCK_TIME_IS_VALID(runningTime) )
+      {
+         /* Decoded on the way to a seek target but outside the segment */
+         GST_LOG("wstsw_sched_frame: pts %" GST_TIME_FORMAT " outside segment", GST_TIME_ARGS(pts));
+         display= false;
+         goto exit;
+      }
+      if ( sched->firstPTS == -1LL )
+      {
+         sched->firstPTS= pts;
+      }
+   }
+
+   GST_OBJECT_LOCK(sched->sink);
+   clock= GST_ELEMENT_CLOCK(sched->sink);
+   if ( clock )
+   {
+      gst_object_ref( clock );
+   }
+   baseTime= GST_ELEMENT_CAST(sched->sink)->base_time;
+   GST_OBJECT_UNLOCK(sched->sink);
+
+   if ( !clock || !GST_CLOCK_TIME_IS_VALID(runningTime) )
+   {
+      gint64 currFrameTime= g_get_monotonic_time();
+      if ( sched->prevFrameTime != -1LL )
+      {
+         gint64 framePeriod= currFrameTime-sched->prevFrameTime;
+         gint64 nominalFramePeriod= 1000000LL / sched->frameRate;
+         gint64 delay= (nominalFramePeriod-framePeriod);
+         GST_LOG("wstsw_sched_frame: time %lld prev_time %lld delay %lld", currFrameTime, sched->prevFrameTime, delay );
+         if ( (delay > 2) && (delay <= nominalFramePeriod) )
+         {
+            usleep( delay );
+            currFrameTime= g_get_monotonic_time();
+         }
+      }
+      sched->prevFrameTime= currFrameTime;
+      goto exit;
+   }
+
+   /* Show the preroll frame right away, hold the rest until playback starts */
+   g_mutex_lock( sched->lock );
+   preroll= (!sched->playing && (sched->framesSinceFlush == 0));
+   if ( !preroll )
+   {
+      swSchedWaitPlaying( sched );
+   }
+   g_mutex_unlock( sched->lock );
+   if ( preroll )
+   {
+      goto exit;
+   }
+
+   GST_OBJECT_LOCK(sched->sink);
+   baseTime= GST_ELEMENT_CAST(sched->sink)->base_time;
+   GST_OBJECT_UNLOCK(sched->sink);
+
+   offset= gst_base_sink_get_ts_offset( sched->sink ) + (GstClockTimeDiff)gst_base_sink_get_latency( sched->sink );
+   renderDelay= gst_base_sink_get_render_delay( sched->sink );
+   offset -= (GstClockTimeDiff)renderDelay;
+
+   for( ; ; )
+   {
+      GstClockTimeDiff target= (GstClockTimeDiff)(baseTime + runningTime) + offset;
+      GstClockID clockId;
+
+      if ( target < 0 )
+      {
+         target= 0;
+      }
+
+      g_mutex_lock( sched->lock );
+      if ( sched->flushing || !sched->active )
+      {
+         g_mutex_unlock( sched->lock );
+         clockRet= GST_CLOCK_UNSCHEDULED;
+         break;
+      }
+      clockId= gst_clock_new_single_shot_id( clock, (GstClockTime)target );
+      sched->clockId= clockId;
+      g_mutex_unlock( sched->lock );
+
+      clockRet= gst_clock_id_wait( clockId, &jitter );
+
+      cancelled= false;
+      g_mutex_lock( sched->lock );
+      sched->clockId= 0;
+      gst_clock_id_unref( clockId );
+      if ( clockRet == GST_CLOCK_UNSCHEDULED )
+      {
+         /* Woken for a pause: wait to resume then re-wait against the new base time */
+         swSchedWaitPlaying( sched );
+         cancelled= (sched->flushing || !sched->active);
+      }
+      g_mutex_unlock( sched->lock );
+
+      if ( (clockRet != GST_CLOCK_UNSCHEDULED) || cancelled )
+      {
+         break;
+      }
+
+      GST_OBJECT_LOCK(sched->sink);
+      baseTime= GST_ELEMENT_CAST(sched->sink)->base_time;
+      GST_OBJECT_UNLOCK(sched->sink);
+   }
+
+   if ( clockRet == GST_CLOCK_UNSCHEDULED )
+   {
+      GST_DEBUG("wstsw_sched_frame: wait for %" GST_TIME_FORMAT " cancelled", GST_TIME_ARGS(runningTime));
+      display= false;
+      goto exit;
+   }
+
+   GST_LOG("wstsw_sched_frame: pts %" GST_TIME_FORMAT " running time %" GST_TIME_FORMAT " jitter %" G_GINT64_FORMAT,
+           GST_TIME_ARGS(pts), GST_TIME_ARGS(runningTime), jitter );
+
+   sched->jitterTotal += ABS(jitter)/1000;
+   ++sched->jitterCount;
+   if ( ABS(jitter)/1000 > sched->jitterMax )
+   {
+      sched->jitterMax= ABS(jitter)/1000;
+   }
+
+   maxLateness= gst_base_sink_get_max_lateness( sched->sink );
+   if ( (maxLateness >= 0) &&
+        (jitter > maxLateness) &&
+        (sched->framesSinceFlush > 0) &&
+        (sched->consecutiveDrops < SW_MAX_CONSECUTIVE_DROPS) )
+   {
+      GST_DEBUG("wstsw_sched_frame: drop frame %" GST_TIME_FORMAT " late by %" G_GINT64_FORMAT " ns",
+                GST_TIME_ARGS(pts), jitter );
+      display= false;
+      ++sched->framesDropped;
+      ++sched->consecutiveDrops;
+   }
+   else
+   {
+      sched->consecutiveDrops= 0;
+   }
+
+   swSchedSendQOS( sched, runningTime, jitter );
+
+exit:
+   if ( display )
+   {
+      ++sched->framesSinceFlush;
+   }
+   if ( clock )
+   {
+      gst_object_unref( clock );
+   }
+   return display;
+}
+
+static void swSchedSignal( SWSched *sched )
+{
+   #ifdef GLIB_VERSION_2_32
+   g_cond_broadcast( &sched->cond );
+   #else
+   g_cond_broadcast( sched->cond );
+   #endif
+}
+
+/*
+ * Wait for playback to resume, a flush or a stop.  Caller must hold
+ * the sched lock.
+ */
+static void swSchedWaitPlaying( SWSched *sched )
+{
+   while( !sched->playing && sched->active && !sched->flushing )
+   {
+      #ifdef GLIB_VERSION_2_32
+      g_cond_wait( &sched->cond, sched->lock );
+      #else
+      g_cond_wait( sched->cond, sched->lock );
+      #endif
+   }
+}
+
+/*
+ * Tell upstream how far behind we are.  While more than half a frame late
+ * skipNonRef is set so the decoder can skip non-reference frames.
+ */
+static void swSchedSendQOS( SWSched *sched, GstClockTime runningTime, GstClockTimeDiff jitter )
+{
+   gint64 frameDuration= (gint64)(GST_SECOND / sched->frameRate);
+   bool late;
+
+   /* Compare the smoothed per packet decode time with the frame duration */
+   sched->qosProportion= (frameDuration > 0) ? (double)sched->qosDecodeTime / (double)frameDuration : 1.0;
+   if ( jitter > 0 )
+   {
+      sched->qosProportion += (double)jitter / (double)frameDuration;
+   }
+   sched->qosProportion= CLAMP( sched->qosProportion, 0.1, 10.0 );
+
+   late= (jitter > frameDuration/2);
+   if ( late != sched->skipNonRef )
+   {
+      GST_DEBUG("swSchedSendQOS: %s skipping non-reference frames", late ? "start" : "stop");
+      sched->skipNonRef= late;
+   }
+
+   if ( gst_base_sink_is_qos_enabled( sched->sink ) )
+   {
+      GstEvent *event;
+
+      event= gst_event_new_qos( (jitter > 0) ? GST_QOS_TYPE_UNDERFLOW : GST_QOS_TYPE_OVERFLOW,
+                                sched->qosProportion,
+                                jitter,
+                                runningTime );
+      if ( !gst_pad_push_event( GST_BASE_SINK_PAD(sched->sink), event ) )
+      {
+         GST_LOG("swSchedSendQOS: qos event not handled upstream");
+      }
+   }
+}
+
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 RDK Management
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __WESTEROS_SINK_SW_SCHED_H__
+#define __WESTEROS_SINK_SW_SCHED_H__
+
+#include <stdbool.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* A late frame is always shown after this many drops in a row so video keeps moving */
+#define SW_MAX_CONSECUTIVE_DROPS (8)
+#define SW_DEFAULT_MAX_LATENESS (20*GST_MSECOND)
+
+/*
+ * Presentation scheduling for software decoded frames.  Playback state
+ * is guarded by the lock supplied at init, which is the sink lock.
+ */
+typedef struct _SWSched
+{
+   GstBaseSink *sink;
+   GMutex *lock;
+   #ifdef GLIB_VERSION_2_32
+   GCond cond;
+   #else
+   GCond *cond;
+   #endif
+   GstClockID clockId;
+   bool active;
+   bool playing;
+   bool paused;
+   bool flushing;
+   double frameRate;
+   gint64 prevFrameTime;
+   gint64 firstPTS;
+   int framesSinceFlush;
+   int consecutiveDrops;
+   double qosProportion;
+   gint64 qosDecodeTime;
+   bool skipNonRef;
+   int framesDropped;
+   gint64 jitterTotal;
+   gint64 jitterMax;
+   int jitterCount;
+} SWSched;
+
+void wstsw_sched_init( SWSched *sched, GstBaseSink *sink, GMutex *lock );
+void wstsw_sched_term( SWSched *sched );
+
+/*
+ * Playback state changes.  These cancel any pending clock wait and wake
+ * a frame waiting to resume.  Caller must hold the sched lock.
+ */
+void wstsw_sched_set_active( SWSched *sched, bool active );
+void wstsw_sched_set_playing( SWSched *sched, bool playing );
+void wstsw_sched_flush( SWSched *sched, bool start );
+
+/*
+ * Block while paused.  Returns false if the sink is no longer active.
+ */
+bool wstsw_sched_wait_unpaused( SWSched *sched );
+
+/*
+ * Wait until a decoded frame is due on the pipeline clock.  Returns false
+ * if the frame should be dropped because it is too late or the wait was
+ * cancelled by a flush or state change.  Without a clock or a timestamp
+ * frames are paced at the nominal frame rate.
+ */
+bool wstsw_sched_frame( SWSched *sched, const GstSegment *segment, GstClockTime pts );
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif
+
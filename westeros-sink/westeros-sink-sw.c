@@ -24,18 +24,44 @@ extern "C" {
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
+#include <libavutil/dict.h>
 
 #if defined(__cplusplus)
 } // extern "C"
 #endif
 
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "westeros-sink-sw-probe.c"
+
 GST_DEBUG_CATEGORY_EXTERN (gst_westeros_sink_debug);
 #define GST_CAT_DEFAULT gst_westeros_sink_debug
 
+#include "westeros-sink-sw-sched.c"
+#include "westeros-sink-sw-buffer.c"
+
+typedef struct _SWCodecInfo
+{
+   int codec;
+   enum AVCodecID codecId;
+   const char *decoderNames[3]; /* preferred decoders, tried before the default for codecId */
+   const char *options; /* decoder options as key=value pairs separated by ':' */
+} SWCodecInfo;
+
+static const SWCodecInfo swCodecs[]=
+{
+   { SWCodec_h264, AV_CODEC_ID_H264, { 0 }, 0 },
+   { SWCodec_h265, AV_CODEC_ID_HEVC, { 0 }, 0 },
+   { SWCodec_vp9, AV_CODEC_ID_VP9, { 0 }, 0 },
+   /* Only output the highest spatial layer of scalable streams */
+   { SWCodec_av1, AV_CODEC_ID_AV1, { "libdav1d", "libaom-av1", 0 }, "alllayers=0" }
+};
+
 typedef struct _SWCtx
 {
+   const SWCodecInfo *codecInfo;
    AVCodec* codec;
    AVCodecContext* codecCtx;
    bool contextOpen;
@@ -45,21 +71,37 @@ typedef struct _SWCtx
    uint8_t *initData;
    int initDataLen;
    bool needInitData;
-   bool active;
-   bool paused;
-   double frameRate;
+   int streamWidth;
+   int streamHeight;
+   SWSched sched;
    int outputFrameCount;
-   gint64 prevFrameTime;
+   bool needFlush;
+   gint64 prevPTS;
+   int threadCount;
+   int threadType;
+   int framesDecoded;
+   int framesDisplayed;
+   int framesDirect;
+   int framesCopied;
+   gint64 decodeTimeTotal;
+   gint64 decodeTimeMax;
+   int decodeCount;
 } SWCtx;
 
 static bool initSWDecoder( GstWesterosSink *sink );
 static void termSWDecoder( SWCtx *swCtx );
+static const SWCodecInfo *swFindCodecInfo( int codec );
+static bool swOpenCodec( GstWesterosSink *sink, SWCtx *swCtx, const SWCodecInfo *codecInfo );
+static void swCloseCodec( SWCtx *swCtx );
+static int swGetBuffer2( AVCodecContext *codecCtx, AVFrame *frame, int flags );
+static void swFreeDirectBuffer( void *opaque, uint8_t *data );
+static void swReleaseDirectBuffer( void *ctx, int bufferId );
+static void swLogStats( SWCtx *swCtx );
 
 
 static bool initSWDecoder( GstWesterosSink *sink )
 {
    bool result= false;
-   int rc;
    SWCtx *swCtx= 0;
 
    swCtx= (SWCtx*)calloc( 1, sizeof(SWCtx) );
@@ -68,14 +110,93 @@ static bool initSWDecoder( GstWesterosSink *sink )
       GST_ERROR("initSWDecoder: no memory for SWCtx");
       goto exit;
    }
-   swCtx->prevFrameTime= -1LL;
-   swCtx->frameRate= 60.0;
+   #ifdef GLIB_VERSION_2_32
+   wstsw_sched_init( &swCtx->sched, GST_BASE_SINK(sink), &sink->mutex );
+   #else
+   wstsw_sched_init( &swCtx->sched, GST_BASE_SINK(sink), sink->mutex );
+   #endif
+   swCtx->prevPTS= -1LL;
+   swCtx->streamWidth= -1;
+   swCtx->streamHeight= -1;
 
    avcodec_register_all();
-   swCtx->codec= avcodec_find_decoder(AV_CODEC_ID_H264);
+
+   /* Start with h264 until caps say otherwise */
+   if ( !swOpenCodec( sink, swCtx, swFindCodecInfo( SWCodec_h264 ) ) )
+   {
+      goto exit;
+   }
+
+   swCtx->packet= av_packet_alloc();
+   if ( !swCtx->packet )
+   {
+      GST_ERROR("initSWDecoder: unable to allocate decode packet" );
+      goto exit;
+   }
+
+   swCtx->frame= av_frame_alloc();
+   if ( !swCtx->frame )
+   {
+      GST_ERROR("initSWDecoder: unable to allocate decode frame" );
+      goto exit;
+   }
+
+   sink->swCtx= swCtx;
+
+   result= true;
+
+exit:
+
+   if ( !result )
+   {
+      if ( swCtx )
+      {
+         termSWDecoder( swCtx );
+      }
+   }
+   return result;
+}
+
+static const SWCodecInfo *swFindCodecInfo( int codec )
+{
+   const SWCodecInfo *codecInfo= 0;
+   int i;
+   for( i= 0; i < (int)(sizeof(swCodecs)/sizeof(swCodecs[0])); ++i )
+   {
+      if ( swCodecs[i].codec == codec )
+      {
+         codecInfo= &swCodecs[i];
+         break;
+      }
+   }
+   return codecInfo;
+}
+
+static bool swOpenCodec( GstWesterosSink *sink, SWCtx *swCtx, const SWCodecInfo *codecInfo )
+{
+   bool result= false;
+   AVDictionary *options= 0;
+   int i, rc;
+
+   if ( !codecInfo )
+   {
+      GST_ERROR("swOpenCodec: no codec info");
+      goto exit;
+   }
+   swCtx->codecInfo= codecInfo;
+
+   swCtx->codec= 0;
+   for( i= 0; !swCtx->codec && codecInfo->decoderNames[i]; ++i )
+   {
+      swCtx->codec= (AVCodec*)avcodec_find_decoder_by_name( codecInfo->decoderNames[i] );
+   }
+   if ( !swCtx->codec )
+   {
+      swCtx->codec= (AVCodec*)avcodec_find_decoder( codecInfo->codecId );
+   }
    if ( !swCtx->codec )
    {
-      GST_ERROR("initSWDecoder: unable to find decoder" );
+      GST_ERROR("swOpenCodec: unable to find decoder for %s", wstsw_codec_name( codecInfo->codec ) );
       goto exit;
    }
 
@@ -86,58 +207,76 @@ static bool initSWDecoder( GstWesterosSink *sink )
    swCtx->codecCtx= avcodec_alloc_context3( swCtx->codec );
    if ( !swCtx->codecCtx )
    {
-      GST_ERROR("initSWDecoder: unable to allocate decoder context" );
+      GST_ERROR("swOpenCodec: unable to allocate decoder context" );
       goto exit;
    }
 
-   rc= avcodec_open2( swCtx->codecCtx, swCtx->codec, (AVDictionary**)NULL );
-   if ( rc != 0 )
+   swCtx->codecCtx->pkt_timebase.num= 1;
+   swCtx->codecCtx->pkt_timebase.den= GST_SECOND;
+
+   swCtx->codecCtx->thread_count= sink->swThreadCount;
+   swCtx->codecCtx->thread_type= 0;
+   if ( sink->swThreadType & SW_THREAD_FRAME )
    {
-      GST_ERROR("initSWDecoder: error opening decoder: rc %d", rc );
-      goto exit;
+      swCtx->codecCtx->thread_type |= FF_THREAD_FRAME;
+   }
+   if ( sink->swThreadType & SW_THREAD_SLICE )
+   {
+      swCtx->codecCtx->thread_type |= FF_THREAD_SLICE;
    }
-   swCtx->contextOpen= true;
 
-   swCtx->parserCtx= av_parser_init( swCtx->codec->id );
-   if ( !swCtx->parserCtx )
+   if ( sink->swAllocBuffer && sink->swFreeBuffer && (swCtx->codec->capabilities & AV_CODEC_CAP_DR1) )
    {
-      GST_ERROR("initSWDecoder: unable to allocate decode parser context" );
-      goto exit;
+      swCtx->codecCtx->opaque= sink;
+      swCtx->codecCtx->get_buffer2= swGetBuffer2;
+      #if LIBAVCODEC_VERSION_MAJOR < 59
+      swCtx->codecCtx->thread_safe_callbacks= 1;
+      #endif
    }
 
-   swCtx->packet= av_packet_alloc();
-   if ( !swCtx->packet )
+   if ( codecInfo->options )
    {
-      GST_ERROR("initSWDecoder: unable to allocate decode packet" );
+      av_dict_parse_string( &options, codecInfo->options, "=", ":", 0 );
+   }
+   rc= avcodec_open2( swCtx->codecCtx, swCtx->codec, &options );
+   av_dict_free( &options );
+   if ( rc != 0 )
+   {
+      GST_ERROR("swOpenCodec: error opening decoder: rc %d", rc );
       goto exit;
    }
+   swCtx->contextOpen= true;
 
-   swCtx->frame= av_frame_alloc();
-   if ( !swCtx->frame )
+   swCtx->threadCount= swCtx->codecCtx->thread_count;
+   swCtx->threadType= swCtx->codecCtx->active_thread_type;
+   g_print("westeros-sink: sw decode %s using %s threads %d type %s%s direct %d\n",
+           wstsw_codec_name( codecInfo->codec ),
+           swCtx->codec->name,
+           swCtx->threadCount,
+           (swCtx->threadType & FF_THREAD_FRAME) ? "frame " : "",
+           (swCtx->threadType & FF_THREAD_SLICE) ? "slice" : "",
+           (swCtx->codecCtx->get_buffer2 == swGetBuffer2) );
+
+   /* Not every codec has a parser, without one each buffer is sent as a packet */
+   swCtx->parserCtx= av_parser_init( swCtx->codec->id );
+   if ( !swCtx->parserCtx )
    {
-      GST_ERROR("initSWDecoder: unable to allocate decode frame" );
-      goto exit;
+      GST_DEBUG("swOpenCodec: no parser for %s", wstsw_codec_name( codecInfo->codec ) );
    }
 
    swCtx->needInitData= true;
 
-   sink->swCtx= swCtx;
-
    result= true;
 
 exit:
-
    if ( !result )
    {
-      if ( swCtx )
-      {
-         termSWDecoder( swCtx );
-      }
+      swCloseCodec( swCtx );
    }
    return result;
 }
 
-static void termSWDecoder( SWCtx *swCtx )
+static void swCloseCodec( SWCtx *swCtx )
 {
    if ( swCtx->parserCtx )
    {
@@ -154,6 +293,16 @@ static void termSWDecoder( SWCtx *swCtx )
       av_free( swCtx->codecCtx );
       swCtx->codecCtx= 0;
    }
+   swCtx->codec= 0;
+}
+
+static void termSWDecoder( SWCtx *swCtx )
+{
+   if ( swCtx->framesDecoded )
+   {
+      swLogStats( swCtx );
+   }
+   swCloseCodec( swCtx );
    if ( swCtx->frame )
    {
       av_frame_free( &swCtx->frame );
@@ -164,9 +313,206 @@ static void termSWDecoder( SWCtx *swCtx )
       av_packet_free( &swCtx->packet );
       swCtx->packet= 0;
    }
+   wstsw_sched_term( &swCtx->sched );
    free( swCtx );
 }
 
+/*
+ * Decode directly into display buffers supplied by the soc so decoded
+ * frames don't need to be copied again before they can be shown.  Falls
+ * back to decoder owned memory for formats the soc can't take or when
+ * it has no free buffer.  Called from decoder threads when frame
+ * threading is active.
+ */
+static int swGetBuffer2( AVCodecContext *codecCtx, AVFrame *frame, int flags )
+{
+   GstWesterosSink *sink= (GstWesterosSink*)codecCtx->opaque;
+   SWDirectBuffer *direct= 0;
+   SWBuffer swBuffer;
+   unsigned char *chroma, *chromaEnd;
+   int linesizeAlign[AV_NUM_DATA_POINTERS];
+   int width, height, i;
+
+   if ( (frame->format != AV_PIX_FMT_YUV420P) && (frame->format != AV_PIX_FMT_YUVJ420P) )
+   {
+      goto fallback;
+   }
+
+   width= frame->width;
+   height= frame->height;
+   avcodec_align_dimensions2( codecCtx, &width, &height, linesizeAlign );
+
+   memset( &swBuffer, 0, sizeof(swBuffer) );
+   swBuffer.bufferId= -1;
+   swBuffer.width= width;
+   swBuffer.height= height;
+   if ( !sink->swAllocBuffer( sink, &swBuffer ) )
+   {
+      GST_LOG("swGetBuffer2: no direct buffer available for %dx%d", width, height);
+      goto fallback;
+   }
+
+   if ( (swBuffer.Ystride % linesizeAlign[0]) ||
+        (swBuffer.Ustride % linesizeAlign[1]) ||
+        (swBuffer.Vstride % linesizeAlign[2]) )
+   {
+      GST_ERROR("swGetBuffer2: buffer %d strides (%d,%d,%d) not aligned to (%d,%d,%d)",
+                swBuffer.bufferId, swBuffer.Ystride, swBuffer.Ustride, swBuffer.Vstride,
+                linesizeAlign[0], linesizeAlign[1], linesizeAlign[2] );
+      goto error;
+   }
+
+   /* U and V are in soc side memory separate from Y so they get their own ref */
+   chroma= MIN( swBuffer.U, swBuffer.V );
+   chromaEnd= MAX( swBuffer.U+swBuffer.Ustride*((swBuffer.height+1)/2),
+                   swBuffer.V+swBuffer.Vstride*((swBuffer.height+1)/2) );
+
+   direct= wstsw_direct_create( swReleaseDirectBuffer, sink, swBuffer.bufferId, 2 );
+   if ( !direct )
+   {
+      GST_ERROR("swGetBuffer2: no memory for direct buffer");
+      goto error;
+   }
+
+   frame->buf[0]= av_buffer_create( swBuffer.Y, swBuffer.Ystride*swBuffer.height,
+                                    swFreeDirectBuffer, direct, 0 );
+   frame->buf[1]= av_buffer_create( chroma, chromaEnd-chroma,
+                                    swFreeDirectBuffer, direct, 0 );
+   if ( !frame->buf[0] || !frame->buf[1] )
+   {
+      GST_ERROR("swGetBuffer2: unable to create buffer refs");
+      /* Drop the shares of refs not made, then the refs, releasing the display buffer */
+      if ( !frame->buf[0] )
+      {
+         wstsw_direct_unref( direct );
+      }
+      if ( !frame->buf[1] )
+      {
+         wstsw_direct_unref( direct );
+      }
+      av_buffer_unref( &frame->buf[0] );
+      av_buffer_unref( &frame->buf[1] );
+      goto fallback;
+   }
+
+   for( i= 0; i < AV_NUM_DATA_POINTERS; ++i )
+   {
+      frame->data[i]= 0;
+      frame->linesize[i]= 0;
+   }
+   frame->data[0]= swBuffer.Y;
+   frame->data[1]= swBuffer.U;
+   frame->data[2]= swBuffer.V;
+   frame->linesize[0]= swBuffer.Ystride;
+   frame->linesize[1]= swBuffer.Ustride;
+   frame->linesize[2]= swBuffer.Vstride;
+   frame->extended_data= frame->data;
+
+   return 0;
+
+error:
+   sink->swFreeBuffer( sink, swBuffer.bufferId );
+
+fallback:
+   return avcodec_default_get_buffer2( codecCtx, frame, flags );
+}
+
+static void swFreeDirectBuffer( void *opaque, uint8_t *data )
+{
+   WESTEROS_UNUSED(data);
+
+   wstsw_direct_unref( wstsw_direct_get( opaque ) );
+}
+
+static void swReleaseDirectBuffer( void *ctx, int bufferId )
+{
+   GstWesterosSink *sink= (GstWesterosSink*)ctx;
+
+   sink->swFreeBuffer( sink, bufferId );
+}
+
+static void swLogStats( SWCtx *swCtx )
+{
+   g_print("westeros-sink: sw decode stats: decoded %d displayed %d dropped %d direct %d copied %d decode avg %lld us max %lld us jitter avg %lld us max %lld us threads %d type %d\n",
+           swCtx->framesDecoded,
+           swCtx->framesDisplayed,
+           swCtx->sched.framesDropped,
+           swCtx->framesDirect,
+           swCtx->framesCopied,
+           (swCtx->decodeCount ? swCtx->decodeTimeTotal/swCtx->decodeCount : 0LL),
+           swCtx->decodeTimeMax,
+           (swCtx->sched.jitterCount ? swCtx->sched.jitterTotal/swCtx->sched.jitterCount : 0LL),
+           swCtx->sched.jitterMax,
+           swCtx->threadCount,
+           swCtx->threadType );
+}
+
+void wstsw_flush( GstWesterosSink *sink, bool start )
+{
+   SWCtx *swCtx;
+
+   LOCK(sink);
+   swCtx= (SWCtx*)sink->swCtx;
+   if ( swCtx )
+   {
+      wstsw_sched_flush( &swCtx->sched, start );
+      if ( !start )
+      {
+         swCtx->needFlush= true;
+         swCtx->prevPTS= -1LL;
+      }
+   }
+   UNLOCK(sink);
+}
+
+void wstsw_release_frame( GstWesterosSink *sink, void *ref )
+{
+   AVBufferRef *bufferRef= (AVBufferRef*)ref;
+
+   WESTEROS_UNUSED(sink);
+
+   if ( bufferRef )
+   {
+      av_buffer_unref( &bufferRef );
+   }
+}
+
+GstStructure *wstsw_get_stats( GstWesterosSink *sink )
+{
+   GstStructure *stats= 0;
+   SWCtx *swCtx;
+
+   LOCK(sink);
+   swCtx= (SWCtx*)sink->swCtx;
+   if ( swCtx )
+   {
+      stats= gst_structure_new( "sw-stats",
+                                "codec", G_TYPE_STRING, wstsw_codec_name( swCtx->codecInfo ? swCtx->codecInfo->codec : SWCodec_none ),
+                                "stream-width", G_TYPE_INT, swCtx->streamWidth,
+                                "stream-height", G_TYPE_INT, swCtx->streamHeight,
+                                "frames-decoded", G_TYPE_INT, swCtx->framesDecoded,
+                                "frames-displayed", G_TYPE_INT, swCtx->framesDisplayed,
+                                "frames-direct", G_TYPE_INT, swCtx->framesDirect,
+                                "frames-copied", G_TYPE_INT, swCtx->framesCopied,
+                                "decode-time-avg", G_TYPE_INT64, (swCtx->decodeCount ? swCtx->decodeTimeTotal/swCtx->decodeCount : 0LL),
+                                "decode-time-max", G_TYPE_INT64, swCtx->decodeTimeMax,
+                                "thread-count", G_TYPE_INT, swCtx->threadCount,
+                                "thread-type", G_TYPE_INT, swCtx->threadType,
+                                "frames-dropped", G_TYPE_INT, swCtx->sched.framesDropped,
+                                "jitter-avg", G_TYPE_INT64, (swCtx->sched.jitterCount ? swCtx->sched.jitterTotal/swCtx->sched.jitterCount : 0LL),
+                                "jitter-max", G_TYPE_INT64, swCtx->sched.jitterMax,
+                                "qos-proportion", G_TYPE_DOUBLE, swCtx->sched.qosProportion,
+                                NULL );
+   }
+   else
+   {
+      stats= gst_structure_new_empty( "sw-stats" );
+   }
+   UNLOCK(sink);
+
+   return stats;
+}
+
 void wstsw_process_caps( GstWesterosSink *sink, GstCaps *caps )
 {
    SWCtx *swCtx= (SWCtx*)sink->swCtx;
@@ -182,14 +528,33 @@ void wstsw_process_caps( GstWesterosSink *sink, GstCaps *caps )
       structure= gst_caps_get_structure(caps, 0);
       if( structure )
       {
+         int codec= wstsw_codec_from_mime( gst_structure_get_name(structure) );
+         if ( codec == SWCodec_none )
+         {
+            GST_ERROR("wstsw_process_caps: unsupported codec (%s)", gst_structure_get_name(structure) );
+         }
+         else if ( !swCtx->codecInfo || (swCtx->codecInfo->codec != codec) )
+         {
+            swCloseCodec( swCtx );
+            if ( codec != SWCodec_h264 )
+            {
+               /* Codec init data is only ever generated for h264 */
+               swCtx->initData= 0;
+               swCtx->initDataLen= 0;
+            }
+            if ( !swOpenCodec( sink, swCtx, swFindCodecInfo( codec ) ) )
+            {
+               GST_ERROR("wstsw_process_caps: unable to open %s decoder", wstsw_codec_name( codec ) );
+            }
+         }
          if ( gst_structure_get_fraction( structure, "framerate", &num, &denom ) )
          {
             if ( denom == 0 ) denom= 1;
-            swCtx->frameRate= (double)num/(double)denom;
-            if ( swCtx->frameRate <= 0.0 )
+            swCtx->sched.frameRate= (double)num/(double)denom;
+            if ( swCtx->sched.frameRate <= 0.0 )
             {
                g_print("westeros-sink: caps have framerate of 0 - assume 60\n");
-               swCtx->frameRate= 60.0;
+               swCtx->sched.frameRate= 60.0;
             }
          }
          sink->soc.pixelAspectRatio= 1.0;
@@ -222,31 +587,35 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
 {
    bool result= true;
    SWCtx *swCtx= (SWCtx*)sink->swCtx;
+   #ifdef USE_GST1
+   GstMapInfo map;
+   bool mapped= false;
+   #endif
 
    GST_LOG("wstsw_render: buffer %p", buffer );
 
-   while( swCtx->paused )
+   if ( swCtx && !wstsw_sched_wait_unpaused( &swCtx->sched ) )
    {
-      usleep( 1000 );
-      if ( !swCtx->active )
-      {      
-         goto exit;
-      }
+      goto exit;
    }
 
-   if ( swCtx )
+   if ( swCtx && swCtx->codecCtx )
    {
       int rc;
       int inputLen, parsedLen, consumed;
       uint8_t *inputData, *parsedData;
-      #ifdef USE_GST1
-      GstMapInfo map;
-      #endif
       int inSize= 0;
       unsigned char *inData= 0;
       int64_t pts= AV_NOPTS_VALUE;
       int64_t dts= AV_NOPTS_VALUE;
 
+      if ( swCtx->needFlush )
+      {
+         GST_DEBUG("wstsw_render: flushing decoder");
+         swCtx->needFlush= false;
+         avcodec_flush_buffers( swCtx->codecCtx );
+      }
+
       if ( GST_BUFFER_PTS_IS_VALID(buffer) )
       {
          pts= GST_BUFFER_PTS(buffer);
@@ -256,7 +625,12 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
          dts= GST_BUFFER_DTS(buffer);
       }
       #ifdef USE_GST1
-      gst_buffer_map(buffer, &map, (GstMapFlags)GST_MAP_READ);
+      if ( !gst_buffer_map(buffer, &map, (GstMapFlags)GST_MAP_READ) )
+      {
+         GST_ERROR("wstsw_render: unable to map buffer");
+         goto exit;
+      }
+      mapped= true;
       inSize= map.size;
       inData= map.data;
       #else
@@ -276,29 +650,24 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
          {
             if ( swCtx->needInitData )
             {
-               bool foundSPS= false;
-               int i;
-               for ( i= 0; i < inSize-5; ++i )
+               int width, height;
+               int offset= wstsw_probe_sequence_header( swCtx->codecInfo->codec, inData, inSize, &width, &height );
+               if ( offset < 0 )
                {
-                  if ( (inData[i+0] == 0) &&
-                       (inData[i+1] == 0) &&
-                       (inData[i+2] == 0) &&
-                       (inData[i+3] == 1) &&
-                       (inData[i+4] == 0x67) )
-                  {
-                    GST_DEBUG("wstsw_render: found sps at offset %d", i);
-                    swCtx->needInitData= false;
-                    foundSPS= true;
-                    inData= inData+i;
-                    inSize= inSize-i;
-                    break;
-                  }
+                  GST_DEBUG("wstsw_render: skipping data until %s sequence header", wstsw_codec_name( swCtx->codecInfo->codec ));
+                  break;
                }
-               if ( !foundSPS )
+               GST_DEBUG("wstsw_render: found sequence header at offset %d: %dx%d", offset, width, height);
+               if ( (width > 0) && (height > 0) &&
+                    ((width != swCtx->streamWidth) || (height != swCtx->streamHeight)) )
                {
-                  GST_DEBUG("wstsw_render: skipping data until sps");
-                  break;
+                  g_print("westeros-sink: sw decode %s stream %dx%d\n", wstsw_codec_name( swCtx->codecInfo->codec ), width, height);
+                  swCtx->streamWidth= width;
+                  swCtx->streamHeight= height;
                }
+               swCtx->needInitData= false;
+               inData= inData+offset;
+               inSize= inSize-offset;
             }
 
             inputData= (uint8_t*)inData;
@@ -310,19 +679,28 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
          {
             parsedData= 0;
             parsedLen= 0;
-            consumed= av_parser_parse2( swCtx->parserCtx,
-                                        swCtx->codecCtx,
-                                        &parsedData,
-                                        &parsedLen,
-                                        inputData,
-                                        inputLen,
-                                        pts,
-                                        dts,
-                                        0 );
-            if ( consumed < 0 )
+            if ( swCtx->parserCtx )
             {
-               GST_ERROR("wstsw_render: av_parser_parse2 error: rc %d", consumed);
-               goto exit;
+               consumed= av_parser_parse2( swCtx->parserCtx,
+                                           swCtx->codecCtx,
+                                           &parsedData,
+                                           &parsedLen,
+                                           inputData,
+                                           inputLen,
+                                           pts,
+                                           dts,
+                                           0 );
+               if ( consumed < 0 )
+               {
+                  GST_ERROR("wstsw_render: av_parser_parse2 error: rc %d", consumed);
+                  goto exit;
+               }
+            }
+            else
+            {
+               parsedData= inputData;
+               parsedLen= inputLen;
+               consumed= inputLen;
             }
 
             inputData += consumed;
@@ -330,9 +708,14 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
 
             if ( parsedLen )
             {
+               gint64 decodeStart, decodeTime;
+
                swCtx->packet->data= parsedData;
                swCtx->packet->size= parsedLen;
+               swCtx->packet->pts= swCtx->parserCtx ? swCtx->parserCtx->pts : pts;
+               swCtx->packet->dts= swCtx->parserCtx ? swCtx->parserCtx->dts : dts;
 
+               decodeStart= g_get_monotonic_time();
                rc= avcodec_send_packet( swCtx->codecCtx, swCtx->packet );
                if ( rc != 0 )
                {      
@@ -342,8 +725,21 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
                while ( rc >= 0 )
                {
                   SWFrame swFrame;
+                  SWDirectBuffer *direct;
 
                   rc= avcodec_receive_frame( swCtx->codecCtx, swCtx->frame );
+                  if ( decodeStart != -1LL )
+                  {
+                     decodeTime= g_get_monotonic_time()-decodeStart;
+                     swCtx->sched.qosDecodeTime= (swCtx->sched.qosDecodeTime*7 + decodeTime*GST_USECOND) / 8;
+                     swCtx->decodeTimeTotal += decodeTime;
+                     swCtx->decodeCount++;
+                     if ( decodeTime > swCtx->decodeTimeMax )
+                     {
+                        swCtx->decodeTimeMax= decodeTime;
+                     }
+                     decodeStart= -1LL;
+                  }
                   if ( (rc == AVERROR(EAGAIN)) || (rc == AVERROR_EOF) )
                   {
                      break;
@@ -366,44 +762,87 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
                           swCtx->frame->data[2],
                           swCtx->frame->data[3]
                          );
+                  swCtx->framesDecoded++;
 
-                  if ( sink->swDisplay )
+                  if ( (swCtx->frame->format != AV_PIX_FMT_YUV420P) &&
+                       (swCtx->frame->format != AV_PIX_FMT_YUVJ420P) )
                   {
-                     gint64 currFrameTime, currFramePTS;
-
-                     swFrame.width= swCtx->frame->width;
-                     swFrame.height= swCtx->frame->height;
-                     swFrame.Y= swCtx->frame->data[0];
-                     swFrame.Ystride= swCtx->frame->linesize[0];
-                     swFrame.U= swCtx->frame->data[1];
-                     swFrame.Ustride= swCtx->frame->linesize[1];
-                     swFrame.V= swCtx->frame->data[2];
-                     swFrame.Vstride= swCtx->frame->linesize[2];
-                     swFrame.frameNumber= swCtx->outputFrameCount;
-                     swFrame.pts= 0;
-
-                     currFrameTime= g_get_monotonic_time();
-                     if ( swCtx->prevFrameTime != -1LL )
+                     /* Display paths only handle 8 bit 4:2:0 */
+                     GST_WARNING("wstsw_render: unsupported output format %d", swCtx->frame->format);
+                  }
+                  else if ( sink->swDisplay )
+                  {
+                     gint64 framePTS= swCtx->frame->best_effort_timestamp;
+                     bool display;
+
+                     if ( framePTS == AV_NOPTS_VALUE )
                      {
-                        gint64 framePeriod= currFrameTime-swCtx->prevFrameTime;
-                        gint64 nominalFramePeriod= 1000000LL / swCtx->frameRate;
-                        gint64 delay= (nominalFramePeriod-framePeriod);
-                        GST_LOG("wstsw_render: time %lld prev_time %lld delay %lld", currFrameTime, swCtx->prevFrameTime, delay ); 
-                        if ( (delay > 2) && (delay <= nominalFramePeriod) )
+                        framePTS= swCtx->frame->pts;
+                     }
+                     if ( (framePTS == AV_NOPTS_VALUE) && (swCtx->prevPTS != -1LL) )
+                     {
+                        framePTS= swCtx->prevPTS + (gint64)(GST_SECOND / swCtx->sched.frameRate);
+                     }
+                     if ( framePTS != AV_NOPTS_VALUE )
+                     {
+                        swCtx->prevPTS= framePTS;
+                     }
+
+                     display= wstsw_sched_frame( &swCtx->sched, &sink->segment,
+                                                 (framePTS != AV_NOPTS_VALUE) ? (GstClockTime)framePTS : GST_CLOCK_TIME_NONE );
+                     swCtx->codecCtx->skip_frame= swCtx->sched.skipNonRef ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+                     if ( display )
+                     {
+                        swFrame.width= swCtx->frame->width;
+                        swFrame.height= swCtx->frame->height;
+                        swFrame.Y= swCtx->frame->data[0];
+                        swFrame.Ystride= swCtx->frame->linesize[0];
+                        swFrame.U= swCtx->frame->data[1];
+                        swFrame.Ustride= swCtx->frame->linesize[1];
+                        swFrame.V= swCtx->frame->data[2];
+                        swFrame.Vstride= swCtx->frame->linesize[2];
+                        swFrame.frameNumber= swCtx->outputFrameCount;
+                        swFrame.pts= (framePTS != AV_NOPTS_VALUE) ? framePTS : -1LL;
+                        swFrame.bufferId= -1;
+                        swFrame.ref= 0;
+                        direct= swCtx->frame->buf[0] ? wstsw_direct_get( av_buffer_get_opaque( swCtx->frame->buf[0] ) ) : 0;
+                        if ( direct )
                         {
-                           usleep( delay );
-                           currFrameTime= g_get_monotonic_time();
+                           swFrame.bufferId= direct->bufferId;
+                           swFrame.ref= av_buffer_ref( swCtx->frame->buf[0] );
+                           if ( !swFrame.ref )
+                           {
+                              GST_ERROR("wstsw_render: unable to reference direct frame %d", swFrame.bufferId);
+                              swFrame.bufferId= -1;
+                           }
+                        }
+                        if ( swFrame.bufferId >= 0 )
+                        {
+                           swCtx->framesDirect++;
+                        }
+                        else
+                        {
+                           swCtx->framesCopied++;
                         }
-                     }
-                     swCtx->prevFrameTime= currFrameTime;
 
-                     sink->position= sink->positionSegmentStart + ((swCtx->outputFrameCount * GST_SECOND) / swCtx->frameRate);
-                     sink->currentPTS= sink->position / (GST_SECOND/90000LL);
-                     GST_LOG("wstsw_render: POSITION: %" GST_TIME_FORMAT, GST_TIME_ARGS (sink->position));
+                        if ( (framePTS != AV_NOPTS_VALUE) && (swCtx->sched.firstPTS != -1LL) )
+                        {
+                           sink->position= sink->positionSegmentStart + framePTS - swCtx->sched.firstPTS;
+                           sink->currentPTS= framePTS / (GST_SECOND/90000LL);
+                        }
+                        else
+                        {
+                           sink->position= sink->positionSegmentStart + ((swCtx->outputFrameCount * GST_SECOND) / swCtx->sched.frameRate);
+                           sink->currentPTS= sink->position / (GST_SECOND/90000LL);
+                        }
+                        GST_LOG("wstsw_render: POSITION: %" GST_TIME_FORMAT, GST_TIME_ARGS (sink->position));
 
-                     sink->swDisplay( sink, &swFrame );
+                        sink->swDisplay( sink, &swFrame );
+                        swCtx->framesDisplayed++;
+                     }
                   }
 
+                  av_frame_unref( swCtx->frame );
                   swCtx->outputFrameCount++;
                }
             }
@@ -411,7 +850,13 @@ bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer )
       }
    }
 exit:
-   if ( !swCtx->active )
+   #ifdef USE_GST1
+   if ( mapped )
+   {
+      gst_buffer_unmap( buffer, &map );
+   }
+   #endif
+   if ( !swCtx || !swCtx->sched.active )
    {
       result= false;
    }
@@ -424,7 +869,16 @@ static gboolean wstsw_null_to_ready( GstWesterosSink *sink, gboolean *passToDefa
    {
       if ( sink->swInit )
       {
-         gst_base_sink_set_sync(GST_BASE_SINK(sink), TRUE);
+         /*
+          * Frames are scheduled against the clock after decode so the base
+          * sink must not also sync the compressed input buffers
+          */
+         gst_base_sink_set_sync(GST_BASE_SINK(sink), FALSE);
+         gst_base_sink_set_qos_enabled(GST_BASE_SINK(sink), TRUE);
+         if ( gst_base_sink_get_max_lateness(GST_BASE_SINK(sink)) < 0 )
+         {
+            gst_base_sink_set_max_lateness(GST_BASE_SINK(sink), SW_DEFAULT_MAX_LATENESS);
+         }
 
          if ( sink->swInit( sink ) )
          {
@@ -452,7 +906,9 @@ static gboolean wstsw_ready_to_paused( GstWesterosSink *sink, gboolean *passToDe
    {
       sink->swLink( sink );
    }
-   swCtx->active= true;
+   LOCK(sink);
+   wstsw_sched_set_active( &swCtx->sched, true );
+   UNLOCK(sink);
 
    return TRUE;
 }
@@ -461,10 +917,12 @@ static gboolean wstsw_paused_to_playing( GstWesterosSink *sink, gboolean *passTo
 {
    SWCtx *swCtx= (SWCtx*)sink->swCtx;
 
-   swCtx->paused= false;
+   LOCK(sink);
+   wstsw_sched_set_playing( &swCtx->sched, true );
+   UNLOCK(sink);
    if ( sink->swEvent )
    {
-      sink->swEvent( sink, SWEvt_pause, (int)swCtx->paused, 0 );
+      sink->swEvent( sink, SWEvt_pause, 0, 0 );
    }
 
    return TRUE;
@@ -474,10 +932,12 @@ static gboolean wstsw_playing_to_paused( GstWesterosSink *sink, gboolean *passTo
 {
    SWCtx *swCtx= (SWCtx*)sink->swCtx;
 
-   swCtx->paused= true;   
+   LOCK(sink);
+   wstsw_sched_set_playing( &swCtx->sched, false );
+   UNLOCK(sink);
    if ( sink->swEvent )
    {
-      sink->swEvent( sink, SWEvt_pause, (int)swCtx->paused, 0 );
+      sink->swEvent( sink, SWEvt_pause, 1, 0 );
    }
 
    return TRUE;
@@ -487,7 +947,9 @@ static gboolean wstsw_paused_to_ready( GstWesterosSink *sink, gboolean *passToDe
 {
    SWCtx *swCtx= (SWCtx*)sink->swCtx;
 
-   swCtx->active= false;
+   LOCK(sink);
+   wstsw_sched_set_active( &swCtx->sched, false );
+   UNLOCK(sink);
    if ( sink->swUnLink )
    {
       sink->swUnLink( sink );
@@ -498,15 +960,20 @@ static gboolean wstsw_paused_to_ready( GstWesterosSink *sink, gboolean *passToDe
 
 static gboolean wstsw_ready_to_null( GstWesterosSink *sink, gboolean *passToDefault )
 {
-   if ( sink->swTerm )
+   SWCtx *swCtx;
+
+   /* Terminate the decoder first so it drops its references to any direct buffers */
+   LOCK(sink);
+   swCtx= (SWCtx*)sink->swCtx;
+   sink->swCtx= 0;
+   UNLOCK(sink);
+   if ( swCtx )
    {
-      sink->swTerm( sink );
+      termSWDecoder( swCtx );
    }
-   if ( sink->swCtx )
+   if ( sink->swTerm )
    {
-      SWCtx *swCtx= (SWCtx*)sink->swCtx;
-      termSWDecoder( swCtx );
-      sink->swCtx= 0;
+      sink->swTerm( sink );
    }
 
    return TRUE;
@@ -43,11 +43,39 @@ typedef struct _SWFrame
    int Vstride;
    int frameNumber;
    long long pts;
+   int bufferId; /* display buffer the frame was decoded into, or -1 */
+   void *ref; /* when non-null, pass to wstsw_release_frame once display is done with the buffer */
 } SWFrame;
 
+/*
+ * Display buffer supplied by a swAllocBuffer method so the decoder can
+ * render into it directly.  The caller fills in width and height (padded
+ * to the decoder's alignment) and the method fills in the rest.
+ */
+typedef struct _SWBuffer
+{
+   int bufferId;
+   int width;
+   int height;
+   unsigned char *Y;
+   unsigned char *U;
+   unsigned char *V;
+   int Ystride;
+   int Ustride;
+   int Vstride;
+} SWBuffer;
+
+#define SW_THREAD_FRAME (1)
+#define SW_THREAD_SLICE (2)
+#define DEFAULT_SW_THREAD_COUNT (0)
+#define DEFAULT_SW_THREAD_TYPE (SW_THREAD_FRAME|SW_THREAD_SLICE)
+
 void wstsw_process_caps( GstWesterosSink *sink, GstCaps *caps );
 void wstsw_set_codec_init_data( GstWesterosSink *sink, int initDataLen, uint8_t *initData );
 bool wstsw_render( GstWesterosSink *sink, GstBuffer *buffer );
+void wstsw_release_frame( GstWesterosSink *sink, void *ref );
+void wstsw_flush( GstWesterosSink *sink, bool start );
+GstStructure *wstsw_get_stats( GstWesterosSink *sink );
 static gboolean wstsw_null_to_ready( GstWesterosSink *sink, gboolean *passToDefault );
 static gboolean wstsw_ready_to_paused( GstWesterosSink *sink, gboolean *passToDefault );
 static gboolean wstsw_paused_to_playing( GstWesterosSink *sink, gboolean *passToDefault );
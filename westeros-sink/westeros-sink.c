@@ -57,7 +57,12 @@ enum
   PROP_ENABLE_TIMECODE,
   PROP_VIDEO_PTS,
   PROP_RES_PRIORITY,
-  PROP_RES_USAGE
+  PROP_RES_USAGE,
+  #ifdef ENABLE_SW_DECODE
+  PROP_SW_THREAD_COUNT,
+  PROP_SW_THREAD_TYPE,
+  PROP_SW_STATS
+  #endif
 };
 
 #ifdef USE_GST1
@@ -1042,6 +1047,23 @@ static void gst_westeros_sink_class_init(GstWesterosSinkClass *klass)
            "current video PTS value",
            G_MININT64, G_MAXINT64, 0, G_PARAM_READABLE));
 
+   #ifdef ENABLE_SW_DECODE
+   g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_SW_THREAD_COUNT,
+       g_param_spec_int ("thread-count", "thread count",
+           "number of software decode threads, 0 for one per cpu",
+           0, 64, DEFAULT_SW_THREAD_COUNT, G_PARAM_READWRITE));
+
+   g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_SW_THREAD_TYPE,
+       g_param_spec_int ("thread-type", "thread type",
+           "software decode threading: 1: frame; 2: slice; 3: frame and slice",
+           1, 3, DEFAULT_SW_THREAD_TYPE, G_PARAM_READWRITE));
+
+   g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_SW_STATS,
+       g_param_spec_boxed ("sw-stats", "software decode statistics",
+           "decode and display statistics of the software decoder",
+           GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+   #endif
+
 #ifdef USE_GST1
   GST_DEBUG_CATEGORY_INIT (gst_westeros_sink_debug,
                            #ifdef USE_RAW_SINK
@@ -1192,6 +1214,10 @@ gst_westeros_sink_init(GstWesterosSink *sink, GstWesterosSinkClass *gclass)
    sink->swUnLink= 0;
    sink->swEvent= 0;
    sink->swDisplay= 0;
+   sink->swAllocBuffer= 0;
+   sink->swFreeBuffer= 0;
+   sink->swThreadCount= DEFAULT_SW_THREAD_COUNT;
+   sink->swThreadType= DEFAULT_SW_THREAD_TYPE;
    #endif
    sink->enableTimeCodeSignal= FALSE;
    sink->timeCodeCapacity= 0;
@@ -1394,6 +1420,20 @@ static void gst_westeros_sink_set_property(GObject *object, guint prop_id, const
          UNLOCK(sink);
          break;
       }
+
+      #ifdef ENABLE_SW_DECODE
+      case PROP_SW_THREAD_COUNT:
+         LOCK(sink);
+         sink->swThreadCount= g_value_get_int(value);
+         UNLOCK(sink);
+         break;
+
+      case PROP_SW_THREAD_TYPE:
+         LOCK(sink);
+         sink->swThreadType= g_value_get_int(value);
+         UNLOCK(sink);
+         break;
+      #endif
       
       default:
          gst_westeros_sink_soc_set_property(object, prop_id, value, pspec);
@@ -1452,6 +1492,27 @@ static void gst_westeros_sink_get_property(GObject *object, guint prop_id, GValu
             UNLOCK(sink);
          }
          break;
+      #ifdef ENABLE_SW_DECODE
+      case PROP_SW_THREAD_COUNT:
+         {
+            LOCK(sink);
+            g_value_set_int(value, sink->swThreadCount);
+            UNLOCK(sink);
+         }
+         break;
+      case PROP_SW_THREAD_TYPE:
+         {
+            LOCK(sink);
+            g_value_set_int(value, sink->swThreadType);
+            UNLOCK(sink);
+         }
+         break;
+      case PROP_SW_STATS:
+         {
+            g_value_take_boxed(value, wstsw_get_stats(sink));
+         }
+         break;
+      #endif
       default:
          gst_westeros_sink_soc_get_property(object, prop_id, value, pspec);
          break;
@@ -1814,6 +1875,9 @@ static gboolean gst_westeros_sink_event(GstPad *pad, GstEvent *event)
          sink->eosEventSeen= FALSE;
          sink->flushStarted= TRUE;
          UNLOCK( sink );
+         #ifdef ENABLE_SW_DECODE
+         wstsw_flush( sink, true );
+         #endif
          timeCodeFlush( sink );
          gst_westeros_sink_soc_flush( sink );
          passToDefault= TRUE;
@@ -1823,6 +1887,9 @@ static gboolean gst_westeros_sink_event(GstPad *pad, GstEvent *event)
          LOCK( sink );
          sink->flushStarted= FALSE;
          UNLOCK( sink );
+         #ifdef ENABLE_SW_DECODE
+         wstsw_flush( sink, false );
+         #endif
          passToDefault= TRUE;
          break;
 
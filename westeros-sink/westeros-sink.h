@@ -75,6 +75,8 @@ typedef void (*SinkSWLink)( GstWesterosSink *sink );
 typedef void (*SinkSWUnLink)( GstWesterosSink *sink );
 typedef void (*SinkSWEvent)( GstWesterosSink *sink, int id, int p1, void *p2 );
 typedef void (*SinkSWDisplay)( GstWesterosSink *sink, SWFrame *frame );
+typedef bool (*SinkSWAllocBuffer)( GstWesterosSink *sink, SWBuffer *buffer );
+typedef void (*SinkSWFreeBuffer)( GstWesterosSink *sink, int bufferId );
 #endif
 
 typedef void (*SinkTimeCodePresent)( GstWesterosSink *sink, guint64 pts, guint signnal );
@@ -196,6 +198,10 @@ struct _GstWesterosSink
    SinkSWLink swUnLink;
    SinkSWEvent swEvent;
    SinkSWDisplay swDisplay;
+   SinkSWAllocBuffer swAllocBuffer;
+   SinkSWFreeBuffer swFreeBuffer;
+   int swThreadCount;
+   int swThreadType;
    #endif
 
    ProcessPadEvent processPadEvent;